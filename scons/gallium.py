@@ -378,6 +378,9 @@ def generate(env):
         if check_functions(env, ['timespec_get']):
             cppdefines += ['HAVE_TIMESPEC_GET']
 
+        if check_functions(env, ['makecontext']):
+            cppdefines += ['HAVE_MAKECONTEXT']
+
         if check_header(env, 'sys/shm.h'):
             cppdefines += ['HAVE_SYS_SHM_H']
 
@@ -2481,6 +2481,41 @@ void radv_stop_feedback(VkPipelineCreationFeedbackEXT *feedback, bool cache_hit)
 	                   (cache_hit ? VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT : 0);
 }
 
+struct radv_compile_to_nir_state {
+	struct radv_pipeline *pipeline;
+	struct radv_device *device;
+	struct radv_shader_module **modules;
+	const VkPipelineShaderStageCreateInfo **pStages;
+	VkPipelineCreateFlags flags;
+	VkPipelineCreationFeedbackEXT **stage_feedbacks;
+	nir_shader **nir;
+	gl_shader_stage stages[MESA_SHADER_STAGES];
+};
+
+static void
+radv_compile_to_nir_job(void *data, unsigned index)
+{
+	struct radv_compile_to_nir_state *state = data;
+	gl_shader_stage i = state->stages[index];
+	const VkPipelineShaderStageCreateInfo *stage = state->pStages[i];
+
+	radv_start_feedback(state->stage_feedbacks[i]);
+
+	state->nir[i] = radv_shader_compile_to_nir(state->device, state->modules[i],
+						   stage ? stage->pName : "main", i,
+						   stage ? stage->pSpecializationInfo : NULL,
+						   state->flags, state->pipeline->layout);
+
+	/* We don't want to alter meta shaders IR directly so clone it
+	 * first.
+	 */
+	if (state->nir[i]->info.name) {
+		state->nir[i] = nir_shader_clone(NULL, state->nir[i]);
+	}
+
+	radv_stop_feedback(state->stage_feedbacks[i], false);
+}
+
 static
 void radv_create_shaders(struct radv_pipeline *pipeline,
                          struct radv_device *device,
@@ -2541,29 +2576,25 @@ void radv_create_shaders(struct radv_pipeline *pipeline,
 		modules[MESA_SHADER_FRAGMENT] = &fs_m;
 	}
 
-	for (unsigned i = 0; i < MESA_SHADER_STAGES; ++i) {
-		const VkPipelineShaderStageCreateInfo *stage = pStages[i];
-
-		if (!modules[i])
-			continue;
-
-		radv_start_feedback(stage_feedbacks[i]);
-
-		nir[i] = radv_shader_compile_to_nir(device, modules[i],
-						    stage ? stage->pName : "main", i,
-						    stage ? stage->pSpecializationInfo : NULL,
-						    flags, pipeline->layout);
-
-		/* We don't want to alter meta shaders IR directly so clone it
-		 * first.
-		 */
-		if (nir[i]->info.name) {
-			nir[i] = nir_shader_clone(NULL, nir[i]);
-		}
+	struct radv_compile_to_nir_state compile = {
+		.pipeline = pipeline,
+		.device = device,
+		.modules = modules,
+		.pStages = pStages,
+		.flags = flags,
+		.stage_feedbacks = stage_feedbacks,
+		.nir = nir,
+	};
+	unsigned num_stages = 0;
 
-		radv_stop_feedback(stage_feedbacks[i], false);
+	for (unsigned i = 0; i < MESA_SHADER_STAGES; ++i) {
+		if (modules[i])
+			compile.stages[num_stages++] = i;
 	}
 
+	/* The stages are only linked together below. */
+	nir_parallel_for(num_stages, radv_compile_to_nir_job, &compile);
+
 	if (nir[MESA_SHADER_TESS_CTRL]) {
 		nir_lower_patch_vertices(nir[MESA_SHADER_TESS_EVAL], nir[MESA_SHADER_TESS_CTRL]->info.tess.tcs_vertices_out, NULL);
 		merge_tess_info(&nir[MESA_SHADER_TESS_EVAL]->info, &nir[MESA_SHADER_TESS_CTRL]->info);
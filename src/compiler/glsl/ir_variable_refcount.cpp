@@ -37,7 +37,7 @@
 
 ir_variable_refcount_visitor::ir_variable_refcount_visitor()
 {
-   this->mem_ctx = ralloc_context(NULL);
+   this->mem_ctx = ralloc_arena_context(NULL);
    this->ht = _mesa_pointer_hash_table_create(NULL);
 }
 
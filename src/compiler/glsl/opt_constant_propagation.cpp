@@ -83,7 +83,7 @@ public:
    {
       progress = false;
       killed_all = false;
-      mem_ctx = ralloc_context(0);
+      mem_ctx = ralloc_arena_context(NULL);
       this->lin_ctx = linear_alloc_parent(this->mem_ctx, 0);
       this->acp = new(mem_ctx) exec_list;
       this->kills = _mesa_pointer_hash_table_create(mem_ctx);
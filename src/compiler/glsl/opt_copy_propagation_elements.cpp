@@ -276,7 +276,7 @@ public:
    {
       this->progress = false;
       this->killed_all = false;
-      this->mem_ctx = ralloc_context(NULL);
+      this->mem_ctx = ralloc_arena_context(NULL);
       this->lin_ctx = linear_alloc_parent(this->mem_ctx, 0);
       this->shader_mem_ctx = NULL;
       this->kills = new(mem_ctx) exec_list;
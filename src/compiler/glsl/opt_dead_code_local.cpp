@@ -314,7 +314,7 @@ dead_code_local_basic_block(ir_instruction *first,
    bool *out_progress = (bool *)data;
    bool progress = false;
 
-   void *ctx = ralloc_context(NULL);
+   void *ctx = ralloc_arena_context(NULL);
    void *lin_ctx = linear_alloc_parent(ctx, 0);
 
    /* Safe looping, since process_assignment */
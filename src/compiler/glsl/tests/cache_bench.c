@@ -0,0 +1,232 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Compares how long an application starting up takes to load its programs
+ * from the shader cache, with one file per entry and with the single-file
+ * pack (MESA_GLSL_CACHE_PACK), for each of the codecs the cache can compress
+ * entries with (MESA_GLSL_CACHE_CODEC). The time taken to write the programs
+ * to the cache in the first place is reported as well.
+ *
+ * Usage: cache_bench [num_programs]
+ *
+ * Note that the cache files are likely still in the page cache when they
+ * are read back, so this mostly measures the per-entry syscall and
+ * filesystem overhead rather than the disk itself.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ftw.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "util/disk_cache.h"
+#include "util/macros.h"
+#include "util/os_time.h"
+
+#define BENCH_TMP "./cache-bench-tmp"
+
+#ifdef ENABLE_SHADER_CACHE
+
+static int
+remove_entry(const char *path,
+             const struct stat *sb,
+             int typeflag,
+             struct FTW *ftwbuf)
+{
+   return remove(path);
+}
+
+/* Fill 'data' with something which compresses about as well as a real
+ * shader binary, i.e. somewhat.
+ */
+static void
+make_program(uint8_t *data, size_t size, unsigned seed)
+{
+   uint32_t x = seed * 2654435761u + 1;
+
+   for (size_t i = 0; i < size; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      data[i] = (x & 0x3) ? (uint8_t) i : (uint8_t) x;
+   }
+}
+
+static size_t
+program_size(unsigned i)
+{
+   return 2048 + (i * 7919) % (30 * 1024);
+}
+
+static void
+wait_until_written(struct disk_cache *cache, const cache_key key)
+{
+   struct timespec req = { 0, 1000000 };
+
+   for (unsigned retries = 0; retries < 10000; retries++) {
+      void *result = disk_cache_get(cache, key, NULL);
+      if (result) {
+         free(result);
+         return;
+      }
+      nanosleep(&req, NULL);
+   }
+}
+
+/* Returns the time in nanoseconds until all programs are written out. */
+static int64_t
+populate(unsigned num_programs, cache_key *keys, uint64_t *total_size)
+{
+   struct disk_cache *cache = disk_cache_create("bench", "cache_bench", 0);
+   uint8_t *data = malloc(program_size(0) + 32 * 1024);
+   int64_t time = 0;
+
+   *total_size = 0;
+
+   for (unsigned i = 0; i < num_programs; i++) {
+      size_t size = program_size(i);
+
+      make_program(data, size, i);
+      disk_cache_compute_key(cache, data, size, keys[i]);
+
+      int64_t start = os_time_get_nano();
+      disk_cache_put(cache, keys[i], data, size, NULL);
+      time += os_time_get_nano() - start;
+
+      *total_size += size;
+   }
+
+   int64_t start = os_time_get_nano();
+   wait_until_written(cache, keys[num_programs - 1]);
+   time += os_time_get_nano() - start;
+
+   free(data);
+   disk_cache_destroy(cache);
+
+   return time;
+}
+
+/* Returns the time in nanoseconds to open the cache and load every program,
+ * or 0 if some program couldn't be found.
+ */
+static int64_t
+load(unsigned num_programs, cache_key *keys)
+{
+   int64_t start = os_time_get_nano();
+   bool complete = true;
+
+   struct disk_cache *cache = disk_cache_create("bench", "cache_bench", 0);
+
+   for (unsigned i = 0; i < num_programs; i++) {
+      void *data = disk_cache_get(cache, keys[i], NULL);
+
+      if (!data)
+         complete = false;
+      free(data);
+   }
+
+   disk_cache_destroy(cache);
+
+   int64_t end = os_time_get_nano();
+
+   return complete ? end - start : 0;
+}
+
+static bool
+run(const char *layout, const char *codec, unsigned num_programs)
+{
+   cache_key *keys = malloc(num_programs * sizeof(cache_key));
+   int64_t best = INT64_MAX;
+   uint64_t total_size;
+
+   nftw(BENCH_TMP, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+   mkdir(BENCH_TMP, 0755);
+
+   setenv("MESA_GLSL_CACHE_DIR", BENCH_TMP, 1);
+   setenv("MESA_GLSL_CACHE_CODEC", codec, 1);
+   if (strcmp(layout, "pack") == 0)
+      setenv("MESA_GLSL_CACHE_PACK", "true", 1);
+   else
+      unsetenv("MESA_GLSL_CACHE_PACK");
+
+   int64_t write_time = populate(num_programs, keys, &total_size);
+
+   for (unsigned i = 0; i < 5; i++) {
+      int64_t t = load(num_programs, keys);
+
+      if (t == 0) {
+         fprintf(stderr, "%s/%s: some programs are missing from the cache\n",
+                 layout, codec);
+         free(keys);
+         return false;
+      }
+
+      if (t < best)
+         best = t;
+   }
+
+   printf("%-6s %-10s write %8.1f MB/s, load %8.3f ms (%7.2f us per program)\n",
+          layout, codec, total_size * 1000.0 / write_time,
+          best / 1000000.0, best / 1000.0 / num_programs);
+
+   free(keys);
+   return true;
+}
+
+#endif /* ENABLE_SHADER_CACHE */
+
+int
+main(int argc, char **argv)
+{
+#ifdef ENABLE_SHADER_CACHE
+   static const char *layouts[] = { "files", "pack" };
+   static const char *codecs[] = {
+      "zlib",
+      "zlib-fast",
+#ifdef HAVE_ZSTD
+      "zstd",
+#endif
+   };
+   unsigned num_programs = argc > 1 ? atoi(argv[1]) : 2000;
+   bool ok = true;
+
+   if (num_programs == 0)
+      return 1;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(layouts); i++) {
+      for (unsigned j = 0; j < ARRAY_SIZE(codecs); j++)
+         ok &= run(layouts[i], codecs[j], num_programs);
+   }
+
+   nftw(BENCH_TMP, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+
+   return ok ? 0 : 1;
+#else
+   return 0;
+#endif /* ENABLE_SHADER_CACHE */
+}
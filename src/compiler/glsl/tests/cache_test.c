@@ -35,8 +35,10 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "util/macros.h"
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
+#include "util/disk_cache_pack.h"
 
 bool error = false;
 
@@ -493,6 +495,302 @@ test_put_key_and_get_key(void)
 
    disk_cache_destroy(cache);
 }
+
+/* Overwrite the size of the index slot holding key, like a truncated
+ * or otherwise damaged pack would leave it.
+ */
+static bool
+corrupt_pack_slot_size(const char *index_path, const uint8_t *key,
+                       uint32_t size)
+{
+   FILE *f = fopen(index_path, "r+b");
+   uint8_t *index;
+   long index_size;
+   bool found = false;
+
+   if (f == NULL)
+      return false;
+
+   fseek(f, 0, SEEK_END);
+   index_size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+   index = malloc(index_size);
+
+   if (index && fread(index, 1, index_size, f) == (size_t) index_size) {
+      uint8_t *slot = memmem(index, index_size, key, CACHE_KEY_SIZE);
+
+      if (slot) {
+         fseek(f, slot + CACHE_KEY_SIZE - index, SEEK_SET);
+         found = fwrite(&size, sizeof(size), 1, f) == 1;
+      }
+   }
+
+   free(index);
+   fclose(f);
+   return found;
+}
+
+static void
+test_pack(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char string[] = "While this string has thirty-four";
+   uint8_t string_key[20];
+   uint8_t *one_MB;
+   uint8_t one_MB_key[20];
+   char *result;
+   size_t size;
+   struct stat sb;
+   int count;
+
+   setenv("MESA_GLSL_CACHE_PACK", "true", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   expect_equal(stat(CACHE_TEST_TMP "/mesa-glsl-cache-dir/" CACHE_DIR_NAME
+                     "/pack", &sb), 0, "pack file created");
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_compute_key(cache, string, sizeof(string), string_key);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_null(result, "pack: disk_cache_get with non-existent item (pointer)");
+   expect_equal(size, 0, "pack: disk_cache_get with non-existent item (size)");
+
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+
+   /* disk_cache_put() hands things off to a thread give it some time to
+    * finish.
+    */
+   wait_until_file_written(cache, blob_key);
+   wait_until_file_written(cache, string_key);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "pack: disk_cache_get of existing item (pointer)");
+   expect_equal(size, sizeof(blob), "pack: disk_cache_get of existing item (size)");
+   free(result);
+
+   result = disk_cache_get(cache, string_key, &size);
+   expect_equal_str(string, result, "pack: 2nd disk_cache_get of existing item (pointer)");
+   expect_equal(size, sizeof(string), "pack: 2nd disk_cache_get of existing item (size)");
+   free(result);
+
+   /* Entries must survive the cache being closed and opened again. */
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   count = 0;
+   if (does_cache_contain(cache, blob_key))
+      count++;
+
+   if (does_cache_contain(cache, string_key))
+      count++;
+
+   expect_equal(count, 2, "pack: items available after reopening the cache");
+
+   disk_cache_remove(cache, blob_key);
+   expect_true(!does_cache_contain(cache, blob_key),
+               "pack: disk_cache_remove removes the item");
+
+   /* Add an incompressible item larger than the whole cache, which has to
+    * force a compaction evicting everything else.
+    */
+   one_MB = malloc(1024 * 1024);
+   uint32_t x = 0x12345678;
+   for (unsigned i = 0; i < 1024 * 1024; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      one_MB[i] = x;
+   }
+
+   disk_cache_compute_key(cache, one_MB, 1024 * 1024, one_MB_key);
+   disk_cache_put(cache, one_MB_key, one_MB, 1024 * 1024, NULL);
+
+   free(one_MB);
+
+   /* disk_cache_put() hands things off to a thread give it some time to
+    * finish.
+    */
+   wait_until_file_written(cache, one_MB_key);
+
+   bool contains_1MB_file = false;
+   count = 0;
+   if (does_cache_contain(cache, blob_key))
+      count++;
+
+   if (does_cache_contain(cache, string_key))
+      count++;
+
+   if (does_cache_contain(cache, one_MB_key)) {
+      count++;
+      contains_1MB_file = true;
+   }
+
+   expect_true(contains_1MB_file, "pack: compaction keeps the newest item");
+   expect_equal(count, 1, "pack: compaction after overflow with MAX_SIZE=1M");
+
+   /* A slot claiming more data than the pack holds must be a miss. */
+   expect_true(corrupt_pack_slot_size(CACHE_TEST_TMP "/mesa-glsl-cache-dir/"
+                                      CACHE_DIR_NAME "/"
+                                      DISK_CACHE_PACK_INDEX_NAME,
+                                      one_MB_key, 0xfffffff0),
+               "pack: corrupting the index");
+   result = disk_cache_get(cache, one_MB_key, &size);
+   expect_null(result, "pack: disk_cache_get through a corrupt slot");
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_PACK");
+}
+
+static void
+test_codecs(void)
+{
+   static const char *codecs[] = {
+      "zlib",
+      "zlib-fast",
+#ifdef HAVE_ZSTD
+      "zstd",
+#endif
+   };
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t keys[ARRAY_SIZE(codecs)][20];
+   uint8_t big_keys[ARRAY_SIZE(codecs)][20];
+   uint8_t *big;
+   size_t big_size = 256 * 1024;
+   char *result;
+   size_t size;
+
+   /* Something more like a real entry: repetitive, but not trivially so,
+    * and large enough for the codecs to use several blocks.
+    */
+   big = malloc(big_size);
+   uint32_t x = 0x12345678;
+   for (unsigned i = 0; i < big_size; i++) {
+      x ^= x << 13;
+      x ^= x >> 17;
+      x ^= x << 5;
+      big[i] = (i / 64) ^ ((x & 0xff) == 0);
+   }
+
+   /* Write two items with each codec. */
+   for (unsigned i = 0; i < ARRAY_SIZE(codecs); i++) {
+      setenv("MESA_GLSL_CACHE_CODEC", codecs[i], 1);
+      cache = disk_cache_create("test", "make_check", 0);
+
+      disk_cache_compute_key(cache, codecs[i], strlen(codecs[i]), keys[i]);
+      disk_cache_put(cache, keys[i], blob, sizeof(blob), NULL);
+
+      big[0] = i;
+      disk_cache_compute_key(cache, big, big_size, big_keys[i]);
+      disk_cache_put(cache, big_keys[i], big, big_size, NULL);
+
+      /* disk_cache_put() hands things off to a thread give it some time to
+       * finish.
+       */
+      wait_until_file_written(cache, keys[i]);
+      wait_until_file_written(cache, big_keys[i]);
+      disk_cache_destroy(cache);
+   }
+
+   /* Whatever codec is used for writing, all of them must be readable. */
+   unsetenv("MESA_GLSL_CACHE_CODEC");
+   cache = disk_cache_create("test", "make_check", 0);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(codecs); i++) {
+      result = disk_cache_get(cache, keys[i], &size);
+      expect_equal_str(blob, result,
+                       "disk_cache_get of item written with any codec (pointer)");
+      expect_equal(size, sizeof(blob),
+                   "disk_cache_get of item written with any codec (size)");
+      free(result);
+
+      big[0] = i;
+      result = disk_cache_get(cache, big_keys[i], &size);
+      expect_true(result && size == big_size &&
+                  memcmp(result, big, big_size) == 0,
+                  "disk_cache_get of large item written with any codec");
+      free(result);
+   }
+
+   disk_cache_destroy(cache);
+   free(big);
+}
+
+static void
+test_read_only_layers(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   char string[] = "While this string has thirty-four";
+   uint8_t string_key[20];
+   uint8_t key_a[20] = {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,
+                         10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+   char *result;
+   size_t size;
+
+   /* Prepare one cache with one file per entry and one with a pack. */
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/layer-files", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_put_key(cache, key_a);
+
+   /* disk_cache_put() hands things off to a thread give it some time to
+    * finish.
+    */
+   wait_until_file_written(cache, blob_key);
+   disk_cache_destroy(cache);
+
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/layer-pack", 1);
+   setenv("MESA_GLSL_CACHE_PACK", "true", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   disk_cache_compute_key(cache, string, sizeof(string), string_key);
+   disk_cache_put(cache, string_key, string, sizeof(string), NULL);
+
+   wait_until_file_written(cache, string_key);
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_PACK");
+
+   /* Both must be found through an empty writable cache. */
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/layer-writable", 1);
+   setenv("MESA_GLSL_CACHE_READ_ONLY_DIRS",
+          CACHE_TEST_TMP "/layer-files:" CACHE_TEST_TMP "/non-existent:"
+          CACHE_TEST_TMP "/layer-pack", 1);
+   cache = disk_cache_create("test", "make_check", 0);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "disk_cache_get from a read-only layer (pointer)");
+   expect_equal(size, sizeof(blob), "disk_cache_get from a read-only layer (size)");
+   free(result);
+
+   result = disk_cache_get(cache, string_key, &size);
+   expect_equal_str(string, result, "disk_cache_get from a read-only pack layer (pointer)");
+   expect_equal(size, sizeof(string), "disk_cache_get from a read-only pack layer (size)");
+   free(result);
+
+   expect_true(disk_cache_has_key(cache, key_a),
+               "disk_cache_has_key finds a key of a read-only layer");
+
+   /* Removing an item only affects the writable cache. */
+   disk_cache_remove(cache, blob_key);
+   expect_true(does_cache_contain(cache, blob_key),
+               "disk_cache_remove leaves read-only layers alone");
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_GLSL_CACHE_READ_ONLY_DIRS");
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_TEST_TMP "/mesa-glsl-cache-dir", 1);
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 int
@@ -507,6 +805,12 @@ main(void)
 
    test_put_key_and_get_key();
 
+   test_pack();
+
+   test_codecs();
+
+   test_read_only_layers();
+
    err = rmrf_local(CACHE_TEST_TMP);
    expect_equal(err, 0, "Removing " CACHE_TEST_TMP " again");
 #endif /* ENABLE_SHADER_CACHE */
@@ -4022,6 +4022,9 @@ void nir_strip(nir_shader *shader);
 
 void nir_sweep(nir_shader *shader);
 
+typedef void (*nir_parallel_func)(void *data, unsigned index);
+void nir_parallel_for(unsigned count, nir_parallel_func func, void *data);
+
 void nir_remap_dual_slot_attributes(nir_shader *shader,
                                     uint64_t *dual_slot_inputs);
 uint64_t nir_get_single_slot_attribs_mask(uint64_t attribs, uint64_t dual_slot);
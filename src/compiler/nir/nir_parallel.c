@@ -0,0 +1,137 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nir.h"
+#include "c11/threads.h"
+#include "util/debug.h"
+#include "util/u_atomic.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+
+/**
+ * \file nir_parallel.c
+ *
+ * Runs independent work on several shaders, typically the stages of a
+ * program or pipeline, on the shared thread pool.
+ */
+
+struct parallel_job {
+   nir_parallel_func func;
+   void *data;
+   unsigned index;
+
+   /* Set by whichever of the pool and the calling thread runs the job. */
+   int claimed;
+
+   struct util_queue_fence fence;
+};
+
+static struct util_queue parallel_queue;
+static once_flag parallel_queue_once = ONCE_FLAG_INIT;
+
+static void
+parallel_queue_init(void)
+{
+   util_cpu_detect();
+
+   if (util_cpu_caps.nr_cpus <= 1 ||
+       !env_var_as_boolean("NIR_PARALLEL", true))
+      return;
+
+   /* Someone waits for these jobs, so they go before background work. */
+   util_queue_init(&parallel_queue, "nir", MESA_SHADER_STAGES * 4,
+                   MIN2(util_cpu_caps.nr_cpus, MESA_SHADER_STAGES),
+                   UTIL_QUEUE_INIT_SHARED_POOL |
+                   UTIL_QUEUE_INIT_HIGH_PRIORITY |
+                   UTIL_QUEUE_INIT_RESIZE_IF_FULL);
+}
+
+static bool
+claim_job(struct parallel_job *job)
+{
+   return p_atomic_cmpxchg(&job->claimed, 0, 1) == 0;
+}
+
+static void
+parallel_job_execute(void *data, UNUSED int thread_index)
+{
+   struct parallel_job *job = data;
+
+   if (claim_job(job))
+      job->func(job->data, job->index);
+}
+
+/**
+ * Calls func(data, i) for every i below count, concurrently.
+ *
+ * The calls must be independent: each one should only modify its own
+ * shader, which has its own ralloc context, and the rest of the state it
+ * reads must not be modified until this returns.  glsl_type is safe to use
+ * from several threads.
+ *
+ * The calling thread runs the calls that no pool thread picked up yet, so
+ * this doesn't deadlock when called from a job of another queue, and runs
+ * everything serially if there is a single CPU or NIR_PARALLEL=false.
+ */
+void
+nir_parallel_for(unsigned count, nir_parallel_func func, void *data)
+{
+   call_once(&parallel_queue_once, parallel_queue_init);
+
+   if (count <= 1 || !util_queue_is_initialized(&parallel_queue)) {
+      for (unsigned i = 0; i < count; i++)
+         func(data, i);
+      return;
+   }
+
+   struct parallel_job *jobs = calloc(count, sizeof(*jobs));
+   if (jobs == NULL) {
+      for (unsigned i = 0; i < count; i++)
+         func(data, i);
+      return;
+   }
+
+   /* The first one is for the calling thread anyway. */
+   for (unsigned i = 1; i < count; i++) {
+      jobs[i].func = func;
+      jobs[i].data = data;
+      jobs[i].index = i;
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(&parallel_queue, &jobs[i], &jobs[i].fence,
+                         parallel_job_execute, NULL);
+   }
+
+   func(data, 0);
+
+   for (unsigned i = 1; i < count; i++) {
+      if (claim_job(&jobs[i]))
+         func(data, i);
+   }
+
+   for (unsigned i = 1; i < count; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+
+   free(jobs);
+}
@@ -39,6 +39,13 @@ struct match_state {
    uint8_t comm_op_direction;
    unsigned variables_seen;
    nir_alu_src variables[NIR_SEARCH_MAX_VARIABLES];
+
+   struct hash_table *range_ht;
+
+   /* Automaton state of every SSA value, updated as values are created */
+   struct util_dynarray *states;
+   const struct per_op_table *pass_op_table;
+   nir_instr_worklist *algebraic_worklist;
 };
 
 static bool
@@ -46,6 +53,12 @@ match_expression(const nir_search_expression *expr, nir_alu_instr *instr,
                  unsigned num_components, const uint8_t *swizzle,
                  struct match_state *state);
 
+static void
+nir_algebraic_update_automaton(nir_instr *new_instr,
+                               nir_instr_worklist *algebraic_worklist,
+                               struct util_dynarray *states,
+                               const struct per_op_table *pass_op_table);
+
 static const uint8_t identity_swizzle[NIR_MAX_VEC_COMPONENTS] = { 0, 1, 2, 3 };
 
 /**
@@ -297,7 +310,8 @@ match_value(const nir_search_value *value, nir_alu_instr *instr, unsigned src,
              instr->src[src].src.ssa->parent_instr->type != nir_instr_type_load_const)
             return false;
 
-         if (var->cond && !var->cond(instr, src, num_components, new_swizzle))
+         if (var->cond && !var->cond(state->range_ht, instr,
+                                     src, num_components, new_swizzle))
             return false;
 
          if (var->type != nir_type_invalid &&
@@ -488,6 +502,9 @@ construct_value(nir_builder *build,
 
       nir_builder_instr_insert(build, &alu->instr);
 
+      nir_algebraic_update_automaton(&alu->instr, state->algebraic_worklist,
+                                     state->states, state->pass_op_table);
+
       nir_alu_src val;
       val.src = nir_src_for_ssa(&alu->dest.dest.ssa);
       val.negate = false;
@@ -535,6 +552,10 @@ construct_value(nir_builder *build,
          unreachable("Invalid alu source type");
       }
 
+      nir_algebraic_update_automaton(cval->parent_instr,
+                                     state->algebraic_worklist,
+                                     state->states, state->pass_op_table);
+
       nir_alu_src val;
       val.src = nir_src_for_ssa(cval);
       val.negate = false;
@@ -619,10 +640,131 @@ UNUSED static void dump_value(const nir_search_value *val)
       printf("@%d", val->bit_size);
 }
 
+static uint16_t *
+automaton_state(struct util_dynarray *states, unsigned index)
+{
+   unsigned num_states = util_dynarray_num_elements(states, uint16_t);
+
+   /* Values created by the pass get new indices, which start in state 0. */
+   if (index >= num_states) {
+      uint16_t *new_states =
+         util_dynarray_grow(states, uint16_t, index + 1 - num_states);
+      memset(new_states, 0, (index + 1 - num_states) * sizeof(uint16_t));
+   }
+
+   return util_dynarray_element(states, uint16_t, index);
+}
+
+/* Computes the automaton state of an instruction from the states of its
+ * sources, and returns whether it changed.
+ */
+static bool
+nir_algebraic_automaton(nir_instr *instr, struct util_dynarray *states,
+                        const struct per_op_table *pass_op_table)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu: {
+      nir_alu_instr *alu = nir_instr_as_alu(instr);
+      nir_op op = alu->op;
+      uint16_t search_op = nir_search_op_for_nir_op(op);
+      const struct per_op_table *tbl = &pass_op_table[search_op];
+      if (tbl->num_filtered_states == 0 || !alu->dest.dest.is_ssa)
+         return false;
+
+      /* Calculate the index into the transition table. Note the index
+       * calculated must match the iteration order of Python's
+       * itertools.product(), which was used to emit the transition
+       * table.
+       */
+      unsigned index = 0;
+      for (unsigned i = 0; i < nir_op_infos[op].num_inputs; i++) {
+         index *= tbl->num_filtered_states;
+         index += tbl->filter[*automaton_state(states,
+                                               alu->src[i].src.ssa->index)];
+      }
+
+      uint16_t *state = automaton_state(states, alu->dest.dest.ssa.index);
+      if (*state != tbl->table[index]) {
+         *state = tbl->table[index];
+         return true;
+      }
+      return false;
+   }
+
+   case nir_instr_type_load_const: {
+      nir_load_const_instr *load_const = nir_instr_as_load_const(instr);
+      uint16_t *state = automaton_state(states, load_const->def.index);
+      if (*state != NIR_SEARCH_CONST_STATE) {
+         *state = NIR_SEARCH_CONST_STATE;
+         return true;
+      }
+      return false;
+   }
+
+   default:
+      return false;
+   }
+}
+
+/* Updates the automaton state of an instruction created or rewritten by the
+ * pass, and of its uses as long as their states change, and queues the
+ * instructions whose state changed to be matched again.
+ */
+static void
+nir_algebraic_update_automaton(nir_instr *new_instr,
+                               nir_instr_worklist *algebraic_worklist,
+                               struct util_dynarray *states,
+                               const struct per_op_table *pass_op_table)
+{
+   nir_instr_worklist *automaton_worklist = nir_instr_worklist_create();
+
+   nir_instr_worklist_push_tail(automaton_worklist, new_instr);
+
+   nir_foreach_instr_in_worklist(instr, automaton_worklist) {
+      if (!nir_algebraic_automaton(instr, states, pass_op_table))
+         continue;
+
+      /* Constants have no transforms, and their state never depends on
+       * anything, so only ALU instructions get here more than once.
+       */
+      if (instr->type != nir_instr_type_alu)
+         continue;
+
+      nir_instr_worklist_push_tail(algebraic_worklist, instr);
+
+      nir_foreach_use(use, &nir_instr_as_alu(instr)->dest.dest.ssa)
+         nir_instr_worklist_push_tail(automaton_worklist, use->parent_instr);
+   }
+
+   nir_instr_worklist_destroy(automaton_worklist);
+}
+
+/* Whether the value is the whole SSA value, which can then replace the
+ * instruction without a mov.
+ */
+static bool
+is_plain_ssa_value(const nir_alu_src *val, unsigned num_components)
+{
+   if (!val->src.is_ssa || val->negate || val->abs ||
+       val->src.ssa->num_components != num_components)
+      return false;
+
+   for (unsigned i = 0; i < num_components; i++) {
+      if (val->swizzle[i] != i)
+         return false;
+   }
+
+   return true;
+}
+
 nir_ssa_def *
 nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
+                  struct hash_table *range_ht,
+                  struct util_dynarray *states,
+                  const struct per_op_table *pass_op_table,
                   const nir_search_expression *search,
-                  const nir_search_value *replace)
+                  const nir_search_value *replace,
+                  nir_instr_worklist *algebraic_worklist)
 {
    uint8_t swizzle[NIR_MAX_VEC_COMPONENTS] = { 0 };
 
@@ -634,6 +776,10 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
    struct match_state state;
    state.inexact_match = false;
    state.has_exact_alu = false;
+   state.range_ht = range_ht;
+   state.states = states;
+   state.pass_op_table = pass_op_table;
+   state.algebraic_worklist = algebraic_worklist;
 
    STATIC_ASSERT(sizeof(state.comm_op_direction) * 8 >= NIR_SEARCH_MAX_COMM_OPS);
 
@@ -675,12 +821,28 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
 
    /* Inserting a mov may be unnecessary.  However, it's much easier to
     * simply let copy propagation clean this up than to try to go through
-    * and rewrite swizzles ourselves.
+    * and rewrite swizzles ourselves.  The common case of a whole value is
+    * easy though, and lets the uses be matched again in this pass.
     */
-   nir_ssa_def *ssa_val =
-      nir_mov_alu(build, val, instr->dest.dest.ssa.num_components);
+   nir_ssa_def *ssa_val;
+   if (is_plain_ssa_value(&val, instr->dest.dest.ssa.num_components)) {
+      ssa_val = val.src.ssa;
+   } else {
+      ssa_val = nir_mov_alu(build, val, instr->dest.dest.ssa.num_components);
+      nir_algebraic_update_automaton(ssa_val->parent_instr, algebraic_worklist,
+                                     states, pass_op_table);
+   }
+
    nir_ssa_def_rewrite_uses(&instr->dest.dest.ssa, nir_src_for_ssa(ssa_val));
 
+   /* The uses now see a different value, which may let them match other
+    * transforms.
+    */
+   nir_foreach_use_safe(use_src, ssa_val) {
+      nir_algebraic_update_automaton(use_src->parent_instr, algebraic_worklist,
+                                     states, pass_op_table);
+   }
+
    /* We know this one has no more uses because we just rewrote them all,
     * so we can remove it.  The rest of the matched expression, however, we
     * don't know so much about.  We'll just let dead code clean them up.
@@ -689,3 +851,112 @@ nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
 
    return ssa_val;
 }
+
+static bool
+nir_algebraic_instr(nir_builder *build, nir_instr *instr,
+                    struct hash_table *range_ht,
+                    struct util_dynarray *states,
+                    const bool *condition_flags,
+                    const struct transform **transforms,
+                    const uint16_t *transform_counts,
+                    const struct per_op_table *pass_op_table,
+                    nir_instr_worklist *worklist)
+{
+   if (instr->type != nir_instr_type_alu)
+      return false;
+
+   nir_alu_instr *alu = nir_instr_as_alu(instr);
+   if (!alu->dest.dest.is_ssa)
+      return false;
+
+   uint16_t state = *automaton_state(states, alu->dest.dest.ssa.index);
+
+   for (unsigned i = 0; i < transform_counts[state]; i++) {
+      const struct transform *xform = &transforms[state][i];
+      if (condition_flags[xform->condition_offset] &&
+          nir_replace_instr(build, alu, range_ht, states, pass_op_table,
+                            xform->search, xform->replace, worklist))
+         return true;
+   }
+
+   return false;
+}
+
+/**
+ * Runs the transforms of an algebraic pass generated by nir_algebraic.py.
+ *
+ * The tree automaton gives every ALU instruction a state, from which all
+ * the transforms that may match it are known without trying the others.
+ * Instructions are matched from the bottom up, and the ones created by a
+ * transform, or whose sources were replaced, are queued to be matched again
+ * so that chains of transforms are applied in a single run.
+ */
+bool
+nir_algebraic_impl(nir_function_impl *impl,
+                   const bool *condition_flags,
+                   const struct transform **transforms,
+                   const uint16_t *transform_counts,
+                   const struct per_op_table *pass_op_table)
+{
+   bool progress = false;
+
+   nir_builder build;
+   nir_builder_init(&build, impl);
+
+   /* Note: it's important here that we're allocating a zeroed array, since
+    * state 0 is the default state, which means we don't have to visit
+    * anything other than constants and ALU instructions.
+    */
+   struct util_dynarray states;
+   util_dynarray_init(&states, NULL);
+   if (impl->ssa_alloc > 0)
+      automaton_state(&states, impl->ssa_alloc - 1);
+
+   /* Transforms don't change the values of the instructions they replace,
+    * so the ranges computed for the conditions stay valid for the whole pass.
+    */
+   struct hash_table *range_ht = _mesa_pointer_hash_table_create(NULL);
+
+   nir_instr_worklist *worklist = nir_instr_worklist_create();
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block)
+         nir_algebraic_automaton(instr, &states, pass_op_table);
+   }
+
+   /* Match the last instructions first, so that the largest patterns are
+    * tried before their sources are rewritten.
+    */
+   nir_foreach_block_reverse(block, impl) {
+      nir_foreach_instr_reverse(instr, block) {
+         if (instr->type == nir_instr_type_alu)
+            nir_instr_worklist_push_tail(worklist, instr);
+      }
+   }
+
+   nir_foreach_instr_in_worklist(instr, worklist) {
+      /* Instructions can be queued again after they were replaced. */
+      if (instr->node.next == NULL)
+         continue;
+
+      progress |= nir_algebraic_instr(&build, instr, range_ht, &states,
+                                      condition_flags, transforms,
+                                      transform_counts, pass_op_table,
+                                      worklist);
+   }
+
+   nir_instr_worklist_destroy(worklist);
+   _mesa_hash_table_destroy(range_ht, NULL);
+   util_dynarray_fini(&states);
+
+   if (progress) {
+      nir_metadata_preserve(impl, nir_metadata_block_index |
+                                  nir_metadata_dominance);
+   } else {
+#ifndef NDEBUG
+      impl->valid_metadata &= ~nir_metadata_not_properly_reset;
+#endif
+   }
+
+   return progress;
+}
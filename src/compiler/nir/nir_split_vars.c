@@ -294,7 +294,7 @@ split_struct_derefs_impl(nir_function_impl *impl,
 bool
 nir_split_struct_vars(nir_shader *shader, nir_variable_mode modes)
 {
-   void *mem_ctx = ralloc_context(NULL);
+   void *mem_ctx = ralloc_arena_context(NULL);
    struct hash_table *var_field_map =
       _mesa_pointer_hash_table_create(mem_ctx);
    struct set *complex_vars = NULL;
@@ -847,7 +847,7 @@ split_array_access_impl(nir_function_impl *impl,
 bool
 nir_split_array_vars(nir_shader *shader, nir_variable_mode modes)
 {
-   void *mem_ctx = ralloc_context(NULL);
+   void *mem_ctx = ralloc_arena_context(NULL);
    struct hash_table *var_info_map = _mesa_pointer_hash_table_create(mem_ctx);
    struct set *complex_vars = NULL;
 
@@ -1610,7 +1610,7 @@ nir_shrink_vec_array_vars(nir_shader *shader, nir_variable_mode modes)
 {
    assert((modes & (nir_var_shader_temp | nir_var_function_temp)) == modes);
 
-   void *mem_ctx = ralloc_context(NULL);
+   void *mem_ctx = ralloc_arena_context(NULL);
 
    struct hash_table *var_usage_map =
       _mesa_pointer_hash_table_create(mem_ctx);
@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include "nir.h"
+#include "nir_builder.h"
+
+class algebraic_test : public ::testing::Test {
+protected:
+   algebraic_test()
+   {
+      glsl_type_singleton_init_or_ref();
+
+      options = { };
+      options.lower_sub = true;
+      nir_builder_init_simple_shader(&bld, NULL, MESA_SHADER_COMPUTE, &options);
+
+      out = nir_variable_create(bld.shader, nir_var_shader_out,
+                                glsl_float_type(), "out");
+      x = nir_u2f32(&bld, nir_load_local_invocation_index(&bld));
+      y = nir_fsqrt(&bld, x);
+   }
+
+   ~algebraic_test()
+   {
+      ralloc_free(bld.shader);
+      glsl_type_singleton_decref();
+   }
+
+   /* Returns the value stored to out. */
+   nir_ssa_def *stored_value()
+   {
+      nir_intrinsic_instr *store =
+         nir_instr_as_intrinsic(nir_block_last_instr(nir_start_block(bld.impl)));
+
+      EXPECT_EQ(store->intrinsic, nir_intrinsic_store_deref);
+      return store->src[1].ssa;
+   }
+
+   nir_shader_compiler_options options;
+   nir_builder bld;
+
+   nir_variable *out;
+   nir_ssa_def *x;
+   nir_ssa_def *y;
+};
+
+TEST_F(algebraic_test, chain_in_one_run)
+{
+   /* The uses of a replaced value are matched again, so this is all folded
+    * away at once instead of one level per run.
+    */
+   nir_ssa_def *v = nir_fmul(&bld, x, nir_imm_float(&bld, 1.0));
+   v = nir_fadd(&bld, v, nir_imm_float(&bld, 0.0));
+   v = nir_fneg(&bld, nir_fneg(&bld, v));
+   nir_store_var(&bld, out, v, 1);
+
+   ASSERT_TRUE(nir_opt_algebraic(bld.shader));
+   nir_validate_shader(bld.shader, NULL);
+
+   EXPECT_EQ(stored_value(), x);
+   EXPECT_FALSE(nir_opt_algebraic(bld.shader));
+}
+
+TEST_F(algebraic_test, replacement_matched_again)
+{
+   /* fsub is lowered to an fadd of an fneg, and that fneg of an fneg is
+    * created by the transform itself.
+    */
+   nir_ssa_def *v = nir_fsub(&bld, x, nir_fneg(&bld, y));
+   nir_store_var(&bld, out, v, 1);
+
+   ASSERT_TRUE(nir_opt_algebraic(bld.shader));
+   nir_validate_shader(bld.shader, NULL);
+
+   nir_alu_instr *alu = nir_instr_as_alu(stored_value()->parent_instr);
+   EXPECT_EQ(alu->op, nir_op_fadd);
+   EXPECT_EQ(alu->src[0].src.ssa, x);
+   EXPECT_EQ(alu->src[1].src.ssa, y);
+   EXPECT_FALSE(nir_opt_algebraic(bld.shader));
+}
+
+TEST_F(algebraic_test, swizzled_replacement)
+{
+   /* The replacement is a single channel of a vector, which still needs a
+    * mov.
+    */
+   nir_ssa_def *vec = nir_vec2(&bld, x, y);
+   nir_ssa_def *one = nir_imm_float(&bld, 1.0);
+
+   nir_alu_instr *mul = nir_alu_instr_create(bld.shader, nir_op_fmul);
+   mul->src[0].src = nir_src_for_ssa(vec);
+   mul->src[0].swizzle[0] = 1;
+   mul->src[1].src = nir_src_for_ssa(one);
+   nir_ssa_dest_init(&mul->instr, &mul->dest.dest, 1, 32, NULL);
+   mul->dest.write_mask = 0x1;
+   nir_builder_instr_insert(&bld, &mul->instr);
+
+   nir_store_var(&bld, out, &mul->dest.dest.ssa, 1);
+
+   ASSERT_TRUE(nir_opt_algebraic(bld.shader));
+   nir_validate_shader(bld.shader, NULL);
+
+   nir_alu_instr *mov = nir_instr_as_alu(stored_value()->parent_instr);
+   EXPECT_EQ(mov->op, nir_op_mov);
+   EXPECT_EQ(mov->src[0].src.ssa, vec);
+   EXPECT_EQ(mov->src[0].swizzle[0], 1);
+}
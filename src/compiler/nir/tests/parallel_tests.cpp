@@ -0,0 +1,116 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include "nir.h"
+#include "nir_builder.h"
+#include "util/u_atomic.h"
+
+#define NUM_SHADERS 16
+
+class parallel_test : public ::testing::Test {
+protected:
+   parallel_test()
+   {
+      glsl_type_singleton_init_or_ref();
+
+      options = { };
+      for (unsigned i = 0; i < NUM_SHADERS; i++) {
+         nir_builder_init_simple_shader(&bld[i], NULL, MESA_SHADER_COMPUTE,
+                                        &options);
+      }
+   }
+
+   ~parallel_test()
+   {
+      for (unsigned i = 0; i < NUM_SHADERS; i++)
+         ralloc_free(bld[i].shader);
+      glsl_type_singleton_decref();
+   }
+
+public:
+   nir_shader_compiler_options options;
+   nir_builder bld[NUM_SHADERS];
+   unsigned calls[NUM_SHADERS];
+   bool progress[NUM_SHADERS];
+};
+
+static void
+count_call(void *data, unsigned index)
+{
+   unsigned *calls = (unsigned *) data;
+   p_atomic_inc(&calls[index]);
+}
+
+TEST_F(parallel_test, every_index_once)
+{
+   for (unsigned count = 0; count <= NUM_SHADERS; count++) {
+      memset(calls, 0, sizeof(calls));
+      nir_parallel_for(count, count_call, calls);
+
+      for (unsigned i = 0; i < NUM_SHADERS; i++)
+         EXPECT_EQ(calls[i], i < count ? 1u : 0u);
+   }
+}
+
+static void
+optimize_shader(void *data, unsigned index)
+{
+   parallel_test *test = (parallel_test *) data;
+   nir_shader *shader = test->bld[index].shader;
+   bool progress = false;
+
+   NIR_PASS(progress, shader, nir_opt_algebraic);
+   NIR_PASS(progress, shader, nir_opt_constant_folding);
+   NIR_PASS(progress, shader, nir_opt_dce);
+
+   test->progress[index] = progress;
+}
+
+TEST_F(parallel_test, optimize_shaders)
+{
+   /* Every shader gets its own types and instructions to clean up. */
+   for (unsigned i = 0; i < NUM_SHADERS; i++) {
+      nir_builder *b = &bld[i];
+      const struct glsl_type *type =
+         glsl_array_type(glsl_vec4_type(), i + 1, 0);
+      nir_variable *out =
+         nir_variable_create(b->shader, nir_var_shader_out, type, "out");
+
+      nir_ssa_def *x = nir_u2f32(b, nir_load_local_invocation_index(b));
+      nir_ssa_def *v = nir_fmul(b, x, nir_imm_float(b, 1.0));
+      v = nir_fadd(b, v, nir_imm_float(b, i));
+      v = nir_fneg(b, nir_fneg(b, v));
+
+      nir_deref_instr *deref =
+         nir_build_deref_array(b, nir_build_deref_var(b, out),
+                               nir_imm_int(b, i));
+      nir_store_deref(b, deref, nir_vec4(b, v, v, v, v), 0xf);
+   }
+
+   nir_parallel_for(NUM_SHADERS, optimize_shader, this);
+
+   for (unsigned i = 0; i < NUM_SHADERS; i++) {
+      EXPECT_TRUE(progress[i]);
+      nir_validate_shader(bld[i].shader, NULL);
+   }
+}
@@ -1055,6 +1055,25 @@ draw_set_mapped_texture(struct draw_context *draw,
 #endif
 }
 
+/**
+ * Let the driver supply and store the machine code of the draw module's
+ * JIT-compiled shaders, keyed by a SHA1 of the shader and variant key.
+ */
+void
+draw_set_disk_cache_callbacks(struct draw_context *draw,
+                              void *data_cookie,
+                              void (*find_shader)(void *cookie,
+                                                  struct lp_cached_code *cache,
+                                                  unsigned char ir_sha1_cache_key[20]),
+                              void (*insert_shader)(void *cookie,
+                                                    struct lp_cached_code *cache,
+                                                    unsigned char ir_sha1_cache_key[20]))
+{
+   draw->disk_cache.data_cookie = data_cookie;
+   draw->disk_cache.find_shader = find_shader;
+   draw->disk_cache.insert_shader = insert_shader;
+}
+
 /**
  * XXX: Results for PIPE_SHADER_CAP_MAX_TEXTURE_SAMPLERS because there are two
  * different ways of setting textures, and drivers typically only support one.
@@ -49,6 +49,7 @@ struct draw_fragment_shader;
 struct tgsi_sampler;
 struct tgsi_image;
 struct tgsi_buffer;
+struct lp_cached_code;
 
 /*
  * structure to contain driver internal information 
@@ -187,6 +188,16 @@ draw_set_mapped_texture(struct draw_context *draw,
                         uint32_t img_stride[PIPE_MAX_TEXTURE_LEVELS],
                         uint32_t mip_offsets[PIPE_MAX_TEXTURE_LEVELS]);
 
+void
+draw_set_disk_cache_callbacks(struct draw_context *draw,
+                              void *data_cookie,
+                              void (*find_shader)(void *cookie,
+                                                  struct lp_cached_code *cache,
+                                                  unsigned char ir_sha1_cache_key[20]),
+                              void (*insert_shader)(void *cookie,
+                                                    struct lp_cached_code *cache,
+                                                    unsigned char ir_sha1_cache_key[20]));
+
 
 /*
  * Vertex shader functions
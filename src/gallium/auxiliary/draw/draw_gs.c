@@ -31,6 +31,9 @@
 #include "draw_context.h"
 #ifdef HAVE_LLVM
 #include "draw_llvm.h"
+#include "gallivm/lp_bld_nir.h"
+#include "nir/nir_to_tgsi_info.h"
+#include "compiler/nir/nir.h"
 #endif
 
 #include "tgsi/tgsi_parse.h"
@@ -793,13 +796,23 @@ draw_create_geometry_shader(struct draw_context *draw,
 
    gs->draw = draw;
    gs->state = *state;
-   gs->state.tokens = tgsi_dup_tokens(state->tokens);
-   if (!gs->state.tokens) {
-      FREE(gs);
-      return NULL;
-   }
+#ifdef HAVE_LLVM
+   if (state->type == PIPE_SHADER_IR_NIR) {
+      /* we take ownership of the NIR, only the LLVM path can run it */
+      assert(use_llvm);
+      lp_build_opt_nir(state->ir.nir);
+      nir_tgsi_scan_shader(state->ir.nir, &gs->info, true);
+   } else
+#endif
+   {
+      gs->state.tokens = tgsi_dup_tokens(state->tokens);
+      if (!gs->state.tokens) {
+         FREE(gs);
+         return NULL;
+      }
 
-   tgsi_scan_shader(state->tokens, &gs->info);
+      tgsi_scan_shader(state->tokens, &gs->info);
+   }
 
    /* setup the defaults */
    gs->max_out_prims = 0;
@@ -946,6 +959,9 @@ void draw_delete_geometry_shader(struct draw_context *draw,
       align_free(dgs->llvm_prim_ids);
 
       align_free(dgs->gs_input);
+
+      if (dgs->state.type == PIPE_SHADER_IR_NIR)
+         ralloc_free(dgs->state.ir.nir);
    }
 #endif
 
@@ -43,6 +43,7 @@
 #include "gallivm/lp_bld_flow.h"
 #include "gallivm/lp_bld_debug.h"
 #include "gallivm/lp_bld_tgsi.h"
+#include "gallivm/lp_bld_nir.h"
 #include "gallivm/lp_bld_printf.h"
 #include "gallivm/lp_bld_intr.h"
 #include "gallivm/lp_bld_init.h"
@@ -52,11 +53,16 @@
 
 #include "tgsi/tgsi_exec.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
 
 #include "util/u_math.h"
 #include "util/u_pointer.h"
 #include "util/u_string.h"
 #include "util/simple_list.h"
+#include "util/mesa-sha1.h"
+#include "compiler/blob.h"
+#include "compiler/nir/nir.h"
+#include "compiler/nir/nir_serialize.h"
 
 
 #define DEBUG_STORE 0
@@ -555,6 +561,41 @@ draw_llvm_destroy(struct draw_llvm *llvm)
 }
 
 
+/**
+ * Compute the disk cache key of a vertex or geometry shader variant: the
+ * shader tokens (or serialized NIR), the variant key and the vertex header
+ * size.
+ */
+static void
+draw_get_ir_cache_key(const char *kind,
+                      const struct pipe_shader_state *state,
+                      const void *key, unsigned key_size,
+                      unsigned num_vertex_header_attribs,
+                      unsigned char ir_sha1_cache_key[20])
+{
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, kind, strlen(kind));
+   if (state->type == PIPE_SHADER_IR_NIR) {
+      struct blob blob;
+
+      blob_init(&blob);
+      nir_serialize(&blob, state->ir.nir);
+      _mesa_sha1_update(&ctx, blob.data, blob.size);
+      blob_finish(&blob);
+   } else {
+      _mesa_sha1_update(&ctx, state->tokens,
+                        tgsi_num_tokens(state->tokens) *
+                        sizeof(struct tgsi_token));
+   }
+   _mesa_sha1_update(&ctx, key, key_size);
+   _mesa_sha1_update(&ctx, &num_vertex_header_attribs,
+                     sizeof num_vertex_header_attribs);
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
 /**
  * Create LLVM-generated code for a vertex shader.
  */
@@ -563,11 +604,15 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
                          unsigned num_inputs,
                          const struct draw_llvm_variant_key *key)
 {
+   struct draw_context *draw = llvm->draw;
    struct draw_llvm_variant *variant;
    struct llvm_vertex_shader *shader =
       llvm_vertex_shader(llvm->draw->vs.vertex_shader);
    LLVMTypeRef vertex_header;
    char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   boolean needs_caching = FALSE;
 
    variant = MALLOC(sizeof *variant +
                     shader->variant_key_size -
@@ -581,14 +626,27 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    snprintf(module_name, sizeof(module_name), "draw_llvm_vs_variant%u",
             variant->shader->variants_cached);
 
-   variant->gallivm = gallivm_create(module_name, llvm->context);
+   if (draw->disk_cache.find_shader) {
+      draw_get_ir_cache_key("vs", &draw->vs.vertex_shader->state,
+                            key, shader->variant_key_size, num_inputs,
+                            ir_sha1_cache_key);
+      draw->disk_cache.find_shader(draw->disk_cache.data_cookie, &cached,
+                                   ir_sha1_cache_key);
+      if (!cached.data_size)
+         needs_caching = TRUE;
+   }
+
+   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
    create_jit_types(variant);
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
    if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
-      tgsi_dump(llvm->draw->vs.vertex_shader->state.tokens, 0);
+      if (llvm->draw->vs.vertex_shader->state.type == PIPE_SHADER_IR_NIR)
+         nir_print_shader(llvm->draw->vs.vertex_shader->state.ir.nir, stderr);
+      else
+         tgsi_dump(llvm->draw->vs.vertex_shader->state.tokens, 0);
       draw_llvm_dump_variant_key(&variant->key);
    }
 
@@ -603,7 +661,12 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_jit_vert_func)
          gallivm_jit_function(variant->gallivm, variant->function);
 
+   if (needs_caching)
+      draw->disk_cache.insert_shader(draw->disk_cache.data_cookie, &cached,
+                                     ir_sha1_cache_key);
+
    gallivm_free_ir(variant->gallivm);
+   free(cached.data);
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
@@ -627,7 +690,7 @@ generate_vs(struct draw_llvm_variant *variant,
             struct lp_build_mask_context *bld_mask)
 {
    struct draw_llvm *llvm = variant->llvm;
-   const struct tgsi_token *tokens = llvm->draw->vs.vertex_shader->state.tokens;
+   const struct pipe_shader_state *state = &llvm->draw->vs.vertex_shader->state;
    LLVMValueRef consts_ptr =
       draw_jit_context_vs_constants(variant->gallivm, context_ptr);
    LLVMValueRef num_consts_ptr =
@@ -652,10 +715,13 @@ generate_vs(struct draw_llvm_variant *variant,
    params.ssbo_ptr = ssbos_ptr;
    params.ssbo_sizes_ptr = num_ssbos_ptr;
 
-   lp_build_tgsi_soa(variant->gallivm,
-                     tokens,
-                     &params,
-                     outputs);
+   if (state->type == PIPE_SHADER_IR_NIR)
+      lp_build_nir_soa(variant->gallivm, state->ir.nir, &params, outputs);
+   else
+      lp_build_tgsi_soa(variant->gallivm,
+                        state->tokens,
+                        &params,
+                        outputs);
 
    {
       LLVMValueRef out;
@@ -1403,7 +1469,7 @@ clipmask_booli8(struct gallivm_state *gallivm,
 
 static LLVMValueRef
 draw_gs_llvm_fetch_input(const struct lp_build_tgsi_gs_iface *gs_iface,
-                         struct lp_build_tgsi_context * bld_base,
+                         struct lp_build_context * bld,
                          boolean is_vindex_indirect,
                          LLVMValueRef vertex_index,
                          boolean is_aindex_indirect,
@@ -1411,15 +1477,15 @@ draw_gs_llvm_fetch_input(const struct lp_build_tgsi_gs_iface *gs_iface,
                          LLVMValueRef swizzle_index)
 {
    const struct draw_gs_llvm_iface *gs = draw_gs_llvm_iface(gs_iface);
-   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   struct gallivm_state *gallivm = bld->gallivm;
    LLVMBuilderRef builder = gallivm->builder;
    LLVMValueRef indices[3];
    LLVMValueRef res;
-   struct lp_type type = bld_base->base.type;
+   struct lp_type type = bld->type;
 
    if (is_vindex_indirect || is_aindex_indirect) {
       int i;
-      res = bld_base->base.zero;
+      res = bld->zero;
       for (i = 0; i < type.length; ++i) {
          LLVMValueRef idx = lp_build_const_int32(gallivm, i);
          LLVMValueRef vert_chan_index = vertex_index;
@@ -1459,7 +1525,7 @@ draw_gs_llvm_fetch_input(const struct lp_build_tgsi_gs_iface *gs_iface,
 
 static void
 draw_gs_llvm_emit_vertex(const struct lp_build_tgsi_gs_iface *gs_base,
-                         struct lp_build_tgsi_context * bld_base,
+                         struct lp_build_context * bld,
                          LLVMValueRef (*outputs)[4],
                          LLVMValueRef emitted_vertices_vec)
 {
@@ -1467,7 +1533,7 @@ draw_gs_llvm_emit_vertex(const struct lp_build_tgsi_gs_iface *gs_base,
    struct draw_gs_llvm_variant *variant = gs_iface->variant;
    struct gallivm_state *gallivm = variant->gallivm;
    LLVMBuilderRef builder = gallivm->builder;
-   struct lp_type gs_type = bld_base->base.type;
+   struct lp_type gs_type = bld->type;
    LLVMValueRef clipmask = lp_build_const_int_vec(gallivm,
                                                   lp_int_type(gs_type), 0);
    LLVMValueRef indices[LP_MAX_VECTOR_LENGTH];
@@ -1493,7 +1559,7 @@ draw_gs_llvm_emit_vertex(const struct lp_build_tgsi_gs_iface *gs_base,
 
 static void
 draw_gs_llvm_end_primitive(const struct lp_build_tgsi_gs_iface *gs_base,
-                           struct lp_build_tgsi_context * bld_base,
+                           struct lp_build_context * bld,
                            LLVMValueRef verts_per_prim_vec,
                            LLVMValueRef emitted_prims_vec)
 {
@@ -1505,7 +1571,7 @@ draw_gs_llvm_end_primitive(const struct lp_build_tgsi_gs_iface *gs_base,
       draw_gs_jit_prim_lengths(variant->gallivm, variant->context_ptr);
    unsigned i;
 
-   for (i = 0; i < bld_base->base.type.length; ++i) {
+   for (i = 0; i < bld->type.length; ++i) {
       LLVMValueRef ind = lp_build_const_int32(gallivm, i);
       LLVMValueRef prims_emitted =
          LLVMBuildExtractElement(builder, emitted_prims_vec, ind, "");
@@ -1522,7 +1588,7 @@ draw_gs_llvm_end_primitive(const struct lp_build_tgsi_gs_iface *gs_base,
 
 static void
 draw_gs_llvm_epilogue(const struct lp_build_tgsi_gs_iface *gs_base,
-                      struct lp_build_tgsi_context * bld_base,
+                      struct lp_build_context * bld,
                       LLVMValueRef total_emitted_vertices_vec,
                       LLVMValueRef emitted_prims_vec)
 {
@@ -1600,8 +1666,7 @@ draw_llvm_generate(struct draw_llvm *llvm, struct draw_llvm_variant *variant)
 
    memset(&system_values, 0, sizeof(system_values));
 
-   snprintf(func_name, sizeof(func_name), "draw_llvm_vs_variant%u",
-            variant->shader->variants_cached);
+   snprintf(func_name, sizeof(func_name), "draw_llvm_vs_variant");
 
    i = 0;
    arg_types[i++] = get_context_ptr_type(variant);       /* context */
@@ -2277,7 +2342,7 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
    struct lp_type gs_type;
    unsigned i;
    struct draw_gs_llvm_iface gs_iface;
-   const struct tgsi_token *tokens = variant->shader->base.state.tokens;
+   const struct pipe_shader_state *state = &variant->shader->base.state;
    LLVMValueRef consts_ptr, num_consts_ptr;
    LLVMValueRef ssbos_ptr, num_ssbos_ptr;
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
@@ -2287,8 +2352,7 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
 
    memset(&system_values, 0, sizeof(system_values));
 
-   snprintf(func_name, sizeof(func_name), "draw_llvm_gs_variant%u",
-            variant->shader->variants_cached);
+   snprintf(func_name, sizeof(func_name), "draw_llvm_gs_variant");
 
    assert(variant->vertex_header_ptr_type);
 
@@ -2376,7 +2440,10 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
    }
 
    if (gallivm_debug & (GALLIVM_DEBUG_TGSI | GALLIVM_DEBUG_IR)) {
-      tgsi_dump(tokens, 0);
+      if (state->type == PIPE_SHADER_IR_NIR)
+         nir_print_shader(state->ir.nir, stderr);
+      else
+         tgsi_dump(state->tokens, 0);
       draw_gs_llvm_dump_variant_key(&variant->key);
    }
 
@@ -2395,10 +2462,13 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
    params.ssbo_ptr = ssbos_ptr;
    params.ssbo_sizes_ptr = num_ssbos_ptr;
 
-   lp_build_tgsi_soa(variant->gallivm,
-                     tokens,
-                     &params,
-                     outputs);
+   if (state->type == PIPE_SHADER_IR_NIR)
+      lp_build_nir_soa(variant->gallivm, state->ir.nir, &params, outputs);
+   else
+      lp_build_tgsi_soa(variant->gallivm,
+                        state->tokens,
+                        &params,
+                        outputs);
 
    sampler->destroy(sampler);
 
@@ -2415,11 +2485,15 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
                             unsigned num_outputs,
                             const struct draw_gs_llvm_variant_key *key)
 {
+   struct draw_context *draw = llvm->draw;
    struct draw_gs_llvm_variant *variant;
    struct llvm_geometry_shader *shader =
       llvm_geometry_shader(llvm->draw->gs.geometry_shader);
    LLVMTypeRef vertex_header;
    char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   boolean needs_caching = FALSE;
 
    variant = MALLOC(sizeof *variant +
                     shader->variant_key_size -
@@ -2433,7 +2507,17 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    snprintf(module_name, sizeof(module_name), "draw_llvm_gs_variant%u",
             variant->shader->variants_cached);
 
-   variant->gallivm = gallivm_create(module_name, llvm->context);
+   if (draw->disk_cache.find_shader) {
+      draw_get_ir_cache_key("gs", &draw->gs.geometry_shader->state,
+                            key, shader->variant_key_size, num_outputs,
+                            ir_sha1_cache_key);
+      draw->disk_cache.find_shader(draw->disk_cache.data_cookie, &cached,
+                                   ir_sha1_cache_key);
+      if (!cached.data_size)
+         needs_caching = TRUE;
+   }
+
+   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
    create_gs_jit_types(variant);
 
@@ -2450,7 +2534,12 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_gs_jit_func)
          gallivm_jit_function(variant->gallivm, variant->function);
 
+   if (needs_caching)
+      draw->disk_cache.insert_shader(draw->disk_cache.data_cookie, &cached,
+                                     ir_sha1_cache_key);
+
    gallivm_free_ir(variant->gallivm);
+   free(cached.data);
 
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
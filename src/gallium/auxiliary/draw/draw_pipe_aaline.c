@@ -329,6 +329,12 @@ bind_aaline_fragment_shader(struct aaline_stage *aaline)
    struct draw_context *draw = aaline->stage.draw;
    struct pipe_context *pipe = draw->pipe;
 
+   /* The AA coverage is added by a TGSI transform, NIR shaders are left
+    * alone.
+    */
+   if (!aaline->fs->state.tokens)
+      return FALSE;
+
    if (!aaline->fs->aaline_fs && !generate_aaline_fs(aaline))
       return FALSE;
 
@@ -618,7 +624,8 @@ aaline_create_fs_state(struct pipe_context *pipe,
    if (!aafs)
       return NULL;
 
-   aafs->state.tokens = tgsi_dup_tokens(fs->tokens);
+   if (fs->type == PIPE_SHADER_IR_TGSI)
+      aafs->state.tokens = tgsi_dup_tokens(fs->tokens);
 
    /* pass-through */
    aafs->driver_fs = aaline->driver_create_fs_state(pipe, fs);
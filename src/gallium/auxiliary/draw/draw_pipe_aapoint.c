@@ -415,6 +415,12 @@ bind_aapoint_fragment_shader(struct aapoint_stage *aapoint)
    struct draw_context *draw = aapoint->stage.draw;
    struct pipe_context *pipe = draw->pipe;
 
+   /* The AA coverage is added by a TGSI transform, NIR shaders are left
+    * alone.
+    */
+   if (!aapoint->fs->state.tokens)
+      return FALSE;
+
    if (!aapoint->fs->aapoint_fs &&
        !generate_aapoint_fs(aapoint))
       return FALSE;
@@ -558,7 +564,11 @@ aapoint_first_point(struct draw_stage *stage, struct prim_header *header)
    /*
     * Bind (generate) our fragprog.
     */
-   bind_aapoint_fragment_shader(aapoint);
+   if (!bind_aapoint_fragment_shader(aapoint)) {
+      stage->point = draw_pipe_passthrough_point;
+      stage->point(stage, header);
+      return;
+   }
 
    draw_aapoint_prepare_outputs(draw, draw->pipeline.aapoint);
 
@@ -710,7 +720,8 @@ aapoint_create_fs_state(struct pipe_context *pipe,
    if (!aafs)
       return NULL;
 
-   aafs->state.tokens = tgsi_dup_tokens(fs->tokens);
+   if (fs->type == PIPE_SHADER_IR_TGSI)
+      aafs->state.tokens = tgsi_dup_tokens(fs->tokens);
 
    /* pass-through */
    aafs->driver_fs = aapoint->driver_create_fs_state(pipe, fs);
@@ -161,6 +161,13 @@ static boolean
 bind_pstip_fragment_shader(struct pstip_stage *pstip)
 {
    struct draw_context *draw = pstip->stage.draw;
+
+   /* The stipple lookup is added by a TGSI transform, NIR shaders are left
+    * alone.
+    */
+   if (!pstip->fs->state.tokens)
+      return FALSE;
+
    if (!pstip->fs->pstip_fs &&
        !generate_pstip_fs(pstip))
       return FALSE;
@@ -334,7 +341,8 @@ pstip_create_fs_state(struct pipe_context *pipe,
    struct pstip_fragment_shader *pstipfs = CALLOC_STRUCT(pstip_fragment_shader);
 
    if (pstipfs) {
-      pstipfs->state.tokens = tgsi_dup_tokens(fs->tokens);
+      if (fs->type == PIPE_SHADER_IR_TGSI)
+         pstipfs->state.tokens = tgsi_dup_tokens(fs->tokens);
 
       /* pass-through */
       pstipfs->driver_fs = pstip->driver_create_fs_state(pstip->pipe, fs);
@@ -50,6 +50,8 @@
 struct gallivm_state;
 #endif
 
+struct lp_cached_code;
+
 
 /** Sum of frustum planes and user-defined planes */
 #define DRAW_TOTAL_CLIP_PLANES (6 + PIPE_MAX_CLIP_PLANES)
@@ -332,6 +334,17 @@ struct draw_context
 
    struct draw_llvm *llvm;
 
+   /** Driver hooks into a persistent cache of JIT-compiled shader code */
+   struct {
+      void *data_cookie;
+      void (*find_shader)(void *cookie,
+                          struct lp_cached_code *cache,
+                          unsigned char ir_sha1_cache_key[20]);
+      void (*insert_shader)(void *cookie,
+                            struct lp_cached_code *cache,
+                            unsigned char ir_sha1_cache_key[20]);
+   } disk_cache;
+
    /** Texture sampler and sampler view state.
     * Note that we have arrays indexed by shader type.  At this time
     * we only handle vertex and geometry shaders in the draw module, but
@@ -28,6 +28,9 @@
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+#include "util/u_debug.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_vbuf.h"
@@ -40,6 +43,32 @@
 #include "gallivm/lp_bld_debug.h"
 
 
+/** Max number of threads running the vertex shader of a single chunk */
+#define LLVM_VS_MAX_THREADS 16
+
+/**
+ * Don't split chunks into slices smaller than this.  Below that the
+ * hand-off to the worker threads costs more than the shading saves.
+ */
+#define LLVM_VS_MIN_SLICE_VERTICES 256
+
+
+/**
+ * A range of the vertices of a chunk, shaded by one thread.
+ */
+struct llvm_vs_slice {
+   struct llvm_middle_end *fpme;
+   struct vertex_header *verts;
+   unsigned count;
+   unsigned start_or_maxelt;
+   unsigned vid_base;
+   const unsigned *elts;
+   unsigned fpstate;
+   boolean clipped;
+   struct util_queue_fence fence;
+};
+
+
 struct llvm_middle_end {
    struct draw_pt_middle_end base;
    struct draw_context *draw;
@@ -57,6 +86,17 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /**
+    * Worker threads for the vertex shader.  Fetch, shading, cliptest and
+    * viewport transform are independent per vertex, so a chunk is split
+    * into slices shaded concurrently.  Everything downstream (GS, stream
+    * output, clipping, primitive assembly, emit) stays on the calling thread
+    * so the primitive order is unchanged.
+    */
+   struct util_queue vs_queue;
+   unsigned num_vs_threads;
+   struct llvm_vs_slice vs_slices[LLVM_VS_MAX_THREADS];
 };
 
 
@@ -364,6 +404,119 @@ emit(struct pt_emit *emit,
 }
 
 
+static boolean
+llvm_vs_run_slice(struct llvm_middle_end *fpme,
+                  const struct llvm_vs_slice *slice)
+{
+   struct draw_context *draw = fpme->draw;
+
+   return fpme->current_variant->jit_func(&fpme->llvm->jit_context,
+                                          slice->verts,
+                                          draw->pt.user.vbuffer,
+                                          slice->count,
+                                          slice->start_or_maxelt,
+                                          fpme->vertex_size,
+                                          draw->pt.vertex_buffer,
+                                          draw->instance_id,
+                                          slice->vid_base,
+                                          draw->start_instance,
+                                          slice->elts);
+}
+
+
+static void
+llvm_vs_slice_execute(void *data, int thread_index)
+{
+   struct llvm_vs_slice *slice = data;
+   unsigned fpstate = util_fpstate_get();
+
+   /* Same denorm handling as draw_vbo() set up on the calling thread. */
+   util_fpstate_set(slice->fpstate);
+   slice->clipped = llvm_vs_run_slice(slice->fpme, slice);
+   util_fpstate_set(fpstate);
+}
+
+
+/**
+ * Run fetch + vertex shader over the vertices of a chunk, on the worker
+ * threads if the chunk is large enough.
+ * \return  whether any vertex needs clipping (or has a non-one edgeflag)
+ */
+static boolean
+llvm_vs_run(struct llvm_middle_end *fpme,
+            struct vertex_header *verts,
+            unsigned count,
+            unsigned start_or_maxelt,
+            unsigned vid_base,
+            const unsigned *elts)
+{
+   const unsigned vector_length = lp_native_vector_width / 32;
+   unsigned num_slices = 1;
+   unsigned slice_size, offset, i;
+   unsigned fpstate;
+   boolean clipped = FALSE;
+
+   if (fpme->num_vs_threads)
+      num_slices = MIN2(fpme->num_vs_threads + 1,
+                        count / LLVM_VS_MIN_SLICE_VERTICES);
+
+   if (num_slices <= 1) {
+      struct llvm_vs_slice slice;
+
+      slice.verts = verts;
+      slice.count = count;
+      slice.start_or_maxelt = start_or_maxelt;
+      slice.vid_base = vid_base;
+      slice.elts = elts;
+      return llvm_vs_run_slice(fpme, &slice);
+   }
+
+   /* The jit function always shades whole vectors, so all but the last
+    * slice must be a multiple of the vector length to not overwrite the
+    * neighbouring slice.
+    */
+   slice_size = align(DIV_ROUND_UP(count, num_slices), vector_length);
+   fpstate = util_fpstate_get();
+
+   for (i = 0, offset = 0; offset < count; i++, offset += slice_size) {
+      struct llvm_vs_slice *slice = &fpme->vs_slices[i];
+
+      slice->fpme = fpme;
+      slice->verts = (struct vertex_header *)
+         ((char *)verts + offset * fpme->vertex_size);
+      slice->count = MIN2(slice_size, count - offset);
+      slice->vid_base = vid_base;
+      if (elts) {
+         slice->start_or_maxelt = start_or_maxelt;
+         slice->elts = elts + offset;
+      }
+      else {
+         slice->start_or_maxelt = start_or_maxelt + offset;
+         slice->elts = NULL;
+      }
+      slice->fpstate = fpstate;
+      slice->clipped = FALSE;
+   }
+   num_slices = i;
+
+   /* Hand out all but the first slice, which the calling thread shades. */
+   for (i = 1; i < num_slices; i++) {
+      util_queue_add_job(&fpme->vs_queue, &fpme->vs_slices[i],
+                         &fpme->vs_slices[i].fence,
+                         llvm_vs_slice_execute, NULL);
+   }
+
+   clipped = llvm_vs_run_slice(fpme, &fpme->vs_slices[0]);
+
+   for (i = 1; i < num_slices; i++) {
+      util_queue_fence_wait(&fpme->vs_slices[i].fence);
+      clipped |= fpme->vs_slices[i].clipped;
+   }
+
+   return clipped;
+}
+
+
 static void
 llvm_pipeline_generic(struct draw_pt_middle_end *middle,
                       const struct draw_fetch_info *fetch_info,
@@ -414,17 +567,8 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
       vid_base = draw->pt.user.eltBias;
       elts = fetch_info->elts;
    }
-   clipped = fpme->current_variant->jit_func(&fpme->llvm->jit_context,
-                                             llvm_vert_info.verts,
-                                             draw->pt.user.vbuffer,
-                                             fetch_info->count,
-                                             start_or_maxelt,
-                                             fpme->vertex_size,
-                                             draw->pt.vertex_buffer,
-                                             draw->instance_id,
-                                             vid_base,
-                                             draw->start_instance,
-                                             elts);
+   clipped = llvm_vs_run(fpme, llvm_vert_info.verts, fetch_info->count,
+                         start_or_maxelt, vid_base, elts);
 
    /* Finished with fetch and vs:
     */
@@ -623,6 +767,7 @@ static void
 llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
 {
    struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   unsigned i;
 
    if (fpme->fetch)
       draw_pt_fetch_destroy( fpme->fetch );
@@ -636,6 +781,12 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
    if (fpme->post_vs)
       draw_pt_post_vs_destroy( fpme->post_vs );
 
+   if (util_queue_is_initialized(&fpme->vs_queue))
+      util_queue_destroy(&fpme->vs_queue);
+
+   for (i = 0; i < ARRAY_SIZE(fpme->vs_slices); i++)
+      util_queue_fence_destroy(&fpme->vs_slices[i].fence);
+
    FREE(middle);
 }
 
@@ -644,6 +795,7 @@ struct draw_pt_middle_end *
 draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 {
    struct llvm_middle_end *fpme = 0;
+   unsigned num_vs_threads, i;
 
    if (!draw->llvm)
       return NULL;
@@ -662,6 +814,20 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 
    fpme->draw = draw;
 
+   for (i = 0; i < ARRAY_SIZE(fpme->vs_slices); i++)
+      util_queue_fence_init(&fpme->vs_slices[i].fence);
+
+   /* The calling thread shades a slice too, hence the - 1. */
+   num_vs_threads = util_cpu_caps.nr_cpus > 1 ?
+                    MIN2(util_cpu_caps.nr_cpus, 4) - 1 : 0;
+   num_vs_threads = debug_get_num_option("DRAW_VS_THREADS", num_vs_threads);
+   num_vs_threads = MIN2(num_vs_threads, LLVM_VS_MAX_THREADS - 1);
+   if (num_vs_threads &&
+       util_queue_init(&fpme->vs_queue, "drawvs", LLVM_VS_MAX_THREADS,
+                       num_vs_threads, 0)) {
+      fpme->num_vs_threads = num_vs_threads;
+   }
+
    fpme->fetch = draw_pt_fetch_create( draw );
    if (!fpme->fetch)
       goto fail;
@@ -55,7 +55,7 @@ draw_create_vertex_shader(struct draw_context *draw,
 {
    struct draw_vertex_shader *vs = NULL;
 
-   if (draw->dump_vs) {
+   if (draw->dump_vs && shader->type == PIPE_SHADER_IR_TGSI) {
       tgsi_dump(shader->tokens, 0);
    }
 
@@ -65,7 +65,8 @@ draw_create_vertex_shader(struct draw_context *draw,
    }
 #endif
 
-   if (!vs) {
+   /* Only the LLVM path can consume NIR */
+   if (!vs && shader->type == PIPE_SHADER_IR_TGSI) {
       vs = draw_create_vs_exec( draw, shader );
    }
 
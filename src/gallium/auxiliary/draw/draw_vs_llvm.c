@@ -37,6 +37,9 @@
 
 #include "tgsi/tgsi_parse.h"
 #include "tgsi/tgsi_scan.h"
+#include "gallivm/lp_bld_nir.h"
+#include "nir/nir_to_tgsi_info.h"
+#include "compiler/nir/nir.h"
 
 static void
 vs_llvm_prepare(struct draw_vertex_shader *shader,
@@ -76,6 +79,8 @@ vs_llvm_delete( struct draw_vertex_shader *dvs )
    }
 
    assert(shader->variants_cached == 0);
+   if (dvs->state.type == PIPE_SHADER_IR_NIR)
+      ralloc_free(dvs->state.ir.nir);
    FREE((void*) dvs->state.tokens);
    FREE( dvs );
 }
@@ -90,15 +95,23 @@ draw_create_vs_llvm(struct draw_context *draw,
    if (!vs)
       return NULL;
 
-   /* we make a private copy of the tokens */
-   vs->base.state.tokens = tgsi_dup_tokens(state->tokens);
-   if (!vs->base.state.tokens) {
-      FREE(vs);
-      return NULL;
+   if (state->type == PIPE_SHADER_IR_NIR) {
+      /* we take ownership of the NIR */
+      vs->base.state.type = PIPE_SHADER_IR_NIR;
+      vs->base.state.ir.nir = state->ir.nir;
+      lp_build_opt_nir(state->ir.nir);
+      nir_tgsi_scan_shader(state->ir.nir, &vs->base.info, true);
+   } else {
+      /* we make a private copy of the tokens */
+      vs->base.state.tokens = tgsi_dup_tokens(state->tokens);
+      if (!vs->base.state.tokens) {
+         FREE(vs);
+         return NULL;
+      }
+
+      tgsi_scan_shader(state->tokens, &vs->base.info);
    }
 
-   tgsi_scan_shader(state->tokens, &vs->base.info);
-
    vs->variant_key_size = 
       draw_llvm_variant_key_size(
          vs->base.info.file_max[TGSI_FILE_INPUT]+1,
@@ -2882,7 +2882,8 @@ lp_build_fast_rsqrt_available(struct lp_type type)
    assert(type.floating);
 
    if ((util_cpu_caps.has_sse && type.width == 32 && type.length == 4) ||
-       (util_cpu_caps.has_avx && type.width == 32 && type.length == 8)) {
+       (util_cpu_caps.has_avx && type.width == 32 &&
+        (type.length == 8 || type.length == 16))) {
       return true;
    }
    return false;
@@ -2910,9 +2911,27 @@ lp_build_fast_rsqrt(struct lp_build_context *bld,
       if (type.length == 4) {
          intrinsic = "llvm.x86.sse.rsqrt.ps";
       }
-      else {
+      else if (type.length == 8) {
          intrinsic = "llvm.x86.avx.rsqrt.ps.256";
       }
+      else {
+         /*
+          * No 16-wide equivalent with the same precision (rsqrt14 would
+          * round differently), so do it in two halves.
+          */
+         struct lp_type type8 = type;
+         LLVMValueRef tmp[2];
+         type8.length = 8;
+         tmp[0] = lp_build_extract_range(bld->gallivm, a, 0, 8);
+         tmp[1] = lp_build_extract_range(bld->gallivm, a, 8, 8);
+         tmp[0] = lp_build_intrinsic_unary(builder, "llvm.x86.avx.rsqrt.ps.256",
+                                           lp_build_vec_type(bld->gallivm, type8),
+                                           tmp[0]);
+         tmp[1] = lp_build_intrinsic_unary(builder, "llvm.x86.avx.rsqrt.ps.256",
+                                           lp_build_vec_type(bld->gallivm, type8),
+                                           tmp[1]);
+         return lp_build_concat(bld->gallivm, tmp, type8, 2);
+      }
       return lp_build_intrinsic_unary(builder, intrinsic, bld->vec_type, a);
    }
    else {
@@ -491,6 +491,16 @@ int lp_build_conv_auto(struct gallivm_state *gallivm,
          lp_build_conv(gallivm, src_type, *dst_type, src, num_srcs, dst, num_dsts);
          return num_dsts;
       }
+
+      /* Special case 1x16x32 --> 1x16x8 */
+      if (src_type.length == 16 &&
+          util_cpu_caps.has_avx)
+      {
+         dst_type->length = 16;
+
+         lp_build_conv(gallivm, src_type, *dst_type, src, num_srcs, dst, num_dsts);
+         return num_dsts;
+      }
    }
 
    /* lp_build_resize does not support M:N */
@@ -673,11 +683,11 @@ lp_build_conv(struct gallivm_state *gallivm,
       return; 
    }
 
-   /* Special case 2x8x32 --> 1x16x8, 1x8x32 ->1x8x8
+   /* Special case 2x8x32 --> 1x16x8, 1x8x32 ->1x8x8, 1x16x32 -> 1x16x8
     */
    else if (src_type.norm     == 0 &&
        src_type.width    == 32 &&
-       src_type.length   == 8 &&
+       (src_type.length == 8 || src_type.length == 16) &&
        src_type.fixed    == 0 &&
 
        dst_type.floating == 0 &&
@@ -688,7 +698,7 @@ lp_build_conv(struct gallivm_state *gallivm,
         (src_type.floating == 0 && dst_type.floating == 0 &&
          src_type.sign == dst_type.sign && dst_type.norm == 0)) &&
 
-      ((dst_type.length == 16 && 2 * num_dsts == num_srcs) ||
+      ((dst_type.length == 16 && src_type.length * num_srcs == 16 * num_dsts) ||
        (num_dsts == 1 && dst_type.length * num_srcs == 8)) &&
 
       util_cpu_caps.has_avx) {
@@ -714,9 +724,10 @@ lp_build_conv(struct gallivm_state *gallivm,
 
       const_scale = lp_build_const_vec(gallivm, src_type, lp_const_scale(dst_type));
 
-      for (i = 0; i < num_dsts; ++i, src += 2) {
-         unsigned j;
-         for (j = 0; j < (num_srcs == 1 ? 1 : 2); j++) {
+      for (i = 0; i < num_dsts; ++i) {
+         unsigned srcs_per_dst = MIN2(num_srcs, 16 / src_type.length);
+         unsigned j, k, n = 0;
+         for (j = 0; j < srcs_per_dst; j++) {
             LLVMValueRef lo, hi, a;
 
             a = src[j];
@@ -740,19 +751,22 @@ lp_build_conv(struct gallivm_state *gallivm,
                   a = lp_build_min(&bld, a, const_max);
                }
             }
-            lo = lp_build_extract_range(gallivm, a, 0, 4);
-            hi = lp_build_extract_range(gallivm, a, 4, 4);
-            /* relying on clamping behavior of sse2 intrinsics here */
-            tmp[j] = lp_build_pack2(gallivm, int32_type, int16_type, lo, hi);
+            for (k = 0; k < src_type.length / 8; k++) {
+               lo = lp_build_extract_range(gallivm, a, k * 8, 4);
+               hi = lp_build_extract_range(gallivm, a, k * 8 + 4, 4);
+               /* relying on clamping behavior of sse2 intrinsics here */
+               tmp[n++] = lp_build_pack2(gallivm, int32_type, int16_type, lo, hi);
+            }
          }
+         src += srcs_per_dst;
 
-         if (num_srcs == 1) {
+         if (n == 1) {
             tmp[1] = tmp[0];
          }
          dst[i] = lp_build_pack2(gallivm, int16_type, dst_type_ext, tmp[0], tmp[1]);
       }
 
-      if (num_srcs == 1) {
+      if (num_srcs == 1 && src_type.length == 8) {
          dst[0] = lp_build_extract_range(gallivm, dst[0], 0, dst_type.length);
       }
 
@@ -35,6 +35,7 @@
 #include "util/os_time.h"
 #include "lp_bld.h"
 #include "lp_bld_debug.h"
+#include "lp_bld_type.h"
 #include "lp_bld_misc.h"
 #include "lp_bld_init.h"
 
@@ -136,15 +137,7 @@ create_pass_manager(struct gallivm_state *gallivm)
    LLVMAddTargetData(gallivm->target, gallivm->passmgr);
 #endif
 
-   {
-      char *td_str;
-      // New ones from the Module.
-      td_str = LLVMCopyStringRepOfTargetData(gallivm->target);
-      LLVMSetDataLayout(gallivm->module, td_str);
-      free(td_str);
-   }
-
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0 && !gallivm->fast_compile) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -213,6 +206,15 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    if (gallivm->builder)
       LLVMDisposeBuilder(gallivm->builder);
 
+   /* The object cache is referenced by the execution engine, so it can only
+    * go away together with it.  The cached code itself is owned by the
+    * caller of gallivm_create().
+    */
+   if (gallivm->cache) {
+      lp_free_objcache(gallivm->cache->jit_obj_cache);
+      gallivm->cache->jit_obj_cache = NULL;
+   }
+
    /* The LLVMContext should be owned by the parent of gallivm. */
 
    gallivm->engine = NULL;
@@ -222,6 +224,7 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    gallivm->passmgr = NULL;
    gallivm->context = NULL;
    gallivm->builder = NULL;
+   gallivm->cache = NULL;
 }
 
 
@@ -248,7 +251,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if ((gallivm_perf & GALLIVM_PERF_NO_OPT) || gallivm->fast_compile) {
          optlevel = None;
       }
       else {
@@ -261,6 +264,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
                                                     gallivm->memorymgr,
                                                     (unsigned) optlevel,
                                                     use_mcjit,
+                                                    gallivm->cache,
                                                     &error);
       if (ret) {
          _debug_printf("%s\n", error);
@@ -309,7 +313,7 @@ fail:
  */
 static boolean
 init_gallivm_state(struct gallivm_state *gallivm, const char *name,
-                   LLVMContextRef context)
+                   LLVMContextRef context, struct lp_cached_code *cache)
 {
    assert(!gallivm->context);
    assert(!gallivm->module);
@@ -318,6 +322,7 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
       return FALSE;
 
    gallivm->context = context;
+   gallivm->cache = cache;
 
    if (!gallivm->context)
       goto fail;
@@ -389,8 +394,12 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
       }
    }
 
-   if (!create_pass_manager(gallivm))
-      goto fail;
+   {
+      char *td_str;
+      td_str = LLVMCopyStringRepOfTargetData(gallivm->target);
+      LLVMSetDataLayout(gallivm->module, td_str);
+      free(td_str);
+   }
 
    return TRUE;
 
@@ -446,6 +455,7 @@ lp_build_init(void)
       util_cpu_caps.has_avx2 = 0;
       util_cpu_caps.has_f16c = 0;
       util_cpu_caps.has_fma = 0;
+      util_cpu_caps.has_avx512f = 0;
    }
 #endif
 
@@ -466,9 +476,20 @@ lp_build_init(void)
       lp_native_vector_width = 128;
    }
  
+   /* 512 bit vectors are opt-in, as on many AVX-512 capable CPUs they cost
+    * clock frequency which only pays off for fragment shading heavy loads.
+    */
    lp_native_vector_width = debug_get_num_option("LP_NATIVE_VECTOR_WIDTH",
                                                  lp_native_vector_width);
 
+   if (lp_native_vector_width > 256 &&
+       (!util_cpu_caps.has_avx512f || HAVE_LLVM < 0x0305 || !use_mcjit)) {
+      /* Only worth it when the vectors map onto AVX-512 registers, which
+       * requires MCJIT. */
+      lp_native_vector_width = 256;
+   }
+   lp_native_vector_width = MIN2(lp_native_vector_width, LP_MAX_VECTOR_WIDTH);
+
    if (lp_native_vector_width <= 128) {
       /* Hide AVX support, as often LLVM AVX intrinsics are only guarded by
        * "util_cpu_caps.has_avx" predicate, and lack the
@@ -482,6 +503,10 @@ lp_build_init(void)
       util_cpu_caps.has_f16c = 0;
       util_cpu_caps.has_fma = 0;
    }
+   if (lp_native_vector_width < 512) {
+      /* Likewise hide AVX-512, its code paths assume 512 bit vectors */
+      util_cpu_caps.has_avx512f = 0;
+   }
    if (HAVE_LLVM < 0x0304 || !use_mcjit) {
       /* AVX2 support has only been tested with LLVM 3.4, and it requires
        * MCJIT. */
@@ -519,15 +544,20 @@ lp_build_init(void)
 
 /**
  * Create a new gallivm_state object.
+ *
+ * \param cache  optional; if non-NULL, receives the object code of the
+ *               compiled module, or supplies it when it is already populated
+ *               (see struct lp_cached_code).
  */
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context)
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache)
 {
    struct gallivm_state *gallivm;
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm, name, context)) {
+      if (!init_gallivm_state(gallivm, name, context, cache)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -610,7 +640,20 @@ gallivm_compile_module(struct gallivm_state *gallivm)
    if (gallivm_debug & GALLIVM_DEBUG_PERF)
       time_begin = os_time_get();
 
-   /* Run optimization passes */
+   /* Run optimization passes, unless the machine code is already cached, in
+    * which case the IR is only needed for symbol lookup.
+    */
+   if (gallivm->cache && gallivm->cache->data_size)
+      goto skip_opt;
+
+   /* The pass manager is only created now so that the optimization level
+    * can still be chosen after the IR was built.
+    */
+   if (!create_pass_manager(gallivm)) {
+      assert(0);
+      goto skip_opt;
+   }
+
    LLVMInitializeFunctionPassManager(gallivm->passmgr);
    func = LLVMGetFirstFunction(gallivm->module);
    while (func) {
@@ -640,6 +683,8 @@ gallivm_compile_module(struct gallivm_state *gallivm)
                    gallivm->module_name, time_msec);
    }
 
+skip_opt:
+
    if (use_mcjit) {
       /* Setting the module's DataLayout to an empty string will cause the
        * ExecutionEngine to copy to the DataLayout string from its target
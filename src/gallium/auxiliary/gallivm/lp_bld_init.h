@@ -39,6 +39,27 @@
 extern "C" {
 #endif
 
+/**
+ * Machine code of a compiled module, as stored in / loaded from a
+ * persistent shader cache.
+ *
+ * When data_size is non-zero on entry to gallivm_compile_module() the object
+ * code is loaded from data instead of being generated.  Otherwise, once the
+ * module is compiled, data/data_size hold a malloc'ed copy of the generated
+ * object code which the caller owns.  dont_cache is set whenever the IR
+ * embeds process-specific addresses and the code must not be reused by
+ * another process.
+ *
+ * Functions are looked up in a loaded object by name, so symbol names must
+ * only depend on what the cache key covers, never on per-process counters.
+ */
+struct lp_cached_code {
+   void *data;
+   size_t data_size;
+   boolean dont_cache;
+   void *jit_obj_cache;
+};
+
 struct gallivm_state
 {
    char *module_name;
@@ -50,7 +71,14 @@ struct gallivm_state
    LLVMBuilderRef builder;
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
+   struct lp_cached_code *cache;
    unsigned compiled;
+
+   /**
+    * Skip IR optimizations and use the fastest code generator settings.
+    * Must be set before gallivm_compile_module().
+    */
+   boolean fast_compile;
 };
 
 
@@ -59,7 +87,8 @@ lp_build_init(void);
 
 
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context);
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache);
 
 void
 gallivm_destroy(struct gallivm_state *gallivm);
@@ -66,6 +66,10 @@
 #else
 #include <llvm/ExecutionEngine/SectionMemoryManager.h>
 #endif
+#if HAVE_LLVM >= 0x0306
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#include <llvm/Support/MemoryBuffer.h>
+#endif
 #include <llvm/Support/CommandLine.h>
 #include <llvm/Support/Host.h>
 #include <llvm/Support/PrettyStackTrace.h>
@@ -97,6 +101,7 @@
 
 #include "lp_bld_misc.h"
 #include "lp_bld_debug.h"
+#include "lp_bld_init.h"
 
 namespace {
 
@@ -473,6 +478,56 @@ class ShaderMemoryManager : public DelegatingJITMemoryManager {
 };
 
 
+#if HAVE_LLVM >= 0x0306
+/**
+ * Object cache hooked into MCJIT so that the machine code of a module can be
+ * saved to, and later restored from, a persistent shader cache.
+ *
+ * If the lp_cached_code already holds object code, MCJIT loads it instead of
+ * running the code generator; otherwise the freshly generated object is
+ * copied out so that the caller can store it.
+ */
+class LPObjectCache : public llvm::ObjectCache {
+private:
+   bool has_object;
+   struct lp_cached_code *cache_out;
+
+public:
+   LPObjectCache(struct lp_cached_code *cache) {
+      cache_out = cache;
+      has_object = false;
+   }
+
+   ~LPObjectCache() {
+   }
+
+   void notifyObjectCompiled(const llvm::Module *M,
+                             llvm::MemoryBufferRef Obj) {
+      /* gallivm compiles exactly one module per engine */
+      assert(!has_object);
+      has_object = true;
+      cache_out->data_size = Obj.getBufferSize();
+      cache_out->data = malloc(cache_out->data_size);
+      if (!cache_out->data) {
+         cache_out->data_size = 0;
+         return;
+      }
+      memcpy(cache_out->data, Obj.getBufferStart(), cache_out->data_size);
+   }
+
+   virtual std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) {
+      if (cache_out->data_size) {
+         return llvm::MemoryBuffer::getMemBuffer(
+            llvm::StringRef((const char *)cache_out->data,
+                            cache_out->data_size),
+            "", false);
+      }
+      return NULL;
+   }
+};
+#endif
+
+
 /**
  * Same as LLVMCreateJITCompilerForModule, but:
  * - allows using MCJIT and enabling AVX feature where available.
@@ -491,6 +546,7 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
                                         LLVMMCJITMemoryManagerRef CMM,
                                         unsigned OptLevel,
                                         int useMCJIT,
+                                        struct lp_cached_code *cache,
                                         char **OutError)
 {
    using namespace llvm;
@@ -612,17 +668,24 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
       MAttrs.push_back("-fma");
    }
    MAttrs.push_back(util_cpu_caps.has_avx2 ? "+avx2" : "-avx2");
-   /* disable avx512 and all subvariants */
+   /*
+    * avx512 is only enabled together with 512 bit native vectors (see
+    * lp_build_init), otherwise disable it and all subvariants.
+    */
 #if HAVE_LLVM >= 0x0304
-   MAttrs.push_back("-avx512cd");
+   MAttrs.push_back(util_cpu_caps.has_avx512f &&
+                    util_cpu_caps.has_avx512cd ? "+avx512cd" : "-avx512cd");
    MAttrs.push_back("-avx512er");
-   MAttrs.push_back("-avx512f");
+   MAttrs.push_back(util_cpu_caps.has_avx512f ? "+avx512f" : "-avx512f");
    MAttrs.push_back("-avx512pf");
 #endif
 #if HAVE_LLVM >= 0x0305
-   MAttrs.push_back("-avx512bw");
-   MAttrs.push_back("-avx512dq");
-   MAttrs.push_back("-avx512vl");
+   MAttrs.push_back(util_cpu_caps.has_avx512f &&
+                    util_cpu_caps.has_avx512bw ? "+avx512bw" : "-avx512bw");
+   MAttrs.push_back(util_cpu_caps.has_avx512f &&
+                    util_cpu_caps.has_avx512dq ? "+avx512dq" : "-avx512dq");
+   MAttrs.push_back(util_cpu_caps.has_avx512f &&
+                    util_cpu_caps.has_avx512vl ? "+avx512vl" : "-avx512vl");
 #endif
 #endif
 #if defined(PIPE_ARCH_ARM)
@@ -759,6 +822,13 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
    JIT->RegisterJITEventListener(JEL);
 #endif
    if (JIT) {
+#if HAVE_LLVM >= 0x0306
+      if (cache && useMCJIT) {
+         LPObjectCache *objcache = new LPObjectCache(cache);
+         JIT->setObjectCache(objcache);
+         cache->jit_obj_cache = (void *)objcache;
+      }
+#endif
       *OutJIT = wrap(JIT);
       return 0;
    }
@@ -777,6 +847,16 @@ lp_free_generated_code(struct lp_generated_code *code)
    ShaderMemoryManager::freeGeneratedCode(code);
 }
 
+extern "C"
+void
+lp_free_objcache(void *objcache_ptr)
+{
+#if HAVE_LLVM >= 0x0306
+   LPObjectCache *objcache = (LPObjectCache *)objcache_ptr;
+   delete objcache;
+#endif
+}
+
 extern "C"
 LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager()
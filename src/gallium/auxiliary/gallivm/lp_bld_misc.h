@@ -41,6 +41,7 @@ extern "C" {
 
 
 struct lp_generated_code;
+struct lp_cached_code;
 
 extern LLVMTargetLibraryInfoRef
 gallivm_create_target_library_info(const char *triple);
@@ -59,11 +60,15 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
                                         LLVMMCJITMemoryManagerRef MM,
                                         unsigned OptLevel,
                                         int useMCJIT,
+                                        struct lp_cached_code *cache,
                                         char **OutError);
 
 extern void
 lp_free_generated_code(struct lp_generated_code *code);
 
+extern void
+lp_free_objcache(void *objcache);
+
 extern LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager();
 
@@ -0,0 +1,1804 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * @file
+ * Generic part of the NIR to LLVM IR translation: control flow walking,
+ * SSA values, registers and ALU instructions.
+ *
+ * Every SSA value component is kept as one vector of the integer type of
+ * its bit size (uint_bld or uint64_bld), and bitcast to the type the
+ * consuming instruction expects.  Booleans are 32 bit, 0 or ~0.
+ *
+ * Divergent control flow is handled with execution masks by the backend,
+ * so the shader must come out of lp_build_opt_nir(): phis are turned into
+ * registers, which are only written under the execution mask, and values
+ * which live past a loop go through LCSSA phis, so lanes which left the
+ * loop early keep the value they had at that point.
+ */
+
+#include "lp_bld_nir.h"
+#include "lp_bld_arit.h"
+#include "lp_bld_bitarit.h"
+#include "lp_bld_const.h"
+#include "lp_bld_conv.h"
+#include "lp_bld_debug.h"
+#include "lp_bld_intr.h"
+#include "lp_bld_flow.h"
+#include "lp_bld_logic.h"
+#include "lp_bld_quad.h"
+#include "lp_bld_sample.h"
+
+#include "compiler/nir/nir_deref.h"
+#include "pipe/p_defines.h"
+#include "util/hash_table.h"
+#include "util/u_debug.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+
+
+static void
+visit_cf_list(struct lp_build_nir_context *bld_base,
+              struct exec_list *list);
+
+
+static LLVMValueRef
+cast_type(struct lp_build_nir_context *bld_base,
+          LLVMValueRef val,
+          nir_alu_type alu_type,
+          unsigned bit_size)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *bld;
+
+   switch (nir_alu_type_get_base_type(alu_type)) {
+   case nir_type_float:
+      bld = get_flt_bld(bld_base, bit_size);
+      break;
+   case nir_type_int:
+      bld = get_int_bld(bld_base, false, bit_size);
+      break;
+   default:
+      bld = get_int_bld(bld_base, true, bit_size);
+      break;
+   }
+   return LLVMBuildBitCast(builder, val, bld->vec_type, "");
+}
+
+
+static void
+assign_ssa(struct lp_build_nir_context *bld_base,
+           const nir_ssa_def *ssa,
+           LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS])
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *uint_bld =
+      get_int_bld(bld_base, true, ssa->bit_size);
+   unsigned i;
+
+   for (i = 0; i < ssa->num_components; i++) {
+      bld_base->ssa_defs[ssa->index][i] =
+         LLVMBuildBitCast(builder, vals[i], uint_bld->vec_type, "");
+   }
+}
+
+
+static void
+assign_reg(struct lp_build_nir_context *bld_base,
+           const nir_reg_dest *reg,
+           unsigned writemask,
+           LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS])
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct hash_entry *entry = _mesa_hash_table_search(bld_base->regs,
+                                                      reg->reg);
+   struct lp_build_context *reg_bld =
+      get_int_bld(bld_base, true, reg->reg->bit_size);
+   LLVMValueRef indir_src = NULL;
+   LLVMValueRef dst[NIR_MAX_VEC_COMPONENTS] = { NULL };
+   unsigned i;
+
+   if (reg->indirect) {
+      LLVMValueRef indir[NIR_MAX_VEC_COMPONENTS];
+      LLVMValueRef *src = NULL;
+
+      assert(reg->indirect->is_ssa);
+      src = bld_base->ssa_defs[reg->indirect->ssa->index];
+      memcpy(indir, src, sizeof(indir));
+      indir_src = cast_type(bld_base, indir[0], nir_type_uint, 32);
+   }
+
+   for (i = 0; i < reg->reg->num_components; i++) {
+      if (writemask & (1 << i))
+         dst[i] = LLVMBuildBitCast(builder, vals[i], reg_bld->vec_type, "");
+   }
+
+   bld_base->store_reg(bld_base, reg_bld, reg, writemask, indir_src,
+                       entry->data, dst);
+}
+
+
+static void
+assign_dest(struct lp_build_nir_context *bld_base,
+            const nir_dest *dest,
+            LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS])
+{
+   if (dest->is_ssa)
+      assign_ssa(bld_base, &dest->ssa, vals);
+   else
+      assign_reg(bld_base, &dest->reg,
+                 (1 << dest->reg.reg->num_components) - 1, vals);
+}
+
+
+static void
+get_src(struct lp_build_nir_context *bld_base,
+        nir_src src,
+        LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   if (src.is_ssa) {
+      memcpy(result, bld_base->ssa_defs[src.ssa->index],
+             sizeof(result[0]) * NIR_MAX_VEC_COMPONENTS);
+   } else {
+      const nir_reg_src *reg = &src.reg;
+      struct hash_entry *entry = _mesa_hash_table_search(bld_base->regs,
+                                                         reg->reg);
+      struct lp_build_context *reg_bld =
+         get_int_bld(bld_base, true, reg->reg->bit_size);
+      LLVMValueRef indir_src = NULL;
+
+      if (reg->indirect) {
+         LLVMValueRef indir[NIR_MAX_VEC_COMPONENTS];
+         get_src(bld_base, *reg->indirect, indir);
+         indir_src = cast_type(bld_base, indir[0], nir_type_uint, 32);
+      }
+      bld_base->load_reg(bld_base, reg_bld, reg, indir_src,
+                         entry->data, result);
+   }
+}
+
+
+/**
+ * Fetch the first component of a source, as the given type.
+ */
+static LLVMValueRef
+get_src_chan0(struct lp_build_nir_context *bld_base,
+              nir_src src,
+              nir_alu_type type)
+{
+   LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS];
+
+   get_src(bld_base, src, vals);
+   return cast_type(bld_base, vals[0], type, nir_src_bit_size(src));
+}
+
+
+static LLVMValueRef
+get_alu_src(struct lp_build_nir_context *bld_base,
+            nir_alu_src src,
+            unsigned chan)
+{
+   LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS];
+
+   assert(!src.abs && !src.negate);
+   get_src(bld_base, src.src, vals);
+   return vals[src.swizzle[chan]];
+}
+
+
+/**
+ * Turn a 32 bit or 64 bit comparison mask into a 32 bit boolean.
+ */
+static LLVMValueRef
+mask_to_bool32(struct lp_build_nir_context *bld_base,
+               LLVMValueRef mask,
+               unsigned src_bit_size)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+
+   if (src_bit_size == 64)
+      return LLVMBuildTrunc(builder, mask, bld_base->int_bld.vec_type, "");
+   return mask;
+}
+
+
+static LLVMValueRef
+fcmp32(struct lp_build_nir_context *bld_base,
+       enum pipe_compare_func compare,
+       unsigned src_bit_size,
+       LLVMValueRef src[NIR_MAX_VEC_COMPONENTS])
+{
+   struct lp_build_context *flt_bld = get_flt_bld(bld_base, src_bit_size);
+   LLVMValueRef result;
+
+   /* Only != is true when either side is NaN */
+   if (compare != PIPE_FUNC_NOTEQUAL)
+      result = lp_build_cmp_ordered(flt_bld, compare, src[0], src[1]);
+   else
+      result = lp_build_cmp(flt_bld, compare, src[0], src[1]);
+
+   return mask_to_bool32(bld_base, result, src_bit_size);
+}
+
+
+static LLVMValueRef
+icmp32(struct lp_build_nir_context *bld_base,
+       enum pipe_compare_func compare,
+       bool is_unsigned,
+       unsigned src_bit_size,
+       LLVMValueRef src[NIR_MAX_VEC_COMPONENTS])
+{
+   struct lp_build_context *i_bld =
+      get_int_bld(bld_base, is_unsigned, src_bit_size);
+   LLVMValueRef result = lp_build_cmp(i_bld, compare, src[0], src[1]);
+
+   return mask_to_bool32(bld_base, result, src_bit_size);
+}
+
+
+static LLVMValueRef
+emit_b2f(struct lp_build_nir_context *bld_base,
+         LLVMValueRef src0,
+         unsigned bitsize)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef result =
+      LLVMBuildAnd(builder, cast_type(bld_base, src0, nir_type_int, 32),
+                   LLVMBuildBitCast(builder,
+                                    lp_build_const_vec(bld_base->base.gallivm,
+                                                       bld_base->base.type,
+                                                       1.0),
+                                    bld_base->int_bld.vec_type, ""),
+                   "");
+
+   result = LLVMBuildBitCast(builder, result, bld_base->base.vec_type, "");
+   if (bitsize == 64)
+      result = LLVMBuildFPExt(builder, result, bld_base->dbl_bld.vec_type, "");
+   return result;
+}
+
+
+static LLVMValueRef
+emit_b2i(struct lp_build_nir_context *bld_base,
+         LLVMValueRef src0,
+         unsigned bitsize)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef result =
+      LLVMBuildAnd(builder, cast_type(bld_base, src0, nir_type_int, 32),
+                   lp_build_const_int_vec(bld_base->base.gallivm,
+                                          bld_base->int_bld.type, 1), "");
+
+   if (bitsize == 64)
+      result = LLVMBuildZExt(builder, result, bld_base->int64_bld.vec_type, "");
+   return result;
+}
+
+
+static LLVMValueRef
+emit_b32csel(struct lp_build_nir_context *bld_base,
+             unsigned src_bit_size[NIR_MAX_VEC_COMPONENTS],
+             LLVMValueRef src[NIR_MAX_VEC_COMPONENTS])
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *bld = get_int_bld(bld_base, false, src_bit_size[1]);
+   LLVMValueRef sel = cast_type(bld_base, src[0], nir_type_int, 32);
+
+   sel = lp_build_cmp(&bld_base->int_bld, PIPE_FUNC_NOTEQUAL, sel,
+                      bld_base->int_bld.zero);
+   if (src_bit_size[1] == 64)
+      sel = LLVMBuildSExt(builder, sel, bld_base->int64_bld.vec_type, "");
+
+   return lp_build_select(bld, sel,
+                          cast_type(bld_base, src[1], nir_type_int,
+                                    src_bit_size[1]),
+                          cast_type(bld_base, src[2], nir_type_int,
+                                    src_bit_size[2]));
+}
+
+
+/**
+ * Integer division and modulo, with the division by zero guard of the TGSI
+ * translation: x / 0 is ~0 and x % 0 is ~0 for unsigned types, and the
+ * value doesn't matter for signed ones as long as it doesn't trap.
+ */
+static LLVMValueRef
+do_int_divide(struct lp_build_nir_context *bld_base,
+              bool is_unsigned,
+              unsigned src_bit_size,
+              LLVMValueRef src,
+              LLVMValueRef src2)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *int_bld =
+      get_int_bld(bld_base, is_unsigned, src_bit_size);
+   struct lp_build_context *mask_bld = get_int_bld(bld_base, true, src_bit_size);
+   LLVMValueRef div_mask = lp_build_cmp(mask_bld, PIPE_FUNC_EQUAL, src2,
+                                        mask_bld->zero);
+   LLVMValueRef divisor = LLVMBuildOr(builder, div_mask, src2, "");
+   LLVMValueRef result = lp_build_div(int_bld, src, divisor);
+
+   if (!is_unsigned) {
+      LLVMValueRef not_div_mask = LLVMBuildNot(builder, div_mask, "");
+      return LLVMBuildAnd(builder, not_div_mask, result, "");
+   } else {
+      /* udiv by zero is guaranteed to return 0xffffffff at least with d3d10
+       * may as well do same for idiv */
+      return LLVMBuildOr(builder, div_mask, result, "");
+   }
+}
+
+
+static LLVMValueRef
+do_int_mod(struct lp_build_nir_context *bld_base,
+           bool is_unsigned,
+           unsigned src_bit_size,
+           LLVMValueRef src,
+           LLVMValueRef src2)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *int_bld =
+      get_int_bld(bld_base, is_unsigned, src_bit_size);
+   struct lp_build_context *mask_bld = get_int_bld(bld_base, true, src_bit_size);
+   LLVMValueRef div_mask = lp_build_cmp(mask_bld, PIPE_FUNC_EQUAL, src2,
+                                        mask_bld->zero);
+   LLVMValueRef divisor = LLVMBuildOr(builder, div_mask, src2, "");
+   LLVMValueRef result = lp_build_mod(int_bld, src, divisor);
+
+   return LLVMBuildOr(builder, div_mask, result, "");
+}
+
+
+/**
+ * imod: like irem, but the result takes the sign of the divisor.
+ */
+static LLVMValueRef
+do_imod(struct lp_build_nir_context *bld_base,
+        unsigned src_bit_size,
+        LLVMValueRef src,
+        LLVMValueRef src2)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *int_bld = get_int_bld(bld_base, false, src_bit_size);
+   LLVMValueRef rem = do_int_mod(bld_base, false, src_bit_size, src, src2);
+   LLVMValueRef nonzero = lp_build_cmp(int_bld, PIPE_FUNC_NOTEQUAL, rem,
+                                       int_bld->zero);
+   LLVMValueRef sign_differs =
+      lp_build_cmp(int_bld, PIPE_FUNC_LESS,
+                   LLVMBuildXor(builder, rem, src2, ""), int_bld->zero);
+   LLVMValueRef adjust = LLVMBuildAnd(builder, nonzero, sign_differs, "");
+
+   return lp_build_select(int_bld, adjust,
+                          lp_build_add(int_bld, rem, src2), rem);
+}
+
+
+/**
+ * Shifts only use the low bits of the shift count, like GLSL expects and
+ * unlike LLVM, for which shifting by the bit size or more is undefined.
+ */
+static LLVMValueRef
+do_shift(struct lp_build_nir_context *bld_base,
+         nir_op op,
+         unsigned src_bit_size,
+         LLVMValueRef src,
+         LLVMValueRef count)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *bld =
+      get_int_bld(bld_base, op != nir_op_ishr, src_bit_size);
+   struct lp_build_context *count_bld = get_int_bld(bld_base, true, 32);
+
+   count = LLVMBuildAnd(builder, count,
+                        lp_build_const_int_vec(bld_base->base.gallivm,
+                                               count_bld->type,
+                                               src_bit_size - 1), "");
+   if (src_bit_size == 64)
+      count = LLVMBuildZExt(builder, count, bld->vec_type, "");
+   else
+      count = LLVMBuildBitCast(builder, count, bld->vec_type, "");
+
+   if (op == nir_op_ishl)
+      return lp_build_shl(bld, src, count);
+   return lp_build_shr(bld, src, count);
+}
+
+
+static LLVMValueRef
+do_int_intrinsic(struct lp_build_nir_context *bld_base,
+                 const char *root,
+                 LLVMValueRef src,
+                 bool with_flag)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMTypeRef type = bld_base->uint_bld.vec_type;
+   char intrinsic[64];
+   LLVMValueRef args[2];
+
+   lp_format_intrinsic(intrinsic, sizeof intrinsic, root, type);
+   args[0] = src;
+   /* ctlz/cttz: zero is not undefined */
+   args[1] = LLVMConstInt(LLVMInt1TypeInContext(gallivm->context), 0, 0);
+   return lp_build_intrinsic(gallivm->builder, intrinsic, type, args,
+                             with_flag ? 2 : 1, 0);
+}
+
+
+static LLVMValueRef
+emit_find_msb(struct lp_build_nir_context *bld_base,
+              bool is_signed,
+              LLVMValueRef src)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef lz;
+
+   if (is_signed) {
+      /* for negative values, look for the most significant zero */
+      LLVMValueRef neg = lp_build_cmp(&bld_base->int_bld, PIPE_FUNC_LESS,
+                                      cast_type(bld_base, src,
+                                                nir_type_int, 32),
+                                      bld_base->int_bld.zero);
+      src = LLVMBuildXor(builder, src, neg, "");
+   }
+
+   /* 31 - ctlz(x), which is -1 for 0 since ctlz(0) is 32 */
+   lz = do_int_intrinsic(bld_base, "llvm.ctlz", src, true);
+   return LLVMBuildSub(builder,
+                       lp_build_const_int_vec(bld_base->base.gallivm,
+                                              uint_bld->type, 31),
+                       lz, "");
+}
+
+
+static LLVMValueRef
+emit_find_lsb(struct lp_build_nir_context *bld_base,
+              LLVMValueRef src)
+{
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef tz = do_int_intrinsic(bld_base, "llvm.cttz", src, true);
+   LLVMValueRef is_zero = lp_build_cmp(uint_bld, PIPE_FUNC_EQUAL, src,
+                                       uint_bld->zero);
+
+   return lp_build_select(uint_bld, is_zero,
+                          lp_build_const_int_vec(bld_base->base.gallivm,
+                                                 uint_bld->type, -1), tz);
+}
+
+
+static LLVMValueRef
+emit_pack_64_2x32(struct lp_build_nir_context *bld_base,
+                  LLVMValueRef lo,
+                  LLVMValueRef hi)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMTypeRef vec_type = bld_base->uint64_bld.vec_type;
+
+   lo = LLVMBuildZExt(builder, lo, vec_type, "");
+   hi = LLVMBuildZExt(builder, hi, vec_type, "");
+   hi = LLVMBuildShl(builder, hi,
+                     lp_build_const_int_vec(bld_base->base.gallivm,
+                                            bld_base->uint64_bld.type, 32), "");
+   return LLVMBuildOr(builder, lo, hi, "");
+}
+
+
+static LLVMValueRef
+emit_unpack_64_2x32(struct lp_build_nir_context *bld_base,
+                    LLVMValueRef src,
+                    bool high)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+
+   if (high)
+      src = LLVMBuildLShr(builder, src,
+                          lp_build_const_int_vec(bld_base->base.gallivm,
+                                                 bld_base->uint64_bld.type,
+                                                 32), "");
+   return LLVMBuildTrunc(builder, src, bld_base->uint_bld.vec_type, "");
+}
+
+
+static LLVMValueRef
+emit_pack_half_2x16(struct lp_build_nir_context *bld_base,
+                    LLVMValueRef x,
+                    LLVMValueRef y)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef vec_type = bld_base->uint_bld.vec_type;
+
+   x = LLVMBuildZExt(builder, lp_build_float_to_half(gallivm, x), vec_type, "");
+   y = LLVMBuildZExt(builder, lp_build_float_to_half(gallivm, y), vec_type, "");
+   y = LLVMBuildShl(builder, y,
+                    lp_build_const_int_vec(gallivm, bld_base->uint_bld.type,
+                                           16), "");
+   return LLVMBuildOr(builder, x, y, "");
+}
+
+
+static LLVMValueRef
+emit_unpack_half_2x16(struct lp_build_nir_context *bld_base,
+                      LLVMValueRef src,
+                      bool high)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i16_vec_type =
+      LLVMVectorType(LLVMInt16TypeInContext(gallivm->context),
+                     bld_base->base.type.length);
+
+   if (high)
+      src = LLVMBuildLShr(builder, src,
+                          lp_build_const_int_vec(gallivm,
+                                                 bld_base->uint_bld.type,
+                                                 16), "");
+   src = LLVMBuildTrunc(builder, src, i16_vec_type, "");
+   return lp_build_half_to_float(gallivm, src);
+}
+
+
+static LLVMValueRef
+do_alu_action(struct lp_build_nir_context *bld_base,
+              nir_op op,
+              unsigned src_bit_size[NIR_MAX_VEC_COMPONENTS],
+              LLVMValueRef src[NIR_MAX_VEC_COMPONENTS])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef result;
+
+   switch (op) {
+   case nir_op_b2f32:
+      result = emit_b2f(bld_base, src[0], 32);
+      break;
+   case nir_op_b2f64:
+      result = emit_b2f(bld_base, src[0], 64);
+      break;
+   case nir_op_b2i32:
+      result = emit_b2i(bld_base, src[0], 32);
+      break;
+   case nir_op_b2i64:
+      result = emit_b2i(bld_base, src[0], 64);
+      break;
+   case nir_op_b32csel:
+      result = emit_b32csel(bld_base, src_bit_size, src);
+      break;
+   case nir_op_bit_count:
+      result = do_int_intrinsic(bld_base, "llvm.ctpop", src[0], false);
+      break;
+   case nir_op_bitfield_reverse:
+      result = do_int_intrinsic(bld_base, "llvm.bitreverse", src[0], false);
+      break;
+   case nir_op_f2b32:
+      result = fcmp32(bld_base, PIPE_FUNC_NOTEQUAL, src_bit_size[0],
+                      (LLVMValueRef[]){ src[0],
+                                        get_flt_bld(bld_base,
+                                                    src_bit_size[0])->zero });
+      break;
+   case nir_op_f2f32:
+      result = LLVMBuildFPTrunc(builder, src[0],
+                                bld_base->base.vec_type, "");
+      break;
+   case nir_op_f2f64:
+      result = LLVMBuildFPExt(builder, src[0],
+                              bld_base->dbl_bld.vec_type, "");
+      break;
+   case nir_op_f2i32:
+      result = LLVMBuildFPToSI(builder, src[0], bld_base->int_bld.vec_type, "");
+      break;
+   case nir_op_f2u32:
+      result = LLVMBuildFPToUI(builder, src[0],
+                               bld_base->uint_bld.vec_type, "");
+      break;
+   case nir_op_f2i64:
+      result = LLVMBuildFPToSI(builder, src[0],
+                               bld_base->int64_bld.vec_type, "");
+      break;
+   case nir_op_f2u64:
+      result = LLVMBuildFPToUI(builder, src[0],
+                               bld_base->uint64_bld.vec_type, "");
+      break;
+   case nir_op_fabs:
+      result = lp_build_abs(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_fadd:
+      result = lp_build_add(get_flt_bld(bld_base, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_fceil:
+      result = lp_build_ceil(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_fcos:
+      result = lp_build_cos(&bld_base->base, src[0]);
+      break;
+   case nir_op_fddx:
+   case nir_op_fddx_coarse:
+   case nir_op_fddx_fine:
+      result = lp_build_ddx(&bld_base->base, src[0]);
+      break;
+   case nir_op_fddy:
+   case nir_op_fddy_coarse:
+   case nir_op_fddy_fine:
+      result = lp_build_ddy(&bld_base->base, src[0]);
+      break;
+   case nir_op_fdiv:
+      result = lp_build_div(get_flt_bld(bld_base, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_feq32:
+      result = fcmp32(bld_base, PIPE_FUNC_EQUAL, src_bit_size[0], src);
+      break;
+   case nir_op_fexp2:
+      result = lp_build_exp2(&bld_base->base, src[0]);
+      break;
+   case nir_op_ffloor:
+      result = lp_build_floor(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_ffma:
+      result = lp_build_mad(get_flt_bld(bld_base, src_bit_size[0]),
+                            src[0], src[1], src[2]);
+      break;
+   case nir_op_ffract:
+      result = lp_build_fract(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_fge32:
+      result = fcmp32(bld_base, PIPE_FUNC_GEQUAL, src_bit_size[0], src);
+      break;
+   case nir_op_flog2:
+      result = lp_build_log2_safe(&bld_base->base, src[0]);
+      break;
+   case nir_op_flt32:
+      result = fcmp32(bld_base, PIPE_FUNC_LESS, src_bit_size[0], src);
+      break;
+   case nir_op_fmax:
+      result = lp_build_max_ext(get_flt_bld(bld_base, src_bit_size[0]),
+                                src[0], src[1], GALLIVM_NAN_RETURN_OTHER);
+      break;
+   case nir_op_fmin:
+      result = lp_build_min_ext(get_flt_bld(bld_base, src_bit_size[0]),
+                                src[0], src[1], GALLIVM_NAN_RETURN_OTHER);
+      break;
+   case nir_op_fmul:
+      result = lp_build_mul(get_flt_bld(bld_base, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_fne32:
+      result = fcmp32(bld_base, PIPE_FUNC_NOTEQUAL, src_bit_size[0], src);
+      break;
+   case nir_op_fneg:
+      result = lp_build_negate(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_fpow:
+      result = lp_build_pow(&bld_base->base, src[0], src[1]);
+      break;
+   case nir_op_frcp:
+      result = src_bit_size[0] == 64 ?
+         lp_build_div(&bld_base->dbl_bld, bld_base->dbl_bld.one, src[0]) :
+         lp_build_rcp(&bld_base->base, src[0]);
+      break;
+   case nir_op_fround_even:
+      result = lp_build_round(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_frsq:
+      result = src_bit_size[0] == 64 ?
+         lp_build_div(&bld_base->dbl_bld, bld_base->dbl_bld.one,
+                      lp_build_sqrt(&bld_base->dbl_bld, src[0])) :
+         lp_build_rsqrt(&bld_base->base, src[0]);
+      break;
+   case nir_op_fsat:
+      result = lp_build_clamp_zero_one_nanzero(get_flt_bld(bld_base,
+                                                           src_bit_size[0]),
+                                               src[0]);
+      break;
+   case nir_op_fsign:
+      result = lp_build_sgn(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_fsin:
+      result = lp_build_sin(&bld_base->base, src[0]);
+      break;
+   case nir_op_fsqrt:
+      result = lp_build_sqrt(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_fsub:
+      result = lp_build_sub(get_flt_bld(bld_base, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_ftrunc:
+      result = lp_build_trunc(get_flt_bld(bld_base, src_bit_size[0]), src[0]);
+      break;
+   case nir_op_i2b32:
+      result = icmp32(bld_base, PIPE_FUNC_NOTEQUAL, false, src_bit_size[0],
+                      (LLVMValueRef[]){ src[0],
+                                        get_int_bld(bld_base, false,
+                                                    src_bit_size[0])->zero });
+      break;
+   case nir_op_i2f32:
+      result = LLVMBuildSIToFP(builder, src[0], bld_base->base.vec_type, "");
+      break;
+   case nir_op_i2f64:
+      result = LLVMBuildSIToFP(builder, src[0], bld_base->dbl_bld.vec_type, "");
+      break;
+   case nir_op_i2i32:
+   case nir_op_u2u32:
+      result = LLVMBuildTrunc(builder, src[0], bld_base->int_bld.vec_type, "");
+      break;
+   case nir_op_i2i64:
+      result = LLVMBuildSExt(builder, src[0], bld_base->int64_bld.vec_type, "");
+      break;
+   case nir_op_u2u64:
+      result = LLVMBuildZExt(builder, src[0],
+                             bld_base->uint64_bld.vec_type, "");
+      break;
+   case nir_op_iabs:
+      result = lp_build_abs(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0]);
+      break;
+   case nir_op_iadd:
+      result = lp_build_add(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_iand:
+      result = lp_build_and(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_idiv:
+      result = do_int_divide(bld_base, false, src_bit_size[0], src[0], src[1]);
+      break;
+   case nir_op_ieq32:
+      result = icmp32(bld_base, PIPE_FUNC_EQUAL, false, src_bit_size[0], src);
+      break;
+   case nir_op_ige32:
+      result = icmp32(bld_base, PIPE_FUNC_GEQUAL, false, src_bit_size[0], src);
+      break;
+   case nir_op_ilt32:
+      result = icmp32(bld_base, PIPE_FUNC_LESS, false, src_bit_size[0], src);
+      break;
+   case nir_op_imax:
+      result = lp_build_max(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_imin:
+      result = lp_build_min(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_imod:
+      result = do_imod(bld_base, src_bit_size[0], src[0], src[1]);
+      break;
+   case nir_op_imul:
+      result = lp_build_mul(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_imul_high: {
+      LLVMValueRef hi;
+      lp_build_mul_32_lohi(&bld_base->int_bld, src[0], src[1], &hi);
+      result = hi;
+      break;
+   }
+   case nir_op_ine32:
+      result = icmp32(bld_base, PIPE_FUNC_NOTEQUAL, false, src_bit_size[0],
+                      src);
+      break;
+   case nir_op_ineg:
+      result = lp_build_negate(get_int_bld(bld_base, false, src_bit_size[0]),
+                               src[0]);
+      break;
+   case nir_op_inot:
+      result = lp_build_not(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0]);
+      break;
+   case nir_op_ior:
+      result = lp_build_or(get_int_bld(bld_base, false, src_bit_size[0]),
+                           src[0], src[1]);
+      break;
+   case nir_op_irem:
+      result = do_int_mod(bld_base, false, src_bit_size[0], src[0], src[1]);
+      break;
+   case nir_op_ishl:
+   case nir_op_ishr:
+   case nir_op_ushr:
+      result = do_shift(bld_base, op, src_bit_size[0], src[0], src[1]);
+      break;
+   case nir_op_isign:
+      result = lp_build_sgn(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0]);
+      break;
+   case nir_op_isub:
+      result = lp_build_sub(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_ixor:
+      result = lp_build_xor(get_int_bld(bld_base, false, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_mov:
+      result = src[0];
+      break;
+   case nir_op_find_lsb:
+      result = emit_find_lsb(bld_base, src[0]);
+      break;
+   case nir_op_ifind_msb:
+      result = emit_find_msb(bld_base, true, src[0]);
+      break;
+   case nir_op_ufind_msb:
+      result = emit_find_msb(bld_base, false, src[0]);
+      break;
+   case nir_op_pack_64_2x32_split:
+      result = emit_pack_64_2x32(bld_base, src[0], src[1]);
+      break;
+   case nir_op_unpack_64_2x32_split_x:
+      result = emit_unpack_64_2x32(bld_base, src[0], false);
+      break;
+   case nir_op_unpack_64_2x32_split_y:
+      result = emit_unpack_64_2x32(bld_base, src[0], true);
+      break;
+   case nir_op_pack_half_2x16_split:
+      result = emit_pack_half_2x16(bld_base, src[0], src[1]);
+      break;
+   case nir_op_unpack_half_2x16_split_x:
+      result = emit_unpack_half_2x16(bld_base, src[0], false);
+      break;
+   case nir_op_unpack_half_2x16_split_y:
+      result = emit_unpack_half_2x16(bld_base, src[0], true);
+      break;
+   case nir_op_u2f32:
+      result = LLVMBuildUIToFP(builder, src[0], bld_base->base.vec_type, "");
+      break;
+   case nir_op_u2f64:
+      result = LLVMBuildUIToFP(builder, src[0], bld_base->dbl_bld.vec_type, "");
+      break;
+   case nir_op_udiv:
+      result = do_int_divide(bld_base, true, src_bit_size[0], src[0], src[1]);
+      break;
+   case nir_op_uge32:
+      result = icmp32(bld_base, PIPE_FUNC_GEQUAL, true, src_bit_size[0], src);
+      break;
+   case nir_op_ult32:
+      result = icmp32(bld_base, PIPE_FUNC_LESS, true, src_bit_size[0], src);
+      break;
+   case nir_op_umax:
+      result = lp_build_max(get_int_bld(bld_base, true, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_umin:
+      result = lp_build_min(get_int_bld(bld_base, true, src_bit_size[0]),
+                            src[0], src[1]);
+      break;
+   case nir_op_umod:
+      result = do_int_mod(bld_base, true, src_bit_size[0], src[0], src[1]);
+      break;
+   case nir_op_umul_high: {
+      LLVMValueRef hi;
+      lp_build_mul_32_lohi(&bld_base->uint_bld, src[0], src[1], &hi);
+      result = hi;
+      break;
+   }
+   default:
+      debug_printf("gallivm: unhandled NIR opcode %s\n", nir_op_infos[op].name);
+      assert(0);
+      result = bld_base->uint_bld.undef;
+      break;
+   }
+   return result;
+}
+
+
+static void
+visit_alu(struct lp_build_nir_context *bld_base,
+          const nir_alu_instr *instr)
+{
+   const nir_op_info *info = &nir_op_infos[instr->op];
+   unsigned num_components = nir_dest_num_components(instr->dest.dest);
+   unsigned dst_bit_size = nir_dest_bit_size(instr->dest.dest);
+   unsigned src_bit_size[NIR_MAX_VEC_COMPONENTS];
+   LLVMValueRef src[NIR_MAX_VEC_COMPONENTS];
+   LLVMValueRef result[NIR_MAX_VEC_COMPONENTS] = { NULL };
+   unsigned writemask = instr->dest.dest.is_ssa ?
+      (1 << num_components) - 1 : instr->dest.write_mask;
+   unsigned c, i;
+
+   assert(!instr->dest.saturate);
+
+   for (i = 0; i < info->num_inputs; i++)
+      src_bit_size[i] = nir_src_bit_size(instr->src[i].src);
+
+   switch (instr->op) {
+   case nir_op_vec2:
+   case nir_op_vec3:
+   case nir_op_vec4:
+      for (i = 0; i < info->num_inputs; i++)
+         result[i] = get_alu_src(bld_base, instr->src[i], 0);
+      break;
+   default:
+      for (c = 0; c < num_components; c++) {
+         if (!(writemask & (1 << c)))
+            continue;
+         for (i = 0; i < info->num_inputs; i++) {
+            /* everything but vecN is scalar after nir_lower_alu_to_scalar */
+            assert(info->input_sizes[i] == 0);
+            src[i] = cast_type(bld_base,
+                               get_alu_src(bld_base, instr->src[i], c),
+                               info->input_types[i], src_bit_size[i]);
+         }
+         result[c] = do_alu_action(bld_base, instr->op, src_bit_size, src);
+         result[c] = cast_type(bld_base, result[c], nir_type_uint,
+                               dst_bit_size);
+      }
+      break;
+   }
+
+   if (instr->dest.dest.is_ssa)
+      assign_ssa(bld_base, &instr->dest.dest.ssa, result);
+   else
+      assign_reg(bld_base, &instr->dest.dest.reg, writemask, result);
+}
+
+
+static void
+visit_load_const(struct lp_build_nir_context *bld_base,
+                 const nir_load_const_instr *instr)
+{
+   LLVMValueRef result[NIR_MAX_VEC_COMPONENTS];
+   struct lp_build_context *int_bld =
+      get_int_bld(bld_base, true, instr->def.bit_size);
+   unsigned i;
+
+   for (i = 0; i < instr->def.num_components; i++) {
+      uint64_t value = instr->def.bit_size == 64 ? instr->value[i].u64 :
+                                                   instr->value[i].u32;
+      result[i] = lp_build_const_int_vec(bld_base->base.gallivm,
+                                         int_bld->type, value);
+   }
+   assign_ssa(bld_base, &instr->def, result);
+}
+
+
+static void
+visit_ssa_undef(struct lp_build_nir_context *bld_base,
+                const nir_ssa_undef_instr *instr)
+{
+   LLVMValueRef undef[NIR_MAX_VEC_COMPONENTS];
+   struct lp_build_context *int_bld =
+      get_int_bld(bld_base, true, instr->def.bit_size);
+   unsigned i;
+
+   for (i = 0; i < instr->def.num_components; i++)
+      undef[i] = int_bld->undef;
+   assign_ssa(bld_base, &instr->def, undef);
+}
+
+
+/**
+ * Get the variable and the constant slot offset of an input or output
+ * deref.  Indirect indexing of inputs and outputs is lowered by
+ * lp_build_opt_nir(), except for the vertex index of per-vertex inputs,
+ * which must be constant too.
+ */
+static nir_variable *
+get_deref_offset(struct lp_build_nir_context *bld_base,
+                 nir_deref_instr *instr,
+                 bool vs_in,
+                 unsigned *vertex_index_out,
+                 unsigned *const_out)
+{
+   nir_variable *var = nir_deref_instr_get_variable(instr);
+   nir_deref_path path;
+   unsigned idx_lvl = 1;
+   unsigned const_offset = 0;
+
+   nir_deref_path_init(&path, instr, NULL);
+
+   if (vertex_index_out != NULL) {
+      *vertex_index_out = nir_src_as_uint(path.path[idx_lvl]->arr.index);
+      ++idx_lvl;
+   }
+
+   for (; path.path[idx_lvl]; ++idx_lvl) {
+      const struct glsl_type *parent_type = path.path[idx_lvl - 1]->type;
+
+      if (path.path[idx_lvl]->deref_type == nir_deref_type_struct) {
+         unsigned index = path.path[idx_lvl]->strct.index;
+         unsigned i;
+
+         for (i = 0; i < index; i++) {
+            const struct glsl_type *ft = glsl_get_struct_field(parent_type, i);
+            const_offset += glsl_count_attribute_slots(ft, vs_in);
+         }
+      } else {
+         assert(path.path[idx_lvl]->deref_type == nir_deref_type_array);
+         const_offset += nir_src_as_uint(path.path[idx_lvl]->arr.index) *
+            glsl_count_attribute_slots(path.path[idx_lvl]->type, vs_in);
+      }
+   }
+
+   nir_deref_path_finish(&path);
+   *const_out = const_offset;
+   return var;
+}
+
+
+static bool
+is_per_vertex_input(const struct lp_build_nir_context *bld_base,
+                    const nir_variable *var)
+{
+   return var->data.mode == nir_var_shader_in &&
+          bld_base->shader->info.stage == MESA_SHADER_GEOMETRY;
+}
+
+
+static void
+visit_load_var(struct lp_build_nir_context *bld_base,
+               nir_intrinsic_instr *instr,
+               LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   nir_deref_instr *deref = nir_instr_as_deref(instr->src[0].ssa->parent_instr);
+   nir_variable *var = nir_deref_instr_get_variable(deref);
+   bool per_vertex = is_per_vertex_input(bld_base, var);
+   unsigned vertex_index = 0;
+   unsigned const_index;
+
+   get_deref_offset(bld_base, deref,
+                    bld_base->shader->info.stage == MESA_SHADER_VERTEX &&
+                    var->data.mode == nir_var_shader_in,
+                    per_vertex ? &vertex_index : NULL, &const_index);
+
+   bld_base->load_var(bld_base, var->data.mode, nir_dest_num_components(instr->dest),
+                      nir_dest_bit_size(instr->dest), var, vertex_index,
+                      const_index, result);
+}
+
+
+static void
+visit_store_var(struct lp_build_nir_context *bld_base,
+                nir_intrinsic_instr *instr)
+{
+   nir_deref_instr *deref = nir_instr_as_deref(instr->src[0].ssa->parent_instr);
+   nir_variable *var = nir_deref_instr_get_variable(deref);
+   unsigned writemask = nir_intrinsic_write_mask(instr);
+   unsigned bit_size = nir_src_bit_size(instr->src[1]);
+   LLVMValueRef src[NIR_MAX_VEC_COMPONENTS];
+   unsigned const_index;
+   unsigned i;
+
+   assert(var->data.mode == nir_var_shader_out);
+   get_deref_offset(bld_base, deref, false, NULL, &const_index);
+
+   get_src(bld_base, instr->src[1], src);
+   for (i = 0; i < nir_src_num_components(instr->src[1]); i++) {
+      if (writemask & (1 << i))
+         bld_base->store_var(bld_base, var->data.mode, 1, bit_size, var,
+                             1 << i, const_index, src[i]);
+   }
+}
+
+
+static void
+visit_load_ubo(struct lp_build_nir_context *bld_base,
+               nir_intrinsic_instr *instr,
+               LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef idx = get_src_chan0(bld_base, instr->src[0], nir_type_uint);
+   LLVMValueRef offset = get_src_chan0(bld_base, instr->src[1], nir_type_uint);
+   bool offset_is_uniform = nir_src_is_dynamically_uniform(instr->src[1]);
+
+   /* Constant buffer 0 holds the default uniform block */
+   idx = LLVMBuildExtractElement(builder, idx,
+                                 lp_build_const_int32(gallivm, 0), "");
+   idx = LLVMBuildAdd(builder, idx, lp_build_const_int32(gallivm, 1), "");
+
+   bld_base->load_ubo(bld_base, nir_dest_num_components(instr->dest),
+                      nir_dest_bit_size(instr->dest), offset_is_uniform,
+                      idx, offset, result);
+}
+
+
+static void
+visit_load_uniform(struct lp_build_nir_context *bld_base,
+                   nir_intrinsic_instr *instr,
+                   LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef offset = get_src_chan0(bld_base, instr->src[0], nir_type_uint);
+   bool offset_is_uniform = nir_src_is_dynamically_uniform(instr->src[0]);
+
+   /* The offset and the base are in vec4 slots */
+   offset = lp_build_add(uint_bld, offset,
+                         lp_build_const_int_vec(gallivm, uint_bld->type,
+                                                nir_intrinsic_base(instr)));
+   offset = lp_build_shl_imm(uint_bld, offset, 4);
+
+   bld_base->load_ubo(bld_base, nir_dest_num_components(instr->dest),
+                      nir_dest_bit_size(instr->dest), offset_is_uniform,
+                      lp_build_const_int32(gallivm, 0), offset, result);
+}
+
+
+static LLVMValueRef
+get_shared_offset(struct lp_build_nir_context *bld_base,
+                  nir_intrinsic_instr *instr,
+                  nir_src src)
+{
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef offset = get_src_chan0(bld_base, src, nir_type_uint);
+
+   return lp_build_add(uint_bld, offset,
+                       lp_build_const_int_vec(bld_base->base.gallivm,
+                                              uint_bld->type,
+                                              nir_intrinsic_base(instr)));
+}
+
+
+static LLVMValueRef
+get_buffer_index(struct lp_build_nir_context *bld_base,
+                 nir_src src)
+{
+   /* Buffer indices are dynamically uniform */
+   return LLVMBuildExtractElement(bld_base->base.gallivm->builder,
+                                  get_src_chan0(bld_base, src, nir_type_uint),
+                                  lp_build_const_int32(bld_base->base.gallivm,
+                                                       0), "");
+}
+
+
+static void
+visit_load_ssbo(struct lp_build_nir_context *bld_base,
+                nir_intrinsic_instr *instr,
+                LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   LLVMValueRef idx = get_buffer_index(bld_base, instr->src[0]);
+   LLVMValueRef offset = get_src_chan0(bld_base, instr->src[1], nir_type_uint);
+
+   bld_base->load_mem(bld_base, nir_dest_num_components(instr->dest),
+                      nir_dest_bit_size(instr->dest), idx, offset, result);
+}
+
+
+static void
+visit_store_ssbo(struct lp_build_nir_context *bld_base,
+                 nir_intrinsic_instr *instr)
+{
+   LLVMValueRef val[NIR_MAX_VEC_COMPONENTS];
+   LLVMValueRef idx = get_buffer_index(bld_base, instr->src[1]);
+   LLVMValueRef offset = get_src_chan0(bld_base, instr->src[2], nir_type_uint);
+   unsigned writemask = nir_intrinsic_write_mask(instr);
+   unsigned nc = nir_src_num_components(instr->src[0]);
+   unsigned bit_size = nir_src_bit_size(instr->src[0]);
+   unsigned i;
+
+   get_src(bld_base, instr->src[0], val);
+   for (i = 0; i < nc; i++) {
+      if (writemask & (1 << i))
+         bld_base->store_mem(bld_base, 1 << i, nc, bit_size, idx, offset,
+                             val[i]);
+   }
+}
+
+
+static void
+visit_load_shared(struct lp_build_nir_context *bld_base,
+                  nir_intrinsic_instr *instr,
+                  LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   LLVMValueRef offset = get_shared_offset(bld_base, instr, instr->src[0]);
+
+   bld_base->load_mem(bld_base, nir_dest_num_components(instr->dest),
+                      nir_dest_bit_size(instr->dest), NULL, offset, result);
+}
+
+
+static void
+visit_store_shared(struct lp_build_nir_context *bld_base,
+                   nir_intrinsic_instr *instr)
+{
+   LLVMValueRef val[NIR_MAX_VEC_COMPONENTS];
+   LLVMValueRef offset = get_shared_offset(bld_base, instr, instr->src[1]);
+   unsigned writemask = nir_intrinsic_write_mask(instr);
+   unsigned nc = nir_src_num_components(instr->src[0]);
+   unsigned bit_size = nir_src_bit_size(instr->src[0]);
+   unsigned i;
+
+   get_src(bld_base, instr->src[0], val);
+   for (i = 0; i < nc; i++) {
+      if (writemask & (1 << i))
+         bld_base->store_mem(bld_base, 1 << i, nc, bit_size, NULL, offset,
+                             val[i]);
+   }
+}
+
+
+static void
+visit_atomic(struct lp_build_nir_context *bld_base,
+             nir_intrinsic_instr *instr,
+             LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   bool is_shared = instr->intrinsic >= nir_intrinsic_shared_atomic_add &&
+                    instr->intrinsic <= nir_intrinsic_shared_atomic_fcomp_swap;
+   unsigned first = is_shared ? 0 : 1;
+   LLVMValueRef idx = is_shared ? NULL :
+      get_buffer_index(bld_base, instr->src[0]);
+   LLVMValueRef offset = is_shared ?
+      get_shared_offset(bld_base, instr, instr->src[0]) :
+      get_src_chan0(bld_base, instr->src[1], nir_type_uint);
+   LLVMValueRef val = get_src_chan0(bld_base, instr->src[first + 1],
+                                    nir_type_uint);
+   LLVMValueRef val2 = NULL;
+
+   if (instr->intrinsic == nir_intrinsic_ssbo_atomic_comp_swap ||
+       instr->intrinsic == nir_intrinsic_shared_atomic_comp_swap)
+      val2 = get_src_chan0(bld_base, instr->src[first + 2], nir_type_uint);
+
+   bld_base->atomic_mem(bld_base, instr->intrinsic, idx, offset, val, val2,
+                        &result[0]);
+}
+
+
+static void
+visit_discard(struct lp_build_nir_context *bld_base,
+              nir_intrinsic_instr *instr)
+{
+   LLVMValueRef cond = NULL;
+
+   if (instr->intrinsic == nir_intrinsic_discard_if)
+      cond = get_src_chan0(bld_base, instr->src[0], nir_type_int);
+
+   bld_base->discard(bld_base, cond);
+}
+
+
+static void
+visit_intrinsic(struct lp_build_nir_context *bld_base,
+                nir_intrinsic_instr *instr)
+{
+   LLVMValueRef result[NIR_MAX_VEC_COMPONENTS] = { NULL };
+
+   switch (instr->intrinsic) {
+   case nir_intrinsic_load_deref:
+      visit_load_var(bld_base, instr, result);
+      break;
+   case nir_intrinsic_store_deref:
+      visit_store_var(bld_base, instr);
+      break;
+   case nir_intrinsic_load_uniform:
+      visit_load_uniform(bld_base, instr, result);
+      break;
+   case nir_intrinsic_load_ubo:
+      visit_load_ubo(bld_base, instr, result);
+      break;
+   case nir_intrinsic_load_ssbo:
+      visit_load_ssbo(bld_base, instr, result);
+      break;
+   case nir_intrinsic_store_ssbo:
+      visit_store_ssbo(bld_base, instr);
+      break;
+   case nir_intrinsic_get_buffer_size:
+      result[0] = bld_base->get_buffer_size(bld_base,
+                                            get_buffer_index(bld_base,
+                                                             instr->src[0]));
+      break;
+   case nir_intrinsic_load_shared:
+      visit_load_shared(bld_base, instr, result);
+      break;
+   case nir_intrinsic_store_shared:
+      visit_store_shared(bld_base, instr);
+      break;
+   case nir_intrinsic_ssbo_atomic_add:
+   case nir_intrinsic_ssbo_atomic_imin:
+   case nir_intrinsic_ssbo_atomic_umin:
+   case nir_intrinsic_ssbo_atomic_imax:
+   case nir_intrinsic_ssbo_atomic_umax:
+   case nir_intrinsic_ssbo_atomic_and:
+   case nir_intrinsic_ssbo_atomic_or:
+   case nir_intrinsic_ssbo_atomic_xor:
+   case nir_intrinsic_ssbo_atomic_exchange:
+   case nir_intrinsic_ssbo_atomic_comp_swap:
+   case nir_intrinsic_shared_atomic_add:
+   case nir_intrinsic_shared_atomic_imin:
+   case nir_intrinsic_shared_atomic_umin:
+   case nir_intrinsic_shared_atomic_imax:
+   case nir_intrinsic_shared_atomic_umax:
+   case nir_intrinsic_shared_atomic_and:
+   case nir_intrinsic_shared_atomic_or:
+   case nir_intrinsic_shared_atomic_xor:
+   case nir_intrinsic_shared_atomic_exchange:
+   case nir_intrinsic_shared_atomic_comp_swap:
+      visit_atomic(bld_base, instr, result);
+      break;
+   case nir_intrinsic_load_vertex_id:
+   case nir_intrinsic_load_vertex_id_zero_base:
+   case nir_intrinsic_load_base_vertex:
+   case nir_intrinsic_load_instance_id:
+   case nir_intrinsic_load_primitive_id:
+   case nir_intrinsic_load_invocation_id:
+   case nir_intrinsic_load_local_invocation_id:
+   case nir_intrinsic_load_work_group_id:
+   case nir_intrinsic_load_num_work_groups:
+   case nir_intrinsic_load_local_group_size:
+      bld_base->sysval_intrin(bld_base, instr, result);
+      break;
+   case nir_intrinsic_discard:
+   case nir_intrinsic_discard_if:
+      visit_discard(bld_base, instr);
+      break;
+   case nir_intrinsic_emit_vertex:
+      bld_base->emit_vertex(bld_base, nir_intrinsic_stream_id(instr));
+      break;
+   case nir_intrinsic_end_primitive:
+      bld_base->end_primitive(bld_base, nir_intrinsic_stream_id(instr));
+      break;
+   case nir_intrinsic_barrier:
+      bld_base->barrier(bld_base);
+      break;
+   case nir_intrinsic_memory_barrier:
+   case nir_intrinsic_memory_barrier_atomic_counter:
+   case nir_intrinsic_memory_barrier_buffer:
+   case nir_intrinsic_memory_barrier_image:
+   case nir_intrinsic_memory_barrier_shared:
+   case nir_intrinsic_group_memory_barrier:
+      LLVMBuildFence(bld_base->base.gallivm->builder,
+                     LLVMAtomicOrderingSequentiallyConsistent, false, "");
+      break;
+   default:
+      debug_printf("gallivm: unhandled NIR intrinsic %s\n",
+                   nir_intrinsic_infos[instr->intrinsic].name);
+      assert(0);
+      break;
+   }
+
+   if (nir_intrinsic_infos[instr->intrinsic].has_dest) {
+      unsigned i;
+
+      for (i = 0; i < nir_dest_num_components(instr->dest); i++) {
+         if (!result[i])
+            result[i] = get_int_bld(bld_base, true,
+                                    nir_dest_bit_size(instr->dest))->undef;
+      }
+      assign_dest(bld_base, &instr->dest, result);
+   }
+}
+
+
+static unsigned
+glsl_sampler_to_pipe(int sampler_dim, bool is_array)
+{
+   switch (sampler_dim) {
+   case GLSL_SAMPLER_DIM_1D:
+      return is_array ? PIPE_TEXTURE_1D_ARRAY : PIPE_TEXTURE_1D;
+   case GLSL_SAMPLER_DIM_2D:
+   case GLSL_SAMPLER_DIM_MS:
+   case GLSL_SAMPLER_DIM_EXTERNAL:
+      return is_array ? PIPE_TEXTURE_2D_ARRAY : PIPE_TEXTURE_2D;
+   case GLSL_SAMPLER_DIM_3D:
+      return PIPE_TEXTURE_3D;
+   case GLSL_SAMPLER_DIM_CUBE:
+      return is_array ? PIPE_TEXTURE_CUBE_ARRAY : PIPE_TEXTURE_CUBE;
+   case GLSL_SAMPLER_DIM_RECT:
+      return PIPE_TEXTURE_RECT;
+   case GLSL_SAMPLER_DIM_BUF:
+      return PIPE_BUFFER;
+   default:
+      assert(0);
+      return PIPE_TEXTURE_2D;
+   }
+}
+
+
+/**
+ * Same heuristic as the TGSI translation, which uses a scalar lod for
+ * constants and immediates: dynamically uniform values are scalar too.
+ */
+static enum lp_sampler_lod_property
+lp_build_nir_lod_property(struct lp_build_nir_context *bld_base,
+                          nir_src lod_src)
+{
+   if (nir_src_is_dynamically_uniform(lod_src))
+      return LP_SAMPLER_LOD_SCALAR;
+   else if (bld_base->shader->info.stage == MESA_SHADER_FRAGMENT) {
+      if (gallivm_perf & GALLIVM_PERF_NO_QUAD_LOD)
+         return LP_SAMPLER_LOD_PER_ELEMENT;
+      else
+         return LP_SAMPLER_LOD_PER_QUAD;
+   }
+   else
+      return LP_SAMPLER_LOD_PER_ELEMENT;
+}
+
+
+static void
+visit_txs(struct lp_build_nir_context *bld_base,
+          nir_tex_instr *instr)
+{
+   struct lp_sampler_size_query_params params;
+   LLVMValueRef sizes_out[NIR_MAX_VEC_COMPONENTS];
+   LLVMValueRef explicit_lod = NULL;
+   unsigned i;
+
+   for (i = 0; i < instr->num_srcs; i++) {
+      if (instr->src[i].src_type == nir_tex_src_lod &&
+          instr->sampler_dim != GLSL_SAMPLER_DIM_BUF &&
+          instr->sampler_dim != GLSL_SAMPLER_DIM_RECT)
+         explicit_lod = get_src_chan0(bld_base, instr->src[i].src,
+                                      nir_type_int);
+   }
+
+   memset(&params, 0, sizeof(params));
+   params.int_type = bld_base->int_bld.type;
+   params.texture_unit = instr->texture_index;
+   params.target = glsl_sampler_to_pipe(instr->sampler_dim, instr->is_array);
+   params.is_sviewinfo = TRUE;
+   params.sizes_out = sizes_out;
+   params.explicit_lod = explicit_lod;
+   params.lod_property = LP_SAMPLER_LOD_SCALAR;
+   if (explicit_lod) {
+      for (i = 0; i < instr->num_srcs; i++) {
+         if (instr->src[i].src_type == nir_tex_src_lod)
+            params.lod_property =
+               lp_build_nir_lod_property(bld_base, instr->src[i].src);
+      }
+   }
+
+   bld_base->tex_size(bld_base, &params);
+
+   /* The number of levels comes in the 4th channel */
+   if (instr->op == nir_texop_query_levels)
+      sizes_out[0] = sizes_out[3];
+   assign_dest(bld_base, &instr->dest, sizes_out);
+}
+
+
+static void
+visit_tex(struct lp_build_nir_context *bld_base,
+          nir_tex_instr *instr)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef coords[5];
+   LLVMValueRef offsets[3] = { NULL };
+   LLVMValueRef explicit_lod = NULL;
+   LLVMValueRef texel[NIR_MAX_VEC_COMPONENTS];
+   struct lp_sampler_params params;
+   struct lp_derivatives derivs;
+   enum lp_sampler_lod_property lod_property = LP_SAMPLER_LOD_SCALAR;
+   bool is_fetch = instr->op == nir_texop_txf || instr->op == nir_texop_txf_ms;
+   nir_alu_type coord_type = is_fetch ? nir_type_int : nir_type_float;
+   unsigned sample_key = 0;
+   unsigned lod_src = 0;
+   unsigned i, chan;
+
+   if (instr->op == nir_texop_txs || instr->op == nir_texop_query_levels) {
+      visit_txs(bld_base, instr);
+      return;
+   }
+
+   if (is_fetch)
+      sample_key |= LP_SAMPLER_OP_FETCH << LP_SAMPLER_OP_TYPE_SHIFT;
+   else if (instr->op == nir_texop_tg4)
+      sample_key |= LP_SAMPLER_OP_GATHER << LP_SAMPLER_OP_TYPE_SHIFT;
+   else if (instr->op == nir_texop_lod)
+      sample_key |= LP_SAMPLER_OP_LODQ << LP_SAMPLER_OP_TYPE_SHIFT;
+   else
+      sample_key |= LP_SAMPLER_OP_TEXTURE << LP_SAMPLER_OP_TYPE_SHIFT;
+
+   for (i = 0; i < 5; i++)
+      coords[i] = is_fetch ? LLVMGetUndef(bld_base->base.int_vec_type) :
+                             bld_base->base.undef;
+
+   memset(&derivs, 0, sizeof(derivs));
+
+   for (i = 0; i < instr->num_srcs; i++) {
+      LLVMValueRef vals[NIR_MAX_VEC_COMPONENTS];
+      unsigned nc = nir_src_num_components(instr->src[i].src);
+
+      get_src(bld_base, instr->src[i].src, vals);
+
+      switch (instr->src[i].src_type) {
+      case nir_tex_src_coord:
+         for (chan = 0; chan < instr->coord_components; ++chan)
+            coords[chan] = cast_type(bld_base, vals[chan], coord_type, 32);
+         break;
+      case nir_tex_src_comparator:
+         sample_key |= LP_SAMPLER_SHADOW;
+         coords[4] = cast_type(bld_base, vals[0], nir_type_float, 32);
+         break;
+      case nir_tex_src_bias:
+         sample_key |= LP_SAMPLER_LOD_BIAS << LP_SAMPLER_LOD_CONTROL_SHIFT;
+         lod_src = i;
+         explicit_lod = cast_type(bld_base, vals[0], nir_type_float, 32);
+         break;
+      case nir_tex_src_lod:
+         /* buffers and multisample textures have no levels */
+         if (is_fetch && (instr->sampler_dim == GLSL_SAMPLER_DIM_BUF ||
+                          instr->sampler_dim == GLSL_SAMPLER_DIM_MS))
+            break;
+         sample_key |= LP_SAMPLER_LOD_EXPLICIT << LP_SAMPLER_LOD_CONTROL_SHIFT;
+         lod_src = i;
+         explicit_lod = cast_type(bld_base, vals[0], coord_type, 32);
+         break;
+      case nir_tex_src_ddx:
+         for (chan = 0; chan < nc; chan++)
+            derivs.ddx[chan] = cast_type(bld_base, vals[chan],
+                                         nir_type_float, 32);
+         break;
+      case nir_tex_src_ddy:
+         for (chan = 0; chan < nc; chan++)
+            derivs.ddy[chan] = cast_type(bld_base, vals[chan],
+                                         nir_type_float, 32);
+         break;
+      case nir_tex_src_offset:
+         sample_key |= LP_SAMPLER_OFFSETS;
+         for (chan = 0; chan < nc; chan++)
+            offsets[chan] = cast_type(bld_base, vals[chan], nir_type_int, 32);
+         break;
+      case nir_tex_src_ms_index:
+         /* XXX: no multisampling */
+         break;
+      default:
+         assert(0);
+         break;
+      }
+   }
+
+   /* The layer always goes into the 3rd slot, except for cube arrays */
+   if (instr->sampler_dim == GLSL_SAMPLER_DIM_1D && instr->is_array) {
+      coords[2] = coords[1];
+      coords[1] = is_fetch ? LLVMGetUndef(bld_base->base.int_vec_type) :
+                             bld_base->base.undef;
+   }
+
+   if (explicit_lod)
+      lod_property = lp_build_nir_lod_property(bld_base,
+                                               instr->src[lod_src].src);
+
+   if (instr->op == nir_texop_txd) {
+      sample_key |= LP_SAMPLER_LOD_DERIVATIVES << LP_SAMPLER_LOD_CONTROL_SHIFT;
+      params.derivs = &derivs;
+      if (bld_base->shader->info.stage == MESA_SHADER_FRAGMENT) {
+         if (gallivm_perf & GALLIVM_PERF_NO_QUAD_LOD)
+            lod_property = LP_SAMPLER_LOD_PER_ELEMENT;
+         else
+            lod_property = LP_SAMPLER_LOD_PER_QUAD;
+      } else
+         lod_property = LP_SAMPLER_LOD_PER_ELEMENT;
+   } else
+      params.derivs = NULL;
+
+   sample_key |= lod_property << LP_SAMPLER_LOD_PROPERTY_SHIFT;
+
+   params.type = bld_base->base.type;
+   params.sample_key = sample_key;
+   params.texture_index = instr->texture_index;
+   /*
+    * The sampler isn't used by fetches, set it to 0 like the TGSI
+    * translation so it won't exceed PIPE_MAX_SAMPLERS.
+    */
+   params.sampler_index = is_fetch ? 0 : instr->sampler_index;
+   params.coords = coords;
+   params.offsets = offsets;
+   params.lod = explicit_lod;
+   params.texel = texel;
+
+   bld_base->tex(bld_base, &params);
+
+   for (i = 0; i < nir_dest_num_components(instr->dest); i++)
+      texel[i] = LLVMBuildBitCast(builder, texel[i],
+                                  bld_base->uint_bld.vec_type, "");
+   assign_dest(bld_base, &instr->dest, texel);
+}
+
+
+static void
+visit_jump(struct lp_build_nir_context *bld_base,
+           const nir_jump_instr *instr)
+{
+   switch (instr->type) {
+   case nir_jump_break:
+      bld_base->break_stmt(bld_base);
+      break;
+   case nir_jump_continue:
+      bld_base->continue_stmt(bld_base);
+      break;
+   default:
+      /* returns are lowered by the state tracker */
+      unreachable("Unknown jump instr\n");
+   }
+}
+
+
+static void
+visit_block(struct lp_build_nir_context *bld_base,
+            nir_block *block)
+{
+   nir_foreach_instr(instr, block) {
+      switch (instr->type) {
+      case nir_instr_type_alu:
+         visit_alu(bld_base, nir_instr_as_alu(instr));
+         break;
+      case nir_instr_type_load_const:
+         visit_load_const(bld_base, nir_instr_as_load_const(instr));
+         break;
+      case nir_instr_type_intrinsic:
+         visit_intrinsic(bld_base, nir_instr_as_intrinsic(instr));
+         break;
+      case nir_instr_type_tex:
+         visit_tex(bld_base, nir_instr_as_tex(instr));
+         break;
+      case nir_instr_type_ssa_undef:
+         visit_ssa_undef(bld_base, nir_instr_as_ssa_undef(instr));
+         break;
+      case nir_instr_type_jump:
+         visit_jump(bld_base, nir_instr_as_jump(instr));
+         break;
+      case nir_instr_type_deref:
+         /* handled by the instructions using them */
+         break;
+      default:
+         fprintf(stderr, "Unknown NIR instr type: ");
+         nir_print_instr(instr, stderr);
+         fprintf(stderr, "\n");
+         abort();
+      }
+   }
+}
+
+
+static void
+visit_if(struct lp_build_nir_context *bld_base,
+         nir_if *if_stmt)
+{
+   LLVMValueRef cond = get_src_chan0(bld_base, if_stmt->condition,
+                                     nir_type_int);
+
+   bld_base->if_cond(bld_base, cond);
+   visit_cf_list(bld_base, &if_stmt->then_list);
+
+   if (!exec_list_is_empty(&if_stmt->else_list)) {
+      bld_base->else_stmt(bld_base);
+      visit_cf_list(bld_base, &if_stmt->else_list);
+   }
+   bld_base->endif_stmt(bld_base);
+}
+
+
+static void
+visit_loop(struct lp_build_nir_context *bld_base,
+           nir_loop *loop)
+{
+   bld_base->bgnloop(bld_base);
+   visit_cf_list(bld_base, &loop->body);
+   bld_base->endloop(bld_base);
+}
+
+
+static void
+visit_cf_list(struct lp_build_nir_context *bld_base,
+              struct exec_list *list)
+{
+   foreach_list_typed(nir_cf_node, node, node, list)
+   {
+      switch (node->type) {
+      case nir_cf_node_block:
+         visit_block(bld_base, nir_cf_node_as_block(node));
+         break;
+
+      case nir_cf_node_if:
+         visit_if(bld_base, nir_cf_node_as_if(node));
+         break;
+
+      case nir_cf_node_loop:
+         visit_loop(bld_base, nir_cf_node_as_loop(node));
+         break;
+
+      default:
+         assert(0);
+      }
+   }
+}
+
+
+/**
+ * Translate the entry point of the shader, which must have been through
+ * lp_build_opt_nir().  The shader isn't modified, so the same one can be
+ * translated for several variants.
+ */
+boolean
+lp_build_nir_llvm(struct lp_build_nir_context *bld_base,
+                  struct nir_shader *nir)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   nir_function_impl *impl = nir_shader_get_entrypoint(nir);
+
+   bld_base->shader = nir;
+   bld_base->regs = _mesa_hash_table_create(NULL, _mesa_hash_pointer,
+                                            _mesa_key_pointer_equal);
+   bld_base->ssa_defs = CALLOC(impl->ssa_alloc, sizeof(*bld_base->ssa_defs));
+   if (!bld_base->regs || !bld_base->ssa_defs) {
+      _mesa_hash_table_destroy(bld_base->regs, NULL);
+      FREE(bld_base->ssa_defs);
+      return FALSE;
+   }
+
+   nir_foreach_register(reg, &impl->registers) {
+      struct lp_build_context *reg_bld = get_int_bld(bld_base, true,
+                                                     reg->bit_size);
+      unsigned size = MAX2(1, reg->num_array_elems) * reg->num_components;
+      LLVMValueRef reg_alloc =
+         lp_build_alloca_undef(gallivm, LLVMArrayType(reg_bld->vec_type, size),
+                               "reg");
+
+      _mesa_hash_table_insert(bld_base->regs, reg, reg_alloc);
+   }
+
+   visit_cf_list(bld_base, &impl->body);
+
+   FREE(bld_base->ssa_defs);
+   bld_base->ssa_defs = NULL;
+   _mesa_hash_table_destroy(bld_base->regs, NULL);
+   bld_base->regs = NULL;
+   return TRUE;
+}
+
+
+void
+lp_build_opt_nir(struct nir_shader *nir)
+{
+   static const struct nir_lower_tex_options lower_tex_options = {
+      .lower_txp = ~0u,
+   };
+   bool progress;
+
+   NIR_PASS_V(nir, nir_lower_tex, &lower_tex_options);
+   NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+   NIR_PASS_V(nir, nir_lower_indirect_derefs,
+              nir_var_shader_in | nir_var_shader_out);
+   NIR_PASS_V(nir, nir_lower_alu_to_scalar, NULL);
+   NIR_PASS_V(nir, nir_lower_pack);
+
+   do {
+      progress = false;
+      NIR_PASS(progress, nir, nir_copy_prop);
+      NIR_PASS(progress, nir, nir_opt_dce);
+      NIR_PASS(progress, nir, nir_opt_cse);
+      NIR_PASS(progress, nir, nir_opt_constant_folding);
+      NIR_PASS(progress, nir, nir_opt_algebraic);
+   } while (progress);
+   NIR_PASS_V(nir, nir_opt_algebraic_late);
+   NIR_PASS_V(nir, nir_copy_prop);
+   NIR_PASS_V(nir, nir_opt_dce);
+
+   NIR_PASS_V(nir, nir_lower_bool_to_int32);
+   NIR_PASS_V(nir, nir_remove_dead_derefs);
+   NIR_PASS_V(nir, nir_remove_dead_variables, nir_var_function_temp);
+
+   /* See the comment at the top of the file */
+   NIR_PASS_V(nir, nir_convert_to_lcssa, true, false);
+   NIR_PASS_V(nir, nir_convert_from_ssa, true);
+   NIR_PASS_V(nir, nir_lower_locals_to_regs);
+
+   nir_index_ssa_defs(nir_shader_get_entrypoint(nir));
+}
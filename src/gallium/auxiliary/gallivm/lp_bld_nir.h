@@ -0,0 +1,228 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * @file
+ * NIR to LLVM IR translation.
+ *
+ * lp_bld_nir.c walks the NIR control flow and translates the ALU
+ * instructions, everything which depends on how the shader is vectorized
+ * (inputs, outputs, memory, control flow, texturing) goes through the
+ * callbacks of lp_build_nir_context, see lp_bld_nir_soa.c.
+ */
+
+#ifndef LP_BLD_NIR_H
+#define LP_BLD_NIR_H
+
+#include "gallivm/lp_bld.h"
+#include "gallivm/lp_bld_limits.h"
+#include "gallivm/lp_bld_type.h"
+#include "gallivm/lp_bld_tgsi.h"
+#include "compiler/nir/nir.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct hash_table;
+struct lp_sampler_params;
+struct lp_sampler_size_query_params;
+
+
+/**
+ * Lowers and optimizes a NIR shader for lp_build_nir_soa().
+ *
+ * Must be called once on every shader given to lp_build_nir_soa(), before
+ * nir_tgsi_scan_shader(), since it takes the shader out of SSA.
+ */
+void
+lp_build_opt_nir(struct nir_shader *nir);
+
+
+void
+lp_build_nir_soa(struct gallivm_state *gallivm,
+                 struct nir_shader *shader,
+                 const struct lp_build_tgsi_params *params,
+                 LLVMValueRef (*outputs)[4]);
+
+
+struct lp_build_nir_context
+{
+   /* Builders for the 32 and 64 bit values, base is float */
+   struct lp_build_context base;
+   struct lp_build_context uint_bld;
+   struct lp_build_context int_bld;
+   struct lp_build_context dbl_bld;
+   struct lp_build_context uint64_bld;
+   struct lp_build_context int64_bld;
+
+   /* Per SSA def component values, always of integer vector type */
+   LLVMValueRef (*ssa_defs)[NIR_MAX_VEC_COMPONENTS];
+   /* nir_register -> alloca */
+   struct hash_table *regs;
+
+   nir_shader *shader;
+
+   /* Constant buffer loads, index 0 is the default uniform block and the
+    * offset is in bytes.
+    */
+   void (*load_ubo)(struct lp_build_nir_context *bld_base,
+                    unsigned nc,
+                    unsigned bit_size,
+                    bool offset_is_uniform,
+                    LLVMValueRef index,
+                    LLVMValueRef offset,
+                    LLVMValueRef result[NIR_MAX_VEC_COMPONENTS]);
+
+   /* SSBO and shared memory accesses, index is NULL for shared memory */
+   void (*load_mem)(struct lp_build_nir_context *bld_base,
+                    unsigned nc,
+                    unsigned bit_size,
+                    LLVMValueRef index,
+                    LLVMValueRef offset,
+                    LLVMValueRef result[NIR_MAX_VEC_COMPONENTS]);
+
+   void (*store_mem)(struct lp_build_nir_context *bld_base,
+                     unsigned writemask,
+                     unsigned nc,
+                     unsigned bit_size,
+                     LLVMValueRef index,
+                     LLVMValueRef offset,
+                     LLVMValueRef dst);
+
+   void (*atomic_mem)(struct lp_build_nir_context *bld_base,
+                      nir_intrinsic_op op,
+                      LLVMValueRef index,
+                      LLVMValueRef offset,
+                      LLVMValueRef val,
+                      LLVMValueRef val2,
+                      LLVMValueRef *result);
+
+   LLVMValueRef (*get_buffer_size)(struct lp_build_nir_context *bld_base,
+                                   LLVMValueRef index);
+
+   /*
+    * Shader inputs and outputs.  const_index is the slot offset from the
+    * start of the variable, in vec4 slots, and vertex_index the vertex of a
+    * per-vertex (GS) input.  Indirect derefs of inputs and outputs are
+    * lowered by lp_build_opt_nir().
+    */
+   void (*load_var)(struct lp_build_nir_context *bld_base,
+                    nir_variable_mode deref_mode,
+                    unsigned num_components,
+                    unsigned bit_size,
+                    nir_variable *var,
+                    unsigned vertex_index,
+                    unsigned const_index,
+                    LLVMValueRef result[NIR_MAX_VEC_COMPONENTS]);
+
+   void (*store_var)(struct lp_build_nir_context *bld_base,
+                     nir_variable_mode deref_mode,
+                     unsigned num_components,
+                     unsigned bit_size,
+                     nir_variable *var,
+                     unsigned writemask,
+                     unsigned const_index,
+                     LLVMValueRef dst);
+
+   /* NIR registers, reg_storage is the array allocated for the register */
+   void (*load_reg)(struct lp_build_nir_context *bld_base,
+                    struct lp_build_context *reg_bld,
+                    const nir_reg_src *reg,
+                    LLVMValueRef indir_src,
+                    LLVMValueRef reg_storage,
+                    LLVMValueRef result[NIR_MAX_VEC_COMPONENTS]);
+
+   void (*store_reg)(struct lp_build_nir_context *bld_base,
+                     struct lp_build_context *reg_bld,
+                     const nir_reg_dest *reg,
+                     unsigned writemask,
+                     LLVMValueRef indir_src,
+                     LLVMValueRef reg_storage,
+                     LLVMValueRef dst[NIR_MAX_VEC_COMPONENTS]);
+
+   void (*tex)(struct lp_build_nir_context *bld_base,
+               struct lp_sampler_params *params);
+
+   void (*tex_size)(struct lp_build_nir_context *bld_base,
+                    struct lp_sampler_size_query_params *params);
+
+   void (*sysval_intrin)(struct lp_build_nir_context *bld_base,
+                         nir_intrinsic_instr *instr,
+                         LLVMValueRef result[NIR_MAX_VEC_COMPONENTS]);
+
+   /* cond is NULL for an unconditional discard */
+   void (*discard)(struct lp_build_nir_context *bld_base,
+                   LLVMValueRef cond);
+
+   void (*bgnloop)(struct lp_build_nir_context *bld_base);
+   void (*endloop)(struct lp_build_nir_context *bld_base);
+   void (*if_cond)(struct lp_build_nir_context *bld_base, LLVMValueRef cond);
+   void (*else_stmt)(struct lp_build_nir_context *bld_base);
+   void (*endif_stmt)(struct lp_build_nir_context *bld_base);
+   void (*break_stmt)(struct lp_build_nir_context *bld_base);
+   void (*continue_stmt)(struct lp_build_nir_context *bld_base);
+
+   void (*barrier)(struct lp_build_nir_context *bld_base);
+
+   void (*emit_vertex)(struct lp_build_nir_context *bld_base,
+                       uint32_t stream_id);
+   void (*end_primitive)(struct lp_build_nir_context *bld_base,
+                         uint32_t stream_id);
+};
+
+
+boolean
+lp_build_nir_llvm(struct lp_build_nir_context *bld_base,
+                  struct nir_shader *nir);
+
+
+static inline struct lp_build_context *
+get_flt_bld(struct lp_build_nir_context *bld_base,
+            unsigned op_bit_size)
+{
+   return op_bit_size == 64 ? &bld_base->dbl_bld : &bld_base->base;
+}
+
+
+static inline struct lp_build_context *
+get_int_bld(struct lp_build_nir_context *bld_base,
+            bool is_unsigned,
+            unsigned op_bit_size)
+{
+   if (is_unsigned)
+      return op_bit_size == 64 ? &bld_base->uint64_bld : &bld_base->uint_bld;
+   else
+      return op_bit_size == 64 ? &bld_base->int64_bld : &bld_base->int_bld;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LP_BLD_NIR_H */
@@ -0,0 +1,1441 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/**
+ * @file
+ * NIR to LLVM IR translation -- SoA.
+ *
+ * The structure of arrays counterpart of lp_bld_tgsi_soa.c, it takes the
+ * same parameters and uses the same interfaces for inputs, outputs,
+ * texturing and geometry/compute shader specifics, so the drivers can use
+ * either one.
+ */
+
+#include "lp_bld_nir.h"
+#include "lp_bld_init.h"
+#include "lp_bld_flow.h"
+#include "lp_bld_logic.h"
+#include "lp_bld_const.h"
+#include "lp_bld_struct.h"
+#include "lp_bld_arit.h"
+#include "lp_bld_bitarit.h"
+#include "lp_bld_sample.h"
+#include "util/bitscan.h"
+#include "util/u_math.h"
+
+
+struct lp_build_nir_soa_context
+{
+   struct lp_build_nir_context bld_base;
+
+   LLVMValueRef consts_ptr;
+   LLVMValueRef const_sizes_ptr;
+   const LLVMValueRef (*inputs)[TGSI_NUM_CHANNELS];
+   LLVMValueRef (*outputs)[TGSI_NUM_CHANNELS];
+   LLVMValueRef context_ptr;
+   LLVMValueRef thread_data_ptr;
+
+   LLVMValueRef ssbo_ptr;
+   LLVMValueRef ssbo_sizes_ptr;
+
+   /** Work group shared memory, compute shaders only */
+   LLVMValueRef shared_ptr;
+   unsigned shared_size;
+
+   const struct lp_build_sampler_soa *sampler;
+
+   struct lp_bld_tgsi_system_values system_values;
+
+   const struct lp_build_tgsi_gs_iface *gs_iface;
+   const struct lp_build_tgsi_cs_iface *cs_iface;
+   LLVMValueRef emitted_prims_vec_ptr;
+   LLVMValueRef total_emitted_vertices_vec_ptr;
+   LLVMValueRef emitted_vertices_vec_ptr;
+   LLVMValueRef max_output_vertices_vec;
+
+   struct lp_build_mask_context *mask;
+   struct lp_exec_mask exec_mask;
+};
+
+
+static inline struct lp_build_nir_soa_context *
+lp_nir_soa_context(struct lp_build_nir_context *bld_base)
+{
+   return (struct lp_build_nir_soa_context *)bld_base;
+}
+
+
+/*
+ * combine the execution mask if there is one with the current mask.
+ */
+static LLVMValueRef
+mask_vec(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_exec_mask *exec_mask = &bld->exec_mask;
+   LLVMValueRef bld_mask = bld->mask ? lp_build_mask_value(bld->mask) : NULL;
+
+   if (!exec_mask->has_mask) {
+      return bld_mask ? bld_mask :
+         lp_build_const_int_vec(bld_base->base.gallivm,
+                                bld_base->uint_bld.type, -1);
+   }
+   if (!bld_mask)
+      return exec_mask->exec_mask;
+   return LLVMBuildAnd(builder, bld_mask, exec_mask->exec_mask, "");
+}
+
+
+/**
+ * Interleave two float vectors into a 64 bit vector, the way 64 bit values
+ * are laid out in the input and output channels.
+ */
+static LLVMValueRef
+emit_fetch_64bit(struct lp_build_nir_context *bld_base,
+                 LLVMValueRef input,
+                 LLVMValueRef input2)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef res;
+   int i;
+   LLVMValueRef shuffles[2 * (LP_MAX_VECTOR_WIDTH/32)];
+   int len = bld_base->base.type.length * 2;
+   assert(len <= (2 * (LP_MAX_VECTOR_WIDTH/32)));
+
+   for (i = 0; i < bld_base->base.type.length * 2; i+=2) {
+      shuffles[i] = lp_build_const_int32(gallivm, i / 2);
+      shuffles[i + 1] = lp_build_const_int32(gallivm, i / 2 + bld_base->base.type.length);
+   }
+   res = LLVMBuildShuffleVector(builder, input, input2, LLVMConstVector(shuffles, len), "");
+
+   return LLVMBuildBitCast(builder, res, bld_base->uint64_bld.vec_type, "");
+}
+
+
+/**
+ * Split a 64 bit vector into its low and high halves.
+ */
+static void
+emit_store_64bit_split(struct lp_build_nir_context *bld_base,
+                       LLVMValueRef value,
+                       LLVMValueRef split_values[2])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned i;
+   LLVMValueRef shuffles[LP_MAX_VECTOR_WIDTH/32];
+   LLVMValueRef shuffles2[LP_MAX_VECTOR_WIDTH/32];
+   int len = bld_base->base.type.length * 2;
+
+   value = LLVMBuildBitCast(gallivm->builder, value,
+                            LLVMVectorType(LLVMFloatTypeInContext(gallivm->context), len), "");
+   for (i = 0; i < bld_base->base.type.length; i++) {
+      shuffles[i] = lp_build_const_int32(gallivm, i * 2);
+      shuffles2[i] = lp_build_const_int32(gallivm, (i * 2) + 1);
+   }
+
+   split_values[0] = LLVMBuildShuffleVector(builder, value,
+                                            LLVMGetUndef(LLVMTypeOf(value)),
+                                            LLVMConstVector(shuffles,
+                                                            bld_base->base.type.length),
+                                            "");
+   split_values[1] = LLVMBuildShuffleVector(builder, value,
+                                            LLVMGetUndef(LLVMTypeOf(value)),
+                                            LLVMConstVector(shuffles2,
+                                                            bld_base->base.type.length),
+                                            "");
+}
+
+
+static void
+emit_store_64bit_chan(struct lp_build_nir_context *bld_base,
+                      LLVMValueRef chan_ptr,
+                      LLVMValueRef chan_ptr2,
+                      LLVMValueRef value)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct lp_build_context *float_bld = &bld_base->base;
+   LLVMValueRef split_vals[2];
+
+   emit_store_64bit_split(bld_base, value, split_vals);
+
+   lp_exec_mask_store(&bld->exec_mask, float_bld, split_vals[0], chan_ptr);
+   lp_exec_mask_store(&bld->exec_mask, float_bld, split_vals[1], chan_ptr2);
+}
+
+
+/**
+ * Map a component of a variable to its slot and channel.  location_frac is
+ * in 32 bit units and a dvec3/dvec4 spans two slots.  The array index of
+ * compact arrays (clip/cull distances) is a component rather than a slot.
+ */
+static void
+get_slot_chan(const nir_variable *var, unsigned bit_size,
+              unsigned const_index, unsigned comp,
+              unsigned *slot, unsigned *chan)
+{
+   unsigned dword = var->data.location_frac +
+                    (bit_size == 64 ? comp * 2 : comp);
+
+   if (var->data.compact) {
+      dword += const_index;
+      const_index = 0;
+   }
+
+   *slot = var->data.driver_location + const_index + dword / 4;
+   *chan = dword % 4;
+}
+
+
+static void
+emit_load_var(struct lp_build_nir_context *bld_base,
+              nir_variable_mode deref_mode,
+              unsigned num_components,
+              unsigned bit_size,
+              nir_variable *var,
+              unsigned vertex_index,
+              unsigned const_index,
+              LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   unsigned i;
+
+   for (i = 0; i < num_components; i++) {
+      unsigned slot, chan;
+
+      get_slot_chan(var, bit_size, const_index, i, &slot, &chan);
+
+      if (deref_mode == nir_var_shader_out) {
+         result[i] = LLVMBuildLoad(builder, bld->outputs[slot][chan], "");
+         if (bit_size == 64)
+            result[i] = emit_fetch_64bit(bld_base, result[i],
+                                         LLVMBuildLoad(builder,
+                                                       bld->outputs[slot][chan + 1],
+                                                       ""));
+      } else if (bld->gs_iface) {
+         LLVMValueRef vertex_index_val = lp_build_const_int32(gallivm, vertex_index);
+         LLVMValueRef attrib_index_val = lp_build_const_int32(gallivm, slot);
+
+         result[i] = bld->gs_iface->fetch_input(bld->gs_iface, &bld_base->base,
+                                                FALSE, vertex_index_val,
+                                                FALSE, attrib_index_val,
+                                                lp_build_const_int32(gallivm, chan));
+         if (bit_size == 64) {
+            LLVMValueRef hi =
+               bld->gs_iface->fetch_input(bld->gs_iface, &bld_base->base,
+                                          FALSE, vertex_index_val,
+                                          FALSE, attrib_index_val,
+                                          lp_build_const_int32(gallivm, chan + 1));
+            result[i] = emit_fetch_64bit(bld_base, result[i], hi);
+         }
+      } else {
+         result[i] = bld->inputs[slot][chan];
+         if (bit_size == 64)
+            result[i] = emit_fetch_64bit(bld_base, result[i],
+                                         bld->inputs[slot][chan + 1]);
+         else if (bld_base->shader->info.stage == MESA_SHADER_FRAGMENT &&
+                  var->data.location == VARYING_SLOT_FACE) {
+            /* The setup code interpolates the facing as +1.0 or -1.0 */
+            result[i] = lp_build_cmp(&bld_base->base, PIPE_FUNC_GREATER,
+                                     result[i], bld_base->base.zero);
+         }
+      }
+   }
+}
+
+
+static void
+emit_store_var(struct lp_build_nir_context *bld_base,
+               nir_variable_mode deref_mode,
+               unsigned num_components,
+               unsigned bit_size,
+               nir_variable *var,
+               unsigned writemask,
+               unsigned const_index,
+               LLVMValueRef dst)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   unsigned slot, chan;
+
+   assert(deref_mode == nir_var_shader_out);
+
+   get_slot_chan(var, bit_size, const_index, ffs(writemask) - 1,
+                 &slot, &chan);
+
+   /* Where the fragment shader code expects the special outputs */
+   if (bld_base->shader->info.stage == MESA_SHADER_FRAGMENT) {
+      switch (var->data.location) {
+      case FRAG_RESULT_DEPTH:
+         chan = 2;
+         break;
+      case FRAG_RESULT_STENCIL:
+         chan = 1;
+         break;
+      case FRAG_RESULT_SAMPLE_MASK:
+         chan = 0;
+         break;
+      default:
+         break;
+      }
+   }
+
+   if (bit_size == 64) {
+      emit_store_64bit_chan(bld_base, bld->outputs[slot][chan],
+                            bld->outputs[slot][chan + 1], dst);
+   } else {
+      dst = LLVMBuildBitCast(builder, dst, bld_base->base.vec_type, "");
+      lp_exec_mask_store(&bld->exec_mask, &bld_base->base, dst,
+                         bld->outputs[slot][chan]);
+   }
+}
+
+
+/**
+ * Per-lane indices into a register array laid out as
+ * [array element][component][lane].
+ */
+static LLVMValueRef
+get_soa_array_offsets(struct lp_build_context *uint_bld,
+                      LLVMValueRef indirect_index,
+                      int num_components,
+                      unsigned chan_index)
+{
+   struct gallivm_state *gallivm = uint_bld->gallivm;
+   LLVMValueRef chan_vec =
+      lp_build_const_int_vec(gallivm, uint_bld->type, chan_index);
+   LLVMValueRef length_vec =
+      lp_build_const_int_vec(gallivm, uint_bld->type, uint_bld->type.length);
+   LLVMValueRef index_vec;
+   LLVMValueRef pixel_offsets;
+   unsigned i;
+
+   /* index_vec = (indirect_index * num_components + chan_index) * length + offsets */
+   index_vec = lp_build_mul(uint_bld, indirect_index,
+                            lp_build_const_int_vec(gallivm, uint_bld->type,
+                                                   num_components));
+   index_vec = lp_build_add(uint_bld, index_vec, chan_vec);
+   index_vec = lp_build_mul(uint_bld, index_vec, length_vec);
+
+   /* Build vector of per-element offsets: (0, 1, 2, ...) */
+   pixel_offsets = uint_bld->undef;
+   for (i = 0; i < uint_bld->type.length; i++) {
+      LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+      pixel_offsets = LLVMBuildInsertElement(gallivm->builder, pixel_offsets,
+                                             ii, ii, "");
+   }
+   return lp_build_add(uint_bld, index_vec, pixel_offsets);
+}
+
+
+static LLVMValueRef
+get_reg_indir_index(struct lp_build_nir_context *bld_base,
+                    const nir_register *reg,
+                    unsigned base_offset,
+                    LLVMValueRef indir_src)
+{
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef max_index =
+      lp_build_const_int_vec(bld_base->base.gallivm, uint_bld->type,
+                             MAX2(1, reg->num_array_elems) - 1);
+   LLVMValueRef index =
+      lp_build_add(uint_bld, indir_src,
+                   lp_build_const_int_vec(bld_base->base.gallivm,
+                                          uint_bld->type, base_offset));
+
+   /* Keep out of bounds accesses inside the register */
+   return lp_build_min(uint_bld, index, max_index);
+}
+
+
+static void
+emit_load_reg(struct lp_build_nir_context *bld_base,
+              struct lp_build_context *reg_bld,
+              const nir_reg_src *reg,
+              LLVMValueRef indir_src,
+              LLVMValueRef reg_storage,
+              LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   int nc = reg->reg->num_components;
+   unsigned i, j;
+
+   if (indir_src) {
+      LLVMValueRef index = get_reg_indir_index(bld_base, reg->reg,
+                                               reg->base_offset, indir_src);
+      LLVMValueRef base_ptr =
+         LLVMBuildBitCast(builder, reg_storage,
+                          LLVMPointerType(reg_bld->elem_type, 0), "");
+
+      for (i = 0; i < nc; i++) {
+         LLVMValueRef indirect_offset =
+            get_soa_array_offsets(&bld_base->uint_bld, index, nc, i);
+
+         result[i] = reg_bld->undef;
+         for (j = 0; j < reg_bld->type.length; j++) {
+            LLVMValueRef jj = lp_build_const_int32(gallivm, j);
+            LLVMValueRef idx =
+               LLVMBuildExtractElement(builder, indirect_offset, jj, "");
+            LLVMValueRef scalar =
+               LLVMBuildLoad(builder,
+                             LLVMBuildGEP(builder, base_ptr, &idx, 1,
+                                          "gather_ptr"), "");
+
+            result[i] = LLVMBuildInsertElement(builder, result[i], scalar,
+                                               jj, "");
+         }
+      }
+   } else {
+      for (i = 0; i < nc; i++) {
+         LLVMValueRef this_storage =
+            lp_build_array_get_ptr(gallivm, reg_storage,
+                                   lp_build_const_int32(gallivm,
+                                                        reg->base_offset * nc + i));
+
+         result[i] = LLVMBuildLoad(builder, this_storage, "");
+      }
+   }
+}
+
+
+/**
+ * Like lp_exec_mask_store(), but for 32 or 64 bit integer vectors.
+ */
+static void
+reg_store_masked(struct lp_build_nir_context *bld_base,
+                 struct lp_build_context *reg_bld,
+                 LLVMValueRef val,
+                 LLVMValueRef dst_ptr)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+
+   if (reg_bld->type.width == 32) {
+      lp_exec_mask_store(&bld->exec_mask, reg_bld, val, dst_ptr);
+   } else if (bld->exec_mask.has_mask) {
+      LLVMValueRef mask = LLVMBuildSExt(builder, bld->exec_mask.exec_mask,
+                                        reg_bld->int_vec_type, "");
+      LLVMValueRef dst = LLVMBuildLoad(builder, dst_ptr, "");
+
+      LLVMBuildStore(builder, lp_build_select(reg_bld, mask, val, dst),
+                     dst_ptr);
+   } else {
+      LLVMBuildStore(builder, val, dst_ptr);
+   }
+}
+
+
+static void
+emit_store_reg(struct lp_build_nir_context *bld_base,
+               struct lp_build_context *reg_bld,
+               const nir_reg_dest *reg,
+               unsigned writemask,
+               LLVMValueRef indir_src,
+               LLVMValueRef reg_storage,
+               LLVMValueRef dst[NIR_MAX_VEC_COMPONENTS])
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   int nc = reg->reg->num_components;
+   unsigned i, j;
+
+   if (indir_src) {
+      LLVMValueRef index = get_reg_indir_index(bld_base, reg->reg,
+                                               reg->base_offset, indir_src);
+      LLVMValueRef base_ptr =
+         LLVMBuildBitCast(builder, reg_storage,
+                          LLVMPointerType(reg_bld->elem_type, 0), "");
+      LLVMValueRef pred = bld->exec_mask.has_mask ?
+         bld->exec_mask.exec_mask : NULL;
+
+      for (i = 0; i < nc; i++) {
+         LLVMValueRef indirect_offset;
+
+         if (!(writemask & (1 << i)))
+            continue;
+
+         indirect_offset = get_soa_array_offsets(&bld_base->uint_bld, index,
+                                                 nc, i);
+         for (j = 0; j < reg_bld->type.length; j++) {
+            LLVMValueRef jj = lp_build_const_int32(gallivm, j);
+            LLVMValueRef idx =
+               LLVMBuildExtractElement(builder, indirect_offset, jj, "");
+            LLVMValueRef scalar_ptr =
+               LLVMBuildGEP(builder, base_ptr, &idx, 1, "scatter_ptr");
+            LLVMValueRef val =
+               LLVMBuildExtractElement(builder, dst[i], jj, "scatter_val");
+
+            if (pred) {
+               LLVMValueRef scalar_pred =
+                  LLVMBuildExtractElement(builder, pred, jj, "scatter_pred");
+               LLVMValueRef dst_val = LLVMBuildLoad(builder, scalar_ptr, "");
+
+               scalar_pred = LLVMBuildICmp(builder, LLVMIntNE, scalar_pred,
+                                           lp_build_const_int32(gallivm, 0),
+                                           "");
+               val = LLVMBuildSelect(builder, scalar_pred, val, dst_val, "");
+            }
+            LLVMBuildStore(builder, val, scalar_ptr);
+         }
+      }
+   } else {
+      for (i = 0; i < nc; i++) {
+         LLVMValueRef this_storage;
+
+         if (!(writemask & (1 << i)))
+            continue;
+
+         this_storage =
+            lp_build_array_get_ptr(gallivm, reg_storage,
+                                   lp_build_const_int32(gallivm,
+                                                        reg->base_offset * nc + i));
+         reg_store_masked(bld_base, reg_bld, dst[i], this_storage);
+      }
+   }
+}
+
+
+/**
+ * Gather 32 bit values, the lanes flagged in overflow_mask read the first
+ * element and return 0, see build_gather() in lp_bld_tgsi_soa.c.
+ */
+static LLVMValueRef
+build_gather(struct lp_build_nir_context *bld_base,
+             LLVMValueRef base_ptr,
+             LLVMValueRef indexes,
+             LLVMValueRef overflow_mask)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef res = uint_bld->undef;
+   unsigned i;
+
+   indexes = lp_build_select(uint_bld, overflow_mask, uint_bld->zero, indexes);
+
+   for (i = 0; i < uint_bld->type.length; i++) {
+      LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+      LLVMValueRef index = LLVMBuildExtractElement(builder, indexes, ii, "");
+      LLVMValueRef scalar_ptr = LLVMBuildGEP(builder, base_ptr,
+                                             &index, 1, "gather_ptr");
+      LLVMValueRef scalar = LLVMBuildLoad(builder, scalar_ptr, "");
+
+      res = LLVMBuildInsertElement(builder, res, scalar, ii, "");
+   }
+
+   return lp_build_select(uint_bld, overflow_mask, uint_bld->zero, res);
+}
+
+
+static LLVMValueRef
+merge_64bit(struct lp_build_nir_context *bld_base,
+            LLVMValueRef lo,
+            LLVMValueRef hi)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   struct lp_build_context *uint64_bld = &bld_base->uint64_bld;
+
+   lo = LLVMBuildZExt(builder, lo, uint64_bld->vec_type, "");
+   hi = LLVMBuildZExt(builder, hi, uint64_bld->vec_type, "");
+   hi = lp_build_shl_imm(uint64_bld, hi, 32);
+   return LLVMBuildOr(builder, lo, hi, "");
+}
+
+
+static void
+emit_load_ubo(struct lp_build_nir_context *bld_base,
+              unsigned nc,
+              unsigned bit_size,
+              bool offset_is_uniform,
+              LLVMValueRef index,
+              LLVMValueRef offset,
+              LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef consts_ptr = lp_build_array_get(gallivm, bld->consts_ptr, index);
+   unsigned dwords = bit_size == 64 ? 2 : 1;
+   unsigned c;
+
+   consts_ptr = LLVMBuildBitCast(builder, consts_ptr,
+                                 LLVMPointerType(uint_bld->elem_type, 0), "");
+
+   /* Offsets in bytes to offsets in dwords */
+   offset = lp_build_shr_imm(uint_bld, offset, 2);
+
+   if (offset_is_uniform) {
+      LLVMTypeRef ptr_type =
+         LLVMPointerType(get_int_bld(bld_base, true, bit_size)->elem_type, 0);
+
+      offset = LLVMBuildExtractElement(builder, offset,
+                                       lp_build_const_int32(gallivm, 0), "");
+
+      for (c = 0; c < nc; c++) {
+         LLVMValueRef this_offset =
+            LLVMBuildAdd(builder, offset,
+                         lp_build_const_int32(gallivm, c * dwords), "");
+         LLVMValueRef scalar_ptr = LLVMBuildGEP(builder, consts_ptr,
+                                                &this_offset, 1, "");
+         LLVMValueRef scalar;
+
+         scalar_ptr = LLVMBuildBitCast(builder, scalar_ptr, ptr_type, "");
+         scalar = LLVMBuildLoad(builder, scalar_ptr, "");
+         result[c] = lp_build_broadcast_scalar(get_int_bld(bld_base, true,
+                                                           bit_size),
+                                               scalar);
+      }
+   } else {
+      /* The sizes are in vec4 units */
+      LLVMValueRef num_consts =
+         lp_build_array_get(gallivm, bld->const_sizes_ptr, index);
+
+      num_consts = LLVMBuildShl(builder, num_consts,
+                                lp_build_const_int32(gallivm, 2), "");
+      num_consts = lp_build_broadcast_scalar(uint_bld, num_consts);
+
+      for (c = 0; c < nc; c++) {
+         LLVMValueRef parts[2];
+         unsigned d;
+
+         for (d = 0; d < dwords; d++) {
+            LLVMValueRef this_offset =
+               lp_build_add(uint_bld, offset,
+                            lp_build_const_int_vec(gallivm, uint_bld->type,
+                                                   c * dwords + d));
+            LLVMValueRef overflow_mask =
+               lp_build_compare(gallivm, uint_bld->type, PIPE_FUNC_GEQUAL,
+                                this_offset, num_consts);
+
+            parts[d] = build_gather(bld_base, consts_ptr, this_offset,
+                                    overflow_mask);
+         }
+         result[c] = bit_size == 64 ? merge_64bit(bld_base, parts[0], parts[1]) :
+                                      parts[0];
+      }
+   }
+}
+
+
+/**
+ * Get the storage of a shader buffer or of the shared memory (index is
+ * NULL), along with its size limit in dwords.
+ */
+static LLVMValueRef
+get_mem_ptr(struct lp_build_nir_context *bld_base,
+            LLVMValueRef index,
+            LLVMValueRef *ssbo_limit)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef ptr;
+
+   if (!index) {
+      *ssbo_limit = lp_build_const_int_vec(gallivm, bld_base->uint_bld.type,
+                                           bld->shared_size / 4);
+      return bld->shared_ptr;
+   }
+
+   ptr = lp_build_array_get(gallivm, bld->ssbo_ptr, index);
+   ptr = LLVMBuildBitCast(builder, ptr,
+                          LLVMPointerType(bld_base->uint_bld.elem_type, 0), "");
+
+   *ssbo_limit = lp_build_array_get(gallivm, bld->ssbo_sizes_ptr, index);
+   *ssbo_limit = LLVMBuildAShr(builder, *ssbo_limit,
+                               lp_build_const_int32(gallivm, 2), "");
+   *ssbo_limit = lp_build_broadcast_scalar(&bld_base->uint_bld, *ssbo_limit);
+   return ptr;
+}
+
+
+static LLVMValueRef
+get_mem_exec_mask(struct lp_build_nir_context *bld_base,
+                  LLVMValueRef loop_index,
+                  LLVMValueRef ssbo_limit)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef exec_mask = mask_vec(bld_base);
+
+   if (ssbo_limit) {
+      LLVMValueRef ssbo_oob_cmp = lp_build_cmp(&bld_base->uint_bld,
+                                               PIPE_FUNC_LESS, loop_index,
+                                               ssbo_limit);
+      exec_mask = LLVMBuildAnd(builder, exec_mask, ssbo_oob_cmp, "");
+   }
+   return exec_mask;
+}
+
+
+static LLVMValueRef
+emit_load_mem_dword(struct lp_build_nir_context *bld_base,
+                    LLVMValueRef scalar_ptr,
+                    LLVMValueRef ssbo_limit,
+                    LLVMValueRef loop_index)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef exec_mask = get_mem_exec_mask(bld_base, loop_index,
+                                              ssbo_limit);
+   LLVMValueRef result = lp_build_alloca(gallivm, uint_bld->vec_type, "");
+   struct lp_build_loop_state loop_state;
+   struct lp_build_if_state ifthen;
+   LLVMValueRef cond, temp_res, scalar;
+
+   lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+
+   loop_index = LLVMBuildExtractElement(gallivm->builder, loop_index,
+                                        loop_state.counter, "");
+
+   cond = LLVMBuildICmp(gallivm->builder, LLVMIntNE, exec_mask, uint_bld->zero, "");
+   cond = LLVMBuildExtractElement(gallivm->builder, cond, loop_state.counter, "");
+
+   lp_build_if(&ifthen, gallivm, cond);
+   scalar = lp_build_pointer_get(builder, scalar_ptr, loop_index);
+
+   temp_res = LLVMBuildLoad(builder, result, "");
+   temp_res = LLVMBuildInsertElement(builder, temp_res, scalar, loop_state.counter, "");
+   LLVMBuildStore(builder, temp_res, result);
+   lp_build_else(&ifthen);
+   temp_res = LLVMBuildLoad(builder, result, "");
+   temp_res = LLVMBuildInsertElement(builder, temp_res, lp_build_const_int32(gallivm, 0), loop_state.counter, "");
+   LLVMBuildStore(builder, temp_res, result);
+   lp_build_endif(&ifthen);
+   lp_build_loop_end_cond(&loop_state, lp_build_const_int32(gallivm, uint_bld->type.length),
+                          NULL, LLVMIntUGE);
+   return LLVMBuildLoad(gallivm->builder, result, "");
+}
+
+
+static void
+emit_load_mem(struct lp_build_nir_context *bld_base,
+              unsigned nc,
+              unsigned bit_size,
+              LLVMValueRef index,
+              LLVMValueRef offset,
+              LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   unsigned dwords = bit_size == 64 ? 2 : 1;
+   LLVMValueRef ssbo_limit;
+   LLVMValueRef scalar_ptr = get_mem_ptr(bld_base, index, &ssbo_limit);
+   unsigned c, d;
+
+   offset = lp_build_shr_imm(uint_bld, offset, 2);
+
+   for (c = 0; c < nc; c++) {
+      LLVMValueRef parts[2];
+
+      for (d = 0; d < dwords; d++) {
+         LLVMValueRef loop_index =
+            lp_build_add(uint_bld, offset,
+                         lp_build_const_int_vec(gallivm, uint_bld->type,
+                                                c * dwords + d));
+
+         parts[d] = emit_load_mem_dword(bld_base, scalar_ptr, ssbo_limit,
+                                        loop_index);
+      }
+      result[c] = bit_size == 64 ? merge_64bit(bld_base, parts[0], parts[1]) :
+                                   parts[0];
+   }
+}
+
+
+static void
+emit_store_mem_dword(struct lp_build_nir_context *bld_base,
+                     LLVMValueRef scalar_ptr,
+                     LLVMValueRef ssbo_limit,
+                     LLVMValueRef loop_index,
+                     LLVMValueRef value)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef exec_mask = get_mem_exec_mask(bld_base, loop_index,
+                                              ssbo_limit);
+   struct lp_build_loop_state loop_state;
+   struct lp_build_if_state ifthen;
+   LLVMValueRef cond, value_ptr;
+
+   lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+
+   value_ptr = LLVMBuildExtractElement(gallivm->builder, value,
+                                       loop_state.counter, "");
+
+   loop_index = LLVMBuildExtractElement(gallivm->builder, loop_index,
+                                        loop_state.counter, "");
+
+   cond = LLVMBuildICmp(gallivm->builder, LLVMIntNE, exec_mask, uint_bld->zero, "");
+   cond = LLVMBuildExtractElement(gallivm->builder, cond, loop_state.counter, "");
+   lp_build_if(&ifthen, gallivm, cond);
+   lp_build_pointer_set(builder, scalar_ptr, loop_index, value_ptr);
+   lp_build_endif(&ifthen);
+   lp_build_loop_end_cond(&loop_state, lp_build_const_int32(gallivm, uint_bld->type.length),
+                          NULL, LLVMIntUGE);
+}
+
+
+static void
+emit_store_mem(struct lp_build_nir_context *bld_base,
+               unsigned writemask,
+               unsigned nc,
+               unsigned bit_size,
+               LLVMValueRef index,
+               LLVMValueRef offset,
+               LLVMValueRef dst)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   unsigned dwords = bit_size == 64 ? 2 : 1;
+   unsigned c = ffs(writemask) - 1;
+   LLVMValueRef ssbo_limit;
+   LLVMValueRef scalar_ptr = get_mem_ptr(bld_base, index, &ssbo_limit);
+   LLVMValueRef parts[2];
+   unsigned d;
+
+   offset = lp_build_shr_imm(uint_bld, offset, 2);
+
+   if (bit_size == 64) {
+      parts[0] = LLVMBuildTrunc(builder, dst, uint_bld->vec_type, "");
+      parts[1] = LLVMBuildTrunc(builder,
+                                lp_build_shr_imm(&bld_base->uint64_bld, dst, 32),
+                                uint_bld->vec_type, "");
+   } else {
+      parts[0] = LLVMBuildBitCast(builder, dst, uint_bld->vec_type, "");
+   }
+
+   for (d = 0; d < dwords; d++) {
+      LLVMValueRef loop_index =
+         lp_build_add(uint_bld, offset,
+                      lp_build_const_int_vec(gallivm, uint_bld->type,
+                                             c * dwords + d));
+
+      emit_store_mem_dword(bld_base, scalar_ptr, ssbo_limit, loop_index,
+                           parts[d]);
+   }
+}
+
+
+static void
+emit_atomic_mem(struct lp_build_nir_context *bld_base,
+                nir_intrinsic_op nir_op,
+                LLVMValueRef index,
+                LLVMValueRef offset,
+                LLVMValueRef val,
+                LLVMValueRef val2,
+                LLVMValueRef *result)
+{
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   LLVMValueRef ssbo_limit;
+   LLVMValueRef scalar_ptr = get_mem_ptr(bld_base, index, &ssbo_limit);
+   LLVMValueRef exec_mask, cond, value_ptr, scalar, temp_res;
+   LLVMValueRef atom_res = lp_build_alloca(gallivm, uint_bld->vec_type, "");
+   struct lp_build_loop_state loop_state;
+   struct lp_build_if_state ifthen;
+   LLVMAtomicRMWBinOp op = LLVMAtomicRMWBinOpAdd;
+
+   switch (nir_op) {
+   case nir_intrinsic_ssbo_atomic_add:
+   case nir_intrinsic_shared_atomic_add:
+      op = LLVMAtomicRMWBinOpAdd;
+      break;
+   case nir_intrinsic_ssbo_atomic_exchange:
+   case nir_intrinsic_shared_atomic_exchange:
+      op = LLVMAtomicRMWBinOpXchg;
+      break;
+   case nir_intrinsic_ssbo_atomic_and:
+   case nir_intrinsic_shared_atomic_and:
+      op = LLVMAtomicRMWBinOpAnd;
+      break;
+   case nir_intrinsic_ssbo_atomic_or:
+   case nir_intrinsic_shared_atomic_or:
+      op = LLVMAtomicRMWBinOpOr;
+      break;
+   case nir_intrinsic_ssbo_atomic_xor:
+   case nir_intrinsic_shared_atomic_xor:
+      op = LLVMAtomicRMWBinOpXor;
+      break;
+   case nir_intrinsic_ssbo_atomic_umin:
+   case nir_intrinsic_shared_atomic_umin:
+      op = LLVMAtomicRMWBinOpUMin;
+      break;
+   case nir_intrinsic_ssbo_atomic_umax:
+   case nir_intrinsic_shared_atomic_umax:
+      op = LLVMAtomicRMWBinOpUMax;
+      break;
+   case nir_intrinsic_ssbo_atomic_imin:
+   case nir_intrinsic_shared_atomic_imin:
+      op = LLVMAtomicRMWBinOpMin;
+      break;
+   case nir_intrinsic_ssbo_atomic_imax:
+   case nir_intrinsic_shared_atomic_imax:
+      op = LLVMAtomicRMWBinOpMax;
+      break;
+   case nir_intrinsic_ssbo_atomic_comp_swap:
+   case nir_intrinsic_shared_atomic_comp_swap:
+      break;
+   default:
+      assert(0);
+      break;
+   }
+
+   offset = lp_build_shr_imm(uint_bld, offset, 2);
+   exec_mask = get_mem_exec_mask(bld_base, offset, ssbo_limit);
+
+   lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+
+   value_ptr = LLVMBuildExtractElement(gallivm->builder, val,
+                                       loop_state.counter, "");
+   value_ptr = LLVMBuildBitCast(gallivm->builder, value_ptr, uint_bld->elem_type, "");
+
+   offset = LLVMBuildExtractElement(gallivm->builder, offset,
+                                    loop_state.counter, "");
+
+   scalar_ptr = LLVMBuildGEP(builder, scalar_ptr,
+                             &offset, 1, "");
+
+   cond = LLVMBuildICmp(gallivm->builder, LLVMIntNE, exec_mask, uint_bld->zero, "");
+   cond = LLVMBuildExtractElement(gallivm->builder, cond, loop_state.counter, "");
+   lp_build_if(&ifthen, gallivm, cond);
+
+   if (val2) {
+      LLVMValueRef cas_src_ptr = LLVMBuildExtractElement(gallivm->builder, val2,
+                                                         loop_state.counter, "");
+      cas_src_ptr = LLVMBuildBitCast(gallivm->builder, cas_src_ptr, uint_bld->elem_type, "");
+      scalar = LLVMBuildAtomicCmpXchg(builder, scalar_ptr, value_ptr,
+                                      cas_src_ptr,
+                                      LLVMAtomicOrderingSequentiallyConsistent,
+                                      LLVMAtomicOrderingSequentiallyConsistent,
+                                      false);
+      scalar = LLVMBuildExtractValue(gallivm->builder, scalar, 0, "");
+   } else {
+      scalar = LLVMBuildAtomicRMW(builder, op,
+                                  scalar_ptr, value_ptr,
+                                  LLVMAtomicOrderingSequentiallyConsistent,
+                                  false);
+   }
+   temp_res = LLVMBuildLoad(builder, atom_res, "");
+   temp_res = LLVMBuildInsertElement(builder, temp_res, scalar, loop_state.counter, "");
+   LLVMBuildStore(builder, temp_res, atom_res);
+   lp_build_else(&ifthen);
+   temp_res = LLVMBuildLoad(builder, atom_res, "");
+   temp_res = LLVMBuildInsertElement(builder, temp_res, lp_build_const_int32(gallivm, 0), loop_state.counter, "");
+   LLVMBuildStore(builder, temp_res, atom_res);
+   lp_build_endif(&ifthen);
+
+   lp_build_loop_end_cond(&loop_state, lp_build_const_int32(gallivm, uint_bld->type.length),
+                          NULL, LLVMIntUGE);
+   *result = LLVMBuildLoad(builder, atom_res, "");
+}
+
+
+static LLVMValueRef
+emit_get_buffer_size(struct lp_build_nir_context *bld_base,
+                     LLVMValueRef index)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMValueRef num_ssbo = lp_build_array_get(gallivm, bld->ssbo_sizes_ptr,
+                                              index);
+
+   return lp_build_broadcast_scalar(&bld_base->uint_bld, num_ssbo);
+}
+
+
+static void
+emit_tex(struct lp_build_nir_context *bld_base,
+         struct lp_sampler_params *params)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+
+   params->context_ptr = bld->context_ptr;
+   params->thread_data_ptr = bld->thread_data_ptr;
+   bld->sampler->emit_tex_sample(bld->sampler,
+                                 bld_base->base.gallivm,
+                                 params);
+}
+
+
+static void
+emit_tex_size(struct lp_build_nir_context *bld_base,
+              struct lp_sampler_size_query_params *params)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+
+   params->context_ptr = bld->context_ptr;
+   bld->sampler->emit_size_query(bld->sampler,
+                                 bld_base->base.gallivm,
+                                 params);
+}
+
+
+static void
+emit_sysval_intrin(struct lp_build_nir_context *bld_base,
+                   nir_intrinsic_instr *instr,
+                   LLVMValueRef result[NIR_MAX_VEC_COMPONENTS])
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct lp_bld_tgsi_system_values *sv = &bld->system_values;
+   unsigned i;
+
+   switch (instr->intrinsic) {
+   case nir_intrinsic_load_instance_id:
+      result[0] = lp_build_broadcast_scalar(uint_bld, sv->instance_id);
+      break;
+   case nir_intrinsic_load_base_vertex:
+      result[0] = sv->basevertex;
+      break;
+   case nir_intrinsic_load_vertex_id:
+      result[0] = sv->vertex_id;
+      break;
+   case nir_intrinsic_load_vertex_id_zero_base:
+      result[0] = sv->vertex_id_nobase;
+      break;
+   case nir_intrinsic_load_primitive_id:
+      result[0] = sv->prim_id;
+      break;
+   case nir_intrinsic_load_invocation_id:
+      result[0] = lp_build_broadcast_scalar(uint_bld, sv->invocation_id);
+      break;
+   case nir_intrinsic_load_local_invocation_id:
+      for (i = 0; i < 3; i++)
+         result[i] = sv->thread_id[i];
+      break;
+   case nir_intrinsic_load_work_group_id:
+      for (i = 0; i < 3; i++)
+         result[i] = lp_build_broadcast_scalar(uint_bld, sv->block_id[i]);
+      break;
+   case nir_intrinsic_load_num_work_groups:
+      for (i = 0; i < 3; i++)
+         result[i] = lp_build_broadcast_scalar(uint_bld, sv->grid_size[i]);
+      break;
+   case nir_intrinsic_load_local_group_size:
+      for (i = 0; i < 3; i++)
+         result[i] = lp_build_broadcast_scalar(uint_bld, sv->block_size[i]);
+      break;
+   default:
+      assert(0);
+      break;
+   }
+}
+
+
+/**
+ * The kill mask is the mask of the lanes which stay alive.
+ */
+static void
+discard(struct lp_build_nir_context *bld_base,
+        LLVMValueRef cond)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef mask;
+
+   if (!cond) {
+      if (bld->exec_mask.has_mask) {
+         mask = LLVMBuildNot(builder, bld->exec_mask.exec_mask, "kilp");
+      } else {
+         mask = LLVMConstNull(bld_base->base.int_vec_type);
+      }
+   } else {
+      mask = LLVMBuildNot(builder, cond, "");
+      if (bld->exec_mask.has_mask) {
+         LLVMValueRef invmask;
+         invmask = LLVMBuildNot(builder, bld->exec_mask.exec_mask, "kilp");
+         mask = LLVMBuildOr(builder, mask, invmask, "");
+      }
+   }
+   lp_build_mask_update(bld->mask, mask);
+   lp_build_mask_check(bld->mask);
+}
+
+
+static void
+bgnloop(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   lp_exec_bgnloop(&bld->exec_mask);
+}
+
+
+static void
+endloop(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   lp_exec_endloop(bld_base->base.gallivm, &bld->exec_mask);
+}
+
+
+static void
+if_cond(struct lp_build_nir_context *bld_base,
+        LLVMValueRef cond)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMValueRef tmp;
+
+   tmp = lp_build_cmp(&bld_base->int_bld, PIPE_FUNC_NOTEQUAL, cond,
+                      bld_base->int_bld.zero);
+   lp_exec_mask_cond_push(&bld->exec_mask, tmp);
+}
+
+
+static void
+else_stmt(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   lp_exec_mask_cond_invert(&bld->exec_mask);
+}
+
+
+static void
+endif_stmt(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   lp_exec_mask_cond_pop(&bld->exec_mask);
+}
+
+
+static void
+break_stmt(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   lp_exec_break(&bld->exec_mask, NULL, false);
+}
+
+
+static void
+continue_stmt(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   lp_exec_continue(&bld->exec_mask);
+}
+
+
+static void
+emit_barrier(struct lp_build_nir_context *bld_base)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+
+   if (bld->cs_iface && bld->cs_iface->emit_barrier)
+      bld->cs_iface->emit_barrier(bld->cs_iface, &bld_base->base);
+}
+
+
+static void
+increment_vec_ptr_by_mask(struct lp_build_nir_context *bld_base,
+                          LLVMValueRef ptr,
+                          LLVMValueRef mask)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef current_vec = LLVMBuildLoad(builder, ptr, "");
+
+   current_vec = LLVMBuildSub(builder, current_vec, mask, "");
+
+   LLVMBuildStore(builder, current_vec, ptr);
+}
+
+
+static void
+clear_uint_vec_ptr_from_mask(struct lp_build_nir_context *bld_base,
+                             LLVMValueRef ptr,
+                             LLVMValueRef mask)
+{
+   LLVMBuilderRef builder = bld_base->base.gallivm->builder;
+   LLVMValueRef current_vec = LLVMBuildLoad(builder, ptr, "");
+
+   current_vec = lp_build_select(&bld_base->uint_bld,
+                                 mask,
+                                 bld_base->uint_bld.zero,
+                                 current_vec);
+
+   LLVMBuildStore(builder, current_vec, ptr);
+}
+
+
+static LLVMValueRef
+clamp_mask_to_max_output_vertices(struct lp_build_nir_soa_context *bld,
+                                  LLVMValueRef current_mask_vec,
+                                  LLVMValueRef total_emitted_vertices_vec)
+{
+   LLVMBuilderRef builder = bld->bld_base.base.gallivm->builder;
+   struct lp_build_context *int_bld = &bld->bld_base.int_bld;
+   LLVMValueRef max_mask = lp_build_cmp(int_bld, PIPE_FUNC_LESS,
+                                        total_emitted_vertices_vec,
+                                        bld->max_output_vertices_vec);
+
+   return LLVMBuildAnd(builder, current_mask_vec, max_mask, "");
+}
+
+
+/*
+ * Only the vertex stream 0 is supported, like with TGSI the other streams
+ * are emitted to it.
+ */
+static void
+emit_vertex(struct lp_build_nir_context *bld_base,
+            uint32_t stream_id)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMBuilderRef builder = bld->bld_base.base.gallivm->builder;
+
+   if (bld->gs_iface->emit_vertex) {
+      LLVMValueRef mask = mask_vec(bld_base);
+      LLVMValueRef total_emitted_vertices_vec =
+         LLVMBuildLoad(builder, bld->total_emitted_vertices_vec_ptr, "");
+
+      mask = clamp_mask_to_max_output_vertices(bld, mask,
+                                               total_emitted_vertices_vec);
+      bld->gs_iface->emit_vertex(bld->gs_iface, &bld->bld_base.base,
+                                 bld->outputs,
+                                 total_emitted_vertices_vec);
+      increment_vec_ptr_by_mask(bld_base, bld->emitted_vertices_vec_ptr,
+                                mask);
+      increment_vec_ptr_by_mask(bld_base, bld->total_emitted_vertices_vec_ptr,
+                                mask);
+   }
+}
+
+
+static void
+end_primitive_masked(struct lp_build_nir_context *bld_base,
+                     LLVMValueRef mask)
+{
+   struct lp_build_nir_soa_context *bld = lp_nir_soa_context(bld_base);
+   LLVMBuilderRef builder = bld->bld_base.base.gallivm->builder;
+
+   if (bld->gs_iface->end_primitive) {
+      struct lp_build_context *uint_bld = &bld_base->uint_bld;
+      LLVMValueRef emitted_vertices_vec =
+         LLVMBuildLoad(builder, bld->emitted_vertices_vec_ptr, "");
+      LLVMValueRef emitted_prims_vec =
+         LLVMBuildLoad(builder, bld->emitted_prims_vec_ptr, "");
+      LLVMValueRef emitted_mask = lp_build_cmp(uint_bld, PIPE_FUNC_NOTEQUAL,
+                                               emitted_vertices_vec,
+                                               uint_bld->zero);
+
+      /* Only end the primitives on the lanes which have unflushed
+       * vertices */
+      mask = LLVMBuildAnd(builder, mask, emitted_mask, "");
+
+      bld->gs_iface->end_primitive(bld->gs_iface, &bld->bld_base.base,
+                                   emitted_vertices_vec,
+                                   emitted_prims_vec);
+      increment_vec_ptr_by_mask(bld_base, bld->emitted_prims_vec_ptr,
+                                mask);
+      clear_uint_vec_ptr_from_mask(bld_base, bld->emitted_vertices_vec_ptr,
+                                   mask);
+   }
+}
+
+
+static void
+end_primitive(struct lp_build_nir_context *bld_base,
+              uint32_t stream_id)
+{
+   end_primitive_masked(bld_base, mask_vec(bld_base));
+}
+
+
+/**
+ * Allocate the output registers, like TGSI's emit_declaration() does for
+ * TGSI_FILE_OUTPUT.  Every channel of every slot a variable covers gets
+ * one, so the fragment shader's depth/stencil/sample mask channels are
+ * there too.
+ */
+static void
+emit_output_decls(struct lp_build_nir_soa_context *bld,
+                  struct nir_shader *shader)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMTypeRef vec_type = bld->bld_base.base.vec_type;
+
+   nir_foreach_variable(var, &shader->outputs) {
+      unsigned num_slots, slot, chan;
+
+      if (var->data.compact)
+         num_slots = DIV_ROUND_UP(var->data.location_frac +
+                                  glsl_get_length(var->type), 4);
+      else
+         num_slots = glsl_count_attribute_slots(var->type, false);
+
+      for (slot = var->data.driver_location;
+           slot < var->data.driver_location + num_slots; slot++) {
+         assert(slot < PIPE_MAX_SHADER_OUTPUTS);
+         for (chan = 0; chan < TGSI_NUM_CHANNELS; chan++)
+            bld->outputs[slot][chan] = lp_build_alloca(gallivm, vec_type,
+                                                       "output");
+      }
+   }
+}
+
+
+void
+lp_build_nir_soa(struct gallivm_state *gallivm,
+                 struct nir_shader *shader,
+                 const struct lp_build_tgsi_params *params,
+                 LLVMValueRef (*outputs)[4])
+{
+   struct lp_build_nir_soa_context bld;
+   struct lp_type type = params->type;
+
+   assert(type.length <= LP_MAX_VECTOR_LENGTH);
+
+   /* Setup build context */
+   memset(&bld, 0, sizeof bld);
+   lp_build_context_init(&bld.bld_base.base, gallivm, type);
+   lp_build_context_init(&bld.bld_base.uint_bld, gallivm, lp_uint_type(type));
+   lp_build_context_init(&bld.bld_base.int_bld, gallivm, lp_int_type(type));
+   {
+      struct lp_type dbl_type;
+      dbl_type = type;
+      dbl_type.width *= 2;
+      lp_build_context_init(&bld.bld_base.dbl_bld, gallivm, dbl_type);
+   }
+   {
+      struct lp_type uint64_type;
+      uint64_type = lp_uint_type(type);
+      uint64_type.width *= 2;
+      lp_build_context_init(&bld.bld_base.uint64_bld, gallivm, uint64_type);
+   }
+   {
+      struct lp_type int64_type;
+      int64_type = lp_int_type(type);
+      int64_type.width *= 2;
+      lp_build_context_init(&bld.bld_base.int64_bld, gallivm, int64_type);
+   }
+
+   bld.bld_base.load_var = emit_load_var;
+   bld.bld_base.store_var = emit_store_var;
+   bld.bld_base.load_reg = emit_load_reg;
+   bld.bld_base.store_reg = emit_store_reg;
+   bld.bld_base.load_ubo = emit_load_ubo;
+   bld.bld_base.load_mem = emit_load_mem;
+   bld.bld_base.store_mem = emit_store_mem;
+   bld.bld_base.atomic_mem = emit_atomic_mem;
+   bld.bld_base.get_buffer_size = emit_get_buffer_size;
+   bld.bld_base.tex = emit_tex;
+   bld.bld_base.tex_size = emit_tex_size;
+   bld.bld_base.sysval_intrin = emit_sysval_intrin;
+   bld.bld_base.discard = discard;
+   bld.bld_base.bgnloop = bgnloop;
+   bld.bld_base.endloop = endloop;
+   bld.bld_base.if_cond = if_cond;
+   bld.bld_base.else_stmt = else_stmt;
+   bld.bld_base.endif_stmt = endif_stmt;
+   bld.bld_base.break_stmt = break_stmt;
+   bld.bld_base.continue_stmt = continue_stmt;
+   bld.bld_base.barrier = emit_barrier;
+   bld.bld_base.emit_vertex = emit_vertex;
+   bld.bld_base.end_primitive = end_primitive;
+
+   bld.mask = params->mask;
+   bld.inputs = params->inputs;
+   bld.outputs = outputs;
+   bld.consts_ptr = params->consts_ptr;
+   bld.const_sizes_ptr = params->const_sizes_ptr;
+   bld.ssbo_ptr = params->ssbo_ptr;
+   bld.ssbo_sizes_ptr = params->ssbo_sizes_ptr;
+   bld.shared_ptr = params->shared_ptr;
+   bld.shared_size = params->shared_size;
+   bld.sampler = params->sampler;
+   bld.context_ptr = params->context_ptr;
+   bld.thread_data_ptr = params->thread_data_ptr;
+   bld.cs_iface = params->cs_iface;
+   bld.gs_iface = params->gs_iface;
+   bld.system_values = *params->system_values;
+
+   if (bld.gs_iface) {
+      struct lp_build_context *uint_bld = &bld.bld_base.uint_bld;
+      unsigned max_output_vertices = shader->info.gs.vertices_out;
+
+      if (!max_output_vertices)
+         max_output_vertices = 32;
+
+      bld.max_output_vertices_vec =
+         lp_build_const_int_vec(gallivm, bld.bld_base.int_bld.type,
+                                max_output_vertices);
+
+      bld.emitted_prims_vec_ptr =
+         lp_build_alloca(gallivm,
+                         uint_bld->vec_type,
+                         "emitted_prims_ptr");
+      bld.emitted_vertices_vec_ptr =
+         lp_build_alloca(gallivm,
+                         uint_bld->vec_type,
+                         "emitted_vertices_ptr");
+      bld.total_emitted_vertices_vec_ptr =
+         lp_build_alloca(gallivm,
+                         uint_bld->vec_type,
+                         "total_emitted_vertices_ptr");
+
+      LLVMBuildStore(gallivm->builder, uint_bld->zero,
+                     bld.emitted_prims_vec_ptr);
+      LLVMBuildStore(gallivm->builder, uint_bld->zero,
+                     bld.emitted_vertices_vec_ptr);
+      LLVMBuildStore(gallivm->builder, uint_bld->zero,
+                     bld.total_emitted_vertices_vec_ptr);
+   }
+
+   lp_exec_mask_init(&bld.exec_mask, &bld.bld_base.int_bld);
+
+   emit_output_decls(&bld, shader);
+   lp_build_nir_llvm(&bld.bld_base, shader);
+
+   if (bld.gs_iface) {
+      LLVMBuilderRef builder = bld.bld_base.base.gallivm->builder;
+      LLVMValueRef total_emitted_vertices_vec;
+      LLVMValueRef emitted_prims_vec;
+
+      /* implicit end_primitives, needed in case there are any unflushed
+         vertices in the cache. Note must not call end_primitive here
+         since the exec_mask is not valid at this point. */
+      end_primitive_masked(&bld.bld_base, lp_build_mask_value(bld.mask));
+      total_emitted_vertices_vec =
+         LLVMBuildLoad(builder, bld.total_emitted_vertices_vec_ptr, "");
+      emitted_prims_vec =
+         LLVMBuildLoad(builder, bld.emitted_prims_vec_ptr, "");
+
+      bld.gs_iface->gs_epilogue(bld.gs_iface,
+                                &bld.bld_base.base,
+                                total_emitted_vertices_vec,
+                                emitted_prims_vec);
+   }
+   lp_exec_mask_fini(&bld.exec_mask);
+}
@@ -2077,3 +2077,65 @@ lp_build_sample_offset(struct lp_build_context *bld,
 
    *out_offset = offset;
 }
+
+
+/**
+ * Compute the offset of a texel of a tiled texture.
+ *
+ * Same as lp_build_sample_offset, but for textures laid out in tiles of
+ * LP_SAMPLER_TILE_SIZE x LP_SAMPLER_TILE_SIZE texels.  Only formats with
+ * 1x1 pixel blocks of power of two size can be tiled, so there are no
+ * sub-block coordinates.  y_stride is still the stride of a single texel row.
+ */
+void
+lp_build_sample_tiled_offset(struct lp_build_context *bld,
+                             const struct util_format_description *format_desc,
+                             LLVMValueRef x,
+                             LLVMValueRef y,
+                             LLVMValueRef z,
+                             LLVMValueRef y_stride,
+                             LLVMValueRef z_stride,
+                             LLVMValueRef *out_offset)
+{
+   const unsigned tile_shift = util_logbase2(LP_SAMPLER_TILE_SIZE);
+   LLVMValueRef tile_mask;
+   LLVMValueRef texel;
+   LLVMValueRef offset;
+
+   assert(format_desc->block.width == 1);
+   assert(format_desc->block.height == 1);
+   assert(util_is_power_of_two_nonzero(format_desc->block.bits));
+
+   tile_mask = lp_build_const_int_vec(bld->gallivm, bld->type,
+                                      LP_SAMPLER_TILE_SIZE - 1);
+
+   /*
+    * Texel index within the row of tiles:
+    *   (x & ~mask) * tile_size + (y & mask) * tile_size + (x & mask)
+    * where the three terms don't overlap, so they can be or'ed together.
+    */
+   texel = lp_build_andnot(bld, x, tile_mask);
+   texel = lp_build_shl_imm(bld, texel, tile_shift);
+   texel = lp_build_or(bld, texel, lp_build_and(bld, x, tile_mask));
+
+   if (y && y_stride) {
+      LLVMValueRef sub_y = lp_build_and(bld, y, tile_mask);
+      texel = lp_build_or(bld, texel, lp_build_shl_imm(bld, sub_y, tile_shift));
+   }
+
+   offset = lp_build_mul_imm(bld, texel, format_desc->block.bits / 8);
+
+   if (y && y_stride) {
+      LLVMValueRef y_offset;
+      y_offset = lp_build_mul(bld, lp_build_andnot(bld, y, tile_mask), y_stride);
+      offset = lp_build_add(bld, offset, y_offset);
+   }
+
+   if (z && z_stride) {
+      LLVMValueRef z_offset;
+      z_offset = lp_build_mul(bld, z, z_stride);
+      offset = lp_build_add(bld, offset, z_offset);
+   }
+
+   *out_offset = offset;
+}
@@ -122,6 +122,16 @@ struct lp_sampler_size_query_params
    LLVMValueRef explicit_lod;
    LLVMValueRef *sizes_out;
 };
+/**
+ * Width and height, in texels, of the tiles of tiled textures.
+ *
+ * Tiles are stored contiguously, left to right, and each row of tiles takes
+ * LP_SAMPLER_TILE_SIZE rows of the texture image.  Within a tile texels are
+ * stored in row-major order.
+ */
+#define LP_SAMPLER_TILE_SIZE 4
+
+
 /**
  * Texture static state.
  *
@@ -143,6 +153,7 @@ struct lp_static_texture_state
    unsigned pot_height:1;
    unsigned pot_depth:1;
    unsigned level_zero_only:1;
+   unsigned tiled:1;         /**< texels stored in LP_SAMPLER_TILE_SIZE tiles */
 };
 
 
@@ -603,6 +614,17 @@ lp_build_sample_offset(struct lp_build_context *bld,
                        LLVMValueRef *out_j);
 
 
+void
+lp_build_sample_tiled_offset(struct lp_build_context *bld,
+                             const struct util_format_description *format_desc,
+                             LLVMValueRef x,
+                             LLVMValueRef y,
+                             LLVMValueRef z,
+                             LLVMValueRef y_stride,
+                             LLVMValueRef z_stride,
+                             LLVMValueRef *out_offset);
+
+
 void
 lp_build_sample_soa(const struct lp_static_texture_state *static_texture_state,
                     const struct lp_static_sampler_state *static_sampler_state,
@@ -137,10 +137,19 @@ lp_build_sample_texel_soa(struct lp_build_sample_context *bld,
    }
 
    /* convert x,y,z coords to linear offset from start of texture, in bytes */
-   lp_build_sample_offset(&bld->int_coord_bld,
-                          bld->format_desc,
-                          x, y, z, y_stride, z_stride,
-                          &offset, &i, &j);
+   if (bld->static_texture_state->tiled) {
+      lp_build_sample_tiled_offset(&bld->int_coord_bld,
+                                   bld->format_desc,
+                                   x, y, z, y_stride, z_stride,
+                                   &offset);
+      i = j = bld->int_coord_bld.zero;
+   }
+   else {
+      lp_build_sample_offset(&bld->int_coord_bld,
+                             bld->format_desc,
+                             x, y, z, y_stride, z_stride,
+                             &offset, &i, &j);
+   }
    if (mipoffsets) {
       offset = lp_build_add(&bld->int_coord_bld, offset, mipoffsets);
    }
@@ -2671,10 +2680,19 @@ lp_build_fetch_texel(struct lp_build_sample_context *bld,
       }
    }
 
-   lp_build_sample_offset(int_coord_bld,
-                          bld->format_desc,
-                          x, y, z, row_stride_vec, img_stride_vec,
-                          &offset, &i, &j);
+   if (bld->static_texture_state->tiled) {
+      lp_build_sample_tiled_offset(int_coord_bld,
+                                   bld->format_desc,
+                                   x, y, z, row_stride_vec, img_stride_vec,
+                                   &offset);
+      i = j = int_coord_bld->zero;
+   }
+   else {
+      lp_build_sample_offset(int_coord_bld,
+                             bld->format_desc,
+                             x, y, z, row_stride_vec, img_stride_vec,
+                             &offset, &i, &j);
+   }
 
    if (bld->static_texture_state->target != PIPE_BUFFER) {
       offset = lp_build_add(int_coord_bld, offset,
@@ -3117,6 +3135,11 @@ lp_build_sample_soa_code(struct gallivm_state *gallivm,
          use_aos = 0;
       }
 
+      /* the AoS path computes linear texel offsets on its own */
+      if (static_texture_state->tiled) {
+         use_aos = 0;
+      }
+
       if (dims > 1) {
          use_aos &= lp_is_simple_wrap_mode(derived_sampler_state.wrap_t);
          if (dims > 2) {
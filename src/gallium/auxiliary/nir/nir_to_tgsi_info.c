@@ -0,0 +1,408 @@
+/*
+ * Copyright 2019 VMware, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/*
+ * tgsi_scan_shader() for NIR shaders, so the code using tgsi_shader_info
+ * (the draw module and the parts of the drivers which don't depend on the
+ * IR) works unchanged.
+ */
+
+#include "compiler/nir/nir.h"
+#include "tgsi/tgsi_from_mesa.h"
+#include "tgsi/tgsi_info.h"
+#include "tgsi/tgsi_scan.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+
+#include "nir_to_tgsi_info.h"
+
+
+static unsigned
+get_var_slots(const nir_shader *nir, const nir_variable *var)
+{
+   const struct glsl_type *type = var->type;
+
+   if (nir_is_per_vertex_io(var, nir->info.stage)) {
+      assert(glsl_type_is_array(type));
+      type = glsl_get_array_element(type);
+   }
+
+   if (var->data.compact) {
+      return DIV_ROUND_UP(var->data.location_frac + glsl_get_length(type), 4);
+   }
+
+   return glsl_count_attribute_slots(type,
+                                     nir->info.stage == MESA_SHADER_VERTEX &&
+                                     var->data.mode == nir_var_shader_in);
+}
+
+
+/*
+ * The channels used by each slot of the variable.  Everything but
+ * the plain vectors and scalars uses the full slots.
+ */
+static unsigned
+get_var_usage_mask(const nir_shader *nir, const nir_variable *var)
+{
+   const struct glsl_type *type = glsl_without_array(var->type);
+   unsigned comps;
+
+   if (var->data.compact || !glsl_type_is_vector_or_scalar(type))
+      return TGSI_WRITEMASK_XYZW;
+
+   comps = glsl_get_vector_elements(type);
+   if (glsl_type_is_64bit(type))
+      comps *= 2;
+   if (var->data.location_frac + comps > 4)
+      return TGSI_WRITEMASK_XYZW;
+   return ((1 << comps) - 1) << var->data.location_frac;
+}
+
+
+static unsigned
+get_interp_mode(const nir_variable *var, unsigned semantic_name)
+{
+   switch (var->data.interpolation) {
+   case INTERP_MODE_FLAT:
+      return TGSI_INTERPOLATE_CONSTANT;
+   case INTERP_MODE_NOPERSPECTIVE:
+      return TGSI_INTERPOLATE_LINEAR;
+   case INTERP_MODE_SMOOTH:
+      return TGSI_INTERPOLATE_PERSPECTIVE;
+   default:
+      if (semantic_name == TGSI_SEMANTIC_COLOR)
+         return TGSI_INTERPOLATE_COLOR;
+      if (semantic_name == TGSI_SEMANTIC_POSITION)
+         return TGSI_INTERPOLATE_LINEAR;
+      if (semantic_name == TGSI_SEMANTIC_FACE ||
+          semantic_name == TGSI_SEMANTIC_PRIMID)
+         return TGSI_INTERPOLATE_CONSTANT;
+      return TGSI_INTERPOLATE_PERSPECTIVE;
+   }
+}
+
+
+static void
+scan_inputs(const nir_shader *nir,
+            struct tgsi_shader_info *info,
+            bool need_texcoord)
+{
+   nir_foreach_variable(var, &nir->inputs) {
+      unsigned slots = get_var_slots(nir, var);
+      unsigned i;
+
+      for (i = 0; i < slots; i++) {
+         unsigned index = var->data.driver_location + i;
+         unsigned semantic_name, semantic_index;
+
+         if (index >= PIPE_MAX_SHADER_INPUTS)
+            break;
+
+         if (nir->info.stage == MESA_SHADER_VERTEX) {
+            semantic_name = TGSI_SEMANTIC_GENERIC;
+            semantic_index = index;
+         } else {
+            tgsi_get_gl_varying_semantic(var->data.location + i,
+                                         need_texcoord,
+                                         &semantic_name, &semantic_index);
+         }
+
+         info->input_semantic_name[index] = semantic_name;
+         info->input_semantic_index[index] = semantic_index;
+         info->input_usage_mask[index] |= get_var_usage_mask(nir, var);
+
+         if (nir->info.stage == MESA_SHADER_FRAGMENT) {
+            info->input_interpolate[index] =
+               get_interp_mode(var, semantic_name);
+            if (var->data.sample)
+               info->input_interpolate_loc[index] = TGSI_INTERPOLATE_LOC_SAMPLE;
+            else if (var->data.centroid)
+               info->input_interpolate_loc[index] = TGSI_INTERPOLATE_LOC_CENTROID;
+            else
+               info->input_interpolate_loc[index] = TGSI_INTERPOLATE_LOC_CENTER;
+
+            if (semantic_name == TGSI_SEMANTIC_FACE)
+               info->uses_frontface = TRUE;
+            else if (semantic_name == TGSI_SEMANTIC_PRIMID)
+               info->uses_primid = TRUE;
+            else if (semantic_name == TGSI_SEMANTIC_POSITION)
+               info->reads_position = TRUE;
+         }
+
+         info->num_inputs = MAX2(info->num_inputs, index + 1);
+      }
+   }
+   info->file_max[TGSI_FILE_INPUT] = info->num_inputs - 1;
+}
+
+
+static void
+scan_outputs(const nir_shader *nir,
+             struct tgsi_shader_info *info,
+             bool need_texcoord)
+{
+   nir_foreach_variable(var, &nir->outputs) {
+      unsigned slots = get_var_slots(nir, var);
+      unsigned i;
+
+      for (i = 0; i < slots; i++) {
+         unsigned index = var->data.driver_location + i;
+         unsigned semantic_name, semantic_index;
+
+         if (index >= PIPE_MAX_SHADER_OUTPUTS)
+            break;
+
+         if (nir->info.stage == MESA_SHADER_FRAGMENT) {
+            tgsi_get_gl_frag_result_semantic(var->data.location + i,
+                                             &semantic_name, &semantic_index);
+            /* dual source blending */
+            if (var->data.index)
+               semantic_index += var->data.index;
+         } else {
+            tgsi_get_gl_varying_semantic(var->data.location + i,
+                                         need_texcoord,
+                                         &semantic_name, &semantic_index);
+         }
+
+         info->output_semantic_name[index] = semantic_name;
+         info->output_semantic_index[index] = semantic_index;
+         info->output_usagemask[index] |= get_var_usage_mask(nir, var);
+
+         switch (semantic_name) {
+         case TGSI_SEMANTIC_POSITION:
+            if (nir->info.stage == MESA_SHADER_FRAGMENT)
+               info->writes_z = TRUE;
+            else
+               info->writes_position = TRUE;
+            break;
+         case TGSI_SEMANTIC_STENCIL:
+            info->writes_stencil = TRUE;
+            break;
+         case TGSI_SEMANTIC_SAMPLEMASK:
+            info->writes_samplemask = TRUE;
+            break;
+         case TGSI_SEMANTIC_EDGEFLAG:
+            info->writes_edgeflag = TRUE;
+            break;
+         case TGSI_SEMANTIC_PSIZE:
+            info->writes_psize = TRUE;
+            break;
+         case TGSI_SEMANTIC_CLIPVERTEX:
+            info->writes_clipvertex = TRUE;
+            break;
+         case TGSI_SEMANTIC_PRIMID:
+            info->writes_primid = TRUE;
+            break;
+         case TGSI_SEMANTIC_VIEWPORT_INDEX:
+            info->writes_viewport_index = TRUE;
+            break;
+         case TGSI_SEMANTIC_LAYER:
+            info->writes_layer = TRUE;
+            break;
+         case TGSI_SEMANTIC_COLOR:
+            if (nir->info.stage == MESA_SHADER_FRAGMENT)
+               info->colors_written |= 1 << semantic_index;
+            break;
+         default:
+            break;
+         }
+
+         info->num_outputs = MAX2(info->num_outputs, index + 1);
+      }
+   }
+   info->file_max[TGSI_FILE_OUTPUT] = info->num_outputs - 1;
+}
+
+
+static void
+scan_instructions(const nir_shader *nir,
+                  struct tgsi_shader_info *info)
+{
+   nir_foreach_function(func, nir) {
+      if (!func->impl)
+         continue;
+
+      nir_foreach_block(block, func->impl) {
+         nir_foreach_instr(instr, block) {
+            info->num_instructions++;
+
+            if (instr->type == nir_instr_type_tex) {
+               nir_tex_instr *tex = nir_instr_as_tex(instr);
+
+               info->file_mask[TGSI_FILE_SAMPLER] |= 1 << tex->sampler_index;
+               info->file_max[TGSI_FILE_SAMPLER] =
+                  MAX2(info->file_max[TGSI_FILE_SAMPLER],
+                       (int)tex->sampler_index);
+               info->file_mask[TGSI_FILE_SAMPLER] |= 1 << tex->texture_index;
+               info->file_max[TGSI_FILE_SAMPLER] =
+                  MAX2(info->file_max[TGSI_FILE_SAMPLER],
+                       (int)tex->texture_index);
+               info->num_memory_instructions++;
+               info->opcode_count[TGSI_OPCODE_TEX]++;
+            } else if (instr->type == nir_instr_type_intrinsic) {
+               nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+
+               switch (intr->intrinsic) {
+               case nir_intrinsic_discard:
+               case nir_intrinsic_discard_if:
+                  info->uses_kill = TRUE;
+                  break;
+               case nir_intrinsic_barrier:
+                  info->opcode_count[TGSI_OPCODE_BARRIER]++;
+                  break;
+               case nir_intrinsic_store_ssbo:
+               case nir_intrinsic_ssbo_atomic_add:
+               case nir_intrinsic_ssbo_atomic_imin:
+               case nir_intrinsic_ssbo_atomic_umin:
+               case nir_intrinsic_ssbo_atomic_imax:
+               case nir_intrinsic_ssbo_atomic_umax:
+               case nir_intrinsic_ssbo_atomic_and:
+               case nir_intrinsic_ssbo_atomic_or:
+               case nir_intrinsic_ssbo_atomic_xor:
+               case nir_intrinsic_ssbo_atomic_exchange:
+               case nir_intrinsic_ssbo_atomic_comp_swap:
+                  info->writes_memory = TRUE;
+                  info->num_memory_instructions++;
+                  break;
+               case nir_intrinsic_load_ssbo:
+                  info->num_memory_instructions++;
+                  break;
+               default:
+                  break;
+               }
+            } else if (instr->type == nir_instr_type_alu) {
+               nir_alu_instr *alu = nir_instr_as_alu(instr);
+
+               if (nir_dest_bit_size(alu->dest.dest) == 64)
+                  info->uses_doubles = TRUE;
+               switch (alu->op) {
+               case nir_op_fddx:
+               case nir_op_fddy:
+               case nir_op_fddx_fine:
+               case nir_op_fddy_fine:
+               case nir_op_fddx_coarse:
+               case nir_op_fddy_coarse:
+                  info->uses_derivatives = TRUE;
+                  break;
+               default:
+                  break;
+               }
+            }
+         }
+      }
+   }
+}
+
+
+void
+nir_tgsi_scan_shader(const struct nir_shader *nir,
+                     struct tgsi_shader_info *info,
+                     bool need_texcoord)
+{
+   uint64_t sv = nir->info.system_values_read;
+   unsigned i;
+
+   memset(info, 0, sizeof(*info));
+   for (i = 0; i < TGSI_FILE_COUNT; i++)
+      info->file_max[i] = -1;
+   for (i = 0; i < ARRAY_SIZE(info->const_file_max); i++)
+      info->const_file_max[i] = -1;
+
+   info->processor = pipe_shader_type_from_mesa(nir->info.stage);
+
+   scan_inputs(nir, info, need_texcoord);
+   scan_outputs(nir, info, need_texcoord);
+
+   info->uses_instanceid = !!(sv & (1ull << SYSTEM_VALUE_INSTANCE_ID));
+   info->uses_vertexid = !!(sv & (1ull << SYSTEM_VALUE_VERTEX_ID));
+   info->uses_vertexid_nobase =
+      !!(sv & (1ull << SYSTEM_VALUE_VERTEX_ID_ZERO_BASE));
+   info->uses_basevertex = !!(sv & (1ull << SYSTEM_VALUE_BASE_VERTEX));
+   info->uses_primid |= !!(sv & (1ull << SYSTEM_VALUE_PRIMITIVE_ID));
+   info->uses_invocationid = !!(sv & (1ull << SYSTEM_VALUE_INVOCATION_ID));
+   info->uses_frontface |= !!(sv & (1ull << SYSTEM_VALUE_FRONT_FACE));
+   info->uses_grid_size = !!(sv & (1ull << SYSTEM_VALUE_NUM_WORK_GROUPS));
+   info->uses_block_size = !!(sv & (1ull << SYSTEM_VALUE_LOCAL_GROUP_SIZE));
+   for (i = 0; i < 3; i++) {
+      info->uses_thread_id[i] =
+         !!(sv & (1ull << SYSTEM_VALUE_LOCAL_INVOCATION_ID));
+      info->uses_block_id[i] = !!(sv & (1ull << SYSTEM_VALUE_WORK_GROUP_ID));
+   }
+
+   info->num_written_clipdistance = nir->info.clip_distance_array_size;
+   info->num_written_culldistance = nir->info.cull_distance_array_size;
+   info->clipdist_writemask = u_bit_consecutive(0, nir->info.clip_distance_array_size);
+   info->culldist_writemask = u_bit_consecutive(0, nir->info.cull_distance_array_size);
+
+   if (nir->info.num_ubos || nir->num_uniforms) {
+      info->const_buffers_declared = u_bit_consecutive(0, nir->info.num_ubos + 1);
+      info->file_max[TGSI_FILE_CONSTANT] = nir->num_uniforms ? 0 : -1;
+   }
+   if (nir->info.num_ssbos) {
+      info->shader_buffers_declared = u_bit_consecutive(0, nir->info.num_ssbos);
+      info->file_max[TGSI_FILE_BUFFER] = nir->info.num_ssbos - 1;
+   }
+
+   scan_instructions(nir, info);
+
+   switch (nir->info.stage) {
+   case MESA_SHADER_FRAGMENT:
+      info->properties[TGSI_PROPERTY_FS_COORD_ORIGIN] =
+         nir->info.fs.origin_upper_left ? TGSI_FS_COORD_ORIGIN_UPPER_LEFT :
+                                          TGSI_FS_COORD_ORIGIN_LOWER_LEFT;
+      info->properties[TGSI_PROPERTY_FS_COORD_PIXEL_CENTER] =
+         nir->info.fs.pixel_center_integer ?
+            TGSI_FS_COORD_PIXEL_CENTER_INTEGER :
+            TGSI_FS_COORD_PIXEL_CENTER_HALF_INTEGER;
+      info->properties[TGSI_PROPERTY_FS_COLOR0_WRITES_ALL_CBUFS] =
+         !!(nir->info.outputs_written & BITFIELD64_BIT(FRAG_RESULT_COLOR));
+      info->properties[TGSI_PROPERTY_FS_EARLY_DEPTH_STENCIL] =
+         nir->info.fs.early_fragment_tests;
+      info->uses_kill |= nir->info.fs.uses_discard;
+      break;
+   case MESA_SHADER_GEOMETRY:
+      info->properties[TGSI_PROPERTY_GS_INPUT_PRIM] =
+         nir->info.gs.input_primitive;
+      info->properties[TGSI_PROPERTY_GS_OUTPUT_PRIM] =
+         nir->info.gs.output_primitive;
+      info->properties[TGSI_PROPERTY_GS_MAX_OUTPUT_VERTICES] =
+         nir->info.gs.vertices_out;
+      info->properties[TGSI_PROPERTY_GS_INVOCATIONS] =
+         nir->info.gs.invocations;
+      break;
+   case MESA_SHADER_VERTEX:
+      info->properties[TGSI_PROPERTY_VS_WINDOW_SPACE_POSITION] =
+         nir->info.vs.window_space_position;
+      break;
+   case MESA_SHADER_COMPUTE:
+      info->properties[TGSI_PROPERTY_CS_FIXED_BLOCK_WIDTH] =
+         nir->info.cs.local_size[0];
+      info->properties[TGSI_PROPERTY_CS_FIXED_BLOCK_HEIGHT] =
+         nir->info.cs.local_size[1];
+      info->properties[TGSI_PROPERTY_CS_FIXED_BLOCK_DEPTH] =
+         nir->info.cs.local_size[2];
+      break;
+   default:
+      break;
+   }
+}
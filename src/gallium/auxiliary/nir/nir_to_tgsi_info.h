@@ -0,0 +1,43 @@
+/*
+ * Copyright 2019 VMware, Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef NIR_TO_TGSI_INFO_H
+#define NIR_TO_TGSI_INFO_H
+
+#include <stdbool.h>
+
+struct nir_shader;
+struct tgsi_shader_info;
+
+/*
+ * Fill in the parts of tgsi_shader_info the gallium drivers and the draw
+ * module use, for a NIR shader whose inputs and outputs have their
+ * driver_location assigned.  Inputs and outputs are indexed by
+ * driver_location.
+ */
+void
+nir_tgsi_scan_shader(const struct nir_shader *nir,
+                     struct tgsi_shader_info *info,
+                     bool need_texcoord);
+
+#endif /* NIR_TO_TGSI_INFO_H */
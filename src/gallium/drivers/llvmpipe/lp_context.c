@@ -38,14 +38,17 @@
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/u_upload_mgr.h"
+#include "util/u_threaded_context.h"
 #include "lp_clear.h"
 #include "lp_context.h"
+#include "lp_fence.h"
 #include "lp_flush.h"
 #include "lp_perf.h"
 #include "lp_state.h"
 #include "lp_surface.h"
 #include "lp_query.h"
 #include "lp_setup.h"
+#include "lp_screen.h"
 
 /* This is only safe if there's just one concurrent context */
 #ifdef EMBEDDED_DEVICE
@@ -89,6 +92,14 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
       pipe_sampler_view_reference(&llvmpipe->sampler_views[PIPE_SHADER_GEOMETRY][i], NULL);
    }
 
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->sampler_views[0]); i++) {
+      pipe_sampler_view_reference(&llvmpipe->sampler_views[PIPE_SHADER_COMPUTE][i], NULL);
+   }
+
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->ssbos[0]); i++) {
+      pipe_resource_reference(&llvmpipe->ssbos[PIPE_SHADER_COMPUTE][i].buffer, NULL);
+   }
+
    for (i = 0; i < ARRAY_SIZE(llvmpipe->constants); i++) {
       for (j = 0; j < ARRAY_SIZE(llvmpipe->constants[i]); j++) {
          pipe_resource_reference(&llvmpipe->constants[i][j].buffer, NULL);
@@ -114,10 +125,49 @@ do_flush( struct pipe_context *pipe,
           struct pipe_fence_handle **fence,
           unsigned flags)
 {
+   /* The threaded context passes in the fence it got from
+    * llvmpipe_create_fence(), which now gets to know the real one.
+    */
+   if ((flags & TC_FLUSH_ASYNC) && fence && *fence) {
+      struct pipe_fence_handle *flushed = NULL;
+
+      llvmpipe_flush(pipe, &flushed, __FUNCTION__);
+      lp_fence_set_flushed((struct lp_fence *)*fence,
+                           (struct lp_fence *)flushed);
+      return;
+   }
+
    llvmpipe_flush(pipe, fence, __FUNCTION__);
 }
 
 
+/**
+ * Threaded context callback, which lets flushes be executed asynchronously
+ * in the driver thread.  Called from the application thread.
+ */
+static struct pipe_fence_handle *
+llvmpipe_create_fence(struct pipe_context *pipe,
+                      struct tc_unflushed_batch_token *tc_token)
+{
+   return (struct pipe_fence_handle *)lp_fence_create_deferred(tc_token);
+}
+
+
+/**
+ * Grids and draws are rasterized in submission order, but the draw module
+ * reads vertex data and vertex/geometry shader resources while binning,
+ * and the application may read mapped buffers, so anything but
+ * framebuffer accesses needs the queued work to be done.
+ */
+static void
+llvmpipe_memory_barrier(struct pipe_context *pipe,
+                        unsigned flags)
+{
+   if (flags & ~(PIPE_BARRIER_FRAMEBUFFER | PIPE_BARRIER_UPDATE))
+      llvmpipe_finish(pipe, __FUNCTION__);
+}
+
+
 static void
 llvmpipe_render_condition(struct pipe_context *pipe,
                           struct pipe_query *query,
@@ -131,6 +181,24 @@ llvmpipe_render_condition(struct pipe_context *pipe,
    llvmpipe->render_cond_cond = condition;
 }
 
+static void
+lp_draw_disk_cache_find_shader(void *cookie,
+                               struct lp_cached_code *cache,
+                               unsigned char ir_sha1_cache_key[20])
+{
+   struct llvmpipe_screen *screen = cookie;
+   lp_disk_cache_find_shader(screen, cache, ir_sha1_cache_key);
+}
+
+static void
+lp_draw_disk_cache_insert_shader(void *cookie,
+                                 struct lp_cached_code *cache,
+                                 unsigned char ir_sha1_cache_key[20])
+{
+   struct llvmpipe_screen *screen = cookie;
+   lp_disk_cache_insert_shader(screen, cache, ir_sha1_cache_key);
+}
+
 struct pipe_context *
 llvmpipe_create_context(struct pipe_screen *screen, void *priv,
                         unsigned flags)
@@ -160,6 +228,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe->pipe.flush = do_flush;
 
    llvmpipe->pipe.render_condition = llvmpipe_render_condition;
+   llvmpipe->pipe.memory_barrier = llvmpipe_memory_barrier;
 
    llvmpipe_init_blend_funcs(llvmpipe);
    llvmpipe_init_clip_funcs(llvmpipe);
@@ -172,6 +241,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe_init_vs_funcs(llvmpipe);
    llvmpipe_init_gs_funcs(llvmpipe);
    llvmpipe_init_rasterizer_funcs(llvmpipe);
+   llvmpipe_init_compute_funcs(llvmpipe);
    llvmpipe_init_context_resource_funcs( &llvmpipe->pipe );
    llvmpipe_init_surface_functions(llvmpipe);
 
@@ -192,6 +262,11 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    if (!llvmpipe->draw)
       goto fail;
 
+   draw_set_disk_cache_callbacks(llvmpipe->draw,
+                                 llvmpipe_screen(screen),
+                                 lp_draw_disk_cache_find_shader,
+                                 lp_draw_disk_cache_insert_shader);
+
    /* FIXME: devise alternative to draw_texture_samplers */
 
    llvmpipe->setup = lp_setup_create( &llvmpipe->pipe,
@@ -233,7 +308,15 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
     */
    llvmpipe->dirty |= LP_NEW_SCISSOR;
 
-   return &llvmpipe->pipe;
+   if (!(flags & PIPE_CONTEXT_PREFER_THREADED) ||
+       (flags & PIPE_CONTEXT_COMPUTE_ONLY) ||
+       !llvmpipe_screen(screen)->threaded)
+      return &llvmpipe->pipe;
+
+   return threaded_context_create(&llvmpipe->pipe,
+                                  &llvmpipe_screen(screen)->pool_transfers,
+                                  llvmpipe_replace_buffer_storage,
+                                  llvmpipe_create_fence, NULL);
 
  fail:
    llvmpipe_destroy(&llvmpipe->pipe);
@@ -48,6 +48,7 @@ struct draw_context;
 struct draw_stage;
 struct draw_vertex_shader;
 struct lp_fragment_shader;
+struct lp_compute_shader;
 struct lp_blend_state;
 struct lp_setup_context;
 struct lp_setup_variant;
@@ -67,6 +68,7 @@ struct llvmpipe_context {
    const struct lp_geometry_shader *gs;
    const struct lp_velems_state *velems;
    const struct lp_so_state *so;
+   struct lp_compute_shader *cs;
 
    /** Other rendering state */
    unsigned sample_mask;
@@ -174,5 +176,18 @@ llvmpipe_context( struct pipe_context *pipe )
    return (struct llvmpipe_context *)pipe;
 }
 
+
+/**
+ * Whether an object created in the given context may be used in this one.
+ * When running threaded, objects are created through the threaded context,
+ * whose priv points to the context it wraps.
+ */
+static inline boolean
+llvmpipe_same_context( struct pipe_context *pipe,
+                       struct pipe_context *creator )
+{
+   return creator == pipe || creator->priv == pipe;
+}
+
 #endif /* LP_CONTEXT_H */
 
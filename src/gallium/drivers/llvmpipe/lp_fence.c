@@ -28,6 +28,7 @@
 
 #include "pipe/p_screen.h"
 #include "util/u_memory.h"
+#include "util/u_threaded_context.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
 
@@ -58,6 +59,8 @@ lp_fence_create(unsigned rank)
    fence->id = fence_id++;
    fence->rank = rank;
 
+   util_queue_fence_init(&fence->ready);
+
    if (LP_DEBUG & DEBUG_FENCE)
       debug_printf("%s %d\n", __FUNCTION__, fence->id);
 
@@ -65,6 +68,46 @@ lp_fence_create(unsigned rank)
 }
 
 
+/**
+ * Create a fence for a flush which the threaded context hasn't executed
+ * yet.  This is called from the application thread.
+ *
+ * \param tc_token  the batch to flush in order to get the fence signalled,
+ *                  or NULL if the flush is already queued
+ */
+struct lp_fence *
+lp_fence_create_deferred(struct tc_unflushed_batch_token *tc_token)
+{
+   struct lp_fence *fence = lp_fence_create(0);
+
+   if (!fence)
+      return NULL;
+
+   util_queue_fence_reset(&fence->ready);
+   tc_unflushed_batch_token_reference(&fence->tc_token, tc_token);
+
+   return fence;
+}
+
+
+/**
+ * Called by the flush a deferred fence was created for, with the fence the
+ * flush returned.  Takes over the reference to flushed.
+ */
+void
+lp_fence_set_flushed(struct lp_fence *fence, struct lp_fence *flushed)
+{
+   assert(!util_queue_fence_is_signalled(&fence->ready));
+
+   if (LP_DEBUG & DEBUG_FENCE)
+      debug_printf("%s %d -> %d\n", __FUNCTION__, fence->id,
+                   flushed ? (int)flushed->id : -1);
+
+   fence->flushed = flushed;
+   util_queue_fence_signal(&fence->ready);
+}
+
+
 /** Destroy a fence.  Called when refcount hits zero. */
 void
 lp_fence_destroy(struct lp_fence *fence)
@@ -72,6 +115,11 @@ lp_fence_destroy(struct lp_fence *fence)
    if (LP_DEBUG & DEBUG_FENCE)
       debug_printf("%s %d\n", __FUNCTION__, fence->id);
 
+   if (fence->flushed)
+      lp_fence_reference(&fence->flushed, NULL);
+   tc_unflushed_batch_token_reference(&fence->tc_token, NULL);
+   util_queue_fence_destroy(&fence->ready);
+
    mtx_destroy(&fence->mutex);
    cnd_destroy(&fence->signalled);
    FREE(fence);
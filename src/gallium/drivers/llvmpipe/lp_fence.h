@@ -33,9 +33,11 @@
 #include "os/os_thread.h"
 #include "pipe/p_state.h"
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 
 
 struct pipe_screen;
+struct tc_unflushed_batch_token;
 
 
 struct lp_fence
@@ -49,12 +51,27 @@ struct lp_fence
    boolean issued;
    unsigned rank;
    unsigned count;
+
+   /**
+    * Deferred fences are created by the threaded context before the flush
+    * they belong to is executed.  Once it is, ready is signalled and they
+    * stand for the flushed fence.
+    */
+   struct util_queue_fence ready;
+   struct tc_unflushed_batch_token *tc_token;
+   struct lp_fence *flushed;
 };
 
 
 struct lp_fence *
 lp_fence_create(unsigned rank);
 
+struct lp_fence *
+lp_fence_create_deferred(struct tc_unflushed_batch_token *tc_token);
+
+void
+lp_fence_set_flushed(struct lp_fence *fence, struct lp_fence *flushed);
+
 
 void
 lp_fence_signal(struct lp_fence *fence);
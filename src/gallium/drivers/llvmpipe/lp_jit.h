@@ -45,6 +45,7 @@
 
 struct lp_build_format_cache;
 struct lp_fragment_shader_variant;
+struct lp_compute_shader_variant;
 struct llvmpipe_screen;
 
 
@@ -269,6 +270,28 @@ typedef void
                     unsigned depth_stride);
 
 
+/**
+ * Compute shader function.
+ * Runs the invocation vectors [first_vector, first_vector + num_vectors)
+ * of the work group block_id.  barrier_data is passed back to
+ * lp_rast_cs_barrier() by shaders which synchronize the invocations of a
+ * group and run each vector on a fiber of its own.
+ */
+typedef void
+(*lp_jit_cs_func)(const struct lp_jit_context *context,
+                  uint32_t block_id_x,
+                  uint32_t block_id_y,
+                  uint32_t block_id_z,
+                  uint32_t grid_size_x,
+                  uint32_t grid_size_y,
+                  uint32_t grid_size_z,
+                  uint32_t first_vector,
+                  uint32_t num_vectors,
+                  void *shared,
+                  void *barrier_data,
+                  struct lp_jit_thread_data *thread_data);
+
+
 void
 lp_jit_screen_cleanup(struct llvmpipe_screen *screen);
 
@@ -281,4 +304,8 @@ void
 lp_jit_init_types(struct lp_fragment_shader_variant *lp);
 
 
+void
+lp_jit_init_cs_types(struct lp_compute_shader_variant *lp);
+
+
 #endif /* LP_JIT_H */
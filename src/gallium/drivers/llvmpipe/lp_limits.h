@@ -61,7 +61,11 @@
 #define LP_MAX_WIDTH  (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 
 
-#define LP_MAX_THREADS 16
+/**
+ * Max number of rasterizer threads.  Per-thread state is small, this
+ * mostly bounds the size of the per-thread query counters.
+ */
+#define LP_MAX_THREADS 128
 
 
 /**
@@ -81,6 +85,12 @@
  */
 #define LP_MAX_SHADER_INSTRUCTIONS (2048 * LP_MAX_SHADER_VARIANTS)
 
+/**
+ * Max number of variants kept around per compute shader.  Compute
+ * variants only depend on the block size and the sampler state.
+ */
+#define LP_MAX_CS_VARIANTS 32
+
 /**
  * Max number of setup variants that will be kept around.
  *
@@ -56,12 +56,17 @@ struct lp_counters
    unsigned nr_fully_covered_4;
    unsigned nr_partially_covered_4;
    unsigned nr_non_empty_4;
+   unsigned nr_hiz_culled_64;
+   unsigned nr_hiz_culled_16;
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
    unsigned nr_color_tile_store;
+
+   unsigned nr_bins_stolen;    /**< bins rasterized by a non-owning thread */
+   int64_t rast_idle_time;     /**< total, in microseconds, over all threads */
 };
 
 
@@ -26,6 +26,11 @@
  **************************************************************************/
 
 #include <limits.h>
+#ifdef HAVE_MAKECONTEXT
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
 #include "util/u_memory.h"
 #include "util/u_math.h"
 #include "util/u_rect.h"
@@ -33,6 +38,7 @@
 #include "util/u_pack_color.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
+#include "util/os_file.h"
 
 #include "util/os_time.h"
 
@@ -70,16 +76,28 @@ lp_rast_begin( struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization( scene );
-   lp_scene_bin_iter_begin( scene );
+   lp_scene_bin_iter_begin( scene, rast->num_threads );
 }
 
 
+/**
+ * End rasterizing a scene.
+ * Called once per scene by one thread, after all threads are done with it.
+ * Signalling the fence hands the scene back to the setup code, which may
+ * immediately reset and rebin it, so it must not be touched afterwards.
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
-   lp_scene_end_rasterization( rast->curr_scene );
+   struct lp_scene *scene = rast->curr_scene;
 
    rast->curr_scene = NULL;
+
+   lp_scene_end_rasterization( scene );
+
+   if (scene->fence) {
+      lp_fence_signal(scene->fence);
+   }
 }
 
 
@@ -109,6 +127,8 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
    task->thread_data.vis_counter = 0;
    task->thread_data.ps_invocations = 0;
 
+   lp_rast_hiz_reset(task, FLT_MAX);
+
    for (i = 0; i < task->scene->fb.nr_cbufs; i++) {
       if (task->scene->fb.cbufs[i]) {
          task->color_tiles[i] = scene->cbufs[i].map +
@@ -281,6 +301,33 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
          }
          dst_layer += scene->zsbuf.layer_stride;
       }
+
+      if (scene->hiz) {
+         enum pipe_format format = scene->fb.zsbuf->format;
+         uint64_t depth_mask = util_pack64_mask_z_stencil(format, ~0, 0);
+
+         if ((clear_mask64 & depth_mask) == depth_mask) {
+            const struct util_format_description *desc =
+               util_format_description(format);
+            uint8_t packed[8];
+            float depth;
+
+            /* the packed value is in the low bits, in host byte order */
+            switch (block_size) {
+            case 2:
+               *(uint16_t *)packed = (uint16_t)arg.clear_zstencil.value;
+               break;
+            case 4:
+               *(uint32_t *)packed = (uint32_t)arg.clear_zstencil.value;
+               break;
+            default:
+               *(uint64_t *)packed = arg.clear_zstencil.value;
+               break;
+            }
+            desc->unpack_z_float(&depth, 0, packed, 0, 1, 1);
+            lp_rast_hiz_reset(task, depth);
+         }
+      }
    }
 }
 
@@ -300,6 +347,7 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    const struct lp_rast_state *state;
    struct lp_fragment_shader_variant *variant;
    const unsigned tile_x = task->x, tile_y = task->y;
+   boolean culled[TILE_SIZE / 16][TILE_SIZE / 16];
    unsigned x, y;
 
    if (inputs->disable) {
@@ -316,6 +364,16 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    }
    variant = state->variant;
 
+   /* 16x16 blocks entirely behind the depth buffer contents */
+   for (y = 0; y < task->height; y += 16) {
+      for (x = 0; x < task->width; x += 16) {
+         culled[y / 16][x / 16] =
+            lp_rast_hiz_cull_16(task, inputs, tile_x + x, tile_y + y);
+         if (culled[y / 16][x / 16])
+            LP_COUNT(nr_hiz_culled_16);
+      }
+   }
+
    /* render the whole 64x64 tile in 4x4 chunks */
    for (y = 0; y < task->height; y += 4){
       for (x = 0; x < task->width; x += 4) {
@@ -325,6 +383,9 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          unsigned depth_stride = 0;
          unsigned i;
 
+         if (culled[y / 16][x / 16])
+            continue;
+
          /* color buffer */
          for (i = 0; i < scene->fb.nr_cbufs; i++){
             if (scene->fb.cbufs[i]) {
@@ -365,6 +426,12 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          END_JIT_CALL();
       }
    }
+
+   for (y = 0; y < task->height; y += 16) {
+      for (x = 0; x < task->width; x += 16) {
+         lp_rast_hiz_update_16(task, inputs, tile_x + x, tile_y + y);
+      }
+   }
 }
 
 
@@ -535,6 +602,10 @@ lp_rast_set_state(struct lp_rasterizer_task *task,
                   const union lp_rast_cmd_arg arg)
 {
    task->state = arg.state;
+
+   /* the depth values may grow, so the depth bounds are no longer valid */
+   if (!task->state->variant->hiz_keep)
+      lp_rast_hiz_reset(task, FLT_MAX);
 }
 
 
@@ -640,17 +711,327 @@ rasterize_bin(struct lp_rasterizer_task *task,
 }
 
 
-/* An empty bin is one that just loads the contents of the tile and
- * stores them again unchanged.  This typically happens when bins have
- * been flushed for some reason in the middle of a frame, or when
- * incremental updates are being made to a render target.
- * 
- * Try to avoid doing pointless work in this case.
+#ifdef HAVE_MAKECONTEXT
+
+struct lp_cs_fiber {
+   ucontext_t context;
+   void *stack;
+   unsigned index;
+   boolean done;
+   struct lp_cs_fibers *fibers;
+};
+
+/**
+ * Each invocation vector of a work group which synchronizes with
+ * barriers runs on a fiber.  A barrier switches back to the scheduler,
+ * which resumes the fibers round-robin: once every fiber has been resumed,
+ * all of them are either done or waiting at the barrier.
  */
+struct lp_cs_fibers {
+   ucontext_t scheduler;
+   struct lp_cs_fiber *fibers;
+   unsigned num_fibers;
+   size_t stack_size;
+
+   /* the work group being run */
+   const struct lp_rast_cs_job *job;
+   unsigned block_id[3];
+   void *shared;
+   struct lp_jit_thread_data *thread_data;
+};
+
+
+static void
+cs_fiber_entry(int ptr_lo, int ptr_hi)
+{
+   struct lp_cs_fiber *fiber = (struct lp_cs_fiber *)(uintptr_t)
+      (((uint64_t)(uint32_t)ptr_hi << 32) | (uint32_t)ptr_lo);
+   struct lp_cs_fibers *fibers = fiber->fibers;
+   const struct lp_rast_cs_job *job = fibers->job;
+
+   job->jit_function(&job->jit_context,
+                     fibers->block_id[0],
+                     fibers->block_id[1],
+                     fibers->block_id[2],
+                     job->grid_size[0],
+                     job->grid_size[1],
+                     job->grid_size[2],
+                     fiber->index, 1,
+                     fibers->shared,
+                     fiber,
+                     fibers->thread_data);
+
+   /* uc_link takes us back to the scheduler */
+   fiber->done = TRUE;
+}
+
+
+/**
+ * Called by the compute shader code at a barrier.
+ */
+void
+lp_rast_cs_barrier(void *barrier_data)
+{
+   struct lp_cs_fiber *fiber = barrier_data;
+
+   swapcontext(&fiber->context, &fiber->fibers->scheduler);
+}
+
+
+/**
+ * Fiber stacks sit on top of an inaccessible page, so that a shader still
+ * overflowing its stack faults right away rather than corrupting the heap.
+ */
+static void *
+cs_alloc_fiber_stack(size_t stack_size)
+{
+   const size_t page_size = sysconf(_SC_PAGESIZE);
+   uint8_t *map;
+
+   map = mmap(NULL, page_size + stack_size, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (map == MAP_FAILED)
+      return NULL;
+
+   if (mprotect(map, page_size, PROT_NONE) != 0) {
+      munmap(map, page_size + stack_size);
+      return NULL;
+   }
+
+   return map + page_size;
+}
+
+
+static void
+cs_free_fiber_stack(void *stack, size_t stack_size)
+{
+   const size_t page_size = sysconf(_SC_PAGESIZE);
+
+   munmap((uint8_t *)stack - page_size, page_size + stack_size);
+}
+
+
+static void
+cs_destroy_fiber_stacks(struct lp_cs_fibers *fibers)
+{
+   unsigned i;
+
+   for (i = 0; i < fibers->num_fibers; i++)
+      cs_free_fiber_stack(fibers->fibers[i].stack, fibers->stack_size);
+   fibers->num_fibers = 0;
+}
+
+
 static boolean
-is_empty_bin( const struct cmd_bin *bin )
+cs_grow_fibers(struct lp_rasterizer_task *task, unsigned num_fibers,
+               size_t stack_size)
+{
+   struct lp_cs_fibers *fibers = task->cs_fibers;
+   struct lp_cs_fiber *array;
+   unsigned i;
+
+   if (!fibers) {
+      fibers = CALLOC_STRUCT(lp_cs_fibers);
+      if (!fibers)
+         return FALSE;
+      task->cs_fibers = fibers;
+   }
+
+   /* Stacks only ever grow, so that grids alternating between shaders
+    * don't keep reallocating them.
+    */
+   if (fibers->stack_size < stack_size) {
+      cs_destroy_fiber_stacks(fibers);
+      fibers->stack_size = stack_size;
+   }
+
+   if (fibers->num_fibers >= num_fibers)
+      return TRUE;
+
+   array = REALLOC(fibers->fibers,
+                   fibers->num_fibers * sizeof *array,
+                   num_fibers * sizeof *array);
+   if (!array)
+      return FALSE;
+   fibers->fibers = array;
+
+   for (i = fibers->num_fibers; i < num_fibers; i++) {
+      array[i].stack = cs_alloc_fiber_stack(fibers->stack_size);
+      if (!array[i].stack)
+         return FALSE;
+      array[i].index = i;
+      array[i].fibers = fibers;
+      fibers->num_fibers = i + 1;
+   }
+
+   return TRUE;
+}
+
+
+static void
+cs_destroy_fibers(struct lp_rasterizer_task *task)
+{
+   struct lp_cs_fibers *fibers = task->cs_fibers;
+   unsigned i;
+
+   if (!fibers)
+      return;
+
+   cs_destroy_fiber_stacks(fibers);
+   FREE(fibers->fibers);
+   FREE(fibers);
+   task->cs_fibers = NULL;
+}
+
+
+static void
+cs_run_fibers(struct lp_rasterizer_task *task,
+              const struct lp_rast_cs_job *job,
+              const unsigned block_id[3],
+              void *shared)
+{
+   struct lp_cs_fibers *fibers;
+   boolean waiting;
+   unsigned i;
+
+   if (!cs_grow_fibers(task, job->num_vectors, job->fiber_stack_size)) {
+      debug_printf("llvmpipe: out of memory for compute shader fibers\n");
+      return;
+   }
+
+   fibers = task->cs_fibers;
+   fibers->job = job;
+   fibers->block_id[0] = block_id[0];
+   fibers->block_id[1] = block_id[1];
+   fibers->block_id[2] = block_id[2];
+   fibers->shared = shared;
+   fibers->thread_data = &task->thread_data;
+
+   for (i = 0; i < job->num_vectors; i++) {
+      struct lp_cs_fiber *fiber = &fibers->fibers[i];
+      uint64_t ptr = (uintptr_t)fiber;
+
+      getcontext(&fiber->context);
+      fiber->context.uc_stack.ss_sp = fiber->stack;
+      fiber->context.uc_stack.ss_size = fibers->stack_size;
+      fiber->context.uc_link = &fibers->scheduler;
+      makecontext(&fiber->context, (void (*)(void))cs_fiber_entry, 2,
+                  (int)(uint32_t)ptr, (int)(uint32_t)(ptr >> 32));
+      fiber->done = FALSE;
+   }
+
+   do {
+      waiting = FALSE;
+      for (i = 0; i < job->num_vectors; i++) {
+         struct lp_cs_fiber *fiber = &fibers->fibers[i];
+
+         if (fiber->done)
+            continue;
+
+         swapcontext(&fibers->scheduler, &fiber->context);
+         waiting |= !fiber->done;
+      }
+   } while (waiting);
+}
+
+
+boolean
+lp_rast_cs_fibers_supported(void)
+{
+   return TRUE;
+}
+
+#else /* !HAVE_MAKECONTEXT */
+
+void
+lp_rast_cs_barrier(void *barrier_data)
+{
+   assert(0);
+}
+
+
+static void
+cs_destroy_fibers(struct lp_rasterizer_task *task)
+{
+}
+
+
+static void
+cs_run_fibers(struct lp_rasterizer_task *task,
+              const struct lp_rast_cs_job *job,
+              const unsigned block_id[3],
+              void *shared)
+{
+   assert(0);
+}
+
+
+boolean
+lp_rast_cs_fibers_supported(void)
 {
-   return bin->head == NULL;
+   return FALSE;
+}
+
+#endif /* !HAVE_MAKECONTEXT */
+
+
+/**
+ * Run work groups of a compute grid until there are none left.
+ * Called by each thread, the groups are claimed a few at a time so
+ * that tiny groups don't make the threads fight over the counter.
+ */
+static void
+rasterize_compute(struct lp_rasterizer_task *task,
+                  struct lp_rast_cs_job *job)
+{
+   const unsigned grid_xy = job->grid_size[0] * job->grid_size[1];
+   void *shared = NULL;
+
+   if (job->shared_size) {
+      if (task->cs_shared_size < job->shared_size) {
+         align_free(task->cs_shared);
+         task->cs_shared = align_malloc(job->shared_size, 16);
+         task->cs_shared_size = task->cs_shared ? job->shared_size : 0;
+         if (!task->cs_shared) {
+            debug_printf("llvmpipe: out of memory for compute shared memory\n");
+            return;
+         }
+      }
+      shared = task->cs_shared;
+   }
+
+   while (1) {
+      uint64_t first, group, end;
+
+      first = (uint64_t)(p_atomic_inc_return(&job->next_claim) - 1) *
+              job->groups_per_claim;
+      if (first >= job->num_groups)
+         break;
+
+      end = MIN2(first + job->groups_per_claim, job->num_groups);
+
+      for (group = first; group < end; group++) {
+         unsigned block_id[3];
+
+         block_id[0] = group % job->grid_size[0];
+         block_id[1] = (group % grid_xy) / job->grid_size[0];
+         block_id[2] = group / grid_xy;
+
+         if (job->fiber_stack_size) {
+            cs_run_fibers(task, job, block_id, shared);
+         }
+         else {
+            job->jit_function(&job->jit_context,
+                              block_id[0], block_id[1], block_id[2],
+                              job->grid_size[0],
+                              job->grid_size[1],
+                              job->grid_size[2],
+                              0, job->num_vectors,
+                              shared, NULL,
+                              &task->thread_data);
+         }
+      }
+   }
 }
 
 
@@ -675,16 +1056,19 @@ rasterize_scene(struct lp_rasterizer_task *task,
 #endif
 #endif
 
-   if (!task->rast->no_rast) {
+   if (scene->cs_job) {
+      rasterize_compute(task, scene->cs_job);
+   }
+   else if (!task->rast->no_rast) {
       /* loop over scene bins, rasterize each */
       {
          struct cmd_bin *bin;
          int i, j;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-            if (!is_empty_bin( bin ))
-               rasterize_bin(task, bin, i, j);
+         while ((bin = lp_scene_bin_iter_next(scene, task->thread_index,
+                                              &i, &j))) {
+            rasterize_bin(task, bin, i, j);
          }
       }
    }
@@ -704,10 +1088,6 @@ rasterize_scene(struct lp_rasterizer_task *task,
    }
 #endif
 
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
-
    task->scene = NULL;
 }
 
@@ -737,8 +1117,6 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
       lp_rast_end( rast );
 
       util_fpstate_set(fpstate);
-
-      rast->curr_scene = NULL;
    }
    else {
       /* threaded rendering! */
@@ -756,20 +1134,189 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 }
 
 
-void
-lp_rast_finish( struct lp_rasterizer *rast )
+/**
+ * Parse a Linux cpulist string ("0-3,8,10-11") into a CPU bitmask.
+ */
+static void
+parse_cpu_list(const char *str, uint32_t *mask, unsigned max_cpus)
 {
-   if (rast->num_threads == 0) {
-      /* nothing to do */
+   while (*str) {
+      unsigned long first, last, cpu;
+      char *end;
+
+      first = strtoul(str, &end, 10);
+      if (end == str)
+         break;
+      last = first;
+      if (*end == '-') {
+         str = end + 1;
+         last = strtoul(str, &end, 10);
+         if (end == str)
+            break;
+      }
+
+      for (cpu = first; cpu <= last && cpu < max_cpus; cpu++)
+         mask[cpu / 32] |= 1u << (cpu % 32);
+
+      str = end;
+      if (*str != ',')
+         break;
+      str++;
    }
-   else {
-      int i;
+}
+
+
+static unsigned
+count_cpus(const uint32_t *mask)
+{
+   unsigned i, count = 0;
+
+   for (i = 0; i < LP_MAX_CPUS / 32; i++)
+      count += util_bitcount(mask[i]);
+
+   return count;
+}
+
+
+/**
+ * Read the CPUs of each online NUMA node from sysfs, restricted to the
+ * CPUs we are allowed to run on.  Nodes without any such CPU are skipped.
+ * Returns the number of nodes found, 0 if the topology isn't available.
+ */
+static unsigned
+get_numa_nodes(const uint32_t *allowed,
+               uint32_t (*node_cpus)[LP_MAX_CPUS / 32],
+               unsigned max_nodes)
+{
+   uint32_t online[LP_MAX_CPUS / 32] = {0};
+   unsigned node, num_nodes = 0;
+   char *str;
+
+   str = os_read_file("/sys/devices/system/node/online");
+   if (!str)
+      return 0;
+   parse_cpu_list(str, online, LP_MAX_CPUS);
+   free(str);
+
+   for (node = 0; node < LP_MAX_CPUS && num_nodes < max_nodes; node++) {
+      char path[64];
+      unsigned i;
+
+      if (!(online[node / 32] & (1u << (node % 32))))
+         continue;
+
+      snprintf(path, sizeof path,
+               "/sys/devices/system/node/node%u/cpulist", node);
+      str = os_read_file(path);
+      if (!str)
+         continue;
+
+      memset(node_cpus[num_nodes], 0, sizeof node_cpus[num_nodes]);
+      parse_cpu_list(str, node_cpus[num_nodes], LP_MAX_CPUS);
+      free(str);
+
+      for (i = 0; i < LP_MAX_CPUS / 32; i++)
+         node_cpus[num_nodes][i] &= allowed[i];
+
+      if (count_cpus(node_cpus[num_nodes]))
+         num_nodes++;
+   }
+
+   return num_nodes;
+}
+
+
+/**
+ * Decide which CPUs each rasterizer thread will be pinned to, according
+ * to the LP_THREAD_AFFINITY environment variable:
+ *   none - let the OS schedule the threads (default)
+ *   cpu  - pin each thread to a single CPU
+ *   numa - spread the threads evenly over the NUMA nodes, each thread
+ *          may run on any CPU of its node
+ */
+static void
+choose_rast_thread_affinity(struct lp_rasterizer *rast)
+{
+   const char *affinity = debug_get_option("LP_THREAD_AFFINITY", "none");
+   uint32_t allowed[LP_MAX_CPUS / 32];
+   unsigned i;
+
+   if (rast->num_threads == 0 || !strcmp(affinity, "none"))
+      return;
+
+   if (!util_get_current_thread_affinity(allowed, LP_MAX_CPUS)) {
+      debug_printf("llvmpipe: thread affinity not supported\n");
+      return;
+   }
+
+   if (!count_cpus(allowed))
+      return;
+
+   if (!strcmp(affinity, "cpu")) {
+      unsigned cpu = 0;
 
-      /* wait for work to complete */
       for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
+         struct lp_rasterizer_task *task = &rast->tasks[i];
+
+         /* the (i % num_cpus)'th allowed CPU */
+         while (!(allowed[cpu / 32] & (1u << (cpu % 32))))
+            cpu = (cpu + 1) % LP_MAX_CPUS;
+
+         memset(task->cpu_mask, 0, sizeof task->cpu_mask);
+         task->cpu_mask[cpu / 32] = 1u << (cpu % 32);
+         task->pin_thread = TRUE;
+         cpu = (cpu + 1) % LP_MAX_CPUS;
       }
    }
+   else if (!strcmp(affinity, "numa")) {
+      uint32_t (*node_cpus)[LP_MAX_CPUS / 32];
+      unsigned num_nodes;
+
+      /* More nodes than threads would leave nodes without threads anyway */
+      node_cpus = MALLOC(rast->num_threads * sizeof *node_cpus);
+      if (!node_cpus)
+         return;
+
+      num_nodes = get_numa_nodes(allowed, node_cpus, rast->num_threads);
+      if (num_nodes > 1) {
+         for (i = 0; i < rast->num_threads; i++) {
+            struct lp_rasterizer_task *task = &rast->tasks[i];
+            unsigned node = i * num_nodes / rast->num_threads;
+
+            memcpy(task->cpu_mask, node_cpus[node], sizeof task->cpu_mask);
+            task->pin_thread = TRUE;
+         }
+      }
+
+      FREE(node_cpus);
+   }
+   else {
+      debug_printf("llvmpipe: unknown LP_THREAD_AFFINITY value '%s'\n",
+                   affinity);
+   }
+}
+
+
+/**
+ * Pin the calling rasterizer thread according to its cpu_mask and
+ * reallocate its per-thread data, so that the pages end up on the
+ * thread's NUMA node with the kernel's first-touch policy.
+ */
+static void
+pin_rast_thread(struct lp_rasterizer_task *task)
+{
+   struct lp_build_format_cache *cache;
+
+   if (!task->pin_thread ||
+       !util_set_current_thread_affinity(task->cpu_mask, LP_MAX_CPUS))
+      return;
+
+   cache = align_malloc(sizeof(struct lp_build_format_cache), 16);
+   if (cache) {
+      memset(cache, 0, sizeof *cache);
+      align_free(task->thread_data.cache);
+      task->thread_data.cache = cache;
+   }
 }
 
 
@@ -778,7 +1325,10 @@ lp_rast_finish( struct lp_rasterizer *rast )
  * It's a simple loop:
  *   1. wait for work
  *   2. do work
- *   3. signal that we're done
+ *   3. signal the scene's fence (thread 0 only)
+ * Nobody waits on the threads directly: the setup code keeps binning
+ * further scenes and only waits on a scene's fence when it needs the
+ * scene (or its results) back.
  */
 static int
 thread_function(void *init_data)
@@ -792,6 +1342,8 @@ thread_function(void *init_data)
    snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
    u_thread_setname(thread_name);
 
+   pin_rast_thread(task);
+
    /* Make sure that denorms are treated like zeros. This is 
     * the behavior required by D3D10. OpenGL doesn't care.
     */
@@ -827,21 +1379,23 @@ thread_function(void *init_data)
 
       rasterize_scene(task,
                       rast->curr_scene);
-      
+
       /* wait for all threads to finish with this scene */
-      util_barrier_wait( &rast->barrier );
+      if (LP_DEBUG & DEBUG_COUNTERS) {
+         int64_t idle_start = os_time_get();
+         util_barrier_wait( &rast->barrier );
+         LP_COUNT_ADD(rast_idle_time, os_time_get() - idle_start);
+      }
+      else {
+         util_barrier_wait( &rast->barrier );
+      }
 
-      /* XXX: shouldn't be necessary:
-       */
       if (task->thread_index == 0) {
          lp_rast_end( rast );
       }
 
-      /* signal done with work */
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
-
-      pipe_semaphore_signal(&task->work_done);
    }
 
 #ifdef _WIN32
@@ -907,6 +1461,8 @@ lp_rast_create( unsigned num_threads )
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", FALSE);
 
+   choose_rast_thread_affinity(rast);
+
    create_rast_threads(rast);
 
    /* for synchronizing rasterization threads */
@@ -966,6 +1522,8 @@ void lp_rast_destroy( struct lp_rasterizer *rast )
    }
    for (i = 0; i < MAX2(1, rast->num_threads); i++) {
       align_free(rast->tasks[i].thread_data.cache);
+      align_free(rast->tasks[i].cs_shared);
+      cs_destroy_fibers(&rast->tasks[i]);
    }
 
    /* for synchronizing rasterization threads */
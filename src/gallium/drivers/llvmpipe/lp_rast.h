@@ -38,6 +38,7 @@
 #define LP_RAST_H
 
 #include "pipe/p_compiler.h"
+#include "util/u_math.h"
 #include "util/u_pack_color.h"
 #include "lp_jit.h"
 
@@ -149,12 +150,61 @@ struct lp_rast_clear_rb {
 };
 
 
+/**
+ * A compute grid dispatch.  Takes the place of the bins in a scene of its
+ * own, see lp_setup_launch_grid().  The rasterizer threads claim batches
+ * of groups_per_claim work groups through next_claim until all num_groups
+ * of them are done.
+ */
+/* Stack of a compute shader fiber, on top of the shader's temporaries */
+#define LP_CS_FIBER_STACK_SIZE (128 * 1024)
+
+struct lp_rast_cs_job {
+   struct lp_jit_context jit_context;
+   lp_jit_cs_func jit_function;
+
+   unsigned grid_size[3];
+   unsigned num_vectors;      /**< SIMD vectors per work group */
+   unsigned shared_size;      /**< bytes of shared memory per work group */
+   unsigned fiber_stack_size; /**< non-zero if vectors run on fibers */
+
+   uint64_t num_groups;
+   unsigned groups_per_claim;
+   int next_claim;
+};
+
+
 #define GET_A0(inputs) ((float (*)[4])((inputs)+1))
 #define GET_DADX(inputs) ((float (*)[4])((char *)((inputs) + 1) + (inputs)->stride))
 #define GET_DADY(inputs) ((float (*)[4])((char *)((inputs) + 1) + 2 * (inputs)->stride))
 #define GET_PLANES(tri) ((struct lp_rast_plane *)((char *)(&(tri)->inputs + 1) + 3 * (tri)->inputs.stride))
 
 
+/**
+ * Range of the depth of a primitive over the pixels [x0, x1] x [y0, y1],
+ * for hierarchical depth culling.  Depth is linear in x and y, so the
+ * extremes are at the corners.  The range is widened to account for the
+ * rounding of the shader's own depth interpolation.
+ */
+static inline void
+lp_rast_depth_range(const struct lp_rast_shader_inputs *inputs,
+                    int x0, int y0, int x1, int y1,
+                    float *zmin, float *zmax)
+{
+   const float z0 = GET_A0(inputs)[0][2];
+   const float dzdx = GET_DADX(inputs)[0][2];
+   const float dzdy = GET_DADY(inputs)[0][2];
+   const float zx0 = dzdx * (float)x0, zx1 = dzdx * (float)x1;
+   const float zy0 = dzdy * (float)y0, zy1 = dzdy * (float)y1;
+   const float err = (fabsf(z0) +
+                      MAX2(fabsf(zx0), fabsf(zx1)) +
+                      MAX2(fabsf(zy0), fabsf(zy1))) * (8.0f * FLT_EPSILON);
+
+   *zmin = z0 + MIN2(zx0, zx1) + MIN2(zy0, zy1) - err;
+   *zmax = z0 + MAX2(zx0, zx1) + MAX2(zy0, zy1) + err;
+}
+
+
 
 struct lp_rasterizer *
 lp_rast_create( unsigned num_threads );
@@ -166,8 +216,11 @@ void
 lp_rast_queue_scene( struct lp_rasterizer *rast,
                      struct lp_scene *scene );
 
+boolean
+lp_rast_cs_fibers_supported(void);
+
 void
-lp_rast_finish( struct lp_rasterizer *rast );
+lp_rast_cs_barrier(void *barrier_data);
 
 
 union lp_rast_cmd_arg {
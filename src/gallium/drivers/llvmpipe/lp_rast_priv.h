@@ -42,6 +42,9 @@
 #define TILE_VECTOR_HEIGHT 4
 #define TILE_VECTOR_WIDTH 4
 
+/** Max number of CPUs rasterizer threads can be pinned to */
+#define LP_MAX_CPUS 1024
+
 /* If we crash in a jitted function, we can examine jit_line and jit_state
  * to get some info.  This is not thread-safe, however.
  */
@@ -75,6 +78,7 @@ extern const struct lp_rasterizer_task *jit_task;
 
 struct lp_rasterizer;
 struct cmd_bin;
+struct lp_cs_fibers;
 
 /**
  * Per-thread rasterization state
@@ -91,6 +95,9 @@ struct lp_rasterizer_task
    uint8_t *color_tiles[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth_tile;
 
+   /** Hierarchical depth: upper bound of the depth of each 16x16 block */
+   float zmax[TILE_SIZE / 16][TILE_SIZE / 16];
+
    /** "back" pointer */
    struct lp_rasterizer *rast;
 
@@ -102,6 +109,15 @@ struct lp_rasterizer_task
 
    pipe_semaphore work_ready;
    pipe_semaphore work_done;
+
+   /** CPUs the thread pins itself to, if pin_thread is set */
+   boolean pin_thread;
+   uint32_t cpu_mask[LP_MAX_CPUS / 32];
+
+   /** Compute shader work group shared memory and fibers, grown on demand */
+   void *cs_shared;
+   unsigned cs_shared_size;
+   struct lp_cs_fibers *cs_fibers;
 };
 
 
@@ -215,6 +231,67 @@ lp_rast_get_depth_block_pointer(struct lp_rasterizer_task *task,
 
 
 
+/**
+ * Hierarchical depth test of a primitive against a 16x16 block: returns
+ * TRUE when the primitive is behind all pixels of the block.
+ * \param x, y location of 16x16 block in window coords
+ */
+static inline boolean
+lp_rast_hiz_cull_16(const struct lp_rasterizer_task *task,
+                    const struct lp_rast_shader_inputs *inputs,
+                    unsigned x, unsigned y)
+{
+   const float bound = task->zmax[(y % TILE_SIZE) / 16][(x % TILE_SIZE) / 16];
+   float zmin, zmax;
+
+   if (bound == FLT_MAX || !task->state->variant->hiz_test)
+      return FALSE;
+
+   lp_rast_depth_range(inputs, x, y, x + 15, y + 15, &zmin, &zmax);
+
+   return MIN2(zmin, 1.0f) > bound + task->scene->hiz_margin;
+}
+
+
+/**
+ * Lower the depth bound of a 16x16 block after shading a primitive which
+ * covers it entirely.
+ * \param x, y location of 16x16 block in window coords
+ */
+static inline void
+lp_rast_hiz_update_16(struct lp_rasterizer_task *task,
+                      const struct lp_rast_shader_inputs *inputs,
+                      unsigned x, unsigned y)
+{
+   float *bound = &task->zmax[(y % TILE_SIZE) / 16][(x % TILE_SIZE) / 16];
+   float zmin, zmax;
+
+   if (!task->scene->hiz || !task->state->variant->hiz_update)
+      return;
+
+   lp_rast_depth_range(inputs, x, y, x + 15, y + 15, &zmin, &zmax);
+
+   /* unorm formats store negative depths as zero */
+   zmax = MAX2(zmax, 0.0f);
+   if (zmax < *bound)
+      *bound = zmax;
+}
+
+
+/**
+ * Set the depth bound of all blocks of the tile, FLT_MAX meaning unknown.
+ */
+static inline void
+lp_rast_hiz_reset(struct lp_rasterizer_task *task, float zmax)
+{
+   unsigned i, j;
+
+   for (i = 0; i < TILE_SIZE / 16; i++)
+      for (j = 0; j < TILE_SIZE / 16; j++)
+         task->zmax[i][j] = zmax;
+}
+
+
 /**
  * Shade all pixels in a 4x4 block.  The fragment code omits the
  * triangle in/out tests.
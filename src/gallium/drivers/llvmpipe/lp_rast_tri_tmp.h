@@ -284,6 +284,22 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
    LP_COUNT_ADD(nr_empty_16, util_bitcount(0xffff & ~(partial_mask | inmask)));
 
+   /* Drop the blocks entirely behind the depth buffer contents:
+    */
+   if (task->state->variant->hiz_test) {
+      unsigned mask = partial_mask | inmask;
+      while (mask) {
+         int i = ffs(mask) - 1;
+         mask &= ~(1 << i);
+         if (lp_rast_hiz_cull_16(task, &tri->inputs,
+                                 x + (i & 3) * 16, y + (i >> 2) * 16)) {
+            partial_mask &= ~(1 << i);
+            inmask &= ~(1 << i);
+            LP_COUNT(nr_hiz_culled_16);
+         }
+      }
+   }
+
    /* Iterate over partials:
     */
    while (partial_mask) {
@@ -318,6 +334,7 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       LP_COUNT(nr_fully_covered_16);
       block_full_16(task, tri, px, py);
+      lp_rast_hiz_update_16(task, &tri->inputs, px, py);
    }
 }
 
@@ -31,9 +31,11 @@
 #include "util/u_inlines.h"
 #include "util/simple_list.h"
 #include "util/u_format.h"
+#include "util/u_atomic.h"
 #include "lp_scene.h"
 #include "lp_fence.h"
 #include "lp_debug.h"
+#include "lp_perf.h"
 
 
 #define RESOURCE_REF_SZ 32
@@ -53,17 +55,18 @@ struct resource_ref {
 struct lp_scene *
 lp_scene_create( struct pipe_context *pipe )
 {
-   struct lp_scene *scene = CALLOC_STRUCT(lp_scene);
+   /* Aligned for lp_scene::bin_queues */
+   struct lp_scene *scene = align_malloc(sizeof(struct lp_scene), 64);
    if (!scene)
       return NULL;
 
+   memset(scene, 0, sizeof(struct lp_scene));
+
    scene->pipe = pipe;
 
    scene->data.head =
       CALLOC_STRUCT(data_block);
 
-   (void) mtx_init(&scene->mutex, mtx_plain);
-
 #ifdef DEBUG
    /* Do some scene limit sanity checks here */
    {
@@ -90,10 +93,9 @@ void
 lp_scene_destroy(struct lp_scene *scene)
 {
    lp_fence_reference(&scene->fence, NULL);
-   mtx_destroy(&scene->mutex);
    assert(scene->data.head->next == NULL);
    FREE(scene->data.head);
-   FREE(scene);
+   align_free(scene);
 }
 
 
@@ -204,12 +206,13 @@ lp_scene_begin_rasterization(struct lp_scene *scene)
 
 
 /**
- * Free all the temporary data in a scene.
+ * Unmap the framebuffer surfaces mapped by lp_scene_begin_rasterization().
+ * Called by the rasterizer once all threads are done with the scene.
  */
 void
 lp_scene_end_rasterization(struct lp_scene *scene )
 {
-   int i, j;
+   int i;
 
    /* Unmap color buffers */
    for (i = 0; i < scene->fb.nr_cbufs; i++) {
@@ -232,6 +235,20 @@ lp_scene_end_rasterization(struct lp_scene *scene )
                               zsbuf->u.tex.first_layer);
       scene->zsbuf.map = NULL;
    }
+}
+
+
+/**
+ * Free all the temporary data in a scene so that it can be binned again.
+ * Called by the setup code, never while the rasterizer still owns the
+ * scene (i.e. its fence must either be NULL or signalled).
+ */
+void
+lp_scene_reset(struct lp_scene *scene )
+{
+   int i, j;
+
+   assert(!scene->zsbuf.map);
 
    /* Reset all command lists:
     */
@@ -269,6 +286,13 @@ lp_scene_end_rasterization(struct lp_scene *scene )
          }
       }
 
+      for (ref = scene->writeable_resources; ref; ref = ref->next) {
+         for (i = 0; i < ref->count; i++) {
+            j++;
+            pipe_resource_reference(&ref->resource[i], NULL);
+         }
+      }
+
       if (LP_DEBUG & DEBUG_SETUP)
          debug_printf("scene %d resources, sz %d\n",
                       j, scene->resource_reference_size);
@@ -292,10 +316,12 @@ lp_scene_end_rasterization(struct lp_scene *scene )
    lp_fence_reference(&scene->fence, NULL);
 
    scene->resources = NULL;
+   scene->writeable_resources = NULL;
    scene->scene_size = 0;
    scene->resource_reference_size = 0;
 
    scene->alloc_failed = FALSE;
+   scene->cs_job = NULL;
 
    util_unreference_framebuffer_state( &scene->fb );
 }
@@ -370,18 +396,26 @@ lp_scene_data_size( const struct lp_scene *scene )
 
 /**
  * Add a reference to a resource by the scene.
+ * \param writeable  the scene commands may write to the resource (e.g. SSBOs)
+ *
+ * The reference is held until the scene is reset, which only happens once
+ * the rasterizer is done with it, so the resource may safely be unbound
+ * or destroyed by the state tracker while the scene is still in flight.
  */
 boolean
 lp_scene_add_resource_reference(struct lp_scene *scene,
                                 struct pipe_resource *resource,
-                                boolean initializing_scene)
+                                boolean initializing_scene,
+                                boolean writeable)
 {
-   struct resource_ref *ref, **last = &scene->resources;
+   struct resource_ref **list = writeable ? &scene->writeable_resources :
+                                            &scene->resources;
+   struct resource_ref *ref, **last = list;
    int i;
 
    /* Look at existing resource blocks:
     */
-   for (ref = scene->resources; ref; ref = ref->next) {
+   for (ref = *list; ref; ref = ref->next) {
       last = &ref->next;
 
       /* Search for this resource:
@@ -427,17 +461,13 @@ lp_scene_add_resource_reference(struct lp_scene *scene,
 }
 
 
-/**
- * Does this scene have a reference to the given resource?
- */
-boolean
-lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                const struct pipe_resource *resource)
+static boolean
+resource_ref_list_contains(const struct resource_ref *ref,
+                           const struct pipe_resource *resource)
 {
-   const struct resource_ref *ref;
    int i;
 
-   for (ref = scene->resources; ref; ref = ref->next) {
+   for (; ref; ref = ref->next) {
       for (i = 0; i < ref->count; i++)
          if (ref->resource[i] == resource)
             return TRUE;
@@ -447,63 +477,156 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 }
 
 
+/**
+ * Does this scene have a reference to the given resource?
+ * \return bitmask of LP_REFERENCED_FOR_READ/WRITE
+ */
+unsigned
+lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                const struct pipe_resource *resource)
+{
+   unsigned i;
+
+   /* The render targets of the scene */
+   for (i = 0; i < scene->fb.nr_cbufs; i++) {
+      if (scene->fb.cbufs[i] && scene->fb.cbufs[i]->texture == resource)
+         return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+   }
+   if (scene->fb.zsbuf && scene->fb.zsbuf->texture == resource)
+      return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+
+   if (resource_ref_list_contains(scene->writeable_resources, resource))
+      return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
+
+   if (resource_ref_list_contains(scene->resources, resource))
+      return LP_REFERENCED_FOR_READ;
+
+   return LP_UNREFERENCED;
+}
+
+
 
 
-/** advance curr_x,y to the next bin */
-static boolean
-next_bin(struct lp_scene *scene)
+/** Estimate the cost of rasterizing a bin from its command count */
+static unsigned
+bin_cost(const struct cmd_bin *bin)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
+   const struct cmd_block *block;
+   unsigned cost = 1;
+
+   for (block = bin->head; block; block = block->next)
+      cost += block->count;
+
+   return cost;
+}
+
+
+/** qsort callback, most expensive bins first */
+static int
+compare_bin_cost(const void *a, const void *b)
+{
+   const struct lp_bin_sched_entry *ea = a;
+   const struct lp_bin_sched_entry *eb = b;
+
+   if (ea->cost != eb->cost)
+      return ea->cost < eb->cost ? 1 : -1;
+   if (ea->y != eb->y)
+      return ea->y < eb->y ? -1 : 1;
+   return ea->x < eb->x ? -1 : (ea->x > eb->x);
+}
+
+
+/**
+ * Prepare the bins of the scene for rasterization by num_threads threads.
+ * Called once per scene by one thread, before the other threads start
+ * calling lp_scene_bin_iter_next().
+ *
+ * Non-empty bins are sorted by decreasing cost and dealt round-robin to
+ * per-thread queues, so that every thread starts with its share of the
+ * expensive bins and the cheap ones are left at the end to even out the
+ * finishing times.  Empty bins are not scheduled at all.
+ */
+void
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_threads )
+{
+   unsigned num_bins = 0;
+   unsigned i, x, y;
+
+   for (y = 0; y < scene->tiles_y; y++) {
+      for (x = 0; x < scene->tiles_x; x++) {
+         const struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
+         if (bin->head) {
+            struct lp_bin_sched_entry *entry = &scene->bin_order[num_bins++];
+            entry->cost = bin_cost(bin);
+            entry->x = x;
+            entry->y = y;
+         }
+      }
    }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return FALSE;
+
+   qsort(scene->bin_order, num_bins, sizeof scene->bin_order[0],
+         compare_bin_cost);
+
+   scene->num_bin_queues = MAX2(1, num_threads);
+   assert(scene->num_bin_queues <= ARRAY_SIZE(scene->bin_queues));
+
+   for (i = 0; i < scene->num_bin_queues; i++) {
+      struct lp_bin_queue *queue = &scene->bin_queues[i];
+      queue->next = 0;
+      queue->first = i;
+      queue->count = i < num_bins ?
+         (num_bins - i + scene->num_bin_queues - 1) / scene->num_bin_queues : 0;
    }
-   return TRUE;
 }
 
 
-void
-lp_scene_bin_iter_begin( struct lp_scene *scene )
+/** Claim the next bin of a queue, returns NULL if the queue is empty */
+static struct lp_bin_sched_entry *
+bin_queue_pop(struct lp_scene *scene, struct lp_bin_queue *queue)
 {
-   scene->curr_x = scene->curr_y = -1;
+   int k;
+
+   if ((unsigned)p_atomic_read(&queue->next) >= queue->count)
+      return NULL;
+
+   k = p_atomic_inc_return(&queue->next) - 1;
+   if ((unsigned)k >= queue->count)
+      return NULL;
+
+   return &scene->bin_order[queue->first + k * scene->num_bin_queues];
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
+ * Return pointer to next bin to be rendered by the given thread.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  A thread first drains its own queue,
+ * then steals from the other threads' queues.
  */
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned thread_index,
+                        int *x, int *y )
 {
-   struct cmd_bin *bin = NULL;
+   struct lp_bin_sched_entry *entry;
+   unsigned i;
 
-   mtx_lock(&scene->mutex);
+   assert(thread_index < scene->num_bin_queues);
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   }
-   else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
+   entry = bin_queue_pop(scene, &scene->bin_queues[thread_index]);
+
+   for (i = 1; !entry && i < scene->num_bin_queues; i++) {
+      unsigned victim = (thread_index + i) % scene->num_bin_queues;
+      entry = bin_queue_pop(scene, &scene->bin_queues[victim]);
+      if (entry)
+         LP_COUNT(nr_bins_stolen);
    }
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+   if (!entry)
+      return NULL;
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   *x = entry->x;
+   *y = entry->y;
+   return lp_scene_get_bin(scene, entry->x, entry->y);
 }
 
 
@@ -545,6 +668,37 @@ void lp_scene_begin_binning(struct lp_scene *scene,
       max_layer = MIN2(max_layer, zsbuf->u.tex.last_layer - zsbuf->u.tex.first_layer);
    }
    scene->fb_max_layer = max_layer;
+
+   /*
+    * Hierarchical depth.  The bounds are tracked for the first layer only.
+    * Unorm depth values are rounded when stored (and are only as precise
+    * as floats before that), so a primitive must be behind the bounds by a
+    * few units in the last place to be culled.
+    */
+   scene->hiz = FALSE;
+   scene->hiz_margin = 0.0f;
+   if (fb->zsbuf && max_layer == 0 && !(LP_PERF & PERF_NO_HIZ)) {
+      enum pipe_format format = fb->zsbuf->format;
+      const struct util_format_description *desc =
+         util_format_description(format);
+
+      if (util_format_has_depth(desc)) {
+         scene->hiz = TRUE;
+         if (desc->channel[desc->swizzle[0]].type != UTIL_FORMAT_TYPE_FLOAT) {
+            unsigned bits = util_format_get_component_bits(
+               format, UTIL_FORMAT_COLORSPACE_ZS, 0);
+            scene->hiz_margin = 3.0f / (float)((1ull << bits) - 1) +
+                                2.0f * FLT_EPSILON;
+         }
+      }
+   }
+
+   for (i = 0; i < scene->tiles_x; i++) {
+      int j;
+      for (j = 0; j < scene->tiles_y; j++) {
+         scene->tile[i][j].zmax = FLT_MAX;
+      }
+   }
 }
 
 
@@ -38,9 +38,11 @@
 #include "os/os_thread.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
+#include "lp_state_fs.h"
 
 struct lp_scene_queue;
 struct lp_rast_state;
+struct lp_rast_cs_job;
 
 /* We're limited to 2K by 2K for 32bit fixed point rasterization.
  * Will need a 64-bit version for larger framebuffers.
@@ -95,6 +97,7 @@ struct data_block {
  */
 struct cmd_bin {
    const struct lp_rast_state *last_state;       /* most recent state set in bin */
+   float zmax;                                   /* upper bound of the tile depth */
    struct cmd_block *head;
    struct cmd_block *tail;
 };
@@ -117,6 +120,33 @@ struct data_block_list {
 
 struct resource_ref;
 
+
+/**
+ * A non-empty bin and its estimated rasterization cost, see
+ * lp_scene_bin_iter_begin().
+ */
+struct lp_bin_sched_entry {
+   unsigned cost;
+   uint16_t x, y;
+};
+
+
+/**
+ * Per-thread queue of bins to rasterize.  The queue holds every
+ * num_bin_queues'th entry of lp_scene::bin_order starting at 'first'.
+ * Bins are claimed by atomically incrementing 'next', both by the owning
+ * thread and by threads which ran out of work and steal from it, so no
+ * lock is needed.  Each queue is padded to a cache line, and the queue
+ * array in lp_scene is cache line aligned.
+ */
+struct lp_bin_queue {
+   int next;
+   unsigned first;
+   unsigned count;
+   uint8_t pad[64 - 3 * sizeof(unsigned)];
+};
+
+
 /**
  * All bins and bin data are contained here.
  * Per-bin data goes into the 'tile' bins.
@@ -151,9 +181,19 @@ struct lp_scene {
    /** the framebuffer to render the scene into */
    struct pipe_framebuffer_state fb;
 
+   /**
+    * Hierarchical depth culling is enabled for the scene, and the depth
+    * error margin of the depth buffer format (see lp_scene_begin_binning()).
+    */
+   boolean hiz;
+   float hiz_margin;
+
    /** list of resources referenced by the scene commands */
    struct resource_ref *resources;
 
+   /** list of resources the scene commands may write to */
+   struct resource_ref *writeable_resources;
+
    /** Total memory used by the scene (in bytes).  This sums all the
     * data blocks and counts all bins, state, resource references and
     * other random allocations within the scene.
@@ -172,8 +212,13 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
+   /** Bin scheduling for the rasterizer threads */
+   PIPE_ALIGN_VAR(64) struct lp_bin_queue bin_queues[LP_MAX_THREADS];
+   unsigned num_bin_queues;
+   struct lp_bin_sched_entry bin_order[TILES_X * TILES_Y];
+
+   /** A compute dispatch to run instead of the bins, or NULL */
+   struct lp_rast_cs_job *cs_job;
 
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
@@ -196,10 +241,11 @@ struct cmd_block *lp_scene_new_cmd_block( struct lp_scene *scene,
 
 boolean lp_scene_add_resource_reference(struct lp_scene *scene,
                                         struct pipe_resource *resource,
-                                        boolean initializing_scene);
+                                        boolean initializing_scene,
+                                        boolean writeable);
 
-boolean lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                        const struct pipe_resource *resource );
+unsigned lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                         const struct pipe_resource *resource );
 
 
 /**
@@ -338,6 +384,8 @@ lp_scene_bin_cmd_with_state( struct lp_scene *scene,
 
    if (state != bin->last_state) {
       bin->last_state = state;
+      if (!state->variant->hiz_keep)
+         bin->zmax = FLT_MAX;
       if (!lp_scene_bin_command(scene, x, y,
                                 LP_RAST_OP_SET_STATE,
                                 lp_rast_arg_state(state)))
@@ -378,10 +426,11 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 
 
 void
-lp_scene_bin_iter_begin( struct lp_scene *scene );
+lp_scene_bin_iter_begin( struct lp_scene *scene, unsigned num_threads );
 
 struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
+lp_scene_bin_iter_next( struct lp_scene *scene, unsigned thread_index,
+                        int *x, int *y );
 
 
 
@@ -403,6 +452,9 @@ lp_scene_begin_rasterization(struct lp_scene *scene);
 void
 lp_scene_end_rasterization(struct lp_scene *scene);
 
+void
+lp_scene_reset(struct lp_scene *scene);
+
 
 
 
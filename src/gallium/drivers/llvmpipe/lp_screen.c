@@ -33,13 +33,22 @@
 #include "util/u_screen.h"
 #include "util/u_string.h"
 #include "util/u_format_s3tc.h"
+#include "util/u_threaded_context.h"
 #include "pipe/p_defines.h"
 #include "pipe/p_screen.h"
 #include "draw/draw_context.h"
+#include "compiler/nir/nir.h"
 #include "gallivm/lp_bld_type.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_debug.h"
+#if HAVE_LLVM >= 0x0700
+#include <llvm-c/TargetMachine.h>
+#endif
 
 #include "util/os_misc.h"
 #include "util/os_time.h"
+#include "util/disk_cache.h"
+#include "util/mesa-sha1.h"
 #include "lp_texture.h"
 #include "lp_fence.h"
 #include "lp_jit.h"
@@ -82,6 +91,7 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_blend",       PERF_NO_BLEND, NULL },
    { "no_depth",       PERF_NO_DEPTH, NULL },
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
+   { "no_hiz",         PERF_NO_HIZ, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -216,9 +226,10 @@ llvmpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_QUADS_FOLLOW_PROVOKING_VERTEX_CONVENTION:
       return 0;
    case PIPE_CAP_COMPUTE:
-      return 0;
+      return lp_rast_cs_fibers_supported();
    case PIPE_CAP_USER_VERTEX_BUFFERS:
-      return 1;
+      /* The threaded context doesn't take user vertex buffers. */
+      return !llvmpipe_screen(screen)->threaded;
    case PIPE_CAP_VERTEX_BUFFER_OFFSET_4BYTE_ALIGNED_ONLY:
    case PIPE_CAP_VERTEX_BUFFER_STRIDE_4BYTE_ALIGNED_ONLY:
    case PIPE_CAP_VERTEX_ELEMENT_SRC_OFFSET_4BYTE_ALIGNED_ONLY:
@@ -397,10 +408,18 @@ llvmpipe_get_shader_param(struct pipe_screen *screen,
                           enum pipe_shader_type shader,
                           enum pipe_shader_cap param)
 {
+   struct llvmpipe_screen *lp_screen = llvmpipe_screen(screen);
+
    switch(shader)
    {
    case PIPE_SHADER_FRAGMENT:
+   case PIPE_SHADER_COMPUTE:
       switch (param) {
+      case PIPE_SHADER_CAP_PREFERRED_IR:
+         return lp_screen->use_nir ? PIPE_SHADER_IR_NIR : PIPE_SHADER_IR_TGSI;
+      case PIPE_SHADER_CAP_SUPPORTED_IRS:
+         return (1 << PIPE_SHADER_IR_TGSI) |
+                (lp_screen->use_nir ? (1 << PIPE_SHADER_IR_NIR) : 0);
       default:
          return gallivm_get_shader_param(param);
       }
@@ -421,6 +440,11 @@ llvmpipe_get_shader_param(struct pipe_screen *screen,
             return PIPE_MAX_SHADER_SAMPLER_VIEWS;
          else
             return 0;
+      case PIPE_SHADER_CAP_PREFERRED_IR:
+         return lp_screen->use_nir ? PIPE_SHADER_IR_NIR : PIPE_SHADER_IR_TGSI;
+      case PIPE_SHADER_CAP_SUPPORTED_IRS:
+         return (1 << PIPE_SHADER_IR_TGSI) |
+                (lp_screen->use_nir ? (1 << PIPE_SHADER_IR_NIR) : 0);
       default:
          return draw_get_shader_param(shader, param);
       }
@@ -429,6 +453,107 @@ llvmpipe_get_shader_param(struct pipe_screen *screen,
    }
 }
 
+static const struct nir_shader_compiler_options gallivm_nir_options = {
+   .lower_scmp = true,
+   .lower_flrp32 = true,
+   .lower_flrp64 = true,
+   .lower_fmod = true,
+   .lower_fdph = true,
+   .lower_bitfield_extract = true,
+   .lower_bitfield_extract_to_shifts = true,
+   .lower_bitfield_insert = true,
+   .lower_bitfield_insert_to_shifts = true,
+   .lower_uadd_carry = true,
+   .lower_usub_borrow = true,
+   .lower_hadd = true,
+   .lower_add_sat = true,
+   .lower_ldexp = true,
+   .lower_extract_byte = true,
+   .lower_extract_word = true,
+   .lower_rotate = true,
+   .lower_pack_half_2x16 = true,
+   .lower_pack_unorm_2x16 = true,
+   .lower_pack_snorm_2x16 = true,
+   .lower_pack_unorm_4x8 = true,
+   .lower_pack_snorm_4x8 = true,
+   .lower_unpack_half_2x16 = true,
+   .lower_unpack_unorm_2x16 = true,
+   .lower_unpack_snorm_2x16 = true,
+   .lower_unpack_unorm_4x8 = true,
+   .lower_unpack_snorm_4x8 = true,
+   .lower_doubles_options = nir_lower_dround_even |
+                            nir_lower_dfract |
+                            nir_lower_dmod,
+   .max_unroll_iterations = 32,
+};
+
+static const void *
+llvmpipe_get_compiler_options(struct pipe_screen *screen,
+                              enum pipe_shader_ir ir,
+                              enum pipe_shader_type shader)
+{
+   assert(ir == PIPE_SHADER_IR_NIR);
+   return &gallivm_nir_options;
+}
+
+static int
+llvmpipe_get_compute_param(struct pipe_screen *_screen,
+                           enum pipe_shader_ir ir_type,
+                           enum pipe_compute_cap param,
+                           void *ret)
+{
+   switch (param) {
+   case PIPE_COMPUTE_CAP_IR_TARGET:
+      return 0;
+   case PIPE_COMPUTE_CAP_GRID_DIMENSION:
+      if (ret) {
+         uint64_t *grid_dimension = ret;
+         *grid_dimension = 3;
+      }
+      return sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_GRID_SIZE:
+      if (ret) {
+         uint64_t *grid_size = ret;
+         grid_size[0] = 65535;
+         grid_size[1] = 65535;
+         grid_size[2] = 65535;
+      }
+      return 3 * sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_BLOCK_SIZE:
+      if (ret) {
+         uint64_t *block_size = ret;
+         block_size[0] = 1024;
+         block_size[1] = 1024;
+         block_size[2] = 1024;
+      }
+      return 3 * sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_THREADS_PER_BLOCK:
+      if (ret) {
+         uint64_t *max_threads_per_block = ret;
+         *max_threads_per_block = 1024;
+      }
+      return sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_LOCAL_SIZE:
+      if (ret) {
+         uint64_t *max_local_size = ret;
+         *max_local_size = 32768;
+      }
+      return sizeof(uint64_t);
+   case PIPE_COMPUTE_CAP_MAX_GLOBAL_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_PRIVATE_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_INPUT_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_MEM_ALLOC_SIZE:
+   case PIPE_COMPUTE_CAP_MAX_CLOCK_FREQUENCY:
+   case PIPE_COMPUTE_CAP_MAX_COMPUTE_UNITS:
+   case PIPE_COMPUTE_CAP_IMAGES_SUPPORTED:
+   case PIPE_COMPUTE_CAP_SUBGROUP_SIZE:
+   case PIPE_COMPUTE_CAP_ADDRESS_BITS:
+   case PIPE_COMPUTE_CAP_MAX_VARIABLE_THREADS_PER_BLOCK:
+      break;
+   }
+   return 0;
+}
+
 static float
 llvmpipe_get_paramf(struct pipe_screen *screen, enum pipe_capf param)
 {
@@ -583,6 +708,19 @@ llvmpipe_flush_frontbuffer(struct pipe_screen *_screen,
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
    struct sw_winsys *winsys = screen->winsys;
    struct llvmpipe_resource *texture = llvmpipe_resource(resource);
+   struct lp_fence *fence = NULL;
+
+   /* Scenes are rasterized asynchronously and there is no context here
+    * to flush, so wait for everything queued so far to land before
+    * presenting the display target.
+    */
+   mtx_lock(&screen->rast_mutex);
+   lp_fence_reference(&fence, screen->last_fence);
+   mtx_unlock(&screen->rast_mutex);
+   if (fence) {
+      lp_fence_wait(fence);
+      lp_fence_reference(&fence, NULL);
+   }
 
    assert(texture->dt);
    if (texture->dt)
@@ -598,12 +736,22 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
+   lp_fence_reference(&screen->last_fence, NULL);
+
    lp_jit_screen_cleanup(screen);
 
+   if (util_queue_is_initialized(&screen->compile_queue))
+      util_queue_destroy(&screen->compile_queue);
+
+   disk_cache_destroy(screen->disk_shader_cache);
+
    if(winsys->destroy)
       winsys->destroy(winsys);
 
    mtx_destroy(&screen->rast_mutex);
+   mtx_destroy(&screen->tile_mutex);
+
+   slab_destroy_parent(&screen->pool_transfers);
 
    FREE(screen);
 }
@@ -611,6 +759,117 @@ llvmpipe_destroy_screen( struct pipe_screen *_screen )
 
 
 
+static struct disk_cache *
+llvmpipe_get_disk_shader_cache(struct pipe_screen *_screen)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
+
+   return screen->disk_shader_cache;
+}
+
+
+/**
+ * Create the persistent cache of JIT-compiled shader variants.
+ *
+ * The generated machine code depends on the Mesa and LLVM builds, on the
+ * host CPU and on the code generation options, so all of these go into the
+ * cache identifier.  Individual entries are then keyed by the shader and
+ * variant key only.
+ */
+static void
+lp_disk_cache_create(struct llvmpipe_screen *screen)
+{
+#ifdef HAVE_DLFCN_H
+   struct mesa_sha1 ctx;
+   struct util_cpu_caps cpu_caps;
+   unsigned char sha1[20];
+   char cache_id[20 * 2 + 1];
+   unsigned llvm_version = HAVE_LLVM;
+
+   _mesa_sha1_init(&ctx);
+
+   if (!disk_cache_get_function_identifier(lp_disk_cache_create, &ctx) ||
+       !disk_cache_get_function_identifier(LLVMLinkInMCJIT, &ctx))
+      return;
+
+   _mesa_sha1_update(&ctx, &llvm_version, sizeof llvm_version);
+
+   /* Only the instruction set matters, not the core count. */
+   cpu_caps = util_cpu_caps;
+   cpu_caps.nr_cpus = 0;
+   cpu_caps.cores_per_L3 = 0;
+   _mesa_sha1_update(&ctx, &cpu_caps, sizeof cpu_caps);
+   _mesa_sha1_update(&ctx, &lp_native_vector_width,
+                     sizeof lp_native_vector_width);
+
+#if HAVE_LLVM >= 0x0700
+   {
+      char *cpu_name = LLVMGetHostCPUName();
+      _mesa_sha1_update(&ctx, cpu_name, strlen(cpu_name));
+      LLVMDisposeMessage(cpu_name);
+   }
+#endif
+
+   _mesa_sha1_final(&ctx, sha1);
+   disk_cache_format_hex_id(cache_id, sha1, 20 * 2);
+
+   /* GALLIVM_PERF flags change the generated code. */
+   screen->disk_shader_cache = disk_cache_create("llvmpipe", cache_id,
+                                                 gallivm_perf);
+#endif
+}
+
+
+/**
+ * Look up the machine code for a shader variant in the disk cache.
+ * On a hit, cache->data is a malloc'ed buffer which the caller must free.
+ */
+void
+lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
+                          struct lp_cached_code *cache,
+                          unsigned char ir_sha1_cache_key[20])
+{
+   unsigned char sha1[CACHE_KEY_SIZE];
+   size_t binary_size;
+   void *buffer;
+
+   if (!screen->disk_shader_cache)
+      return;
+
+   disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key, 20,
+                          sha1);
+
+   buffer = disk_cache_get(screen->disk_shader_cache, sha1, &binary_size);
+   if (!buffer) {
+      cache->data_size = 0;
+      return;
+   }
+
+   cache->data = buffer;
+   cache->data_size = binary_size;
+}
+
+
+/**
+ * Store the machine code of a freshly compiled shader variant.
+ */
+void
+lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
+                            struct lp_cached_code *cache,
+                            unsigned char ir_sha1_cache_key[20])
+{
+   unsigned char sha1[CACHE_KEY_SIZE];
+
+   if (!screen->disk_shader_cache || !cache->data_size || cache->dont_cache)
+      return;
+
+   disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_key, 20,
+                          sha1);
+   disk_cache_put(screen->disk_shader_cache, sha1, cache->data,
+                  cache->data_size, NULL);
+}
+
+
 /**
  * Fence reference counting.
  */
@@ -637,6 +896,35 @@ llvmpipe_fence_finish(struct pipe_screen *screen,
 {
    struct lp_fence *f = (struct lp_fence *) fence_handle;
 
+   /* A deferred fence of the threaded context, see llvmpipe_create_fence().
+    * Get its flush going if it's still in the context's current batch, then
+    * wait for it to be executed.
+    */
+   if (!util_queue_fence_is_signalled(&f->ready)) {
+      if (f->tc_token && ctx)
+         threaded_context_flush(ctx, f->tc_token, timeout == 0);
+
+      if (!timeout)
+         return false;
+
+      if (timeout == PIPE_TIMEOUT_INFINITE) {
+         util_queue_fence_wait(&f->ready);
+      } else {
+         int64_t abs_timeout = os_time_get_absolute_timeout(timeout);
+         int64_t now;
+
+         if (!util_queue_fence_wait_timeout(&f->ready, abs_timeout))
+            return false;
+
+         /* Whatever is left goes to the flushed fence. */
+         now = os_time_get_nano();
+         timeout = abs_timeout > now ? abs_timeout - now : 0;
+      }
+   }
+
+   if (f->flushed)
+      f = f->flushed;
+
    if (!timeout)
       return lp_fence_signalled(f);
 
@@ -691,7 +979,9 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.get_param = llvmpipe_get_param;
    screen->base.get_shader_param = llvmpipe_get_shader_param;
    screen->base.get_paramf = llvmpipe_get_paramf;
+   screen->base.get_compute_param = llvmpipe_get_compute_param;
    screen->base.is_format_supported = llvmpipe_is_format_supported;
+   screen->base.get_compiler_options = llvmpipe_get_compiler_options;
 
    screen->base.context_create = llvmpipe_create_context;
    screen->base.flush_frontbuffer = llvmpipe_flush_frontbuffer;
@@ -699,6 +989,7 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    screen->base.fence_finish = llvmpipe_fence_finish;
 
    screen->base.get_timestamp = llvmpipe_get_timestamp;
+   screen->base.get_disk_shader_cache = llvmpipe_get_disk_shader_cache;
 
    llvmpipe_init_screen_resource_funcs(&screen->base);
 
@@ -717,5 +1008,38 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
    }
    (void) mtx_init(&screen->rast_mutex, mtx_plain);
 
+   lp_disk_cache_create(screen);
+
+   screen->tiled_textures = debug_get_bool_option("LP_TILED_TEXTURES", FALSE);
+   (void) mtx_init(&screen->tile_mutex, mtx_plain);
+
+   /* The vertex and geometry shaders run in the draw module, which can only
+    * consume NIR when it generates LLVM code itself.
+    */
+   screen->use_nir = debug_get_bool_option("LP_NIR", FALSE) &&
+                     draw_get_option_use_llvm();
+
+   /* Same default as threaded_context_create(). */
+   screen->threaded = debug_get_bool_option("GALLIUM_THREAD",
+                                            util_cpu_caps.nr_cpus > 1);
+
+   /* Compile threads run at minimum priority so that they only soak up time
+    * the rasterizer threads leave idle.
+    */
+   if (debug_get_bool_option("LP_ASYNC_COMPILE", screen->num_threads > 0)) {
+      unsigned num_compile_threads = CLAMP(util_cpu_caps.nr_cpus / 4, 1, 4);
+
+      /* On failure the queue is left uninitialized and variants are simply
+       * compiled synchronously.
+       */
+      (void) util_queue_init(&screen->compile_queue, "lpcompile", 64,
+                             num_compile_threads,
+                             UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                             UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY);
+   }
+
+   slab_create_parent(&screen->pool_transfers,
+                      sizeof(struct llvmpipe_transfer), 64);
+
    return &screen->base;
 }
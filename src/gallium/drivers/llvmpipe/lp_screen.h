@@ -37,10 +37,14 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
+#include "util/u_queue.h"
+#include "util/slab.h"
 #include "gallivm/lp_bld.h"
 
 
 struct sw_winsys;
+struct disk_cache;
+struct lp_cached_code;
 
 
 struct llvmpipe_screen
@@ -57,6 +61,38 @@ struct llvmpipe_screen
 
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
+
+   /** Fence of the last scene queued by any context, under rast_mutex */
+   struct lp_fence *last_fence;
+
+   /** Persistent cache of JIT-compiled shader variants, may be NULL */
+   struct disk_cache *disk_shader_cache;
+
+   /**
+    * Background threads producing optimized shader variants, while draws
+    * use a quickly compiled unoptimized version.  Not initialized if
+    * LP_ASYNC_COMPILE is disabled.
+    */
+   struct util_queue compile_queue;
+
+   /** Store sampler-only textures in tiles, see LP_TILED_TEXTURES */
+   boolean tiled_textures;
+
+   /**
+    * Taken when untiling a texture, and by contexts while they derive
+    * sampler state, so that shader variants and texture addresses agree on
+    * the layout.
+    */
+   mtx_t tile_mutex;
+
+   /** Advertise NIR as the preferred shader IR, see LP_NIR */
+   boolean use_nir;
+
+   /** Whether contexts are wrapped in the threaded context (GALLIUM_THREAD) */
+   boolean threaded;
+
+   /** Transfers allocated by the threaded contexts */
+   struct slab_parent_pool pool_transfers;
 };
 
 
@@ -69,5 +105,15 @@ llvmpipe_screen( struct pipe_screen *pipe )
 }
 
 
+void
+lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
+                          struct lp_cached_code *cache,
+                          unsigned char ir_sha1_cache_key[20]);
+
+void
+lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
+                            struct lp_cached_code *cache,
+                            unsigned char ir_sha1_cache_key[20]);
+
 
 #endif /* LP_SCREEN_H */
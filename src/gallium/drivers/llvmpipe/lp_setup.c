@@ -64,8 +64,16 @@ static boolean set_scene_state( struct lp_setup_context *, enum setup_state,
 static boolean try_update_scene_state( struct lp_setup_context *setup );
 
 
+/**
+ * Get the next scene of the ring to bin into.
+ * Scenes are handed to the rasterizer in ring order, so the next scene is
+ * always the oldest one.  If it is still being rasterized we have no
+ * choice but to wait for it; otherwise binning of this scene overlaps
+ * with the rasterization of the previous ones.
+ */
 static void
-lp_setup_get_empty_scene(struct lp_setup_context *setup)
+lp_setup_get_empty_scene(struct lp_setup_context *setup,
+                         struct pipe_framebuffer_state *fb)
 {
    assert(setup->scene == NULL);
 
@@ -80,10 +88,10 @@ lp_setup_get_empty_scene(struct lp_setup_context *setup)
                       __FUNCTION__, setup->scene->fence->id);
 
       lp_fence_wait(setup->scene->fence);
+      lp_scene_reset(setup->scene);
    }
 
-   lp_scene_begin_binning(setup->scene, &setup->fb);
-
+   lp_scene_begin_binning(setup->scene, fb);
 }
 
 
@@ -165,23 +173,15 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
    if (setup->last_fence)
       setup->last_fence->issued = TRUE;
 
-   mtx_lock(&screen->rast_mutex);
-
-   /* FIXME: We enqueue the scene then wait on the rasterizer to finish.
-    * This means we never actually run any vertex stuff in parallel to
-    * rasterization (not in the same context at least) which is what the
-    * multiple scenes per setup is about - when we get a new empty scene
-    * any old one is already empty again because we waited here for
-    * raster tasks to be finished. Ideally, we shouldn't need to wait here
-    * and rely on fences elsewhere when waiting is necessary.
-    * Certainly, lp_scene_end_rasterization() would need to be deferred too
-    * and there's probably other bits why this doesn't actually work.
+   /* Don't wait for the rasterizer here: the scene is reclaimed by
+    * lp_setup_get_empty_scene() once its fence signals, and anybody who
+    * needs the results waits on the fence returned by lp_setup_flush().
     */
+   mtx_lock(&screen->rast_mutex);
    lp_rast_queue_scene(screen->rast, scene);
-   lp_rast_finish(screen->rast);
+   lp_fence_reference(&screen->last_fence, scene->fence);
    mtx_unlock(&screen->rast_mutex);
 
-   lp_scene_end_rasterization(setup->scene);
    lp_setup_reset( setup );
 
    LP_DBG(DEBUG_SETUP, "%s done \n", __FUNCTION__);
@@ -189,6 +189,29 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
 
 
 
+/**
+ * A depth clear sets the hierarchical depth bound of all tiles.  Bins
+ * forget their last state, so that the rasterizer sees the next state
+ * change, which may invalidate the bounds again, after the clear.
+ */
+static void
+clear_hiz(struct lp_scene *scene, float depth)
+{
+   unsigned i, j;
+
+   if (!scene->hiz)
+      return;
+
+   for (i = 0; i < scene->tiles_x; i++) {
+      for (j = 0; j < scene->tiles_y; j++) {
+         struct cmd_bin *bin = lp_scene_get_bin(scene, i, j);
+         bin->zmax = MAX2(depth, 0.0f);
+         bin->last_state = NULL;
+      }
+   }
+}
+
+
 static boolean
 begin_binning( struct lp_setup_context *setup )
 {
@@ -199,9 +222,10 @@ begin_binning( struct lp_setup_context *setup )
    assert(scene);
    assert(scene->fence == NULL);
 
-   /* Always create a fence:
+   /* Always create a fence.  It is signalled once, by the rasterizer,
+    * when all threads are done with the scene:
     */
-   scene->fence = lp_fence_create(MAX2(1, setup->num_threads));
+   scene->fence = lp_fence_create(1);
    if (!scene->fence)
       return FALSE;
 
@@ -253,6 +277,9 @@ begin_binning( struct lp_setup_context *setup )
                                           setup->clear.zsmask));
          if (!ok)
             return FALSE;
+
+         if (setup->clear.flags & PIPE_CLEAR_DEPTH)
+            clear_hiz(scene, setup->clear.depth);
       }
    }
 
@@ -312,7 +339,7 @@ set_scene_state( struct lp_setup_context *setup,
    /* wait for a free/empty scene
     */
    if (old_state == SETUP_FLUSHED) 
-      lp_setup_get_empty_scene(setup);
+      lp_setup_get_empty_scene(setup, &setup->fb);
 
    switch (new_state) {
    case SETUP_CLEARED:
@@ -342,7 +369,7 @@ set_scene_state( struct lp_setup_context *setup,
 
 fail:
    if (setup->scene) {
-      lp_scene_end_rasterization(setup->scene);
+      lp_scene_reset(setup->scene);
       setup->scene = NULL;
    }
 
@@ -516,6 +543,9 @@ lp_setup_try_clear_zs(struct lp_setup_context *setup,
                                    LP_RAST_OP_CLEAR_ZSTENCIL,
                                    lp_rast_arg_clearzs(zsvalue, zsmask)))
          return FALSE;
+
+      if (flags & PIPE_CLEAR_DEPTH)
+         clear_hiz(scene, (float)depth);
    }
    else {
       /* Put ourselves into the 'pre-clear' state, specifically to try
@@ -527,6 +557,9 @@ lp_setup_try_clear_zs(struct lp_setup_context *setup,
 
       setup->clear.flags |= flags;
 
+      if (flags & PIPE_CLEAR_DEPTH)
+         setup->clear.depth = (float)depth;
+
       setup->clear.zsmask |= zsmask;
       setup->clear.zsvalue =
          (setup->clear.zsvalue & ~zsmask) | (zsvalue & zsmask);
@@ -809,6 +842,122 @@ lp_setup_set_viewports(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Fill in the jit texture of a sampler view.
+ */
+static void
+setup_jit_texture(struct lp_jit_texture *jit_tex,
+                  struct pipe_sampler_view *view)
+{
+   struct pipe_resource *res = view->texture;
+   struct llvmpipe_resource *lp_tex = llvmpipe_resource(res);
+
+   if (!lp_tex->dt) {
+      /* regular texture - setup array of mipmap level offsets */
+      int j;
+      unsigned first_level = 0;
+      unsigned last_level = 0;
+
+      if (llvmpipe_resource_is_texture(res)) {
+         first_level = view->u.tex.first_level;
+         last_level = view->u.tex.last_level;
+         assert(first_level <= last_level);
+         assert(last_level <= res->last_level);
+         jit_tex->base = lp_tex->tex_data;
+      }
+      else {
+        jit_tex->base = lp_tex->data;
+      }
+
+      if (LP_PERF & PERF_TEX_MEM) {
+         /* use dummy tile memory */
+         jit_tex->base = lp_dummy_tile;
+         jit_tex->width = TILE_SIZE/8;
+         jit_tex->height = TILE_SIZE/8;
+         jit_tex->depth = 1;
+         jit_tex->first_level = 0;
+         jit_tex->last_level = 0;
+         jit_tex->mip_offsets[0] = 0;
+         jit_tex->row_stride[0] = 0;
+         jit_tex->img_stride[0] = 0;
+      }
+      else {
+         jit_tex->width = res->width0;
+         jit_tex->height = res->height0;
+         jit_tex->depth = res->depth0;
+         jit_tex->first_level = first_level;
+         jit_tex->last_level = last_level;
+
+         if (llvmpipe_resource_is_texture(res)) {
+            for (j = first_level; j <= last_level; j++) {
+               jit_tex->mip_offsets[j] = lp_tex->mip_offsets[j];
+               jit_tex->row_stride[j] = lp_tex->row_stride[j];
+               jit_tex->img_stride[j] = lp_tex->img_stride[j];
+            }
+
+            if (res->target == PIPE_TEXTURE_1D_ARRAY ||
+                res->target == PIPE_TEXTURE_2D_ARRAY ||
+                res->target == PIPE_TEXTURE_CUBE ||
+                res->target == PIPE_TEXTURE_CUBE_ARRAY) {
+               /*
+                * For array textures, we don't have first_layer, instead
+                * adjust last_layer (stored as depth) plus the mip level offsets
+                * (as we have mip-first layout can't just adjust base ptr).
+                * XXX For mip levels, could do something similar.
+                */
+               jit_tex->depth = view->u.tex.last_layer - view->u.tex.first_layer + 1;
+               for (j = first_level; j <= last_level; j++) {
+                  jit_tex->mip_offsets[j] += view->u.tex.first_layer *
+                                             lp_tex->img_stride[j];
+               }
+               if (view->target == PIPE_TEXTURE_CUBE ||
+                   view->target == PIPE_TEXTURE_CUBE_ARRAY) {
+                  assert(jit_tex->depth % 6 == 0);
+               }
+               assert(view->u.tex.first_layer <= view->u.tex.last_layer);
+               assert(view->u.tex.last_layer < res->array_size);
+            }
+         }
+         else {
+            /*
+             * For buffers, we don't have "offset", instead adjust
+             * the size (stored as width) plus the base pointer.
+             */
+            unsigned view_blocksize = util_format_get_blocksize(view->format);
+            /* probably don't really need to fill that out */
+            jit_tex->mip_offsets[0] = 0;
+            jit_tex->row_stride[0] = 0;
+            jit_tex->img_stride[0] = 0;
+
+            /* everything specified in number of elements here. */
+            jit_tex->width = view->u.buf.size / view_blocksize;
+            jit_tex->base = (uint8_t *)jit_tex->base + view->u.buf.offset;
+            /* XXX Unsure if we need to sanitize parameters? */
+            assert(view->u.buf.offset + view->u.buf.size <= res->width0);
+         }
+      }
+   }
+   else {
+      /* display target texture/surface */
+      /*
+       * XXX: Where should this be unmapped?
+       */
+      struct llvmpipe_screen *screen = llvmpipe_screen(res->screen);
+      struct sw_winsys *winsys = screen->winsys;
+      jit_tex->base = winsys->displaytarget_map(winsys, lp_tex->dt,
+                                                PIPE_TRANSFER_READ);
+      jit_tex->row_stride[0] = lp_tex->row_stride[0];
+      jit_tex->img_stride[0] = lp_tex->img_stride[0];
+      jit_tex->mip_offsets[0] = 0;
+      jit_tex->width = res->width0;
+      jit_tex->height = res->height0;
+      jit_tex->depth = res->depth0;
+      jit_tex->first_level = jit_tex->last_level = 0;
+      assert(jit_tex->base);
+   }
+}
+
+
 /**
  * Called during state validation when LP_NEW_SAMPLER_VIEW is set.
  */
@@ -829,119 +978,12 @@ lp_setup_set_fragment_sampler_views(struct lp_setup_context *setup,
       struct pipe_sampler_view *view = i < num ? views[i] : NULL;
 
       if (view) {
-         struct pipe_resource *res = view->texture;
-         struct llvmpipe_resource *lp_tex = llvmpipe_resource(res);
-         struct lp_jit_texture *jit_tex;
-         jit_tex = &setup->fs.current.jit_context.textures[i];
-
          /* We're referencing the texture's internal data, so save a
           * reference to it.
           */
-         pipe_resource_reference(&setup->fs.current_tex[i], res);
-
-         if (!lp_tex->dt) {
-            /* regular texture - setup array of mipmap level offsets */
-            int j;
-            unsigned first_level = 0;
-            unsigned last_level = 0;
-
-            if (llvmpipe_resource_is_texture(res)) {
-               first_level = view->u.tex.first_level;
-               last_level = view->u.tex.last_level;
-               assert(first_level <= last_level);
-               assert(last_level <= res->last_level);
-               jit_tex->base = lp_tex->tex_data;
-            }
-            else {
-              jit_tex->base = lp_tex->data;
-            }
+         pipe_resource_reference(&setup->fs.current_tex[i], view->texture);
 
-            if (LP_PERF & PERF_TEX_MEM) {
-               /* use dummy tile memory */
-               jit_tex->base = lp_dummy_tile;
-               jit_tex->width = TILE_SIZE/8;
-               jit_tex->height = TILE_SIZE/8;
-               jit_tex->depth = 1;
-               jit_tex->first_level = 0;
-               jit_tex->last_level = 0;
-               jit_tex->mip_offsets[0] = 0;
-               jit_tex->row_stride[0] = 0;
-               jit_tex->img_stride[0] = 0;
-            }
-            else {
-               jit_tex->width = res->width0;
-               jit_tex->height = res->height0;
-               jit_tex->depth = res->depth0;
-               jit_tex->first_level = first_level;
-               jit_tex->last_level = last_level;
-
-               if (llvmpipe_resource_is_texture(res)) {
-                  for (j = first_level; j <= last_level; j++) {
-                     jit_tex->mip_offsets[j] = lp_tex->mip_offsets[j];
-                     jit_tex->row_stride[j] = lp_tex->row_stride[j];
-                     jit_tex->img_stride[j] = lp_tex->img_stride[j];
-                  }
-
-                  if (res->target == PIPE_TEXTURE_1D_ARRAY ||
-                      res->target == PIPE_TEXTURE_2D_ARRAY ||
-                      res->target == PIPE_TEXTURE_CUBE ||
-                      res->target == PIPE_TEXTURE_CUBE_ARRAY) {
-                     /*
-                      * For array textures, we don't have first_layer, instead
-                      * adjust last_layer (stored as depth) plus the mip level offsets
-                      * (as we have mip-first layout can't just adjust base ptr).
-                      * XXX For mip levels, could do something similar.
-                      */
-                     jit_tex->depth = view->u.tex.last_layer - view->u.tex.first_layer + 1;
-                     for (j = first_level; j <= last_level; j++) {
-                        jit_tex->mip_offsets[j] += view->u.tex.first_layer *
-                                                   lp_tex->img_stride[j];
-                     }
-                     if (view->target == PIPE_TEXTURE_CUBE ||
-                         view->target == PIPE_TEXTURE_CUBE_ARRAY) {
-                        assert(jit_tex->depth % 6 == 0);
-                     }
-                     assert(view->u.tex.first_layer <= view->u.tex.last_layer);
-                     assert(view->u.tex.last_layer < res->array_size);
-                  }
-               }
-               else {
-                  /*
-                   * For buffers, we don't have "offset", instead adjust
-                   * the size (stored as width) plus the base pointer.
-                   */
-                  unsigned view_blocksize = util_format_get_blocksize(view->format);
-                  /* probably don't really need to fill that out */
-                  jit_tex->mip_offsets[0] = 0;
-                  jit_tex->row_stride[0] = 0;
-                  jit_tex->img_stride[0] = 0;
-
-                  /* everything specified in number of elements here. */
-                  jit_tex->width = view->u.buf.size / view_blocksize;
-                  jit_tex->base = (uint8_t *)jit_tex->base + view->u.buf.offset;
-                  /* XXX Unsure if we need to sanitize parameters? */
-                  assert(view->u.buf.offset + view->u.buf.size <= res->width0);
-               }
-            }
-         }
-         else {
-            /* display target texture/surface */
-            /*
-             * XXX: Where should this be unmapped?
-             */
-            struct llvmpipe_screen *screen = llvmpipe_screen(res->screen);
-            struct sw_winsys *winsys = screen->winsys;
-            jit_tex->base = winsys->displaytarget_map(winsys, lp_tex->dt,
-                                                         PIPE_TRANSFER_READ);
-            jit_tex->row_stride[0] = lp_tex->row_stride[0];
-            jit_tex->img_stride[0] = lp_tex->img_stride[0];
-            jit_tex->mip_offsets[0] = 0;
-            jit_tex->width = res->width0;
-            jit_tex->height = res->height0;
-            jit_tex->depth = res->depth0;
-            jit_tex->first_level = jit_tex->last_level = 0;
-            assert(jit_tex->base);
-         }
+         setup_jit_texture(&setup->fs.current.jit_context.textures[i], view);
       }
       else {
          pipe_resource_reference(&setup->fs.current_tex[i], NULL);
@@ -985,6 +1027,248 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Called during compute state validation, like the fragment shader
+ * counterparts above.
+ */
+void
+lp_setup_set_compute_sampler_views(struct lp_setup_context *setup,
+                                   unsigned num,
+                                   struct pipe_sampler_view **views)
+{
+   unsigned i, max_tex_num;
+
+   LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
+
+   assert(num <= PIPE_MAX_SHADER_SAMPLER_VIEWS);
+
+   max_tex_num = MAX2(num, setup->cs.current_tex_num);
+
+   for (i = 0; i < max_tex_num; i++) {
+      struct pipe_sampler_view *view = i < num ? views[i] : NULL;
+
+      if (view) {
+         pipe_resource_reference(&setup->cs.current_tex[i], view->texture);
+
+         setup_jit_texture(&setup->cs.jit_context.textures[i], view);
+      }
+      else {
+         pipe_resource_reference(&setup->cs.current_tex[i], NULL);
+      }
+   }
+   setup->cs.current_tex_num = num;
+}
+
+
+void
+lp_setup_set_compute_sampler_state(struct lp_setup_context *setup,
+                                   unsigned num,
+                                   struct pipe_sampler_state **samplers)
+{
+   unsigned i;
+
+   LP_DBG(DEBUG_SETUP, "%s\n", __FUNCTION__);
+
+   assert(num <= PIPE_MAX_SAMPLERS);
+
+   for (i = 0; i < num; i++) {
+      const struct pipe_sampler_state *sampler = samplers[i];
+
+      if (sampler) {
+         struct lp_jit_sampler *jit_sam;
+         jit_sam = &setup->cs.jit_context.samplers[i];
+
+         jit_sam->min_lod = sampler->min_lod;
+         jit_sam->max_lod = sampler->max_lod;
+         jit_sam->lod_bias = sampler->lod_bias;
+         COPY_4V(jit_sam->border_color, sampler->border_color.f);
+      }
+   }
+}
+
+
+void
+lp_setup_set_cs_constants(struct lp_setup_context *setup,
+                          unsigned num,
+                          struct pipe_constant_buffer *buffers)
+{
+   unsigned i;
+
+   LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) buffers);
+
+   assert(num <= ARRAY_SIZE(setup->cs.constants));
+
+   for (i = 0; i < num; ++i) {
+      util_copy_constant_buffer(&setup->cs.constants[i], &buffers[i]);
+   }
+   for (; i < ARRAY_SIZE(setup->cs.constants); i++) {
+      util_copy_constant_buffer(&setup->cs.constants[i], NULL);
+   }
+}
+
+
+void
+lp_setup_set_cs_ssbos(struct lp_setup_context *setup,
+                      unsigned num,
+                      struct pipe_shader_buffer *buffers)
+{
+   unsigned i;
+
+   LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) buffers);
+
+   assert(num <= ARRAY_SIZE(setup->cs.ssbos));
+
+   for (i = 0; i < num; ++i) {
+      util_copy_shader_buffer(&setup->cs.ssbos[i], &buffers[i]);
+   }
+   for (; i < ARRAY_SIZE(setup->cs.ssbos); i++) {
+      util_copy_shader_buffer(&setup->cs.ssbos[i], NULL);
+   }
+}
+
+
+/**
+ * Store the compute state in the scene: constants are copied since the
+ * application may change them before the grid has run, buffers and
+ * textures are referenced.
+ */
+static boolean
+setup_cs_job_state(struct lp_scene *scene,
+                   struct lp_setup_context *setup,
+                   struct lp_rast_cs_job *job)
+{
+   static const float fake_const_buf[4];
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(setup->cs.constants); ++i) {
+      const struct pipe_constant_buffer *cb = &setup->cs.constants[i];
+      const unsigned size = MIN2(cb->buffer_size,
+                                 LP_MAX_TGSI_CONST_BUFFER_SIZE);
+      const ubyte *data = NULL;
+
+      if (cb->buffer)
+         data = (ubyte *) llvmpipe_resource_data(cb->buffer);
+      else if (cb->user_buffer)
+         data = (ubyte *) cb->user_buffer;
+
+      if (data && size) {
+         void *stored = lp_scene_alloc(scene, size);
+         if (!stored)
+            return FALSE;
+
+         memcpy(stored, data + cb->buffer_offset, size);
+         job->jit_context.constants[i] = stored;
+         job->jit_context.num_constants[i] = size / (sizeof(float) * 4);
+      }
+      else {
+         job->jit_context.constants[i] = fake_const_buf;
+         job->jit_context.num_constants[i] = 0;
+      }
+   }
+
+   for (i = 0; i < ARRAY_SIZE(setup->cs.ssbos); ++i) {
+      const struct pipe_shader_buffer *sb = &setup->cs.ssbos[i];
+      const ubyte *data = NULL;
+
+      if (sb->buffer) {
+         if (!lp_scene_add_resource_reference(scene, sb->buffer, TRUE, TRUE))
+            return FALSE;
+         data = (ubyte *) llvmpipe_resource_data(sb->buffer);
+      }
+
+      if (data) {
+         job->jit_context.ssbos[i] = (const uint32_t *)(data + sb->buffer_offset);
+         job->jit_context.num_ssbos[i] = sb->buffer_size;
+      }
+      else {
+         job->jit_context.ssbos[i] = NULL;
+         job->jit_context.num_ssbos[i] = 0;
+      }
+   }
+
+   for (i = 0; i < setup->cs.current_tex_num; i++) {
+      if (setup->cs.current_tex[i] &&
+          !lp_scene_add_resource_reference(scene, setup->cs.current_tex[i],
+                                           TRUE, FALSE))
+         return FALSE;
+   }
+
+   return TRUE;
+}
+
+
+/**
+ * Queue a compute grid.  The grid gets a scene of its own, which the
+ * rasterizer threads share out by work groups rather than by bins.
+ * Anything binned so far is flushed first so that the grid sees its
+ * results.  fiber_stack_size is zero unless the vectors of a work group
+ * synchronize with barriers, and so run on fibers with stacks that big.
+ */
+boolean
+lp_setup_launch_grid(struct lp_setup_context *setup,
+                     lp_jit_cs_func jit_function,
+                     unsigned num_vectors,
+                     unsigned fiber_stack_size,
+                     const unsigned grid_size[3],
+                     unsigned shared_size)
+{
+   struct pipe_framebuffer_state no_fb;
+   struct lp_scene *scene;
+   struct lp_rast_cs_job *job;
+   unsigned num_threads = MAX2(1, setup->num_threads);
+
+   LP_DBG(DEBUG_SETUP, "%s %ux%ux%u\n", __FUNCTION__,
+          grid_size[0], grid_size[1], grid_size[2]);
+
+   if (!grid_size[0] || !grid_size[1] || !grid_size[2])
+      return TRUE;
+
+   set_scene_state(setup, SETUP_FLUSHED, __FUNCTION__);
+
+   memset(&no_fb, 0, sizeof no_fb);
+   lp_setup_get_empty_scene(setup, &no_fb);
+   scene = setup->scene;
+
+   scene->fence = lp_fence_create(1);
+   if (!scene->fence)
+      goto fail;
+
+   job = lp_scene_alloc(scene, sizeof *job);
+   if (!job)
+      goto fail;
+
+   memcpy(&job->jit_context, &setup->cs.jit_context, sizeof job->jit_context);
+   job->jit_function = jit_function;
+   job->grid_size[0] = grid_size[0];
+   job->grid_size[1] = grid_size[1];
+   job->grid_size[2] = grid_size[2];
+   job->num_vectors = num_vectors;
+   job->shared_size = shared_size;
+   job->fiber_stack_size = fiber_stack_size;
+   job->num_groups = (uint64_t)grid_size[0] * grid_size[1] * grid_size[2];
+   job->next_claim = 0;
+
+   /* Enough claims for the threads to balance out, few enough that small
+    * work groups don't all contend for the counter.
+    */
+   job->groups_per_claim =
+      (unsigned)CLAMP(job->num_groups / (num_threads * 16), 1, 64);
+
+   if (!setup_cs_job_state(scene, setup, job))
+      goto fail;
+
+   scene->cs_job = job;
+   lp_setup_rasterize_scene(setup);
+   return TRUE;
+
+fail:
+   lp_scene_reset(scene);
+   setup->scene = NULL;
+   lp_setup_reset(setup);
+   return FALSE;
+}
+
+
 /**
  * Is the given texture referenced by any scene?
  * Note: we have to check all scenes including any scenes currently
@@ -994,6 +1278,7 @@ unsigned
 lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
                                 const struct pipe_resource *texture )
 {
+   unsigned referenced = LP_UNREFERENCED;
    unsigned i;
 
    /* check the render targets */
@@ -1005,19 +1290,27 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
       return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
-   /* check textures referenced by the scene */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
-      if (lp_scene_is_resource_referenced(setup->scenes[i], texture)) {
-         return LP_REFERENCED_FOR_READ;
-      }
-   }
-
    for (i = 0; i < ARRAY_SIZE(setup->ssbos); i++) {
       if (setup->ssbos[i].current.buffer == texture)
          return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
-   return LP_UNREFERENCED;
+   /* check resources referenced by the scene being built and by any
+    * scenes still queued for or being rasterized.  Scenes the rasterizer
+    * is done with keep their references until they are reused, but they
+    * no longer matter.
+    */
+   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
+      const struct lp_scene *scene = setup->scenes[i];
+
+      if (scene != setup->scene &&
+          (!scene->fence || lp_fence_signalled(scene->fence)))
+         continue;
+
+      referenced |= lp_scene_is_resource_referenced(scene, texture);
+   }
+
+   return referenced;
 }
 
 
@@ -1167,6 +1460,13 @@ try_update_scene_state( struct lp_setup_context *setup )
 
          if (!buffer)
             continue;
+
+         /* The shader may write to the buffer while the scene is in flight */
+         if (!lp_scene_add_resource_reference(scene, buffer, new_scene, TRUE)) {
+            assert(!new_scene);
+            return FALSE;
+         }
+
          /* resource buffer */
          current_data = (ubyte *) llvmpipe_resource_data(buffer);
          if (current_data) {
@@ -1211,7 +1511,7 @@ try_update_scene_state( struct lp_setup_context *setup )
             if (setup->fs.current_tex[i]) {
                if (!lp_scene_add_resource_reference(scene,
                                                     setup->fs.current_tex[i],
-                                                    new_scene)) {
+                                                    new_scene, FALSE)) {
                   assert(!new_scene);
                   return FALSE;
                }
@@ -1336,12 +1636,26 @@ lp_setup_destroy( struct lp_setup_context *setup )
       pipe_resource_reference(&setup->ssbos[i].current.buffer, NULL);
    }
 
-   /* free the scenes in the 'empty' queue */
+   for (i = 0; i < ARRAY_SIZE(setup->cs.current_tex); i++) {
+      pipe_resource_reference(&setup->cs.current_tex[i], NULL);
+   }
+
+   for (i = 0; i < ARRAY_SIZE(setup->cs.constants); i++) {
+      pipe_resource_reference(&setup->cs.constants[i].buffer, NULL);
+   }
+
+   for (i = 0; i < ARRAY_SIZE(setup->cs.ssbos); i++) {
+      pipe_resource_reference(&setup->cs.ssbos[i].buffer, NULL);
+   }
+
+   /* wait for the scenes still in flight, then free all of them */
    for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
       struct lp_scene *scene = setup->scenes[i];
 
-      if (scene->fence)
+      if (scene->fence) {
          lp_fence_wait(scene->fence);
+         lp_scene_reset(scene);
+      }
 
       lp_scene_destroy(scene);
    }
@@ -140,6 +140,34 @@ lp_setup_set_fragment_sampler_state(struct lp_setup_context *setup,
                                     unsigned num,
                                     struct pipe_sampler_state **samplers);
 
+void
+lp_setup_set_compute_sampler_views(struct lp_setup_context *setup,
+                                   unsigned num,
+                                   struct pipe_sampler_view **views);
+
+void
+lp_setup_set_compute_sampler_state(struct lp_setup_context *setup,
+                                   unsigned num,
+                                   struct pipe_sampler_state **samplers);
+
+void
+lp_setup_set_cs_constants(struct lp_setup_context *setup,
+                          unsigned num,
+                          struct pipe_constant_buffer *buffers);
+
+void
+lp_setup_set_cs_ssbos(struct lp_setup_context *setup,
+                      unsigned num,
+                      struct pipe_shader_buffer *buffers);
+
+boolean
+lp_setup_launch_grid(struct lp_setup_context *setup,
+                     lp_jit_cs_func jit_function,
+                     unsigned num_vectors,
+                     unsigned fiber_stack_size,
+                     const unsigned grid_size[3],
+                     unsigned shared_size);
+
 unsigned
 lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
                                 const struct pipe_resource *texture );
@@ -54,9 +54,10 @@
 struct lp_setup_variant;
 
 
-/** Max number of scenes */
-/* XXX: make multiple scenes per context work, see lp_setup_rasterize_scene */
-#define MAX_SCENES 1
+/** Max number of scenes per context.  While the rasterizer threads work
+ * on one scene the setup code can bin the next ones.
+ */
+#define MAX_SCENES 4
 
 
 
@@ -121,6 +122,7 @@ struct lp_setup_context
       union util_color color_val[PIPE_MAX_COLOR_BUFS];
       uint64_t zsmask;
       uint64_t zsvalue;               /**< lp_rast_clear_zstencil() cmd */
+      float depth;                    /**< depth clear value, for hiz */
    } clear;
 
    enum setup_state {
@@ -153,6 +155,15 @@ struct lp_setup_context
       uint8_t *stored;
    } blend_color;
 
+   /** compute shader state, copied into each lp_setup_launch_grid() scene */
+   struct {
+      struct lp_jit_context jit_context;
+      struct pipe_resource *current_tex[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+      unsigned current_tex_num;
+      struct pipe_constant_buffer constants[LP_MAX_TGSI_CONST_BUFFERS];
+      struct pipe_shader_buffer ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+   } cs;
+
 
    struct {
       const struct lp_setup_variant *variant;
@@ -206,6 +206,40 @@ lp_rast_32_tri_tab[MAX_PLANES+1] = {
 
 
 
+/**
+ * Hierarchical depth test of a primitive against a tile: returns TRUE
+ * when the primitive is behind all pixels of the tile covered by box.
+ *
+ * \param tx, ty  the tile position in tiles, not pixels
+ */
+static inline boolean
+lp_setup_hiz_cull(struct lp_setup_context *setup,
+                  const struct lp_rast_shader_inputs *inputs,
+                  const struct u_rect *box,
+                  int tx, int ty)
+{
+   const struct lp_scene *scene = setup->scene;
+   const float bound = scene->tile[tx][ty].zmax;
+   float zmin, zmax;
+
+   if (bound == FLT_MAX || !setup->fs.stored->variant->hiz_test)
+      return FALSE;
+
+   lp_rast_depth_range(inputs,
+                       MAX2(box->x0, tx * TILE_SIZE),
+                       MAX2(box->y0, ty * TILE_SIZE),
+                       MIN2(box->x1, tx * TILE_SIZE + TILE_SIZE - 1),
+                       MIN2(box->y1, ty * TILE_SIZE + TILE_SIZE - 1),
+                       &zmin, &zmax);
+
+   if (MIN2(zmin, 1.0f) > bound + scene->hiz_margin) {
+      LP_COUNT(nr_hiz_culled_64);
+      return TRUE;
+   }
+   return FALSE;
+}
+
+
 /**
  * The primitive covers the whole tile- shade whole tile.
  *
@@ -248,10 +282,24 @@ lp_setup_whole_tile(struct lp_setup_context *setup,
                                           lp_rast_arg_inputs(inputs) );
    } else {
       LP_COUNT(nr_shade_64);
-      return lp_scene_bin_cmd_with_state( scene, tx, ty,
-                                          setup->fs.stored, 
-                                          LP_RAST_OP_SHADE_TILE,
-                                          lp_rast_arg_inputs(inputs) );
+      if (!lp_scene_bin_cmd_with_state( scene, tx, ty,
+                                        setup->fs.stored,
+                                        LP_RAST_OP_SHADE_TILE,
+                                        lp_rast_arg_inputs(inputs) ))
+         return FALSE;
+
+      /* Lower the depth bound of the tile */
+      if (scene->hiz && setup->fs.stored->variant->hiz_update) {
+         struct cmd_bin *bin = lp_scene_get_bin(scene, tx, ty);
+         float zmin, zmax;
+
+         lp_rast_depth_range(inputs, tx * TILE_SIZE, ty * TILE_SIZE,
+                             tx * TILE_SIZE + TILE_SIZE - 1,
+                             ty * TILE_SIZE + TILE_SIZE - 1,
+                             &zmin, &zmax);
+         bin->zmax = MIN2(bin->zmax, MAX2(zmax, 0.0f));
+      }
+      return TRUE;
    }
 }
 
@@ -801,6 +849,9 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
       assert(iy0 == bbox->y1 / TILE_SIZE &&
 	     ix0 == bbox->x1 / TILE_SIZE);
 
+      if (lp_setup_hiz_cull(setup, &tri->inputs, bbox, ix0, iy0))
+         return TRUE;
+
       if (nr_planes == 3) {
          if (sz < 4)
          {
@@ -927,6 +978,11 @@ lp_setup_bin_triangle(struct lp_setup_context *setup,
                   break;  /* exiting triangle, all done with this row */
                LP_COUNT(nr_empty_64);
             }
+            else if (lp_setup_hiz_cull(setup, &tri->inputs, &trimmed_box,
+                                       x, y)) {
+               /* triangle is behind the tile's depth bound */
+               in = TRUE;
+            }
             else if (partial) {
                /* Not trivially accepted by at least one plane -
                 * rasterize/shade partial tile
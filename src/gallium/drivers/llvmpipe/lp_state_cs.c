@@ -0,0 +1,766 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/**
+ * @file
+ * Compute shaders.
+ *
+ * A work group is run as a sequence of SIMD vectors of invocations, each
+ * lane of a vector being one invocation.  The block size is part of the
+ * variant key, so the invocation ids of a lane are derived from constants.
+ *
+ * Grids are executed by the rasterizer threads, which share out the work
+ * groups of a grid, see lp_setup_launch_grid().  A shader which uses
+ * barriers and whose work groups span several vectors runs each vector
+ * on a fiber of its own so that all of them can reach the barrier before
+ * any goes past it.
+ */
+
+#include "pipe/p_defines.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_pointer.h"
+#include "util/simple_list.h"
+#include "util/os_time.h"
+#include "util/mesa-sha1.h"
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
+#include "nir/nir_to_tgsi_info.h"
+#include "compiler/nir/nir.h"
+#include "compiler/nir/nir_serialize.h"
+#include "compiler/blob.h"
+#include "gallivm/lp_bld_type.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_intr.h"
+#include "gallivm/lp_bld_logic.h"
+#include "gallivm/lp_bld_tgsi.h"
+#include "gallivm/lp_bld_nir.h"
+#include "gallivm/lp_bld_swizzle.h"
+#include "gallivm/lp_bld_flow.h"
+#include "gallivm/lp_bld_debug.h"
+
+#include "lp_context.h"
+#include "lp_debug.h"
+#include "lp_flush.h"
+#include "lp_limits.h"
+#include "lp_perf.h"
+#include "lp_rast.h"
+#include "lp_screen.h"
+#include "lp_setup.h"
+#include "lp_state.h"
+#include "lp_state_cs.h"
+#include "lp_tex_sample.h"
+
+
+/** counter for debugging / profiling */
+static unsigned cs_no = 0;
+
+
+/**
+ * Barrier interface for shaders running on fibers.
+ */
+struct lp_cs_barrier_iface
+{
+   struct lp_build_tgsi_cs_iface base;
+
+   LLVMValueRef barrier_data;
+};
+
+
+static void
+cs_emit_barrier(const struct lp_build_tgsi_cs_iface *cs_iface,
+                struct lp_build_context *bld)
+{
+   const struct lp_cs_barrier_iface *iface =
+      (const struct lp_cs_barrier_iface *)cs_iface;
+   struct gallivm_state *gallivm = bld->gallivm;
+   LLVMTypeRef arg_type;
+   LLVMValueRef function;
+   LLVMValueRef arg;
+
+   arg_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+
+   function = lp_build_const_func_pointer(gallivm,
+                                          func_to_pointer((func_pointer)lp_rast_cs_barrier),
+                                          LLVMVoidTypeInContext(gallivm->context),
+                                          &arg_type, 1,
+                                          "lp_rast_cs_barrier");
+
+   arg = iface->barrier_data;
+   LLVMBuildCall(gallivm->builder, function, &arg, 1, "");
+}
+
+
+static void
+generate_compute(struct lp_compute_shader *shader,
+                 struct lp_compute_shader_variant *variant)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   const struct lp_compute_shader_variant_key *key = &variant->key;
+   const unsigned num_invocations =
+      key->block_size[0] * key->block_size[1] * key->block_size[2];
+   char func_name[64];
+   struct lp_type cs_type;
+   struct lp_type uint_type;
+   struct lp_build_context uint_bld;
+   LLVMTypeRef arg_types[12];
+   LLVMTypeRef func_type;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef int8_type = LLVMInt8TypeInContext(gallivm->context);
+   LLVMValueRef function;
+   LLVMValueRef context_ptr;
+   LLVMValueRef block_id[3];
+   LLVMValueRef grid_size[3];
+   LLVMValueRef first_vector;
+   LLVMValueRef num_vectors;
+   LLVMValueRef shared_ptr;
+   LLVMValueRef barrier_data;
+   LLVMValueRef thread_data_ptr;
+   LLVMValueRef lane_offsets;
+   LLVMValueRef lanes[LP_MAX_VECTOR_LENGTH];
+   LLVMValueRef idx, tmp, mask_val;
+   LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
+   LLVMBasicBlockRef block;
+   LLVMBuilderRef builder;
+   struct lp_build_sampler_soa *sampler;
+   struct lp_bld_tgsi_system_values system_values;
+   struct lp_build_for_loop_state loop_state;
+   struct lp_build_mask_context mask;
+   struct lp_build_tgsi_params params;
+   struct lp_cs_barrier_iface barrier_iface;
+   unsigned i;
+
+   memset(&cs_type, 0, sizeof cs_type);
+   cs_type.floating = TRUE;      /* floating point values */
+   cs_type.sign = TRUE;          /* values are signed */
+   cs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
+   cs_type.width = 32;           /* 32-bit float */
+   cs_type.length = MIN2(lp_native_vector_width / 32, 16); /* n*4 elements per vector */
+
+   uint_type = lp_uint_type(cs_type);
+   lp_build_context_init(&uint_bld, gallivm, uint_type);
+
+   /*
+    * Generate the function prototype. Any change here must be reflected in
+    * lp_jit.h's lp_jit_cs_func function pointer type, and vice-versa.
+    */
+
+   snprintf(func_name, sizeof(func_name), "cs_variant");
+
+   arg_types[0] = variant->jit_context_ptr_type;       /* context */
+   arg_types[1] = int32_type;                          /* block_id_x */
+   arg_types[2] = int32_type;                          /* block_id_y */
+   arg_types[3] = int32_type;                          /* block_id_z */
+   arg_types[4] = int32_type;                          /* grid_size_x */
+   arg_types[5] = int32_type;                          /* grid_size_y */
+   arg_types[6] = int32_type;                          /* grid_size_z */
+   arg_types[7] = int32_type;                          /* first_vector */
+   arg_types[8] = int32_type;                          /* num_vectors */
+   arg_types[9] = LLVMPointerType(int8_type, 0);       /* shared */
+   arg_types[10] = LLVMPointerType(int8_type, 0);      /* barrier_data */
+   arg_types[11] = variant->jit_thread_data_ptr_type;  /* per thread data */
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                                arg_types, ARRAY_SIZE(arg_types), 0);
+
+   function = LLVMAddFunction(gallivm->module, func_name, func_type);
+   LLVMSetFunctionCallConv(function, LLVMCCallConv);
+
+   variant->function = function;
+
+   context_ptr  = LLVMGetParam(function, 0);
+   for (i = 0; i < 3; i++) {
+      block_id[i] = LLVMGetParam(function, 1 + i);
+      grid_size[i] = LLVMGetParam(function, 4 + i);
+   }
+   first_vector = LLVMGetParam(function, 7);
+   num_vectors  = LLVMGetParam(function, 8);
+   shared_ptr   = LLVMGetParam(function, 9);
+   barrier_data = LLVMGetParam(function, 10);
+   thread_data_ptr = LLVMGetParam(function, 11);
+
+   lp_build_name(context_ptr, "context");
+   lp_build_name(block_id[0], "block_id_x");
+   lp_build_name(block_id[1], "block_id_y");
+   lp_build_name(block_id[2], "block_id_z");
+   lp_build_name(grid_size[0], "grid_size_x");
+   lp_build_name(grid_size[1], "grid_size_y");
+   lp_build_name(grid_size[2], "grid_size_z");
+   lp_build_name(first_vector, "first_vector");
+   lp_build_name(num_vectors, "num_vectors");
+   lp_build_name(shared_ptr, "shared");
+   lp_build_name(barrier_data, "barrier_data");
+   lp_build_name(thread_data_ptr, "thread_data");
+
+   /*
+    * Function body
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
+   builder = gallivm->builder;
+   assert(builder);
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   /* code generated texture sampling */
+   sampler = lp_llvm_sampler_soa_create(key->state);
+
+   memset(&system_values, 0, sizeof system_values);
+   for (i = 0; i < 3; i++) {
+      system_values.block_id[i] = block_id[i];
+      system_values.grid_size[i] = grid_size[i];
+      system_values.block_size[i] =
+         lp_build_const_int32(gallivm, key->block_size[i]);
+   }
+
+   for (i = 0; i < cs_type.length; i++)
+      lanes[i] = lp_build_const_int32(gallivm, i);
+   lane_offsets = LLVMConstVector(lanes, cs_type.length);
+
+   memset(&barrier_iface, 0, sizeof barrier_iface);
+   barrier_iface.base.emit_barrier = cs_emit_barrier;
+   barrier_iface.barrier_data = barrier_data;
+
+   lp_build_for_loop_begin(&loop_state, gallivm,
+                           first_vector,
+                           LLVMIntULT,
+                           LLVMBuildAdd(builder, first_vector, num_vectors, ""),
+                           lp_build_const_int32(gallivm, 1));
+
+   /* index of each lane's invocation within the work group */
+   tmp = LLVMBuildMul(builder, loop_state.counter,
+                      lp_build_const_int32(gallivm, cs_type.length), "");
+   idx = LLVMBuildAdd(builder, lp_build_broadcast_scalar(&uint_bld, tmp),
+                      lane_offsets, "invocation");
+
+   tmp = lp_build_const_int_vec(gallivm, uint_type, key->block_size[0]);
+   system_values.thread_id[0] = LLVMBuildURem(builder, idx, tmp, "");
+   idx = LLVMBuildUDiv(builder, idx, tmp, "");
+   tmp = lp_build_const_int_vec(gallivm, uint_type, key->block_size[1]);
+   system_values.thread_id[1] = LLVMBuildURem(builder, idx, tmp, "");
+   system_values.thread_id[2] = LLVMBuildUDiv(builder, idx, tmp, "");
+
+   /* the last vector of a group may be partially filled */
+   if (num_invocations % cs_type.length) {
+      mask_val = lp_build_cmp(&uint_bld, PIPE_FUNC_LESS,
+                              system_values.thread_id[2],
+                              lp_build_const_int_vec(gallivm, uint_type,
+                                                     key->block_size[2]));
+   }
+   else {
+      mask_val = lp_build_const_int_vec(gallivm, uint_type, ~0);
+   }
+
+   lp_build_mask_begin(&mask, gallivm, cs_type, mask_val);
+
+   memset(outputs, 0, sizeof outputs);
+   memset(&params, 0, sizeof(params));
+
+   params.type = cs_type;
+   params.mask = &mask;
+   params.consts_ptr = lp_jit_context_constants(gallivm, context_ptr);
+   params.const_sizes_ptr = lp_jit_context_num_constants(gallivm, context_ptr);
+   params.system_values = &system_values;
+   params.context_ptr = context_ptr;
+   params.thread_data_ptr = thread_data_ptr;
+   params.sampler = sampler;
+   params.info = &shader->info.base;
+   params.ssbo_ptr = lp_jit_context_ssbos(gallivm, context_ptr);
+   params.ssbo_sizes_ptr = lp_jit_context_num_ssbos(gallivm, context_ptr);
+   params.shared_ptr = LLVMBuildBitCast(builder, shared_ptr,
+                                        LLVMPointerType(int32_type, 0), "");
+   params.shared_size = shader->base.req_local_mem;
+   if (variant->use_fibers)
+      params.cs_iface = &barrier_iface.base;
+
+   /* Build the actual shader */
+   if (shader->base.ir_type == PIPE_SHADER_IR_NIR)
+      lp_build_nir_soa(gallivm, (struct nir_shader *)shader->base.prog,
+                       &params, outputs);
+   else
+      lp_build_tgsi_soa(gallivm, shader->base.prog, &params, outputs);
+
+   lp_build_mask_end(&mask);
+
+   lp_build_for_loop_end(&loop_state);
+
+   sampler->destroy(sampler);
+
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, function);
+}
+
+
+static void
+lp_cs_get_ir_cache_key(const struct lp_compute_shader *shader,
+                       const struct lp_compute_shader_variant_key *key,
+                       unsigned char ir_sha1_cache_key[20])
+{
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, "cs", 2);
+   if (shader->base.ir_type == PIPE_SHADER_IR_NIR) {
+      struct blob blob;
+
+      blob_init(&blob);
+      nir_serialize(&blob, shader->base.prog);
+      _mesa_sha1_update(&ctx, blob.data, blob.size);
+      blob_finish(&blob);
+   } else {
+      _mesa_sha1_update(&ctx, shader->base.prog,
+                        tgsi_num_tokens(shader->base.prog) *
+                        sizeof(struct tgsi_token));
+   }
+   /* The shared memory bounds checks depend on it */
+   _mesa_sha1_update(&ctx, &shader->base.req_local_mem,
+                     sizeof(shader->base.req_local_mem));
+   _mesa_sha1_update(&ctx, key, shader->variant_key_size);
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
+/**
+ * Stack size for the fibers running the function: besides the few KiB the
+ * JIT code needs for spills and calls, the temporaries it allocas, which
+ * can be big arrays for shaders indexing them indirectly.
+ */
+static unsigned
+cs_fiber_stack_size(struct gallivm_state *gallivm, LLVMValueRef function)
+{
+   uint64_t size = 0;
+   LLVMBasicBlockRef block;
+   LLVMValueRef inst;
+
+   for (block = LLVMGetFirstBasicBlock(function); block;
+        block = LLVMGetNextBasicBlock(block)) {
+      for (inst = LLVMGetFirstInstruction(block); inst;
+           inst = LLVMGetNextInstruction(inst)) {
+         LLVMValueRef count;
+         LLVMTypeRef type;
+
+         if (!LLVMIsAAllocaInst(inst))
+            continue;
+
+         type = LLVMGetElementType(LLVMTypeOf(inst));
+         count = LLVMGetOperand(inst, 0);
+         size += LLVMABISizeOfType(gallivm->target, type) *
+                 (LLVMIsAConstantInt(count) ?
+                  LLVMConstIntGetZExtValue(count) : 1);
+      }
+   }
+
+   size = align64(size, 4096) + LP_CS_FIBER_STACK_SIZE;
+   return (unsigned)MIN2(size, 64 * 1024 * 1024);
+}
+
+
+static struct lp_compute_shader_variant *
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 const struct lp_compute_shader_variant_key *key)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct lp_compute_shader_variant *variant;
+   const unsigned num_invocations =
+      key->block_size[0] * key->block_size[1] * key->block_size[2];
+   const unsigned vector_length = MIN2(lp_native_vector_width / 32, 16);
+   char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   boolean needs_caching;
+
+   variant = CALLOC_STRUCT(lp_compute_shader_variant);
+   if (!variant)
+      return NULL;
+
+   memcpy(&variant->key, key, shader->variant_key_size);
+   variant->shader = shader;
+   variant->list_item_local.base = variant;
+   variant->no = shader->variants_created++;
+
+   variant->num_vectors = DIV_ROUND_UP(num_invocations, vector_length);
+   variant->use_fibers =
+      shader->info.base.opcode_count[TGSI_OPCODE_BARRIER] > 0 &&
+      variant->num_vectors > 1;
+
+   snprintf(module_name, sizeof(module_name), "cs%u_variant%u",
+            shader->no, variant->no);
+
+   /* Code calling back into lp_rast_cs_barrier() has its address baked in,
+    * which marks it dont_cache, so such variants are never found here.
+    */
+   lp_cs_get_ir_cache_key(shader, key, ir_sha1_cache_key);
+   lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+   needs_caching = !cached.data_size;
+
+   variant->gallivm = gallivm_create(module_name, lp->context, &cached);
+   if (!variant->gallivm) {
+      free(cached.data);
+      FREE(variant);
+      return NULL;
+   }
+
+   lp_jit_init_cs_types(variant);
+
+   generate_compute(shader, variant);
+
+   if (variant->use_fibers)
+      variant->fiber_stack_size =
+         cs_fiber_stack_size(variant->gallivm, variant->function);
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   variant->jit_function = (lp_jit_cs_func)
+      gallivm_jit_function(variant->gallivm, variant->function);
+
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+
+   gallivm_free_ir(variant->gallivm);
+
+   free(cached.data);
+
+   return variant;
+}
+
+
+static void
+llvmpipe_remove_cs_variant(struct lp_compute_shader_variant *variant)
+{
+   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
+      debug_printf("llvmpipe: del cs #%u var %u v created %u v cached %u "
+                   "inst %u\n",
+                   variant->shader->no, variant->no,
+                   variant->shader->variants_created,
+                   variant->shader->variants_cached,
+                   variant->nr_instrs);
+   }
+
+   gallivm_destroy(variant->gallivm);
+
+   remove_from_list(&variant->list_item_local);
+   variant->shader->variants_cached--;
+
+   FREE(variant);
+}
+
+
+static void
+make_variant_key(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 const unsigned block_size[3],
+                 struct lp_compute_shader_variant_key *key)
+{
+   unsigned i;
+
+   memset(key, 0, shader->variant_key_size);
+
+   key->block_size[0] = block_size[0];
+   key->block_size[1] = block_size[1];
+   key->block_size[2] = block_size[2];
+
+   key->nr_samplers = shader->info.base.file_max[TGSI_FILE_SAMPLER] + 1;
+
+   for (i = 0; i < key->nr_samplers; ++i) {
+      if (shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+         lp_sampler_static_sampler_state(&key->state[i].sampler_state,
+                                         lp->samplers[PIPE_SHADER_COMPUTE][i]);
+      }
+   }
+
+   /* See the fragment shader counterpart about mixing sampler opcodes. */
+   if (shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] != -1) {
+      key->nr_sampler_views = shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
+            llvmpipe_sampler_static_texture_state(&key->state[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+   else {
+      key->nr_sampler_views = key->nr_samplers;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+            llvmpipe_sampler_static_texture_state(&key->state[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+}
+
+
+/**
+ * Find or build the variant of the bound compute shader for the current
+ * state.
+ */
+static struct lp_compute_shader_variant *
+llvmpipe_update_cs(struct llvmpipe_context *lp,
+                   const unsigned block_size[3])
+{
+   struct lp_compute_shader *shader = lp->cs;
+   struct lp_compute_shader_variant_key key;
+   struct lp_compute_shader_variant *variant = NULL;
+   struct lp_cs_variant_list_item *li;
+   int64_t t0, t1;
+
+   make_variant_key(lp, shader, block_size, &key);
+
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      if (memcmp(&li->base->key, &key, shader->variant_key_size) == 0) {
+         variant = li->base;
+         break;
+      }
+      li = next_elem(li);
+   }
+
+   if (variant) {
+      move_to_head(&shader->variants, &variant->list_item_local);
+      return variant;
+   }
+
+   if (shader->variants_cached >= LP_MAX_CS_VARIANTS) {
+      /* The grids still queued may be using the variant. */
+      llvmpipe_finish(&lp->pipe, __FUNCTION__);
+      llvmpipe_remove_cs_variant(last_elem(&shader->variants)->base);
+   }
+
+   t0 = os_time_get();
+   variant = generate_variant(lp, shader, &key);
+   t1 = os_time_get();
+   LP_COUNT_ADD(llvm_compile_time, t1 - t0);
+   LP_COUNT_ADD(nr_llvm_compiles, 1);
+
+   if (variant) {
+      insert_at_head(&shader->variants, &variant->list_item_local);
+      shader->variants_cached++;
+   }
+
+   return variant;
+}
+
+
+static void *
+llvmpipe_create_compute_state(struct pipe_context *pipe,
+                              const struct pipe_compute_state *templ)
+{
+   struct lp_compute_shader *shader;
+   int nr_samplers;
+   int nr_sampler_views;
+
+   assert(templ->ir_type == PIPE_SHADER_IR_TGSI ||
+          templ->ir_type == PIPE_SHADER_IR_NIR);
+
+   shader = CALLOC_STRUCT(lp_compute_shader);
+   if (!shader)
+      return NULL;
+
+   shader->no = cs_no++;
+   make_empty_list(&shader->variants);
+
+   shader->base = *templ;
+
+   if (templ->ir_type == PIPE_SHADER_IR_NIR) {
+      /* we take ownership of the NIR */
+      struct nir_shader *nir = (struct nir_shader *)templ->prog;
+
+      lp_build_opt_nir(nir);
+      nir_tgsi_scan_shader(nir, &shader->info.base, true);
+   } else {
+      /* we need to keep a local copy of the tokens */
+      shader->base.prog = tgsi_dup_tokens(templ->prog);
+      if (!shader->base.prog) {
+         FREE(shader);
+         return NULL;
+      }
+
+      /* get/save the summary info for this shader */
+      lp_build_tgsi_info(shader->base.prog, &shader->info);
+   }
+
+   nr_samplers = shader->info.base.file_max[TGSI_FILE_SAMPLER] + 1;
+   nr_sampler_views = shader->info.base.file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
+
+   shader->variant_key_size = Offset(struct lp_compute_shader_variant_key,
+                                     state[MAX2(nr_samplers, nr_sampler_views)]);
+
+   if (LP_DEBUG & DEBUG_TGSI) {
+      debug_printf("llvmpipe: Create compute shader #%u %p:\n",
+                   shader->no, (void *) shader);
+      if (shader->base.ir_type == PIPE_SHADER_IR_NIR)
+         nir_print_shader((struct nir_shader *)shader->base.prog, stderr);
+      else
+         tgsi_dump(shader->base.prog, 0);
+   }
+
+   return shader;
+}
+
+
+static void
+llvmpipe_bind_compute_state(struct pipe_context *pipe, void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+
+   llvmpipe->cs = (struct lp_compute_shader *) cs;
+}
+
+
+static void
+llvmpipe_delete_compute_state(struct pipe_context *pipe, void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct lp_compute_shader *shader = cs;
+   struct lp_cs_variant_list_item *li;
+
+   assert(cs != llvmpipe->cs);
+
+   /* Grids using the shader may still be queued. */
+   llvmpipe_finish(pipe, __FUNCTION__);
+
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      struct lp_cs_variant_list_item *next = next_elem(li);
+      llvmpipe_remove_cs_variant(li->base);
+      li = next;
+   }
+
+   assert(shader->variants_cached == 0);
+   if (shader->base.ir_type == PIPE_SHADER_IR_NIR)
+      ralloc_free((void *) shader->base.prog);
+   else
+      FREE((void *) shader->base.prog);
+   FREE(shader);
+}
+
+
+/**
+ * Get the grid size, which may come from a buffer.
+ */
+static void
+fill_grid_size(struct pipe_context *pipe,
+               const struct pipe_grid_info *info,
+               unsigned grid_size[3])
+{
+   struct pipe_transfer *transfer;
+   uint32_t *params;
+
+   if (!info->indirect) {
+      grid_size[0] = info->grid[0];
+      grid_size[1] = info->grid[1];
+      grid_size[2] = info->grid[2];
+      return;
+   }
+
+   params = pipe_buffer_map_range(pipe, info->indirect,
+                                  info->indirect_offset,
+                                  3 * sizeof(uint32_t),
+                                  PIPE_TRANSFER_READ,
+                                  &transfer);
+   if (!params) {
+      grid_size[0] = grid_size[1] = grid_size[2] = 0;
+      return;
+   }
+
+   grid_size[0] = params[0];
+   grid_size[1] = params[1];
+   grid_size[2] = params[2];
+   pipe_buffer_unmap(pipe, transfer);
+}
+
+
+static void
+llvmpipe_launch_grid(struct pipe_context *pipe,
+                     const struct pipe_grid_info *info)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct lp_compute_shader *shader = llvmpipe->cs;
+   struct lp_compute_shader_variant *variant;
+   unsigned grid_size[3];
+
+   if (!shader)
+      return;
+
+   fill_grid_size(pipe, info, grid_size);
+   if (!grid_size[0] || !grid_size[1] || !grid_size[2])
+      return;
+
+   /* See llvmpipe_update_derived() */
+   if (screen->tiled_textures)
+      mtx_lock(&screen->tile_mutex);
+
+   variant = llvmpipe_update_cs(llvmpipe, info->block);
+   if (!variant) {
+      if (screen->tiled_textures)
+         mtx_unlock(&screen->tile_mutex);
+      return;
+   }
+
+   lp_setup_set_cs_constants(llvmpipe->setup,
+                             ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_COMPUTE]),
+                             llvmpipe->constants[PIPE_SHADER_COMPUTE]);
+   lp_setup_set_cs_ssbos(llvmpipe->setup,
+                         ARRAY_SIZE(llvmpipe->ssbos[PIPE_SHADER_COMPUTE]),
+                         llvmpipe->ssbos[PIPE_SHADER_COMPUTE]);
+   lp_setup_set_compute_sampler_views(llvmpipe->setup,
+                                      llvmpipe->num_sampler_views[PIPE_SHADER_COMPUTE],
+                                      llvmpipe->sampler_views[PIPE_SHADER_COMPUTE]);
+
+   if (screen->tiled_textures)
+      mtx_unlock(&screen->tile_mutex);
+
+   lp_setup_set_compute_sampler_state(llvmpipe->setup,
+                                      llvmpipe->num_samplers[PIPE_SHADER_COMPUTE],
+                                      llvmpipe->samplers[PIPE_SHADER_COMPUTE]);
+
+   if (!lp_setup_launch_grid(llvmpipe->setup,
+                             variant->jit_function,
+                             variant->num_vectors,
+                             variant->use_fibers ?
+                                variant->fiber_stack_size : 0,
+                             grid_size,
+                             shader->base.req_local_mem)) {
+      debug_printf("llvmpipe: failed to queue compute grid\n");
+   }
+}
+
+
+void
+llvmpipe_init_compute_funcs(struct llvmpipe_context *llvmpipe)
+{
+   llvmpipe->pipe.create_compute_state = llvmpipe_create_compute_state;
+   llvmpipe->pipe.bind_compute_state = llvmpipe_bind_compute_state;
+   llvmpipe->pipe.delete_compute_state = llvmpipe_delete_compute_state;
+   llvmpipe->pipe.launch_grid = llvmpipe_launch_grid;
+}
@@ -0,0 +1,116 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+
+#ifndef LP_STATE_CS_H_
+#define LP_STATE_CS_H_
+
+
+#include "pipe/p_compiler.h"
+#include "pipe/p_state.h"
+#include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
+#include "lp_jit.h"
+#include "lp_state_fs.h" /* for struct lp_sampler_static_state */
+
+
+struct lp_compute_shader;
+
+
+struct lp_compute_shader_variant_key
+{
+   /* The work group size is baked into the code */
+   unsigned block_size[3];
+
+   unsigned nr_samplers:8;
+   unsigned nr_sampler_views:8;
+
+   struct lp_sampler_static_state state[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+};
+
+
+/** doubly-linked list item */
+struct lp_cs_variant_list_item
+{
+   struct lp_compute_shader_variant *base;
+   struct lp_cs_variant_list_item *next, *prev;
+};
+
+
+struct lp_compute_shader_variant
+{
+   struct lp_compute_shader_variant_key key;
+
+   struct gallivm_state *gallivm;
+
+   LLVMTypeRef jit_context_ptr_type;
+   LLVMTypeRef jit_thread_data_ptr_type;
+
+   LLVMValueRef function;
+
+   lp_jit_cs_func jit_function;
+
+   /* Number of SIMD vectors a work group is made of */
+   unsigned num_vectors;
+
+   /*
+    * The shader synchronizes the invocations of a work group which don't
+    * fit in a single vector, so each vector must run on a fiber of its own.
+    */
+   boolean use_fibers;
+
+   /* Stack size for those fibers, which must fit the shader's temporaries */
+   unsigned fiber_stack_size;
+
+   /* Total number of LLVM instructions generated */
+   unsigned nr_instrs;
+
+   struct lp_cs_variant_list_item list_item_local;
+   struct lp_compute_shader *shader;
+
+   /* For debugging/profiling purposes */
+   unsigned no;
+};
+
+
+/** Subclass of pipe_compute_state */
+struct lp_compute_shader
+{
+   struct pipe_compute_state base;
+
+   struct lp_tgsi_info info;
+
+   struct lp_cs_variant_list_item variants;
+
+   /* For debugging/profiling purposes */
+   unsigned variant_key_size;
+   unsigned no;
+   unsigned variants_created;
+   unsigned variants_cached;
+};
+
+
+#endif /* LP_STATE_CS_H_ */
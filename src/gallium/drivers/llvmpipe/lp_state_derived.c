@@ -184,6 +184,12 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
 {
    struct llvmpipe_screen *lp_screen = llvmpipe_screen(llvmpipe->pipe.screen);
 
+   /* Textures may not be untiled from the fragment shader variant key being
+    * made until their addresses are set up, see llvmpipe_resource_untile().
+    */
+   if (lp_screen->tiled_textures)
+      mtx_lock(&lp_screen->tile_mutex);
+
    /* Check for updated textures.
     */
    if (llvmpipe->tex_timestamp != lp_screen->timestamp) {
@@ -265,6 +271,9 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
                                           llvmpipe->num_sampler_views[PIPE_SHADER_FRAGMENT],
                                           llvmpipe->sampler_views[PIPE_SHADER_FRAGMENT]);
 
+   if (lp_screen->tiled_textures)
+      mtx_unlock(&lp_screen->tile_mutex);
+
    if (llvmpipe->dirty & (LP_NEW_SAMPLER))
       lp_setup_set_fragment_sampler_state(llvmpipe->setup,
                                           llvmpipe->num_samplers[PIPE_SHADER_FRAGMENT],
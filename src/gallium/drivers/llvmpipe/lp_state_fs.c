@@ -60,6 +60,7 @@
 #include <limits.h>
 #include "pipe/p_defines.h"
 #include "util/u_inlines.h"
+#include "util/u_atomic.h"
 #include "util/u_memory.h"
 #include "util/u_pointer.h"
 #include "util/u_format.h"
@@ -68,11 +69,16 @@
 #include "util/simple_list.h"
 #include "util/u_dual_blend.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
 #include "tgsi/tgsi_dump.h"
 #include "tgsi/tgsi_scan.h"
 #include "tgsi/tgsi_parse.h"
+#include "nir/nir_to_tgsi_info.h"
+#include "compiler/nir/nir.h"
+#include "compiler/nir/nir_serialize.h"
+#include "compiler/blob.h"
 #include "gallivm/lp_bld_type.h"
 #include "gallivm/lp_bld_const.h"
 #include "gallivm/lp_bld_conv.h"
@@ -80,6 +86,7 @@
 #include "gallivm/lp_bld_intr.h"
 #include "gallivm/lp_bld_logic.h"
 #include "gallivm/lp_bld_tgsi.h"
+#include "gallivm/lp_bld_nir.h"
 #include "gallivm/lp_bld_swizzle.h"
 #include "gallivm/lp_bld_flow.h"
 #include "gallivm/lp_bld_debug.h"
@@ -95,6 +102,7 @@
 #include "lp_bld_interp.h"
 #include "lp_context.h"
 #include "lp_debug.h"
+#include "lp_screen.h"
 #include "lp_perf.h"
 #include "lp_setup.h"
 #include "lp_state.h"
@@ -308,7 +316,6 @@ generate_fs_loop(struct gallivm_state *gallivm,
                  LLVMValueRef thread_data_ptr)
 {
    const struct util_format_description *zs_format_desc = NULL;
-   const struct tgsi_token *tokens = shader->base.tokens;
    struct lp_type int_type = lp_int_type(type);
    LLVMTypeRef vec_type, int_vec_type;
    LLVMValueRef mask_ptr, mask_val;
@@ -495,8 +502,12 @@ generate_fs_loop(struct gallivm_state *gallivm,
    params.ssbo_sizes_ptr = num_ssbo_ptr;
 
    /* Build the actual shader */
-   lp_build_tgsi_soa(gallivm, tokens, &params,
-                     outputs);
+   if (shader->base.type == PIPE_SHADER_IR_NIR)
+      lp_build_nir_soa(gallivm, shader->base.ir.nir, &params,
+                       outputs);
+   else
+      lp_build_tgsi_soa(gallivm, shader->base.tokens, &params,
+                        outputs);
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -667,7 +678,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
  * However in memory pixels are stored in rows
  *  e.g. (0, 0), (1, 0), (2, 0), (3, 0) ; (0, 1) ...
  *
- * @param type            fragment shader type (4x or 8x float)
+ * @param type            fragment shader type (4x, 8x or 16x float)
  * @param num_fs          number of fs_src
  * @param is_1d           whether we're outputting to a 1d resource
  * @param dst_channels    number of output channels
@@ -685,6 +696,7 @@ generate_fs_twiddle(struct gallivm_state *gallivm,
                     LLVMValueRef* dst,
                     bool pad_inline)
 {
+   LLVMBuilderRef builder = gallivm->builder;
    LLVMValueRef src[16];
 
    bool swizzle_pad;
@@ -695,19 +707,43 @@ generate_fs_twiddle(struct gallivm_state *gallivm,
    unsigned reorder_group;
    unsigned src_channels;
    unsigned src_count;
-   unsigned i;
+   unsigned i, j;
 
    src_channels = dst_channels < 3 ? dst_channels : 4;
    src_count = num_fs * src_channels;
 
-   assert(pixels == 2 || pixels == 1);
+   assert(pixels == 4 || pixels == 2 || pixels == 1);
    assert(num_fs * src_channels <= ARRAY_SIZE(src));
 
    /*
     * Transpose from SoA -> AoS
     */
-   for (i = 0; i < num_fs; ++i) {
-      lp_build_transpose_aos_n(gallivm, type, &fs_src[i][0], src_channels, &src[i * src_channels]);
+   if (pixels == 4 && src_channels == 2) {
+      /*
+       * A 16 wide interleave doesn't stay within 128 bit lanes, so instead
+       * gather each row of the 4x4 block from the 2x2 quads directly.
+       */
+      assert(num_fs == 1);
+
+      for (i = 0; i < 4; ++i) {
+         LLVMValueRef shuffles[8];
+
+         for (j = 0; j < 4; ++j) {
+            unsigned idx = (i / 2) * 8 + (j / 2) * 4 + (i % 2) * 2 + j % 2;
+            shuffles[j * 2 + 0] = lp_build_const_int32(gallivm, idx);
+            shuffles[j * 2 + 1] = lp_build_const_int32(gallivm, idx + 16);
+         }
+
+         src[i] = LLVMBuildShuffleVector(builder, fs_src[0][0], fs_src[0][1],
+                                         LLVMConstVector(shuffles, 8), "");
+      }
+
+      src_count = 4;
+      type.length = 8;
+   } else {
+      for (i = 0; i < num_fs; ++i) {
+         lp_build_transpose_aos_n(gallivm, type, &fs_src[i][0], src_channels, &src[i * src_channels]);
+      }
    }
 
    /*
@@ -721,7 +757,7 @@ generate_fs_twiddle(struct gallivm_state *gallivm,
    if (dst_channels == 1) {
       twiddle = true;
 
-      if (pixels == 2) {
+      if (pixels > 1) {
          split = true;
       }
    } else if (dst_channels == 2) {
@@ -741,15 +777,17 @@ generate_fs_twiddle(struct gallivm_state *gallivm,
    }
 
    /*
-    * Split the src in half
+    * Split the src into quads
     */
    if (split) {
       for (i = num_fs; i > 0; --i) {
-         src[(i - 1)*2 + 1] = lp_build_extract_range(gallivm, src[i - 1], 4, 4);
-         src[(i - 1)*2 + 0] = lp_build_extract_range(gallivm, src[i - 1], 0, 4);
+         for (j = pixels; j > 0; --j) {
+            src[(i - 1)*pixels + j - 1] =
+               lp_build_extract_range(gallivm, src[i - 1], (j - 1) * 4, 4);
+         }
       }
 
-      src_count *= 2;
+      src_count *= pixels;
       type.length = 4;
    }
 
@@ -770,6 +808,33 @@ generate_fs_twiddle(struct gallivm_state *gallivm,
          unsigned j = block + (reorder_sw[group % 4] * reorder_group) + (i % reorder_group);
          dst[i] = src[j];
       }
+   } else if (twiddle && type.length == 16) {
+      /*
+       * After the transpose src[n] holds pixel n of each of the four quads,
+       * one quad per 128 bit lane.  Interleaving lanes of (src[0], src[1])
+       * gives rows 0 and 2, (src[2], src[3]) rows 1 and 3.
+       */
+      for (i = 0; i < src_count; i += 4) {
+         for (j = 0; j < 4; ++j) {
+            LLVMValueRef shuffles[16];
+            unsigned hi = j / 2;
+            unsigned k;
+
+            for (k = 0; k < 16; ++k) {
+               unsigned lane = k / 4;
+               shuffles[k] = lp_build_const_int32(gallivm,
+                                                  (lane % 2) * 16 +
+                                                  (lane / 2 + hi * 2) * 4 +
+                                                  k % 4);
+            }
+
+            dst[i + j] = LLVMBuildShuffleVector(builder,
+                                                src[i + (j % 2) * 2],
+                                                src[i + (j % 2) * 2 + 1],
+                                                LLVMConstVector(shuffles, 16),
+                                                "");
+         }
+      }
    } else if (twiddle) {
       /* Twiddle pixels across elements of array */
       /*
@@ -1312,7 +1377,7 @@ convert_to_blend_type(struct gallivm_state *gallivm,
          /* expand 4x16bit values to 4x32bit */
          struct lp_type type32x4 = src_type;
          LLVMTypeRef ltype32x4;
-         unsigned num_fetch = dst_type.length == 8 ? num_srcs / 2 : num_srcs / 4;
+         unsigned num_fetch = num_srcs * dst_type.length / 16;
          type32x4.width = 32;
          ltype32x4 = lp_build_vec_type(gallivm, type32x4);
          for (i = 0; i < num_fetch; i++) {
@@ -1342,6 +1407,20 @@ convert_to_blend_type(struct gallivm_state *gallivm,
             tmps = LLVMBuildShuffleVector(builder, tmps, tmps,
                                           LLVMConstVector(shuffles, 8), "");
          }
+         else if (dst_type.length == 16) {
+            LLVMValueRef shuffles[16];
+            unsigned j;
+            /*
+             * all four rows in one vector, transposed so the aos transpose
+             * below yields one row per vector.
+             */
+            tmps = lp_build_concat(gallivm, tmpsrc, src_type, 4);
+            for (j = 0; j < 16; j++) {
+               shuffles[j] = lp_build_const_int32(gallivm, (j % 4) * 4 + j / 4);
+            }
+            tmps = LLVMBuildShuffleVector(builder, tmps, tmps,
+                                          LLVMConstVector(shuffles, 16), "");
+         }
          if (src_fmt->format == PIPE_FORMAT_R11G11B10_FLOAT) {
             lp_build_r11g11b10_to_float(gallivm, tmps, tmpsoa);
          }
@@ -1504,6 +1583,22 @@ convert_from_blend_type(struct gallivm_state *gallivm,
             src[i * 2] = lp_build_extract_range(gallivm, tmpaos, 0, 4);
             src[i * 2 + 1] = lp_build_extract_range(gallivm, tmpaos, 4, 4);
          }
+         else if (src_type.length == 16) {
+            LLVMValueRef tmpaos, shuffles[16];
+            unsigned j;
+            /*
+             * the transpose has given us the pixels in column order, put
+             * them back in rows and split the rows.
+             */
+            for (j = 0; j < 16; j++) {
+               shuffles[j] = lp_build_const_int32(gallivm, (j % 4) * 4 + j / 4);
+            }
+            tmpaos = LLVMBuildShuffleVector(builder, tmpdst, tmpdst,
+                                            LLVMConstVector(shuffles, 16), "");
+            for (j = 0; j < 4; j++) {
+               src[i * 4 + j] = lp_build_extract_range(gallivm, tmpaos, j * 4, 4);
+            }
+         }
          else {
             src[i] = tmpdst;
          }
@@ -1512,7 +1607,7 @@ convert_from_blend_type(struct gallivm_state *gallivm,
          struct lp_type type16x8 = dst_type;
          struct lp_type type32x4 = dst_type;
          LLVMTypeRef ltype16x4, ltypei64, ltypei128;
-         unsigned num_fetch = src_type.length == 8 ? num_srcs / 2 : num_srcs / 4;
+         unsigned num_fetch = num_srcs * src_type.length / 16;
          type16x8.length = 8;
          type32x4.width = 32;
          ltypei128 = LLVMIntTypeInContext(gallivm->context, 128);
@@ -1550,7 +1645,8 @@ convert_from_blend_type(struct gallivm_state *gallivm,
 
    /* Remove any padding */
    if (!is_arith && (src_type.length % mem_type.length)) {
-      src_type.length -= (src_type.length % mem_type.length);
+      /* the padding is one element per pixel, all at the end */
+      src_type.length = src_type.length / 4 * mem_type.length;
 
       for (i = 0; i < num_srcs; ++i) {
          dst[i] = lp_build_extract_range(gallivm, dst[i], 0, src_type.length);
@@ -1774,7 +1870,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    unsigned dst_channels;
    unsigned dst_count;
    unsigned src_count;
-   unsigned i, j;
+   unsigned i, j, k;
 
    const struct util_format_description* out_format_desc = util_format_description(out_format);
 
@@ -1787,7 +1883,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
 
    const boolean is_1d = variant->key.resource_1d;
    boolean twiddle_after_convert = FALSE;
-   unsigned num_fullblock_fs = is_1d ? 2 * num_fs : num_fs;
+   unsigned num_fullblock_fs = block_size / fs_type.length;
    LLVMValueRef fpstate = 0;
 
    /* Get type from output format */
@@ -1937,15 +2033,17 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
       }
 
       /* We split the row_mask and row_alpha as we want 128bit interleave */
-      if (fs_type.length == 8) {
-         src_mask[i*2 + 0]  = lp_build_extract_range(gallivm, fs_mask[i],
-                                                     0, src_channels);
-         src_mask[i*2 + 1]  = lp_build_extract_range(gallivm, fs_mask[i],
-                                                     src_channels, src_channels);
-
-         src_alpha[i*2 + 0] = lp_build_extract_range(gallivm, alpha, 0, src_channels);
-         src_alpha[i*2 + 1] = lp_build_extract_range(gallivm, alpha,
-                                                     src_channels, src_channels);
+      if (fs_type.length > 4) {
+         unsigned num_quads = fs_type.length / 4;
+
+         for (k = 0; k < num_quads; ++k) {
+            src_mask[i*num_quads + k]  = lp_build_extract_range(gallivm, fs_mask[i],
+                                                                k * src_channels,
+                                                                src_channels);
+            src_alpha[i*num_quads + k] = lp_build_extract_range(gallivm, alpha,
+                                                                k * src_channels,
+                                                                src_channels);
+         }
       } else {
          src_mask[i] = fs_mask[i];
          src_alpha[i] = alpha;
@@ -1974,10 +2072,14 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
          if (dst_channels == 3 && !has_alpha) {
             fs_src1[i][3] = alpha;
          }
-         if (fs_type.length == 8) {
-            src1_alpha[i*2 + 0] = lp_build_extract_range(gallivm, alpha, 0, src_channels);
-            src1_alpha[i*2 + 1] = lp_build_extract_range(gallivm, alpha,
-                                                         src_channels, src_channels);
+         if (fs_type.length > 4) {
+            unsigned num_quads = fs_type.length / 4;
+
+            for (k = 0; k < num_quads; ++k) {
+               src1_alpha[i*num_quads + k] = lp_build_extract_range(gallivm, alpha,
+                                                                    k * src_channels,
+                                                                    src_channels);
+            }
          } else {
             src1_alpha[i] = alpha;
          }
@@ -2029,9 +2131,10 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
    } else {
       src_count = num_fullblock_fs * dst_channels;
       /*
-       * We reorder things a bit here, so the cases for 4-wide and 8-wide
-       * (AVX) turn out the same later when untwiddling/transpose (albeit
-       * for true AVX2 path untwiddle needs to be different).
+       * We reorder things a bit here, so the cases for 4-wide, 8-wide
+       * (AVX) and 16-wide (AVX-512) turn out the same later when
+       * untwiddling/transpose (albeit for true AVX2 path untwiddle needs
+       * to be different).
        * For now just order by colors first (so we can use unpack later).
        */
       for (j = 0; j < num_fullblock_fs; j++) {
@@ -2082,7 +2185,7 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
       src_count /= combined;
 
       bits = row_type.width * row_type.length;
-      assert(bits == 128 || bits == 256);
+      assert(bits == 128 || bits == 256 || bits == 512);
    }
 
    if (twiddle_after_convert) {
@@ -2503,8 +2606,8 @@ generate_fragment(struct llvmpipe_context *lp,
 
    blend_vec_type = lp_build_vec_type(gallivm, blend_type);
 
-   snprintf(func_name, sizeof(func_name), "fs%u_variant%u_%s",
-            shader->no, variant->no, partial_mask ? "partial" : "whole");
+   snprintf(func_name, sizeof(func_name), "fs_variant_%s",
+            partial_mask ? "partial" : "whole");
 
    arg_types[0] = variant->jit_context_ptr_type;       /* context */
    arg_types[1] = int32_type;                          /* x */
@@ -2595,7 +2698,7 @@ generate_fragment(struct llvmpipe_context *lp,
 
    num_fs = 16 / fs_type.length; /* number of loops per 4x4 stamp */
    /* for 1d resources only run "upper half" of stamp */
-   if (key->resource_1d)
+   if (key->resource_1d && num_fs > 1)
       num_fs /= 2;
 
    {
@@ -2808,6 +2911,8 @@ dump_fs_variant_key(const struct lp_fragment_shader_variant_key *key)
                    texture->pot_width,
                    texture->pot_height,
                    texture->pot_depth);
+      debug_printf("  .tiled = %u\n",
+                   texture->tiled);
    }
 }
 
@@ -2817,26 +2922,181 @@ lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant)
 {
    debug_printf("llvmpipe: Fragment shader #%u variant #%u:\n", 
                 variant->shader->no, variant->no);
-   tgsi_dump(variant->shader->base.tokens, 0);
+   if (variant->shader->base.type == PIPE_SHADER_IR_NIR)
+      nir_print_shader(variant->shader->base.ir.nir, stderr);
+   else
+      tgsi_dump(variant->shader->base.tokens, 0);
    dump_fs_variant_key(&variant->key);
    debug_printf("variant->opaque = %u\n", variant->opaque);
+   debug_printf("variant->hiz_test = %u\n", variant->hiz_test);
+   debug_printf("variant->hiz_update = %u\n", variant->hiz_update);
+   debug_printf("variant->hiz_keep = %u\n", variant->hiz_keep);
    debug_printf("\n");
 }
 
 
+/**
+ * Compute the disk cache key of a fragment shader variant: the shader
+ * tokens (or serialized NIR), the variant key and whether the code is
+ * built with gallivm->fast_compile.
+ */
+static void
+lp_fs_get_ir_cache_key(const struct lp_fragment_shader *shader,
+                       const struct lp_fragment_shader_variant_key *key,
+                       boolean fast_compile,
+                       unsigned char ir_sha1_cache_key[20])
+{
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, "fs", 2);
+   if (shader->base.type == PIPE_SHADER_IR_NIR) {
+      struct blob blob;
+
+      blob_init(&blob);
+      nir_serialize(&blob, shader->base.ir.nir);
+      _mesa_sha1_update(&ctx, blob.data, blob.size);
+      blob_finish(&blob);
+   } else {
+      _mesa_sha1_update(&ctx, shader->base.tokens,
+                        tgsi_num_tokens(shader->base.tokens) *
+                        sizeof(struct tgsi_token));
+   }
+   _mesa_sha1_update(&ctx, key, shader->variant_key_size);
+   _mesa_sha1_update(&ctx, &fast_compile, sizeof(fast_compile));
+   _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+}
+
+
+/**
+ * Build the IR of all the functions of a fragment shader variant, compile
+ * them and look up the entry points.
+ */
+static void
+compile_variant(struct llvmpipe_context *lp,
+                struct lp_fragment_shader *shader,
+                struct lp_fragment_shader_variant *variant)
+{
+   lp_jit_init_types(variant);
+
+   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
+      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+
+   if (variant->jit_function[RAST_WHOLE] == NULL) {
+      if (variant->opaque) {
+         /* Specialized shader, which doesn't need to read the color buffer. */
+         generate_fragment(lp, shader, variant, RAST_WHOLE);
+      }
+   }
+
+   /*
+    * Compile everything
+    */
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   if (variant->function[RAST_EDGE_TEST]) {
+      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+            gallivm_jit_function(variant->gallivm,
+                                 variant->function[RAST_EDGE_TEST]);
+   }
+
+   if (variant->function[RAST_WHOLE]) {
+         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+               gallivm_jit_function(variant->gallivm,
+                                    variant->function[RAST_WHOLE]);
+   } else if (!variant->jit_function[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
+   }
+}
+
+
+/**
+ * Compile queue job: build the optimized code of a variant which is already
+ * in use with fast-compiled code, then switch the variant over to it.
+ *
+ * This runs on a compile thread, so the IR is built in a private LLVM
+ * context and only the variant's key and shader, which are immutable, are
+ * accessed.  Rasterizer threads may be calling jit_function[] meanwhile;
+ * the unoptimized code stays around until the variant is destroyed.
+ */
+static void
+optimize_variant(void *data, int thread_index)
+{
+   struct lp_fragment_shader_variant *variant = data;
+   struct lp_fragment_shader *shader = variant->shader;
+   struct llvmpipe_screen *screen = variant->screen;
+   struct lp_fragment_shader_variant *opt;
+   LLVMContextRef context;
+   char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+
+   opt = CALLOC_STRUCT(lp_fragment_shader_variant);
+   if (!opt)
+      return;
+
+   memcpy(&opt->key, &variant->key, shader->variant_key_size);
+   opt->shader = shader;
+   opt->opaque = variant->opaque;
+   opt->no = variant->no;
+
+   context = LLVMContextCreate();
+   if (!context) {
+      FREE(opt);
+      return;
+   }
+
+   snprintf(module_name, sizeof(module_name), "fs%u_variant%u_opt",
+            shader->no, variant->no);
+
+   lp_fs_get_ir_cache_key(shader, &variant->key, FALSE, ir_sha1_cache_key);
+
+   opt->gallivm = gallivm_create(module_name, context, &cached);
+   if (opt->gallivm) {
+      compile_variant(NULL, shader, opt);
+
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+
+      gallivm_free_ir(opt->gallivm);
+
+      variant->optimized_gallivm = opt->gallivm;
+      p_atomic_set(&variant->jit_function[RAST_EDGE_TEST],
+                   opt->jit_function[RAST_EDGE_TEST]);
+      p_atomic_set(&variant->jit_function[RAST_WHOLE],
+                   opt->jit_function[RAST_WHOLE]);
+   }
+
+   LLVMContextDispose(context);
+   free(cached.data);
+   FREE(opt);
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * Unless the code is found in the disk cache, with the compile queue
+ * enabled the variant is first compiled without optimizations, and the
+ * optimized code is produced in the background.
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
                  struct lp_fragment_shader *shader,
                  const struct lp_fragment_shader_variant_key *key)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_fragment_shader_variant *variant;
    const struct util_format_description *cbuf0_format_desc = NULL;
    boolean fullcolormask;
    char module_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   boolean needs_caching = FALSE;
+   boolean async = FALSE;
 
    variant = CALLOC_STRUCT(lp_fragment_shader_variant);
    if (!variant)
@@ -2845,16 +3105,32 @@ generate_variant(struct llvmpipe_context *lp,
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
             shader->no, shader->variants_created);
 
-   variant->gallivm = gallivm_create(module_name, lp->context);
+   /* Only optimized code is ever looked up or stored. */
+   lp_fs_get_ir_cache_key(shader, key, FALSE, ir_sha1_cache_key);
+   lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+   if (!cached.data_size) {
+      if (util_queue_is_initialized(&screen->compile_queue))
+         async = TRUE;
+      else
+         needs_caching = TRUE;
+   }
+
+   /* Unoptimized code must not end up in the disk cache. */
+   variant->gallivm = gallivm_create(module_name, lp->context,
+                                     async ? NULL : &cached);
    if (!variant->gallivm) {
+      free(cached.data);
       FREE(variant);
       return NULL;
    }
+   variant->gallivm->fast_compile = async;
 
    variant->shader = shader;
+   variant->screen = screen;
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    variant->no = shader->variants_created++;
+   util_queue_fence_init(&variant->optimize_fence);
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
@@ -2879,46 +3155,56 @@ generate_variant(struct llvmpipe_context *lp,
          !shader->info.base.writes_samplemask
       ? TRUE : FALSE;
 
-   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
-      lp_debug_fs_variant(variant);
-   }
-
-   lp_jit_init_types(variant);
-   
-   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
-
-   if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
-         /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
-      }
-   }
-
    /*
-    * Compile everything
+    * Hierarchical depth.  The depth bounds are upper bounds, so only
+    * LESS/LEQUAL can reject against them, and they stay valid only as long
+    * as depth writes can't increase the stored values.
     */
+   variant->hiz_test =
+         key->depth.enabled &&
+         (key->depth.func == PIPE_FUNC_LESS ||
+          key->depth.func == PIPE_FUNC_LEQUAL) &&
+         !key->depth_clamp &&
+         !key->stencil[0].enabled &&
+         !shader->info.base.writes_z
+      ? TRUE : FALSE;
 
-   gallivm_compile_module(variant->gallivm);
+   variant->hiz_update =
+         variant->hiz_test &&
+         key->depth.writemask &&
+         !key->alpha.enabled &&
+         !key->blend.alpha_to_coverage &&
+         !shader->info.base.uses_kill &&
+         !shader->info.base.writes_samplemask
+      ? TRUE : FALSE;
 
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+   variant->hiz_keep =
+         !key->depth.enabled ||
+         !key->depth.writemask ||
+         key->depth.func == PIPE_FUNC_NEVER ||
+         key->depth.func == PIPE_FUNC_LESS ||
+         key->depth.func == PIPE_FUNC_LEQUAL ||
+         key->depth.func == PIPE_FUNC_EQUAL
+      ? TRUE : FALSE;
 
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
-            gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST]);
+   if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
+      lp_debug_fs_variant(variant);
    }
 
-   if (variant->function[RAST_WHOLE]) {
-         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-               gallivm_jit_function(variant->gallivm,
-                                    variant->function[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
-   }
+   compile_variant(lp, shader, variant);
+
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
 
    gallivm_free_ir(variant->gallivm);
 
+   free(cached.data);
+
+   if (async) {
+      util_queue_add_job(&screen->compile_queue, variant,
+                         &variant->optimize_fence, optimize_variant, NULL);
+   }
+
    return variant;
 }
 
@@ -2940,14 +3226,25 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
    shader->no = fs_no++;
    make_empty_list(&shader->variants);
 
-   /* get/save the summary info for this shader */
-   lp_build_tgsi_info(templ->tokens, &shader->info);
+   if (templ->type == PIPE_SHADER_IR_NIR) {
+      /* we take ownership of the NIR */
+      shader->base.type = PIPE_SHADER_IR_NIR;
+      shader->base.ir.nir = templ->ir.nir;
+      lp_build_opt_nir(shader->base.ir.nir);
+      nir_tgsi_scan_shader(shader->base.ir.nir, &shader->info.base, true);
+   } else {
+      /* get/save the summary info for this shader */
+      lp_build_tgsi_info(templ->tokens, &shader->info);
 
-   /* we need to keep a local copy of the tokens */
-   shader->base.tokens = tgsi_dup_tokens(templ->tokens);
+      /* we need to keep a local copy of the tokens */
+      shader->base.tokens = tgsi_dup_tokens(templ->tokens);
+   }
 
-   shader->draw_data = draw_create_fragment_shader(llvmpipe->draw, templ);
+   shader->draw_data = draw_create_fragment_shader(llvmpipe->draw,
+                                                   &shader->base);
    if (shader->draw_data == NULL) {
+      if (shader->base.type == PIPE_SHADER_IR_NIR)
+         ralloc_free(shader->base.ir.nir);
       FREE((void *) shader->base.tokens);
       FREE(shader);
       return NULL;
@@ -3001,7 +3298,10 @@ llvmpipe_create_fs_state(struct pipe_context *pipe,
       unsigned attrib;
       debug_printf("llvmpipe: Create fragment shader #%u %p:\n",
                    shader->no, (void *) shader);
-      tgsi_dump(templ->tokens, 0);
+      if (shader->base.type == PIPE_SHADER_IR_NIR)
+         nir_print_shader(shader->base.ir.nir, stderr);
+      else
+         tgsi_dump(templ->tokens, 0);
       debug_printf("usage masks:\n");
       for (attrib = 0; attrib < shader->info.base.num_inputs; ++attrib) {
          unsigned usage_mask = shader->info.base.input_usage_mask[attrib];
@@ -3053,7 +3353,15 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                    lp->nr_fs_variants, variant->nr_instrs, lp->nr_fs_instrs);
    }
 
+   /* The compile job references the variant. */
+   if (util_queue_is_initialized(&variant->screen->compile_queue))
+      util_queue_drop_job(&variant->screen->compile_queue,
+                          &variant->optimize_fence);
+   util_queue_fence_destroy(&variant->optimize_fence);
+
    gallivm_destroy(variant->gallivm);
+   if (variant->optimized_gallivm)
+      gallivm_destroy(variant->optimized_gallivm);
 
    /* remove from shader's list */
    remove_from_list(&variant->list_item_local);
@@ -3096,6 +3404,8 @@ llvmpipe_delete_fs_state(struct pipe_context *pipe, void *fs)
    draw_delete_fragment_shader(llvmpipe->draw, shader->draw_data);
 
    assert(shader->variants_cached == 0);
+   if (shader->base.type == PIPE_SHADER_IR_NIR)
+      ralloc_free(shader->base.ir.nir);
    FREE((void *) shader->base.tokens);
    FREE(shader);
 }
@@ -3145,7 +3455,7 @@ llvmpipe_set_constant_buffer(struct pipe_context *pipe,
       draw_set_mapped_constant_buffer(llvmpipe->draw, shader,
                                       index, data, size);
    }
-   else {
+   else if (shader == PIPE_SHADER_FRAGMENT) {
       llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
    }
 
@@ -3386,8 +3696,8 @@ make_variant_key(struct llvmpipe_context *lp,
           * used views may be included in the shader key.
           */
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
-            lp_sampler_static_texture_state(&key->state[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_sampler_static_texture_state(&key->state[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -3395,8 +3705,8 @@ make_variant_key(struct llvmpipe_context *lp,
       key->nr_sampler_views = key->nr_samplers;
       for(i = 0; i < key->nr_sampler_views; ++i) {
          if(shader->info.base.file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
-            lp_sampler_static_texture_state(&key->state[i].texture_state,
-                                            lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+            llvmpipe_sampler_static_texture_state(&key->state[i].texture_state,
+                                                  lp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
          }
       }
    }
@@ -35,11 +35,13 @@
 #include "tgsi/tgsi_scan.h" /* for tgsi_shader_info */
 #include "gallivm/lp_bld_sample.h" /* for struct lp_sampler_static_state */
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
+#include "util/u_queue.h" /* for util_queue_fence */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 
 
 struct tgsi_token;
 struct lp_fragment_shader;
+struct llvmpipe_screen;
 
 
 /** Indexes into jit_function[] array */
@@ -99,6 +101,16 @@ struct lp_fragment_shader_variant
 
    boolean opaque;
 
+   /*
+    * Hierarchical depth: hiz_test is set when fragments behind the depth
+    * bounds of a tile or block can be skipped, hiz_update when fully
+    * covered areas lower those bounds, and hiz_keep when the bounds remain
+    * valid after drawing (depth values can only decrease).
+    */
+   boolean hiz_test;
+   boolean hiz_update;
+   boolean hiz_keep;
+
    struct gallivm_state *gallivm;
 
    LLVMTypeRef jit_context_ptr_type;
@@ -109,11 +121,20 @@ struct lp_fragment_shader_variant
 
    lp_jit_frag_func jit_function[2];
 
+   /**
+    * Optimized code, compiled in the background when the variant was first
+    * built with gallivm->fast_compile.  jit_function[] is switched over to it
+    * once it is ready.
+    */
+   struct util_queue_fence optimize_fence;
+   struct gallivm_state *optimized_gallivm;
+
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
+   struct llvmpipe_screen *screen;
 
    /* For debugging/profiling purposes */
    unsigned no;
@@ -31,6 +31,7 @@
 
 #include "util/u_inlines.h"
 #include "util/u_memory.h"
+#include "util/u_format.h"
 
 #include "draw/draw_context.h"
 
@@ -38,6 +39,7 @@
 #include "lp_screen.h"
 #include "lp_state.h"
 #include "lp_debug.h"
+#include "lp_texture.h"
 #include "state_tracker/sw_winsys.h"
 
 
@@ -98,7 +100,7 @@ llvmpipe_bind_sampler_states(struct pipe_context *pipe,
                         llvmpipe->samplers[shader],
                         llvmpipe->num_samplers[shader]);
    }
-   else {
+   else if (shader == PIPE_SHADER_FRAGMENT) {
       llvmpipe->dirty |= LP_NEW_SAMPLER;
    }
 }
@@ -128,7 +130,7 @@ llvmpipe_set_sampler_views(struct pipe_context *pipe,
        * (which is why we need the hack above in the first place).
        * An assert would be better but st/mesa relies on it...
        */
-      if (views[i] && views[i]->context != pipe) {
+      if (views[i] && !llvmpipe_same_context(pipe, views[i]->context)) {
          debug_printf("Illegal setting of sampler_view %d created in another "
                       "context\n", i);
       }
@@ -145,12 +147,18 @@ llvmpipe_set_sampler_views(struct pipe_context *pipe,
    }
 
    if (shader == PIPE_SHADER_VERTEX || shader == PIPE_SHADER_GEOMETRY) {
+      /* the draw module only samples linear textures */
+      for (i = 0; i < num; i++) {
+         if (views[i])
+            llvmpipe_resource_untile(pipe, views[i]->texture);
+      }
+
       draw_set_sampler_views(llvmpipe->draw,
                              shader,
                              llvmpipe->sampler_views[shader],
                              llvmpipe->num_sampler_views[shader]);
    }
-   else {
+   else if (shader == PIPE_SHADER_FRAGMENT) {
       llvmpipe->dirty |= LP_NEW_SAMPLER_VIEW;
    }
 }
@@ -171,6 +179,13 @@ llvmpipe_create_sampler_view(struct pipe_context *pipe,
       texture->bind |= PIPE_BIND_SAMPLER_VIEW;
    }
 
+   /* Tiled sampling relies on the texel size of the texture format */
+   if (llvmpipe_resource(texture)->tiled &&
+       util_format_get_blocksize(templ->format) !=
+       util_format_get_blocksize(texture->format)) {
+      llvmpipe_resource_untile(pipe, texture);
+   }
+
    if (view) {
       *view = *templ;
       view->reference.count = 1;
@@ -230,6 +245,21 @@ llvmpipe_delete_sampler_state(struct pipe_context *pipe,
 }
 
 
+/**
+ * Static texture state of a sampler view for the fragment and compute shader
+ * variant keys, which unlike draw's also depends on the texture layout.
+ */
+void
+llvmpipe_sampler_static_texture_state(struct lp_static_texture_state *state,
+                                      const struct pipe_sampler_view *view)
+{
+   lp_sampler_static_texture_state(state, view);
+
+   if (view && view->texture)
+      state->tiled = llvmpipe_resource_const(view->texture)->tiled;
+}
+
+
 static void
 prepare_shader_sampling(
    struct llvmpipe_context *lp,
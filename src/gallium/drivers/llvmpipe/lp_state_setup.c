@@ -30,6 +30,7 @@
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
 #include "gallivm/lp_bld_arit.h"
 #include "gallivm/lp_bld_bitarit.h"
 #include "gallivm/lp_bld_const.h"
@@ -707,10 +708,14 @@ static struct lp_setup_variant *
 generate_setup_variant(struct lp_setup_variant_key *key,
                        struct llvmpipe_context *lp)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
    struct lp_setup_variant *variant = NULL;
    struct gallivm_state *gallivm;
    struct lp_setup_args args;
    char func_name[64];
+   unsigned char ir_sha1_cache_key[20];
+   struct lp_cached_code cached = { 0 };
+   boolean needs_caching = FALSE;
    LLVMTypeRef vec4f_type;
    LLVMTypeRef func_type;
    LLVMTypeRef arg_types[7];
@@ -727,10 +732,22 @@ generate_setup_variant(struct lp_setup_variant_key *key,
 
    variant->no = setup_no++;
 
-   snprintf(func_name, sizeof(func_name), "setup_variant_%u",
-            variant->no);
+   snprintf(func_name, sizeof(func_name), "setup_variant");
 
-   variant->gallivm = gallivm = gallivm_create(func_name, lp->context);
+   {
+      struct mesa_sha1 ctx;
+
+      _mesa_sha1_init(&ctx);
+      _mesa_sha1_update(&ctx, "setup", 5);
+      _mesa_sha1_update(&ctx, key, key->size);
+      _mesa_sha1_final(&ctx, ir_sha1_cache_key);
+   }
+   lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
+   if (!cached.data_size)
+      needs_caching = TRUE;
+
+   variant->gallivm = gallivm = gallivm_create(func_name, lp->context,
+                                               &cached);
    if (!variant->gallivm) {
       goto fail;
    }
@@ -805,7 +822,11 @@ generate_setup_variant(struct lp_setup_variant_key *key,
    if (!variant->jit_function)
       goto fail;
 
+   if (needs_caching)
+      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+
    gallivm_free_ir(variant->gallivm);
+   free(cached.data);
 
    /*
     * Update timing information:
@@ -825,6 +846,7 @@ fail:
       }
       FREE(variant);
    }
+   free(cached.data);
 
    return NULL;
 }
@@ -29,6 +29,7 @@
 
 #include "pipe/p_defines.h"
 #include "tgsi/tgsi_dump.h"
+#include "compiler/nir/nir.h"
 #include "tgsi/tgsi_parse.h"
 #include "util/u_memory.h"
 #include "draw/draw_context.h"
@@ -52,7 +53,10 @@ llvmpipe_create_vs_state(struct pipe_context *pipe,
 
    if (LP_DEBUG & DEBUG_TGSI) {
       debug_printf("llvmpipe: Create vertex shader %p:\n", (void *) vs);
-      tgsi_dump(templ->tokens, 0);
+      if (templ->type == PIPE_SHADER_IR_NIR)
+         nir_print_shader(templ->ir.nir, stderr);
+      else
+         tgsi_dump(templ->tokens, 0);
    }
 
    return vs;
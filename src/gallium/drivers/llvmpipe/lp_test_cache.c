@@ -0,0 +1,472 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Disk cache test.
+ *
+ * Draws and dispatches with two sets of shaders on one screen, then does
+ * the same on a second screen with the shaders created in the opposite
+ * order, so that they get different shader and variant numbers.  The second
+ * screen must get all of its code from the cache, and produce the same
+ * results.
+ */
+
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "tgsi/tgsi_text.h"
+#include "util/disk_cache.h"
+#include "util/u_box.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_public.h"
+
+
+#define WIDTH 32
+#define HEIGHT 32
+#define THREADS 64
+
+/* Exit code for skipped tests, see meson's test() */
+#define SKIP 77
+
+
+static const char *vs_text =
+   "VERT\n"
+   "DCL IN[0]\n"
+   "DCL IN[1]\n"
+   "DCL OUT[0], POSITION\n"
+   "DCL OUT[1], GENERIC[0]\n"
+   "MOV OUT[0], IN[0]\n"
+   "MOV OUT[1], IN[1]\n"
+   "END\n";
+
+static const char *fs_text[2] = {
+   "FRAG\n"
+   "DCL IN[0], GENERIC[0], PERSPECTIVE\n"
+   "DCL OUT[0], COLOR\n"
+   "MOV OUT[0], IN[0]\n"
+   "END\n",
+
+   "FRAG\n"
+   "DCL IN[0], GENERIC[0], PERSPECTIVE\n"
+   "DCL OUT[0], COLOR\n"
+   "IMM[0] FLT32 { 0.5, 0.25, 1.0, 1.0 }\n"
+   "MUL OUT[0], IN[0].wzyx, IMM[0]\n"
+   "END\n",
+};
+
+static const char *cs_text[2] = {
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0]\n"
+   "IMM[0] UINT32 { 4, 7, 0, 0 }\n"
+   "UMUL TEMP[0].x, SV[0].xxxx, IMM[0].xxxx\n"
+   "UADD TEMP[0].y, SV[0].xxxx, IMM[0].yyyy\n"
+   "STORE BUFFER[0].x, TEMP[0].xxxx, TEMP[0].yyyy\n"
+   "END\n",
+
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0]\n"
+   "IMM[0] UINT32 { 4, 3, 0, 0 }\n"
+   "UMUL TEMP[0].x, SV[0].xxxx, IMM[0].xxxx\n"
+   "UMUL TEMP[0].y, SV[0].xxxx, IMM[0].yyyy\n"
+   "STORE BUFFER[0].x, TEMP[0].xxxx, TEMP[0].yyyy\n"
+   "END\n",
+};
+
+/* Results of each shader set */
+struct results {
+   uint64_t image[2];
+   uint32_t buffer[2][THREADS];
+};
+
+
+static void *
+create_shader(struct pipe_context *pipe, const char *text,
+              enum pipe_shader_type type)
+{
+   struct tgsi_token tokens[1024];
+
+   if (!tgsi_text_translate(text, tokens, ARRAY_SIZE(tokens))) {
+      fprintf(stderr, "failed to translate:\n%s", text);
+      exit(1);
+   }
+
+   if (type == PIPE_SHADER_COMPUTE) {
+      struct pipe_compute_state state;
+
+      memset(&state, 0, sizeof state);
+      state.ir_type = PIPE_SHADER_IR_TGSI;
+      state.prog = tokens;
+      return pipe->create_compute_state(pipe, &state);
+   } else {
+      struct pipe_shader_state state;
+
+      memset(&state, 0, sizeof state);
+      state.type = PIPE_SHADER_IR_TGSI;
+      state.tokens = tokens;
+      if (type == PIPE_SHADER_VERTEX)
+         return pipe->create_vs_state(pipe, &state);
+      return pipe->create_fs_state(pipe, &state);
+   }
+}
+
+
+static void
+set_state(struct pipe_screen *screen, struct pipe_context *pipe,
+          struct pipe_resource *rt, struct pipe_surface **surf,
+          struct pipe_resource **vbuf)
+{
+   static const float verts[3][8] = {
+      { -0.9, -0.9, 0, 1,   1, 0, 0, 1 },
+      {  0.9, -0.7, 0, 1,   0, 1, 0, 1 },
+      { -0.3,  0.9, 0, 1,   0, 0, 1, 1 },
+   };
+   struct pipe_blend_state blend;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_vertex_element velems[2];
+   struct pipe_vertex_buffer vb;
+   struct pipe_surface surf_tmpl;
+   struct pipe_framebuffer_state fb;
+   struct pipe_viewport_state vp;
+
+   memset(&blend, 0, sizeof blend);
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   pipe->bind_blend_state(pipe, pipe->create_blend_state(pipe, &blend));
+
+   memset(&dsa, 0, sizeof dsa);
+   pipe->bind_depth_stencil_alpha_state(pipe,
+      pipe->create_depth_stencil_alpha_state(pipe, &dsa));
+
+   memset(velems, 0, sizeof velems);
+   velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   velems[1].src_offset = 4 * sizeof(float);
+   pipe->bind_vertex_elements_state(pipe,
+      pipe->create_vertex_elements_state(pipe, 2, velems));
+
+   *vbuf = pipe_buffer_create(screen, PIPE_BIND_VERTEX_BUFFER,
+                              PIPE_USAGE_DEFAULT, sizeof verts);
+   pipe_buffer_write(pipe, *vbuf, 0, sizeof verts, verts);
+   memset(&vb, 0, sizeof vb);
+   vb.stride = sizeof verts[0];
+   vb.buffer.resource = *vbuf;
+   pipe->set_vertex_buffers(pipe, 0, 1, &vb);
+
+   memset(&surf_tmpl, 0, sizeof surf_tmpl);
+   surf_tmpl.format = rt->format;
+   *surf = pipe->create_surface(pipe, rt, &surf_tmpl);
+   memset(&fb, 0, sizeof fb);
+   fb.width = WIDTH;
+   fb.height = HEIGHT;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = *surf;
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   memset(&vp, 0, sizeof vp);
+   vp.scale[0] = WIDTH / 2.0f;
+   vp.scale[1] = HEIGHT / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = WIDTH / 2.0f;
+   vp.translate[1] = HEIGHT / 2.0f;
+   vp.translate[2] = 0.5f;
+   pipe->set_viewport_states(pipe, 0, 1, &vp);
+}
+
+
+static uint64_t
+hash_image(struct pipe_context *pipe, struct pipe_resource *rt)
+{
+   struct pipe_transfer *transfer;
+   struct pipe_box box;
+   const uint8_t *map;
+   uint64_t hash = 1469598103934665603ull;
+   unsigned x, y;
+
+   u_box_2d(0, 0, WIDTH, HEIGHT, &box);
+   map = pipe->transfer_map(pipe, rt, 0, PIPE_TRANSFER_READ, &box, &transfer);
+   for (y = 0; y < HEIGHT; y++)
+      for (x = 0; x < WIDTH * 4; x++)
+         hash = (hash ^ map[y * transfer->stride + x]) * 1099511628211ull;
+   pipe->transfer_unmap(pipe, transfer);
+
+   return hash;
+}
+
+
+/**
+ * Draw and dispatch with shader set i.  The shaders are created here, so
+ * the order of the calls decides their numbers.  The rasterizer state goes
+ * into the draw module's vertex shader variant key, so the vertex shader
+ * variants are numbered in call order too.
+ */
+static void
+run(struct pipe_screen *screen, struct pipe_context *pipe,
+    struct pipe_resource *rt, unsigned i, struct results *results)
+{
+   union pipe_color_union clear_color;
+   struct pipe_rasterizer_state rast;
+   struct pipe_draw_info info;
+   struct pipe_grid_info grid;
+   struct pipe_shader_buffer sb;
+   struct pipe_resource *buf;
+   struct pipe_transfer *transfer;
+   void *rs, *fs, *cs;
+   uint32_t *map;
+
+   memset(&rast, 0, sizeof rast);
+   rast.half_pixel_center = 1;
+   rast.depth_clip_near = 1;
+   rast.depth_clip_far = 1;
+   rast.clip_halfz = i;
+   rs = pipe->create_rasterizer_state(pipe, &rast);
+   pipe->bind_rasterizer_state(pipe, rs);
+
+   fs = create_shader(pipe, fs_text[i], PIPE_SHADER_FRAGMENT);
+   pipe->bind_fs_state(pipe, fs);
+
+   memset(&clear_color, 0, sizeof clear_color);
+   pipe->clear(pipe, PIPE_CLEAR_COLOR, &clear_color, 0.0, 0);
+
+   memset(&info, 0, sizeof info);
+   info.mode = PIPE_PRIM_TRIANGLES;
+   info.count = 3;
+   info.instance_count = 1;
+   info.max_index = ~0;
+   pipe->draw_vbo(pipe, &info);
+
+   results->image[i] = hash_image(pipe, rt);
+
+   cs = create_shader(pipe, cs_text[i], PIPE_SHADER_COMPUTE);
+   pipe->bind_compute_state(pipe, cs);
+
+   buf = pipe_buffer_create(screen, PIPE_BIND_SHADER_BUFFER,
+                            PIPE_USAGE_DEFAULT, THREADS * 4);
+   memset(&sb, 0, sizeof sb);
+   sb.buffer = buf;
+   sb.buffer_size = THREADS * 4;
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, &sb, 1);
+
+   memset(&grid, 0, sizeof grid);
+   grid.block[0] = THREADS;
+   grid.block[1] = 1;
+   grid.block[2] = 1;
+   grid.grid[0] = 1;
+   grid.grid[1] = 1;
+   grid.grid[2] = 1;
+   pipe->launch_grid(pipe, &grid);
+
+   map = pipe_buffer_map(pipe, buf, PIPE_TRANSFER_READ, &transfer);
+   memcpy(results->buffer[i], map, THREADS * 4);
+   pipe_buffer_unmap(pipe, transfer);
+
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, NULL, 0);
+   pipe_resource_reference(&buf, NULL);
+
+   pipe->bind_compute_state(pipe, NULL);
+   pipe->delete_compute_state(pipe, cs);
+   pipe->bind_fs_state(pipe, NULL);
+   pipe->delete_fs_state(pipe, fs);
+   pipe->bind_rasterizer_state(pipe, NULL);
+   pipe->delete_rasterizer_state(pipe, rs);
+}
+
+
+/**
+ * Wait for the cache writes queued so far.  They are done in order, so
+ * once a marker entry put after them can be read back they are all there.
+ */
+static void
+wait_for_cache(struct disk_cache *cache, unsigned n)
+{
+   cache_key key;
+   size_t size;
+   void *data;
+   unsigned i;
+
+   disk_cache_compute_key(cache, &n, sizeof n, key);
+   disk_cache_put(cache, key, &n, sizeof n, NULL);
+
+   for (i = 0; i < 10000; i++) {
+      data = disk_cache_get(cache, key, &size);
+      if (data) {
+         free(data);
+         return;
+      }
+      usleep(1000);
+   }
+
+   fprintf(stderr, "cache writes didn't complete\n");
+   exit(1);
+}
+
+
+static unsigned num_files;
+
+static int
+count_file(const char *path, const struct stat *sb, int type,
+           struct FTW *ftwbuf)
+{
+   if (type == FTW_F && strcmp(path + ftwbuf->base, "index") != 0)
+      num_files++;
+   return 0;
+}
+
+static int
+remove_file(const char *path, const struct stat *sb, int type,
+            struct FTW *ftwbuf)
+{
+   return remove(path);
+}
+
+
+/**
+ * Run both shader sets in the given order on a new screen, and return the
+ * number of cache entries afterwards.
+ */
+static int
+test_screen(unsigned first, struct results *results, const char *dir)
+{
+   struct pipe_screen *screen;
+   struct pipe_context *pipe;
+   struct pipe_resource templ, *rt, *vbuf;
+   struct pipe_surface *surf;
+   struct disk_cache *cache;
+   void *vs;
+
+   screen = llvmpipe_create_screen(null_sw_create());
+   if (!screen) {
+      fprintf(stderr, "failed to create screen\n");
+      exit(1);
+   }
+
+   cache = screen->get_disk_shader_cache(screen);
+   if (!cache) {
+      screen->destroy(screen);
+      return -1;
+   }
+
+   pipe = screen->context_create(screen, NULL, 0);
+
+   memset(&templ, 0, sizeof templ);
+   templ.target = PIPE_TEXTURE_2D;
+   templ.format = PIPE_FORMAT_R8G8B8A8_UNORM;
+   templ.width0 = WIDTH;
+   templ.height0 = HEIGHT;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.bind = PIPE_BIND_RENDER_TARGET;
+   rt = screen->resource_create(screen, &templ);
+
+   set_state(screen, pipe, rt, &surf, &vbuf);
+   vs = create_shader(pipe, vs_text, PIPE_SHADER_VERTEX);
+   pipe->bind_vs_state(pipe, vs);
+
+   run(screen, pipe, rt, first, results);
+   run(screen, pipe, rt, !first, results);
+
+   wait_for_cache(cache, first);
+
+   pipe->bind_vs_state(pipe, NULL);
+   pipe->delete_vs_state(pipe, vs);
+   pipe_surface_reference(&surf, NULL);
+   pipe_resource_reference(&rt, NULL);
+   pipe_resource_reference(&vbuf, NULL);
+   pipe->destroy(pipe);
+   screen->destroy(screen);
+
+   num_files = 0;
+   nftw(dir, count_file, 16, FTW_PHYS);
+   return num_files;
+}
+
+
+int
+main(int argc, char **argv)
+{
+   char dir[] = "/tmp/lp_test_cache.XXXXXX";
+   struct results results[2];
+   int entries[2];
+   int ret = 0;
+
+   if (!mkdtemp(dir)) {
+      perror("mkdtemp");
+      return 1;
+   }
+
+   setenv("MESA_GLSL_CACHE_DIR", dir, 1);
+   setenv("MESA_GLSL_CACHE_DISABLE", "false", 1);
+   /* Background compiles would store the code at some later point. */
+   setenv("LP_ASYNC_COMPILE", "false", 1);
+
+   memset(results, 0, sizeof results);
+   entries[0] = test_screen(0, &results[0], dir);
+   if (entries[0] < 0) {
+      printf("shader cache not available, skipping\n");
+      nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+      return SKIP;
+   }
+   entries[1] = test_screen(1, &results[1], dir);
+
+   /* Everything but the marker entry must have been found in the cache. */
+   if (entries[1] != entries[0] + 1) {
+      printf("%d new cache entries, expected none\n",
+             entries[1] - entries[0] - 1);
+      ret = 1;
+   }
+
+   if (memcmp(&results[0], &results[1], sizeof results[0]) != 0) {
+      printf("results from cached code differ\n");
+      ret = 1;
+   }
+
+   if (results[0].image[0] == results[0].image[1] ||
+       results[0].buffer[0][1] != 8 || results[0].buffer[1][1] != 3) {
+      printf("unexpected results\n");
+      ret = 1;
+   }
+
+   nftw(dir, remove_file, 16, FTW_DEPTH | FTW_PHYS);
+
+   printf("%s\n", ret ? "FAIL" : "PASS");
+   return ret;
+}
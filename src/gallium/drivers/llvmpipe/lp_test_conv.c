@@ -221,7 +221,7 @@ test_one(unsigned verbose,
    }
 
    context = LLVMContextCreate();
-   gallivm = gallivm_create("test_module", context);
+   gallivm = gallivm_create("test_module", context, NULL);
 
    func = add_conv_test(gallivm, src_type, num_srcs, dst_type, num_dsts);
 
@@ -352,6 +352,11 @@ const struct lp_type conv_types[] = {
    {   TRUE, FALSE, FALSE,  TRUE,    32,   8 },
    {   TRUE, FALSE, FALSE, FALSE,    32,   8 },
 
+   {   TRUE, FALSE,  TRUE,  TRUE,    32,  16 },
+   {   TRUE, FALSE,  TRUE, FALSE,    32,  16 },
+   {   TRUE, FALSE, FALSE,  TRUE,    32,  16 },
+   {   TRUE, FALSE, FALSE, FALSE,    32,  16 },
+
    /* Fixed */
    {  FALSE,  TRUE,  TRUE,  TRUE,    32,   4 },
    {  FALSE,  TRUE,  TRUE, FALSE,    32,   4 },
@@ -0,0 +1,1099 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * NIR backend test.
+ *
+ * Runs every test once with TGSI shaders and once with the same shaders
+ * in NIR, and checks the results of both.  Vertex and fragment shaders are
+ * converted with tgsi_to_nir.  That can't translate geometry shader emits,
+ * compute shader resources or most 64 bit instructions, so the geometry
+ * and compute shaders are built with nir_builder, the way the state
+ * tracker would hand them over.
+ *
+ * With -b the compile time and the run time of the shaders are measured
+ * with either IR instead.
+ */
+
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "tgsi/tgsi_text.h"
+#include "nir/tgsi_to_nir.h"
+#include "compiler/nir/nir.h"
+#include "compiler/nir/nir_builder.h"
+#include "util/os_time.h"
+#include "util/u_box.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_public.h"
+
+
+#define WIDTH 32
+#define HEIGHT 32
+#define THREADS 64
+#define GROUPS 4
+#define NUM_POINTS 4
+
+/* Bytes written per compute thread by the 64 bit test */
+#define CS_64BIT_STRIDE 48
+
+/* The throughput runs draw this many instances, and dispatch this many
+ * times the groups.
+ */
+#define BENCH_WORK 256
+#define BENCH_COMPILES 10
+#define BENCH_RUNS 20
+
+/* Exit code for skipped tests, see meson's test() */
+#define SKIP 77
+
+
+static const char vs_text[] =
+   "VERT\n"
+   "DCL IN[0]\n"
+   "DCL IN[1]\n"
+   "DCL OUT[0], POSITION\n"
+   "DCL OUT[1], GENERIC[0]\n"
+   "MOV OUT[0], IN[0]\n"
+   "MOV OUT[1], IN[1]\n"
+   "END\n";
+
+/*
+ * Turns each point into two quads, 6 pixels wide and 12 high, left and right
+ * of it.  The left one gets the point's colour with the primitive id in
+ * alpha, the right one the colour times 2 plus 0.25.
+ */
+static const char gs_text[] =
+   "GEOM\n"
+   "PROPERTY GS_INPUT_PRIMITIVE POINTS\n"
+   "PROPERTY GS_OUTPUT_PRIMITIVE TRIANGLE_STRIP\n"
+   "PROPERTY GS_MAX_OUTPUT_VERTICES 8\n"
+   "PROPERTY GS_INVOCATIONS 1\n"
+   "DCL IN[][0], POSITION\n"
+   "DCL IN[][1], GENERIC[0]\n"
+   "DCL SV[0], PRIM_ID\n"
+   "DCL OUT[0], POSITION\n"
+   "DCL OUT[1], GENERIC[0]\n"
+   "DCL TEMP[0..1]\n"
+   "IMM[0] FLT32 { -0.375, 0.0, 0.375, 0.0 }\n"
+   "IMM[1] FLT32 { 2.0, 0.25, 0.0, 0.0 }\n"
+   "IMM[2] UINT32 { 0, 0, 0, 0 }\n"
+   "MOV TEMP[0].xyz, IN[0][1].xyzz\n"
+   "U2F TEMP[0].w, SV[0].xxxx\n"
+   "MAD TEMP[1], IN[0][1], IMM[1].xxxx, IMM[1].yyyy\n"
+   "ADD OUT[0], IN[0][0], IMM[0].xxww\n"
+   "MOV OUT[1], TEMP[0]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].yxww\n"
+   "MOV OUT[1], TEMP[0]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].xzww\n"
+   "MOV OUT[1], TEMP[0]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].yzww\n"
+   "MOV OUT[1], TEMP[0]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ENDPRIM IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].yxww\n"
+   "MOV OUT[1], TEMP[1]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].zxww\n"
+   "MOV OUT[1], TEMP[1]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].yzww\n"
+   "MOV OUT[1], TEMP[1]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ADD OUT[0], IN[0][0], IMM[0].zzww\n"
+   "MOV OUT[1], TEMP[1]\n"
+   "EMIT IMM[2].xxxx\n"
+   "ENDPRIM IMM[2].xxxx\n"
+   "END\n";
+
+/* The vertex offsets of the above, per quad */
+static const float gs_offsets[2][4][2] = {
+   { { -0.375, -0.375 }, { 0.0, -0.375 }, { -0.375, 0.375 }, { 0.0, 0.375 } },
+   { { 0.0, -0.375 }, { 0.375, -0.375 }, { 0.0, 0.375 }, { 0.375, 0.375 } },
+};
+
+static const char fs_copy_text[] =
+   "FRAG\n"
+   "DCL IN[0], GENERIC[0], CONSTANT\n"
+   "DCL OUT[0], COLOR\n"
+   "MOV OUT[0], IN[0]\n"
+   "END\n";
+
+#define FS_LOOP_ITERATIONS 16
+
+static const char fs_loop_text[] =
+   "FRAG\n"
+   "DCL IN[0], GENERIC[0], CONSTANT\n"
+   "DCL OUT[0], COLOR\n"
+   "DCL TEMP[0..1]\n"
+   "IMM[0] FLT32 { 0.25, 0.125, 0.0, 0.0 }\n"
+   "IMM[1] INT32 { 0, 1, 16, 0 }\n"
+   "MOV TEMP[0], IN[0]\n"
+   "MOV TEMP[1].x, IMM[1].xxxx\n"
+   "BGNLOOP\n"
+   "  ISGE TEMP[1].y, TEMP[1].xxxx, IMM[1].zzzz\n"
+   "  UIF TEMP[1].yyyy\n"
+   "    BRK\n"
+   "  ENDIF\n"
+   "  MUL TEMP[0], TEMP[0], TEMP[0].yzwx\n"
+   "  MAD TEMP[0], TEMP[0], IMM[0].xxxx, IMM[0].yyyy\n"
+   "  UADD TEMP[1].x, TEMP[1].xxxx, IMM[1].yyyy\n"
+   "ENDLOOP\n"
+   "MOV OUT[0], TEMP[0]\n"
+   "END\n";
+
+/* out[i] = shared[63 - t] after each thread t stored t * 3 + group */
+static const char cs_shared_text[] =
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL SV[1], BLOCK_ID\n"
+   "DCL BUFFER[0]\n"
+   "DCL MEMORY[0], SHARED\n"
+   "DCL TEMP[0..2]\n"
+   "IMM[0] UINT32 { 4, 63, 64, 3 }\n"
+   "UMUL TEMP[0].x, SV[0].xxxx, IMM[0].xxxx\n"
+   "UMAD TEMP[1].x, SV[0].xxxx, IMM[0].wwww, SV[1].xxxx\n"
+   "STORE MEMORY[0].x, TEMP[0].xxxx, TEMP[1].xxxx\n"
+   "BARRIER\n"
+   "UADD TEMP[0].x, IMM[0].yyyy, -SV[0].xxxx\n"
+   "UMUL TEMP[0].x, TEMP[0].xxxx, IMM[0].xxxx\n"
+   "LOAD TEMP[1].x, MEMORY[0], TEMP[0].xxxx\n"
+   "UMAD TEMP[2].x, SV[1].xxxx, IMM[0].zzzz, SV[0].xxxx\n"
+   "UMUL TEMP[2].x, TEMP[2].xxxx, IMM[0].xxxx\n"
+   "STORE BUFFER[0].x, TEMP[2].xxxx, TEMP[1].xxxx\n"
+   "END\n";
+
+/*
+ * With i the global thread index, d = i + 1 and q = i + 1 as 64 bit integer,
+ * writes
+ *
+ *    y = d * 2^32 + 0.5 + sqrt(d * d) / 3, (float)y, y < 2^36,
+ *    c = ((q * 0x300000007) << 5) / 7 + q * 0x300000007 % 1000, -c >> 3,
+ *    q * 0x300000007 < 2^36, (uint)(y / 2^32)
+ *
+ * with 32 bit booleans being ~0 for true.
+ */
+static const char cs_64bit_text[] =
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL SV[1], BLOCK_ID\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0..9]\n"
+   "IMM[0] UINT32 { 64, 48, 1, 5 }\n"
+   "IMM[1] UINT32 { 0, 16, 32, 3 }\n"
+   "IMM[2] FLT64 { 4294967296.0, 0.5 }\n"
+   "IMM[3] FLT64 { 3.0, 68719476736.0 }\n"
+   "IMM[4] UINT64 { 12884901895, 68719476736 }\n"
+   "IMM[5] UINT64 { 7, 1000 }\n"
+   "UMAD TEMP[0].x, SV[1].xxxx, IMM[0].xxxx, SV[0].xxxx\n"
+   "UADD TEMP[0].y, TEMP[0].xxxx, IMM[0].zzzz\n"
+   "UMUL TEMP[0].z, TEMP[0].xxxx, IMM[0].yyyy\n"
+   "U2D TEMP[1].xy, TEMP[0].yyyy\n"
+   "DMUL TEMP[2].xy, TEMP[1].xyxy, IMM[2].xyxy\n"
+   "DADD TEMP[2].xy, TEMP[2].xyxy, IMM[2].zwzw\n"
+   "DMUL TEMP[3].xy, TEMP[1].xyxy, TEMP[1].xyxy\n"
+   "DSQRT TEMP[3].xy, TEMP[3].xyxy\n"
+   "DDIV TEMP[3].xy, TEMP[3].xyxy, IMM[3].xyxy\n"
+   "DADD TEMP[2].xy, TEMP[2].xyxy, TEMP[3].xyxy\n"
+   "D2F TEMP[3].x, TEMP[2].xyxy\n"
+   "DSLT TEMP[3].y, TEMP[2].xyxy, IMM[3].zwzw\n"
+   "DDIV TEMP[1].xy, TEMP[2].xyxy, IMM[2].xyxy\n"
+   "D2U TEMP[4].y, TEMP[1].xyxy\n"
+   "U2I64 TEMP[5].xy, TEMP[0].yyyy\n"
+   "U64MUL TEMP[5].xy, TEMP[5].xyxy, IMM[4].xyxy\n"
+   "U64SLT TEMP[4].x, TEMP[5].xyxy, IMM[4].zwzw\n"
+   "U64SHL TEMP[6].xy, TEMP[5].xyxy, IMM[0].wwww\n"
+   "U64DIV TEMP[6].xy, TEMP[6].xyxy, IMM[5].xyxy\n"
+   "U64MOD TEMP[7].xy, TEMP[5].xyxy, IMM[5].zwzw\n"
+   "U64ADD TEMP[6].xy, TEMP[6].xyxy, TEMP[7].xyxy\n"
+   "I64NEG TEMP[7].xy, TEMP[6].xyxy\n"
+   "I64SHR TEMP[7].xy, TEMP[7].xyxy, IMM[1].wwww\n"
+   "MOV TEMP[8].xy, TEMP[2].xyxy\n"
+   "MOV TEMP[8].zw, TEMP[3].xxxy\n"
+   "STORE BUFFER[0].xyzw, TEMP[0].zzzz, TEMP[8]\n"
+   "MOV TEMP[8].xy, TEMP[6].xyxy\n"
+   "MOV TEMP[8].zw, TEMP[7].xxxy\n"
+   "UADD TEMP[9].x, TEMP[0].zzzz, IMM[1].yyyy\n"
+   "STORE BUFFER[0].xyzw, TEMP[9].xxxx, TEMP[8]\n"
+   "MOV TEMP[8].xy, TEMP[4].xyxy\n"
+   "MOV TEMP[8].zw, IMM[1].xxxx\n"
+   "UADD TEMP[9].x, TEMP[0].zzzz, IMM[1].zzzz\n"
+   "STORE BUFFER[0].xyzw, TEMP[9].xxxx, TEMP[8]\n"
+   "END\n";
+
+
+static void
+init_builder(nir_builder *b, struct pipe_screen *screen,
+             gl_shader_stage stage, enum pipe_shader_type type)
+{
+   nir_builder_init_simple_shader(b, NULL, stage,
+      screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR, type));
+}
+
+
+static nir_variable *
+create_io_var(nir_shader *nir, nir_variable_mode mode,
+              const struct glsl_type *type, const char *name,
+              int location, unsigned driver_location)
+{
+   nir_variable *var = nir_variable_create(nir, mode, type, name);
+
+   var->data.location = location;
+   var->data.driver_location = driver_location;
+   return var;
+}
+
+
+static void
+build_store_ssbo(nir_builder *b, nir_ssa_def *value, nir_ssa_def *offset)
+{
+   nir_intrinsic_instr *store =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_store_ssbo);
+
+   store->num_components = value->num_components;
+   store->src[0] = nir_src_for_ssa(value);
+   store->src[1] = nir_src_for_ssa(nir_imm_int(b, 0));
+   store->src[2] = nir_src_for_ssa(offset);
+   nir_intrinsic_set_write_mask(store, (1 << value->num_components) - 1);
+   nir_intrinsic_set_align(store, value->bit_size / 8, 0);
+   nir_builder_instr_insert(b, &store->instr);
+}
+
+
+static void
+build_gs_intrinsic(nir_builder *b, nir_intrinsic_op op)
+{
+   nir_intrinsic_instr *instr = nir_intrinsic_instr_create(b->shader, op);
+
+   nir_intrinsic_set_stream_id(instr, 0);
+   nir_builder_instr_insert(b, &instr->instr);
+}
+
+
+static nir_shader *
+build_gs(struct pipe_screen *screen)
+{
+   const struct glsl_type *in_type = glsl_array_type(glsl_vec4_type(), 1, 0);
+   nir_variable *in_pos, *in_color, *out_pos, *out_color;
+   nir_ssa_def *pos, *color, *colors[2];
+   nir_builder b;
+   unsigned i, j;
+
+   init_builder(&b, screen, MESA_SHADER_GEOMETRY, PIPE_SHADER_GEOMETRY);
+   b.shader->info.gs.input_primitive = PIPE_PRIM_POINTS;
+   b.shader->info.gs.output_primitive = PIPE_PRIM_TRIANGLE_STRIP;
+   b.shader->info.gs.vertices_out = 8;
+   b.shader->info.gs.invocations = 1;
+
+   in_pos = create_io_var(b.shader, nir_var_shader_in, in_type, "in_pos",
+                          VARYING_SLOT_POS, 0);
+   in_color = create_io_var(b.shader, nir_var_shader_in, in_type, "in_color",
+                            VARYING_SLOT_VAR0, 1);
+   out_pos = create_io_var(b.shader, nir_var_shader_out, glsl_vec4_type(),
+                           "out_pos", VARYING_SLOT_POS, 0);
+   out_color = create_io_var(b.shader, nir_var_shader_out, glsl_vec4_type(),
+                             "out_color", VARYING_SLOT_VAR0, 1);
+
+   pos = nir_load_deref(&b, nir_build_deref_array_imm(&b,
+                               nir_build_deref_var(&b, in_pos), 0));
+   color = nir_load_deref(&b, nir_build_deref_array_imm(&b,
+                                 nir_build_deref_var(&b, in_color), 0));
+
+   colors[0] = nir_vec4(&b, nir_channel(&b, color, 0),
+                        nir_channel(&b, color, 1),
+                        nir_channel(&b, color, 2),
+                        nir_u2f32(&b, nir_load_primitive_id(&b)));
+   colors[1] = nir_fadd(&b, nir_fmul(&b, color, nir_imm_float(&b, 2.0)),
+                        nir_imm_float(&b, 0.25));
+
+   for (i = 0; i < 2; i++) {
+      for (j = 0; j < 4; j++) {
+         nir_ssa_def *offset = nir_imm_vec4(&b, gs_offsets[i][j][0],
+                                            gs_offsets[i][j][1], 0.0, 0.0);
+
+         nir_store_var(&b, out_pos, nir_fadd(&b, pos, offset), 0xf);
+         nir_store_var(&b, out_color, colors[i], 0xf);
+         build_gs_intrinsic(&b, nir_intrinsic_emit_vertex);
+      }
+      build_gs_intrinsic(&b, nir_intrinsic_end_primitive);
+   }
+
+   b.shader->num_inputs = 2;
+   b.shader->num_outputs = 2;
+   return b.shader;
+}
+
+
+static nir_shader *
+build_cs_shared(struct pipe_screen *screen)
+{
+   nir_intrinsic_instr *store, *barrier, *load;
+   nir_ssa_def *thread, *group, *index;
+   nir_builder b;
+
+   init_builder(&b, screen, MESA_SHADER_COMPUTE, PIPE_SHADER_COMPUTE);
+   b.shader->info.num_ssbos = 1;
+   b.shader->info.cs.shared_size = THREADS * 4;
+
+   thread = nir_channel(&b, nir_load_local_invocation_id(&b), 0);
+   group = nir_channel(&b, nir_load_work_group_id(&b), 0);
+
+   store = nir_intrinsic_instr_create(b.shader, nir_intrinsic_store_shared);
+   store->num_components = 1;
+   store->src[0] = nir_src_for_ssa(nir_iadd(&b, nir_imul(&b, thread,
+                                                         nir_imm_int(&b, 3)),
+                                            group));
+   store->src[1] = nir_src_for_ssa(nir_imul(&b, thread, nir_imm_int(&b, 4)));
+   nir_intrinsic_set_write_mask(store, 0x1);
+   nir_intrinsic_set_align(store, 4, 0);
+   nir_builder_instr_insert(&b, &store->instr);
+
+   barrier = nir_intrinsic_instr_create(b.shader, nir_intrinsic_barrier);
+   nir_builder_instr_insert(&b, &barrier->instr);
+
+   load = nir_intrinsic_instr_create(b.shader, nir_intrinsic_load_shared);
+   load->num_components = 1;
+   load->src[0] = nir_src_for_ssa(
+      nir_imul(&b, nir_isub(&b, nir_imm_int(&b, THREADS - 1), thread),
+               nir_imm_int(&b, 4)));
+   nir_intrinsic_set_align(load, 4, 0);
+   nir_ssa_dest_init(&load->instr, &load->dest, 1, 32, NULL);
+   nir_builder_instr_insert(&b, &load->instr);
+
+   index = nir_iadd(&b, nir_imul(&b, group, nir_imm_int(&b, THREADS)), thread);
+   build_store_ssbo(&b, &load->dest.ssa,
+                    nir_imul(&b, index, nir_imm_int(&b, 4)));
+   return b.shader;
+}
+
+
+static nir_shader *
+build_cs_64bit(struct pipe_screen *screen)
+{
+   nir_ssa_def *index, *offset, *all_ones, *zero;
+   nir_ssa_def *d, *y, *f, *y_less, *u, *q, *a, *c, *e, *a_less;
+   nir_builder b;
+
+   init_builder(&b, screen, MESA_SHADER_COMPUTE, PIPE_SHADER_COMPUTE);
+   b.shader->info.num_ssbos = 1;
+
+   index = nir_iadd(&b,
+                    nir_imul(&b, nir_channel(&b, nir_load_work_group_id(&b), 0),
+                             nir_imm_int(&b, THREADS)),
+                    nir_channel(&b, nir_load_local_invocation_id(&b), 0));
+   offset = nir_imul(&b, index, nir_imm_int(&b, CS_64BIT_STRIDE));
+   index = nir_iadd(&b, index, nir_imm_int(&b, 1));
+   all_ones = nir_imm_int(&b, ~0);
+   zero = nir_imm_int(&b, 0);
+
+   d = nir_u2f64(&b, index);
+   y = nir_fadd(&b, nir_fmul(&b, d, nir_imm_double(&b, 4294967296.0)),
+                nir_imm_double(&b, 0.5));
+   y = nir_fadd(&b, y, nir_fdiv(&b, nir_fsqrt(&b, nir_fmul(&b, d, d)),
+                                nir_imm_double(&b, 3.0)));
+
+   q = nir_u2u64(&b, index);
+   a = nir_imul(&b, q, nir_imm_int64(&b, 0x300000007ll));
+   c = nir_iadd(&b, nir_udiv(&b, nir_ishl(&b, a, nir_imm_int(&b, 5)),
+                             nir_imm_int64(&b, 7)),
+                nir_umod(&b, a, nir_imm_int64(&b, 1000)));
+
+   y_less = nir_bcsel(&b, nir_flt(&b, y, nir_imm_double(&b, 68719476736.0)),
+                      all_ones, zero);
+   a_less = nir_bcsel(&b, nir_ult(&b, a, nir_imm_int64(&b, 1ll << 36)),
+                      all_ones, zero);
+   f = nir_f2f32(&b, y);
+   u = nir_f2u32(&b, nir_fdiv(&b, y, nir_imm_double(&b, 4294967296.0)));
+   y = nir_unpack_64_2x32(&b, y);
+   e = nir_unpack_64_2x32(&b, nir_ishr(&b, nir_ineg(&b, c),
+                                       nir_imm_int(&b, 3)));
+   c = nir_unpack_64_2x32(&b, c);
+
+   /* The same three vec4 stores as the TGSI shader */
+   build_store_ssbo(&b, nir_vec4(&b, nir_channel(&b, y, 0),
+                                 nir_channel(&b, y, 1), f, y_less),
+                    offset);
+   build_store_ssbo(&b, nir_vec4(&b, nir_channel(&b, c, 0),
+                                 nir_channel(&b, c, 1),
+                                 nir_channel(&b, e, 0),
+                                 nir_channel(&b, e, 1)),
+                    nir_iadd(&b, offset, nir_imm_int(&b, 16)));
+   build_store_ssbo(&b, nir_vec4(&b, a_less, u, zero, zero),
+                    nir_iadd(&b, offset, nir_imm_int(&b, 32)));
+   return b.shader;
+}
+
+
+static void
+point_color(unsigned k, float color[4])
+{
+   color[0] = k == 0 ? 1.0f : 0.25f * k;
+   color[1] = 0.5f;
+   color[2] = 0.125f * k;
+   color[3] = 1.0f;
+}
+
+
+/**
+ * The colour the geometry shader gives pixel (x, y), false for background.
+ */
+static bool
+gs_color(unsigned x, unsigned y, float color[4])
+{
+   unsigned k;
+
+   for (k = 0; k < NUM_POINTS; k++) {
+      int cx = 8 + 16 * (k % 2);
+      int cy = 8 + 16 * (k / 2);
+      unsigned c;
+
+      if ((int)y < cy - 6 || (int)y >= cy + 6 ||
+          (int)x < cx - 6 || (int)x >= cx + 6)
+         continue;
+
+      point_color(k, color);
+      if ((int)x < cx) {
+         color[3] = k;
+      } else {
+         for (c = 0; c < 4; c++)
+            color[c] = color[c] * 2.0f + 0.25f;
+      }
+      return true;
+   }
+
+   return false;
+}
+
+
+static bool
+check_gs(const void *data)
+{
+   const float *image = data;
+   unsigned x, y, c;
+   unsigned errors = 0;
+
+   for (y = 0; y < HEIGHT; y++) {
+      for (x = 0; x < WIDTH; x++) {
+         const float *pixel = &image[(y * WIDTH + x) * 4];
+         float expected[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+         gs_color(x, y, expected);
+         for (c = 0; c < 4; c++) {
+            if (pixel[c] != expected[c]) {
+               if (errors++ < 4)
+                  printf("  pixel (%u, %u).%u = %f, expected %f\n",
+                         x, y, c, pixel[c], expected[c]);
+            }
+         }
+      }
+   }
+
+   return errors == 0;
+}
+
+
+static bool
+check_fs_loop(const void *data)
+{
+   const float *image = data;
+   unsigned x, y, c, i;
+   unsigned errors = 0;
+
+   for (y = 0; y < HEIGHT; y++) {
+      for (x = 0; x < WIDTH; x++) {
+         const float *pixel = &image[(y * WIDTH + x) * 4];
+         float expected[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+         if (gs_color(x, y, expected)) {
+            for (i = 0; i < FS_LOOP_ITERATIONS; i++) {
+               float tmp[4];
+
+               for (c = 0; c < 4; c++)
+                  tmp[c] = expected[c] * expected[(c + 1) % 4];
+               for (c = 0; c < 4; c++)
+                  expected[c] = tmp[c] * 0.25f + 0.125f;
+            }
+         }
+
+         for (c = 0; c < 4; c++) {
+            if (fabsf(pixel[c] - expected[c]) > 1e-5f) {
+               if (errors++ < 4)
+                  printf("  pixel (%u, %u).%u = %f, expected %f\n",
+                         x, y, c, pixel[c], expected[c]);
+            }
+         }
+      }
+   }
+
+   return errors == 0;
+}
+
+
+static bool
+check_cs_shared(const void *data)
+{
+   const uint32_t *buffer = data;
+   unsigned i, errors = 0;
+
+   for (i = 0; i < GROUPS * THREADS; i++) {
+      uint32_t expected = (THREADS - 1 - i % THREADS) * 3 + i / THREADS;
+
+      if (buffer[i] != expected && errors++ < 4)
+         printf("  [%u] = %u, expected %u\n", i, buffer[i], expected);
+   }
+
+   return errors == 0;
+}
+
+
+static bool
+check_cs_64bit(const void *data)
+{
+   unsigned i, errors = 0;
+
+   for (i = 0; i < GROUPS * THREADS; i++) {
+      const uint8_t *out = (const uint8_t *)data + i * CS_64BIT_STRIDE;
+      double d = i + 1;
+      double y = d * 4294967296.0 + 0.5 + sqrt(d * d) / 3.0;
+      float f = y;
+      uint32_t y_less = y < 68719476736.0 ? ~0u : 0;
+      uint64_t a = (i + 1) * 0x300000007ull;
+      uint64_t c = (a << 5) / 7 + a % 1000;
+      int64_t e = -(int64_t)c >> 3;
+      uint32_t a_less = a < (1ull << 36) ? ~0u : 0;
+      uint32_t u = y / 4294967296.0;
+
+      if (memcmp(out, &y, 8) || memcmp(out + 8, &f, 4) ||
+          memcmp(out + 12, &y_less, 4) || memcmp(out + 16, &c, 8) ||
+          memcmp(out + 24, &e, 8) || memcmp(out + 32, &a_less, 4) ||
+          memcmp(out + 36, &u, 4)) {
+         if (errors++ < 4) {
+            const uint32_t *words = (const uint32_t *)out;
+            unsigned j;
+
+            printf("  [%u] =", i);
+            for (j = 0; j < 10; j++)
+               printf(" %08x", words[j]);
+            printf("\n");
+         }
+      }
+   }
+
+   return errors == 0;
+}
+
+
+typedef nir_shader *(*build_nir_func)(struct pipe_screen *screen);
+
+struct test {
+   const char *name;
+   /* TGSI text per stage, NULL for unused stages */
+   const char *tgsi[PIPE_SHADER_TYPES];
+   /* Builds the NIR for the stages tgsi_to_nir can't translate */
+   build_nir_func nir[PIPE_SHADER_TYPES];
+   unsigned local_mem;
+   bool (*check)(const void *data);
+};
+
+static const struct test tests[] = {
+   {
+      .name = "gs",
+      .tgsi = {
+         [PIPE_SHADER_VERTEX] = vs_text,
+         [PIPE_SHADER_GEOMETRY] = gs_text,
+         [PIPE_SHADER_FRAGMENT] = fs_copy_text,
+      },
+      .nir = { [PIPE_SHADER_GEOMETRY] = build_gs },
+      .check = check_gs,
+   },
+   {
+      .name = "fs_loop",
+      .tgsi = {
+         [PIPE_SHADER_VERTEX] = vs_text,
+         [PIPE_SHADER_GEOMETRY] = gs_text,
+         [PIPE_SHADER_FRAGMENT] = fs_loop_text,
+      },
+      .nir = { [PIPE_SHADER_GEOMETRY] = build_gs },
+      .check = check_fs_loop,
+   },
+   {
+      .name = "cs_shared",
+      .tgsi = { [PIPE_SHADER_COMPUTE] = cs_shared_text },
+      .nir = { [PIPE_SHADER_COMPUTE] = build_cs_shared },
+      .local_mem = THREADS * 4,
+      .check = check_cs_shared,
+   },
+   {
+      .name = "cs_64bit",
+      .tgsi = { [PIPE_SHADER_COMPUTE] = cs_64bit_text },
+      .nir = { [PIPE_SHADER_COMPUTE] = build_cs_64bit },
+      .check = check_cs_64bit,
+   },
+};
+
+
+/* A test's shaders in either IR, ready to be handed to the driver */
+struct shaders {
+   struct tgsi_token tokens[PIPE_SHADER_TYPES][1024];
+   nir_shader *nir[PIPE_SHADER_TYPES];
+};
+
+
+static void
+prepare_shaders(struct pipe_screen *screen, const struct test *test,
+                bool use_nir, struct shaders *shaders)
+{
+   unsigned type;
+
+   for (type = 0; type < PIPE_SHADER_TYPES; type++) {
+      nir_shader *nir;
+
+      shaders->nir[type] = NULL;
+      if (!test->tgsi[type])
+         continue;
+
+      if (!tgsi_text_translate(test->tgsi[type], shaders->tokens[type],
+                               ARRAY_SIZE(shaders->tokens[type]))) {
+         fprintf(stderr, "failed to translate:\n%s", test->tgsi[type]);
+         exit(1);
+      }
+
+      if (!use_nir)
+         continue;
+
+      if (test->nir[type]) {
+         nir = test->nir[type](screen);
+         nir_shader_gather_info(nir, nir_shader_get_entrypoint(nir));
+      } else {
+         /* What st_nir_assign_varying_locations() does for GLSL */
+         nir = tgsi_to_nir(shaders->tokens[type], screen);
+         if (nir->info.stage != MESA_SHADER_VERTEX)
+            nir_assign_io_var_locations(&nir->inputs, &nir->num_inputs,
+                                        nir->info.stage);
+         nir_assign_io_var_locations(&nir->outputs, &nir->num_outputs,
+                                     nir->info.stage);
+      }
+      shaders->nir[type] = nir;
+   }
+}
+
+
+/**
+ * Create and bind the shaders.  The driver takes ownership of the NIR.
+ */
+static void
+create_shaders(struct pipe_context *pipe, const struct test *test,
+               struct shaders *shaders, void *cso[PIPE_SHADER_TYPES])
+{
+   unsigned type;
+
+   for (type = 0; type < PIPE_SHADER_TYPES; type++) {
+      struct pipe_shader_state state;
+      struct pipe_compute_state cs_state;
+
+      cso[type] = NULL;
+      if (!test->tgsi[type])
+         continue;
+
+      memset(&state, 0, sizeof state);
+      if (shaders->nir[type]) {
+         state.type = PIPE_SHADER_IR_NIR;
+         state.ir.nir = shaders->nir[type];
+      } else {
+         state.type = PIPE_SHADER_IR_TGSI;
+         state.tokens = shaders->tokens[type];
+      }
+      shaders->nir[type] = NULL;
+
+      switch (type) {
+      case PIPE_SHADER_VERTEX:
+         cso[type] = pipe->create_vs_state(pipe, &state);
+         pipe->bind_vs_state(pipe, cso[type]);
+         break;
+      case PIPE_SHADER_GEOMETRY:
+         cso[type] = pipe->create_gs_state(pipe, &state);
+         pipe->bind_gs_state(pipe, cso[type]);
+         break;
+      case PIPE_SHADER_FRAGMENT:
+         cso[type] = pipe->create_fs_state(pipe, &state);
+         pipe->bind_fs_state(pipe, cso[type]);
+         break;
+      case PIPE_SHADER_COMPUTE:
+         memset(&cs_state, 0, sizeof cs_state);
+         cs_state.ir_type = state.type;
+         cs_state.prog = state.type == PIPE_SHADER_IR_NIR ?
+            (const void *)state.ir.nir : (const void *)state.tokens;
+         cs_state.req_local_mem = test->local_mem;
+         cso[type] = pipe->create_compute_state(pipe, &cs_state);
+         pipe->bind_compute_state(pipe, cso[type]);
+         break;
+      default:
+         assert(0);
+      }
+   }
+}
+
+
+static void
+delete_shaders(struct pipe_context *pipe, void *cso[PIPE_SHADER_TYPES])
+{
+   if (cso[PIPE_SHADER_VERTEX]) {
+      pipe->bind_vs_state(pipe, NULL);
+      pipe->delete_vs_state(pipe, cso[PIPE_SHADER_VERTEX]);
+   }
+   if (cso[PIPE_SHADER_GEOMETRY]) {
+      pipe->bind_gs_state(pipe, NULL);
+      pipe->delete_gs_state(pipe, cso[PIPE_SHADER_GEOMETRY]);
+   }
+   if (cso[PIPE_SHADER_FRAGMENT]) {
+      pipe->bind_fs_state(pipe, NULL);
+      pipe->delete_fs_state(pipe, cso[PIPE_SHADER_FRAGMENT]);
+   }
+   if (cso[PIPE_SHADER_COMPUTE]) {
+      pipe->bind_compute_state(pipe, NULL);
+      pipe->delete_compute_state(pipe, cso[PIPE_SHADER_COMPUTE]);
+   }
+}
+
+
+static void
+set_state(struct pipe_screen *screen, struct pipe_context *pipe,
+          struct pipe_resource *rt, struct pipe_surface **surf,
+          struct pipe_resource **vbuf, struct pipe_resource *buf)
+{
+   float verts[NUM_POINTS][8];
+   struct pipe_rasterizer_state rast;
+   struct pipe_blend_state blend;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_vertex_element velems[2];
+   struct pipe_vertex_buffer vb;
+   struct pipe_surface surf_tmpl;
+   struct pipe_framebuffer_state fb;
+   struct pipe_viewport_state vp;
+   struct pipe_shader_buffer sb;
+   unsigned k;
+
+   memset(&rast, 0, sizeof rast);
+   rast.half_pixel_center = 1;
+   rast.depth_clip_near = 1;
+   rast.depth_clip_far = 1;
+   pipe->bind_rasterizer_state(pipe, pipe->create_rasterizer_state(pipe, &rast));
+
+   memset(&blend, 0, sizeof blend);
+   blend.rt[0].colormask = PIPE_MASK_RGBA;
+   pipe->bind_blend_state(pipe, pipe->create_blend_state(pipe, &blend));
+
+   memset(&dsa, 0, sizeof dsa);
+   pipe->bind_depth_stencil_alpha_state(pipe,
+      pipe->create_depth_stencil_alpha_state(pipe, &dsa));
+
+   memset(velems, 0, sizeof velems);
+   velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   velems[1].src_offset = 4 * sizeof(float);
+   pipe->bind_vertex_elements_state(pipe,
+      pipe->create_vertex_elements_state(pipe, 2, velems));
+
+   for (k = 0; k < NUM_POINTS; k++) {
+      verts[k][0] = k % 2 ? 0.5f : -0.5f;
+      verts[k][1] = k / 2 ? 0.5f : -0.5f;
+      verts[k][2] = 0.0f;
+      verts[k][3] = 1.0f;
+      point_color(k, &verts[k][4]);
+   }
+   *vbuf = pipe_buffer_create(screen, PIPE_BIND_VERTEX_BUFFER,
+                              PIPE_USAGE_DEFAULT, sizeof verts);
+   pipe_buffer_write(pipe, *vbuf, 0, sizeof verts, verts);
+   memset(&vb, 0, sizeof vb);
+   vb.stride = sizeof verts[0];
+   vb.buffer.resource = *vbuf;
+   pipe->set_vertex_buffers(pipe, 0, 1, &vb);
+
+   memset(&surf_tmpl, 0, sizeof surf_tmpl);
+   surf_tmpl.format = rt->format;
+   *surf = pipe->create_surface(pipe, rt, &surf_tmpl);
+   memset(&fb, 0, sizeof fb);
+   fb.width = WIDTH;
+   fb.height = HEIGHT;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = *surf;
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   memset(&vp, 0, sizeof vp);
+   vp.scale[0] = WIDTH / 2.0f;
+   vp.scale[1] = HEIGHT / 2.0f;
+   vp.scale[2] = 0.5f;
+   vp.translate[0] = WIDTH / 2.0f;
+   vp.translate[1] = HEIGHT / 2.0f;
+   vp.translate[2] = 0.5f;
+   pipe->set_viewport_states(pipe, 0, 1, &vp);
+
+   memset(&sb, 0, sizeof sb);
+   sb.buffer = buf;
+   sb.buffer_size = buf->width0;
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, &sb, 1);
+}
+
+
+/**
+ * Draw or dispatch work times, and wait for it.
+ */
+static void
+run(struct pipe_screen *screen, struct pipe_context *pipe,
+    const struct test *test, unsigned work)
+{
+   struct pipe_fence_handle *fence = NULL;
+
+   if (test->tgsi[PIPE_SHADER_COMPUTE]) {
+      struct pipe_grid_info grid;
+
+      memset(&grid, 0, sizeof grid);
+      grid.block[0] = THREADS;
+      grid.block[1] = 1;
+      grid.block[2] = 1;
+      grid.grid[0] = GROUPS * work;
+      grid.grid[1] = 1;
+      grid.grid[2] = 1;
+      pipe->launch_grid(pipe, &grid);
+   } else {
+      union pipe_color_union clear_color;
+      struct pipe_draw_info info;
+
+      memset(&clear_color, 0, sizeof clear_color);
+      pipe->clear(pipe, PIPE_CLEAR_COLOR, &clear_color, 0.0, 0);
+
+      memset(&info, 0, sizeof info);
+      info.mode = PIPE_PRIM_POINTS;
+      info.count = NUM_POINTS;
+      info.instance_count = work;
+      info.max_index = ~0;
+      pipe->draw_vbo(pipe, &info);
+   }
+
+   pipe->flush(pipe, &fence, 0);
+   screen->fence_finish(screen, pipe, fence, PIPE_TIMEOUT_INFINITE);
+   screen->fence_reference(screen, &fence, NULL);
+}
+
+
+static bool
+check(struct pipe_screen *screen, struct pipe_context *pipe,
+      const struct test *test, bool use_nir,
+      struct pipe_resource *rt, struct pipe_resource *buf)
+{
+   struct shaders *shaders = CALLOC_STRUCT(shaders);
+   struct pipe_transfer *transfer;
+   void *cso[PIPE_SHADER_TYPES];
+   uint8_t *data, *map;
+   bool pass;
+
+   prepare_shaders(screen, test, use_nir, shaders);
+   create_shaders(pipe, test, shaders, cso);
+
+   printf("%s %s:\n", test->name, use_nir ? "nir" : "tgsi");
+
+   if (test->tgsi[PIPE_SHADER_COMPUTE]) {
+      size_t size = GROUPS * THREADS * CS_64BIT_STRIDE;
+
+      /* Don't let the previous run's results pass for this one's */
+      map = pipe_buffer_map(pipe, buf, PIPE_TRANSFER_WRITE, &transfer);
+      memset(map, 0xcd, size);
+      pipe_buffer_unmap(pipe, transfer);
+
+      run(screen, pipe, test, 1);
+
+      data = MALLOC(size);
+      map = pipe_buffer_map(pipe, buf, PIPE_TRANSFER_READ, &transfer);
+      memcpy(data, map, size);
+      pipe_buffer_unmap(pipe, transfer);
+   } else {
+      struct pipe_box box;
+      unsigned y;
+
+      run(screen, pipe, test, 1);
+
+      data = MALLOC(WIDTH * HEIGHT * 16);
+      u_box_2d(0, 0, WIDTH, HEIGHT, &box);
+      map = pipe->transfer_map(pipe, rt, 0, PIPE_TRANSFER_READ, &box,
+                               &transfer);
+      for (y = 0; y < HEIGHT; y++)
+         memcpy(data + y * WIDTH * 16, map + y * transfer->stride, WIDTH * 16);
+      pipe->transfer_unmap(pipe, transfer);
+   }
+
+   pass = test->check(data);
+   printf("  %s\n", pass ? "ok" : "FAIL");
+
+   FREE(data);
+   delete_shaders(pipe, cso);
+   FREE(shaders);
+   return pass;
+}
+
+
+/**
+ * Returns the best compile time and the best run time of the test's work
+ * in milliseconds.  The IR is prepared before the clock starts, so only
+ * the driver's part of compiling is measured: creating the shaders and
+ * the first run with them, which compiles the variants.
+ */
+static void
+benchmark(struct pipe_screen *screen, struct pipe_context *pipe,
+          const struct test *test, bool use_nir,
+          double *compile_ms, double *run_ms)
+{
+   struct shaders *shaders = CALLOC_STRUCT(shaders);
+   void *cso[PIPE_SHADER_TYPES];
+   int64_t best = INT64_MAX, start, end;
+   unsigned i;
+
+   for (i = 0; i < BENCH_COMPILES; i++) {
+      prepare_shaders(screen, test, use_nir, shaders);
+      start = os_time_get_nano();
+      create_shaders(pipe, test, shaders, cso);
+      run(screen, pipe, test, 1);
+      end = os_time_get_nano();
+      best = MIN2(best, end - start);
+      delete_shaders(pipe, cso);
+   }
+   *compile_ms = best / 1e6;
+
+   prepare_shaders(screen, test, use_nir, shaders);
+   create_shaders(pipe, test, shaders, cso);
+   run(screen, pipe, test, 1);
+   best = INT64_MAX;
+   for (i = 0; i < BENCH_RUNS; i++) {
+      start = os_time_get_nano();
+      run(screen, pipe, test, BENCH_WORK);
+      end = os_time_get_nano();
+      best = MIN2(best, end - start);
+   }
+   *run_ms = best / 1e6;
+   delete_shaders(pipe, cso);
+
+   FREE(shaders);
+}
+
+
+int
+main(int argc, char **argv)
+{
+   struct pipe_screen *screen;
+   struct pipe_context *pipe;
+   struct pipe_resource templ, *rt, *vbuf, *buf;
+   struct pipe_surface *surf;
+   bool bench = argc > 1 && strcmp(argv[1], "-b") == 0;
+   unsigned i;
+   int ret = 0;
+
+   setenv("LP_NIR", "true", 1);
+   /* Compile every shader, and before the draw returns */
+   setenv("MESA_GLSL_CACHE_DISABLE", "true", 1);
+   setenv("LP_ASYNC_COMPILE", "false", 1);
+
+   screen = llvmpipe_create_screen(null_sw_create());
+   if (!screen) {
+      fprintf(stderr, "failed to create screen\n");
+      return 1;
+   }
+
+   if (!(screen->get_shader_param(screen, PIPE_SHADER_GEOMETRY,
+                                  PIPE_SHADER_CAP_SUPPORTED_IRS) &
+         (1 << PIPE_SHADER_IR_NIR))) {
+      printf("NIR not supported, skipping\n");
+      screen->destroy(screen);
+      return SKIP;
+   }
+
+   pipe = screen->context_create(screen, NULL, 0);
+
+   memset(&templ, 0, sizeof templ);
+   templ.target = PIPE_TEXTURE_2D;
+   templ.format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   templ.width0 = WIDTH;
+   templ.height0 = HEIGHT;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.bind = PIPE_BIND_RENDER_TARGET;
+   rt = screen->resource_create(screen, &templ);
+
+   buf = pipe_buffer_create(screen, PIPE_BIND_SHADER_BUFFER,
+                            PIPE_USAGE_DEFAULT,
+                            GROUPS * BENCH_WORK * THREADS * CS_64BIT_STRIDE);
+
+   set_state(screen, pipe, rt, &surf, &vbuf, buf);
+
+   if (bench) {
+      printf("%-10s %26s %26s\n", "", "compile ms", "run ms");
+      printf("%-10s %8s %8s %8s %8s %8s %8s\n", "test",
+             "tgsi", "nir", "nir/tgsi", "tgsi", "nir", "nir/tgsi");
+   }
+
+   for (i = 0; i < ARRAY_SIZE(tests); i++) {
+      if (bench) {
+         double compile_ms[2], run_ms[2];
+
+         benchmark(screen, pipe, &tests[i], false, &compile_ms[0], &run_ms[0]);
+         benchmark(screen, pipe, &tests[i], true, &compile_ms[1], &run_ms[1]);
+         printf("%-10s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", tests[i].name,
+                compile_ms[0], compile_ms[1], compile_ms[1] / compile_ms[0],
+                run_ms[0], run_ms[1], run_ms[1] / run_ms[0]);
+      } else {
+         if (!check(screen, pipe, &tests[i], false, rt, buf))
+            ret = 1;
+         if (!check(screen, pipe, &tests[i], true, rt, buf))
+            ret = 1;
+      }
+   }
+
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, NULL, 0);
+   pipe_surface_reference(&surf, NULL);
+   pipe_resource_reference(&rt, NULL);
+   pipe_resource_reference(&vbuf, NULL);
+   pipe_resource_reference(&buf, NULL);
+   pipe->destroy(pipe);
+   screen->destroy(screen);
+
+   if (!bench)
+      printf("%s\n", ret ? "FAIL" : "PASS");
+   return ret;
+}
@@ -35,12 +35,16 @@
 #include "pipe/p_context.h"
 #include "pipe/p_defines.h"
 
+#include "draw/draw_context.h"
+
 #include "util/u_inlines.h"
 #include "util/u_cpu_detect.h"
 #include "util/u_format.h"
+#include "util/u_atomic.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/simple_list.h"
+#include "util/u_surface.h"
 #include "util/u_transfer.h"
 
 #include "lp_context.h"
@@ -51,6 +55,8 @@
 #include "lp_state.h"
 #include "lp_rast.h"
 
+#include "gallivm/lp_bld_sample.h"
+
 #include "state_tracker/sw_winsys.h"
 
 
@@ -60,6 +66,106 @@ static struct llvmpipe_resource resource_list;
 static unsigned id_counter = 0;
 
 
+/**
+ * Offset of texel (x, y) within an image of a tiled texture.
+ * Must match lp_build_sample_tiled_offset().
+ */
+static inline unsigned
+tiled_texel_offset(unsigned x, unsigned y, unsigned row_stride, unsigned bpp)
+{
+   const unsigned mask = LP_SAMPLER_TILE_SIZE - 1;
+
+   return (y & ~mask) * row_stride +
+          ((x & ~mask) * LP_SAMPLER_TILE_SIZE +
+           (y & mask) * LP_SAMPLER_TILE_SIZE + (x & mask)) * bpp;
+}
+
+
+/**
+ * Copy a rectangle of texels between an image of a tiled texture and a
+ * linear buffer, in the direction given by 'to_tiled'.
+ */
+static void
+tiled_image_copy(ubyte *image, unsigned row_stride,
+                 ubyte *linear, unsigned linear_stride,
+                 unsigned x0, unsigned y0,
+                 unsigned width, unsigned height,
+                 unsigned bpp, boolean to_tiled)
+{
+   unsigned x, y;
+
+   for (y = 0; y < height; y++) {
+      ubyte *row = linear + y * linear_stride;
+
+      for (x = 0; x < width; ) {
+         unsigned tx = x0 + x;
+         /* texels up to the end of the tile row are contiguous */
+         unsigned n = MIN2(LP_SAMPLER_TILE_SIZE -
+                           (tx & (LP_SAMPLER_TILE_SIZE - 1)), width - x);
+         ubyte *texels = image + tiled_texel_offset(tx, y0 + y,
+                                                    row_stride, bpp);
+
+         if (to_tiled)
+            memcpy(texels, row + x * bpp, n * bpp);
+         else
+            memcpy(row + x * bpp, texels, n * bpp);
+
+         x += n;
+      }
+   }
+}
+
+
+/**
+ * Whether a new texture can start out tiled.
+ *
+ * Tiled textures can only be accessed through transfers and by the
+ * fragment and compute shader samplers; anything else untiles them first.
+ */
+static boolean
+llvmpipe_can_tile(const struct llvmpipe_screen *screen,
+                  const struct pipe_resource *pt)
+{
+   const struct util_format_description *desc;
+
+   if (!screen->tiled_textures)
+      return FALSE;
+
+   switch (pt->target) {
+   case PIPE_TEXTURE_2D:
+   case PIPE_TEXTURE_2D_ARRAY:
+   case PIPE_TEXTURE_RECT:
+   case PIPE_TEXTURE_3D:
+   case PIPE_TEXTURE_CUBE:
+   case PIPE_TEXTURE_CUBE_ARRAY:
+      break;
+   default:
+      return FALSE;
+   }
+
+   if (pt->bind & (PIPE_BIND_DEPTH_STENCIL |
+                   PIPE_BIND_DISPLAY_TARGET |
+                   PIPE_BIND_SCANOUT |
+                   PIPE_BIND_SHARED |
+                   PIPE_BIND_LINEAR |
+                   PIPE_BIND_SHADER_IMAGE |
+                   PIPE_BIND_GLOBAL))
+      return FALSE;
+
+   if (pt->usage == PIPE_USAGE_STAGING || pt->nr_samples > 1)
+      return FALSE;
+
+   /* The layout pads images to whole tiles */
+   STATIC_ASSERT(LP_RASTER_BLOCK_SIZE % LP_SAMPLER_TILE_SIZE == 0);
+
+   desc = util_format_description(pt->format);
+   return desc &&
+          desc->block.width == 1 && desc->block.height == 1 &&
+          desc->block.bits >= 8 &&
+          util_is_power_of_two_nonzero(desc->block.bits);
+}
+
+
 /**
  * Conventional allocation path for non-display textures:
  * Compute strides and allocate data (unless asked not to).
@@ -249,6 +355,7 @@ llvmpipe_resource_create_front(struct pipe_screen *_screen,
    lpr->base = *templat;
    pipe_reference_init(&lpr->base.reference, 1);
    lpr->base.screen = &screen->base;
+   threaded_resource_init(&lpr->base);
 
    /* assert(lpr->base.bind); */
 
@@ -264,6 +371,8 @@ llvmpipe_resource_create_front(struct pipe_screen *_screen,
          /* texture map */
          if (!llvmpipe_texture_layout(screen, lpr, true))
             goto fail;
+
+         lpr->tiled = llvmpipe_can_tile(screen, &lpr->base);
       }
    }
    else {
@@ -300,6 +409,7 @@ llvmpipe_resource_create_front(struct pipe_screen *_screen,
    return &lpr->base;
 
  fail:
+   threaded_resource_deinit(&lpr->base);
    FREE(lpr);
    return NULL;
 }
@@ -331,12 +441,19 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
          align_free(lpr->tex_data);
          lpr->tex_data = NULL;
       }
+      if (lpr->tiled_data)
+         align_free(lpr->tiled_data);
+   }
+   else if (lpr->storage) {
+      pipe_resource_reference(&lpr->storage, NULL);
    }
    else if (!lpr->userBuffer) {
       assert(lpr->data);
       align_free(lpr->data);
    }
 
+   threaded_resource_deinit(pt);
+
 #ifdef DEBUG
    if (lpr->next)
       remove_from_list(lpr);
@@ -453,6 +570,8 @@ llvmpipe_resource_from_handle(struct pipe_screen *screen,
    lpr->base = *template;
    pipe_reference_init(&lpr->base.reference, 1);
    lpr->base.screen = screen;
+   threaded_resource_init(&lpr->base);
+   lpr->threaded.is_shared = true;
 
    /*
     * Looks like unaligned displaytargets work just fine,
@@ -480,6 +599,7 @@ llvmpipe_resource_from_handle(struct pipe_screen *screen,
    return &lpr->base;
 
 no_dt:
+   threaded_resource_deinit(&lpr->base);
    FREE(lpr);
 no_lpr:
    return NULL;
@@ -504,6 +624,33 @@ llvmpipe_resource_get_handle(struct pipe_screen *screen,
 }
 
 
+/**
+ * Flag the fragment shader constants as changed if the buffer is bound as
+ * one of them.  The storage is compared as well, as the threaded context
+ * maps the latest reallocation of an invalidated buffer.
+ */
+static void
+check_fs_constants(struct llvmpipe_context *llvmpipe,
+                   struct pipe_resource *resource)
+{
+   const void *data = llvmpipe_resource(resource)->data;
+   unsigned i;
+
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]); ++i) {
+      struct pipe_resource *buffer =
+         llvmpipe->constants[PIPE_SHADER_FRAGMENT][i].buffer;
+
+      if (buffer &&
+          (buffer == resource ||
+           (data && llvmpipe_resource(buffer)->data == data))) {
+         /* constants may have changed */
+         llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
+         break;
+      }
+   }
+}
+
+
 static void *
 llvmpipe_transfer_map( struct pipe_context *pipe,
                        struct pipe_resource *resource,
@@ -546,19 +693,20 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
       }
    }
 
-   /* Check if we're mapping a current constant buffer */
+   /* Check if we're mapping a current constant buffer.  Threaded
+    * unsynchronized maps come from another thread, so that's left to the
+    * unmap, which is always called from the driver thread.
+    */
    if ((usage & PIPE_TRANSFER_WRITE) &&
+       !(usage & TC_TRANSFER_MAP_THREADED_UNSYNC) &&
        (resource->bind & PIPE_BIND_CONSTANT_BUFFER)) {
-      unsigned i;
-      for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_FRAGMENT]); ++i) {
-         if (resource == llvmpipe->constants[PIPE_SHADER_FRAGMENT][i].buffer) {
-            /* constants may have changed */
-            llvmpipe->dirty |= LP_NEW_FS_CONSTANTS;
-            break;
-         }
-      }
+      check_fs_constants(llvmpipe, resource);
    }
 
+   /* Tiled textures are only ever accessed through a linear copy */
+   if (lpr->tiled && (usage & PIPE_TRANSFER_MAP_DIRECTLY))
+      return NULL;
+
    lpt = CALLOC_STRUCT(llvmpipe_transfer);
    if (!lpt)
       return NULL;
@@ -596,6 +744,51 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
 
    format = lpr->base.format;
 
+   /* Keeps the texture from being untiled while copying from its tiles */
+   if (screen->tiled_textures)
+      mtx_lock(&screen->tile_mutex);
+
+   if (lpr->tiled) {
+      unsigned bpp = util_format_get_blocksize(format);
+      unsigned z;
+
+      pt->stride = box->width * bpp;
+      pt->layer_stride = pt->stride * box->height;
+
+      lpt->staging = MALLOC(pt->layer_stride * box->depth);
+      if (!lpt->staging) {
+         mtx_unlock(&screen->tile_mutex);
+         pipe_resource_reference(&pt->resource, NULL);
+         FREE(lpt);
+         *transfer = NULL;
+         return NULL;
+      }
+
+      if (!(usage & (PIPE_TRANSFER_DISCARD_RANGE |
+                     PIPE_TRANSFER_DISCARD_WHOLE_RESOURCE))) {
+         for (z = 0; z < box->depth; z++) {
+            tiled_image_copy(llvmpipe_get_texture_image_address(lpr,
+                                                                box->z + z,
+                                                                level),
+                             lpr->row_stride[level],
+                             (ubyte *) lpt->staging + z * pt->layer_stride,
+                             pt->stride,
+                             box->x, box->y, box->width, box->height,
+                             bpp, FALSE);
+         }
+      }
+
+      mtx_unlock(&screen->tile_mutex);
+
+      if (usage & PIPE_TRANSFER_WRITE)
+         p_atomic_inc(&screen->timestamp);
+
+      return lpt->staging;
+   }
+
+   if (screen->tiled_textures)
+      mtx_unlock(&screen->tile_mutex);
+
    map = llvmpipe_resource_map(resource,
                                level,
                                box->z,
@@ -607,8 +800,10 @@ llvmpipe_transfer_map( struct pipe_context *pipe,
     */
    if (usage & PIPE_TRANSFER_WRITE) {
       /* Do something to notify sharing contexts of a texture change.
+       * Unsynchronized maps get here from the application thread when
+       * running threaded, hence the atomic.
        */
-      screen->timestamp++;
+      p_atomic_inc(&screen->timestamp);
    }
 
    map +=
@@ -623,21 +818,136 @@ static void
 llvmpipe_transfer_unmap(struct pipe_context *pipe,
                         struct pipe_transfer *transfer)
 {
+   struct llvmpipe_transfer *lpt = llvmpipe_transfer(transfer);
+
    assert(transfer->resource);
 
-   llvmpipe_resource_unmap(transfer->resource,
-                           transfer->level,
-                           transfer->box.z);
+   if ((transfer->usage & PIPE_TRANSFER_WRITE) &&
+       (transfer->usage & TC_TRANSFER_MAP_THREADED_UNSYNC) &&
+       (transfer->resource->bind & PIPE_BIND_CONSTANT_BUFFER)) {
+      check_fs_constants(llvmpipe_context(pipe), transfer->resource);
+   }
+
+   if (lpt->staging) {
+      /* Copy the linear data back into the tiles, or into the linear
+       * storage if another context untiled the texture in the meantime.
+       */
+      if (transfer->usage & PIPE_TRANSFER_WRITE) {
+         struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+         struct llvmpipe_resource *lpr = llvmpipe_resource(transfer->resource);
+         const struct pipe_box *box = &transfer->box;
+         unsigned level = transfer->level;
+         unsigned bpp = util_format_get_blocksize(lpr->base.format);
+         unsigned z;
+
+         mtx_lock(&screen->tile_mutex);
+
+         for (z = 0; z < box->depth; z++) {
+            ubyte *image = llvmpipe_get_texture_image_address(lpr, box->z + z,
+                                                              level);
+            ubyte *src = (ubyte *) lpt->staging + z * transfer->layer_stride;
+
+            if (lpr->tiled) {
+               tiled_image_copy(image, lpr->row_stride[level],
+                                src, transfer->stride,
+                                box->x, box->y, box->width, box->height,
+                                bpp, TRUE);
+            }
+            else {
+               util_copy_rect(image, lpr->base.format, lpr->row_stride[level],
+                              box->x, box->y, box->width, box->height,
+                              src, transfer->stride, 0, 0);
+            }
+         }
+
+         mtx_unlock(&screen->tile_mutex);
+      }
+
+      FREE(lpt->staging);
+   }
+   else {
+      llvmpipe_resource_unmap(transfer->resource,
+                              transfer->level,
+                              transfer->box.z);
+   }
 
    /* Effectively do the texture_update work here - if texture images
     * needed post-processing to put them into hardware layout, this is
-    * where it would happen.  For llvmpipe, nothing to do.
+    * where it would happen.  Only tiled textures need any.
     */
    assert (transfer->resource);
    pipe_resource_reference(&transfer->resource, NULL);
    FREE(transfer);
 }
 
+/**
+ * Make dst use the storage of src, a buffer which the threaded context
+ * allocated to invalidate dst.  Both keep pointing to the same memory
+ * afterwards, since the threaded context keeps mapping src for
+ * unsynchronized transfers of dst.
+ */
+void
+llvmpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_resource *ldst = llvmpipe_resource(dst);
+   struct llvmpipe_resource *lsrc = llvmpipe_resource(src);
+   struct pipe_resource *old_storage = ldst->storage;
+   void *old_data = ldst->data;
+   unsigned sh, i;
+
+   assert(dst->target == PIPE_BUFFER && src->target == PIPE_BUFFER);
+   assert(!ldst->userBuffer && !lsrc->storage);
+
+   /* Queued scenes may still be reading the old storage. */
+   llvmpipe_flush_resource(pipe, dst, 0,
+                           FALSE, /* read_only */
+                           TRUE, /* cpu_access */
+                           FALSE, /* do_not_block */
+                           __FUNCTION__);
+
+   ldst->storage = NULL;
+   pipe_resource_reference(&ldst->storage, src);
+   ldst->data = lsrc->data;
+
+   /* Rebind everything which caches a pointer to the storage. */
+   for (sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
+      for (i = 0; i < ARRAY_SIZE(llvmpipe->constants[sh]); i++) {
+         if (llvmpipe->constants[sh][i].buffer == dst) {
+            struct pipe_constant_buffer cb = llvmpipe->constants[sh][i];
+            pipe->set_constant_buffer(pipe, sh, i, &cb);
+         }
+      }
+
+      for (i = 0; i < ARRAY_SIZE(llvmpipe->ssbos[sh]); i++) {
+         if (llvmpipe->ssbos[sh][i].buffer == dst) {
+            struct pipe_shader_buffer sb = llvmpipe->ssbos[sh][i];
+            pipe->set_shader_buffers(pipe, sh, i, 1, &sb, 0);
+         }
+      }
+
+      for (i = 0; i < llvmpipe->num_sampler_views[sh]; i++) {
+         if (llvmpipe->sampler_views[sh][i] &&
+             llvmpipe->sampler_views[sh][i]->texture == dst)
+            llvmpipe->dirty |= LP_NEW_SAMPLER_VIEW;
+      }
+   }
+
+   for (i = 0; i < llvmpipe->num_so_targets; i++) {
+      if (llvmpipe->so_targets[i] &&
+          llvmpipe->so_targets[i]->target.buffer == dst)
+         llvmpipe->so_targets[i]->mapping = ldst->data;
+   }
+
+   if (old_storage)
+      pipe_resource_reference(&old_storage, NULL);
+   else
+      align_free(old_data);
+}
+
+
 unsigned int
 llvmpipe_is_resource_referenced( struct pipe_context *pipe,
                                  struct pipe_resource *presource,
@@ -712,6 +1022,10 @@ llvmpipe_user_buffer_create(struct pipe_screen *screen,
    buffer->userBuffer = TRUE;
    buffer->data = ptr;
 
+   threaded_resource_init(&buffer->base);
+   buffer->threaded.is_user_ptr = true;
+   util_range_add(&buffer->threaded.valid_buffer_range, 0, bytes);
+
    return &buffer->base;
 }
 
@@ -748,6 +1062,74 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
 }
 
 
+/**
+ * Switch a tiled texture to the linear layout, for good.
+ *
+ * Needed before the texture gets rendered to, sampled by the draw module or
+ * viewed with a format of a different texel size.  The texels are copied to
+ * new storage rather than converted in place: scenes of any context which
+ * were set up before keep sampling the tiled storage, which lives on until
+ * the texture is destroyed.  Contexts notice the switch through the screen
+ * timestamp and pick the linear layout up at their next state validation.
+ */
+void
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(resource->screen);
+   struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+   unsigned bpp = util_format_get_blocksize(resource->format);
+   unsigned mip_align = MAX2(64, util_cpu_caps.cacheline);
+   unsigned last_level = resource->last_level;
+   unsigned size = lpr->mip_offsets[last_level] +
+                   lpr->img_stride[last_level] *
+                   util_num_layers(resource, last_level);
+   unsigned level, layer;
+   ubyte *linear;
+
+   if (!lpr->tiled)
+      return;
+
+   mtx_lock(&screen->tile_mutex);
+
+   /* Another context may have been faster */
+   if (!lpr->tiled) {
+      mtx_unlock(&screen->tile_mutex);
+      return;
+   }
+
+   linear = align_malloc(size, mip_align);
+   if (!linear) {
+      mtx_unlock(&screen->tile_mutex);
+      debug_printf("llvmpipe: out of memory for untiling a texture\n");
+      return;
+   }
+   memset(linear, 0, size);
+
+   for (level = 0; level <= resource->last_level; level++) {
+      unsigned width = u_minify(resource->width0, level);
+      unsigned height = u_minify(resource->height0, level);
+      unsigned row_stride = lpr->row_stride[level];
+
+      for (layer = 0; layer < util_num_layers(resource, level); layer++) {
+         ubyte *image = llvmpipe_get_texture_image_address(lpr, layer, level);
+
+         tiled_image_copy(image, row_stride,
+                          linear + (image - (ubyte *) lpr->tex_data),
+                          row_stride, 0, 0, width, height, bpp, FALSE);
+      }
+   }
+
+   lpr->tiled_data = lpr->tex_data;
+   lpr->tex_data = linear;
+   lpr->tiled = FALSE;
+
+   p_atomic_inc(&screen->timestamp);
+
+   mtx_unlock(&screen->tile_mutex);
+}
+
+
 /**
  * Return size of resource in bytes
  */
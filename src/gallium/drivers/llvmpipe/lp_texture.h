@@ -31,6 +31,7 @@
 
 #include "pipe/p_state.h"
 #include "util/u_debug.h"
+#include "util/u_threaded_context.h"
 #include "lp_limits.h"
 
 
@@ -58,7 +59,10 @@ struct sw_displaytarget;
  */
 struct llvmpipe_resource
 {
-   struct pipe_resource base;
+   union {
+      struct pipe_resource base;
+      struct threaded_resource threaded;
+   };
 
    /** Row stride in bytes */
    unsigned row_stride[LP_MAX_TEXTURE_LEVELS];
@@ -85,6 +89,26 @@ struct llvmpipe_resource
     */
    void *data;
 
+   /**
+    * The buffer which owns data above, if the threaded context replaced
+    * the original storage, see llvmpipe_replace_buffer_storage().
+    */
+   struct pipe_resource *storage;
+
+   /**
+    * Texels are stored in LP_SAMPLER_TILE_SIZE x LP_SAMPLER_TILE_SIZE tiles
+    * rather than linearly.  Only set for textures which are just sampled by
+    * fragment and compute shaders, see llvmpipe_resource_untile().
+    * Changes under the screen's tile_mutex.
+    */
+   boolean tiled;
+
+   /**
+    * Former tiled storage of an untiled texture, which scenes set up before
+    * the switch may still be sampling.
+    */
+   void *tiled_data;
+
    boolean userBuffer;  /** Is this a user-space buffer? */
    unsigned timestamp;
 
@@ -99,9 +123,15 @@ struct llvmpipe_resource
 
 struct llvmpipe_transfer
 {
-   struct pipe_transfer base;
+   union {
+      struct pipe_transfer base;
+      struct threaded_transfer threaded;
+   };
 
    unsigned long offset;
+
+   /** Linear copy of the mapped box of tiled textures */
+   void *staging;
 };
 
 
@@ -220,6 +250,17 @@ llvmpipe_get_texture_image_address(struct llvmpipe_resource *lpr,
                                    unsigned face_slice, unsigned level);
 
 
+void
+llvmpipe_resource_untile(struct pipe_context *pipe,
+                         struct pipe_resource *resource);
+
+
+void
+llvmpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src);
+
+
 extern void
 llvmpipe_print_resources(void);
 
@@ -1037,7 +1037,8 @@ radeonsi_screen_create_impl(struct radeon_winsys *ws,
 	if (!util_queue_init(&sscreen->shader_compiler_queue, "sh",
 			     64, num_comp_hi_threads,
 			     UTIL_QUEUE_INIT_RESIZE_IF_FULL |
-			     UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY)) {
+			     UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY |
+			     UTIL_QUEUE_INIT_SHARED_POOL)) {
 		si_destroy_shader_cache(sscreen);
 		FREE(sscreen);
 		return NULL;
@@ -38,6 +38,7 @@
 #include "sp_clear.h"
 #include "sp_context.h"
 #include "sp_query.h"
+#include "sp_rast_threads.h"
 #include "sp_tile_cache.h"
 
 
@@ -68,8 +69,12 @@ softpipe_clear(struct pipe_context *pipe, unsigned buffers,
 
    if (buffers & PIPE_CLEAR_COLOR) {
       for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++) {
-         if (buffers & (PIPE_CLEAR_COLOR0 << i))
+         if (buffers & (PIPE_CLEAR_COLOR0 << i)) {
             sp_tile_cache_clear(softpipe->cbuf_cache[i], color, 0);
+            if (softpipe->rast_threads)
+               sp_rast_threads_clear_tile_cache(softpipe->rast_threads,
+                                                i, color, 0);
+         }
       }
    }
 
@@ -85,6 +90,9 @@ softpipe_clear(struct pipe_context *pipe, unsigned buffers,
 
       cv = util_pack64_z_stencil(zsbuf->format, depth, stencil);
       sp_tile_cache_clear(softpipe->zsbuf_cache, &zero, cv);
+      if (softpipe->rast_threads)
+         sp_rast_threads_clear_tile_cache(softpipe->rast_threads,
+                                          PIPE_MAX_COLOR_BUFS, &zero, cv);
    }
 
    softpipe->dirty_render_cache = TRUE;
@@ -38,12 +38,14 @@
 #include "util/u_pstipple.h"
 #include "util/u_inlines.h"
 #include "util/u_upload_mgr.h"
+#include "util/u_threaded_context.h"
 #include "tgsi/tgsi_exec.h"
 #include "sp_buffer.h"
 #include "sp_clear.h"
 #include "sp_context.h"
 #include "sp_flush.h"
 #include "sp_prim_vbuf.h"
+#include "sp_rast_threads.h"
 #include "sp_state.h"
 #include "sp_surface.h"
 #include "sp_tile_cache.h"
@@ -53,6 +55,7 @@
 #include "sp_screen.h"
 #include "sp_tex_sample.h"
 #include "sp_image.h"
+#include "sp_limits.h"
 
 static void
 softpipe_destroy( struct pipe_context *pipe )
@@ -75,17 +78,10 @@ softpipe_destroy( struct pipe_context *pipe )
    if (softpipe->draw)
       draw_destroy( softpipe->draw );
 
-   if (softpipe->quad.shade)
-      softpipe->quad.shade->destroy( softpipe->quad.shade );
+   if (softpipe->rast_threads)
+      sp_rast_threads_destroy( softpipe->rast_threads );
 
-   if (softpipe->quad.depth_test)
-      softpipe->quad.depth_test->destroy( softpipe->quad.depth_test );
-
-   if (softpipe->quad.blend)
-      softpipe->quad.blend->destroy( softpipe->quad.blend );
-
-   if (softpipe->quad.pstipple)
-      softpipe->quad.pstipple->destroy( softpipe->quad.pstipple );
+   sp_destroy_quad_pipeline( &softpipe->quad );
 
    if (softpipe->pipe.stream_uploader)
       u_upload_destroy(softpipe->pipe.stream_uploader);
@@ -198,6 +194,7 @@ softpipe_create_context(struct pipe_screen *screen,
 {
    struct softpipe_screen *sp_screen = softpipe_screen(screen);
    struct softpipe_context *softpipe = CALLOC_STRUCT(softpipe_context);
+   unsigned num_threads;
    uint i, sh;
 
    util_init_math();
@@ -266,10 +263,24 @@ softpipe_create_context(struct pipe_screen *screen,
    softpipe->fs_machine = tgsi_exec_machine_create(PIPE_SHADER_FRAGMENT);
 
    /* setup quad rendering stages */
-   softpipe->quad.shade = sp_quad_shade_stage(softpipe);
-   softpipe->quad.depth_test = sp_quad_depth_test_stage(softpipe);
-   softpipe->quad.blend = sp_quad_blend_stage(softpipe);
-   softpipe->quad.pstipple = sp_quad_polygon_stipple_stage(softpipe);
+   if (!sp_init_quad_pipeline(&softpipe->quad, softpipe))
+      goto fail;
+   softpipe->quad.fs_machine = softpipe->fs_machine;
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
+      softpipe->quad.cbuf_cache[i] = softpipe->cbuf_cache[i];
+   softpipe->quad.zsbuf_cache = softpipe->zsbuf_cache;
+   softpipe->quad.occlusion_count = &softpipe->occlusion_count;
+   softpipe->quad.ps_invocations =
+      &softpipe->pipeline_statistics.ps_invocations;
+
+   /* hand quads to other threads? */
+   num_threads = debug_get_num_option("SOFTPIPE_NUM_THREADS", 0);
+   num_threads = MIN2(num_threads, SP_MAX_THREADS);
+   if (num_threads > 1) {
+      softpipe->rast_threads = sp_rast_threads_create(softpipe, num_threads);
+      if (!softpipe->rast_threads)
+         goto fail;
+   }
 
    softpipe->pipe.stream_uploader = u_upload_create_default(&softpipe->pipe);
    if (!softpipe->pipe.stream_uploader)
@@ -356,7 +367,16 @@ softpipe_create_context(struct pipe_screen *screen,
    softpipe->pstipple.sampler = util_pstipple_create_sampler(&softpipe->pipe);
 #endif
 
-   return &softpipe->pipe;
+   if (!(flags & PIPE_CONTEXT_PREFER_THREADED) ||
+       (flags & PIPE_CONTEXT_COMPUTE_ONLY) ||
+       !sp_screen->threaded)
+      return &softpipe->pipe;
+
+   /* There is no create_fence callback, so flushes are synchronous. */
+   return threaded_context_create(&softpipe->pipe,
+                                  &sp_screen->pool_transfers,
+                                  softpipe_replace_buffer_storage,
+                                  NULL, NULL);
 
  fail:
    softpipe_destroy(&softpipe->pipe);
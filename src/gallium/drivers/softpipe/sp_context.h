@@ -56,6 +56,7 @@ struct sp_fragment_shader;
 struct sp_vertex_shader;
 struct sp_velems_state;
 struct sp_so_state;
+struct sp_rast_threads;
 
 struct softpipe_context {
    struct pipe_context pipe;  /**< base class */
@@ -161,13 +162,10 @@ struct softpipe_context {
    } pstipple;
 
    /** Software quad rendering pipeline */
-   struct {
-      struct quad_stage *shade;
-      struct quad_stage *depth_test;
-      struct quad_stage *blend;
-      struct quad_stage *pstipple;
-      struct quad_stage *first; /**< points to one of the above stages */
-   } quad;
+   struct sp_quad_pipeline quad;
+
+   /** Threads running further quad pipelines, if any */
+   struct sp_rast_threads *rast_threads;
 
    /** TGSI exec things */
    struct {
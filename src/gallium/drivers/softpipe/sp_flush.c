@@ -35,6 +35,7 @@
 #include "draw/draw_context.h"
 #include "sp_flush.h"
 #include "sp_context.h"
+#include "sp_rast_threads.h"
 #include "sp_state.h"
 #include "sp_tile_cache.h"
 #include "sp_tex_tile_cache.h"
@@ -61,6 +62,9 @@ softpipe_flush( struct pipe_context *pipe,
             sp_flush_tex_tile_cache(softpipe->tex_cache[sh][i]);
          }
       }
+
+      if (softpipe->rast_threads)
+         sp_rast_threads_flush_tex_caches(softpipe->rast_threads);
    }
 
    /* If this is a swapbuffers, just flush color buffers.
@@ -75,6 +79,9 @@ softpipe_flush( struct pipe_context *pipe,
    if (softpipe->zsbuf_cache)
       sp_flush_tile_cache(softpipe->zsbuf_cache);
 
+   if (softpipe->rast_threads)
+      sp_rast_threads_flush_tile_caches(softpipe->rast_threads);
+
    softpipe->dirty_render_cache = FALSE;
 
    /* Enable to dump BMPs of the color/depth buffers each frame */
@@ -180,6 +187,9 @@ void softpipe_texture_barrier(struct pipe_context *pipe, unsigned flags)
       }
    }
 
+   if (softpipe->rast_threads)
+      sp_rast_threads_flush_tex_caches(softpipe->rast_threads);
+
    for (i = 0; i < softpipe->framebuffer.nr_cbufs; i++)
       if (softpipe->cbuf_cache[i])
          sp_flush_tile_cache(softpipe->cbuf_cache[i]);
@@ -187,6 +197,9 @@ void softpipe_texture_barrier(struct pipe_context *pipe, unsigned flags)
    if (softpipe->zsbuf_cache)
       sp_flush_tile_cache(softpipe->zsbuf_cache);
 
+   if (softpipe->rast_threads)
+      sp_rast_threads_flush_tile_caches(softpipe->rast_threads);
+
    softpipe->dirty_render_cache = FALSE;
 }
 
@@ -56,6 +56,14 @@
 #define MASK_ALL          0xf
 
 
+/**
+ * Max number of quads (2x2 pixel blocks) to process per batch.
+ * This can't be arbitrarily increased since we depend on some 32-bit
+ * bitmasks (two bits per quad).
+ */
+#define MAX_QUADS 16
+
+
 /**
  * Quad stage inputs (pos, coverage, front/back face, etc)
  */
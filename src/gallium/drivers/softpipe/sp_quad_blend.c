@@ -932,7 +932,7 @@ blend_fallback(struct quad_stage *qs,
          const uint blend_buf = blend->independent_blend_enable ? cbuf : 0;
          float dest[4][TGSI_QUAD_SIZE];
          struct softpipe_cached_tile *tile
-            = sp_get_cached_tile(softpipe->cbuf_cache[cbuf],
+            = sp_get_cached_tile(qs->pipeline->cbuf_cache[cbuf],
                                  quads[0]->input.x0, 
                                  quads[0]->input.y0, quads[0]->input.layer);
          const boolean clamp = bqs->clamp[cbuf];
@@ -1035,7 +1035,7 @@ blend_single_add_src_alpha_inv_src_alpha(struct quad_stage *qs,
    uint i, j, q;
 
    struct softpipe_cached_tile *tile
-      = sp_get_cached_tile(qs->softpipe->cbuf_cache[0],
+      = sp_get_cached_tile(qs->pipeline->cbuf_cache[0],
                            quads[0]->input.x0, 
                            quads[0]->input.y0, quads[0]->input.layer);
 
@@ -1109,7 +1109,7 @@ blend_single_add_one_one(struct quad_stage *qs,
    uint i, j, q;
 
    struct softpipe_cached_tile *tile
-      = sp_get_cached_tile(qs->softpipe->cbuf_cache[0],
+      = sp_get_cached_tile(qs->pipeline->cbuf_cache[0],
                            quads[0]->input.x0, 
                            quads[0]->input.y0, quads[0]->input.layer);
 
@@ -1177,7 +1177,7 @@ single_output_color(struct quad_stage *qs,
    uint i, j, q;
 
    struct softpipe_cached_tile *tile
-      = sp_get_cached_tile(qs->softpipe->cbuf_cache[0],
+      = sp_get_cached_tile(qs->pipeline->cbuf_cache[0],
                            quads[0]->input.x0, 
                            quads[0]->input.y0, quads[0]->input.layer);
 
@@ -1295,14 +1295,15 @@ static void blend_destroy(struct quad_stage *qs)
 }
 
 
-struct quad_stage *sp_quad_blend_stage( struct softpipe_context *softpipe )
+struct quad_stage *sp_quad_blend_stage( struct sp_quad_pipeline *qp )
 {
    struct blend_quad_stage *stage = CALLOC_STRUCT(blend_quad_stage);
 
    if (!stage)
       return NULL;
 
-   stage->base.softpipe = softpipe;
+   stage->base.softpipe = qp->softpipe;
+   stage->base.pipeline = qp;
    stage->base.begin = blend_begin;
    stage->base.run = choose_blend_quad;
    stage->base.destroy = blend_destroy;
@@ -800,7 +800,7 @@ depth_test_quads_fallback(struct quad_stage *qs,
 
       data.ps = qs->softpipe->framebuffer.zsbuf;
       data.format = data.ps->format;
-      data.tile = sp_get_cached_tile(qs->softpipe->zsbuf_cache, 
+      data.tile = sp_get_cached_tile(qs->pipeline->zsbuf_cache, 
                                      quads[0]->input.x0, 
                                      quads[0]->input.y0, quads[0]->input.layer);
       data.clamp = !qs->softpipe->rasterizer->depth_clip_near;
@@ -843,7 +843,7 @@ depth_test_quads_fallback(struct quad_stage *qs,
 
    if (qs->softpipe->active_query_count) {
       for (i = 0; i < nr; i++) 
-         qs->softpipe->occlusion_count += mask_count[quads[i]->inout.mask];
+         *qs->pipeline->occlusion_count += mask_count[quads[i]->inout.mask];
    }
 
    if (nr)
@@ -995,11 +995,12 @@ depth_test_destroy(struct quad_stage *qs)
 
 
 struct quad_stage *
-sp_quad_depth_test_stage(struct softpipe_context *softpipe)
+sp_quad_depth_test_stage(struct sp_quad_pipeline *qp)
 {
    struct quad_stage *stage = CALLOC_STRUCT(quad_stage);
 
-   stage->softpipe = softpipe;
+   stage->softpipe = qp->softpipe;
+   stage->pipeline = qp;
    stage->begin = depth_test_begin;
    stage->run = choose_depth_test;
    stage->destroy = depth_test_destroy;
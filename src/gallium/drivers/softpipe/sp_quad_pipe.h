@@ -31,9 +31,14 @@
 #ifndef SP_QUAD_PIPE_H
 #define SP_QUAD_PIPE_H
 
+#include "pipe/p_state.h"
+
 
 struct softpipe_context;
+struct softpipe_tile_cache;
+struct tgsi_exec_machine;
 struct quad_header;
+struct sp_quad_pipeline;
 
 
 /**
@@ -43,6 +48,7 @@ struct quad_header;
  */
 struct quad_stage {
    struct softpipe_context *softpipe;
+   struct sp_quad_pipeline *pipeline;  /**< the pipeline we belong to */
 
    struct quad_stage *next;
 
@@ -55,18 +61,47 @@ struct quad_stage {
 };
 
 
-struct quad_stage *sp_quad_polygon_stipple_stage( struct softpipe_context *softpipe );
+/**
+ * A quad pipeline and the per-pipeline objects its stages operate on.
+ * The context owns one; each rasterization thread (see sp_rast_threads.h)
+ * owns another, with its own interpreter and framebuffer tile caches.
+ */
+struct sp_quad_pipeline {
+   struct softpipe_context *softpipe;
+
+   struct quad_stage *shade;
+   struct quad_stage *depth_test;
+   struct quad_stage *blend;
+   struct quad_stage *pstipple;
+   struct quad_stage *first; /**< points to one of the above stages */
+
+   struct tgsi_exec_machine *fs_machine;
+
+   struct softpipe_tile_cache *cbuf_cache[PIPE_MAX_COLOR_BUFS];
+   struct softpipe_tile_cache *zsbuf_cache;
+
+   /** Where to accumulate query results */
+   uint64_t *occlusion_count;
+   uint64_t *ps_invocations;
+};
+
+
+struct quad_stage *sp_quad_polygon_stipple_stage( struct sp_quad_pipeline *qp );
 struct quad_stage *sp_quad_earlyz_stage( struct softpipe_context *softpipe );
-struct quad_stage *sp_quad_shade_stage( struct softpipe_context *softpipe );
+struct quad_stage *sp_quad_shade_stage( struct sp_quad_pipeline *qp );
 struct quad_stage *sp_quad_alpha_test_stage( struct softpipe_context *softpipe );
 struct quad_stage *sp_quad_stencil_test_stage( struct softpipe_context *softpipe );
-struct quad_stage *sp_quad_depth_test_stage( struct softpipe_context *softpipe );
+struct quad_stage *sp_quad_depth_test_stage( struct sp_quad_pipeline *qp );
 struct quad_stage *sp_quad_occlusion_stage( struct softpipe_context *softpipe );
 struct quad_stage *sp_quad_coverage_stage( struct softpipe_context *softpipe );
-struct quad_stage *sp_quad_blend_stage( struct softpipe_context *softpipe );
+struct quad_stage *sp_quad_blend_stage( struct sp_quad_pipeline *qp );
 struct quad_stage *sp_quad_colormask_stage( struct softpipe_context *softpipe );
 struct quad_stage *sp_quad_output_stage( struct softpipe_context *softpipe );
 
-void sp_build_quad_pipeline(struct softpipe_context *sp);
+boolean sp_init_quad_pipeline(struct sp_quad_pipeline *qp,
+                              struct softpipe_context *sp);
+void sp_destroy_quad_pipeline(struct sp_quad_pipeline *qp);
+void sp_build_quad_pipeline(struct softpipe_context *sp,
+                            struct sp_quad_pipeline *qp);
 
 #endif /* SP_QUAD_PIPE_H */
@@ -68,11 +68,12 @@ static void stipple_destroy(struct quad_stage *qs)
 
 
 struct quad_stage *
-sp_quad_polygon_stipple_stage( struct softpipe_context *softpipe )
+sp_quad_polygon_stipple_stage( struct sp_quad_pipeline *qp )
 {
    struct quad_stage *stage = CALLOC_STRUCT(quad_stage);
 
-   stage->softpipe = softpipe;
+   stage->softpipe = qp->softpipe;
+   stage->pipeline = qp;
    stage->begin = stipple_begin;
    stage->run = stipple_quad;
    stage->destroy = stipple_destroy;
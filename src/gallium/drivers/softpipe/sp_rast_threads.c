@@ -0,0 +1,660 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/**
+ * Multithreaded quad processing.
+ *
+ * Setup records the quads of each thread, along with the interpolation
+ * coefficients of the primitives they belong to, into command chunks.
+ * Every thread has two chunks: one is recorded while the other one runs
+ * on the queue, so a thread's quads are always processed in order.
+ *
+ * The first thread runs the context's own quad pipeline, which uses the
+ * context's interpreter, sampler and tile caches.  The other threads get
+ * private copies of these, refreshed whenever the derived state changes.
+ */
+
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_queue.h"
+#include "tgsi/tgsi_exec.h"
+#include "sp_context.h"
+#include "sp_quad.h"
+#include "sp_quad_pipe.h"
+#include "sp_rast_threads.h"
+#include "sp_state.h"
+#include "sp_tex_sample.h"
+#include "sp_tex_tile_cache.h"
+#include "sp_texture.h"
+#include "sp_tile_cache.h"
+
+
+#define SP_RAST_CHUNK_SIZE (64 * 1024)
+
+
+enum sp_rast_cmd_type {
+   SP_RAST_CMD_PRIM,
+   SP_RAST_CMD_QUADS,
+};
+
+
+struct sp_rast_cmd_header {
+   unsigned type;  /**< SP_RAST_CMD_x */
+   unsigned size;  /**< in bytes, including the header */
+};
+
+
+/** The coefficients of the quads following this command */
+struct sp_rast_cmd_prim {
+   struct sp_rast_cmd_header header;
+   struct tgsi_interp_coef posCoef;
+   struct tgsi_interp_coef coef[];
+};
+
+
+struct sp_rast_cmd_quad {
+   struct quad_header_input input;
+   unsigned mask;
+};
+
+
+/** A batch of quads, all within the same tile */
+struct sp_rast_cmd_quads {
+   struct sp_rast_cmd_header header;
+   unsigned nr;
+   struct sp_rast_cmd_quad quad[];
+};
+
+
+struct sp_rast_chunk {
+   struct sp_rast_thread *thread;
+   struct util_queue_fence fence;
+   unsigned used;  /**< bytes of data recorded */
+   uint64_t data[SP_RAST_CHUNK_SIZE / sizeof(uint64_t)];
+};
+
+
+struct sp_rast_thread {
+   struct sp_quad_pipeline *pipeline;  /**< the context's one, or &quad */
+
+   /* The following are unused by the first thread */
+   struct sp_quad_pipeline quad;
+   struct sp_tgsi_sampler *sampler;
+   struct softpipe_tex_tile_cache *tex_cache[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   uint64_t occlusion_count;
+   uint64_t ps_invocations;
+
+   struct sp_rast_chunk chunk[2];
+   unsigned cur;  /**< index of the chunk being recorded */
+
+   /** The primitive whose coefficients the current chunk holds, if any */
+   boolean has_prim;
+   unsigned prim;
+
+   struct quad_header quads[MAX_QUADS];
+   struct quad_header *quad_ptrs[MAX_QUADS];
+};
+
+
+struct sp_rast_threads {
+   struct softpipe_context *softpipe;
+   struct util_queue queue;
+   unsigned num_threads;
+   struct sp_rast_thread **thread;
+};
+
+
+/**
+ * Process the commands of a chunk.
+ * Called via util_queue.
+ */
+static void
+rast_chunk_execute(void *data, int thread_index)
+{
+   struct sp_rast_chunk *chunk = (struct sp_rast_chunk *) data;
+   struct sp_rast_thread *thread = chunk->thread;
+   struct quad_stage *first = thread->pipeline->first;
+   const struct sp_rast_cmd_prim *prim = NULL;
+   const ubyte *ptr = (const ubyte *) chunk->data;
+   const ubyte *end = ptr + chunk->used;
+
+   while (ptr < end) {
+      const struct sp_rast_cmd_header *header =
+         (const struct sp_rast_cmd_header *) ptr;
+
+      if (header->type == SP_RAST_CMD_PRIM) {
+         prim = (const struct sp_rast_cmd_prim *) header;
+      }
+      else {
+         const struct sp_rast_cmd_quads *cmd =
+            (const struct sp_rast_cmd_quads *) header;
+         unsigned i;
+
+         assert(header->type == SP_RAST_CMD_QUADS);
+         assert(prim);
+
+         for (i = 0; i < cmd->nr; i++) {
+            struct quad_header *quad = &thread->quads[i];
+
+            quad->input = cmd->quad[i].input;
+            quad->inout.mask = cmd->quad[i].mask;
+            quad->posCoef = &prim->posCoef;
+            quad->coef = prim->coef;
+            thread->quad_ptrs[i] = quad;
+         }
+
+         first->run(first, thread->quad_ptrs, cmd->nr);
+      }
+
+      ptr += header->size;
+   }
+}
+
+
+/**
+ * Queue the chunk being recorded and switch to the other one.
+ */
+static void
+rast_thread_submit(struct sp_rast_threads *threads,
+                   struct sp_rast_thread *thread)
+{
+   struct sp_rast_chunk *chunk = &thread->chunk[thread->cur];
+   struct sp_rast_chunk *other = &thread->chunk[!thread->cur];
+
+   if (!chunk->used)
+      return;
+
+   /* The previous chunk must be done before this one may start, and
+    * before we can record into it again.
+    */
+   util_queue_fence_wait(&other->fence);
+
+   util_queue_add_job(&threads->queue, chunk, &chunk->fence,
+                      rast_chunk_execute, NULL);
+
+   thread->cur = !thread->cur;
+   other->used = 0;
+   thread->has_prim = FALSE;
+}
+
+
+static void *
+rast_thread_alloc_cmd(struct sp_rast_chunk *chunk,
+                      enum sp_rast_cmd_type type, unsigned size)
+{
+   struct sp_rast_cmd_header *header =
+      (struct sp_rast_cmd_header *) ((ubyte *) chunk->data + chunk->used);
+
+   assert(chunk->used + size <= SP_RAST_CHUNK_SIZE);
+
+   header->type = type;
+   header->size = size;
+   chunk->used += size;
+
+   return header;
+}
+
+
+/**
+ * Hand a batch of quads of the given primitive to the thread owning the
+ * tile they lie in.  The quads all share the coefficients of quads[0].
+ */
+void
+sp_rast_threads_run(struct sp_rast_threads *threads,
+                    unsigned prim,
+                    struct quad_header *quads[],
+                    unsigned nr)
+{
+   const struct quad_header *quad0 = quads[0];
+   const union tile_address addr =
+      tile_address(quad0->input.x0, quad0->input.y0, quad0->input.layer);
+   struct sp_rast_thread *thread =
+      threads->thread[sp_tile_thread(addr, threads->num_threads)];
+   const unsigned num_coefs = threads->softpipe->fs_variant->info.num_inputs;
+   const unsigned prim_size =
+      align(sizeof(struct sp_rast_cmd_prim) +
+            num_coefs * sizeof(struct tgsi_interp_coef), 8);
+   const unsigned quads_size =
+      align(sizeof(struct sp_rast_cmd_quads) +
+            nr * sizeof(struct sp_rast_cmd_quad), 8);
+   struct sp_rast_chunk *chunk = &thread->chunk[thread->cur];
+   struct sp_rast_cmd_quads *cmd;
+   unsigned i;
+
+   assert(nr <= MAX_QUADS);
+
+   if (chunk->used + prim_size + quads_size > SP_RAST_CHUNK_SIZE) {
+      rast_thread_submit(threads, thread);
+      chunk = &thread->chunk[thread->cur];
+   }
+
+   /* Only record the coefficients once per primitive and chunk */
+   if (!thread->has_prim || thread->prim != prim) {
+      struct sp_rast_cmd_prim *cmd_prim =
+         rast_thread_alloc_cmd(chunk, SP_RAST_CMD_PRIM, prim_size);
+
+      cmd_prim->posCoef = *quad0->posCoef;
+      memcpy(cmd_prim->coef, quad0->coef,
+             num_coefs * sizeof(struct tgsi_interp_coef));
+
+      thread->has_prim = TRUE;
+      thread->prim = prim;
+   }
+
+   cmd = rast_thread_alloc_cmd(chunk, SP_RAST_CMD_QUADS, quads_size);
+   cmd->nr = nr;
+   for (i = 0; i < nr; i++) {
+      cmd->quad[i].input = quads[i]->input;
+      cmd->quad[i].mask = quads[i]->inout.mask;
+   }
+}
+
+
+/**
+ * Wait until the threads have processed all the quads handed to them.
+ */
+void
+sp_rast_threads_finish(struct sp_rast_threads *threads)
+{
+   struct softpipe_context *sp = threads->softpipe;
+   unsigned t;
+
+   for (t = 0; t < threads->num_threads; t++)
+      rast_thread_submit(threads, threads->thread[t]);
+
+   for (t = 0; t < threads->num_threads; t++) {
+      struct sp_rast_thread *thread = threads->thread[t];
+
+      util_queue_fence_wait(&thread->chunk[0].fence);
+      util_queue_fence_wait(&thread->chunk[1].fence);
+
+      sp->occlusion_count += thread->occlusion_count;
+      sp->pipeline_statistics.ps_invocations += thread->ps_invocations;
+      thread->occlusion_count = 0;
+      thread->ps_invocations = 0;
+   }
+}
+
+
+/**
+ * Mirror the context's fragment sampler state into a thread's sampler,
+ * with the thread's own texture caches.
+ */
+static void
+rast_thread_update_samplers(struct sp_rast_thread *thread,
+                            struct softpipe_context *sp)
+{
+   const struct sp_tgsi_sampler *sampler =
+      sp->tgsi.sampler[PIPE_SHADER_FRAGMENT];
+   unsigned i;
+
+   for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+      struct softpipe_tex_tile_cache *tc = thread->tex_cache[i];
+
+      sp_tex_tile_cache_set_sampler_view(tc,
+            sp->sampler_views[PIPE_SHADER_FRAGMENT][i]);
+
+      if (tc->texture) {
+         struct softpipe_resource *spt = softpipe_resource(tc->texture);
+         if (spt->timestamp != tc->timestamp) {
+            sp_tex_tile_cache_validate_texture(tc);
+            tc->timestamp = spt->timestamp;
+         }
+      }
+   }
+
+   memcpy(thread->sampler->sp_sampler, sampler->sp_sampler,
+          sizeof(sampler->sp_sampler));
+   memcpy(thread->sampler->sp_sview, sampler->sp_sview,
+          sizeof(sampler->sp_sview));
+
+   for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+      if (thread->sampler->sp_sview[i].cache)
+         thread->sampler->sp_sview[i].cache = thread->tex_cache[i];
+   }
+}
+
+
+/**
+ * Bring the threads' quad pipelines in line with the context's one after
+ * softpipe_update_derived() validated the state flagged in dirty.
+ */
+void
+sp_rast_threads_update_derived(struct sp_rast_threads *threads,
+                               unsigned dirty)
+{
+   struct softpipe_context *sp = threads->softpipe;
+   unsigned t;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      struct sp_rast_thread *thread = threads->thread[t];
+
+      if (dirty & (SP_NEW_SAMPLER |
+                   SP_NEW_TEXTURE |
+                   SP_NEW_FS |
+                   SP_NEW_VS))
+         rast_thread_update_samplers(thread, sp);
+
+      if (sp->fs_variant &&
+          thread->quad.fs_machine->Tokens != sp->fs_variant->tokens) {
+         sp->fs_variant->prepare(sp->fs_variant,
+                                 thread->quad.fs_machine,
+                                 (struct tgsi_sampler *) thread->sampler,
+                                 (struct tgsi_image *)
+                                    sp->tgsi.image[PIPE_SHADER_FRAGMENT],
+                                 (struct tgsi_buffer *)
+                                    sp->tgsi.buffer[PIPE_SHADER_FRAGMENT]);
+      }
+
+      if (dirty & (SP_NEW_BLEND |
+                   SP_NEW_DEPTH_STENCIL_ALPHA |
+                   SP_NEW_FRAMEBUFFER |
+                   SP_NEW_STIPPLE |
+                   SP_NEW_FS))
+         sp_build_quad_pipeline(sp, &thread->quad);
+   }
+}
+
+
+/**
+ * Per-primitive-type setup of the threads' quad pipelines.
+ */
+void
+sp_rast_threads_begin(struct sp_rast_threads *threads)
+{
+   unsigned t;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      struct quad_stage *first = threads->thread[t]->quad.first;
+      first->begin(first);
+   }
+}
+
+
+/**
+ * Make sure no thread's interpreter refers to a variant being deleted.
+ */
+void
+sp_rast_threads_unbind_fs_variant(struct sp_rast_threads *threads,
+                                  const struct sp_fragment_shader_variant *var)
+{
+   unsigned t;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      struct tgsi_exec_machine *machine = threads->thread[t]->quad.fs_machine;
+
+      if (machine->Tokens == var->tokens)
+         tgsi_exec_machine_bind_shader(machine, NULL, NULL, NULL, NULL);
+   }
+}
+
+
+/**
+ * Point the threads' tile caches at the surfaces of a new framebuffer,
+ * flushing the old ones.
+ */
+void
+sp_rast_threads_set_framebuffer(struct sp_rast_threads *threads,
+                                const struct pipe_framebuffer_state *fb)
+{
+   unsigned t, i;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      struct sp_quad_pipeline *qp = &threads->thread[t]->quad;
+
+      for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+         struct pipe_surface *cb = i < fb->nr_cbufs ? fb->cbufs[i] : NULL;
+
+         if (sp_tile_cache_get_surface(qp->cbuf_cache[i]) != cb) {
+            sp_flush_tile_cache(qp->cbuf_cache[i]);
+            sp_tile_cache_set_surface(qp->cbuf_cache[i], cb);
+         }
+      }
+
+      if (sp_tile_cache_get_surface(qp->zsbuf_cache) != fb->zsbuf) {
+         sp_flush_tile_cache(qp->zsbuf_cache);
+         sp_tile_cache_set_surface(qp->zsbuf_cache, fb->zsbuf);
+      }
+   }
+}
+
+
+/**
+ * Clear the threads' tiles of a color buffer, or of the depth/stencil
+ * buffer if buf is PIPE_MAX_COLOR_BUFS.
+ */
+void
+sp_rast_threads_clear_tile_cache(struct sp_rast_threads *threads,
+                                 unsigned buf,
+                                 const union pipe_color_union *color,
+                                 uint64_t clearValue)
+{
+   unsigned t;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      struct sp_quad_pipeline *qp = &threads->thread[t]->quad;
+
+      if (buf < PIPE_MAX_COLOR_BUFS)
+         sp_tile_cache_clear(qp->cbuf_cache[buf], color, clearValue);
+      else
+         sp_tile_cache_clear(qp->zsbuf_cache, color, clearValue);
+   }
+}
+
+
+/**
+ * Write the threads' tiles back to the framebuffer surfaces.
+ */
+void
+sp_rast_threads_flush_tile_caches(struct sp_rast_threads *threads)
+{
+   struct softpipe_context *sp = threads->softpipe;
+   unsigned t, i;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      struct sp_quad_pipeline *qp = &threads->thread[t]->quad;
+
+      for (i = 0; i < sp->framebuffer.nr_cbufs; i++)
+         sp_flush_tile_cache(qp->cbuf_cache[i]);
+
+      sp_flush_tile_cache(qp->zsbuf_cache);
+   }
+}
+
+
+void
+sp_rast_threads_flush_tex_caches(struct sp_rast_threads *threads)
+{
+   struct softpipe_context *sp = threads->softpipe;
+   unsigned t, i;
+
+   for (t = 1; t < threads->num_threads; t++) {
+      for (i = 0; i < sp->num_sampler_views[PIPE_SHADER_FRAGMENT]; i++)
+         sp_flush_tex_tile_cache(threads->thread[t]->tex_cache[i]);
+   }
+}
+
+
+static void
+rast_thread_destroy(struct sp_rast_thread *thread)
+{
+   unsigned i;
+
+   util_queue_fence_destroy(&thread->chunk[0].fence);
+   util_queue_fence_destroy(&thread->chunk[1].fence);
+
+   if (thread->pipeline == &thread->quad) {
+      sp_destroy_quad_pipeline(&thread->quad);
+
+      for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
+         sp_destroy_tile_cache(thread->quad.cbuf_cache[i]);
+      sp_destroy_tile_cache(thread->quad.zsbuf_cache);
+
+      for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++)
+         sp_destroy_tex_tile_cache(thread->tex_cache[i]);
+
+      if (thread->quad.fs_machine)
+         tgsi_exec_machine_destroy(thread->quad.fs_machine);
+
+      FREE(thread->sampler);
+   }
+
+   FREE(thread);
+}
+
+
+static struct sp_rast_thread *
+rast_thread_create(struct softpipe_context *sp,
+                   unsigned index, unsigned num_threads)
+{
+   struct sp_rast_thread *thread;
+   struct sp_quad_pipeline *qp;
+   unsigned i;
+
+   thread = CALLOC_STRUCT(sp_rast_thread);
+   if (!thread)
+      return NULL;
+
+   for (i = 0; i < 2; i++) {
+      thread->chunk[i].thread = thread;
+      util_queue_fence_init(&thread->chunk[i].fence);
+   }
+
+   if (index == 0) {
+      /* The first thread uses the context's pipeline */
+      thread->pipeline = &sp->quad;
+      return thread;
+   }
+
+   thread->pipeline = qp = &thread->quad;
+
+   if (!sp_init_quad_pipeline(qp, sp))
+      goto fail;
+
+   qp->fs_machine = tgsi_exec_machine_create(PIPE_SHADER_FRAGMENT);
+   if (!qp->fs_machine)
+      goto fail;
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++) {
+      qp->cbuf_cache[i] = sp_create_tile_cache(&sp->pipe);
+      if (!qp->cbuf_cache[i])
+         goto fail;
+      qp->cbuf_cache[i]->thread = index;
+      qp->cbuf_cache[i]->num_threads = num_threads;
+   }
+
+   qp->zsbuf_cache = sp_create_tile_cache(&sp->pipe);
+   if (!qp->zsbuf_cache)
+      goto fail;
+   qp->zsbuf_cache->thread = index;
+   qp->zsbuf_cache->num_threads = num_threads;
+
+   qp->occlusion_count = &thread->occlusion_count;
+   qp->ps_invocations = &thread->ps_invocations;
+
+   thread->sampler = sp_create_tgsi_sampler();
+   if (!thread->sampler)
+      goto fail;
+
+   for (i = 0; i < PIPE_MAX_SHADER_SAMPLER_VIEWS; i++) {
+      thread->tex_cache[i] = sp_create_tex_tile_cache(&sp->pipe);
+      if (!thread->tex_cache[i])
+         goto fail;
+   }
+
+   return thread;
+
+fail:
+   rast_thread_destroy(thread);
+   return NULL;
+}
+
+
+/**
+ * Create num_threads rasterization threads, the first of which takes
+ * over the context's quad pipeline.
+ */
+struct sp_rast_threads *
+sp_rast_threads_create(struct softpipe_context *sp, unsigned num_threads)
+{
+   struct sp_rast_threads *threads;
+   unsigned t, i;
+
+   assert(num_threads > 1);
+
+   threads = CALLOC_STRUCT(sp_rast_threads);
+   if (!threads)
+      return NULL;
+
+   threads->softpipe = sp;
+   threads->num_threads = num_threads;
+
+   threads->thread = CALLOC(num_threads, sizeof(threads->thread[0]));
+   if (!threads->thread)
+      goto fail;
+
+   for (t = 0; t < num_threads; t++) {
+      threads->thread[t] = rast_thread_create(sp, t, num_threads);
+      if (!threads->thread[t])
+         goto fail;
+   }
+
+   /* At most two chunks of every thread are ever queued */
+   if (!util_queue_init(&threads->queue, "sprast", 2 * num_threads,
+                        num_threads, 0))
+      goto fail;
+
+   for (i = 0; i < PIPE_MAX_COLOR_BUFS; i++)
+      sp->cbuf_cache[i]->num_threads = num_threads;
+   sp->zsbuf_cache->num_threads = num_threads;
+
+   return threads;
+
+fail:
+   sp_rast_threads_destroy(threads);
+   return NULL;
+}
+
+
+void
+sp_rast_threads_destroy(struct sp_rast_threads *threads)
+{
+   unsigned t;
+
+   if (util_queue_is_initialized(&threads->queue))
+      util_queue_destroy(&threads->queue);
+
+   if (threads->thread) {
+      for (t = 0; t < threads->num_threads; t++) {
+         if (threads->thread[t])
+            rast_thread_destroy(threads->thread[t]);
+      }
+      FREE(threads->thread);
+   }
+
+   FREE(threads);
+}
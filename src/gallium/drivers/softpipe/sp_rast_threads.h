@@ -0,0 +1,98 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDERS, AUTHORS AND/OR ITS SUPPLIERS BE LIABLE FOR ANY CLAIM,
+ * DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR
+ * OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE
+ * USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ **************************************************************************/
+
+/**
+ * Multithreaded quad processing.
+ *
+ * The framebuffer tiles are split between a number of threads, each running
+ * its own quad pipeline (shading, depth/stencil testing, blending) with its
+ * own interpreter and tile caches.  Setup keeps running on the context's
+ * thread and hands every batch of quads to the thread owning the tile it
+ * lies in, see sp_tile_thread().
+ *
+ * The threads only run while the vbuf code is rasterizing primitives, so
+ * the rest of the driver never sees them busy.
+ */
+
+#ifndef SP_RAST_THREADS_H
+#define SP_RAST_THREADS_H
+
+#include "pipe/p_compiler.h"
+
+
+struct softpipe_context;
+struct sp_fragment_shader_variant;
+struct sp_rast_threads;
+struct quad_header;
+struct pipe_framebuffer_state;
+union pipe_color_union;
+
+
+struct sp_rast_threads *
+sp_rast_threads_create(struct softpipe_context *sp, unsigned num_threads);
+
+void
+sp_rast_threads_destroy(struct sp_rast_threads *threads);
+
+void
+sp_rast_threads_update_derived(struct sp_rast_threads *threads,
+                               unsigned dirty);
+
+void
+sp_rast_threads_begin(struct sp_rast_threads *threads);
+
+void
+sp_rast_threads_run(struct sp_rast_threads *threads,
+                    unsigned prim,
+                    struct quad_header *quads[],
+                    unsigned nr);
+
+void
+sp_rast_threads_finish(struct sp_rast_threads *threads);
+
+void
+sp_rast_threads_unbind_fs_variant(struct sp_rast_threads *threads,
+                                  const struct sp_fragment_shader_variant *var);
+
+void
+sp_rast_threads_set_framebuffer(struct sp_rast_threads *threads,
+                                const struct pipe_framebuffer_state *fb);
+
+void
+sp_rast_threads_clear_tile_cache(struct sp_rast_threads *threads,
+                                 unsigned buf,
+                                 const union pipe_color_union *color,
+                                 uint64_t clearValue);
+
+void
+sp_rast_threads_flush_tile_caches(struct sp_rast_threads *threads);
+
+void
+sp_rast_threads_flush_tex_caches(struct sp_rast_threads *threads);
+
+
+#endif /* SP_RAST_THREADS_H */
@@ -170,6 +170,7 @@ softpipe_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_COMPUTE:
       return 1;
    case PIPE_CAP_USER_VERTEX_BUFFERS:
+      return !sp_screen->threaded;
    case PIPE_CAP_STREAM_OUTPUT_PAUSE_RESUME:
    case PIPE_CAP_STREAM_OUTPUT_INTERLEAVE_BUFFERS:
    case PIPE_CAP_TGSI_VS_LAYER_VIEWPORT:
@@ -511,6 +512,8 @@ softpipe_destroy_screen( struct pipe_screen *screen )
    if(winsys->destroy)
       winsys->destroy(winsys);
 
+   slab_destroy_parent(&sp_screen->pool_transfers);
+
    FREE(screen);
 }
 
@@ -621,8 +624,14 @@ softpipe_create_screen(struct sw_winsys *winsys)
    screen->base.get_compute_param = softpipe_get_compute_param;
    screen->use_llvm = debug_get_option_use_llvm();
 
+   /* Off unless asked for. */
+   screen->threaded = debug_get_bool_option("GALLIUM_THREAD", FALSE);
+
    softpipe_init_screen_texture_funcs(&screen->base);
    softpipe_init_screen_fence_funcs(&screen->base);
 
+   slab_create_parent(&screen->pool_transfers,
+                      sizeof(struct softpipe_transfer), 64);
+
    return &screen->base;
 }
@@ -33,6 +33,7 @@
 
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
+#include "util/slab.h"
 
 
 struct sw_winsys;
@@ -47,6 +48,14 @@ struct softpipe_screen {
     */
    unsigned timestamp;
    boolean use_llvm;
+
+   /* Whether contexts are wrapped in the threaded context, which doesn't
+    * take user vertex buffers.
+    */
+   boolean threaded;
+
+   /* Transfers allocated by the threaded contexts. */
+   struct slab_parent_pool pool_transfers;
 };
 
 static inline struct softpipe_screen *
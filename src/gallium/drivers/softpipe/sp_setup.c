@@ -35,6 +35,7 @@
 #include "sp_context.h"
 #include "sp_quad.h"
 #include "sp_quad_pipe.h"
+#include "sp_rast_threads.h"
 #include "sp_setup.h"
 #include "sp_state.h"
 #include "draw/draw_context.h"
@@ -59,14 +60,6 @@ struct edge {
 };
 
 
-/**
- * Max number of quads (2x2 pixel blocks) to process per batch.
- * This can't be arbitrarily increased since we depend on some 32-bit
- * bitmasks (two bits per quad).
- */
-#define MAX_QUADS 16
-
-
 /**
  * Triangle setup info.
  * Also used for line drawing (taking some liberties).
@@ -99,6 +92,7 @@ struct setup_context {
 
    struct tgsi_interp_coef coef[PIPE_MAX_SHADER_INPUTS];
    struct tgsi_interp_coef posCoef;  /* For Z, W */
+   unsigned prim_serial;  /**< bumped whenever the above change */
 
    struct {
       int left[2];   /**< [0] = row0, [1] = row1 */
@@ -121,6 +115,23 @@ struct setup_context {
 
 
 
+/**
+ * Pass a batch of quads to the quad pipeline, or to the thread handling
+ * the tile they lie in.
+ */
+static inline void
+run_quads(struct setup_context *setup, struct quad_header *quads[],
+          unsigned nr)
+{
+   struct softpipe_context *sp = setup->softpipe;
+
+   if (sp->rast_threads)
+      sp_rast_threads_run(sp->rast_threads, setup->prim_serial, quads, nr);
+   else
+      sp->quad.first->run( sp->quad.first, quads, nr );
+}
+
+
 /**
  * Clip setup->quad against the scissor/surface bounds.
  */
@@ -162,13 +173,11 @@ clip_emit_quad(struct setup_context *setup, struct quad_header *quad)
    quad_clip(setup, quad);
 
    if (quad->inout.mask) {
-      struct softpipe_context *sp = setup->softpipe;
-
 #if DEBUG_FRAGS
       setup->numFragsEmitted += util_bitcount(quad->inout.mask);
 #endif
 
-      sp->quad.first->run( sp->quad.first, &quad, 1 );
+      run_quads( setup, &quad, 1 );
    }
 }
 
@@ -203,7 +212,6 @@ flush_spans(struct setup_context *setup)
    const int xleft1 = setup->span.left[1];
    const int xright0 = setup->span.right[0];
    const int xright1 = setup->span.right[1];
-   struct quad_stage *pipe = setup->softpipe->quad.first;
 
    const int minleft = block_x(MIN2(xleft0, xleft1));
    const int maxright = MAX2(xright0, xright1);
@@ -248,7 +256,7 @@ flush_spans(struct setup_context *setup)
             lx += 2;
          } while (mask0 | mask1);
 
-         pipe->run( pipe, setup->quad_ptrs, q );
+         run_quads( setup, setup->quad_ptrs, q );
       }
    }
 
@@ -593,6 +601,9 @@ setup_tri_coefficients(struct setup_context *setup)
 
    assert(sinfo->valid);
 
+   /* new coefficients, see run_quads() */
+   setup->prim_serial++;
+
    /* z and w are done by linear interpolation:
     */
    v[0] = setup->vmin[0][2];
@@ -981,6 +992,9 @@ setup_line_coefficients(struct setup_context *setup,
       return FALSE;
    setup->oneoverarea = 1.0f / area;
 
+   /* new coefficients, see run_quads() */
+   setup->prim_serial++;
+
    /* z and w are done by linear interpolation:
     */
    v[0] = setup->vmin[0][2];
@@ -1275,6 +1289,9 @@ sp_setup_point(struct setup_context *setup,
     */
    setup->vprovoke = v0;
 
+   /* new coefficients, see run_quads() */
+   setup->prim_serial++;
+
    /* setup Z, W */
    const_coeff(setup, &setup->posCoef, 0, 2);
    const_coeff(setup, &setup->posCoef, 0, 3);
@@ -1478,6 +1495,8 @@ sp_setup_prepare(struct setup_context *setup)
    setup->max_layer = max_layer;
 
    sp->quad.first->begin( sp->quad.first );
+   if (sp->rast_threads)
+      sp_rast_threads_begin( sp->rast_threads );
 
    if (sp->reduced_api_prim == PIPE_PRIM_TRIANGLES &&
        sp->rasterizer->fill_front == PIPE_POLYGON_MODE_FILL &&
@@ -1492,6 +1511,19 @@ sp_setup_prepare(struct setup_context *setup)
 }
 
 
+/**
+ * Called by vbuf code once it has set up all the primitives it was given.
+ */
+void
+sp_setup_finish(struct setup_context *setup)
+{
+   struct softpipe_context *sp = setup->softpipe;
+
+   if (sp->rast_threads)
+      sp_rast_threads_finish( sp->rast_threads );
+}
+
+
 void
 sp_setup_destroy_context(struct setup_context *setup)
 {
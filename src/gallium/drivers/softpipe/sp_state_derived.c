@@ -33,6 +33,7 @@
 #include "draw/draw_context.h"
 #include "draw/draw_vertex.h"
 #include "sp_context.h"
+#include "sp_rast_threads.h"
 #include "sp_screen.h"
 #include "sp_state.h"
 #include "sp_texture.h"
@@ -481,7 +482,10 @@ softpipe_update_derived(struct softpipe_context *softpipe, unsigned prim)
                           SP_NEW_FRAMEBUFFER |
                           SP_NEW_STIPPLE |
                           SP_NEW_FS))
-      sp_build_quad_pipeline(softpipe);
+      sp_build_quad_pipeline(softpipe, &softpipe->quad);
+
+   if (softpipe->rast_threads)
+      sp_rast_threads_update_derived(softpipe->rast_threads, softpipe->dirty);
 
    softpipe->dirty = 0;
 }
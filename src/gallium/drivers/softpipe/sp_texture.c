@@ -31,6 +31,7 @@
   */
 
 #include "pipe/p_defines.h"
+#include "draw/draw_context.h"
 #include "util/u_inlines.h"
 
 #include "util/u_format.h"
@@ -43,6 +44,7 @@
 #include "sp_flush.h"
 #include "sp_texture.h"
 #include "sp_screen.h"
+#include "sp_state.h"
 
 #include "state_tracker/sw_winsys.h"
 
@@ -165,6 +167,7 @@ softpipe_resource_create_front(struct pipe_screen *screen,
    spr->base = *templat;
    pipe_reference_init(&spr->base.reference, 1);
    spr->base.screen = screen;
+   threaded_resource_init(&spr->base);
 
    spr->pot = (util_is_power_of_two_or_zero(templat->width0) &&
                util_is_power_of_two_or_zero(templat->height0) &&
@@ -184,6 +187,7 @@ softpipe_resource_create_front(struct pipe_screen *screen,
    return &spr->base;
 
  fail:
+   threaded_resource_deinit(&spr->base);
    FREE(spr);
    return NULL;
 }
@@ -207,11 +211,16 @@ softpipe_resource_destroy(struct pipe_screen *pscreen,
       struct sw_winsys *winsys = screen->winsys;
       winsys->displaytarget_destroy(winsys, spr->dt);
    }
+   else if (spr->storage) {
+      pipe_resource_reference(&spr->storage, NULL);
+   }
    else if (!spr->userBuffer) {
       /* regular texture */
       align_free(spr->data);
    }
 
+   threaded_resource_deinit(pt);
+
    FREE(spr);
 }
 
@@ -230,6 +239,8 @@ softpipe_resource_from_handle(struct pipe_screen *screen,
    spr->base = *templat;
    pipe_reference_init(&spr->base.reference, 1);
    spr->base.screen = screen;
+   threaded_resource_init(&spr->base);
+   spr->threaded.is_shared = true;
 
    spr->pot = (util_is_power_of_two_or_zero(templat->width0) &&
                util_is_power_of_two_or_zero(templat->height0) &&
@@ -245,6 +256,7 @@ softpipe_resource_from_handle(struct pipe_screen *screen,
    return &spr->base;
 
  fail:
+   threaded_resource_deinit(&spr->base);
    FREE(spr);
    return NULL;
 }
@@ -505,10 +517,81 @@ softpipe_user_buffer_create(struct pipe_screen *screen,
    spr->userBuffer = TRUE;
    spr->data = ptr;
 
+   threaded_resource_init(&spr->base);
+   spr->threaded.is_user_ptr = true;
+   util_range_add(&spr->threaded.valid_buffer_range, 0, bytes);
+
    return &spr->base;
 }
 
 
+/**
+ * Make dst use the storage of src, a buffer which the threaded context
+ * allocated to invalidate dst.  Both keep pointing to the same memory
+ * afterwards, since the threaded context keeps mapping src for
+ * unsynchronized transfers of dst.
+ */
+void
+softpipe_replace_buffer_storage(struct pipe_context *pipe,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src)
+{
+   struct softpipe_context *softpipe = softpipe_context(pipe);
+   struct softpipe_resource *sdst = softpipe_resource(dst);
+   struct softpipe_resource *ssrc = softpipe_resource(src);
+   struct pipe_resource *old_storage = sdst->storage;
+   char *old_data = sdst->data;
+   unsigned sh, i;
+
+   assert(dst->target == PIPE_BUFFER && src->target == PIPE_BUFFER);
+   assert(!sdst->userBuffer && !ssrc->storage);
+
+   /* This also drops the texture cache mappings of the old storage. */
+   softpipe_flush_resource(pipe, dst, 0, -1,
+                           0, /* flush_flags */
+                           FALSE, /* read_only */
+                           TRUE, /* cpu_access */
+                           FALSE); /* do_not_block */
+   draw_flush(softpipe->draw);
+
+   sdst->storage = NULL;
+   pipe_resource_reference(&sdst->storage, src);
+   sdst->data = ssrc->data;
+
+   /* Rebind everything which caches a pointer to the storage. */
+   for (sh = 0; sh < PIPE_SHADER_TYPES; sh++) {
+      for (i = 0; i < ARRAY_SIZE(softpipe->constants[sh]); i++) {
+         const char *data;
+
+         if (softpipe->constants[sh][i] != dst)
+            continue;
+
+         data = (char *) sdst->data +
+                ((const char *) softpipe->mapped_constants[sh][i] - old_data);
+
+         if (sh == PIPE_SHADER_VERTEX || sh == PIPE_SHADER_GEOMETRY) {
+            draw_set_mapped_constant_buffer(softpipe->draw, sh, i, data,
+                                            softpipe->const_buffer_size[sh][i]);
+         }
+
+         softpipe->mapped_constants[sh][i] = data;
+         softpipe->dirty |= SP_NEW_CONSTANTS;
+      }
+   }
+
+   for (i = 0; i < softpipe->num_so_targets; i++) {
+      if (softpipe->so_targets[i] &&
+          softpipe->so_targets[i]->target.buffer == dst)
+         softpipe->so_targets[i]->mapping = sdst->data;
+   }
+
+   if (old_storage)
+      pipe_resource_reference(&old_storage, NULL);
+   else
+      align_free(old_data);
+}
+
+
 void
 softpipe_init_texture_funcs(struct pipe_context *pipe)
 {
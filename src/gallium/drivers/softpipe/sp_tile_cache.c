@@ -42,16 +42,6 @@ static struct softpipe_cached_tile *
 sp_alloc_tile(struct softpipe_tile_cache *tc);
 
 
-/**
- * Return the position in the cache for the tile that contains win pos (x,y).
- * We currently use a direct mapped cache so this is like a hack key.
- * At some point we should investige something more sophisticated, like
- * a LRU replacement policy.
- */
-#define CACHE_POS(x, y, l)                        \
-   (((x) + (y) * 5 + (l) * 10) % NUM_ENTRIES)
-
-
 static inline int addr_to_clear_pos(union tile_address addr)
 {
    int pos;
@@ -74,6 +64,19 @@ is_clear_flag_set(const uint *bitvec, union tile_address addr, unsigned max)
 }
    
 
+/**
+ * Mark the tile at (x,y) as cleared.
+ */
+static inline void
+set_clear_flag(uint *bitvec, union tile_address addr, unsigned max)
+{
+   int pos;
+   pos = addr_to_clear_pos(addr);
+   assert(pos / 32 < max);
+   bitvec[pos / 32] |= (1 << (pos & 31));
+}
+
+
 /**
  * Mark the tile at (x,y) as not cleared.
  */
@@ -108,6 +111,7 @@ sp_create_tile_cache( struct pipe_context *pipe )
          tc->tile_addrs[pos].bits.invalid = 1;
       }
       tc->last_tile_addr.bits.invalid = 1;
+      tc->num_threads = 1;
 
       /* this allocation allows us to guarantee that allocation
        * failures are never fatal later
@@ -520,6 +524,9 @@ sp_find_cached_tile(struct softpipe_tile_cache *tc,
                              addr.bits.y, addr.bits.layer);
    struct softpipe_cached_tile *tile = tc->entries[pos];
    int layer;
+
+   assert(sp_tile_thread(addr, tc->num_threads) == tc->thread);
+
    if (!tile) {
       tile = sp_alloc_tile(tc);
       tc->entries[pos] = tile;
@@ -640,8 +647,32 @@ sp_tile_cache_clear(struct softpipe_tile_cache *tc,
 
    tc->clear_val = clearValue;
 
-   /* set flags to indicate all the tiles are cleared */
-   memset(tc->clear_flags, 255, tc->clear_flags_size);
+   if (tc->num_threads > 1) {
+      /* set flags to indicate our tiles are cleared */
+      int layer;
+      uint x, y;
+
+      memset(tc->clear_flags, 0, tc->clear_flags_size);
+
+      for (layer = 0; layer < tc->num_maps; layer++) {
+         const uint w = tc->transfer[layer]->box.width;
+         const uint h = tc->transfer[layer]->box.height;
+
+         for (y = 0; y < h; y += TILE_SIZE) {
+            for (x = 0; x < w; x += TILE_SIZE) {
+               union tile_address addr = tile_address(x, y, layer);
+
+               if (sp_tile_thread(addr, tc->num_threads) == tc->thread)
+                  set_clear_flag(tc->clear_flags, addr,
+                                 tc->clear_flags_size);
+            }
+         }
+      }
+   }
+   else {
+      /* set flags to indicate all the tiles are cleared */
+      memset(tc->clear_flags, 255, tc->clear_flags_size);
+   }
 
    for (pos = 0; pos < ARRAY_SIZE(tc->tile_addrs); pos++) {
       tc->tile_addrs[pos].bits.invalid = 1;
@@ -79,6 +79,16 @@ struct softpipe_cached_tile
 #define NUM_ENTRIES 50
 
 
+/**
+ * Return the position in the cache for the tile that contains win pos (x,y).
+ * We currently use a direct mapped cache so this is like a hack key.
+ * At some point we should investige something more sophisticated, like
+ * a LRU replacement policy.
+ */
+#define CACHE_POS(x, y, l)                        \
+   (((x) + (y) * 5 + (l) * 10) % NUM_ENTRIES)
+
+
 struct softpipe_tile_cache
 {
    struct pipe_context *pipe;
@@ -99,6 +109,13 @@ struct softpipe_tile_cache
 
    union tile_address last_tile_addr;
    struct softpipe_cached_tile *last_tile;  /**< most recently retrieved tile */
+
+   /**
+    * When rasterization is split between threads, each thread has its own
+    * cache which only ever holds (and clears) the tiles of that thread.
+    * See sp_tile_thread().
+    */
+   unsigned thread, num_threads;
 };
 
 
@@ -141,6 +158,19 @@ tile_address( unsigned x,
    return addr;
 }
 
+/**
+ * Return which of num_threads rasterization threads handles the tile at
+ * addr.  The tiles sharing a cache position all go to the same thread, so
+ * each thread's cache fetches and evicts its tiles in the same order a
+ * single cache would, and the results don't depend on the thread count.
+ */
+static inline unsigned
+sp_tile_thread(union tile_address addr, unsigned num_threads)
+{
+   return CACHE_POS(addr.bits.x, addr.bits.y, addr.bits.layer) % num_threads;
+}
+
+
 /* Quickly retrieve tile if it matches last lookup.
  */
 static inline struct softpipe_cached_tile *
@@ -37,6 +37,7 @@
 #include "util/u_inlines.h"
 #include "util/u_sampler.h"
 #include "util/u_format.h"
+#include "util/os_time.h"
 #include "tgsi/tgsi_text.h"
 #include "pipe-loader/pipe_loader.h"
 
@@ -430,6 +431,7 @@ static void launch_grid(struct context *ctx, const uint *block_layout,
         struct pipe_grid_info info;
         int i;
 
+        memset(&info, 0, sizeof(info));
         for (i = 0; i < 3; i++) {
                 info.block[i] = block_layout[i];
                 info.grid[i] = grid_layout[i];
@@ -1641,6 +1643,187 @@ static void test_atom_race(struct context *ctx, bool global)
         destroy_prog(ctx);
 }
 
+/* test_throughput */
+#define THROUGHPUT_GROUPS 4096
+#define THROUGHPUT_ITERATIONS 64
+
+static void test_throughput_expect(void *p, int s, int x, int y)
+{
+        *(uint32_t *)p = 63 - x % 64;
+}
+
+static void test_throughput(struct context *ctx)
+{
+        const char *src = "COMP\n"
+                "PROPERTY CS_FIXED_BLOCK_WIDTH 64\n"
+                "PROPERTY CS_FIXED_BLOCK_HEIGHT 1\n"
+                "PROPERTY CS_FIXED_BLOCK_DEPTH 1\n"
+                "DCL SV[0], THREAD_ID\n"
+                "DCL SV[1], BLOCK_ID\n"
+                "DCL BUFFER[0]\n"
+                "DCL MEMORY[0], SHARED\n"
+                "DCL TEMP[0..2], LOCAL\n"
+                "IMM[0] UINT32 { 4, 64, 63, 0 }\n"
+                "\n"
+                "    UMUL TEMP[0].x, SV[0].xxxx, IMM[0].xxxx\n"
+                "    STORE MEMORY[0].x, TEMP[0].xxxx, SV[0].xxxx\n"
+                "    BARRIER\n"
+                "    INEG TEMP[1].x, SV[0].xxxx\n"
+                "    UADD TEMP[1].x, TEMP[1].xxxx, IMM[0].zzzz\n"
+                "    UMUL TEMP[1].x, TEMP[1].xxxx, IMM[0].xxxx\n"
+                "    LOAD TEMP[1].x, MEMORY[0], TEMP[1].xxxx\n"
+                "    UMAD TEMP[2].x, SV[1].xxxx, IMM[0].yyyy, SV[0].xxxx\n"
+                "    UMUL TEMP[2].x, TEMP[2].xxxx, IMM[0].xxxx\n"
+                "    STORE BUFFER[0].x, TEMP[2].xxxx, TEMP[1].xxxx\n"
+                "    END\n";
+        struct pipe_context *pipe = ctx->pipe;
+        struct pipe_screen *screen = ctx->screen;
+        struct pipe_shader_buffer sb;
+        struct pipe_fence_handle *fence = NULL;
+        int64_t t0, t1;
+        int i;
+
+        printf("- %s\n", __func__);
+
+        init_prog(ctx, 256, 0, 0, src, NULL);
+        init_tex(ctx, 0, PIPE_BUFFER, true, PIPE_FORMAT_R32_UINT,
+                 THROUGHPUT_GROUPS * 64 * 4, 0, test_default_init);
+
+        memset(&sb, 0, sizeof(sb));
+        sb.buffer = ctx->tex[0];
+        sb.buffer_size = ctx->tex[0]->width0;
+        pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, &sb, 1);
+
+        t0 = os_time_get();
+        for (i = 0; i < THROUGHPUT_ITERATIONS; i++)
+                launch_grid(ctx, (uint []){64, 1, 1},
+                            (uint []){THROUGHPUT_GROUPS, 1, 1}, 0, NULL);
+        pipe->flush(pipe, &fence, 0);
+        screen->fence_finish(screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+        screen->fence_reference(screen, &fence, NULL);
+        t1 = os_time_get();
+
+        printf("%.1f Minvocations/s\n",
+               (double)THROUGHPUT_GROUPS * 64 * THROUGHPUT_ITERATIONS /
+               (double)MAX2(t1 - t0, 1));
+
+        check_tex(ctx, 0, test_throughput_expect, NULL);
+        pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, NULL, 0);
+        destroy_tex(ctx);
+        destroy_prog(ctx);
+}
+
+/* test_sample_throughput */
+#define SAMPLE_THROUGHPUT_SIZE 1024
+#define SAMPLE_THROUGHPUT_ITERATIONS 16
+
+static void test_sample_throughput_expect(void *p, int s, int x, int y)
+{
+        *(uint32_t *)p = x;
+}
+
+/*
+ * Fetches every texel of a large texture with nearest filtering, walking
+ * down the columns, which is the worst case for linearly stored textures.
+ * The texture is only bound as a sampler view, so llvmpipe can store it in
+ * tiles (LP_TILED_TEXTURES).
+ */
+static void test_sample_throughput(struct context *ctx)
+{
+        const char *src = "COMP\n"
+                "PROPERTY CS_FIXED_BLOCK_WIDTH 1\n"
+                "PROPERTY CS_FIXED_BLOCK_HEIGHT 64\n"
+                "PROPERTY CS_FIXED_BLOCK_DEPTH 1\n"
+                "DCL SV[0], THREAD_ID\n"
+                "DCL SV[1], BLOCK_ID\n"
+                "DCL SVIEW[0], 2D, FLOAT\n"
+                "DCL SAMP[0]\n"
+                "DCL BUFFER[0]\n"
+                "DCL TEMP[0..1], LOCAL\n"
+                "IMM[0] UINT32 { 64, 1024, 4, 0 }\n"
+                "IMM[1] FLT32 { 0.5, 0.0009765625, 0, 0 }\n"
+                "\n"
+                "    MOV TEMP[0].x, SV[1].xxxx\n"
+                "    UMAD TEMP[0].y, SV[1].yyyy, IMM[0].xxxx, SV[0].yyyy\n"
+                "    U2F TEMP[1].xy, TEMP[0].xyyy\n"
+                "    ADD TEMP[1].xy, TEMP[1].xyyy, IMM[1].xxxx\n"
+                "    MUL TEMP[1].xy, TEMP[1].xyyy, IMM[1].yyyy\n"
+                "    SAMPLE TEMP[1], TEMP[1], SVIEW[0], SAMP[0]\n"
+                "    F2U TEMP[1].x, TEMP[1].xxxx\n"
+                "    UMAD TEMP[0].x, TEMP[0].xxxx, IMM[0].yyyy, TEMP[0].yyyy\n"
+                "    UMUL TEMP[0].x, TEMP[0].xxxx, IMM[0].zzzz\n"
+                "    STORE BUFFER[0].x, TEMP[0].xxxx, TEMP[1].xxxx\n"
+                "    END\n";
+        struct pipe_context *pipe = ctx->pipe;
+        struct pipe_screen *screen = ctx->screen;
+        struct pipe_resource ttex = {
+                .target = PIPE_TEXTURE_2D,
+                .format = PIPE_FORMAT_R32_FLOAT,
+                .width0 = SAMPLE_THROUGHPUT_SIZE,
+                .height0 = SAMPLE_THROUGHPUT_SIZE,
+                .depth0 = 1,
+                .array_size = 1,
+                .bind = PIPE_BIND_SAMPLER_VIEW
+        };
+        struct pipe_shader_buffer sb;
+        struct pipe_fence_handle *fence = NULL;
+        struct pipe_transfer *xfer;
+        char *map;
+        int64_t t0, t1;
+        int i, x, y;
+
+        printf("- %s\n", __func__);
+
+        init_prog(ctx, 0, 0, 0, src, NULL);
+
+        /* texel (x, y) holds the index of its column-major position */
+        ctx->tex[0] = screen->resource_create(screen, &ttex);
+        assert(ctx->tex[0]);
+        map = pipe->transfer_map(pipe, ctx->tex[0], 0, PIPE_TRANSFER_WRITE,
+                                 &(struct pipe_box) {
+                                         .width = SAMPLE_THROUGHPUT_SIZE,
+                                         .height = SAMPLE_THROUGHPUT_SIZE,
+                                         .depth = 1 }, &xfer);
+        assert(map);
+        for (y = 0; y < SAMPLE_THROUGHPUT_SIZE; ++y)
+                for (x = 0; x < SAMPLE_THROUGHPUT_SIZE; ++x)
+                        ((float *)(map + y * xfer->stride))[x] =
+                                x * SAMPLE_THROUGHPUT_SIZE + y;
+        pipe->transfer_unmap(pipe, xfer);
+
+        init_tex(ctx, 1, PIPE_BUFFER, true, PIPE_FORMAT_R32_UINT,
+                 SAMPLE_THROUGHPUT_SIZE * SAMPLE_THROUGHPUT_SIZE * 4, 0,
+                 test_default_init);
+        init_sampler_views(ctx, (int []) { 0, -1 });
+        init_sampler_states(ctx, 1);
+
+        memset(&sb, 0, sizeof(sb));
+        sb.buffer = ctx->tex[1];
+        sb.buffer_size = ctx->tex[1]->width0;
+        pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, &sb, 1);
+
+        t0 = os_time_get();
+        for (i = 0; i < SAMPLE_THROUGHPUT_ITERATIONS; i++)
+                launch_grid(ctx, (uint []){1, 64, 1},
+                            (uint []){SAMPLE_THROUGHPUT_SIZE,
+                                      SAMPLE_THROUGHPUT_SIZE / 64, 1}, 0, NULL);
+        pipe->flush(pipe, &fence, 0);
+        screen->fence_finish(screen, NULL, fence, PIPE_TIMEOUT_INFINITE);
+        screen->fence_reference(screen, &fence, NULL);
+        t1 = os_time_get();
+
+        printf("%.1f Msamples/s\n",
+               (double)SAMPLE_THROUGHPUT_SIZE * SAMPLE_THROUGHPUT_SIZE *
+               SAMPLE_THROUGHPUT_ITERATIONS / (double)MAX2(t1 - t0, 1));
+
+        check_tex(ctx, 1, test_sample_throughput_expect, NULL);
+        pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, NULL, 0);
+        destroy_sampler_states(ctx);
+        destroy_sampler_views(ctx);
+        destroy_tex(ctx);
+        destroy_prog(ctx);
+}
+
 int main(int argc, char *argv[])
 {
         struct context *ctx = CALLOC_STRUCT(context);
@@ -1683,6 +1866,10 @@ int main(int argc, char *argv[])
            test_atom_ops(ctx, false);
         if (tests & (1 << 16))
            test_atom_race(ctx, false);
+        if (tests & (1 << 17))
+           test_throughput(ctx);
+        if (tests & (1 << 18))
+           test_sample_throughput(ctx);
 
         destroy_ctx(ctx);
 
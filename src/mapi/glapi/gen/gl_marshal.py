@@ -79,17 +79,20 @@ class PrintCode(gl_XML.gl_print_base):
     def printRealFooter(self):
         pass
 
-    def print_sync_call(self, func):
+    def print_sync_call(self, func, call_after=False):
         call = 'CALL_{0}(ctx->CurrentServerDispatch, ({1}))'.format(
             func.name, func.get_called_parameter_string())
         if func.return_type == 'void':
             out('{0};'.format(call))
+            if call_after and func.marshal_call_after:
+                out('{0};'.format(func.marshal_call_after))
         else:
+            assert not func.marshal_call_after
             out('return {0};'.format(call))
 
     def print_sync_dispatch(self, func):
         out('debug_print_sync_fallback("{0}");'.format(func.name))
-        self.print_sync_call(func)
+        self.print_sync_call(func, call_after=True)
 
     def print_sync_body(self, func):
         out('/* {0}: marshalled synchronously */'.format(func.name))
@@ -98,9 +101,14 @@ class PrintCode(gl_XML.gl_print_base):
         out('{')
         with indent():
             out('GET_CURRENT_CONTEXT(ctx);')
-            out('_mesa_glthread_finish(ctx);')
+            if func.marshal_client:
+                assert func.return_type == 'void'
+                out('if ({0})'.format(func.marshal_client))
+                with indent():
+                    out('return;')
+            out('_mesa_glthread_finish_before(ctx, "{0}");'.format(func.name))
             out('debug_print_sync("{0}");'.format(func.name))
-            self.print_sync_call(func)
+            self.print_sync_call(func, call_after=True)
         out('}')
         out('')
         out('')
@@ -109,7 +117,7 @@ class PrintCode(gl_XML.gl_print_base):
         out('cmd = _mesa_glthread_allocate_command(ctx, '
             'DISPATCH_CMD_{0}, cmd_size);'.format(func.name))
         for p in func.fixed_params:
-            if p.count:
+            if p.count and not func.pointers_by_value:
                 out('memcpy(cmd->{0}, {0}, {1});'.format(
                         p.name, p.size_string()))
             else:
@@ -142,7 +150,7 @@ class PrintCode(gl_XML.gl_print_base):
         with indent():
             out('struct marshal_cmd_base cmd_base;')
             for p in func.fixed_params:
-                if p.count:
+                if p.count and not func.pointers_by_value:
                     out('{0} {1}[{2}];'.format(
                             p.get_base_type_string(), p.name, p.count))
                 else:
@@ -173,14 +181,18 @@ class PrintCode(gl_XML.gl_print_base):
         out('{')
         with indent():
             for p in func.fixed_params:
-                if p.count:
+                if p.count and not func.pointers_by_value:
                     p_decl = '{0} * {1} = cmd->{1};'.format(
                             p.get_base_type_string(), p.name)
+                elif p.is_pointer():
+                    # Pointers passed by value, which may be outputs.
+                    p_decl = '{0} const {1} = cmd->{1};'.format(
+                            p.type_string(), p.name)
                 else:
                     p_decl = '{0} {1} = cmd->{1};'.format(
                             p.type_string(), p.name)
 
-                if not p_decl.startswith('const '):
+                if not p_decl.startswith('const ') and ' const ' not in p_decl:
                     # Declare all local function variables as const, even if
                     # the original parameter is not const.
                     p_decl = 'const ' + p_decl
@@ -213,7 +225,7 @@ class PrintCode(gl_XML.gl_print_base):
         # Check that any counts for variable-length arguments might be < 0, in
         # which case the command alloc or the memcpy would blow up before we
         # get to the validation in Mesa core.
-        for p in func.parameters:
+        for p in func.variable_params:
             if p.is_variable_length():
                 out('if (unlikely({0} < 0)) {{'.format(p.size_string()))
                 with indent():
@@ -254,9 +266,20 @@ class PrintCode(gl_XML.gl_print_base):
                     out('return;')
                 out('}')
 
+            if func.marshal_sync:
+                out('if ({0}) {{'.format(func.marshal_sync))
+                with indent():
+                    out('_mesa_glthread_finish_before(ctx, "{0}");'.format(
+                        func.name))
+                    self.print_sync_dispatch(func)
+                    out('return;')
+                out('}')
+
             out('if (cmd_size <= MARSHAL_MAX_CMD_SIZE) {')
             with indent():
                 self.print_async_dispatch(func)
+                if func.marshal_call_after:
+                    out('{0};'.format(func.marshal_call_after))
                 out('return;')
             out('}')
 
@@ -264,7 +287,7 @@ class PrintCode(gl_XML.gl_print_base):
         if need_fallback_sync:
             out('fallback_to_sync:')
         with indent():
-            out('_mesa_glthread_finish(ctx);')
+            out('_mesa_glthread_finish_before(ctx, "{0}");'.format(func.name))
             self.print_sync_dispatch(func)
 
         out('}')
@@ -44,21 +44,38 @@ class marshal_function(gl_XML.gl_function):
         if element.get('name') != self.name:
             return
 
+        # Store the "marshal" attribute, if present.
+        self.marshal = element.get('marshal')
+        self.marshal_fail = element.get('marshal_fail')
+
+        # The condition under which the call is executed synchronously,
+        # without disabling glthread.  Otherwise, the pointers of the call are
+        # offsets into a bound buffer and are passed by value, except the
+        # arrays of the multi-draw calls.
+        self.marshal_sync = element.get('marshal_sync')
+
+        # Code called after queuing the call, typically to track the state
+        # that decides how other calls are marshalled.
+        self.marshal_call_after = element.get('marshal_call_after')
+
+        # An expression that executes the call on the client side if it is
+        # true, e.g. for queries of state tracked there.
+        self.marshal_client = element.get('marshal_client')
+
+        self.pointers_by_value = (self.marshal_sync is not None and
+                                  self.marshal != 'draw')
+
         # Classify fixed and variable parameters.
         self.fixed_params = []
         self.variable_params = []
         for p in self.parameters:
             if p.is_padding:
                 continue
-            if p.is_variable_length():
+            if p.is_variable_length() and not self.pointers_by_value:
                 self.variable_params.append(p)
             else:
                 self.fixed_params.append(p)
 
-        # Store the "marshal" attribute, if present.
-        self.marshal = element.get('marshal')
-        self.marshal_fail = element.get('marshal_fail')
-
     def marshal_flavor(self):
         """Find out how this function should be marshalled between
         client and server threads."""
@@ -74,6 +91,8 @@ class marshal_function(gl_XML.gl_function):
 
         if self.return_type != 'void':
             return 'sync'
+        if self.pointers_by_value:
+            return 'async'
         for p in self.parameters:
             if p.is_output:
                 return 'sync'
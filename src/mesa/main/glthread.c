@@ -36,14 +36,18 @@
 #include "main/glthread.h"
 #include "main/marshal.h"
 #include "main/marshal_generated.h"
+#include "util/debug.h"
+#include "util/hash_table.h"
+#include "util/bitscan.h"
+#include "util/futex.h"
+#include "util/os_time.h"
 #include "util/u_atomic.h"
 #include "util/u_thread.h"
 
 
 static void
-glthread_unmarshal_batch(void *job, int thread_index)
+glthread_unmarshal_batch(struct glthread_batch *batch)
 {
-   struct glthread_batch *batch = (struct glthread_batch*)job;
    struct gl_context *ctx = batch->ctx;
    size_t pos = 0;
 
@@ -56,6 +60,173 @@ glthread_unmarshal_batch(void *job, int thread_index)
    batch->used = 0;
 }
 
+static void
+record_latency(unsigned *histogram, int64_t start)
+{
+   uint64_t us = (os_time_get_nano() - start) / 1000;
+   unsigned bucket = us ? util_last_bit64(us) : 0;
+
+   histogram[MIN2(bucket, MARSHAL_LATENCY_BUCKETS - 1)]++;
+}
+
+/* The batch counters are incremented by SEQNO_INC, the low bits are flags:
+ * - SEQNO_WAITING is set by the thread sleeping until the counter changes,
+ *   so that the thread changing it wakes it up.
+ * - SEQNO_PARKED is set in glthread_state::submitted when the worker thread
+ *   returned to the queue after being idle for a while, so that the main
+ *   thread adds it again.  Otherwise the atexit handler of util_queue would
+ *   wait forever for a context that isn't destroyed.
+ *
+ * Both threads only use atomic read-modify-write operations on the
+ * counters, so one of them always sees the other's change.
+ */
+#define SEQNO_WAITING 1
+#define SEQNO_PARKED 2
+#define SEQNO_INC 4
+
+#define SEQNO_SLOT(seqno) (((seqno) / SEQNO_INC) % MARSHAL_MAX_BATCHES)
+
+/* How long the worker thread waits for batches before parking. */
+#define WORKER_IDLE_TIMEOUT_NS (20 * 1000 * 1000)
+
+static inline uint32_t
+read_seqno(uint32_t *seqno)
+{
+   return p_atomic_read(seqno) & ~(SEQNO_INC - 1);
+}
+
+/**
+ * Sleeps until the batch counter at *seqno isn't value anymore, or
+ * returns earlier, e.g. at abs_timeout if it isn't 0.
+ */
+static void
+wait_for_change(struct glthread_state *glthread, uint32_t *seqno,
+                uint32_t value, int64_t abs_timeout)
+{
+   uint32_t old = p_atomic_cmpxchg(seqno, value, value | SEQNO_WAITING);
+
+   if (old != value && old != (value | SEQNO_WAITING))
+      return;
+
+#ifdef GLTHREAD_FUTEX
+   struct timespec ts;
+   ts.tv_sec = abs_timeout / (1000*1000*1000);
+   ts.tv_nsec = abs_timeout % (1000*1000*1000);
+
+   futex_wait(seqno, value | SEQNO_WAITING, abs_timeout ? &ts : NULL);
+#else
+   mtx_lock(&glthread->wait_mutex);
+   if (p_atomic_read(seqno) == (value | SEQNO_WAITING)) {
+      if (abs_timeout) {
+         /* cnd_timedwait is relative to the TIME_UTC clock. */
+         int64_t rel = MAX2(abs_timeout - os_time_get_nano(), 0);
+         struct timespec ts;
+
+         timespec_get(&ts, TIME_UTC);
+         ts.tv_sec += rel / (1000*1000*1000);
+         ts.tv_nsec += rel % (1000*1000*1000);
+         if (ts.tv_nsec >= (1000*1000*1000)) {
+            ts.tv_sec++;
+            ts.tv_nsec -= (1000*1000*1000);
+         }
+         cnd_timedwait(&glthread->wait_cond, &glthread->wait_mutex, &ts);
+      } else {
+         cnd_wait(&glthread->wait_cond, &glthread->wait_mutex);
+      }
+   }
+   mtx_unlock(&glthread->wait_mutex);
+#endif
+}
+
+/**
+ * Advances the batch counter at *seqno and wakes up the other thread.
+ * Returns the flags that were set.
+ */
+static uint32_t
+advance(struct glthread_state *glthread, uint32_t *seqno)
+{
+   uint32_t old = p_atomic_xchg(seqno, read_seqno(seqno) + SEQNO_INC);
+
+   if (old & SEQNO_WAITING) {
+#ifdef GLTHREAD_FUTEX
+      futex_wake(seqno, INT_MAX);
+#else
+      mtx_lock(&glthread->wait_mutex);
+      cnd_broadcast(&glthread->wait_cond);
+      mtx_unlock(&glthread->wait_mutex);
+#endif
+   }
+   return old & (SEQNO_INC - 1);
+}
+
+static void glthread_worker(void *job, int thread_index);
+
+/** Submits the batch in the next slot of the ring. */
+static void
+submit_batch(struct gl_context *ctx, struct glthread_batch *batch)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   glthread->ring[SEQNO_SLOT(read_seqno(&glthread->submitted))] = batch;
+
+   if (advance(glthread, &glthread->submitted) & SEQNO_PARKED) {
+      /* The worker job is returning, if it hasn't yet. */
+      util_queue_fence_wait(&glthread->worker_fence);
+      util_queue_add_job(&glthread->queue, ctx, &glthread->worker_fence,
+                         glthread_worker, NULL);
+   }
+}
+
+/**
+ * Executes the submitted batches until a NULL batch is submitted, or until
+ * none were submitted for WORKER_IDLE_TIMEOUT_NS.
+ */
+static void
+glthread_worker(void *job, int thread_index)
+{
+   struct gl_context *ctx = (struct gl_context*)job;
+   struct glthread_state *glthread = ctx->GLThread;
+   uint32_t executed = read_seqno(&glthread->executed);
+   int64_t abs_timeout = 0;
+
+   while (true) {
+      uint32_t submitted = p_atomic_read(&glthread->submitted);
+
+      if ((submitted & ~(SEQNO_INC - 1)) == executed) {
+         if (!abs_timeout) {
+            abs_timeout = os_time_get_nano() + WORKER_IDLE_TIMEOUT_NS;
+         } else if (os_time_get_nano() >= abs_timeout) {
+            /* Park, unless a batch was submitted in the meantime. */
+            if (p_atomic_cmpxchg(&glthread->submitted, submitted,
+                                 executed | SEQNO_PARKED) == submitted)
+               return;
+            continue;
+         }
+
+         wait_for_change(glthread, &glthread->submitted, executed,
+                         abs_timeout);
+         continue;
+      }
+
+      abs_timeout = 0;
+
+      struct glthread_batch *batch = glthread->ring[SEQNO_SLOT(executed)];
+
+      if (batch) {
+         if (unlikely(glthread->sync_calls))
+            record_latency(glthread->queue_latency, batch->submit_time);
+
+         glthread_unmarshal_batch(batch);
+      }
+
+      advance(glthread, &glthread->executed);
+      executed += SEQNO_INC;
+
+      if (!batch)
+         return;
+   }
+}
+
 static void
 glthread_thread_initialization(void *job, int thread_index)
 {
@@ -65,6 +236,110 @@ glthread_thread_initialization(void *job, int thread_index)
    _glapi_set_context(ctx);
 }
 
+static struct glthread_batch *
+alloc_batch(struct gl_context *ctx)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+   struct glthread_batch *batch = malloc(sizeof(*batch));
+
+   if (batch) {
+      batch->ctx = ctx;
+      batch->used = 0;
+      glthread->num_batches++;
+   }
+   return batch;
+}
+
+/** Puts the batches executed by the worker thread back in free_batches. */
+static void
+reclaim_batches(struct glthread_state *glthread)
+{
+   uint32_t executed = read_seqno(&glthread->executed);
+
+   for (; glthread->reclaimed != executed; glthread->reclaimed += SEQNO_INC) {
+      struct glthread_batch *batch =
+         glthread->ring[SEQNO_SLOT(glthread->reclaimed)];
+
+      if (batch)
+         glthread->free_batches[glthread->num_free_batches++] = batch;
+   }
+}
+
+/**
+ * Returns an empty batch to fill, waiting for the worker thread to execute
+ * one if max_batches are in flight already.
+ */
+static struct glthread_batch *
+get_free_batch(struct gl_context *ctx)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+   int64_t wait_start = 0;
+
+   reclaim_batches(glthread);
+
+   if (!glthread->num_free_batches &&
+       glthread->num_batches >= glthread->max_batches &&
+       glthread->max_batches < MARSHAL_MAX_BATCHES) {
+      /* The worker thread is behind, make room for more batches so that
+       * the main thread waits less often.
+       */
+      glthread->max_batches = MIN2(glthread->max_batches * 2,
+                                   MARSHAL_MAX_BATCHES);
+      glthread->shrink_countdown = MARSHAL_BATCH_SHRINK_PERIOD;
+   }
+
+   while (!glthread->num_free_batches) {
+      if (glthread->num_batches < glthread->max_batches) {
+         struct glthread_batch *batch = alloc_batch(ctx);
+         if (batch)
+            return batch;
+      }
+
+      /* At least the batch submitted last is in flight. */
+      uint32_t executed = read_seqno(&glthread->executed);
+
+      if (unlikely(glthread->sync_calls) && !wait_start)
+         wait_start = os_time_get_nano();
+
+      if (executed == glthread->reclaimed)
+         wait_for_change(glthread, &glthread->executed, executed, 0);
+
+      reclaim_batches(glthread);
+   }
+
+   if (wait_start)
+      record_latency(glthread->wait_latency, wait_start);
+
+   return glthread->free_batches[--glthread->num_free_batches];
+}
+
+/**
+ * Frees the batches that weren't needed during the last
+ * MARSHAL_BATCH_SHRINK_PERIOD submissions.
+ */
+static void
+update_max_batches(struct glthread_state *glthread, unsigned in_flight)
+{
+   glthread->max_in_flight = MAX2(glthread->max_in_flight, in_flight);
+
+   if (--glthread->shrink_countdown)
+      return;
+
+   /* Count the batch being filled as well. */
+   if (glthread->max_in_flight + 1 < glthread->max_batches / 2)
+      glthread->max_batches = MAX2(glthread->max_batches / 2,
+                                   MARSHAL_MIN_BATCHES);
+
+   while (glthread->num_batches > glthread->max_batches &&
+          glthread->num_free_batches) {
+      free(glthread->free_batches[--glthread->num_free_batches]);
+      glthread->num_batches--;
+   }
+
+   glthread->max_in_flight = 0;
+   glthread->shrink_countdown = MARSHAL_BATCH_SHRINK_PERIOD;
+}
+
 void
 _mesa_glthread_init(struct gl_context *ctx)
 {
@@ -73,8 +348,7 @@ _mesa_glthread_init(struct gl_context *ctx)
    if (!glthread)
       return;
 
-   if (!util_queue_init(&glthread->queue, "gl", MARSHAL_MAX_BATCHES - 2,
-                        1, 0)) {
+   if (!util_queue_init(&glthread->queue, "gl", 2, 1, 0)) {
       free(glthread);
       return;
    }
@@ -86,14 +360,35 @@ _mesa_glthread_init(struct gl_context *ctx)
       return;
    }
 
-   for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++) {
-      glthread->batches[i].ctx = ctx;
-      util_queue_fence_init(&glthread->batches[i].fence);
+   ctx->GLThread = glthread;
+
+   glthread->max_batches = MARSHAL_MIN_BATCHES;
+   glthread->shrink_countdown = MARSHAL_BATCH_SHRINK_PERIOD;
+   glthread->batch_size = MARSHAL_MAX_CMD_SIZE;
+   glthread->next = alloc_batch(ctx);
+   if (!glthread->next) {
+      ctx->GLThread = NULL;
+      free(ctx->MarshalExec);
+      ctx->MarshalExec = NULL;
+      util_queue_destroy(&glthread->queue);
+      free(glthread);
+      return;
    }
 
+#ifndef GLTHREAD_FUTEX
+   mtx_init(&glthread->wait_mutex, mtx_plain);
+   cnd_init(&glthread->wait_cond);
+#endif
+
    glthread->stats.queue = &glthread->queue;
+   glthread->unpack.Alignment = 4;
+
+   if (env_var_as_boolean("MESA_GLTHREAD_STATS", false)) {
+      glthread->sync_calls = _mesa_hash_table_create(NULL, _mesa_hash_string,
+                                                     _mesa_key_string_equal);
+   }
+
    ctx->CurrentClientDispatch = ctx->MarshalExec;
-   ctx->GLThread = glthread;
 
    /* Execute the thread initialization function in the thread. */
    struct util_queue_fence fence;
@@ -102,6 +397,70 @@ _mesa_glthread_init(struct gl_context *ctx)
                       glthread_thread_initialization, NULL);
    util_queue_fence_wait(&fence);
    util_queue_fence_destroy(&fence);
+
+   /* The worker thread then keeps executing batches until destruction. */
+   util_queue_fence_init(&glthread->worker_fence);
+   util_queue_add_job(&glthread->queue, ctx, &glthread->worker_fence,
+                      glthread_worker, NULL);
+}
+
+static int
+compare_sync_calls(const void *a, const void *b)
+{
+   const struct hash_entry *ea = *(const struct hash_entry **)a;
+   const struct hash_entry *eb = *(const struct hash_entry **)b;
+   uintptr_t ca = (uintptr_t)ea->data;
+   uintptr_t cb = (uintptr_t)eb->data;
+
+   if (ca != cb)
+      return ca < cb ? 1 : -1;
+   return strcmp(ea->key, eb->key);
+}
+
+static void
+print_latency(const char *name, const unsigned *histogram)
+{
+   fprintf(stderr, "glthread: %s latency:\n", name);
+
+   for (unsigned i = 0; i < MARSHAL_LATENCY_BUCKETS; i++) {
+      if (!histogram[i])
+         continue;
+
+      if (i == MARSHAL_LATENCY_BUCKETS - 1)
+         fprintf(stderr, "glthread: %8u >= %u us\n", histogram[i], 1u << (i - 1));
+      else
+         fprintf(stderr, "glthread: %8u  < %u us\n", histogram[i], 1u << i);
+   }
+}
+
+/**
+ * Prints which functions made the main thread wait for the worker thread,
+ * most frequent first, and the latency histograms.
+ */
+static void
+print_sync_calls(struct glthread_state *glthread)
+{
+   struct hash_table *ht = glthread->sync_calls;
+   const struct hash_entry **entries =
+      malloc(MAX2(ht->entries, 1) * sizeof(*entries));
+   unsigned num_entries = 0;
+
+   if (!entries)
+      return;
+
+   hash_table_foreach(ht, entry)
+      entries[num_entries++] = entry;
+   qsort(entries, num_entries, sizeof(*entries), compare_sync_calls);
+
+   fprintf(stderr, "glthread: %u syncs in total\n", glthread->stats.num_syncs);
+   for (unsigned i = 0; i < num_entries; i++) {
+      fprintf(stderr, "glthread: %8"PRIuPTR" gl%s\n",
+              (uintptr_t)entries[i]->data, (const char *)entries[i]->key);
+   }
+   free(entries);
+
+   print_latency("batch queueing", glthread->queue_latency);
+   print_latency("main thread wait", glthread->wait_latency);
 }
 
 void
@@ -113,10 +472,27 @@ _mesa_glthread_destroy(struct gl_context *ctx)
       return;
 
    _mesa_glthread_finish(ctx);
+
+   /* Stop the worker thread. */
+   submit_batch(ctx, NULL);
+   util_queue_fence_wait(&glthread->worker_fence);
+   util_queue_fence_destroy(&glthread->worker_fence);
    util_queue_destroy(&glthread->queue);
 
-   for (unsigned i = 0; i < MARSHAL_MAX_BATCHES; i++)
-      util_queue_fence_destroy(&glthread->batches[i].fence);
+   reclaim_batches(glthread);
+   for (unsigned i = 0; i < glthread->num_free_batches; i++)
+      free(glthread->free_batches[i]);
+   free(glthread->next);
+
+#ifndef GLTHREAD_FUTEX
+   mtx_destroy(&glthread->wait_mutex);
+   cnd_destroy(&glthread->wait_cond);
+#endif
+
+   if (glthread->sync_calls) {
+      print_sync_calls(glthread);
+      _mesa_hash_table_destroy(glthread->sync_calls, NULL);
+   }
 
    free(glthread);
    ctx->GLThread = NULL;
@@ -136,9 +512,9 @@ _mesa_glthread_restore_dispatch(struct gl_context *ctx, const char *func)
    if (_glapi_get_dispatch() == ctx->MarshalExec) {
        ctx->CurrentClientDispatch = ctx->CurrentServerDispatch;
        _glapi_set_dispatch(ctx->CurrentClientDispatch);
-#if 0
-       printf("glthread disabled: %s\n", func);
-#endif
+
+       if (ctx->GLThread && ctx->GLThread->sync_calls)
+          fprintf(stderr, "glthread: disabled by %s\n", func);
    }
 }
 
@@ -149,7 +525,7 @@ _mesa_glthread_flush_batch(struct gl_context *ctx)
    if (!glthread)
       return;
 
-   struct glthread_batch *next = &glthread->batches[glthread->next];
+   struct glthread_batch *next = glthread->next;
    if (!next->used)
       return;
 
@@ -159,17 +535,36 @@ _mesa_glthread_flush_batch(struct gl_context *ctx)
     * need to restore it when it returns.
     */
    if (false) {
-      glthread_unmarshal_batch(next, 0);
+      glthread_unmarshal_batch(next);
       _glapi_set_dispatch(ctx->CurrentClientDispatch);
       return;
    }
 
    p_atomic_add(&glthread->stats.num_offloaded_items, next->used);
 
-   util_queue_add_job(&glthread->queue, next, &next->fence,
-                      glthread_unmarshal_batch, NULL);
-   glthread->last = glthread->next;
-   glthread->next = (glthread->next + 1) % MARSHAL_MAX_BATCHES;
+   uint32_t submitted = read_seqno(&glthread->submitted);
+   unsigned in_flight =
+      (submitted - read_seqno(&glthread->executed)) / SEQNO_INC;
+
+   /* Flush smaller batches while the worker thread is idle, so that it
+    * starts sooner, and bigger ones while it's behind, so that it is woken
+    * up less often.
+    */
+   if (in_flight == 0) {
+      glthread->batch_size = MAX2(glthread->batch_size / 2,
+                                  MARSHAL_MIN_BATCH_SIZE);
+   } else if (in_flight > 1) {
+      glthread->batch_size = MIN2(glthread->batch_size * 2,
+                                  MARSHAL_MAX_CMD_SIZE);
+   }
+
+   if (unlikely(glthread->sync_calls))
+      next->submit_time = os_time_get_nano();
+
+   submit_batch(ctx, next);
+
+   update_max_batches(glthread, in_flight + 1);
+   glthread->next = get_free_batch(ctx);
 }
 
 /**
@@ -193,12 +588,22 @@ _mesa_glthread_finish(struct gl_context *ctx)
    if (u_thread_is_self(glthread->queue.threads[0]))
       return;
 
-   struct glthread_batch *last = &glthread->batches[glthread->last];
-   struct glthread_batch *next = &glthread->batches[glthread->next];
+   struct glthread_batch *next = glthread->next;
+   uint32_t submitted = read_seqno(&glthread->submitted);
+   uint32_t executed = read_seqno(&glthread->executed);
    bool synced = false;
 
-   if (!util_queue_fence_is_signalled(&last->fence)) {
-      util_queue_fence_wait(&last->fence);
+   if (executed != submitted) {
+      int64_t wait_start =
+         unlikely(glthread->sync_calls) ? os_time_get_nano() : 0;
+
+      do {
+         wait_for_change(glthread, &glthread->executed, executed, 0);
+         executed = read_seqno(&glthread->executed);
+      } while (executed != submitted);
+
+      if (wait_start)
+         record_latency(glthread->wait_latency, wait_start);
       synced = true;
    }
 
@@ -209,7 +614,7 @@ _mesa_glthread_finish(struct gl_context *ctx)
        * restore it after it's done.
        */
       struct _glapi_table *dispatch = _glapi_get_dispatch();
-      glthread_unmarshal_batch(next, 0);
+      glthread_unmarshal_batch(next);
       _glapi_set_dispatch(dispatch);
 
       /* It's not a sync because we don't enqueue partial batches, but
@@ -221,3 +626,62 @@ _mesa_glthread_finish(struct gl_context *ctx)
    if (synced)
       p_atomic_inc(&glthread->stats.num_syncs);
 }
+
+/**
+ * Waits for the worker thread before executing func on the main thread.
+ *
+ * This is _mesa_glthread_finish() for the calls that can't be marshalled,
+ * counted per function for MESA_GLTHREAD_STATS.
+ */
+void
+_mesa_glthread_finish_before(struct gl_context *ctx, const char *func)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+   if (!glthread)
+      return;
+
+   if (unlikely(glthread->sync_calls)) {
+      struct hash_entry *entry =
+         _mesa_hash_table_search(glthread->sync_calls, func);
+
+      if (entry)
+         entry->data = (void *)((uintptr_t)entry->data + 1);
+      else
+         _mesa_hash_table_insert(glthread->sync_calls, func, (void *)1);
+   }
+
+   _mesa_glthread_finish(ctx);
+}
+
+/**
+ * Allocates a copy of client memory read by a command that doesn't fit in a
+ * batch.  The unmarshal function frees it with _mesa_glthread_free_staging().
+ *
+ * Returns NULL if too much staging memory is in flight already, in which
+ * case the caller should execute the call synchronously.
+ */
+void *
+_mesa_glthread_alloc_staging(struct gl_context *ctx, size_t size)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   if (size > MARSHAL_MAX_STAGING_SIZE ||
+       p_atomic_read(&glthread->staging_size) + size >
+       MARSHAL_MAX_STAGING_SIZE)
+      return NULL;
+
+   void *data = malloc(size);
+   if (data)
+      p_atomic_add(&glthread->staging_size, size);
+   return data;
+}
+
+void
+_mesa_glthread_free_staging(struct gl_context *ctx, void *data, size_t size)
+{
+   /* This runs on the worker thread, or on the main thread from
+    * _mesa_glthread_finish().
+    */
+   p_atomic_add(&ctx->GLThread->staging_size, -(int)size);
+   free(data);
+}
@@ -31,69 +31,229 @@
  * - a smaller number of calls per frame can still get decent parallelism
  * - the memory footprint of the queue is low, and with that comes a lower
  *   chance of experiencing CPU cache thrashing
- * but it should be high enough so that u_queue overhead remains negligible.
+ * but it should be high enough so that the wakeup overhead remains
+ * negligible.  Batches are flushed before they are full while the worker
+ * thread is idle, see glthread_state::batch_size.
  */
 #define MARSHAL_MAX_CMD_SIZE (8 * 1024)
 
-/* The number of batch slots in memory.
+/* The smallest amount of commands flushed at once. */
+#define MARSHAL_MIN_BATCH_SIZE 1024
+
+/* The range of the number of batches in memory.
  *
  * One batch is being executed, one batch is being filled, the rest are
  * waiting batches. There must be at least 1 slot for a waiting batch,
- * so the minimum number of batches is 3.
+ * so the minimum number of batches is 3.  More batches are allocated when
+ * the main thread has to wait for the worker thread to execute one, and
+ * they are freed again once they aren't needed anymore.  The maximum must
+ * be a power of two.
+ */
+#define MARSHAL_MIN_BATCHES 4
+#define MARSHAL_MAX_BATCHES 32
+
+/* The number of batch submissions after which the number of batches is
+ * reduced if fewer than half of them were used.
+ */
+#define MARSHAL_BATCH_SHRINK_PERIOD 256
+
+/* The number of buckets of the latency histograms, bucket i counts the
+ * latencies below 2^i microseconds and the last one all the others.
+ */
+#define MARSHAL_LATENCY_BUCKETS 20
+
+/* The maximum size of the staging copies of uploads that don't fit in a
+ * batch, which haven't been executed yet.  Past that, uploads wait for the
+ * worker thread instead.
  */
-#define MARSHAL_MAX_BATCHES 8
+#define MARSHAL_MAX_STAGING_SIZE (64 * 1024 * 1024)
 
 #include <inttypes.h>
 #include <stdbool.h>
 #include "util/u_queue.h"
+#include "main/mtypes.h"
+
+#if defined(__GNUC__) && defined(HAVE_LINUX_FUTEX_H)
+#define GLTHREAD_FUTEX
+#endif
 
 enum marshal_dispatch_cmd_id;
 struct gl_context;
+struct hash_table;
+
+/** The client-side state of a vertex array. */
+struct glthread_attrib
+{
+   /** Size of one element in bytes. */
+   GLuint element_size;
+
+   /** The effective stride, i.e. element_size if the stride was 0. */
+   GLsizei stride;
+
+   /** Pointer to client memory, or offset into the array buffer. */
+   const void *pointer;
+};
+
+/**
+ * The vertex array state tracked on the main thread side.
+ *
+ * This is only tracked on compatibility and ES contexts, which can source
+ * vertex arrays from client memory, and only for the default vertex array
+ * object, since binding another one disables glthread there.  Draw calls use
+ * it to copy the referenced ranges of client memory into the batch.
+ *
+ * This is what glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT) saves.
+ */
+struct glthread_vao
+{
+   struct glthread_attrib attribs[VERT_ATTRIB_MAX];
+
+   /** Enabled arrays (VERT_BIT_*). */
+   GLbitfield enabled;
+
+   /** Arrays whose pointer is in client memory. */
+   GLbitfield user_pointer;
+
+   /** Arrays with a non-zero instance divisor. */
+   GLbitfield instanced;
+
+   /** Names of the GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER bindings. */
+   GLuint array_buffer;
+   GLuint element_array_buffer;
+
+   /** glClientActiveTexture() unit. */
+   GLuint active_texture;
+
+   bool primitive_restart;
+   bool primitive_restart_fixed_index;
+};
+
+/** An entry of the client attribute stack. */
+struct glthread_client_attrib
+{
+   GLbitfield mask;
+   struct glthread_vao vao;
+   struct gl_pixelstore_attrib unpack;
+   GLuint pixel_pack_buffer;
+   GLuint pixel_unpack_buffer;
+};
 
 /** A single batch of commands queued up for execution. */
 struct glthread_batch
 {
-   /** Batch fence for waiting for the execution to finish. */
-   struct util_queue_fence fence;
-
    /** The worker thread will access the context with this. */
    struct gl_context *ctx;
 
    /** Amount of data used by batch commands, in bytes. */
    size_t used;
 
+   /** os_time_get_nano() at submission, only set with MESA_GLTHREAD_STATS. */
+   int64_t submit_time;
+
    /** Data contained in the command buffer. */
    uint8_t buffer[MARSHAL_MAX_CMD_SIZE];
 };
 
 struct glthread_state
 {
-   /** Multithreaded queue. */
+   /** The queue which runs the worker thread. */
    struct util_queue queue;
+   struct util_queue_fence worker_fence;
 
    /** This is sent to the driver for framebuffer overlay / HUD. */
    struct util_queue_monitoring stats;
 
-   /** The ring of batches in memory. */
-   struct glthread_batch batches[MARSHAL_MAX_BATCHES];
+   /**
+    * The ring of submitted batches, written by the main thread and read by
+    * the worker thread without locking.
+    *
+    * submitted and executed count the batches in units of SEQNO_INC, with
+    * the SEQNO_WAITING and SEQNO_PARKED flags in the low bits; see the
+    * SEQNO_* defines in glthread.c.  A NULL batch tells the worker thread
+    * to exit.
+    */
+   struct glthread_batch *ring[MARSHAL_MAX_BATCHES];
+   uint32_t submitted;
+   uint32_t executed;
+
+#ifndef GLTHREAD_FUTEX
+   mtx_t wait_mutex;
+   cnd_t wait_cond;
+#endif
+
+   /** The batch being filled and about to be submitted. */
+   struct glthread_batch *next;
 
-   /** Index of the last submitted batch. */
-   unsigned last;
+   /** The executed batches were put back in free_batches up to this. */
+   uint32_t reclaimed;
 
-   /** Index of the batch being filled and about to be submitted. */
-   unsigned next;
+   /** Allocated batches which aren't submitted. */
+   struct glthread_batch *free_batches[MARSHAL_MAX_BATCHES];
+   unsigned num_free_batches;
+
+   /** The number of allocated batches, and how many can be allocated. */
+   unsigned num_batches;
+   unsigned max_batches;
+
+   /**
+    * The most batches that were in flight at once, and the submissions
+    * left until max_batches is adjusted to that.
+    */
+   unsigned max_in_flight;
+   unsigned shrink_countdown;
 
    /**
-    * Tracks on the main thread side whether the current vertex array binding
-    * is in a VBO.
+    * The amount of commands after which the next batch is submitted.  It
+    * decreases while the worker thread is idle when batches are submitted,
+    * so that it gets work sooner, and increases when batches pile up, so
+    * that it is woken up less often.
     */
-   bool vertex_array_is_vbo;
+   size_t batch_size;
 
    /**
-    * Tracks on the main thread side whether the current element array (index
-    * buffer) binding is in a VBO.
+    * Histograms of the time between the submission and the execution of
+    * batches (written by the worker thread), and of the time the main
+    * thread spent waiting for the worker thread.  Only recorded with
+    * MESA_GLTHREAD_STATS.
     */
-   bool element_array_is_vbo;
+   unsigned queue_latency[MARSHAL_LATENCY_BUCKETS];
+   unsigned wait_latency[MARSHAL_LATENCY_BUCKETS];
+
+   /** Vertex arrays, see struct glthread_vao. */
+   struct glthread_vao vao;
+
+   /**
+    * Set once the vertex arrays were changed in a way that isn't tracked,
+    * e.g. by glInterleavedArrays() or ARB_vertex_attrib_binding.  Draw calls
+    * don't copy client arrays after that, and setting one disables glthread.
+    */
+   bool vao_untracked;
+
+   /** Names of the GL_PIXEL_PACK_BUFFER and GL_PIXEL_UNPACK_BUFFER bindings. */
+   GLuint pixel_pack_buffer;
+   GLuint pixel_unpack_buffer;
+
+   /** Pixel unpacking state, to find the client memory read by uploads. */
+   struct gl_pixelstore_attrib unpack;
+
+   /**
+    * Set once the pixel unpacking state was changed in a way that isn't
+    * tracked.  Uploads from client memory are executed synchronously then.
+    */
+   bool unpack_untracked;
+
+   /** glPushClientAttrib() stack. */
+   struct glthread_client_attrib client_attrib_stack[MAX_CLIENT_ATTRIB_STACK_DEPTH];
+   unsigned client_attrib_stack_depth;
+
+   /** Size of the staging copies not freed by the worker thread yet. */
+   int staging_size;
+
+   /**
+    * Number of synchronous calls per function name, only allocated if
+    * MESA_GLTHREAD_STATS is set.
+    */
+   struct hash_table *sync_calls;
 };
 
 void _mesa_glthread_init(struct gl_context *ctx);
@@ -102,5 +262,41 @@ void _mesa_glthread_destroy(struct gl_context *ctx);
 void _mesa_glthread_restore_dispatch(struct gl_context *ctx, const char *func);
 void _mesa_glthread_flush_batch(struct gl_context *ctx);
 void _mesa_glthread_finish(struct gl_context *ctx);
+void _mesa_glthread_finish_before(struct gl_context *ctx, const char *func);
+
+void *_mesa_glthread_alloc_staging(struct gl_context *ctx, size_t size);
+void _mesa_glthread_free_staging(struct gl_context *ctx, void *data,
+                                 size_t size);
+
+void _mesa_glthread_DeleteBuffers(struct gl_context *ctx, GLsizei n,
+                                  const GLuint *buffers);
+void _mesa_glthread_PixelStore(struct gl_context *ctx, GLenum pname,
+                               GLint param);
+void _mesa_glthread_AttribPointer(struct gl_context *ctx,
+                                  gl_vert_attrib attrib, GLint size,
+                                  GLenum type, GLsizei stride,
+                                  const void *pointer);
+void _mesa_glthread_TexCoordPointer(struct gl_context *ctx, GLuint unit,
+                                    GLint size, GLenum type, GLsizei stride,
+                                    const void *pointer);
+void _mesa_glthread_GenericAttribPointer(struct gl_context *ctx,
+                                         GLuint index, GLint size,
+                                         GLenum type, GLsizei stride,
+                                         const void *pointer);
+void _mesa_glthread_ClientState(struct gl_context *ctx, const GLuint *index,
+                                GLenum cap, bool enable);
+void _mesa_glthread_EnableVertexAttribArray(struct gl_context *ctx,
+                                            GLuint index, bool enable);
+void _mesa_glthread_ClientActiveTexture(struct gl_context *ctx,
+                                        GLenum texture);
+void _mesa_glthread_VertexAttribDivisor(struct gl_context *ctx, GLuint index,
+                                        GLuint divisor);
+void _mesa_glthread_PushClientAttrib(struct gl_context *ctx, GLbitfield mask);
+void _mesa_glthread_PopClientAttrib(struct gl_context *ctx);
+void _mesa_glthread_UntrackVertexArrays(struct gl_context *ctx,
+                                        bool sets_user_arrays,
+                                        const char *func);
+bool _mesa_glthread_GetIntegerv(struct gl_context *ctx, GLenum pname,
+                                GLint *params);
 
 #endif /* _GLTHREAD_H*/
@@ -0,0 +1,408 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/** @file glthread_varray.c
+ *
+ * Tracking of the state that decides how calls are marshalled, on the main
+ * thread side: vertex arrays, the client attribute stack, pixel unpacking and
+ * buffer bindings.
+ *
+ * All of this assumes that the calls are valid, like the tracking of buffer
+ * bindings in marshal.c, except where an invalid call would make us read
+ * client memory that the worker thread won't.  The server ignores the calls
+ * that generate errors, so these ignore them too.
+ */
+
+#include "main/context.h"
+#include "main/glformats.h"
+#include "main/glthread.h"
+#include "main/marshal.h"
+#include "main/mtypes.h"
+
+/**
+ * Only compatibility and ES contexts can source vertex arrays from client
+ * memory, and glthread is disabled there when binding a non-default vertex
+ * array object, so this is the state of the default one.
+ */
+static inline bool
+tracks_vertex_arrays(const struct gl_context *ctx)
+{
+   return ctx->API != API_OPENGL_CORE;
+}
+
+/**
+ * Whether the tracked buffer bindings are known to be those of the server.
+ * glBindBuffer() fails in core contexts for names that weren't generated,
+ * leaving the previous binding, which isn't known here; that's only ruled
+ * out in compatibility contexts, where any name can be bound.
+ */
+static inline bool
+tracks_buffer_names(const struct gl_context *ctx)
+{
+   return ctx->API == API_OPENGL_COMPAT;
+}
+
+static inline GLuint
+max_generic_attribs(const struct gl_context *ctx)
+{
+   return ctx->Const.Program[MESA_SHADER_VERTEX].MaxAttribs;
+}
+
+void
+_mesa_glthread_DeleteBuffers(struct gl_context *ctx, GLsizei n,
+                             const GLuint *buffers)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   if (!buffers)
+      return;
+
+   /* Deleting a bound buffer unbinds it. */
+   for (GLsizei i = 0; i < n; i++) {
+      GLuint id = buffers[i];
+
+      if (!id)
+         continue;
+
+      if (id == glthread->vao.array_buffer)
+         glthread->vao.array_buffer = 0;
+      if (id == glthread->vao.element_array_buffer)
+         glthread->vao.element_array_buffer = 0;
+      if (id == glthread->pixel_pack_buffer)
+         glthread->pixel_pack_buffer = 0;
+      if (id == glthread->pixel_unpack_buffer)
+         glthread->pixel_unpack_buffer = 0;
+   }
+}
+
+void
+_mesa_glthread_PixelStore(struct gl_context *ctx, GLenum pname, GLint param)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+   struct gl_pixelstore_attrib *unpack = &glthread->unpack;
+   const bool has_subimage = _mesa_is_desktop_gl(ctx) || _mesa_is_gles3(ctx);
+
+   /* Only what changes the memory read by uploads, see pixel_storei(). */
+   switch (pname) {
+   case GL_UNPACK_ALIGNMENT:
+      if (param == 1 || param == 2 || param == 4 || param == 8)
+         unpack->Alignment = param;
+      break;
+   case GL_UNPACK_ROW_LENGTH:
+   case GL_UNPACK_SKIP_PIXELS:
+   case GL_UNPACK_SKIP_ROWS:
+      if (param < 0)
+         break;
+
+      /* OpenGL ES 2.0 contexts accept these for EXT_unpack_subimage, which
+       * isn't tracked, so uploads from client memory synchronize there.
+       */
+      if (!has_subimage) {
+         if (ctx->API == API_OPENGLES2 && param)
+            glthread->unpack_untracked = true;
+         break;
+      }
+
+      if (pname == GL_UNPACK_ROW_LENGTH)
+         unpack->RowLength = param;
+      else if (pname == GL_UNPACK_SKIP_PIXELS)
+         unpack->SkipPixels = param;
+      else
+         unpack->SkipRows = param;
+      break;
+   case GL_UNPACK_IMAGE_HEIGHT:
+      if (has_subimage && param >= 0)
+         unpack->ImageHeight = param;
+      break;
+   case GL_UNPACK_SKIP_IMAGES:
+      if (has_subimage && param >= 0)
+         unpack->SkipImages = param;
+      break;
+   }
+}
+
+void
+_mesa_glthread_AttribPointer(struct gl_context *ctx, gl_vert_attrib attrib,
+                             GLint size, GLenum type, GLsizei stride,
+                             const void *pointer)
+{
+   struct glthread_vao *vao = &ctx->GLThread->vao;
+
+   if (!tracks_vertex_arrays(ctx))
+      return;
+
+   if (size == GL_BGRA)
+      size = 4;
+
+   int element_size = _mesa_bytes_per_vertex_attrib(size, type);
+   if (size < 1 || size > 4 || element_size <= 0 || stride < 0)
+      return;
+
+   struct glthread_attrib *a = &vao->attribs[attrib];
+   a->element_size = element_size;
+   a->stride = stride ? stride : element_size;
+   a->pointer = pointer;
+
+   if (vao->array_buffer)
+      vao->user_pointer &= ~VERT_BIT(attrib);
+   else
+      vao->user_pointer |= VERT_BIT(attrib);
+}
+
+void
+_mesa_glthread_TexCoordPointer(struct gl_context *ctx, GLuint unit,
+                               GLint size, GLenum type, GLsizei stride,
+                               const void *pointer)
+{
+   if (unit < ctx->Const.MaxTextureCoordUnits) {
+      _mesa_glthread_AttribPointer(ctx, VERT_ATTRIB_TEX(unit), size, type,
+                                   stride, pointer);
+   }
+}
+
+void
+_mesa_glthread_GenericAttribPointer(struct gl_context *ctx, GLuint index,
+                                    GLint size, GLenum type, GLsizei stride,
+                                    const void *pointer)
+{
+   if (index < max_generic_attribs(ctx)) {
+      _mesa_glthread_AttribPointer(ctx, VERT_ATTRIB_GENERIC(index), size,
+                                   type, stride, pointer);
+   }
+}
+
+static void
+set_enabled(struct glthread_vao *vao, gl_vert_attrib attrib, bool enable)
+{
+   if (enable)
+      vao->enabled |= VERT_BIT(attrib);
+   else
+      vao->enabled &= ~VERT_BIT(attrib);
+}
+
+/**
+ * Tracks gl{Enable,Disable}ClientState(), and glEnable()/glDisable() which
+ * also take the client arrays and the primitive restart enables (part of the
+ * client vertex array state).  index is the texture unit of the
+ * glEnableClientStateiEXT() variants.
+ */
+void
+_mesa_glthread_ClientState(struct gl_context *ctx, const GLuint *index,
+                           GLenum cap, bool enable)
+{
+   struct glthread_vao *vao = &ctx->GLThread->vao;
+
+   if (!tracks_vertex_arrays(ctx))
+      return;
+
+   if (index && cap != GL_TEXTURE_COORD_ARRAY)
+      return;
+
+   switch (cap) {
+   case GL_VERTEX_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_POS, enable);
+      break;
+   case GL_NORMAL_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_NORMAL, enable);
+      break;
+   case GL_COLOR_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_COLOR0, enable);
+      break;
+   case GL_INDEX_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_COLOR_INDEX, enable);
+      break;
+   case GL_TEXTURE_COORD_ARRAY: {
+      GLuint unit = index ? *index : vao->active_texture;
+
+      if (unit < ctx->Const.MaxTextureCoordUnits)
+         set_enabled(vao, VERT_ATTRIB_TEX(unit), enable);
+      break;
+   }
+   case GL_EDGE_FLAG_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_EDGEFLAG, enable);
+      break;
+   case GL_FOG_COORDINATE_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_FOG, enable);
+      break;
+   case GL_SECONDARY_COLOR_ARRAY:
+      set_enabled(vao, VERT_ATTRIB_COLOR1, enable);
+      break;
+   case GL_POINT_SIZE_ARRAY_OES:
+      set_enabled(vao, VERT_ATTRIB_POINT_SIZE, enable);
+      break;
+   case GL_PRIMITIVE_RESTART_NV:
+   case GL_PRIMITIVE_RESTART:
+      vao->primitive_restart = enable;
+      break;
+   case GL_PRIMITIVE_RESTART_FIXED_INDEX:
+      vao->primitive_restart_fixed_index = enable;
+      break;
+   }
+}
+
+void
+_mesa_glthread_EnableVertexAttribArray(struct gl_context *ctx, GLuint index,
+                                       bool enable)
+{
+   if (tracks_vertex_arrays(ctx) && index < max_generic_attribs(ctx))
+      set_enabled(&ctx->GLThread->vao, VERT_ATTRIB_GENERIC(index), enable);
+}
+
+void
+_mesa_glthread_ClientActiveTexture(struct gl_context *ctx, GLenum texture)
+{
+   GLuint unit = texture - GL_TEXTURE0;
+
+   if (unit < ctx->Const.MaxTextureCoordUnits)
+      ctx->GLThread->vao.active_texture = unit;
+}
+
+void
+_mesa_glthread_VertexAttribDivisor(struct gl_context *ctx, GLuint index,
+                                   GLuint divisor)
+{
+   struct glthread_vao *vao = &ctx->GLThread->vao;
+
+   if (!tracks_vertex_arrays(ctx) || index >= max_generic_attribs(ctx))
+      return;
+
+   if (divisor)
+      vao->instanced |= VERT_BIT_GENERIC(index);
+   else
+      vao->instanced &= ~VERT_BIT_GENERIC(index);
+}
+
+void
+_mesa_glthread_PushClientAttrib(struct gl_context *ctx, GLbitfield mask)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   if (ctx->API != API_OPENGL_COMPAT ||
+       glthread->client_attrib_stack_depth >= MAX_CLIENT_ATTRIB_STACK_DEPTH)
+      return;
+
+   struct glthread_client_attrib *top =
+      &glthread->client_attrib_stack[glthread->client_attrib_stack_depth++];
+
+   top->mask = mask;
+   if (mask & GL_CLIENT_VERTEX_ARRAY_BIT)
+      top->vao = glthread->vao;
+   if (mask & GL_CLIENT_PIXEL_STORE_BIT) {
+      top->unpack = glthread->unpack;
+      top->pixel_pack_buffer = glthread->pixel_pack_buffer;
+      top->pixel_unpack_buffer = glthread->pixel_unpack_buffer;
+   }
+}
+
+void
+_mesa_glthread_PopClientAttrib(struct gl_context *ctx)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   if (ctx->API != API_OPENGL_COMPAT ||
+       glthread->client_attrib_stack_depth == 0)
+      return;
+
+   const struct glthread_client_attrib *top =
+      &glthread->client_attrib_stack[--glthread->client_attrib_stack_depth];
+
+   if (top->mask & GL_CLIENT_VERTEX_ARRAY_BIT)
+      glthread->vao = top->vao;
+   if (top->mask & GL_CLIENT_PIXEL_STORE_BIT) {
+      glthread->unpack = top->unpack;
+      glthread->pixel_pack_buffer = top->pixel_pack_buffer;
+      glthread->pixel_unpack_buffer = top->pixel_unpack_buffer;
+   }
+}
+
+/**
+ * Called after calls that change the vertex arrays in ways that we don't
+ * track.  The draw calls stop copying client arrays, so if there are any, or
+ * if the call can set some, this disables glthread like it used to be
+ * disabled on any client array.
+ */
+void
+_mesa_glthread_UntrackVertexArrays(struct gl_context *ctx,
+                                   bool sets_user_arrays, const char *func)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   if (!tracks_vertex_arrays(ctx))
+      return;
+
+   glthread->vao_untracked = true;
+
+   if (sets_user_arrays || glthread->vao.user_pointer) {
+      _mesa_glthread_finish(ctx);
+      _mesa_glthread_restore_dispatch(ctx, func);
+   }
+}
+
+/**
+ * Answers the glGetIntegerv() queries of state tracked here without waiting
+ * for the worker thread.  Returns false for everything else.
+ */
+bool
+_mesa_glthread_GetIntegerv(struct gl_context *ctx, GLenum pname,
+                           GLint *params)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   switch (pname) {
+   case GL_ARRAY_BUFFER_BINDING:
+      if (!tracks_buffer_names(ctx))
+         return false;
+      *params = glthread->vao.array_buffer;
+      return true;
+   case GL_ELEMENT_ARRAY_BUFFER_BINDING:
+      if (!tracks_buffer_names(ctx))
+         return false;
+      *params = glthread->vao.element_array_buffer;
+      return true;
+   case GL_CLIENT_ACTIVE_TEXTURE:
+      if (ctx->API != API_OPENGL_COMPAT && ctx->API != API_OPENGLES)
+         return false;
+      *params = GL_TEXTURE0 + glthread->vao.active_texture;
+      return true;
+   case GL_PIXEL_PACK_BUFFER_BINDING:
+      if (!tracks_buffer_names(ctx) || !_mesa_glthread_has_pixel_buffers(ctx))
+         return false;
+      *params = glthread->pixel_pack_buffer;
+      return true;
+   case GL_PIXEL_UNPACK_BUFFER_BINDING:
+      if (!tracks_buffer_names(ctx) || !_mesa_glthread_has_pixel_buffers(ctx))
+         return false;
+      *params = glthread->pixel_unpack_buffer;
+      return true;
+   case GL_UNPACK_ALIGNMENT:
+      *params = glthread->unpack.Alignment;
+      return true;
+   case GL_UNPACK_ROW_LENGTH:
+      if (!_mesa_is_desktop_gl(ctx))
+         return false;
+      *params = glthread->unpack.RowLength;
+      return true;
+   default:
+      return false;
+   }
+}
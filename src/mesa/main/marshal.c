@@ -27,11 +27,17 @@
  * thread when automatic code generation isn't appropriate.
  */
 
+#include "main/bufferobj.h"
 #include "main/enums.h"
+#include "main/glformats.h"
+#include "main/image.h"
 #include "main/macros.h"
+#include "main/teximage.h"
+#include "main/varray.h"
 #include "marshal.h"
 #include "dispatch.h"
 #include "marshal_generated.h"
+#include "util/bitscan.h"
 
 struct marshal_cmd_Flush
 {
@@ -65,6 +71,46 @@ _mesa_marshal_Flush(void)
    _mesa_glthread_flush_batch(ctx);
 }
 
+/**
+ * Allocates a command followed by data_size bytes of data.  If they don't fit
+ * in a batch, the data goes to a staging copy instead, which the unmarshal
+ * function frees.  Returns NULL if that fails too, in which case the call has
+ * to be executed synchronously.
+ */
+static void *
+allocate_command_with_data(struct gl_context *ctx, uint16_t cmd_id,
+                           size_t cmd_size, size_t data_size,
+                           void **data, void **staging)
+{
+   const size_t aligned_cmd_size = ALIGN(cmd_size, 8);
+   void *cmd;
+
+   if (data_size <= MARSHAL_MAX_CMD_SIZE - aligned_cmd_size) {
+      cmd = _mesa_glthread_allocate_command(ctx, cmd_id,
+                                            aligned_cmd_size + data_size);
+      *data = (char *) cmd + aligned_cmd_size;
+      *staging = NULL;
+      return cmd;
+   }
+
+   *staging = _mesa_glthread_alloc_staging(ctx, data_size);
+   if (!*staging)
+      return NULL;
+
+   cmd = _mesa_glthread_allocate_command(ctx, cmd_id, cmd_size);
+   *data = *staging;
+   return cmd;
+}
+
+/** Returns the data allocated by allocate_command_with_data(). */
+static inline const void *
+get_command_data(const void *cmd, size_t cmd_size, const void *staging)
+{
+   if (staging)
+      return staging;
+   return (const char *) cmd + ALIGN(cmd_size, 8);
+}
+
 /* Enable: marshalled asynchronously */
 struct marshal_cmd_Enable
 {
@@ -95,6 +141,7 @@ _mesa_marshal_Enable(GLenum cap)
                                             sizeof(*cmd));
       cmd->cap = cap;
       _mesa_post_marshal_hook(ctx);
+      _mesa_glthread_ClientState(ctx, NULL, cap, true);
       return;
    }
 
@@ -187,7 +234,7 @@ _mesa_marshal_ShaderSource(GLuint shader, GLsizei count,
       }
       _mesa_post_marshal_hook(ctx);
    } else {
-      _mesa_glthread_finish(ctx);
+      _mesa_glthread_finish_before(ctx, "ShaderSource");
       CALL_ShaderSource(ctx->CurrentServerDispatch,
                         (shader, count, string, length_tmp));
    }
@@ -204,12 +251,13 @@ struct marshal_cmd_BindBufferBase
    GLuint buffer;
 };
 
-/** Tracks the current bindings for the vertex array and index array buffers.
+/** Tracks the current bindings for the vertex array, index array and pixel
+ * buffers.
  *
- * This is part of what we need to enable glthread on compat-GL contexts that
- * happen to use VBOs, without also supporting the full tracking of VBO vs
- * user vertex array bindings per attribute on each vertex array for
- * determining what to upload at draw call time.
+ * This is how we know whether the vertex arrays set by gl*Pointer() and the
+ * indices of draw calls are in client memory, in which case the draw calls
+ * copy what they reference, and whether the pointers of pixel uploads and
+ * readbacks are offsets into a buffer.
  *
  * Note that GL core makes it so that a buffer binding with an invalid handle
  * in the "buffer" parameter will throw an error, and then a
@@ -234,14 +282,22 @@ track_vbo_binding(struct gl_context *ctx, GLenum target, GLuint buffer)
 
    switch (target) {
    case GL_ARRAY_BUFFER:
-      glthread->vertex_array_is_vbo = (buffer != 0);
+      glthread->vao.array_buffer = buffer;
       break;
    case GL_ELEMENT_ARRAY_BUFFER:
       /* The current element array buffer binding is actually tracked in the
        * vertex array object instead of the context, so this would need to
        * change on vertex array object updates.
        */
-      glthread->element_array_is_vbo = (buffer != 0);
+      glthread->vao.element_array_buffer = buffer;
+      break;
+   case GL_PIXEL_PACK_BUFFER:
+      if (_mesa_glthread_has_pixel_buffers(ctx))
+         glthread->pixel_pack_buffer = buffer;
+      break;
+   case GL_PIXEL_UNPACK_BUFFER:
+      if (_mesa_glthread_has_pixel_buffers(ctx))
+         glthread->pixel_unpack_buffer = buffer;
       break;
    }
 }
@@ -283,7 +339,7 @@ _mesa_marshal_BindBuffer(GLenum target, GLuint buffer)
       cmd->buffer = buffer;
       _mesa_post_marshal_hook(ctx);
    } else {
-      _mesa_glthread_finish(ctx);
+      _mesa_glthread_finish_before(ctx, "BindBuffer");
       CALL_BindBuffer(ctx->CurrentServerDispatch, (target, buffer));
    }
 }
@@ -296,6 +352,7 @@ struct marshal_cmd_BufferData
    GLsizeiptr size;
    GLenum usage;
    bool data_null; /* If set, no data follows for "data" */
+   void *staging; /* If set, the data is here instead of following */
    /* Next size bytes are GLubyte data[size] */
 };
 
@@ -311,9 +368,12 @@ _mesa_unmarshal_BufferData(struct gl_context *ctx,
    if (cmd->data_null)
       data = NULL;
    else
-      data = (const void *) (cmd + 1);
+      data = get_command_data(cmd, sizeof(*cmd), cmd->staging);
 
    CALL_BufferData(ctx->CurrentServerDispatch, (target, size, data, usage));
+
+   if (cmd->staging)
+      _mesa_glthread_free_staging(ctx, cmd->staging, size);
 }
 
 void GLAPIENTRY
@@ -321,8 +381,6 @@ _mesa_marshal_BufferData(GLenum target, GLsizeiptr size, const GLvoid * data,
                          GLenum usage)
 {
    GET_CURRENT_CONTEXT(ctx);
-   size_t cmd_size =
-      sizeof(struct marshal_cmd_BufferData) + (data ? size : 0);
    debug_print_marshal("BufferData");
 
    if (unlikely(size < 0)) {
@@ -331,26 +389,29 @@ _mesa_marshal_BufferData(GLenum target, GLsizeiptr size, const GLvoid * data,
       return;
    }
 
-   if (target != GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD &&
-       cmd_size <= MARSHAL_MAX_CMD_SIZE) {
-      struct marshal_cmd_BufferData *cmd =
-         _mesa_glthread_allocate_command(ctx, DISPATCH_CMD_BufferData,
-                                         cmd_size);
-
-      cmd->target = target;
-      cmd->size = size;
-      cmd->usage = usage;
-      cmd->data_null = !data;
-      if (data) {
-         char *variable_data = (char *) (cmd + 1);
-         memcpy(variable_data, data, size);
+   if (target != GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD) {
+      struct marshal_cmd_BufferData *cmd;
+      void *variable_data, *staging;
+
+      cmd = allocate_command_with_data(ctx, DISPATCH_CMD_BufferData,
+                                       sizeof(*cmd), data ? size : 0,
+                                       &variable_data, &staging);
+      if (cmd) {
+         cmd->target = target;
+         cmd->size = size;
+         cmd->usage = usage;
+         cmd->data_null = !data;
+         cmd->staging = staging;
+         if (data)
+            memcpy(variable_data, data, size);
+         _mesa_post_marshal_hook(ctx);
+         return;
       }
-      _mesa_post_marshal_hook(ctx);
-   } else {
-      _mesa_glthread_finish(ctx);
-      CALL_BufferData(ctx->CurrentServerDispatch,
-                      (target, size, data, usage));
    }
+
+   _mesa_glthread_finish_before(ctx, "BufferData");
+   CALL_BufferData(ctx->CurrentServerDispatch,
+                   (target, size, data, usage));
 }
 
 /* BufferSubData: marshalled asynchronously */
@@ -360,6 +421,7 @@ struct marshal_cmd_BufferSubData
    GLenum target;
    GLintptr offset;
    GLsizeiptr size;
+   void *staging; /* If set, the data is here instead of following */
    /* Next size bytes are GLubyte data[size] */
 };
 
@@ -370,10 +432,13 @@ _mesa_unmarshal_BufferSubData(struct gl_context *ctx,
    const GLenum target = cmd->target;
    const GLintptr offset = cmd->offset;
    const GLsizeiptr size = cmd->size;
-   const void *data = (const void *) (cmd + 1);
+   const void *data = get_command_data(cmd, sizeof(*cmd), cmd->staging);
 
    CALL_BufferSubData(ctx->CurrentServerDispatch,
                       (target, offset, size, data));
+
+   if (cmd->staging)
+      _mesa_glthread_free_staging(ctx, cmd->staging, size);
 }
 
 void GLAPIENTRY
@@ -381,7 +446,6 @@ _mesa_marshal_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
                             const GLvoid * data)
 {
    GET_CURRENT_CONTEXT(ctx);
-   size_t cmd_size = sizeof(struct marshal_cmd_BufferSubData) + size;
 
    debug_print_marshal("BufferSubData");
    if (unlikely(size < 0)) {
@@ -390,22 +454,27 @@ _mesa_marshal_BufferSubData(GLenum target, GLintptr offset, GLsizeiptr size,
       return;
    }
 
-   if (target != GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD &&
-       cmd_size <= MARSHAL_MAX_CMD_SIZE) {
-      struct marshal_cmd_BufferSubData *cmd =
-         _mesa_glthread_allocate_command(ctx, DISPATCH_CMD_BufferSubData,
-                                         cmd_size);
-      cmd->target = target;
-      cmd->offset = offset;
-      cmd->size = size;
-      char *variable_data = (char *) (cmd + 1);
-      memcpy(variable_data, data, size);
-      _mesa_post_marshal_hook(ctx);
-   } else {
-      _mesa_glthread_finish(ctx);
-      CALL_BufferSubData(ctx->CurrentServerDispatch,
-                         (target, offset, size, data));
+   if (target != GL_EXTERNAL_VIRTUAL_MEMORY_BUFFER_AMD) {
+      struct marshal_cmd_BufferSubData *cmd;
+      void *variable_data, *staging;
+
+      cmd = allocate_command_with_data(ctx, DISPATCH_CMD_BufferSubData,
+                                       sizeof(*cmd), size,
+                                       &variable_data, &staging);
+      if (cmd) {
+         cmd->target = target;
+         cmd->offset = offset;
+         cmd->size = size;
+         cmd->staging = staging;
+         memcpy(variable_data, data, size);
+         _mesa_post_marshal_hook(ctx);
+         return;
+      }
    }
+
+   _mesa_glthread_finish_before(ctx, "BufferSubData");
+   CALL_BufferSubData(ctx->CurrentServerDispatch,
+                      (target, offset, size, data));
 }
 
 /* NamedBufferData: marshalled asynchronously */
@@ -416,6 +485,7 @@ struct marshal_cmd_NamedBufferData
    GLsizei size;
    GLenum usage;
    bool data_null; /* If set, no data follows for "data" */
+   void *staging; /* If set, the data is here instead of following */
    /* Next size bytes are GLubyte data[size] */
 };
 
@@ -431,10 +501,13 @@ _mesa_unmarshal_NamedBufferData(struct gl_context *ctx,
    if (cmd->data_null)
       data = NULL;
    else
-      data = (const void *) (cmd + 1);
+      data = get_command_data(cmd, sizeof(*cmd), cmd->staging);
 
    CALL_NamedBufferData(ctx->CurrentServerDispatch,
                         (name, size, data, usage));
+
+   if (cmd->staging)
+      _mesa_glthread_free_staging(ctx, cmd->staging, size);
 }
 
 void GLAPIENTRY
@@ -442,7 +515,6 @@ _mesa_marshal_NamedBufferData(GLuint buffer, GLsizeiptr size,
                               const GLvoid * data, GLenum usage)
 {
    GET_CURRENT_CONTEXT(ctx);
-   size_t cmd_size = sizeof(struct marshal_cmd_NamedBufferData) + (data ? size : 0);
 
    debug_print_marshal("NamedBufferData");
    if (unlikely(size < 0)) {
@@ -451,24 +523,29 @@ _mesa_marshal_NamedBufferData(GLuint buffer, GLsizeiptr size,
       return;
    }
 
-   if (buffer > 0 && cmd_size <= MARSHAL_MAX_CMD_SIZE) {
-      struct marshal_cmd_NamedBufferData *cmd =
-         _mesa_glthread_allocate_command(ctx, DISPATCH_CMD_NamedBufferData,
-                                         cmd_size);
-      cmd->name = buffer;
-      cmd->size = size;
-      cmd->usage = usage;
-      cmd->data_null = !data;
-      if (data) {
-         char *variable_data = (char *) (cmd + 1);
-         memcpy(variable_data, data, size);
+   if (buffer > 0) {
+      struct marshal_cmd_NamedBufferData *cmd;
+      void *variable_data, *staging;
+
+      cmd = allocate_command_with_data(ctx, DISPATCH_CMD_NamedBufferData,
+                                       sizeof(*cmd), data ? size : 0,
+                                       &variable_data, &staging);
+      if (cmd) {
+         cmd->name = buffer;
+         cmd->size = size;
+         cmd->usage = usage;
+         cmd->data_null = !data;
+         cmd->staging = staging;
+         if (data)
+            memcpy(variable_data, data, size);
+         _mesa_post_marshal_hook(ctx);
+         return;
       }
-      _mesa_post_marshal_hook(ctx);
-   } else {
-      _mesa_glthread_finish(ctx);
-      CALL_NamedBufferData(ctx->CurrentServerDispatch,
-                           (buffer, size, data, usage));
    }
+
+   _mesa_glthread_finish_before(ctx, "NamedBufferData");
+   CALL_NamedBufferData(ctx->CurrentServerDispatch,
+                        (buffer, size, data, usage));
 }
 
 /* NamedBufferSubData: marshalled asynchronously */
@@ -478,6 +555,7 @@ struct marshal_cmd_NamedBufferSubData
    GLuint name;
    GLintptr offset;
    GLsizei size;
+   void *staging; /* If set, the data is here instead of following */
    /* Next size bytes are GLubyte data[size] */
 };
 
@@ -488,10 +566,13 @@ _mesa_unmarshal_NamedBufferSubData(struct gl_context *ctx,
    const GLuint name = cmd->name;
    const GLintptr offset = cmd->offset;
    const GLsizei size = cmd->size;
-   const void *data = (const void *) (cmd + 1);
+   const void *data = get_command_data(cmd, sizeof(*cmd), cmd->staging);
 
    CALL_NamedBufferSubData(ctx->CurrentServerDispatch,
                            (name, offset, size, data));
+
+   if (cmd->staging)
+      _mesa_glthread_free_staging(ctx, cmd->staging, size);
 }
 
 void GLAPIENTRY
@@ -499,7 +580,6 @@ _mesa_marshal_NamedBufferSubData(GLuint buffer, GLintptr offset,
                                  GLsizeiptr size, const GLvoid * data)
 {
    GET_CURRENT_CONTEXT(ctx);
-   size_t cmd_size = sizeof(struct marshal_cmd_NamedBufferSubData) + size;
 
    debug_print_marshal("NamedBufferSubData");
    if (unlikely(size < 0)) {
@@ -508,21 +588,27 @@ _mesa_marshal_NamedBufferSubData(GLuint buffer, GLintptr offset,
       return;
    }
 
-   if (buffer > 0 && cmd_size <= MARSHAL_MAX_CMD_SIZE) {
-      struct marshal_cmd_NamedBufferSubData *cmd =
-         _mesa_glthread_allocate_command(ctx, DISPATCH_CMD_NamedBufferSubData,
-                                         cmd_size);
-      cmd->name = buffer;
-      cmd->offset = offset;
-      cmd->size = size;
-      char *variable_data = (char *) (cmd + 1);
-      memcpy(variable_data, data, size);
-      _mesa_post_marshal_hook(ctx);
-   } else {
-      _mesa_glthread_finish(ctx);
-      CALL_NamedBufferSubData(ctx->CurrentServerDispatch,
-                              (buffer, offset, size, data));
+   if (buffer > 0) {
+      struct marshal_cmd_NamedBufferSubData *cmd;
+      void *variable_data, *staging;
+
+      cmd = allocate_command_with_data(ctx, DISPATCH_CMD_NamedBufferSubData,
+                                       sizeof(*cmd), size,
+                                       &variable_data, &staging);
+      if (cmd) {
+         cmd->name = buffer;
+         cmd->offset = offset;
+         cmd->size = size;
+         cmd->staging = staging;
+         memcpy(variable_data, data, size);
+         _mesa_post_marshal_hook(ctx);
+         return;
+      }
    }
+
+   _mesa_glthread_finish_before(ctx, "NamedBufferSubData");
+   CALL_NamedBufferSubData(ctx->CurrentServerDispatch,
+                           (buffer, offset, size, data));
 }
 
 /* ClearBuffer* (all variants): marshalled asynchronously */
@@ -651,7 +737,7 @@ _mesa_marshal_ClearBufferfv(GLenum buffer, GLint drawbuffer,
    if (!clear_buffer_add_command(ctx, DISPATCH_CMD_ClearBufferfv, buffer,
                                  drawbuffer, (GLuint *)value, size)) {
       debug_print_sync("ClearBufferfv");
-      _mesa_glthread_finish(ctx);
+      _mesa_glthread_finish_before(ctx, "ClearBufferfv");
       CALL_ClearBufferfv(ctx->CurrentServerDispatch,
                          (buffer, drawbuffer, value));
    }
@@ -681,7 +767,7 @@ _mesa_marshal_ClearBufferiv(GLenum buffer, GLint drawbuffer,
    if (!clear_buffer_add_command(ctx, DISPATCH_CMD_ClearBufferiv, buffer,
                                  drawbuffer, (GLuint *)value, size)) {
       debug_print_sync("ClearBufferiv");
-      _mesa_glthread_finish(ctx);
+      _mesa_glthread_finish_before(ctx, "ClearBufferiv");
       CALL_ClearBufferiv(ctx->CurrentServerDispatch,
                          (buffer, drawbuffer, value));
    }
@@ -710,7 +796,7 @@ _mesa_marshal_ClearBufferuiv(GLenum buffer, GLint drawbuffer,
    if (!clear_buffer_add_command(ctx, DISPATCH_CMD_ClearBufferuiv, buffer,
                                  drawbuffer, (GLuint *)value, 4)) {
       debug_print_sync("ClearBufferuiv");
-      _mesa_glthread_finish(ctx);
+      _mesa_glthread_finish_before(ctx, "ClearBufferuiv");
       CALL_ClearBufferuiv(ctx->CurrentServerDispatch,
                          (buffer, drawbuffer, value));
    }
@@ -742,8 +828,853 @@ _mesa_marshal_ClearBufferfi(GLenum buffer, GLint drawbuffer,
    if (!clear_buffer_add_command(ctx, DISPATCH_CMD_ClearBufferfi, buffer,
                                  drawbuffer, (GLuint *)value, 2)) {
       debug_print_sync("ClearBufferfi");
-      _mesa_glthread_finish(ctx);
+      _mesa_glthread_finish_before(ctx, "ClearBufferfi");
       CALL_ClearBufferfi(ctx->CurrentServerDispatch,
                          (buffer, drawbuffer, depth, stencil));
    }
 }
+
+/** How the pixels of an upload are passed to the worker thread. */
+struct marshal_image
+{
+   /** The pixels pointer, unless they were copied. */
+   const GLvoid *pixels;
+
+   /** The offset of the copy from the pixels pointer. */
+   GLintptr start;
+
+   /** The size of the copy. */
+   size_t size;
+
+   /** If set, the copy is here instead of following the command. */
+   void *staging;
+
+   bool copied;
+};
+
+/**
+ * Finds the range of client memory read by a pixel upload with the tracked
+ * unpacking state, relative to the pixels pointer.  Returns false if it
+ * isn't known, e.g. because the call generates an error.
+ */
+static bool
+get_image_range(const struct gl_context *ctx, GLuint dims, GLsizei width,
+                GLsizei height, GLsizei depth, GLenum format, GLenum type,
+                GLintptr *start, size_t *size)
+{
+   const struct gl_pixelstore_attrib *unpack = &ctx->GLThread->unpack;
+
+   if (ctx->GLThread->unpack_untracked)
+      return false;
+
+   if (width < 0 || height < 0 || depth < 0 || type == GL_BITMAP)
+      return false;
+
+   if (width == 0 || height == 0 || depth == 0) {
+      *start = 0;
+      *size = 0;
+      return true;
+   }
+
+   const GLint bytes_per_pixel = _mesa_bytes_per_pixel(format, type);
+   if (bytes_per_pixel <= 0)
+      return false;
+
+   const GLintptr first =
+      _mesa_image_offset(dims, unpack, width, height, format, type, 0, 0, 0);
+   const GLintptr last =
+      _mesa_image_offset(dims, unpack, width, height, format, type,
+                         dims == 3 ? depth - 1 : 0, dims >= 2 ? height - 1 : 0,
+                         0) + (GLintptr) width * bytes_per_pixel;
+
+   if (first < 0 || last < first)
+      return false;
+
+   *start = first;
+   *size = last - first;
+   return true;
+}
+
+/**
+ * Allocates a pixel upload command, followed by the copy of the client memory
+ * it reads, unless the pixels are in a pixel unpack buffer.  Returns NULL if
+ * the call has to be executed synchronously.
+ */
+static void *
+allocate_image_command(struct gl_context *ctx, uint16_t cmd_id,
+                       size_t cmd_size, GLuint dims, GLsizei width,
+                       GLsizei height, GLsizei depth, GLenum format,
+                       GLenum type, const GLvoid *pixels,
+                       struct marshal_image *image)
+{
+   void *cmd, *copy;
+
+   memset(image, 0, sizeof(*image));
+   image->pixels = pixels;
+
+   if (!pixels || _mesa_glthread_has_unpack_buffer(ctx))
+      return _mesa_glthread_allocate_command(ctx, cmd_id, cmd_size);
+
+   if (!get_image_range(ctx, dims, width, height, depth, format, type,
+                        &image->start, &image->size))
+      return NULL;
+
+   cmd = allocate_command_with_data(ctx, cmd_id, cmd_size, image->size,
+                                    &copy, &image->staging);
+   if (!cmd)
+      return NULL;
+
+   memcpy(copy, (const GLubyte *) pixels + image->start, image->size);
+   image->copied = true;
+   return cmd;
+}
+
+static const GLvoid *
+get_image_pixels(const void *cmd, size_t cmd_size,
+                 const struct marshal_image *image)
+{
+   if (!image->copied)
+      return image->pixels;
+
+   return (const GLubyte *) get_command_data(cmd, cmd_size, image->staging) -
+          image->start;
+}
+
+static void
+free_image(struct gl_context *ctx, const struct marshal_image *image)
+{
+   if (image->staging)
+      _mesa_glthread_free_staging(ctx, image->staging, image->size);
+}
+
+/* TexImage1D/2D/3D: marshalled asynchronously */
+struct marshal_cmd_TexImage
+{
+   struct marshal_cmd_base cmd_base;
+   GLenum target;
+   GLint level;
+   GLint internalformat;
+   GLsizei width;
+   GLsizei height;
+   GLsizei depth;
+   GLint border;
+   GLenum format;
+   GLenum type;
+   struct marshal_image image;
+   /* Next image.size bytes are the copy of the pixels, unless staged */
+};
+
+void
+_mesa_unmarshal_TexImage1D(struct gl_context *ctx,
+                           const struct marshal_cmd_TexImage *cmd)
+{
+   CALL_TexImage1D(ctx->CurrentServerDispatch,
+                   (cmd->target, cmd->level, cmd->internalformat, cmd->width,
+                    cmd->border, cmd->format, cmd->type,
+                    get_image_pixels(cmd, sizeof(*cmd), &cmd->image)));
+   free_image(ctx, &cmd->image);
+}
+
+void
+_mesa_unmarshal_TexImage2D(struct gl_context *ctx,
+                           const struct marshal_cmd_TexImage *cmd)
+{
+   CALL_TexImage2D(ctx->CurrentServerDispatch,
+                   (cmd->target, cmd->level, cmd->internalformat, cmd->width,
+                    cmd->height, cmd->border, cmd->format, cmd->type,
+                    get_image_pixels(cmd, sizeof(*cmd), &cmd->image)));
+   free_image(ctx, &cmd->image);
+}
+
+void
+_mesa_unmarshal_TexImage3D(struct gl_context *ctx,
+                           const struct marshal_cmd_TexImage *cmd)
+{
+   CALL_TexImage3D(ctx->CurrentServerDispatch,
+                   (cmd->target, cmd->level, cmd->internalformat, cmd->width,
+                    cmd->height, cmd->depth, cmd->border, cmd->format,
+                    cmd->type,
+                    get_image_pixels(cmd, sizeof(*cmd), &cmd->image)));
+   free_image(ctx, &cmd->image);
+}
+
+static bool
+marshal_tex_image(struct gl_context *ctx, uint16_t cmd_id, GLuint dims,
+                  GLenum target, GLint level, GLint internalformat,
+                  GLsizei width, GLsizei height, GLsizei depth, GLint border,
+                  GLenum format, GLenum type, const GLvoid *pixels)
+{
+   struct marshal_cmd_TexImage *cmd;
+   struct marshal_image image;
+
+   /* Proxy textures only check the parameters, the pixels are never read */
+   if (_mesa_is_proxy_texture(target))
+      pixels = NULL;
+
+   cmd = allocate_image_command(ctx, cmd_id, sizeof(*cmd), dims, width,
+                                height, depth, format, type, pixels, &image);
+   if (!cmd)
+      return false;
+
+   cmd->target = target;
+   cmd->level = level;
+   cmd->internalformat = internalformat;
+   cmd->width = width;
+   cmd->height = height;
+   cmd->depth = depth;
+   cmd->border = border;
+   cmd->format = format;
+   cmd->type = type;
+   cmd->image = image;
+   _mesa_post_marshal_hook(ctx);
+   return true;
+}
+
+void GLAPIENTRY
+_mesa_marshal_TexImage1D(GLenum target, GLint level, GLint internalformat,
+                         GLsizei width, GLint border, GLenum format,
+                         GLenum type, const GLvoid *pixels)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("TexImage1D");
+
+   if (!marshal_tex_image(ctx, DISPATCH_CMD_TexImage1D, 1, target, level,
+                          internalformat, width, 1, 1, border, format, type,
+                          pixels)) {
+      _mesa_glthread_finish_before(ctx, "TexImage1D");
+      debug_print_sync_fallback("TexImage1D");
+      CALL_TexImage1D(ctx->CurrentServerDispatch,
+                      (target, level, internalformat, width, border, format,
+                       type, pixels));
+   }
+}
+
+void GLAPIENTRY
+_mesa_marshal_TexImage2D(GLenum target, GLint level, GLint internalformat,
+                         GLsizei width, GLsizei height, GLint border,
+                         GLenum format, GLenum type, const GLvoid *pixels)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("TexImage2D");
+
+   if (!marshal_tex_image(ctx, DISPATCH_CMD_TexImage2D, 2, target, level,
+                          internalformat, width, height, 1, border, format,
+                          type, pixels)) {
+      _mesa_glthread_finish_before(ctx, "TexImage2D");
+      debug_print_sync_fallback("TexImage2D");
+      CALL_TexImage2D(ctx->CurrentServerDispatch,
+                      (target, level, internalformat, width, height, border,
+                       format, type, pixels));
+   }
+}
+
+void GLAPIENTRY
+_mesa_marshal_TexImage3D(GLenum target, GLint level, GLint internalformat,
+                         GLsizei width, GLsizei height, GLsizei depth,
+                         GLint border, GLenum format, GLenum type,
+                         const GLvoid *pixels)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("TexImage3D");
+
+   if (!marshal_tex_image(ctx, DISPATCH_CMD_TexImage3D, 3, target, level,
+                          internalformat, width, height, depth, border,
+                          format, type, pixels)) {
+      _mesa_glthread_finish_before(ctx, "TexImage3D");
+      debug_print_sync_fallback("TexImage3D");
+      CALL_TexImage3D(ctx->CurrentServerDispatch,
+                      (target, level, internalformat, width, height, depth,
+                       border, format, type, pixels));
+   }
+}
+
+/* TexSubImage1D/2D/3D: marshalled asynchronously */
+struct marshal_cmd_TexSubImage
+{
+   struct marshal_cmd_base cmd_base;
+   GLenum target;
+   GLint level;
+   GLint xoffset;
+   GLint yoffset;
+   GLint zoffset;
+   GLsizei width;
+   GLsizei height;
+   GLsizei depth;
+   GLenum format;
+   GLenum type;
+   struct marshal_image image;
+   /* Next image.size bytes are the copy of the pixels, unless staged */
+};
+
+void
+_mesa_unmarshal_TexSubImage1D(struct gl_context *ctx,
+                              const struct marshal_cmd_TexSubImage *cmd)
+{
+   CALL_TexSubImage1D(ctx->CurrentServerDispatch,
+                      (cmd->target, cmd->level, cmd->xoffset, cmd->width,
+                       cmd->format, cmd->type,
+                       get_image_pixels(cmd, sizeof(*cmd), &cmd->image)));
+   free_image(ctx, &cmd->image);
+}
+
+void
+_mesa_unmarshal_TexSubImage2D(struct gl_context *ctx,
+                              const struct marshal_cmd_TexSubImage *cmd)
+{
+   CALL_TexSubImage2D(ctx->CurrentServerDispatch,
+                      (cmd->target, cmd->level, cmd->xoffset, cmd->yoffset,
+                       cmd->width, cmd->height, cmd->format, cmd->type,
+                       get_image_pixels(cmd, sizeof(*cmd), &cmd->image)));
+   free_image(ctx, &cmd->image);
+}
+
+void
+_mesa_unmarshal_TexSubImage3D(struct gl_context *ctx,
+                              const struct marshal_cmd_TexSubImage *cmd)
+{
+   CALL_TexSubImage3D(ctx->CurrentServerDispatch,
+                      (cmd->target, cmd->level, cmd->xoffset, cmd->yoffset,
+                       cmd->zoffset, cmd->width, cmd->height, cmd->depth,
+                       cmd->format, cmd->type,
+                       get_image_pixels(cmd, sizeof(*cmd), &cmd->image)));
+   free_image(ctx, &cmd->image);
+}
+
+static bool
+marshal_tex_sub_image(struct gl_context *ctx, uint16_t cmd_id, GLuint dims,
+                      GLenum target, GLint level, GLint xoffset,
+                      GLint yoffset, GLint zoffset, GLsizei width,
+                      GLsizei height, GLsizei depth, GLenum format,
+                      GLenum type, const GLvoid *pixels)
+{
+   struct marshal_cmd_TexSubImage *cmd;
+   struct marshal_image image;
+
+   cmd = allocate_image_command(ctx, cmd_id, sizeof(*cmd), dims, width,
+                                height, depth, format, type, pixels, &image);
+   if (!cmd)
+      return false;
+
+   cmd->target = target;
+   cmd->level = level;
+   cmd->xoffset = xoffset;
+   cmd->yoffset = yoffset;
+   cmd->zoffset = zoffset;
+   cmd->width = width;
+   cmd->height = height;
+   cmd->depth = depth;
+   cmd->format = format;
+   cmd->type = type;
+   cmd->image = image;
+   _mesa_post_marshal_hook(ctx);
+   return true;
+}
+
+void GLAPIENTRY
+_mesa_marshal_TexSubImage1D(GLenum target, GLint level, GLint xoffset,
+                            GLsizei width, GLenum format, GLenum type,
+                            const GLvoid *pixels)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("TexSubImage1D");
+
+   if (!marshal_tex_sub_image(ctx, DISPATCH_CMD_TexSubImage1D, 1, target,
+                              level, xoffset, 0, 0, width, 1, 1, format,
+                              type, pixels)) {
+      _mesa_glthread_finish_before(ctx, "TexSubImage1D");
+      debug_print_sync_fallback("TexSubImage1D");
+      CALL_TexSubImage1D(ctx->CurrentServerDispatch,
+                         (target, level, xoffset, width, format, type,
+                          pixels));
+   }
+}
+
+void GLAPIENTRY
+_mesa_marshal_TexSubImage2D(GLenum target, GLint level, GLint xoffset,
+                            GLint yoffset, GLsizei width, GLsizei height,
+                            GLenum format, GLenum type, const GLvoid *pixels)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("TexSubImage2D");
+
+   if (!marshal_tex_sub_image(ctx, DISPATCH_CMD_TexSubImage2D, 2, target,
+                              level, xoffset, yoffset, 0, width, height, 1,
+                              format, type, pixels)) {
+      _mesa_glthread_finish_before(ctx, "TexSubImage2D");
+      debug_print_sync_fallback("TexSubImage2D");
+      CALL_TexSubImage2D(ctx->CurrentServerDispatch,
+                         (target, level, xoffset, yoffset, width, height,
+                          format, type, pixels));
+   }
+}
+
+void GLAPIENTRY
+_mesa_marshal_TexSubImage3D(GLenum target, GLint level, GLint xoffset,
+                            GLint yoffset, GLint zoffset, GLsizei width,
+                            GLsizei height, GLsizei depth, GLenum format,
+                            GLenum type, const GLvoid *pixels)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("TexSubImage3D");
+
+   if (!marshal_tex_sub_image(ctx, DISPATCH_CMD_TexSubImage3D, 3, target,
+                              level, xoffset, yoffset, zoffset, width, height,
+                              depth, format, type, pixels)) {
+      _mesa_glthread_finish_before(ctx, "TexSubImage3D");
+      debug_print_sync_fallback("TexSubImage3D");
+      CALL_TexSubImage3D(ctx->CurrentServerDispatch,
+                         (target, level, xoffset, yoffset, zoffset, width,
+                          height, depth, format, type, pixels));
+   }
+}
+
+/**
+ * Returns the enabled user vertex arrays that draw calls copy.  Arrays with a
+ * NULL pointer are left alone, since they are only valid if the draw call
+ * doesn't read them.
+ */
+static GLbitfield
+get_user_arrays(const struct gl_context *ctx)
+{
+   const struct glthread_vao *vao = &ctx->GLThread->vao;
+
+   if (!_mesa_glthread_has_user_arrays(ctx))
+      return 0;
+
+   GLbitfield mask = vao->enabled & vao->user_pointer;
+   GLbitfield arrays = 0;
+
+   while (mask) {
+      const int a = u_bit_scan(&mask);
+
+      if (vao->attribs[a].pointer)
+         arrays |= VERT_BIT(a);
+   }
+   return arrays;
+}
+
+/**
+ * Returns the end of the copies of the vertices min_index..max_index of the
+ * user vertex arrays, placed from offset pos on, or SIZE_MAX if it's too
+ * large.  Instanced arrays only need their first element in non-instanced
+ * draw calls.
+ */
+static size_t
+get_user_arrays_size(const struct glthread_vao *vao, GLbitfield arrays,
+                     GLuint min_index, GLuint max_index, size_t pos)
+{
+   uint64_t size = pos;
+
+   while (arrays) {
+      const int a = u_bit_scan(&arrays);
+      const struct glthread_attrib *attrib = &vao->attribs[a];
+
+      size = align64(size, 8);
+      if (!(vao->instanced & VERT_BIT(a)))
+         size += (uint64_t) (max_index - min_index) * attrib->stride;
+      size += attrib->element_size;
+   }
+   return size <= MARSHAL_MAX_STAGING_SIZE ? size : SIZE_MAX;
+}
+
+/**
+ * Copies what get_user_arrays_size() counted to data + pos, and writes the
+ * offsets of the copies into offsets, biased so that the copies can be
+ * indexed with the vertex indices of the draw call.
+ */
+static void
+copy_user_arrays(const struct glthread_vao *vao, GLbitfield arrays,
+                 GLuint min_index, GLuint max_index, GLintptr *offsets,
+                 GLubyte *data, size_t pos)
+{
+   while (arrays) {
+      const int a = u_bit_scan(&arrays);
+      const struct glthread_attrib *attrib = &vao->attribs[a];
+      const GLubyte *src = attrib->pointer;
+      size_t size = attrib->element_size;
+
+      pos = ALIGN(pos, 8);
+      if (vao->instanced & VERT_BIT(a)) {
+         *offsets++ = pos;
+      } else {
+         src += (size_t) min_index * attrib->stride;
+         size += (size_t) (max_index - min_index) * attrib->stride;
+         *offsets++ = pos - (GLintptr) min_index * attrib->stride;
+      }
+
+      memcpy(data + pos, src, size);
+      pos += size;
+   }
+}
+
+/**
+ * Points the user vertex arrays of a draw call at their copies for the
+ * duration of the call, saving the client pointers.
+ */
+static void
+bind_user_arrays(struct gl_context *ctx, GLbitfield arrays,
+                 const GLintptr *offsets, const GLubyte *data,
+                 const GLubyte **saved)
+{
+   struct gl_vertex_array_object *vao = ctx->Array.VAO;
+
+   while (arrays) {
+      const int a = u_bit_scan(&arrays);
+      struct gl_array_attributes *array = &vao->VertexAttrib[a];
+      struct gl_vertex_buffer_binding *binding =
+         &vao->BufferBinding[array->BufferBindingIndex];
+      const GLubyte *ptr = data + *offsets++;
+
+      saved[a] = array->Ptr;
+
+      /* The tracking is wrong if the call that set it failed. */
+      if (_mesa_is_bufferobj(binding->BufferObj))
+         continue;
+
+      array->Ptr = ptr;
+      _mesa_bind_vertex_buffer(ctx, vao, array->BufferBindingIndex,
+                               binding->BufferObj, (GLintptr) ptr,
+                               binding->Stride);
+   }
+}
+
+static void
+restore_user_arrays(struct gl_context *ctx, GLbitfield arrays,
+                    const GLubyte **saved)
+{
+   struct gl_vertex_array_object *vao = ctx->Array.VAO;
+
+   while (arrays) {
+      const int a = u_bit_scan(&arrays);
+      struct gl_array_attributes *array = &vao->VertexAttrib[a];
+      struct gl_vertex_buffer_binding *binding =
+         &vao->BufferBinding[array->BufferBindingIndex];
+
+      if (_mesa_is_bufferobj(binding->BufferObj))
+         continue;
+
+      array->Ptr = saved[a];
+      _mesa_bind_vertex_buffer(ctx, vao, array->BufferBindingIndex,
+                               binding->BufferObj, (GLintptr) saved[a],
+                               binding->Stride);
+   }
+}
+
+/** The size of a draw command, followed by the offsets of the copies. */
+static inline size_t
+get_draw_cmd_size(size_t cmd_size, GLbitfield user_arrays)
+{
+   return cmd_size + util_bitcount(user_arrays) * sizeof(GLintptr);
+}
+
+/* DrawArrays: marshalled asynchronously */
+struct marshal_cmd_DrawArrays
+{
+   struct marshal_cmd_base cmd_base;
+   GLenum mode;
+   GLint first;
+   GLsizei count;
+   GLbitfield user_arrays; /* The user vertex arrays that were copied */
+   void *staging; /* If set, the copies are here instead of following */
+   size_t staging_size;
+   /* Next util_bitcount(user_arrays) GLintptr are the offsets of the copies,
+    * then the copies.
+    */
+};
+
+void
+_mesa_unmarshal_DrawArrays(struct gl_context *ctx,
+                           const struct marshal_cmd_DrawArrays *cmd)
+{
+   const GLintptr *offsets = (const GLintptr *) (cmd + 1);
+   const GLubyte *data =
+      get_command_data(cmd, get_draw_cmd_size(sizeof(*cmd), cmd->user_arrays),
+                       cmd->staging);
+   const GLubyte *saved[VERT_ATTRIB_MAX];
+
+   bind_user_arrays(ctx, cmd->user_arrays, offsets, data, saved);
+   CALL_DrawArrays(ctx->CurrentServerDispatch,
+                   (cmd->mode, cmd->first, cmd->count));
+   restore_user_arrays(ctx, cmd->user_arrays, saved);
+
+   if (cmd->staging)
+      _mesa_glthread_free_staging(ctx, cmd->staging, cmd->staging_size);
+}
+
+void GLAPIENTRY
+_mesa_marshal_DrawArrays(GLenum mode, GLint first, GLsizei count)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   const struct glthread_vao *vao = &ctx->GLThread->vao;
+   struct marshal_cmd_DrawArrays *cmd;
+   GLbitfield user_arrays = 0;
+   GLuint last = 0;
+   size_t size = 0;
+   void *data, *staging;
+   debug_print_marshal("DrawArrays");
+
+   /* Nothing is read if there is an error or nothing to draw. */
+   if (first >= 0 && count > 0) {
+      user_arrays = get_user_arrays(ctx);
+      last = (GLuint) first + (GLuint) count - 1;
+      size = get_user_arrays_size(vao, user_arrays, first, last, 0);
+   }
+
+   cmd = allocate_command_with_data(ctx, DISPATCH_CMD_DrawArrays,
+                                    get_draw_cmd_size(sizeof(*cmd),
+                                                      user_arrays),
+                                    size, &data, &staging);
+   if (likely(cmd)) {
+      cmd->mode = mode;
+      cmd->first = first;
+      cmd->count = count;
+      cmd->user_arrays = user_arrays;
+      cmd->staging = staging;
+      cmd->staging_size = size;
+      copy_user_arrays(vao, user_arrays, first, last, (GLintptr *) (cmd + 1),
+                       data, 0);
+      _mesa_post_marshal_hook(ctx);
+      return;
+   }
+
+   _mesa_glthread_finish_before(ctx, "DrawArrays");
+   debug_print_sync_fallback("DrawArrays");
+   CALL_DrawArrays(ctx->CurrentServerDispatch, (mode, first, count));
+}
+
+static unsigned
+get_index_size(GLenum type)
+{
+   switch (type) {
+   case GL_UNSIGNED_BYTE:
+      return 1;
+   case GL_UNSIGNED_SHORT:
+      return 2;
+   case GL_UNSIGNED_INT:
+      return 4;
+   default:
+      return 0;
+   }
+}
+
+#define SCAN_INDICES(T, restart_index)                       \
+   do {                                                      \
+      const T *ui = indices;                                 \
+      for (GLsizei i = 0; i < count; i++) {                  \
+         if (restart && ui[i] == (restart_index))            \
+            continue;                                        \
+         min = MIN2(min, ui[i]);                             \
+         max = MAX2(max, ui[i]);                             \
+      }                                                      \
+   } while (0)
+
+/**
+ * Finds the range of user indices.  With primitive restart, that can only
+ * be done for the fixed restart index, which isn't a vertex index.
+ */
+static void
+get_index_range(GLenum type, const GLvoid *indices, GLsizei count,
+                bool restart, GLuint *min_index, GLuint *max_index)
+{
+   GLuint min = ~0u, max = 0;
+
+   switch (type) {
+   case GL_UNSIGNED_BYTE:
+      SCAN_INDICES(GLubyte, 0xff);
+      break;
+   case GL_UNSIGNED_SHORT:
+      SCAN_INDICES(GLushort, 0xffff);
+      break;
+   case GL_UNSIGNED_INT:
+      SCAN_INDICES(GLuint, 0xffffffff);
+      break;
+   default:
+      unreachable("invalid index type");
+   }
+
+   /* All indices were restarts. */
+   if (min > max)
+      min = max = 0;
+
+   *min_index = min;
+   *max_index = max;
+}
+
+#undef SCAN_INDICES
+
+/* DrawElements, DrawRangeElements: marshalled asynchronously */
+struct marshal_cmd_DrawElements
+{
+   struct marshal_cmd_base cmd_base;
+   GLenum mode;
+   GLuint start; /* Only used by DrawRangeElements */
+   GLuint end;
+   GLsizei count;
+   GLenum type;
+   const GLvoid *indices; /* Unless user_indices is set */
+   bool user_indices; /* If set, the indices were copied before the arrays */
+   GLbitfield user_arrays; /* The user vertex arrays that were copied */
+   void *staging; /* If set, the copies are here instead of following */
+   size_t staging_size;
+   /* Next util_bitcount(user_arrays) GLintptr are the offsets of the copies,
+    * then the copies.
+    */
+};
+
+static bool
+marshal_draw_elements(struct gl_context *ctx, uint16_t cmd_id, GLenum mode,
+                      bool range, GLuint start, GLuint end, GLsizei count,
+                      GLenum type, const GLvoid *indices)
+{
+   const struct glthread_vao *vao = &ctx->GLThread->vao;
+   const unsigned index_size = get_index_size(type);
+   struct marshal_cmd_DrawElements *cmd;
+   bool user_indices = false;
+   GLbitfield user_arrays = 0;
+   GLuint min_index = 0, max_index = 0;
+   size_t indices_size = 0, size;
+   void *data, *staging;
+
+   /* Nothing is read if there is an error or nothing to draw. */
+   if (count > 0 && index_size && !(range && end < start)) {
+      user_indices = ctx->API != API_OPENGL_CORE &&
+                     !vao->element_array_buffer && indices;
+      user_arrays = get_user_arrays(ctx);
+   }
+
+   if (user_arrays) {
+      if (range) {
+         min_index = start;
+         max_index = end;
+      } else if (user_indices && !vao->primitive_restart) {
+         get_index_range(type, indices, count,
+                         vao->primitive_restart_fixed_index,
+                         &min_index, &max_index);
+      } else {
+         /* We would have to read the index buffer, or to know the
+          * restart index.
+          */
+         return false;
+      }
+   }
+
+   if (user_indices) {
+      if ((uint64_t) count * index_size > MARSHAL_MAX_STAGING_SIZE)
+         return false;
+      indices_size = (size_t) count * index_size;
+   }
+
+   size = get_user_arrays_size(vao, user_arrays, min_index, max_index,
+                               indices_size);
+
+   cmd = allocate_command_with_data(ctx, cmd_id,
+                                    get_draw_cmd_size(sizeof(*cmd),
+                                                      user_arrays),
+                                    size, &data, &staging);
+   if (!cmd)
+      return false;
+
+   cmd->mode = mode;
+   cmd->start = start;
+   cmd->end = end;
+   cmd->count = count;
+   cmd->type = type;
+   cmd->indices = indices;
+   cmd->user_indices = user_indices;
+   cmd->user_arrays = user_arrays;
+   cmd->staging = staging;
+   cmd->staging_size = size;
+   if (user_indices)
+      memcpy(data, indices, indices_size);
+   copy_user_arrays(vao, user_arrays, min_index, max_index,
+                    (GLintptr *) (cmd + 1), data, indices_size);
+   _mesa_post_marshal_hook(ctx);
+   return true;
+}
+
+/**
+ * Binds the copies of a DrawElements or DrawRangeElements command, and
+ * returns its indices.
+ */
+static const GLvoid *
+bind_draw_elements(struct gl_context *ctx,
+                   const struct marshal_cmd_DrawElements *cmd,
+                   const GLubyte **saved)
+{
+   const GLintptr *offsets = (const GLintptr *) (cmd + 1);
+   const GLubyte *data =
+      get_command_data(cmd, get_draw_cmd_size(sizeof(*cmd), cmd->user_arrays),
+                       cmd->staging);
+
+   bind_user_arrays(ctx, cmd->user_arrays, offsets, data, saved);
+   return cmd->user_indices ? data : cmd->indices;
+}
+
+static void
+unbind_draw_elements(struct gl_context *ctx,
+                     const struct marshal_cmd_DrawElements *cmd,
+                     const GLubyte **saved)
+{
+   restore_user_arrays(ctx, cmd->user_arrays, saved);
+
+   if (cmd->staging)
+      _mesa_glthread_free_staging(ctx, cmd->staging, cmd->staging_size);
+}
+
+void
+_mesa_unmarshal_DrawElements(struct gl_context *ctx,
+                             const struct marshal_cmd_DrawElements *cmd)
+{
+   const GLubyte *saved[VERT_ATTRIB_MAX];
+   const GLvoid *indices = bind_draw_elements(ctx, cmd, saved);
+
+   CALL_DrawElements(ctx->CurrentServerDispatch,
+                     (cmd->mode, cmd->count, cmd->type, indices));
+   unbind_draw_elements(ctx, cmd, saved);
+}
+
+void GLAPIENTRY
+_mesa_marshal_DrawElements(GLenum mode, GLsizei count, GLenum type,
+                           const GLvoid *indices)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("DrawElements");
+
+   if (!marshal_draw_elements(ctx, DISPATCH_CMD_DrawElements, mode, false,
+                              0, 0, count, type, indices)) {
+      _mesa_glthread_finish_before(ctx, "DrawElements");
+      debug_print_sync_fallback("DrawElements");
+      CALL_DrawElements(ctx->CurrentServerDispatch,
+                        (mode, count, type, indices));
+   }
+}
+
+void
+_mesa_unmarshal_DrawRangeElements(struct gl_context *ctx,
+                                  const struct marshal_cmd_DrawElements *cmd)
+{
+   const GLubyte *saved[VERT_ATTRIB_MAX];
+   const GLvoid *indices = bind_draw_elements(ctx, cmd, saved);
+
+   CALL_DrawRangeElements(ctx->CurrentServerDispatch,
+                          (cmd->mode, cmd->start, cmd->end, cmd->count,
+                           cmd->type, indices));
+   unbind_draw_elements(ctx, cmd, saved);
+}
+
+void GLAPIENTRY
+_mesa_marshal_DrawRangeElements(GLenum mode, GLuint start, GLuint end,
+                                GLsizei count, GLenum type,
+                                const GLvoid *indices)
+{
+   GET_CURRENT_CONTEXT(ctx);
+   debug_print_marshal("DrawRangeElements");
+
+   if (!marshal_draw_elements(ctx, DISPATCH_CMD_DrawRangeElements, mode, true,
+                              start, end, count, type, indices)) {
+      _mesa_glthread_finish_before(ctx, "DrawRangeElements");
+      debug_print_sync_fallback("DrawRangeElements");
+      CALL_DrawRangeElements(ctx->CurrentServerDispatch,
+                             (mode, start, end, count, type, indices));
+   }
+}
@@ -53,13 +53,13 @@ _mesa_glthread_allocate_command(struct gl_context *ctx,
                                 size_t size)
 {
    struct glthread_state *glthread = ctx->GLThread;
-   struct glthread_batch *next = &glthread->batches[glthread->next];
+   struct glthread_batch *next = glthread->next;
    struct marshal_cmd_base *cmd_base;
    const size_t aligned_size = ALIGN(size, 8);
 
-   if (unlikely(next->used + size > MARSHAL_MAX_CMD_SIZE)) {
+   if (unlikely(next->used + size > glthread->batch_size)) {
       _mesa_glthread_flush_batch(ctx);
-      next = &glthread->batches[glthread->next];
+      next = glthread->next;
    }
 
    cmd_base = (struct marshal_cmd_base *)&next->buffer[next->used];
@@ -70,28 +70,70 @@ _mesa_glthread_allocate_command(struct gl_context *ctx,
 }
 
 /**
- * Instead of conditionally handling marshaling previously-bound user vertex
- * array data in draw calls (deprecated and removed in GL core), we just
- * disable threading at the point where the user sets a user vertex array.
+ * Draw calls copy the client memory referenced by the user vertex arrays
+ * (deprecated and removed in GL core) that are set by the tracked gl*Pointer()
+ * functions.  Once the vertex arrays were changed in a way we don't track, we
+ * just disable threading at the point where the user sets a user vertex
+ * array.
  */
 static inline bool
 _mesa_glthread_is_non_vbo_vertex_attrib_pointer(const struct gl_context *ctx)
 {
    struct glthread_state *glthread = ctx->GLThread;
 
-   return ctx->API != API_OPENGL_CORE && !glthread->vertex_array_is_vbo;
+   return ctx->API != API_OPENGL_CORE && !glthread->vao.array_buffer &&
+          glthread->vao_untracked;
 }
 
 /**
  * Instead of conditionally handling marshaling immediate index data in draw
  * calls (deprecated and removed in GL core), we just disable threading.
+ * glDrawElements() and glDrawRangeElements() copy the indices instead.
  */
 static inline bool
 _mesa_glthread_is_non_vbo_draw_elements(const struct gl_context *ctx)
 {
    struct glthread_state *glthread = ctx->GLThread;
 
-   return ctx->API != API_OPENGL_CORE && !glthread->element_array_is_vbo;
+   return ctx->API != API_OPENGL_CORE && !glthread->vao.element_array_buffer;
+}
+
+/**
+ * Whether the enabled vertex arrays include user vertex arrays.  The draw
+ * calls that don't copy them are executed synchronously then.
+ */
+static inline bool
+_mesa_glthread_has_user_arrays(const struct gl_context *ctx)
+{
+   struct glthread_state *glthread = ctx->GLThread;
+
+   return ctx->API != API_OPENGL_CORE && !glthread->vao_untracked &&
+          (glthread->vao.enabled & glthread->vao.user_pointer);
+}
+
+static inline bool
+_mesa_glthread_has_pixel_buffers(const struct gl_context *ctx)
+{
+   return _mesa_has_EXT_pixel_buffer_object(ctx) || _mesa_is_gles3(ctx);
+}
+
+/**
+ * With a pixel unpack buffer bound, the pointers of uploads are offsets into
+ * it, so they can be marshalled asynchronously.
+ */
+static inline bool
+_mesa_glthread_has_unpack_buffer(const struct gl_context *ctx)
+{
+   return _mesa_glthread_has_pixel_buffers(ctx) &&
+          ctx->GLThread->pixel_unpack_buffer != 0;
+}
+
+/** Likewise for readbacks into a pixel pack buffer. */
+static inline bool
+_mesa_glthread_has_pack_buffer(const struct gl_context *ctx)
+{
+   return _mesa_glthread_has_pixel_buffers(ctx) &&
+          ctx->GLThread->pixel_pack_buffer != 0;
 }
 
 #define DEBUG_MARSHAL_PRINT_CALLS 0
@@ -187,6 +229,17 @@ struct marshal_cmd_ClearBuffer;
 #define marshal_cmd_ClearBufferiv   marshal_cmd_ClearBuffer
 #define marshal_cmd_ClearBufferuiv  marshal_cmd_ClearBuffer
 #define marshal_cmd_ClearBufferfi   marshal_cmd_ClearBuffer
+struct marshal_cmd_TexImage;
+#define marshal_cmd_TexImage1D      marshal_cmd_TexImage
+#define marshal_cmd_TexImage2D      marshal_cmd_TexImage
+#define marshal_cmd_TexImage3D      marshal_cmd_TexImage
+struct marshal_cmd_TexSubImage;
+#define marshal_cmd_TexSubImage1D   marshal_cmd_TexSubImage
+#define marshal_cmd_TexSubImage2D   marshal_cmd_TexSubImage
+#define marshal_cmd_TexSubImage3D   marshal_cmd_TexSubImage
+struct marshal_cmd_DrawArrays;
+struct marshal_cmd_DrawElements;
+#define marshal_cmd_DrawRangeElements marshal_cmd_DrawElements
 
 void
 _mesa_unmarshal_Enable(struct gl_context *ctx,
@@ -281,4 +334,84 @@ void GLAPIENTRY
 _mesa_marshal_ClearBufferfi(GLenum buffer, GLint drawbuffer,
                             const GLfloat depth, const GLint stencil);
 
+void
+_mesa_unmarshal_TexImage1D(struct gl_context *ctx,
+                           const struct marshal_cmd_TexImage *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_TexImage1D(GLenum target, GLint level, GLint internalformat,
+                         GLsizei width, GLint border, GLenum format,
+                         GLenum type, const GLvoid *pixels);
+
+void
+_mesa_unmarshal_TexImage2D(struct gl_context *ctx,
+                           const struct marshal_cmd_TexImage *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_TexImage2D(GLenum target, GLint level, GLint internalformat,
+                         GLsizei width, GLsizei height, GLint border,
+                         GLenum format, GLenum type, const GLvoid *pixels);
+
+void
+_mesa_unmarshal_TexImage3D(struct gl_context *ctx,
+                           const struct marshal_cmd_TexImage *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_TexImage3D(GLenum target, GLint level, GLint internalformat,
+                         GLsizei width, GLsizei height, GLsizei depth,
+                         GLint border, GLenum format, GLenum type,
+                         const GLvoid *pixels);
+
+void
+_mesa_unmarshal_TexSubImage1D(struct gl_context *ctx,
+                              const struct marshal_cmd_TexSubImage *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_TexSubImage1D(GLenum target, GLint level, GLint xoffset,
+                            GLsizei width, GLenum format, GLenum type,
+                            const GLvoid *pixels);
+
+void
+_mesa_unmarshal_TexSubImage2D(struct gl_context *ctx,
+                              const struct marshal_cmd_TexSubImage *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_TexSubImage2D(GLenum target, GLint level, GLint xoffset,
+                            GLint yoffset, GLsizei width, GLsizei height,
+                            GLenum format, GLenum type, const GLvoid *pixels);
+
+void
+_mesa_unmarshal_TexSubImage3D(struct gl_context *ctx,
+                              const struct marshal_cmd_TexSubImage *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_TexSubImage3D(GLenum target, GLint level, GLint xoffset,
+                            GLint yoffset, GLint zoffset, GLsizei width,
+                            GLsizei height, GLsizei depth, GLenum format,
+                            GLenum type, const GLvoid *pixels);
+
+void
+_mesa_unmarshal_DrawArrays(struct gl_context *ctx,
+                           const struct marshal_cmd_DrawArrays *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_DrawArrays(GLenum mode, GLint first, GLsizei count);
+
+void
+_mesa_unmarshal_DrawElements(struct gl_context *ctx,
+                             const struct marshal_cmd_DrawElements *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_DrawElements(GLenum mode, GLsizei count, GLenum type,
+                           const GLvoid *indices);
+
+void
+_mesa_unmarshal_DrawRangeElements(struct gl_context *ctx,
+                                  const struct marshal_cmd_DrawElements *cmd);
+
+void GLAPIENTRY
+_mesa_marshal_DrawRangeElements(GLenum mode, GLuint start, GLuint end,
+                                GLsizei count, GLenum type,
+                                const GLvoid *indices);
+
 #endif /* MARSHAL_H */
@@ -40,6 +40,7 @@
 #include "st_draw.h"
 #include "st_program.h"
 #include "st_util.h"
+#include "st_nir.h"
 
 #include "pipe/p_context.h"
 #include "pipe/p_defines.h"
@@ -48,6 +49,7 @@
 
 #include "draw/draw_private.h"
 #include "draw/draw_context.h"
+#include "compiler/nir/nir.h"
 
 
 /**
@@ -142,7 +144,24 @@ st_feedback_draw_vbo(struct gl_context *ctx,
    vs = &vp_variant->tgsi;
 
    if (!vp_variant->draw_shader) {
-      vp_variant->draw_shader = draw_create_vertex_shader(draw, vs);
+      if (vs->type == PIPE_SHADER_IR_NIR) {
+         /* The driver owns the variant's NIR, give the draw module a copy
+          * built the same way.
+          */
+         struct pipe_shader_state state = *vs;
+
+         state.ir.nir = nir_shader_clone(NULL, vp->tgsi.ir.nir);
+         if (vp_variant->key.clamp_color)
+            NIR_PASS_V(state.ir.nir, nir_lower_clamp_color_outputs);
+         if (vp_variant->key.passthrough_edgeflags)
+            NIR_PASS_V(state.ir.nir, nir_lower_passthrough_edgeflags);
+         st_finalize_nir(st, (struct gl_program *) &vp->Base,
+                         vp->shader_program, state.ir.nir);
+
+         vp_variant->draw_shader = draw_create_vertex_shader(draw, &state);
+      } else {
+         vp_variant->draw_shader = draw_create_vertex_shader(draw, vs);
+      }
    }
 
    /*
@@ -304,8 +304,6 @@ st_glsl_to_nir(struct st_context *st, struct gl_program *prog,
    struct pipe_screen *screen = st->pipe->screen;
    bool is_scalar = screen->get_shader_param(screen, type, PIPE_SHADER_CAP_SCALAR_ISA);
    assert(options);
-   bool lower_64bit =
-      options->lower_int64_options || options->lower_doubles_options;
 
    if (prog->nir)
       return prog->nir;
@@ -359,6 +357,22 @@ st_glsl_to_nir(struct st_context *st, struct gl_program *prog,
 
    /* before buffers and vars_to_ssa */
    NIR_PASS_V(nir, gl_nir_lower_bindless_images);
+
+   return nir;
+}
+
+/* The optimization loop of converting glsl_to_nir.  It only modifies the
+ * shader, so it runs for all the stages of a program at once.
+ */
+static void
+st_glsl_to_nir_opts(struct st_context *st, nir_shader *nir,
+                    const struct gl_shader_program *shader_program,
+                    bool is_scalar)
+{
+   const nir_shader_compiler_options *options = nir->options;
+   bool lower_64bit =
+      options->lower_int64_options || options->lower_doubles_options;
+
    st_nir_opts(nir, is_scalar);
 
    NIR_PASS_V(nir, gl_nir_lower_buffers, shader_program);
@@ -380,7 +394,24 @@ st_glsl_to_nir(struct st_context *st, struct gl_program *prog,
          st_nir_opts(nir, is_scalar);
    }
 
-   return nir;
+   if (is_scalar)
+      NIR_PASS_V(nir, nir_lower_load_const_to_scalar);
+}
+
+struct st_link_opts_state {
+   struct st_context *st;
+   const struct gl_shader_program *shader_program;
+   nir_shader *shaders[MESA_SHADER_STAGES];
+   bool is_scalar[MESA_SHADER_STAGES];
+};
+
+static void
+st_link_opts_job(void *data, unsigned index)
+{
+   struct st_link_opts_state *state = (struct st_link_opts_state *) data;
+
+   st_glsl_to_nir_opts(state->st, state->shaders[index],
+                       state->shader_program, state->is_scalar[index]);
 }
 
 /* Second third of converting glsl_to_nir. This creates uniforms, gathers
@@ -679,6 +710,8 @@ st_link_nir(struct gl_context *ctx,
    struct st_context *st = st_context(ctx);
    struct pipe_screen *screen = st->pipe->screen;
    bool is_scalar[MESA_SHADER_STAGES];
+   struct st_link_opts_state opts = { st, shader_program };
+   unsigned num_opts = 0;
 
    unsigned last_stage = 0;
    for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
@@ -691,14 +724,21 @@ st_link_nir(struct gl_context *ctx,
       is_scalar[i] = screen->get_shader_param(screen, type,
                                               PIPE_SHADER_CAP_SCALAR_ISA);
 
+      bool translated = shader->Program->nir == NULL;
       st_nir_get_mesa_program(ctx, shader_program, shader);
       last_stage = i;
 
-      if (is_scalar[i]) {
+      if (translated) {
+         opts.shaders[num_opts] = shader->Program->nir;
+         opts.is_scalar[num_opts++] = is_scalar[i];
+      } else if (is_scalar[i]) {
          NIR_PASS_V(shader->Program->nir, nir_lower_load_const_to_scalar);
       }
    }
 
+   /* The stages don't depend on each other until they are linked below. */
+   nir_parallel_for(num_opts, st_link_opts_job, &opts);
+
    /* Linking the stages in the opposite order (from fragment to vertex)
     * ensures that inter-shader outputs written to in an earlier stage
     * are eliminated if they are (transitively) not used in a later
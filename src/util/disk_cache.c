@@ -40,6 +40,10 @@
 #include <inttypes.h>
 #include "zlib.h"
 
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+
 #include "util/crc32.h"
 #include "util/debug.h"
 #include "util/rand_xor.h"
@@ -51,6 +55,7 @@
 #include "main/errors.h"
 
 #include "disk_cache.h"
+#include "disk_cache_pack.h"
 
 /* Number of bits to mask off from a cache key to get an index. */
 #define CACHE_INDEX_KEY_BITS 16
@@ -75,6 +80,19 @@
  */
 #define CACHE_VERSION 1
 
+/* A read-only cache directory, searched when the writable cache misses. */
+struct disk_cache_layer {
+   char *path;
+
+   /* The layer's pack, if it has one. */
+   struct disk_cache_pack *pack;
+
+   /* The layer's index of keys stored with disk_cache_put_key(), if it has
+    * one.
+    */
+   uint8_t *stored_keys;
+};
+
 struct disk_cache {
    /* The path to the cache directory. */
    char *path;
@@ -99,6 +117,16 @@ struct disk_cache {
    /* Maximum size of all cached objects (in bytes). */
    uint64_t max_size;
 
+   /* Codec used to compress new entries. */
+   const struct cache_codec *codec;
+
+   /* Single-file storage used instead of one file per entry, if enabled. */
+   struct disk_cache_pack *pack;
+
+   /* Read-only caches from $MESA_GLSL_CACHE_READ_ONLY_DIRS. */
+   struct disk_cache_layer *layers;
+   unsigned num_layers;
+
    /* Driver cache keys. */
    uint8_t *driver_keys_blob;
    size_t driver_keys_blob_size;
@@ -123,6 +151,192 @@ struct disk_cache_put_job {
    struct cache_item_metadata cache_item_metadata;
 };
 
+/* Compression codecs for cache entries.
+ *
+ * Entries compressed with anything other than deflate have their data
+ * prefixed with a cache_entry_codec_tag. Deflate entries are left untagged,
+ * exactly like the ones written by older versions of Mesa. This is
+ * unambiguous as a zlib stream can never start with the tag's magic,
+ * (the low nibble of its first byte is always 8).
+ */
+enum cache_codec_id {
+   CACHE_CODEC_DEFLATE = 0,
+   CACHE_CODEC_ZSTD = 1,
+};
+
+struct cache_entry_codec_tag {
+   uint8_t magic[2];
+   uint8_t codec;
+   uint8_t pad;
+};
+
+static const uint8_t cache_codec_tag_magic[2] = { 'M', 'C' };
+
+struct cache_codec {
+   const char *name;
+   enum cache_codec_id id;
+   int level;
+
+   /* Worst case compressed size of 'size' bytes. */
+   size_t (*bound)(size_t size);
+
+   /* Returns the compressed size, or 0 on failure. */
+   size_t (*compress)(int level, const void *in_data, size_t in_data_size,
+                      uint8_t *out_data, size_t out_data_size);
+
+   /* Returns true if exactly 'out_data_size' bytes were decompressed. */
+   bool (*decompress)(const uint8_t *in_data, size_t in_data_size,
+                      uint8_t *out_data, size_t out_data_size);
+};
+
+static size_t
+deflate_bound(size_t size)
+{
+   return compressBound(size);
+}
+
+static size_t
+deflate_cache_data(int level, const void *in_data, size_t in_data_size,
+                   uint8_t *out_data, size_t out_data_size)
+{
+   z_stream strm;
+
+   /* allocate deflate state */
+   strm.zalloc = Z_NULL;
+   strm.zfree = Z_NULL;
+   strm.opaque = Z_NULL;
+   strm.next_in = (uint8_t *) in_data;
+   strm.avail_in = in_data_size;
+   strm.next_out = out_data;
+   strm.avail_out = out_data_size;
+
+   int ret = deflateInit(&strm, level);
+   if (ret != Z_OK)
+      return 0;
+
+   /* The output buffer is large enough to compress everything in one go. */
+   ret = deflate(&strm, Z_FINISH);
+   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+
+   (void)deflateEnd(&strm);
+
+   if (ret != Z_STREAM_END)
+      return 0;
+
+   return out_data_size - strm.avail_out;
+}
+
+static bool
+inflate_cache_data(const uint8_t *in_data, size_t in_data_size,
+                   uint8_t *out_data, size_t out_data_size)
+{
+   z_stream strm;
+
+   /* allocate inflate state */
+   strm.zalloc = Z_NULL;
+   strm.zfree = Z_NULL;
+   strm.opaque = Z_NULL;
+   strm.next_in = (uint8_t *) in_data;
+   strm.avail_in = in_data_size;
+   strm.next_out = out_data;
+   strm.avail_out = out_data_size;
+
+   int ret = inflateInit(&strm);
+   if (ret != Z_OK)
+      return false;
+
+   ret = inflate(&strm, Z_NO_FLUSH);
+   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+
+   /* Unless there was an error we should have decompressed everything in one
+    * go as we know the uncompressed file size.
+    */
+   if (ret != Z_STREAM_END) {
+      (void)inflateEnd(&strm);
+      return false;
+   }
+   assert(strm.avail_out == 0);
+
+   /* clean up and return */
+   (void)inflateEnd(&strm);
+   return true;
+}
+
+#ifdef HAVE_ZSTD
+static size_t
+zstd_bound(size_t size)
+{
+   return ZSTD_compressBound(size);
+}
+
+static size_t
+zstd_compress_cache_data(int level, const void *in_data, size_t in_data_size,
+                         uint8_t *out_data, size_t out_data_size)
+{
+   size_t ret = ZSTD_compress(out_data, out_data_size, in_data, in_data_size,
+                              level);
+   return ZSTD_isError(ret) ? 0 : ret;
+}
+
+static bool
+zstd_decompress_cache_data(const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size)
+{
+   size_t ret = ZSTD_decompress(out_data, out_data_size, in_data,
+                                in_data_size);
+   return !ZSTD_isError(ret) && ret == out_data_size;
+}
+#endif
+
+static const struct cache_codec cache_codecs[] = {
+   { "zlib", CACHE_CODEC_DEFLATE, Z_BEST_COMPRESSION,
+     deflate_bound, deflate_cache_data, inflate_cache_data },
+   { "zlib-fast", CACHE_CODEC_DEFLATE, Z_BEST_SPEED,
+     deflate_bound, deflate_cache_data, inflate_cache_data },
+#ifdef HAVE_ZSTD
+   { "zstd", CACHE_CODEC_ZSTD, 1,
+     zstd_bound, zstd_compress_cache_data, zstd_decompress_cache_data },
+#endif
+};
+
+/* Returns the codec to write new entries with: the one named by
+ * $MESA_GLSL_CACHE_CODEC, or else zlib.
+ */
+static const struct cache_codec *
+choose_cache_codec(void)
+{
+   const char *name = getenv("MESA_GLSL_CACHE_CODEC");
+
+   /* Stick to the slow but thorough zlib setting used so far, so that
+    * existing caches don't suddenly grow larger.  zstd is opt-in.
+    */
+   const struct cache_codec *codec = &cache_codecs[0];
+
+   if (name) {
+      for (unsigned i = 0; i < ARRAY_SIZE(cache_codecs); i++) {
+         if (strcmp(cache_codecs[i].name, name) == 0)
+            return &cache_codecs[i];
+      }
+
+      fprintf(stderr, "Unknown shader cache codec %s, using %s.\n", name,
+              codec->name);
+   }
+
+   return codec;
+}
+
+/* Returns a codec able to decompress data tagged with 'id'. */
+static const struct cache_codec *
+find_cache_codec(enum cache_codec_id id)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(cache_codecs); i++) {
+      if (cache_codecs[i].id == id)
+         return &cache_codecs[i];
+   }
+
+   return NULL;
+}
+
 /* Create a directory named 'path' if it does not already exist.
  *
  * Returns: 0 if path already exists as a directory or if created.
@@ -183,6 +397,80 @@ concatenate_and_mkdir(void *ctx, const char *path, const char *name)
       return NULL;
 }
 
+/* Size of the index file holding the keys stored with disk_cache_put_key(). */
+#define CACHE_INDEX_FILE_SIZE \
+   (sizeof(uint64_t) + CACHE_INDEX_MAX_KEYS * CACHE_KEY_SIZE)
+
+/* Open the read-only caches listed in $MESA_GLSL_CACHE_READ_ONLY_DIRS. Each
+ * one is a directory which has been used as $MESA_GLSL_CACHE_DIR before, and
+ * may hold entries in either layout. Directories which don't contain a
+ * cache are ignored.
+ */
+static void
+open_cache_layers(struct disk_cache *cache)
+{
+   const char *dirs = getenv("MESA_GLSL_CACHE_READ_ONLY_DIRS");
+   struct stat sb;
+
+   if (dirs == NULL)
+      return;
+
+   char *dirs_copy = ralloc_strdup(cache, dirs);
+   char *save_ptr = NULL;
+   unsigned max_layers = 1;
+
+   for (const char *c = dirs; *c; c++) {
+      if (*c == ':')
+         max_layers++;
+   }
+
+   cache->layers = rzalloc_array(cache, struct disk_cache_layer, max_layers);
+   if (cache->layers == NULL)
+      return;
+
+   for (char *dir = strtok_r(dirs_copy, ":", &save_ptr); dir != NULL;
+        dir = strtok_r(NULL, ":", &save_ptr)) {
+      struct disk_cache_layer *layer = &cache->layers[cache->num_layers];
+
+      layer->path = ralloc_asprintf(cache, "%s/%s", dir, CACHE_DIR_NAME);
+      if (layer->path == NULL ||
+          stat(layer->path, &sb) != 0 || !S_ISDIR(sb.st_mode))
+         continue;
+
+      layer->pack = disk_cache_pack_open_read_only(layer->path);
+
+      char *index_path = ralloc_asprintf(cache, "%s/index", layer->path);
+      int fd = index_path ? open(index_path, O_RDONLY | O_CLOEXEC) : -1;
+      if (fd != -1) {
+         if (fstat(fd, &sb) == 0 && sb.st_size == CACHE_INDEX_FILE_SIZE) {
+            uint8_t *index = mmap(NULL, CACHE_INDEX_FILE_SIZE, PROT_READ,
+                                  MAP_SHARED, fd, 0);
+            if (index != MAP_FAILED)
+               layer->stored_keys = index + sizeof(uint64_t);
+         }
+         close(fd);
+      }
+      ralloc_free(index_path);
+
+      cache->num_layers++;
+   }
+
+   ralloc_free(dirs_copy);
+}
+
+static void
+close_cache_layers(struct disk_cache *cache)
+{
+   for (unsigned i = 0; i < cache->num_layers; i++) {
+      struct disk_cache_layer *layer = &cache->layers[i];
+
+      if (layer->pack)
+         disk_cache_pack_close(layer->pack);
+      if (layer->stored_keys)
+         munmap(layer->stored_keys - sizeof(uint64_t), CACHE_INDEX_FILE_SIZE);
+   }
+}
+
 #define DRV_KEY_CPY(_dst, _src, _src_size) \
 do {                                       \
    memcpy(_dst, _src, _src_size);          \
@@ -304,7 +592,7 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
       goto path_fail;
 
    /* Force the index file to be the expected size. */
-   size = sizeof(*cache->size) + CACHE_INDEX_MAX_KEYS * CACHE_KEY_SIZE;
+   size = CACHE_INDEX_FILE_SIZE;
    if (sb.st_size != size) {
       if (ftruncate(fd, size) == -1)
          goto path_fail;
@@ -369,6 +657,14 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
 
    cache->max_size = max_size;
 
+   cache->codec = choose_cache_codec();
+
+   /* At user request, keep all entries in a single pack file. If that
+    * can't be set up, fall back to one file per entry.
+    */
+   if (env_var_as_boolean("MESA_GLSL_CACHE_PACK", false))
+      cache->pack = disk_cache_pack_open(cache->path, max_size);
+
    /* 1 thread was chosen because we don't really care about getting things
     * to disk quickly just that it's not blocking other tasks.
     *
@@ -417,6 +713,11 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    DRV_KEY_CPY(drv_key_blob, &ptr_size, ptr_size_size)
    DRV_KEY_CPY(drv_key_blob, &driver_flags, driver_flags_size)
 
+   /* Even if we can't write to our own cache, prebuilt ones might still
+    * provide hits.
+    */
+   open_cache_layers(cache);
+
    /* Seed our rand function */
    s_rand_xorshift128plus(cache->seed_xorshift128plus, true);
 
@@ -437,34 +738,50 @@ disk_cache_destroy(struct disk_cache *cache)
 {
    if (cache && !cache->path_init_failed) {
       util_queue_destroy(&cache->cache_queue);
+      if (cache->pack)
+         disk_cache_pack_close(cache->pack);
       munmap(cache->index_mmap, cache->index_mmap_size);
    }
 
+   if (cache)
+      close_cache_layers(cache);
+
    ralloc_free(cache);
 }
 
-/* Return a filename within the cache's directory corresponding to 'key'. The
- * returned filename is ralloced with 'cache' as the parent context.
+/* Return a filename within the cache directory 'path' corresponding to
+ * 'key'. The returned filename is malloc'ed.
  *
  * Returns NULL if out of memory.
  */
 static char *
-get_cache_file(struct disk_cache *cache, const cache_key key)
+get_cache_file_in(const char *path, const cache_key key)
 {
    char buf[41];
    char *filename;
 
-   if (cache->path_init_failed)
-      return NULL;
-
    _mesa_sha1_format(buf, key);
-   if (asprintf(&filename, "%s/%c%c/%s", cache->path, buf[0],
+   if (asprintf(&filename, "%s/%c%c/%s", path, buf[0],
                 buf[1], buf + 2) == -1)
       return NULL;
 
    return filename;
 }
 
+/* Return a filename within the cache's directory corresponding to 'key'. The
+ * returned filename is malloc'ed.
+ *
+ * Returns NULL if out of memory.
+ */
+static char *
+get_cache_file(struct disk_cache *cache, const cache_key key)
+{
+   if (cache->path_init_failed)
+      return NULL;
+
+   return get_cache_file_in(cache->path, key);
+}
+
 /* Create the directory that will be needed for the cache file for \key.
  *
  * Obviously, the implementation here must closely match
@@ -672,6 +989,11 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
    struct stat sb;
 
+   if (cache->pack) {
+      disk_cache_pack_remove(cache->pack, key);
+      return;
+   }
+
    char *filename = get_cache_file(cache, key);
    if (filename == NULL) {
       return;
@@ -719,82 +1041,6 @@ write_all(int fd, const void *buf, size_t count)
    return done;
 }
 
-/* From the zlib docs:
- *    "If the memory is available, buffers sizes on the order of 128K or 256K
- *    bytes should be used."
- */
-#define BUFSIZE 256 * 1024
-
-/**
- * Compresses cache entry in memory and writes it to disk. Returns the size
- * of the data written to disk.
- */
-static size_t
-deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
-                          const char *filename)
-{
-   unsigned char *out;
-
-   /* allocate deflate state */
-   z_stream strm;
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.next_in = (uint8_t *) in_data;
-   strm.avail_in = in_data_size;
-
-   int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
-   if (ret != Z_OK)
-       return 0;
-
-   /* compress until end of in_data */
-   size_t compressed_size = 0;
-   int flush;
-
-   out = malloc(BUFSIZE * sizeof(unsigned char));
-   if (out == NULL)
-      return 0;
-
-   do {
-      int remaining = in_data_size - BUFSIZE;
-      flush = remaining > 0 ? Z_NO_FLUSH : Z_FINISH;
-      in_data_size -= BUFSIZE;
-
-      /* Run deflate() on input until the output buffer is not full (which
-       * means there is no more data to deflate).
-       */
-      do {
-         strm.avail_out = BUFSIZE;
-         strm.next_out = out;
-
-         ret = deflate(&strm, flush);    /* no bad return value */
-         assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
-
-         size_t have = BUFSIZE - strm.avail_out;
-         compressed_size += have;
-
-         ssize_t written = write_all(dest, out, have);
-         if (written == -1) {
-            (void)deflateEnd(&strm);
-            free(out);
-            return 0;
-         }
-      } while (strm.avail_out == 0);
-
-      /* all input should be used */
-      assert(strm.avail_in == 0);
-
-   } while (flush != Z_FINISH);
-
-   /* stream should be complete */
-   assert(ret == Z_STREAM_END);
-
-   /* clean up and return */
-   (void)deflateEnd(&strm);
-   free(out);
-   return compressed_size;
-}
-
 static struct disk_cache_put_job *
 create_put_job(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -856,6 +1102,84 @@ struct cache_entry_file_data {
    uint32_t uncompressed_size;
 };
 
+/**
+ * Builds the on-disk representation of a cache entry in memory:
+ *
+ *  - the driver_keys_blob
+ *  - the cache item metadata
+ *  - a struct cache_entry_file_data
+ *  - the compressed data
+ *
+ * Returns a malloc'ed buffer holding the entry, or NULL on failure.
+ */
+static uint8_t *
+create_cache_entry(struct disk_cache_put_job *dc_job, size_t *entry_size)
+{
+   struct disk_cache *cache = dc_job->cache;
+   struct cache_item_metadata *md = &dc_job->cache_item_metadata;
+   const struct cache_codec *codec = cache->codec;
+   uint8_t *entry, *p;
+
+   size_t md_size = sizeof(uint32_t);
+   if (md->type == CACHE_ITEM_TYPE_GLSL)
+      md_size += sizeof(uint32_t) + md->num_keys * sizeof(cache_key);
+
+   size_t header_size = cache->driver_keys_blob_size + md_size +
+                        sizeof(struct cache_entry_file_data);
+   if (codec->id != CACHE_CODEC_DEFLATE)
+      header_size += sizeof(struct cache_entry_codec_tag);
+
+   size_t max_entry_size = header_size + codec->bound(dc_job->size);
+
+   entry = malloc(max_entry_size);
+   if (entry == NULL)
+      return NULL;
+   p = entry;
+
+   /* Write the driver_keys_blob, this can be used find information about the
+    * mesa version that produced the entry or deal with hash collisions,
+    * should that ever become a real problem.
+    */
+   DRV_KEY_CPY(p, cache->driver_keys_blob, cache->driver_keys_blob_size)
+
+   /* Write the cache item metadata. This data can be used to deal with
+    * hash collisions, as well as providing useful information to 3rd party
+    * tools reading the cache files.
+    */
+   DRV_KEY_CPY(p, &md->type, sizeof(uint32_t))
+   if (md->type == CACHE_ITEM_TYPE_GLSL) {
+      DRV_KEY_CPY(p, &md->num_keys, sizeof(uint32_t))
+      DRV_KEY_CPY(p, md->keys[0], md->num_keys * sizeof(cache_key))
+   }
+
+   /* Create CRC of the data. We will read this when restoring the cache and
+    * use it to check for corruption.
+    */
+   struct cache_entry_file_data cf_data;
+   cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
+   cf_data.uncompressed_size = dc_job->size;
+   DRV_KEY_CPY(p, &cf_data, sizeof(cf_data))
+
+   if (codec->id != CACHE_CODEC_DEFLATE) {
+      struct cache_entry_codec_tag tag = {
+         .magic = { cache_codec_tag_magic[0], cache_codec_tag_magic[1] },
+         .codec = codec->id,
+      };
+      DRV_KEY_CPY(p, &tag, sizeof(tag))
+   }
+
+   size_t compressed_size =
+      codec->compress(codec->level, dc_job->data, dc_job->size,
+                      p, max_entry_size - header_size);
+   if (compressed_size == 0) {
+      free(entry);
+      return NULL;
+   }
+
+   *entry_size = header_size + compressed_size;
+   return entry;
+}
+
 static void
 cache_put(void *job, int thread_index)
 {
@@ -864,8 +1188,23 @@ cache_put(void *job, int thread_index)
    int fd = -1, fd_final = -1, err, ret;
    unsigned i = 0;
    char *filename = NULL, *filename_tmp = NULL;
+   uint8_t *entry = NULL;
+   size_t entry_size;
    struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
 
+   if (dc_job->cache->pack) {
+      struct disk_cache_pack *pack = dc_job->cache->pack;
+
+      entry = create_cache_entry(dc_job, &entry_size);
+      if (entry)
+         disk_cache_pack_queue(pack, dc_job->key, entry, entry_size);
+
+      /* Write the batch out once we run out of jobs. */
+      if (p_atomic_read(&dc_job->cache->cache_queue.num_queued) == 0)
+         disk_cache_pack_flush(pack);
+      return;
+   }
+
    filename = get_cache_file(dc_job->cache, dc_job->key);
    if (filename == NULL)
       goto done;
@@ -934,69 +1273,22 @@ cache_put(void *job, int thread_index)
     * by some other process.
     */
 
-   /* Write the driver_keys_blob, this can be used find information about the
-    * mesa version that produced the entry or deal with hash collisions,
-    * should that ever become a real problem.
+   /* Now, finally, write out the entry to the temporary file, then
+    * rename it atomically to the destination filename, and also
+    * perform an atomic increment of the total cache size.
     */
-   ret = write_all(fd, dc_job->cache->driver_keys_blob,
-                   dc_job->cache->driver_keys_blob_size);
-   if (ret == -1) {
+   entry = create_cache_entry(dc_job, &entry_size);
+   if (entry == NULL) {
       unlink(filename_tmp);
       goto done;
    }
 
-   /* Write the cache item metadata. This data can be used to deal with
-    * hash collisions, as well as providing useful information to 3rd party
-    * tools reading the cache files.
-    */
-   ret = write_all(fd, &dc_job->cache_item_metadata.type,
-                   sizeof(uint32_t));
+   ret = write_all(fd, entry, entry_size);
    if (ret == -1) {
       unlink(filename_tmp);
       goto done;
    }
 
-   if (dc_job->cache_item_metadata.type == CACHE_ITEM_TYPE_GLSL) {
-      ret = write_all(fd, &dc_job->cache_item_metadata.num_keys,
-                      sizeof(uint32_t));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-
-      ret = write_all(fd, dc_job->cache_item_metadata.keys[0],
-                      dc_job->cache_item_metadata.num_keys *
-                      sizeof(cache_key));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-   }
-
-   /* Create CRC of the data. We will read this when restoring the cache and
-    * use it to check for corruption.
-    */
-   struct cache_entry_file_data cf_data;
-   cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
-   cf_data.uncompressed_size = dc_job->size;
-
-   size_t cf_data_size = sizeof(cf_data);
-   ret = write_all(fd, &cf_data, cf_data_size);
-   if (ret == -1) {
-      unlink(filename_tmp);
-      goto done;
-   }
-
-   /* Now, finally, write out the contents to the temporary file, then
-    * rename them atomically to the destination filename, and also
-    * perform an atomic increment of the total cache size.
-    */
-   size_t file_size = deflate_and_write_to_disk(dc_job->data, dc_job->size,
-                                                fd, filename_tmp);
-   if (file_size == 0) {
-      unlink(filename_tmp);
-      goto done;
-   }
    ret = rename(filename_tmp, filename);
    if (ret == -1) {
       unlink(filename_tmp);
@@ -1020,6 +1312,7 @@ cache_put(void *job, int thread_index)
     */
    if (fd != -1)
       close(fd);
+   free(entry);
    free(filename_tmp);
    free(filename);
 }
@@ -1048,53 +1341,199 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
 }
 
 /**
- * Decompresses cache entry, returns true if successful.
+ * Checks the part of an entry created by create_cache_entry() following the
+ * driver_keys_blob, and decompresses it.
+ *
+ * Returns the malloc'ed uncompressed data, or NULL if the entry is invalid.
  */
-static bool
-inflate_cache_data(uint8_t *in_data, size_t in_data_size,
-                   uint8_t *out_data, size_t out_data_size)
+static void *
+decompress_cache_entry(uint8_t *p, uint8_t *end, size_t *size)
 {
-   z_stream strm;
+   uint8_t *uncompressed_data;
 
-   /* allocate inflate state */
-   strm.zalloc = Z_NULL;
-   strm.zfree = Z_NULL;
-   strm.opaque = Z_NULL;
-   strm.next_in = in_data;
-   strm.avail_in = in_data_size;
-   strm.next_out = out_data;
-   strm.avail_out = out_data_size;
+   uint32_t md_type;
+   if (end - p < sizeof(md_type))
+      return NULL;
+   memcpy(&md_type, p, sizeof(md_type));
+   p += sizeof(md_type);
 
-   int ret = inflateInit(&strm);
-   if (ret != Z_OK)
+   if (md_type == CACHE_ITEM_TYPE_GLSL) {
+      uint32_t num_keys;
+      if (end - p < sizeof(num_keys))
+         return NULL;
+      memcpy(&num_keys, p, sizeof(num_keys));
+      p += sizeof(num_keys);
+
+      /* The cache item metadata is currently just used for distributing
+       * precompiled shaders, they are not used by Mesa so just skip them for
+       * now.
+       * TODO: pass the metadata back to the caller and do some basic
+       * validation.
+       */
+      if (end - p < (uint64_t) num_keys * sizeof(cache_key))
+         return NULL;
+      p += num_keys * sizeof(cache_key);
+   }
+
+   /* Load the CRC that was created when the entry was written. */
+   struct cache_entry_file_data cf_data;
+   if (end - p < sizeof(cf_data))
+      return NULL;
+   memcpy(&cf_data, p, sizeof(cf_data));
+   p += sizeof(cf_data);
+
+   /* Find out how the data was compressed, untagged data is deflated. */
+   const struct cache_codec *codec = find_cache_codec(CACHE_CODEC_DEFLATE);
+   struct cache_entry_codec_tag tag;
+   if (end - p >= sizeof(tag)) {
+      memcpy(&tag, p, sizeof(tag));
+      if (memcmp(tag.magic, cache_codec_tag_magic, sizeof(tag.magic)) == 0) {
+         codec = find_cache_codec(tag.codec);
+         if (codec == NULL)
+            return NULL;
+         p += sizeof(tag);
+      }
+   }
+
+   /* Uncompress the cache data */
+   uncompressed_data = malloc(cf_data.uncompressed_size);
+   if (!uncompressed_data)
+      return NULL;
+
+   if (!codec->decompress(p, end - p, uncompressed_data,
+                          cf_data.uncompressed_size))
+      goto fail;
+
+   /* Check the data for corruption */
+   if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
+                                        cf_data.uncompressed_size))
+      goto fail;
+
+   if (size)
+      *size = cf_data.uncompressed_size;
+
+   return uncompressed_data;
+
+ fail:
+   free(uncompressed_data);
+   return NULL;
+}
+
+/**
+ * Checks an entry created by create_cache_entry() and decompresses it.
+ *
+ * Returns the malloc'ed uncompressed data, or NULL if the entry is invalid.
+ */
+static void *
+parse_cache_entry(struct disk_cache *cache, uint8_t *entry, size_t entry_size,
+                  size_t *size)
+{
+   size_t ck_size = cache->driver_keys_blob_size;
+   if (entry_size < ck_size)
+      return NULL;
+
+   /* Check for extremely unlikely hash collisions */
+   if (memcmp(cache->driver_keys_blob, entry, ck_size) != 0) {
+      assert(!"Mesa cache keys mismatch!");
+      return NULL;
+   }
+
+   return decompress_cache_entry(entry + ck_size, entry + entry_size, size);
+}
+
+bool
+disk_cache_entry_is_valid(const void *entry, size_t entry_size)
+{
+   uint8_t *p = (uint8_t *) entry, *end = p + entry_size;
+
+   /* Walk the driver_keys_blob, see disk_cache_create(). */
+   if (end - p < 1 || *p != CACHE_VERSION)
       return false;
+   p++;
 
-   ret = inflate(&strm, Z_NO_FLUSH);
-   assert(ret != Z_STREAM_ERROR);  /* state not clobbered */
+   for (unsigned i = 0; i < 2; i++) {
+      uint8_t *nul = memchr(p, '\0', end - p);
+      if (nul == NULL)
+         return false;
+      p = nul + 1;
+   }
 
-   /* Unless there was an error we should have decompressed everything in one
-    * go as we know the uncompressed file size.
-    */
-   if (ret != Z_STREAM_END) {
-      (void)inflateEnd(&strm);
+   if (end - p < sizeof(uint8_t) + sizeof(uint64_t))
       return false;
+   p += sizeof(uint8_t) + sizeof(uint64_t);
+
+   void *data = decompress_cache_entry(p, end, NULL);
+   free(data);
+
+   return data != NULL;
+}
+
+/* Read a whole cache file into a malloc'ed buffer. */
+static uint8_t *
+read_cache_file(const char *filename, size_t *size)
+{
+   struct stat sb;
+   uint8_t *data = NULL;
+   int fd;
+
+   fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return NULL;
+
+   if (fstat(fd, &sb) == -1)
+      goto fail;
+
+   data = malloc(sb.st_size);
+   if (data == NULL)
+      goto fail;
+
+   if (read_all(fd, data, sb.st_size) == -1) {
+      free(data);
+      data = NULL;
+      goto fail;
    }
-   assert(strm.avail_out == 0);
 
-   /* clean up and return */
-   (void)inflateEnd(&strm);
-   return true;
+   *size = sb.st_size;
+
+ fail:
+   close(fd);
+   return data;
+}
+
+/* Look for 'key' in the read-only caches. */
+static uint8_t *
+read_from_cache_layers(struct disk_cache *cache, const cache_key key,
+                       size_t *size)
+{
+   for (unsigned i = 0; i < cache->num_layers; i++) {
+      struct disk_cache_layer *layer = &cache->layers[i];
+      uint8_t *data = NULL;
+
+      if (layer->pack)
+         data = disk_cache_pack_read(layer->pack, key, size);
+
+      if (data == NULL) {
+         char *filename = get_cache_file_in(layer->path, key);
+         if (filename) {
+            data = read_cache_file(filename, size);
+            free(filename);
+         }
+      }
+
+      if (data)
+         return data;
+   }
+
+   return NULL;
 }
 
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
-   int fd = -1, ret;
-   struct stat sb;
-   char *filename = NULL;
+   char *filename;
    uint8_t *data = NULL;
    uint8_t *uncompressed_data = NULL;
-   uint8_t *file_header = NULL;
+   size_t data_size;
 
    if (size)
       *size = 0;
@@ -1121,112 +1560,26 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       return blob;
    }
 
-   filename = get_cache_file(cache, key);
-   if (filename == NULL)
-      goto fail;
-
-   fd = open(filename, O_RDONLY | O_CLOEXEC);
-   if (fd == -1)
-      goto fail;
-
-   if (fstat(fd, &sb) == -1)
-      goto fail;
-
-   data = malloc(sb.st_size);
-   if (data == NULL)
-      goto fail;
-
-   size_t ck_size = cache->driver_keys_blob_size;
-   file_header = malloc(ck_size);
-   if (!file_header)
-      goto fail;
-
-   if (sb.st_size < ck_size)
-      goto fail;
-
-   ret = read_all(fd, file_header, ck_size);
-   if (ret == -1)
-      goto fail;
-
-   /* Check for extremely unlikely hash collisions */
-   if (memcmp(cache->driver_keys_blob, file_header, ck_size) != 0) {
-      assert(!"Mesa cache keys mismatch!");
-      goto fail;
-   }
-
-   size_t cache_item_md_size = sizeof(uint32_t);
-   uint32_t md_type;
-   ret = read_all(fd, &md_type, cache_item_md_size);
-   if (ret == -1)
-      goto fail;
-
-   if (md_type == CACHE_ITEM_TYPE_GLSL) {
-      uint32_t num_keys;
-      cache_item_md_size += sizeof(uint32_t);
-      ret = read_all(fd, &num_keys, sizeof(uint32_t));
-      if (ret == -1)
-         goto fail;
-
-      /* The cache item metadata is currently just used for distributing
-       * precompiled shaders, they are not used by Mesa so just skip them for
-       * now.
-       * TODO: pass the metadata back to the caller and do some basic
-       * validation.
-       */
-      cache_item_md_size += num_keys * sizeof(cache_key);
-      ret = lseek(fd, num_keys * sizeof(cache_key), SEEK_CUR);
-      if (ret == -1)
-         goto fail;
+   if (cache->pack) {
+      data = disk_cache_pack_read(cache->pack, key, &data_size);
+   } else {
+      filename = get_cache_file(cache, key);
+      if (filename) {
+         data = read_cache_file(filename, &data_size);
+         free(filename);
+      }
    }
 
-   /* Load the CRC that was created when the file was written. */
-   struct cache_entry_file_data cf_data;
-   size_t cf_data_size = sizeof(cf_data);
-   ret = read_all(fd, &cf_data, cf_data_size);
-   if (ret == -1)
-      goto fail;
-
-   /* Load the actual cache data. */
-   size_t cache_data_size =
-      sb.st_size - cf_data_size - ck_size - cache_item_md_size;
-   ret = read_all(fd, data, cache_data_size);
-   if (ret == -1)
-      goto fail;
-
-   /* Uncompress the cache data */
-   uncompressed_data = malloc(cf_data.uncompressed_size);
-   if (!inflate_cache_data(data, cache_data_size, uncompressed_data,
-                           cf_data.uncompressed_size))
-      goto fail;
+   if (data == NULL)
+      data = read_from_cache_layers(cache, key, &data_size);
 
-   /* Check the data for corruption */
-   if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
-                                        cf_data.uncompressed_size))
-      goto fail;
+   if (data == NULL)
+      return NULL;
 
+   uncompressed_data = parse_cache_entry(cache, data, data_size, size);
    free(data);
-   free(filename);
-   free(file_header);
-   close(fd);
-
-   if (size)
-      *size = cf_data.uncompressed_size;
 
    return uncompressed_data;
-
- fail:
-   if (data)
-      free(data);
-   if (uncompressed_data)
-      free(uncompressed_data);
-   if (filename)
-      free(filename);
-   if (file_header)
-      free(file_header);
-   if (fd != -1)
-      close(fd);
-
-   return NULL;
 }
 
 void
@@ -1268,12 +1621,22 @@ disk_cache_has_key(struct disk_cache *cache, const cache_key key)
       return cache->blob_get_cb(key, CACHE_KEY_SIZE, &blob, sizeof(uint32_t));
    }
 
-   if (cache->path_init_failed)
-      return false;
+   if (!cache->path_init_failed) {
+      entry = &cache->stored_keys[i * CACHE_KEY_SIZE];
+      if (memcmp(entry, key, CACHE_KEY_SIZE) == 0)
+         return true;
+   }
 
-   entry = &cache->stored_keys[i * CACHE_KEY_SIZE];
+   for (unsigned l = 0; l < cache->num_layers; l++) {
+      if (cache->layers[l].stored_keys == NULL)
+         continue;
+
+      entry = &cache->layers[l].stored_keys[i * CACHE_KEY_SIZE];
+      if (memcmp(entry, key, CACHE_KEY_SIZE) == 0)
+         return true;
+   }
 
-   return memcmp(entry, key, CACHE_KEY_SIZE) == 0;
+   return false;
 }
 
 void
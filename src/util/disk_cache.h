@@ -246,6 +246,14 @@ void
 disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
                          disk_cache_get_cb get);
 
+/**
+ * Check that \entry of given \size is a complete cache entry, as stored on
+ * disk, whose data matches its checksum. This is meant for tools working on
+ * caches offline, which can't tell which driver wrote an entry.
+ */
+bool
+disk_cache_entry_is_valid(const void *entry, size_t size);
+
 #else
 
 static inline struct disk_cache *
@@ -306,6 +314,12 @@ disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
    return;
 }
 
+static inline bool
+disk_cache_entry_is_valid(const void *entry, size_t size)
+{
+   return false;
+}
+
 #endif /* ENABLE_SHADER_CACHE */
 
 #ifdef __cplusplus
@@ -0,0 +1,928 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifdef ENABLE_SHADER_CACHE
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/file.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "util/macros.h"
+#include "util/simple_mtx.h"
+#include "util/u_atomic.h"
+#include "util/u_dynarray.h"
+#include "main/compiler.h"
+
+#include "disk_cache_pack.h"
+
+#define PACK_MAGIC         0x4b50434d /* "MCPK" */
+#define PACK_RECORD_MAGIC  0x4552434d /* "MCRE" */
+#define PACK_INDEX_MAGIC   0x5849434d /* "MCIX" */
+
+/* Bump whenever the layout of the pack or the index changes. Mismatching
+ * files are simply thrown away and recreated.
+ */
+#define PACK_VERSION 1
+
+/* Number of slots in the index hash table (must be a power of two). Once
+ * three quarters of them are in use the pack gets compacted.
+ */
+#define PACK_INDEX_SLOTS (1 << 16)
+
+/* Values of pack_index_slot::offset which don't point at a record. No record
+ * can live at offset 0 since that is where the pack file header is.
+ */
+#define PACK_SLOT_EMPTY   0
+#define PACK_SLOT_DELETED UINT64_MAX
+
+/* Amount of queued entry data after which a batch is written out without
+ * waiting for disk_cache_pack_flush().
+ */
+#define PACK_BATCH_SIZE (1024 * 1024)
+
+struct pack_file_header {
+   uint32_t magic;
+   uint32_t version;
+};
+
+/* Every entry in the pack is preceded by one of these. Checking the key
+ * makes reads through stale index slots (see pack_compact()) harmless.
+ */
+struct pack_record_header {
+   uint32_t magic;
+   uint32_t size;
+   uint8_t key[CACHE_KEY_SIZE];
+};
+
+struct pack_index_header {
+   uint32_t magic;
+   uint32_t version;
+   uint32_t num_slots;
+
+   /* Slots which are not PACK_SLOT_EMPTY, including deleted ones. */
+   uint32_t num_used;
+
+   /* Incremented whenever the pack file is replaced by compaction. */
+   uint64_t generation;
+
+   /* End of the last record written to the pack. */
+   uint64_t pack_end;
+
+   /* Total size of the entries reachable from the index. */
+   uint64_t live_size;
+
+   /* Source of the pack_index_slot::last_access stamps. */
+   uint64_t clock;
+};
+
+struct pack_index_slot {
+   uint8_t key[CACHE_KEY_SIZE];
+   uint32_t size;
+   uint64_t offset;
+   uint64_t last_access;
+};
+
+struct pack_pending_entry {
+   cache_key key;
+   void *data;
+   size_t size;
+};
+
+struct disk_cache_pack {
+   char *pack_path;
+
+   /* The index file, kept open as the lock serializing writers across
+    * processes.
+    */
+   int index_fd;
+
+   /* The mmapped index. */
+   struct pack_index_header *header;
+   struct pack_index_slot *slots;
+   size_t index_size;
+
+   /* The pack file matching 'generation'. Pack files replaced by a
+    * compaction are only closed in disk_cache_pack_close(), since other
+    * threads might still be reading from them.
+    */
+   simple_mtx_t fd_mutex;
+   int fd;
+   uint64_t generation;
+   struct util_dynarray old_fds;
+
+   uint64_t max_size;
+
+   /* Opened with disk_cache_pack_open_read_only(). */
+   bool read_only;
+
+   /* Entries queued by disk_cache_pack_queue(), only ever accessed by the
+    * writer thread.
+    */
+   struct util_dynarray pending;
+   size_t pending_size;
+};
+
+static int
+pack_lock(int fd)
+{
+#ifdef HAVE_FLOCK
+   return flock(fd, LOCK_EX);
+#else
+   struct flock lock = {
+      .l_start = 0,
+      .l_len = 0, /* entire file */
+      .l_type = F_WRLCK,
+      .l_whence = SEEK_SET
+   };
+   return fcntl(fd, F_SETLKW, &lock);
+#endif
+}
+
+static void
+pack_unlock(int fd)
+{
+#ifdef HAVE_FLOCK
+   flock(fd, LOCK_UN);
+#else
+   struct flock lock = {
+      .l_start = 0,
+      .l_len = 0, /* entire file */
+      .l_type = F_UNLCK,
+      .l_whence = SEEK_SET
+   };
+   fcntl(fd, F_SETLK, &lock);
+#endif
+}
+
+static ssize_t
+pread_all(int fd, void *buf, size_t count, uint64_t offset)
+{
+   char *in = buf;
+   ssize_t read_ret;
+   size_t done;
+
+   for (done = 0; done < count; done += read_ret) {
+      read_ret = pread(fd, in + done, count - done, offset + done);
+      if (read_ret == -1 || read_ret == 0)
+         return -1;
+   }
+   return done;
+}
+
+static ssize_t
+pwrite_all(int fd, const void *buf, size_t count, uint64_t offset)
+{
+   const char *out = buf;
+   ssize_t written;
+   size_t done;
+
+   for (done = 0; done < count; done += written) {
+      written = pwrite(fd, out + done, count - done, offset + done);
+      if (written == -1)
+         return -1;
+   }
+   return done;
+}
+
+static inline unsigned
+pack_key_hash(const cache_key key)
+{
+   uint32_t key_chunk;
+
+   memcpy(&key_chunk, key, sizeof(key_chunk));
+   return CPU_TO_LE32(key_chunk);
+}
+
+/* Returns the slot holding 'key', or -1 if there is none. */
+static int
+pack_lookup_slot(const struct pack_index_slot *slots, unsigned num_slots,
+                 const cache_key key)
+{
+   unsigned mask = num_slots - 1;
+   unsigned i = pack_key_hash(key) & mask;
+
+   for (unsigned n = 0; n < num_slots; n++, i = (i + 1) & mask) {
+      uint64_t offset = p_atomic_read(&slots[i].offset);
+
+      if (offset == PACK_SLOT_EMPTY)
+         break;
+
+      if (offset != PACK_SLOT_DELETED &&
+          memcmp(slots[i].key, key, CACHE_KEY_SIZE) == 0)
+         return i;
+   }
+
+   return -1;
+}
+
+/* Returns a free slot for 'key', which must not be in the table yet, or -1
+ * if the table is full.
+ */
+static int
+pack_insert_slot(const struct pack_index_slot *slots, unsigned num_slots,
+                 const cache_key key)
+{
+   unsigned mask = num_slots - 1;
+   unsigned i = pack_key_hash(key) & mask;
+
+   for (unsigned n = 0; n < num_slots; n++, i = (i + 1) & mask) {
+      uint64_t offset = slots[i].offset;
+
+      if (offset == PACK_SLOT_EMPTY || offset == PACK_SLOT_DELETED)
+         return i;
+   }
+
+   return -1;
+}
+
+/* Make the index and the pack file describe an empty cache. Must be called
+ * with the lock held.
+ */
+static bool
+pack_reset(struct disk_cache_pack *pack)
+{
+   struct pack_index_header *header = pack->header;
+   uint64_t generation = header->generation;
+
+   memset(pack->header, 0, pack->index_size);
+
+   if (ftruncate(pack->fd, 0) == -1)
+      return false;
+
+   struct pack_file_header file_header = {
+      .magic = PACK_MAGIC,
+      .version = PACK_VERSION,
+   };
+   if (pwrite_all(pack->fd, &file_header, sizeof(file_header), 0) == -1)
+      return false;
+
+   header->version = PACK_VERSION;
+   header->num_slots = PACK_INDEX_SLOTS;
+   header->pack_end = sizeof(file_header);
+   /* Make other processes drop the file they have open. */
+   header->generation = generation + 1;
+   header->magic = PACK_INDEX_MAGIC;
+
+   pack->generation = header->generation;
+
+   return true;
+}
+
+/* Is the index consistent with the pack file we have open? */
+static bool
+pack_is_valid(struct disk_cache_pack *pack)
+{
+   const struct pack_index_header *header = pack->header;
+   struct pack_file_header file_header;
+   struct stat sb;
+
+   if (header->magic != PACK_INDEX_MAGIC ||
+       header->version != PACK_VERSION ||
+       header->num_slots != PACK_INDEX_SLOTS)
+      return false;
+
+   if (fstat(pack->fd, &sb) == -1 || sb.st_size < header->pack_end)
+      return false;
+
+   if (pread_all(pack->fd, &file_header, sizeof(file_header), 0) == -1)
+      return false;
+
+   return file_header.magic == PACK_MAGIC &&
+          file_header.version == PACK_VERSION;
+}
+
+static struct disk_cache_pack *
+pack_create(const char *path, uint64_t max_size, bool read_only,
+            char **index_path)
+{
+   struct disk_cache_pack *pack;
+
+   pack = calloc(1, sizeof(*pack));
+   if (pack == NULL)
+      return NULL;
+
+   pack->index_fd = -1;
+   pack->fd = -1;
+   pack->header = MAP_FAILED;
+   pack->index_size = sizeof(struct pack_index_header) +
+                      PACK_INDEX_SLOTS * sizeof(struct pack_index_slot);
+   pack->max_size = max_size;
+   pack->read_only = read_only;
+   simple_mtx_init(&pack->fd_mutex, mtx_plain);
+   util_dynarray_init(&pack->old_fds, NULL);
+   util_dynarray_init(&pack->pending, NULL);
+
+   if (asprintf(&pack->pack_path, "%s/%s", path, DISK_CACHE_PACK_NAME) == -1)
+      pack->pack_path = NULL;
+
+   if (asprintf(index_path, "%s/%s", path, DISK_CACHE_PACK_INDEX_NAME) == -1)
+      *index_path = NULL;
+
+   return pack;
+}
+
+static void
+pack_destroy(struct disk_cache_pack *pack)
+{
+   if (pack->header != MAP_FAILED)
+      munmap(pack->header, pack->index_size);
+   if (pack->fd != -1)
+      close(pack->fd);
+   if (pack->index_fd != -1)
+      close(pack->index_fd);
+
+   util_dynarray_foreach(&pack->old_fds, int, fd)
+      close(*fd);
+
+   util_dynarray_fini(&pack->old_fds);
+   util_dynarray_fini(&pack->pending);
+   simple_mtx_destroy(&pack->fd_mutex);
+   free(pack->pack_path);
+   free(pack);
+}
+
+struct disk_cache_pack *
+disk_cache_pack_open(const char *path, uint64_t max_size)
+{
+   struct disk_cache_pack *pack;
+   char *index_path = NULL;
+   struct stat sb;
+
+   pack = pack_create(path, max_size, false, &index_path);
+   if (pack == NULL)
+      return NULL;
+
+   if (pack->pack_path == NULL || index_path == NULL)
+      goto fail;
+
+   pack->index_fd = open(index_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (pack->index_fd == -1)
+      goto fail;
+
+   if (pack_lock(pack->index_fd) == -1)
+      goto fail;
+
+   /* Force the index file to be the expected size. A file of the wrong
+    * size is from an incompatible version, which pack_is_valid() below
+    * will notice once it has been truncated.
+    */
+   if (fstat(pack->index_fd, &sb) == -1)
+      goto fail_unlock;
+
+   if (sb.st_size != pack->index_size) {
+      if (ftruncate(pack->index_fd, 0) == -1 ||
+          ftruncate(pack->index_fd, pack->index_size) == -1)
+         goto fail_unlock;
+   }
+
+   /* Mapped shared, so that other processes see our updates. */
+   pack->header = mmap(NULL, pack->index_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED, pack->index_fd, 0);
+   if (pack->header == MAP_FAILED)
+      goto fail_unlock;
+   pack->slots = (struct pack_index_slot *) (pack->header + 1);
+
+   pack->fd = open(pack->pack_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (pack->fd == -1)
+      goto fail_unlock;
+
+   pack->generation = pack->header->generation;
+
+   if (!pack_is_valid(pack) && !pack_reset(pack))
+      goto fail_unlock;
+
+   pack_unlock(pack->index_fd);
+   free(index_path);
+
+   return pack;
+
+ fail_unlock:
+   pack_unlock(pack->index_fd);
+ fail:
+   free(index_path);
+   pack_destroy(pack);
+
+   return NULL;
+}
+
+struct disk_cache_pack *
+disk_cache_pack_open_read_only(const char *path)
+{
+   struct disk_cache_pack *pack;
+   char *index_path = NULL;
+   struct stat sb;
+
+   pack = pack_create(path, 0, true, &index_path);
+   if (pack == NULL)
+      return NULL;
+
+   if (pack->pack_path == NULL || index_path == NULL)
+      goto fail;
+
+   /* Nothing writes to a read-only pack, so there is no locking here. */
+   pack->index_fd = open(index_path, O_RDONLY | O_CLOEXEC);
+   if (pack->index_fd == -1)
+      goto fail;
+
+   if (fstat(pack->index_fd, &sb) == -1 || sb.st_size != pack->index_size)
+      goto fail;
+
+   pack->header = mmap(NULL, pack->index_size, PROT_READ, MAP_SHARED,
+                       pack->index_fd, 0);
+   if (pack->header == MAP_FAILED)
+      goto fail;
+   pack->slots = (struct pack_index_slot *) (pack->header + 1);
+
+   pack->fd = open(pack->pack_path, O_RDONLY | O_CLOEXEC);
+   if (pack->fd == -1)
+      goto fail;
+
+   pack->generation = pack->header->generation;
+
+   if (!pack_is_valid(pack))
+      goto fail;
+
+   free(index_path);
+
+   return pack;
+
+ fail:
+   free(index_path);
+   pack_destroy(pack);
+
+   return NULL;
+}
+
+void
+disk_cache_pack_close(struct disk_cache_pack *pack)
+{
+   disk_cache_pack_flush(pack);
+   pack_destroy(pack);
+}
+
+/* Switch to 'fd' as the pack file for 'generation'. */
+static void
+pack_set_fd(struct disk_cache_pack *pack, int fd, uint64_t generation)
+{
+   if (pack->fd != -1)
+      util_dynarray_append(&pack->old_fds, int, pack->fd);
+
+   pack->fd = fd;
+   pack->generation = generation;
+}
+
+/* Return the pack file matching the current index, reopening it if another
+ * process has replaced it.
+ */
+static int
+pack_get_fd(struct disk_cache_pack *pack)
+{
+   uint64_t generation = p_atomic_read(&pack->header->generation);
+   int fd;
+
+   simple_mtx_lock(&pack->fd_mutex);
+
+   if (unlikely(generation != pack->generation)) {
+      fd = open(pack->pack_path,
+                (pack->read_only ? O_RDONLY : O_RDWR) | O_CLOEXEC);
+      if (fd != -1)
+         pack_set_fd(pack, fd, generation);
+   }
+   fd = pack->fd;
+
+   simple_mtx_unlock(&pack->fd_mutex);
+
+   return fd;
+}
+
+void *
+disk_cache_pack_read(struct disk_cache_pack *pack, const cache_key key,
+                     size_t *size)
+{
+   struct pack_record_header record;
+   uint8_t *data;
+
+   int i = pack_lookup_slot(pack->slots, PACK_INDEX_SLOTS, key);
+   if (i < 0)
+      return NULL;
+
+   struct pack_index_slot *slot = &pack->slots[i];
+   uint32_t entry_size = slot->size;
+   uint64_t offset = p_atomic_read(&slot->offset);
+   if (offset == PACK_SLOT_EMPTY || offset == PACK_SLOT_DELETED)
+      return NULL;
+
+   /* The index is mmapped from disk and read-only layers come from
+    * wherever they were built, so don't trust the slot to point inside
+    * the pack before allocating for it.
+    */
+   size_t record_size = sizeof(record) + entry_size;
+   int fd = pack_get_fd(pack);
+   struct stat sb;
+
+   if (fstat(fd, &sb) == -1 ||
+       offset < sizeof(struct pack_file_header) ||
+       offset > (uint64_t) sb.st_size ||
+       record_size > (uint64_t) sb.st_size - offset)
+      return NULL;
+
+   /* Read the record header and the entry with a single syscall. */
+   data = malloc(record_size);
+   if (data == NULL)
+      return NULL;
+
+   if (pread_all(fd, data, record_size, offset) == -1)
+      goto fail;
+
+   /* The slot might have been changed by a concurrent compaction, or we
+    * might be looking at a replaced pack file, so make sure we got the
+    * record we asked for.
+    */
+   memcpy(&record, data, sizeof(record));
+   if (record.magic != PACK_RECORD_MAGIC || record.size != entry_size ||
+       memcmp(record.key, key, CACHE_KEY_SIZE) != 0)
+      goto fail;
+
+   memmove(data, data + sizeof(record), entry_size);
+
+   if (!pack->read_only)
+      slot->last_access = p_atomic_inc_return(&pack->header->clock);
+
+   *size = entry_size;
+   return data;
+
+ fail:
+   free(data);
+   return NULL;
+}
+
+void
+disk_cache_pack_foreach(struct disk_cache_pack *pack,
+                        void (*cb)(void *data, const cache_key key),
+                        void *data)
+{
+   for (unsigned i = 0; i < PACK_INDEX_SLOTS; i++) {
+      const struct pack_index_slot *slot = &pack->slots[i];
+      uint64_t offset = p_atomic_read(&slot->offset);
+      cache_key key;
+
+      if (offset == PACK_SLOT_EMPTY || offset == PACK_SLOT_DELETED)
+         continue;
+
+      memcpy(key, slot->key, CACHE_KEY_SIZE);
+      cb(data, key);
+   }
+}
+
+void
+disk_cache_pack_queue(struct disk_cache_pack *pack, const cache_key key,
+                      void *data, size_t size)
+{
+   struct pack_pending_entry entry;
+
+   if (size > UINT32_MAX) {
+      free(data);
+      return;
+   }
+
+   memcpy(entry.key, key, CACHE_KEY_SIZE);
+   entry.data = data;
+   entry.size = size;
+   util_dynarray_append(&pack->pending, struct pack_pending_entry, entry);
+   pack->pending_size += sizeof(struct pack_record_header) + size;
+
+   if (pack->pending_size >= PACK_BATCH_SIZE)
+      disk_cache_pack_flush(pack);
+}
+
+struct pack_live_entry {
+   uint64_t last_access;
+   uint64_t offset;
+   unsigned slot;
+};
+
+static int
+compare_last_access_desc(const void *a, const void *b)
+{
+   const struct pack_live_entry *ea = a, *eb = b;
+
+   if (ea->last_access != eb->last_access)
+      return ea->last_access > eb->last_access ? -1 : 1;
+   return 0;
+}
+
+static int
+compare_offset(const void *a, const void *b)
+{
+   const struct pack_live_entry *ea = a, *eb = b;
+
+   if (ea->offset != eb->offset)
+      return ea->offset < eb->offset ? -1 : 1;
+   return 0;
+}
+
+/* Replace the pack file with one holding only the most recently used
+ * entries, leaving room for 'incoming_size' bytes in 'incoming_count' new
+ * entries. Must be called with the lock held.
+ *
+ * The index is rewritten in place while other processes may be reading
+ * it. A reader racing with the rewrite either misses, or reads a record
+ * whose key doesn't match what it looked up, which it treats as a miss too.
+ */
+static void
+pack_compact(struct disk_cache_pack *pack, uint64_t incoming_size,
+             unsigned incoming_count)
+{
+   struct pack_index_header *header = pack->header;
+   struct pack_live_entry *live;
+   struct pack_index_slot *new_slots = NULL;
+   struct pack_record_header *record;
+   uint8_t *buf = NULL;
+   size_t buf_size = 0;
+   char *tmp_path = NULL;
+   int old_fd, fd = -1;
+   unsigned num_live = 0, num_kept = 0;
+
+   live = malloc(PACK_INDEX_SLOTS * sizeof(*live));
+   if (live == NULL)
+      return;
+
+   for (unsigned i = 0; i < PACK_INDEX_SLOTS; i++) {
+      uint64_t offset = pack->slots[i].offset;
+
+      if (offset == PACK_SLOT_EMPTY || offset == PACK_SLOT_DELETED)
+         continue;
+
+      live[num_live].last_access = pack->slots[i].last_access;
+      live[num_live].offset = offset;
+      live[num_live].slot = i;
+      num_live++;
+   }
+
+   /* Keep the most recently used entries, leaving some headroom so that we
+    * don't have to compact again right after the next few writes.
+    */
+   uint64_t budget = pack->max_size / 4 * 3;
+   uint64_t kept_size = 0;
+   unsigned max_kept = PACK_INDEX_SLOTS / 2;
+
+   budget = budget > incoming_size ? budget - incoming_size : 0;
+   max_kept = max_kept > incoming_count ? max_kept - incoming_count : 0;
+
+   qsort(live, num_live, sizeof(*live), compare_last_access_desc);
+   while (num_kept < num_live && num_kept < max_kept) {
+      uint64_t size = sizeof(*record) + pack->slots[live[num_kept].slot].size;
+
+      if (kept_size + size > budget)
+         break;
+
+      kept_size += size;
+      num_kept++;
+   }
+
+   /* Copy them in pack order, so that we read the old pack sequentially. */
+   qsort(live, num_kept, sizeof(*live), compare_offset);
+
+   if (asprintf(&tmp_path, "%s.tmp", pack->pack_path) == -1) {
+      tmp_path = NULL;
+      goto done;
+   }
+
+   new_slots = calloc(PACK_INDEX_SLOTS, sizeof(*new_slots));
+   if (new_slots == NULL)
+      goto done;
+
+   fd = open(tmp_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd == -1)
+      goto done;
+
+   struct pack_file_header file_header = {
+      .magic = PACK_MAGIC,
+      .version = PACK_VERSION,
+   };
+   if (pwrite_all(fd, &file_header, sizeof(file_header), 0) == -1)
+      goto fail;
+
+   old_fd = pack_get_fd(pack);
+
+   uint64_t pack_end = sizeof(file_header);
+   uint64_t live_size = 0;
+   unsigned num_used = 0;
+
+   for (unsigned i = 0; i < num_kept; i++) {
+      const struct pack_index_slot *slot = &pack->slots[live[i].slot];
+      size_t record_size = sizeof(*record) + slot->size;
+
+      if (record_size > buf_size) {
+         uint8_t *tmp = realloc(buf, record_size);
+         if (tmp == NULL)
+            goto fail;
+         buf = tmp;
+         buf_size = record_size;
+      }
+
+      /* Drop whatever we can't read back intact. */
+      record = (struct pack_record_header *) buf;
+      if (pread_all(old_fd, buf, record_size, slot->offset) == -1 ||
+          record->magic != PACK_RECORD_MAGIC ||
+          record->size != slot->size ||
+          memcmp(record->key, slot->key, CACHE_KEY_SIZE) != 0)
+         continue;
+
+      if (pwrite_all(fd, buf, record_size, pack_end) == -1)
+         goto fail;
+
+      int j = pack_insert_slot(new_slots, PACK_INDEX_SLOTS, slot->key);
+      assert(j >= 0);
+
+      new_slots[j] = *slot;
+      new_slots[j].offset = pack_end;
+
+      pack_end += record_size;
+      live_size += slot->size;
+      num_used++;
+   }
+
+   if (rename(tmp_path, pack->pack_path) == -1)
+      goto fail;
+
+   memcpy(pack->slots, new_slots, PACK_INDEX_SLOTS * sizeof(*new_slots));
+   header->pack_end = pack_end;
+   header->live_size = live_size;
+   header->num_used = num_used;
+   p_atomic_inc(&header->generation);
+
+   simple_mtx_lock(&pack->fd_mutex);
+   pack_set_fd(pack, fd, header->generation);
+   simple_mtx_unlock(&pack->fd_mutex);
+   fd = -1;
+
+   goto done;
+
+ fail:
+   unlink(tmp_path);
+ done:
+   if (fd != -1)
+      close(fd);
+   free(buf);
+   free(new_slots);
+   free(tmp_path);
+   free(live);
+}
+
+void
+disk_cache_pack_flush(struct disk_cache_pack *pack)
+{
+   struct pack_index_header *header = pack->header;
+   unsigned count = util_dynarray_num_elements(&pack->pending,
+                                               struct pack_pending_entry);
+   struct pack_pending_entry *entries = pack->pending.data;
+   uint8_t *batch = NULL;
+
+   if (count == 0)
+      return;
+
+   if (pack_lock(pack->index_fd) == -1)
+      goto done;
+
+   /* Another process might have found the files damaged and started
+    * over while we weren't holding the lock.
+    */
+   if (header->magic != PACK_INDEX_MAGIC)
+      goto done_unlock;
+
+   if (header->live_size + pack->pending_size > pack->max_size ||
+       header->num_used + count > PACK_INDEX_SLOTS / 4 * 3)
+      pack_compact(pack, pack->pending_size, count);
+
+   /* Write the whole batch with a single syscall, and only then publish the
+    * new records in the index.
+    */
+   batch = malloc(pack->pending_size);
+   if (batch == NULL)
+      goto done_unlock;
+
+   size_t batch_size = 0;
+   for (unsigned i = 0; i < count; i++) {
+      struct pack_pending_entry *entry = &entries[i];
+      bool duplicate = false;
+
+      if (pack_lookup_slot(pack->slots, PACK_INDEX_SLOTS, entry->key) >= 0)
+         continue;
+
+      for (unsigned j = 0; j < i; j++) {
+         if (entries[j].data == NULL &&
+             memcmp(entries[j].key, entry->key, CACHE_KEY_SIZE) == 0) {
+            duplicate = true;
+            break;
+         }
+      }
+      if (duplicate)
+         continue;
+
+      struct pack_record_header record;
+      record.magic = PACK_RECORD_MAGIC;
+      record.size = entry->size;
+      memcpy(record.key, entry->key, CACHE_KEY_SIZE);
+
+      memcpy(batch + batch_size, &record, sizeof(record));
+      memcpy(batch + batch_size + sizeof(record), entry->data, entry->size);
+      batch_size += sizeof(record) + entry->size;
+
+      /* Mark the entry as part of the batch. */
+      free(entry->data);
+      entry->data = NULL;
+   }
+
+   uint64_t offset = header->pack_end;
+   if (batch_size == 0 ||
+       pwrite_all(pack_get_fd(pack), batch, batch_size, offset) == -1)
+      goto done_unlock;
+
+   for (unsigned i = 0; i < count; i++) {
+      struct pack_pending_entry *entry = &entries[i];
+
+      if (entry->data != NULL)
+         continue;
+
+      int j = pack_insert_slot(pack->slots, PACK_INDEX_SLOTS, entry->key);
+      if (j >= 0) {
+         struct pack_index_slot *slot = &pack->slots[j];
+
+         if (slot->offset == PACK_SLOT_EMPTY)
+            header->num_used++;
+
+         memcpy(slot->key, entry->key, CACHE_KEY_SIZE);
+         slot->size = entry->size;
+         slot->last_access = p_atomic_inc_return(&header->clock);
+         p_atomic_set(&slot->offset, offset);
+
+         header->live_size += entry->size;
+      }
+
+      offset += sizeof(struct pack_record_header) + entry->size;
+   }
+
+   header->pack_end = offset;
+
+ done_unlock:
+   pack_unlock(pack->index_fd);
+ done:
+   util_dynarray_foreach(&pack->pending, struct pack_pending_entry, entry)
+      free(entry->data);
+   util_dynarray_clear(&pack->pending);
+   pack->pending_size = 0;
+   free(batch);
+}
+
+void
+disk_cache_pack_remove(struct disk_cache_pack *pack, const cache_key key)
+{
+   struct pack_index_header *header = pack->header;
+
+   if (pack->read_only)
+      return;
+
+   if (pack_lookup_slot(pack->slots, PACK_INDEX_SLOTS, key) < 0)
+      return;
+
+   if (pack_lock(pack->index_fd) == -1)
+      return;
+
+   int i = pack_lookup_slot(pack->slots, PACK_INDEX_SLOTS, key);
+   if (i >= 0) {
+      header->live_size -= pack->slots[i].size;
+      p_atomic_set(&pack->slots[i].offset, PACK_SLOT_DELETED);
+   }
+
+   pack_unlock(pack->index_fd);
+}
+
+#endif /* ENABLE_SHADER_CACHE */
@@ -0,0 +1,132 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Single-file storage for the shader cache.
+ *
+ * Instead of one file per entry, all entries are appended to a single pack
+ * file, and an open-addressing hash table mapping keys to pack offsets is
+ * kept in a separate, mmapped index file.  A lookup is a probe of the mmapped
+ * table followed by a single pread(), without touching the directory tree.
+ *
+ * Entries are written in batches by the cache's writer thread.  Space is
+ * reclaimed by compaction: when the pack grows past the maximum cache size,
+ * the most recently used entries are copied into a new pack file which then
+ * replaces the old one.
+ *
+ * The pack code only deals with opaque, already serialized cache entries;
+ * building and parsing them is left to disk_cache.c.
+ */
+
+#ifndef DISK_CACHE_PACK_H
+#define DISK_CACHE_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "util/disk_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DISK_CACHE_PACK_NAME "pack"
+#define DISK_CACHE_PACK_INDEX_NAME "pack.idx"
+
+struct disk_cache_pack;
+
+/**
+ * Open (creating them as needed) the pack and pack index files within the
+ * cache directory 'path'.
+ *
+ * Returns NULL on failure, in which case the caller should fall back to
+ * the one-file-per-entry layout.
+ */
+struct disk_cache_pack *
+disk_cache_pack_open(const char *path, uint64_t max_size);
+
+/**
+ * Open an existing pack in 'path' for lookups only, e.g. one shipped as
+ * part of a read-only, prebuilt cache.
+ *
+ * Returns NULL if there is no valid pack there.
+ */
+struct disk_cache_pack *
+disk_cache_pack_open_read_only(const char *path);
+
+/**
+ * Write out all entries still queued by disk_cache_pack_queue() and close
+ * the pack.
+ */
+void
+disk_cache_pack_close(struct disk_cache_pack *pack);
+
+/**
+ * Look up 'key' in the pack.
+ *
+ * Returns a malloc'ed copy of the entry, (or NULL if the key is not in the
+ * pack or the entry is damaged). The caller should free it when finished.
+ */
+void *
+disk_cache_pack_read(struct disk_cache_pack *pack, const cache_key key,
+                     size_t *size);
+
+/**
+ * Call 'cb' with the key of every entry in the pack.
+ */
+void
+disk_cache_pack_foreach(struct disk_cache_pack *pack,
+                        void (*cb)(void *data, const cache_key key),
+                        void *data);
+
+/**
+ * Queue an entry to be written to the pack. The pack takes ownership of
+ * 'data', which must have been malloc'ed.
+ *
+ * Queued entries are only written when the batch gets large enough or at
+ * the next disk_cache_pack_flush(). Must only be called from a single
+ * thread, (the cache's writer thread).
+ */
+void
+disk_cache_pack_queue(struct disk_cache_pack *pack, const cache_key key,
+                      void *data, size_t size);
+
+/**
+ * Append all queued entries to the pack, compacting it first if it would
+ * otherwise grow beyond the maximum cache size.
+ */
+void
+disk_cache_pack_flush(struct disk_cache_pack *pack);
+
+/**
+ * Drop 'key' from the pack index. The space it used is reclaimed at the
+ * next compaction.
+ */
+void
+disk_cache_pack_remove(struct disk_cache_pack *pack, const cache_key key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DISK_CACHE_PACK_H */
@@ -33,11 +33,17 @@
  */
 
 /**
- * Implements an open-addressing, linear-reprobing hash table.
+ * Implements an open-addressing hash table probed a group of entries at a
+ * time, after the "Swiss tables" design:
  *
- * For more information, see:
+ * https://abseil.io/about/design/swisstables
  *
- * http://cgit.freedesktop.org/~anholt/hash_table/tree/README
+ * Next to the entries, the table keeps one control byte per entry, which is
+ * either CTRL_EMPTY, CTRL_DELETED, or for present entries, 7 bits of their
+ * hash. Lookups compare the control bytes of a whole group of entries to
+ * those bits at once (using SSE2 or NEON when available), so entries are
+ * only looked at when their hash is likely to match, and the end of the
+ * probe sequence is found without touching the entries at all.
  */
 
 #include <stdlib.h>
@@ -47,56 +53,141 @@
 #include "hash_table.h"
 #include "ralloc.h"
 #include "macros.h"
+#include "bitscan.h"
+#include "u_endian.h"
 #include "main/hash.h"
-#include "fast_urem_by_const.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 static const uint32_t deleted_key_value;
 
-/**
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
+#define CTRL_EMPTY   0x80
+#define CTRL_DELETED 0xfe
+
+/* Both special values have the top bit set, present entries don't. */
+#define ctrl_is_present(c) (((c) & 0x80) == 0)
+
+/* The group functions return a mask of the entries of the group matching
+ * the condition, to be walked with group_mask_next().
  */
-static const struct {
-   uint32_t max_entries, size, rehash;
-   uint64_t size_magic, rehash_magic;
-} hash_sizes[] = {
-#define ENTRY(max_entries, size, rehash) \
-   { max_entries, size, rehash, \
-      REMAINDER_MAGIC(size), REMAINDER_MAGIC(rehash) }
-
-   ENTRY(2,            5,            3            ),
-   ENTRY(4,            7,            5            ),
-   ENTRY(8,            13,           11           ),
-   ENTRY(16,           19,           17           ),
-   ENTRY(32,           43,           41           ),
-   ENTRY(64,           73,           71           ),
-   ENTRY(128,          151,          149          ),
-   ENTRY(256,          283,          281          ),
-   ENTRY(512,          571,          569          ),
-   ENTRY(1024,         1153,         1151         ),
-   ENTRY(2048,         2269,         2267         ),
-   ENTRY(4096,         4519,         4517         ),
-   ENTRY(8192,         9013,         9011         ),
-   ENTRY(16384,        18043,        18041        ),
-   ENTRY(32768,        36109,        36107        ),
-   ENTRY(65536,        72091,        72089        ),
-   ENTRY(131072,       144409,       144407       ),
-   ENTRY(262144,       288361,       288359       ),
-   ENTRY(524288,       576883,       576881       ),
-   ENTRY(1048576,      1153459,      1153457      ),
-   ENTRY(2097152,      2307163,      2307161      ),
-   ENTRY(4194304,      4613893,      4613891      ),
-   ENTRY(8388608,      9227641,      9227639      ),
-   ENTRY(16777216,     18455029,     18455027     ),
-   ENTRY(33554432,     36911011,     36911009     ),
-   ENTRY(67108864,     73819861,     73819859     ),
-   ENTRY(134217728,    147639589,    147639587    ),
-   ENTRY(268435456,    295279081,    295279079    ),
-   ENTRY(536870912,    590559793,    590559791    ),
-   ENTRY(1073741824,   1181116273,   1181116271   ),
-   ENTRY(2147483648ul, 2362232233ul, 2362232231ul )
-};
+#if defined(__SSE2__)
+
+#define GROUP_WIDTH_LOG2 4
+
+static inline uint64_t
+group_match(const uint8_t *ctrl, uint8_t h2)
+{
+   __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+}
+
+static inline uint64_t
+group_match_empty(const uint8_t *ctrl)
+{
+   return group_match(ctrl, CTRL_EMPTY);
+}
+
+static inline uint64_t
+group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+   return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+static inline unsigned
+group_mask_next(uint64_t *mask)
+{
+   return u_bit_scan64(mask);
+}
+
+/* Number of entries before the first and after the last match of a mask. */
+static inline unsigned
+group_mask_leading(uint64_t mask)
+{
+   return 16 - util_last_bit64(mask);
+}
+
+static inline unsigned
+group_mask_trailing(uint64_t mask)
+{
+   return mask ? ffsll(mask) - 1 : 16;
+}
+
+#else
+
+/* One bit (the top one) per byte of a 64-bit word. */
+#define GROUP_WIDTH_LOG2 3
+#define GROUP_MSBS 0x8080808080808080ull
+#define GROUP_LSBS 0x0101010101010101ull
+
+static inline uint64_t
+group_load(const uint8_t *ctrl)
+{
+#if defined(__ARM_NEON) && defined(__aarch64__)
+   return vget_lane_u64(vreinterpret_u64_u8(vld1_u8(ctrl)), 0);
+#else
+   uint64_t group;
+   memcpy(&group, ctrl, sizeof(group));
+#ifdef PIPE_ARCH_BIG_ENDIAN
+   group = __builtin_bswap64(group);
+#endif
+   return group;
+#endif
+}
+
+static inline uint64_t
+group_match(const uint8_t *ctrl, uint8_t h2)
+{
+#if defined(__ARM_NEON) && defined(__aarch64__)
+   uint8x8_t eq = vceq_u8(vld1_u8(ctrl), vdup_n_u8(h2));
+   return vget_lane_u64(vreinterpret_u64_u8(eq), 0) & GROUP_MSBS;
+#else
+   /* This can report false positives when a byte following a match is
+    * h2 ^ 1, which is fine since the hashes get compared anyway.
+    */
+   uint64_t x = group_load(ctrl) ^ (GROUP_LSBS * h2);
+   return (x - GROUP_LSBS) & ~x & GROUP_MSBS;
+#endif
+}
+
+static inline uint64_t
+group_match_empty(const uint8_t *ctrl)
+{
+   /* CTRL_EMPTY is the only value with the top bit set and bit 1 clear. */
+   uint64_t group = group_load(ctrl);
+   return group & ~(group << 6) & GROUP_MSBS;
+}
+
+static inline uint64_t
+group_match_empty_or_deleted(const uint8_t *ctrl)
+{
+   return group_load(ctrl) & GROUP_MSBS;
+}
+
+static inline unsigned
+group_mask_next(uint64_t *mask)
+{
+   return u_bit_scan64(mask) / 8;
+}
+
+static inline unsigned
+group_mask_leading(uint64_t mask)
+{
+   return (64 - util_last_bit64(mask)) / 8;
+}
+
+static inline unsigned
+group_mask_trailing(uint64_t mask)
+{
+   return mask ? (ffsll(mask) - 1) / 8 : 8;
+}
+
+#endif
+
+#define GROUP_WIDTH (1 << GROUP_WIDTH_LOG2)
 
 static inline bool
 key_pointer_is_reserved(const struct hash_table *ht, const void *key)
@@ -104,22 +195,58 @@ key_pointer_is_reserved(const struct hash_table *ht, const void *key)
    return key == NULL || key == ht->deleted_key;
 }
 
-static int
-entry_is_free(const struct hash_entry *entry)
+/**
+ * Split the hash into the position where probing starts, and the 7 bits
+ * stored in the control bytes. The hash is mixed first, because many hash
+ * functions used with the table only have a few good bits.
+ */
+static inline uint32_t
+hash_split(uint32_t hash, uint8_t *h2)
 {
-   return entry->key == NULL;
+   uint64_t mixed = (uint64_t) hash * 0x9e3779b97f4a7c15ull;
+
+   *h2 = (mixed >> 25) & 0x7f;
+   return mixed >> 32;
 }
 
-static int
-entry_is_deleted(const struct hash_table *ht, struct hash_entry *entry)
+static inline void
+set_ctrl(struct hash_table *ht, uint32_t index, uint8_t ctrl)
 {
-   return entry->key == ht->deleted_key;
+   ht->ctrl[index] = ctrl;
+
+   /* The first group is mirrored after the last entry so that groups can
+    * be loaded from any position without wrapping around.
+    */
+   if (index < GROUP_WIDTH)
+      ht->ctrl[ht->size + index] = ctrl;
 }
 
-static int
-entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
+/**
+ * Allocate the entries and control bytes for a table of 2^size_index
+ * entries.
+ */
+static bool
+hash_table_alloc(struct hash_table *ht, void *mem_ctx, unsigned size_index)
 {
-   return entry->key != NULL && entry->key != ht->deleted_key;
+   uint32_t size = 1u << size_index;
+   struct hash_entry *table;
+
+   table = ralloc_size(mem_ctx, size * sizeof(struct hash_entry) +
+                                size + GROUP_WIDTH);
+   if (table == NULL)
+      return false;
+
+   /* Only the control bytes need to be initialized, entries are never read
+    * unless their control byte says they are present.
+    */
+   ht->table = table;
+   ht->ctrl = (uint8_t *)(table + size);
+   ht->size_index = size_index;
+   ht->size = size;
+   ht->max_entries = size - size / 8;
+   memset(ht->ctrl, CTRL_EMPTY, size + GROUP_WIDTH);
+
+   return true;
 }
 
 bool
@@ -129,20 +256,13 @@ _mesa_hash_table_init(struct hash_table *ht,
                       bool (*key_equals_function)(const void *a,
                                                   const void *b))
 {
-   ht->size_index = 0;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->size_magic = hash_sizes[ht->size_index].size_magic;
-   ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
    ht->deleted_key = &deleted_key_value;
 
-   return ht->table != NULL;
+   return hash_table_alloc(ht, mem_ctx, GROUP_WIDTH_LOG2);
 }
 
 struct hash_table *
@@ -172,6 +292,8 @@ struct hash_table *
 _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 {
    struct hash_table *ht;
+   size_t table_size = src->size * sizeof(struct hash_entry) +
+                       src->size + GROUP_WIDTH;
 
    ht = ralloc(dst_mem_ctx, struct hash_table);
    if (ht == NULL)
@@ -179,13 +301,14 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+   ht->table = ralloc_size(ht, table_size);
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table, table_size);
+   ht->ctrl = (uint8_t *)(ht->table + ht->size);
 
    return ht;
 }
@@ -221,18 +344,17 @@ void
 _mesa_hash_table_clear(struct hash_table *ht,
                        void (*delete_function)(struct hash_entry *entry))
 {
-   struct hash_entry *entry;
-
-   for (entry = ht->table; entry != ht->table + ht->size; entry++) {
-      if (entry->key == NULL)
+   for (uint32_t i = 0; i < ht->size; i++) {
+      if (ht->ctrl[i] == CTRL_EMPTY)
          continue;
 
-      if (delete_function != NULL && entry->key != ht->deleted_key)
-         delete_function(entry);
+      if (delete_function != NULL && ctrl_is_present(ht->ctrl[i]))
+         delete_function(&ht->table[i]);
 
-      entry->key = NULL;
+      ht->table[i].key = NULL;
    }
 
+   memset(ht->ctrl, CTRL_EMPTY, ht->size + GROUP_WIDTH);
    ht->entries = 0;
    ht->deleted_entries = 0;
 }
@@ -253,32 +375,38 @@ _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
    ht->deleted_key = deleted_key;
 }
 
+/* Probing visits the groups starting at pos, pos + GROUP_WIDTH,
+ * pos + 3 * GROUP_WIDTH, pos + 6 * GROUP_WIDTH... which goes through the
+ * whole table once the stride reaches its size.
+ */
+#define hash_table_foreach_probe(ht, hash_pos, pos, stride)                 \
+   for (uint32_t pos = (hash_pos) & ((ht)->size - 1), stride = GROUP_WIDTH; \
+        stride <= (ht)->size;                                               \
+        pos = (pos + stride) & ((ht)->size - 1), stride += GROUP_WIDTH)
+
 static struct hash_entry *
 hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
 {
    assert(!key_pointer_is_reserved(ht, key));
 
-   uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
+   uint8_t h2;
+   uint32_t hash_pos = hash_split(hash, &h2);
 
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
+   hash_table_foreach_probe(ht, hash_pos, pos, stride) {
+      const uint8_t *group = ht->ctrl + pos;
+      uint64_t match = group_match(group, h2);
 
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(ht, entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+      while (match) {
+         uint32_t index = (pos + group_mask_next(&match)) & (ht->size - 1);
+         struct hash_entry *entry = ht->table + index;
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key))
             return entry;
-         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_hash_address);
+      if (likely(group_match_empty(group)))
+         return NULL;
+   }
 
    return NULL;
 }
@@ -304,66 +432,52 @@ _mesa_hash_table_search_pre_hashed(struct hash_table *ht, uint32_t hash,
    return hash_table_search(ht, hash, key);
 }
 
-static struct hash_entry *
-hash_table_insert(struct hash_table *ht, uint32_t hash,
-                  const void *key, void *data);
-
 static void
 hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
                          const void *key, void *data)
 {
-   uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
+   uint8_t h2;
+   uint32_t hash_pos = hash_split(hash, &h2);
+
+   hash_table_foreach_probe(ht, hash_pos, pos, stride) {
+      uint64_t available = group_match_empty_or_deleted(ht->ctrl + pos);
 
-      if (likely(entry->key == NULL)) {
+      if (likely(available)) {
+         uint32_t index = (pos + group_mask_next(&available)) & (ht->size - 1);
+         struct hash_entry *entry = ht->table + index;
+
+         set_ctrl(ht, index, h2);
          entry->hash = hash;
          entry->key = key;
          entry->data = data;
          return;
       }
-
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (true);
+   }
 }
 
 static void
 _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
 {
    struct hash_table old_ht;
-   struct hash_entry *table;
 
-   if (new_size_index >= ARRAY_SIZE(hash_sizes))
-      return;
-
-   table = rzalloc_array(ralloc_parent(ht->table), struct hash_entry,
-                         hash_sizes[new_size_index].size);
-   if (table == NULL)
+   if (new_size_index >= 32)
       return;
 
    old_ht = *ht;
 
-   ht->table = table;
-   ht->size_index = new_size_index;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->size_magic = hash_sizes[ht->size_index].size_magic;
-   ht->rehash_magic = hash_sizes[ht->size_index].rehash_magic;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
-   ht->entries = 0;
-   ht->deleted_entries = 0;
+   if (!hash_table_alloc(ht, ralloc_parent(old_ht.table), new_size_index)) {
+      *ht = old_ht;
+      return;
+   }
 
-   hash_table_foreach(&old_ht, entry) {
-      hash_table_insert_rehash(ht, entry->hash, entry->key, entry->data);
+   for (uint32_t i = 0; i < old_ht.size; i++) {
+      if (ctrl_is_present(old_ht.ctrl[i])) {
+         struct hash_entry *entry = &old_ht.table[i];
+         hash_table_insert_rehash(ht, entry->hash, entry->key, entry->data);
+      }
    }
 
-   ht->entries = old_ht.entries;
+   ht->deleted_entries = 0;
 
    ralloc_free(old_ht.table);
 }
@@ -372,7 +486,7 @@ static struct hash_entry *
 hash_table_insert(struct hash_table *ht, uint32_t hash,
                   const void *key, void *data)
 {
-   struct hash_entry *available_entry = NULL;
+   int64_t available_index = -1;
 
    assert(!key_pointer_is_reserved(ht, key));
 
@@ -382,21 +496,12 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
       _mesa_hash_table_rehash(ht, ht->size_index);
    }
 
-   uint32_t size = ht->size;
-   uint32_t start_hash_address = util_fast_urem32(hash, size, ht->size_magic);
-   uint32_t double_hash = 1 + util_fast_urem32(hash, ht->rehash,
-                                               ht->rehash_magic);
-   uint32_t hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-
-      if (!entry_is_present(ht, entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
-      }
+   uint8_t h2;
+   uint32_t hash_pos = hash_split(hash, &h2);
+
+   hash_table_foreach_probe(ht, hash_pos, pos, stride) {
+      const uint8_t *group = ht->ctrl + pos;
+      uint64_t match = group_match(group, h2);
 
       /* Implement replacement when another insert happens
        * with a matching key.  This is a relatively common
@@ -409,27 +514,41 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
        * required to avoid memory leaks, perform a search
        * before inserting.
        */
-      if (!entry_is_deleted(ht, entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         entry->key = key;
-         entry->data = data;
-         return entry;
+      while (match) {
+         uint32_t index = (pos + group_mask_next(&match)) & (ht->size - 1);
+         struct hash_entry *entry = ht->table + index;
+
+         if (entry->hash == hash && ht->key_equals_function(key, entry->key)) {
+            entry->key = key;
+            entry->data = data;
+            return entry;
+         }
       }
 
-      hash_address += double_hash;
-      if (hash_address >= size)
-         hash_address -= size;
-   } while (hash_address != start_hash_address);
+      /* Stash the first available entry we find */
+      if (available_index < 0) {
+         uint64_t available = group_match_empty_or_deleted(group);
+         if (available) {
+            available_index =
+               (pos + group_mask_next(&available)) & (ht->size - 1);
+         }
+      }
+
+      if (likely(group_match_empty(group)))
+         break;
+   }
 
-   if (available_entry) {
-      if (entry_is_deleted(ht, available_entry))
+   if (available_index >= 0) {
+      struct hash_entry *entry = ht->table + available_index;
+
+      if (ht->ctrl[available_index] == CTRL_DELETED)
          ht->deleted_entries--;
-      available_entry->hash = hash;
-      available_entry->key = key;
-      available_entry->data = data;
+      set_ctrl(ht, available_index, h2);
+      entry->hash = hash;
+      entry->key = key;
+      entry->data = data;
       ht->entries++;
-      return available_entry;
+      return entry;
    }
 
    /* We could hit here if a required resize failed. An unchecked-malloc
@@ -472,9 +591,24 @@ _mesa_hash_table_remove(struct hash_table *ht,
    if (!entry)
       return;
 
+   uint32_t index = entry - ht->table;
+   uint64_t empty_before =
+      group_match_empty(ht->ctrl + ((index - GROUP_WIDTH) & (ht->size - 1)));
+   uint64_t empty_after = group_match_empty(ht->ctrl + index);
+
    entry->key = ht->deleted_key;
    ht->entries--;
-   ht->deleted_entries++;
+
+   /* If every group containing the entry has an empty one, no probe ever
+    * went past it and it can be marked empty instead of deleted.
+    */
+   if (group_mask_leading(empty_before) +
+       group_mask_trailing(empty_after) < GROUP_WIDTH) {
+      set_ctrl(ht, index, CTRL_EMPTY);
+   } else {
+      set_ctrl(ht, index, CTRL_DELETED);
+      ht->deleted_entries++;
+   }
 }
 
 /**
@@ -496,15 +630,11 @@ struct hash_entry *
 _mesa_hash_table_next_entry(struct hash_table *ht,
                             struct hash_entry *entry)
 {
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
+   uint32_t i = entry == NULL ? 0 : entry - ht->table + 1;
 
-   for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry)) {
-         return entry;
-      }
+   for (; i < ht->size; i++) {
+      if (ctrl_is_present(ht->ctrl[i]))
+         return ht->table + i;
    }
 
    return NULL;
@@ -522,23 +652,17 @@ struct hash_entry *
 _mesa_hash_table_random_entry(struct hash_table *ht,
                               bool (*predicate)(struct hash_entry *entry))
 {
-   struct hash_entry *entry;
-   uint32_t i = rand() % ht->size;
+   uint32_t start = rand() % ht->size;
 
    if (ht->entries == 0)
       return NULL;
 
-   for (entry = ht->table + i; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry) &&
-          (!predicate || predicate(entry))) {
-         return entry;
-      }
-   }
+   for (uint32_t n = 0; n < ht->size; n++) {
+      uint32_t i = (start + n) & (ht->size - 1);
 
-   for (entry = ht->table; entry != ht->table + i; entry++) {
-      if (entry_is_present(ht, entry) &&
-          (!predicate || predicate(entry))) {
-         return entry;
+      if (ctrl_is_present(ht->ctrl[i]) &&
+          (!predicate || predicate(&ht->table[i]))) {
+         return &ht->table[i];
       }
    }
 
@@ -35,6 +35,7 @@ _CRTIMP int _vscprintf(const char *format, va_list argptr);
 #endif
 
 #include "ralloc.h"
+#include "debug.h"
 
 #ifndef va_copy
 #ifdef __va_copy
@@ -76,6 +77,9 @@ struct
    struct ralloc_header *next;
 
    void (*destructor)(void *);
+
+   /* The arena this block was allocated from, or is the root of. */
+   struct ralloc_arena *arena;
 };
 
 typedef struct ralloc_header ralloc_header;
@@ -83,6 +87,187 @@ typedef struct ralloc_header ralloc_header;
 static void unlink_block(ralloc_header *info);
 static void unsafe_free(ralloc_header *info);
 
+#define PTR_FROM_HEADER(info) (((char *) info) + sizeof(ralloc_header))
+
+/***************************************************************************
+ * Arenas
+ ***************************************************************************
+ *
+ * The root of an arena is a regular malloc'd block, and all of its
+ * descendants are bump-allocated out of slabs owned by the arena, with the
+ * same header as other blocks.  Large blocks and blocks that were resized
+ * get their own allocation instead, in the list of large blocks.
+ *
+ * Freeing the root only frees the slabs, unless some blocks of the tree need
+ * to be visited: blocks with a destructor and children that don't belong to
+ * the arena (malloc'd blocks, roots of other arenas, blocks of other arenas).
+ * Those are counted in num_visits, conservatively, and the whole tree is
+ * walked as usual when there are any.
+ *
+ * Blocks of the arena that were stolen out of its tree keep the slabs alive
+ * until they are freed, which is what refcount counts in addition to the
+ * root.
+ */
+
+/* Slabs stay below glibc's default mmap threshold (128K), so that the heap
+ * memory of freed arenas is reused by the next one instead of being
+ * unmapped and faulted in again.
+ */
+#define ARENA_MIN_SLAB_SIZE (16 * 1024)
+#define ARENA_MAX_SLAB_SIZE (64 * 1024)
+
+/* The alignment of ralloc_header. */
+#define ARENA_ALIGNMENT (2 * sizeof(void *))
+
+struct arena_slab {
+   struct arena_slab *next;
+   char *end;
+};
+
+struct arena_large_block {
+   struct arena_large_block *next;
+   struct arena_large_block *prev;
+};
+
+struct ralloc_arena {
+   ralloc_header *root;          /* NULL once the root is freed */
+   struct arena_slab *slabs;     /* the current slab first */
+   struct arena_large_block *large_blocks;
+   char *next;                   /* free space of the current slab */
+   char *end;
+   ralloc_header *last;          /* the block just before next */
+   size_t slab_size;             /* size of the next slab */
+   unsigned refcount;
+   unsigned num_visits;
+};
+
+static bool
+is_arena_block(const ralloc_header *info)
+{
+   return info->arena != NULL && info->arena->root != info;
+}
+
+/* Whether the block keeps its arena alive on its own. */
+static bool
+is_pinned(const ralloc_header *info)
+{
+   return is_arena_block(info) &&
+          (info->parent == NULL || info->parent->arena != info->arena);
+}
+
+/* Count blocks that don't belong to the arena of their parent. */
+static void
+update_visits(const ralloc_header *info, int delta)
+{
+   ralloc_header *parent = info->parent;
+
+   if (parent != NULL && parent->arena != NULL &&
+       parent->arena != info->arena)
+      parent->arena->num_visits += delta;
+}
+
+static void
+arena_unref(struct ralloc_arena *arena)
+{
+   assert(arena->refcount > 0);
+   if (--arena->refcount > 0)
+      return;
+
+   while (arena->slabs) {
+      struct arena_slab *slab = arena->slabs;
+      arena->slabs = slab->next;
+      free(slab);
+   }
+   while (arena->large_blocks) {
+      struct arena_large_block *large = arena->large_blocks;
+      arena->large_blocks = large->next;
+      free(large);
+   }
+   free(arena);
+}
+
+static void
+arena_link_large_block(struct ralloc_arena *arena,
+                       struct arena_large_block *large)
+{
+   large->prev = NULL;
+   large->next = arena->large_blocks;
+   if (large->next != NULL)
+      large->next->prev = large;
+   arena->large_blocks = large;
+}
+
+static ralloc_header *
+arena_alloc_large(struct ralloc_arena *arena, size_t size)
+{
+   struct arena_large_block *large = malloc(sizeof(*large) + size);
+
+   if (unlikely(large == NULL))
+      return NULL;
+
+   arena_link_large_block(arena, large);
+   return (ralloc_header *) &large[1];
+}
+
+static ralloc_header *
+arena_alloc_slow(struct ralloc_arena *arena, size_t size)
+{
+   struct arena_slab *slab;
+
+   /* Large blocks get their own allocation, so that the rest of the current
+    * slab isn't wasted.
+    */
+   if (size > arena->slab_size / 4)
+      return arena_alloc_large(arena, size);
+
+   slab = malloc(sizeof(*slab) + arena->slab_size);
+   if (unlikely(slab == NULL))
+      return NULL;
+
+   slab->end = (char *) &slab[1] + arena->slab_size;
+   slab->next = arena->slabs;
+   arena->slabs = slab;
+   arena->next = (char *) &slab[1] + size;
+   arena->end = slab->end;
+   arena->last = (ralloc_header *) &slab[1];
+   arena->slab_size = MIN2(arena->slab_size * 2, ARENA_MAX_SLAB_SIZE);
+
+   return arena->last;
+}
+
+static inline ralloc_header *
+arena_alloc(struct ralloc_arena *arena, size_t size)
+{
+   ralloc_header *info;
+
+   size = ALIGN_POT(sizeof(ralloc_header) + size, ARENA_ALIGNMENT);
+   if (unlikely(size > (size_t) (arena->end - arena->next)))
+      return arena_alloc_slow(arena, size);
+
+   info = (ralloc_header *) arena->next;
+   arena->next += size;
+   arena->last = info;
+   return info;
+}
+
+/* Return how many bytes can be read from the data of a block in a slab,
+ * which is at least its size, or 0 for large blocks.
+ */
+static size_t
+arena_block_capacity(struct ralloc_arena *arena, ralloc_header *info)
+{
+   char *ptr = (char *) info;
+
+   for (struct arena_slab *slab = arena->slabs; slab; slab = slab->next) {
+      if (ptr > (char *) slab && ptr < slab->end) {
+         char *end = slab == arena->slabs ? arena->next : slab->end;
+         return end - ptr - sizeof(ralloc_header);
+      }
+   }
+
+   return 0;
+}
+
 static ralloc_header *
 get_header(const void *ptr)
 {
@@ -92,8 +277,6 @@ get_header(const void *ptr)
    return info;
 }
 
-#define PTR_FROM_HEADER(info) (((char *) info) + sizeof(ralloc_header))
-
 static void
 add_child(ralloc_header *parent, ralloc_header *info)
 {
@@ -104,9 +287,30 @@ add_child(ralloc_header *parent, ralloc_header *info)
 
       if (info->next != NULL)
 	 info->next->prev = info;
+
+      update_visits(info, 1);
    }
 }
 
+static void
+init_block(ralloc_header *info, struct ralloc_arena *arena)
+{
+   /* measurements have shown that calloc is slower (because of
+    * the multiplication overflow checking?), so clear things
+    * manually
+    */
+   info->parent = NULL;
+   info->child = NULL;
+   info->prev = NULL;
+   info->next = NULL;
+   info->destructor = NULL;
+   info->arena = arena;
+
+#ifndef NDEBUG
+   info->canary = CANARY;
+#endif
+}
+
 void *
 ralloc_context(const void *ctx)
 {
@@ -114,33 +318,64 @@ ralloc_context(const void *ctx)
 }
 
 void *
-ralloc_size(const void *ctx, size_t size)
+ralloc_arena_context(const void *ctx)
 {
-   void *block = malloc(size + sizeof(ralloc_header));
+   static int enabled = -1;
+   struct ralloc_arena *arena;
    ralloc_header *info;
    ralloc_header *parent;
 
-   if (unlikely(block == NULL))
+   if (unlikely(enabled < 0))
+      enabled = env_var_as_boolean("MESA_RALLOC_ARENA", true);
+   if (!enabled)
+      return ralloc_context(ctx);
+
+   arena = malloc(sizeof(*arena));
+   info = malloc(sizeof(ralloc_header));
+   if (unlikely(arena == NULL || info == NULL)) {
+      free(arena);
+      free(info);
       return NULL;
+   }
 
-   info = (ralloc_header *) block;
-   /* measurements have shown that calloc is slower (because of
-    * the multiplication overflow checking?), so clear things
-    * manually
-    */
-   info->parent = NULL;
-   info->child = NULL;
-   info->prev = NULL;
-   info->next = NULL;
-   info->destructor = NULL;
+   arena->root = info;
+   arena->slabs = NULL;
+   arena->large_blocks = NULL;
+   arena->next = NULL;
+   arena->end = NULL;
+   arena->last = NULL;
+   arena->slab_size = ARENA_MIN_SLAB_SIZE;
+   arena->refcount = 1;
+   arena->num_visits = 0;
+
+   init_block(info, arena);
 
    parent = ctx != NULL ? get_header(ctx) : NULL;
 
    add_child(parent, info);
 
-#ifndef NDEBUG
-   info->canary = CANARY;
-#endif
+   return PTR_FROM_HEADER(info);
+}
+
+void *
+ralloc_size(const void *ctx, size_t size)
+{
+   ralloc_header *info;
+   ralloc_header *parent;
+
+   parent = ctx != NULL ? get_header(ctx) : NULL;
+
+   if (parent != NULL && parent->arena != NULL)
+      info = arena_alloc(parent->arena, size);
+   else
+      info = malloc(size + sizeof(ralloc_header));
+
+   if (unlikely(info == NULL))
+      return NULL;
+
+   init_block(info, parent != NULL ? parent->arena : NULL);
+
+   add_child(parent, info);
 
    return PTR_FROM_HEADER(info);
 }
@@ -156,6 +391,57 @@ rzalloc_size(const void *ctx, size_t size)
    return ptr;
 }
 
+/* helper function for arena blocks */
+static ralloc_header *
+arena_resize(ralloc_header *old, size_t size)
+{
+   struct ralloc_arena *arena = old->arena;
+   ralloc_header *info;
+   size_t capacity;
+
+   /* Grow or shrink the last block in place if it fits. */
+   if (old == arena->last) {
+      size_t full_size = ALIGN_POT(sizeof(ralloc_header) + size,
+                                   ARENA_ALIGNMENT);
+
+      if (full_size <= (size_t) (arena->end - (char *) old)) {
+         arena->next = (char *) old + full_size;
+         return old;
+      }
+   }
+
+   capacity = arena_block_capacity(arena, old);
+
+   if (capacity == 0) {
+      struct arena_large_block *large = (struct arena_large_block *) old - 1;
+      struct arena_large_block *next = large->next, *prev = large->prev;
+
+      large = realloc(large, sizeof(*large) + sizeof(ralloc_header) + size);
+      if (large == NULL)
+         return NULL;
+
+      if (prev != NULL)
+         prev->next = large;
+      else
+         arena->large_blocks = large;
+      if (next != NULL)
+         next->prev = large;
+
+      return (ralloc_header *) &large[1];
+   }
+
+   /* Blocks that are resized tend to be resized again, so move them out of
+    * the slab to avoid wasting a copy each time.  We don't know the old size,
+    * but copying more than it is harmless.
+    */
+   info = arena_alloc_large(arena, sizeof(ralloc_header) + size);
+   if (info == NULL)
+      return NULL;
+
+   memcpy(info, old, sizeof(ralloc_header) + MIN2(size, capacity));
+   return info;
+}
+
 /* helper function - assumes ptr != NULL */
 static void *
 resize(void *ptr, size_t size)
@@ -163,7 +449,16 @@ resize(void *ptr, size_t size)
    ralloc_header *child, *old, *info;
 
    old = get_header(ptr);
-   info = realloc(old, size + sizeof(ralloc_header));
+
+   if (is_arena_block(old)) {
+      info = arena_resize(old, size);
+   } else {
+      bool is_arena_root = old->arena != NULL;
+
+      info = realloc(old, size + sizeof(ralloc_header));
+      if (info != NULL && is_arena_root)
+         info->arena->root = info;
+   }
 
    if (info == NULL)
       return NULL;
@@ -253,13 +548,21 @@ void
 ralloc_free(void *ptr)
 {
    ralloc_header *info;
+   struct ralloc_arena *arena;
+   bool pinned;
 
    if (ptr == NULL)
       return;
 
    info = get_header(ptr);
+   arena = info->arena;
+   pinned = is_pinned(info);
+
    unlink_block(info);
    unsafe_free(info);
+
+   if (pinned)
+      arena_unref(arena);
 }
 
 static void
@@ -267,6 +570,8 @@ unlink_block(ralloc_header *info)
 {
    /* Unlink from parent & siblings */
    if (info->parent != NULL) {
+      update_visits(info, -1);
+
       if (info->parent->child == info)
 	 info->parent->child = info->next;
 
@@ -284,19 +589,52 @@ unlink_block(ralloc_header *info)
 static void
 unsafe_free(ralloc_header *info)
 {
+   struct ralloc_arena *arena = info->arena;
+   bool is_arena_root = arena != NULL && arena->root == info;
+
+   /* Only free the slabs of an arena if nothing else needs to be done. */
+   if (is_arena_root && arena->num_visits == 0)
+      info->child = NULL;
+
    /* Recursively free any children...don't waste time unlinking them. */
    ralloc_header *temp;
    while (info->child != NULL) {
+      struct ralloc_arena *temp_arena;
+      bool pinned;
+
       temp = info->child;
       info->child = temp->next;
+
+      temp_arena = temp->arena;
+      pinned = is_pinned(temp);
+      update_visits(temp, -1);
+
       unsafe_free(temp);
+
+      if (pinned)
+         arena_unref(temp_arena);
    }
 
    /* Free the block itself.  Call the destructor first, if any. */
    if (info->destructor != NULL)
       info->destructor(PTR_FROM_HEADER(info));
 
-   free(info);
+   if (is_arena_root) {
+      arena->root = NULL;
+      free(info);
+      arena_unref(arena);
+   } else if (arena != NULL) {
+      if (info->destructor != NULL)
+         arena->num_visits--;
+
+      /* Give the memory back if nothing was allocated since. */
+      if (info == arena->last) {
+         arena->next = (char *) info;
+         arena->last = NULL;
+      }
+   } else {
+      free(info);
+   }
 }
 
 void
@@ -310,9 +648,32 @@ ralloc_steal(const void *new_ctx, void *ptr)
    info = get_header(ptr);
    parent = new_ctx ? get_header(new_ctx) : NULL;
 
+   bool was_pinned = is_pinned(info);
+
    unlink_block(info);
 
    add_child(parent, info);
+
+   /* This never drops the last reference, the new parent holds one. */
+   if (is_pinned(info) != was_pinned)
+      info->arena->refcount += was_pinned ? -1 : 1;
+}
+
+/* Only changes the parent pointer of a block, which must be linked into the
+ * list of children of the new parent separately.
+ */
+static void
+set_parent(ralloc_header *info, ralloc_header *parent)
+{
+   bool was_pinned = is_pinned(info);
+
+   update_visits(info, -1);
+   info->parent = parent;
+   update_visits(info, 1);
+
+   /* This never drops the last reference, the new parent holds one. */
+   if (is_pinned(info) != was_pinned)
+      info->arena->refcount += was_pinned ? -1 : 1;
 }
 
 void
@@ -332,9 +693,9 @@ ralloc_adopt(const void *new_ctx, void *old_ctx)
 
    /* Set all the children's parent to new_ctx; get a pointer to the last child. */
    for (child = old_info->child; child->next != NULL; child = child->next) {
-      child->parent = new_info;
+      set_parent(child, new_info);
    }
-   child->parent = new_info;
+   set_parent(child, new_info);
 
    /* Connect the two lists together; parent them to new_ctx; make old_ctx empty. */
    child->next = new_info->child;
@@ -360,6 +721,10 @@ void
 ralloc_set_destructor(const void *ptr, void(*destructor)(void *))
 {
    ralloc_header *info = get_header(ptr);
+
+   if (is_arena_block(info))
+      info->arena->num_visits += (destructor != NULL) - (info->destructor != NULL);
+
    info->destructor = destructor;
 }
 
@@ -91,6 +91,25 @@ extern "C" {
  */
 void *ralloc_context(const void *ctx);
 
+/**
+ * Allocate a new ralloc context backed by an arena.
+ *
+ * Everything allocated out of the context or its descendants is carved out
+ * of large slabs instead of being malloc'd separately, and freeing the
+ * context releases the slabs without visiting its descendants, unless some
+ * of them have destructors or were stolen from another context.
+ *
+ * Freeing or resizing a descendant doesn't return its memory until the whole
+ * context is freed, so this is meant for short-lived contexts with many
+ * small allocations, like the temporary context of a compiler pass.
+ * Descendants can still be stolen to other contexts, at the cost of keeping
+ * all the slabs alive until they are freed.
+ *
+ * Setting MESA_RALLOC_ARENA=false makes this equivalent to ralloc_context(),
+ * which is useful with memory debugging tools.
+ */
+void *ralloc_arena_context(const void *ctx);
+
 /**
  * Allocate memory chained off of the given context.
  *
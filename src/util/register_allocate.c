@@ -76,6 +76,7 @@
 #include "main/imports.h"
 #include "main/macros.h"
 #include "util/bitset.h"
+#include "util/u_math.h"
 #include "register_allocate.h"
 
 #define NO_REG ~0U
@@ -126,7 +127,6 @@ struct ra_node {
     * List of which nodes this node interferes with.  This should be
     * symmetric with the other node.
     */
-   BITSET_WORD *adjacency;
    unsigned int *adjacency_list;
    unsigned int adjacency_list_size;
    unsigned int adjacency_count;
@@ -171,6 +171,13 @@ struct ra_graph {
 
    unsigned int alloc; /**< count of nodes allocated. */
 
+   /**
+    * Bit-set indicating, for each pair of nodes, if they interfere.  Only
+    * the lower triangle of the matrix is stored, see ra_adjacency_bit(), so
+    * that growing the graph doesn't move the existing bits.
+    */
+   BITSET_WORD *adjacency;
+
    unsigned int (*select_reg_callback)(struct ra_graph *g, BITSET_WORD *regs,
                                        void *data);
    void *select_reg_callback_data;
@@ -186,17 +193,23 @@ struct ra_graph {
       /** Bit-set indicating, for each register, if it pre-assigned */
       BITSET_WORD *reg_assigned;
 
-      /** Bit-set indicating, for each register, the value of the pq test */
-      BITSET_WORD *pq_test;
+      /**
+       * Bit-set indicating, for each node, if it passes the pq test and isn't
+       * in the stack or pre-assigned yet.
+       */
+      BITSET_WORD *pq_ready;
 
-      /** For each BITSET_WORD, the minimum q value or ~0 if unknown */
-      unsigned int *min_q_total;
+      /** Bit-set indicating, for each BITSET_WORD of pq_ready, if it's set */
+      BITSET_WORD *pq_ready_words;
 
-      /*
-       * * For each BITSET_WORD, the node with the minimum q_total if
-       * min_q_total[i] != ~0.
+      /**
+       * Binary tree of the minimum min_q_key() of the nodes not in the stack
+       * nor pre-assigned, from which we take the optimistic node.  Leaf
+       * min_q_size + i is for the nodes of BITSET_WORD i, and the root is
+       * min_q[1].
        */
-      unsigned int *min_q_node;
+      uint64_t *min_q;
+      unsigned int min_q_size;
 
       /**
        * Tracks the start of the set of optimistically-colored registers in the
@@ -417,11 +430,28 @@ ra_set_finalize(struct ra_regs *regs, unsigned int **q_values)
    }
 }
 
+/**
+ * Returns the index of the bit of g->adjacency for the interference between
+ * n1 and n2, in the lower triangle of the adjacency matrix.
+ */
+static inline uint64_t
+ra_adjacency_bit(unsigned int n1, unsigned int n2)
+{
+   uint64_t high = MAX2(n1, n2), low = MIN2(n1, n2);
+
+   assert(n1 != n2);
+   return high * (high - 1) / 2 + low;
+}
+
+static inline size_t
+ra_adjacency_words(unsigned int count)
+{
+   return BITSET_WORDS((uint64_t)count * (count - 1) / 2);
+}
+
 static void
 ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
 {
-   BITSET_SET(g->nodes[n1].adjacency, n2);
-
    assert(n1 != n2);
 
    int n1_class = g->nodes[n1].class;
@@ -443,8 +473,6 @@ ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
 static void
 ra_node_remove_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
 {
-   BITSET_CLEAR(g->nodes[n1].adjacency, n2);
-
    assert(n1 != n2);
 
    int n1_class = g->nodes[n1].class;
@@ -479,19 +507,16 @@ ra_realloc_interference_graph(struct ra_graph *g, unsigned int alloc)
 
    g->nodes = reralloc(g, g->nodes, struct ra_node, alloc);
 
-   unsigned g_bitset_count = BITSET_WORDS(g->alloc);
+   /* The bits of the nodes already in the graph stay where they are. */
+   g->adjacency = rerzalloc(g, g->adjacency, BITSET_WORD,
+                            ra_adjacency_words(g->alloc),
+                            ra_adjacency_words(alloc));
+
    unsigned bitset_count = BITSET_WORDS(alloc);
-   /* For nodes already in the graph, we just have to grow the adjacency set */
-   for (unsigned i = 0; i < g->alloc; i++) {
-      assert(g->nodes[i].adjacency != NULL);
-      g->nodes[i].adjacency = rerzalloc(g, g->nodes[i].adjacency, BITSET_WORD,
-                                        g_bitset_count, bitset_count);
-   }
 
    /* For new nodes, we have to fully initialize them */
    for (unsigned i = g->alloc; i < alloc; i++) {
       memset(&g->nodes[i], 0, sizeof(g->nodes[i]));
-      g->nodes[i].adjacency = rzalloc_array(g, BITSET_WORD, bitset_count);
       g->nodes[i].adjacency_list_size = 4;
       g->nodes[i].adjacency_list =
          ralloc_array(g, unsigned int, g->nodes[i].adjacency_list_size);
@@ -510,11 +535,11 @@ ra_realloc_interference_graph(struct ra_graph *g, unsigned int alloc)
 
    g->tmp.reg_assigned = reralloc(g, g->tmp.reg_assigned, BITSET_WORD,
                                   bitset_count);
-   g->tmp.pq_test = reralloc(g, g->tmp.pq_test, BITSET_WORD, bitset_count);
-   g->tmp.min_q_total = reralloc(g, g->tmp.min_q_total, unsigned int,
-                                 bitset_count);
-   g->tmp.min_q_node = reralloc(g, g->tmp.min_q_node, unsigned int,
-                                bitset_count);
+   g->tmp.pq_ready = reralloc(g, g->tmp.pq_ready, BITSET_WORD, bitset_count);
+   g->tmp.pq_ready_words = reralloc(g, g->tmp.pq_ready_words, BITSET_WORD,
+                                    BITSET_WORDS(bitset_count));
+   g->tmp.min_q = reralloc(g, g->tmp.min_q, uint64_t,
+                           2 * util_next_power_of_two(bitset_count));
 
    g->alloc = alloc;
 }
@@ -537,7 +562,7 @@ ra_resize_interference_graph(struct ra_graph *g, unsigned int count)
 {
    g->count = count;
    if (count > g->alloc)
-      ra_realloc_interference_graph(g, g->alloc * 2);
+      ra_realloc_interference_graph(g, MAX2(g->alloc * 2, count));
 }
 
 void ra_set_select_reg_callback(struct ra_graph *g,
@@ -580,7 +605,12 @@ ra_add_node_interference(struct ra_graph *g,
                          unsigned int n1, unsigned int n2)
 {
    assert(n1 < g->count && n2 < g->count);
-   if (n1 != n2 && !BITSET_TEST(g->nodes[n1].adjacency, n2)) {
+   if (n1 == n2)
+      return;
+
+   uint64_t bit = ra_adjacency_bit(n1, n2);
+   if (!BITSET_TEST(g->adjacency, bit)) {
+      BITSET_SET(g->adjacency, bit);
       ra_add_node_adjacency(g, n1, n2);
       ra_add_node_adjacency(g, n2, n1);
    }
@@ -589,35 +619,109 @@ ra_add_node_interference(struct ra_graph *g,
 void
 ra_reset_node_interference(struct ra_graph *g, unsigned int n)
 {
-   for (unsigned int i = 0; i < g->nodes[n].adjacency_count; i++)
-      ra_node_remove_adjacency(g, g->nodes[n].adjacency_list[i], n);
+   for (unsigned int i = 0; i < g->nodes[n].adjacency_count; i++) {
+      unsigned int n2 = g->nodes[n].adjacency_list[i];
+
+      BITSET_CLEAR(g->adjacency, ra_adjacency_bit(n, n2));
+      ra_node_remove_adjacency(g, n2, n);
+   }
 
-   memset(g->nodes[n].adjacency, 0,
-          BITSET_WORDS(g->count) * sizeof(BITSET_WORD));
    g->nodes[n].adjacency_count = 0;
 }
 
+/**
+ * Returns the key of node n in g->tmp.min_q.  The optimistic node is the one
+ * with the lowest q_total, and in order to remain consistent with the old
+ * naive implementation of the algorithm, the highest node index among those.
+ */
+static inline uint64_t
+min_q_key(struct ra_graph *g, unsigned int n)
+{
+   return ((uint64_t)g->nodes[n].tmp.q_total << 32) | ~n;
+}
+
+static inline unsigned int
+min_q_key_node(uint64_t key)
+{
+   return ~(unsigned int)key;
+}
+
+/**
+ * Recomputes the leaf of g->tmp.min_q for BITSET_WORD i of the nodes, and
+ * its parents if update_parents is set.
+ */
+static void
+update_min_q_word(struct ra_graph *g, unsigned int i, bool update_parents)
+{
+   BITSET_WORD nodes = ~(g->tmp.in_stack[i] | g->tmp.reg_assigned[i]);
+   uint64_t key = UINT64_MAX;
+
+   if (i == BITSET_WORDS(g->count) - 1 && g->count % BITSET_WORDBITS)
+      nodes &= BITSET_MASK(g->count % BITSET_WORDBITS);
+
+   while (nodes) {
+      unsigned int n = i * BITSET_WORDBITS + u_bit_scan(&nodes);
+      key = MIN2(key, min_q_key(g, n));
+   }
+
+   unsigned int k = g->tmp.min_q_size + i;
+   g->tmp.min_q[k] = key;
+
+   if (update_parents) {
+      for (k /= 2; k > 0; k /= 2)
+         g->tmp.min_q[k] = MIN2(g->tmp.min_q[2 * k], g->tmp.min_q[2 * k + 1]);
+   }
+}
+
 static void
 update_pq_info(struct ra_graph *g, unsigned int n)
 {
-   int i = n / BITSET_WORDBITS;
    int n_class = g->nodes[n].class;
    if (g->nodes[n].tmp.q_total < g->regs->classes[n_class]->p) {
-      BITSET_SET(g->tmp.pq_test, n);
-   } else if (g->tmp.min_q_total[i] != UINT_MAX) {
-      /* Only update min_q_total and min_q_node if min_q_total != UINT_MAX so
-       * that we don't update while we have stale data and accidentally mark
-       * it as non-stale.  Also, in order to remain consistent with the old
-       * naive implementation of the algorithm, we do a lexicographical sort
-       * to ensure that we always choose the node with the highest node index.
-       */
-      if (g->nodes[n].tmp.q_total < g->tmp.min_q_total[i] ||
-          (g->nodes[n].tmp.q_total == g->tmp.min_q_total[i] &&
-           n > g->tmp.min_q_node[i])) {
-         g->tmp.min_q_total[i] = g->nodes[n].tmp.q_total;
-         g->tmp.min_q_node[i] = n;
+      BITSET_SET(g->tmp.pq_ready, n);
+      BITSET_SET(g->tmp.pq_ready_words, n / BITSET_WORDBITS);
+   } else {
+      /* q_total only goes down, so this can only lower the minimums. */
+      uint64_t key = min_q_key(g, n);
+      for (unsigned int k = g->tmp.min_q_size + n / BITSET_WORDBITS;
+           k > 0 && key < g->tmp.min_q[k]; k /= 2)
+         g->tmp.min_q[k] = key;
+   }
+}
+
+/**
+ * Returns the highest node below limit which passes the pq test and isn't in
+ * the stack yet, or UINT_MAX if there is none.
+ */
+static unsigned int
+find_pq_ready_node(struct ra_graph *g, unsigned int limit)
+{
+   if (limit == 0)
+      return UINT_MAX;
+
+   int i = (limit - 1) / BITSET_WORDBITS;
+   BITSET_WORD ready = g->tmp.pq_ready[i] &
+                       BITSET_MASK((limit - 1) % BITSET_WORDBITS + 1);
+
+   while (!ready && i > 0) {
+      i--;
+
+      /* Skip the empty words using pq_ready_words. */
+      BITSET_WORD words = g->tmp.pq_ready_words[i / BITSET_WORDBITS] &
+                          BITSET_MASK(i % BITSET_WORDBITS + 1);
+      if (!words) {
+         i -= i % BITSET_WORDBITS;
+         continue;
       }
+
+      i = i - i % BITSET_WORDBITS + util_last_bit(words) - 1;
+      ready = g->tmp.pq_ready[i];
    }
+
+   if (!ready)
+      return UINT_MAX;
+
+   return i * BITSET_WORDBITS + util_last_bit(ready) - 1;
 }
 
 static void
@@ -644,8 +748,14 @@ add_node_to_stack(struct ra_graph *g, unsigned int n)
    g->tmp.stack_count++;
    BITSET_SET(g->tmp.in_stack, n);
 
-   /* Flag the min_q_total for n's block as dirty so it gets recalculated */
-   g->tmp.min_q_total[n / BITSET_WORDBITS] = UINT_MAX;
+   i = n / BITSET_WORDBITS;
+   BITSET_CLEAR(g->tmp.pq_ready, n);
+   if (!g->tmp.pq_ready[i])
+      BITSET_CLEAR(g->tmp.pq_ready_words, i);
+
+   /* If n was the minimum of its word, find the new one. */
+   if (min_q_key_node(g->tmp.min_q[g->tmp.min_q_size + i]) == n)
+      update_min_q_word(g, i, true);
 }
 
 /**
@@ -657,110 +767,86 @@ add_node_to_stack(struct ra_graph *g, unsigned int n)
  * we optimistically choose a node and push it on the stack. We heuristically
  * push the node with the lowest total q value, since it has the fewest
  * neighbors and therefore is most likely to be allocated.
+ *
+ * The trivially-colorable nodes are pushed in sweeps from the highest node
+ * to the lowest one, and a node which becomes trivially colorable during a
+ * sweep is only picked up by it if it's below the last pushed node.
  */
 static void
 ra_simplify(struct ra_graph *g)
 {
-   bool progress = true;
    unsigned int stack_optimistic_start = UINT_MAX;
-
-   /* Figure out the high bit and bit mask for the first iteration of a loop
-    * over BITSET_WORDs.
-    */
-   const unsigned int top_word_high_bit = (g->count - 1) % BITSET_WORDBITS;
+   unsigned int num_words = BITSET_WORDS(g->count);
 
    /* Do a quick pre-pass to set things up */
    g->tmp.stack_count = 0;
-   for (int i = BITSET_WORDS(g->count) - 1, high_bit = top_word_high_bit;
-        i >= 0; i--, high_bit = BITSET_WORDBITS - 1) {
-      g->tmp.in_stack[i] = 0;
-      g->tmp.reg_assigned[i] = 0;
-      g->tmp.pq_test[i] = 0;
-      g->tmp.min_q_total[i] = UINT_MAX;
-      g->tmp.min_q_node[i] = UINT_MAX;
-      for (int j = high_bit; j >= 0; j--) {
-         unsigned int n = i * BITSET_WORDBITS + j;
-         g->nodes[n].reg = g->nodes[n].forced_reg;
-         g->nodes[n].tmp.q_total = g->nodes[n].q_total;
-         if (g->nodes[n].reg != NO_REG)
-            g->tmp.reg_assigned[i] |= BITSET_BIT(j);
+   g->tmp.stack_optimistic_start = UINT_MAX;
+   if (g->count == 0)
+      return;
+
+   memset(g->tmp.in_stack, 0, num_words * sizeof(BITSET_WORD));
+   memset(g->tmp.reg_assigned, 0, num_words * sizeof(BITSET_WORD));
+   memset(g->tmp.pq_ready, 0, num_words * sizeof(BITSET_WORD));
+   memset(g->tmp.pq_ready_words, 0,
+          BITSET_WORDS(num_words) * sizeof(BITSET_WORD));
+
+   g->tmp.min_q_size = util_next_power_of_two(MAX2(num_words, 1));
+   for (unsigned int k = 1; k < 2 * g->tmp.min_q_size; k++)
+      g->tmp.min_q[k] = UINT64_MAX;
+
+   for (unsigned int n = 0; n < g->count; n++) {
+      g->nodes[n].reg = g->nodes[n].forced_reg;
+      g->nodes[n].tmp.q_total = g->nodes[n].q_total;
+      if (g->nodes[n].reg != NO_REG)
+         BITSET_SET(g->tmp.reg_assigned, n);
+      else
          update_pq_info(g, n);
-      }
    }
 
-   while (progress) {
-      unsigned int min_q_total = UINT_MAX;
-      unsigned int min_q_node = UINT_MAX;
+   for (unsigned int i = 0; i < num_words; i++)
+      update_min_q_word(g, i, false);
+   for (unsigned int k = g->tmp.min_q_size - 1; k > 0; k--)
+      g->tmp.min_q[k] = MIN2(g->tmp.min_q[2 * k], g->tmp.min_q[2 * k + 1]);
 
-      progress = false;
+   unsigned int limit = g->count;
+   bool progress = false;
 
-      for (int i = BITSET_WORDS(g->count) - 1, high_bit = top_word_high_bit;
-           i >= 0; i--, high_bit = BITSET_WORDBITS - 1) {
-         BITSET_WORD mask = ~(BITSET_WORD)0 >> (31 - high_bit);
-
-         BITSET_WORD skip = g->tmp.in_stack[i] | g->tmp.reg_assigned[i];
-         if (skip == mask)
-            continue;
-
-         BITSET_WORD pq = g->tmp.pq_test[i] & ~skip;
-         if (pq) {
-            /* In this case, we have stuff we can immediately take off the
-             * stack.  This also means that we're guaranteed to make progress
-             * and we don't need to bother updating lowest_q_total because we
-             * know we're going to loop again before attempting to do anything
-             * optimistic.
-             */
-            for (int j = high_bit; j >= 0; j--) {
-               if (pq & BITSET_BIT(j)) {
-                  unsigned int n = i * BITSET_WORDBITS + j;
-                  assert(n < g->count);
-                  add_node_to_stack(g, n);
-                  /* add_node_to_stack() may update pq_test for this word so
-                   * we need to update our local copy.
-                   */
-                  pq = g->tmp.pq_test[i] & ~skip;
-                  progress = true;
-               }
-            }
-         } else if (!progress) {
-            if (g->tmp.min_q_total[i] == UINT_MAX) {
-               /* The min_q_total and min_q_node are dirty because we added
-                * one of these nodes to the stack.  It needs to be
-                * recalculated.
-                */
-               for (int j = high_bit; j >= 0; j--) {
-                  if (skip & BITSET_BIT(j))
-                     continue;
-
-                  unsigned int n = i * BITSET_WORDBITS + j;
-                  assert(n < g->count);
-                  if (g->nodes[n].tmp.q_total < g->tmp.min_q_total[i]) {
-                     g->tmp.min_q_total[i] = g->nodes[n].tmp.q_total;
-                     g->tmp.min_q_node[i] = n;
-                  }
-               }
-            }
-            if (g->tmp.min_q_total[i] < min_q_total) {
-               min_q_node = g->tmp.min_q_node[i];
-               min_q_total = g->tmp.min_q_total[i];
-            }
-         }
+   while (true) {
+      unsigned int n = find_pq_ready_node(g, limit);
+
+      if (n != UINT_MAX) {
+         add_node_to_stack(g, n);
+         limit = n;
+         progress = true;
+         continue;
       }
 
-      if (!progress && min_q_total != UINT_MAX) {
+      /* This sweep is done.  If it didn't push anything, push the node with
+       * the lowest q_total before starting the next one.
+       */
+      if (!progress) {
+         if (g->tmp.min_q[1] == UINT64_MAX)
+            break;
+
          if (stack_optimistic_start == UINT_MAX)
             stack_optimistic_start = g->tmp.stack_count;
 
-         add_node_to_stack(g, min_q_node);
-         progress = true;
+         add_node_to_stack(g, min_q_key_node(g->tmp.min_q[1]));
       }
+
+      limit = g->count;
+      progress = false;
    }
 
    g->tmp.stack_optimistic_start = stack_optimistic_start;
 }
 
-static bool
-ra_any_neighbors_conflict(struct ra_graph *g, unsigned int n, unsigned int r)
+/**
+ * Returns a neighbor of n which is already colored with a register
+ * conflicting with r, or NO_REG if there is none.
+ */
+static unsigned int
+ra_find_conflicting_neighbor(struct ra_graph *g, unsigned int n, unsigned int r)
 {
    unsigned int i;
 
@@ -769,11 +855,11 @@ ra_any_neighbors_conflict(struct ra_graph *g, unsigned int n, unsigned int r)
 
       if (!BITSET_TEST(g->tmp.in_stack, n2) &&
           BITSET_TEST(g->regs->regs[r].conflicts, g->nodes[n2].reg)) {
-         return true;
+         return n2;
       }
    }
 
-   return false;
+   return NO_REG;
 }
 
 /* Computes a bitfield of what regs are available for a given register
@@ -849,12 +935,22 @@ ra_select(struct ra_graph *g)
          /* Find the lowest-numbered reg which is not used by a member
           * of the graph adjacent to us.
           */
+         unsigned int conflicting = NO_REG;
          for (ri = 0; ri < g->regs->count; ri++) {
             r = (start_search_reg + ri) % g->regs->count;
             if (!reg_belongs_to_class(r, c))
                continue;
 
-            if (!ra_any_neighbors_conflict(g, n, r))
+            /* The neighbor which ruled out the previous register usually
+             * rules out the next ones too, so try it before the others.
+             */
+            if (conflicting != NO_REG &&
+                BITSET_TEST(g->regs->regs[r].conflicts,
+                            g->nodes[conflicting].reg))
+               continue;
+
+            conflicting = ra_find_conflicting_neighbor(g, n, r);
+            if (conflicting == NO_REG)
                break;
          }
 
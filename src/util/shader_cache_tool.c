@@ -0,0 +1,507 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Offline maintenance of on-disk shader caches, e.g. to prepare prebuilt
+ * caches to be used with MESA_GLSL_CACHE_READ_ONLY_DIRS.
+ *
+ * Cache directories are given the same way as with MESA_GLSL_CACHE_DIR, the
+ * cache itself being in their mesa_shader_cache subdirectory. Both the
+ * one-file-per-entry and the pack layouts are handled.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "util/disk_cache.h"
+#include "util/disk_cache_pack.h"
+#include "util/mesa-sha1.h"
+
+typedef void (*entry_cb)(void *data, const cache_key key,
+                         const char *filename, uint8_t *entry, size_t size);
+
+struct cache_dir {
+   /* <dir>/mesa_shader_cache */
+   char *path;
+   struct disk_cache_pack *pack;
+};
+
+struct stats {
+   unsigned valid;
+   unsigned invalid;
+   unsigned duplicate;
+};
+
+static void
+usage(void)
+{
+   fprintf(stderr,
+           "Usage: shader_cache_tool validate [--remove] DIR...\n"
+           "       shader_cache_tool merge [--pack] DEST SOURCE...\n"
+           "\n"
+           "validate  Check every entry of the caches in the given\n"
+           "          directories, and report the damaged ones.\n"
+           "          --remove  delete the damaged entries\n"
+           "\n"
+           "merge     Copy the valid entries of the SOURCE caches to the\n"
+           "          cache in DEST, which is created as needed.\n"
+           "          --pack    use the single-file pack layout for DEST\n"
+           "\n"
+           "Note that merging doesn't update the size accounting of a\n"
+           "one-file-per-entry cache, so DEST should only be used as a\n"
+           "read-only cache.\n");
+}
+
+static int
+hex_value(char c)
+{
+   if (c >= '0' && c <= '9')
+      return c - '0';
+   if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+   return -1;
+}
+
+/* Parse the key of a cache file from its hexadecimal name, split between
+ * the two-character subdirectory and the file.
+ */
+static bool
+parse_key(const char *dir_name, const char *file_name, cache_key key)
+{
+   char hex[2 * CACHE_KEY_SIZE];
+
+   if (strlen(dir_name) != 2 || strlen(file_name) != sizeof(hex) - 2)
+      return false;
+
+   memcpy(hex, dir_name, 2);
+   memcpy(hex + 2, file_name, sizeof(hex) - 2);
+
+   for (unsigned i = 0; i < CACHE_KEY_SIZE; i++) {
+      int hi = hex_value(hex[2 * i]);
+      int lo = hex_value(hex[2 * i + 1]);
+
+      if (hi < 0 || lo < 0)
+         return false;
+      key[i] = hi << 4 | lo;
+   }
+
+   return true;
+}
+
+static uint8_t *
+read_file(const char *filename, size_t *size)
+{
+   struct stat sb;
+   uint8_t *data = NULL;
+   size_t done = 0;
+   int fd;
+
+   fd = open(filename, O_RDONLY | O_CLOEXEC);
+   if (fd == -1)
+      return NULL;
+
+   if (fstat(fd, &sb) == -1)
+      goto fail;
+
+   data = malloc(sb.st_size);
+   if (data == NULL)
+      goto fail;
+
+   while (done < sb.st_size) {
+      ssize_t ret = read(fd, data + done, sb.st_size - done);
+      if (ret <= 0) {
+         free(data);
+         data = NULL;
+         goto fail;
+      }
+      done += ret;
+   }
+
+   *size = sb.st_size;
+
+ fail:
+   close(fd);
+   return data;
+}
+
+static bool
+write_file(const char *filename, const uint8_t *data, size_t size)
+{
+   char *filename_tmp;
+   size_t done = 0;
+   int fd;
+
+   /* Write to a temporary file and rename it, so that processes using the
+    * cache never see a partially written entry.
+    */
+   if (asprintf(&filename_tmp, "%s.tmp", filename) == -1)
+      return false;
+
+   fd = open(filename_tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd == -1) {
+      free(filename_tmp);
+      return false;
+   }
+
+   while (done < size) {
+      ssize_t ret = write(fd, data + done, size - done);
+      if (ret == -1)
+         break;
+      done += ret;
+   }
+   close(fd);
+
+   bool ok = done == size && rename(filename_tmp, filename) == 0;
+   if (!ok)
+      unlink(filename_tmp);
+
+   free(filename_tmp);
+   return ok;
+}
+
+static bool
+open_cache_dir(struct cache_dir *dir, const char *path, bool create,
+               bool pack, bool writable)
+{
+   struct stat sb;
+
+   if (create) {
+      mkdir(path, 0755);
+   }
+
+   if (asprintf(&dir->path, "%s/%s", path, CACHE_DIR_NAME) == -1)
+      return false;
+
+   if (create)
+      mkdir(dir->path, 0755);
+
+   if (stat(dir->path, &sb) != 0 || !S_ISDIR(sb.st_mode)) {
+      fprintf(stderr, "%s: no shader cache found\n", path);
+      free(dir->path);
+      return false;
+   }
+
+   /* Don't create a pack where there was none, unless asked to. */
+   dir->pack = NULL;
+   if (pack) {
+      dir->pack = disk_cache_pack_open(dir->path, UINT64_MAX);
+      if (dir->pack == NULL) {
+         fprintf(stderr, "%s: failed to open the pack\n", path);
+         free(dir->path);
+         return false;
+      }
+   } else if (writable) {
+      char *index_path;
+
+      if (asprintf(&index_path, "%s/%s", dir->path,
+                   DISK_CACHE_PACK_INDEX_NAME) != -1) {
+         if (access(index_path, F_OK) == 0)
+            dir->pack = disk_cache_pack_open(dir->path, UINT64_MAX);
+         free(index_path);
+      }
+   } else {
+      dir->pack = disk_cache_pack_open_read_only(dir->path);
+   }
+
+   return true;
+}
+
+static void
+close_cache_dir(struct cache_dir *dir)
+{
+   if (dir->pack)
+      disk_cache_pack_close(dir->pack);
+   free(dir->path);
+}
+
+struct pack_foreach_state {
+   struct disk_cache_pack *pack;
+   entry_cb cb;
+   void *data;
+};
+
+static void
+pack_foreach_cb(void *data, const cache_key key)
+{
+   struct pack_foreach_state *state = data;
+   size_t size = 0;
+
+   uint8_t *entry = disk_cache_pack_read(state->pack, key, &size);
+   state->cb(state->data, key, NULL, entry, size);
+   free(entry);
+}
+
+/* Call 'cb' for every entry in the cache. 'entry' is NULL for entries which
+ * can't be read.
+ */
+static void
+foreach_entry(struct cache_dir *dir, entry_cb cb, void *data)
+{
+   DIR *top, *sub;
+   struct dirent *d, *e;
+
+   if (dir->pack) {
+      struct pack_foreach_state state = { dir->pack, cb, data };
+      disk_cache_pack_foreach(dir->pack, pack_foreach_cb, &state);
+   }
+
+   top = opendir(dir->path);
+   if (top == NULL)
+      return;
+
+   while ((d = readdir(top)) != NULL) {
+      char *sub_path;
+
+      if (strlen(d->d_name) != 2 || strcmp(d->d_name, "..") == 0)
+         continue;
+
+      if (asprintf(&sub_path, "%s/%s", dir->path, d->d_name) == -1)
+         continue;
+
+      sub = opendir(sub_path);
+      if (sub == NULL) {
+         free(sub_path);
+         continue;
+      }
+
+      while ((e = readdir(sub)) != NULL) {
+         cache_key key;
+         char *filename;
+         size_t size = 0;
+
+         if (!parse_key(d->d_name, e->d_name, key))
+            continue;
+
+         if (asprintf(&filename, "%s/%s", sub_path, e->d_name) == -1)
+            continue;
+
+         uint8_t *entry = read_file(filename, &size);
+         cb(data, key, filename, entry, size);
+
+         free(entry);
+         free(filename);
+      }
+
+      closedir(sub);
+      free(sub_path);
+   }
+
+   closedir(top);
+}
+
+struct validate_state {
+   struct cache_dir *dir;
+   bool remove;
+   struct stats stats;
+};
+
+static void
+validate_cb(void *data, const cache_key key, const char *filename,
+            uint8_t *entry, size_t size)
+{
+   struct validate_state *state = data;
+   char hex[41];
+
+   if (entry && disk_cache_entry_is_valid(entry, size)) {
+      state->stats.valid++;
+      return;
+   }
+
+   state->stats.invalid++;
+
+   _mesa_sha1_format(hex, key);
+   printf("%s: %s: damaged%s\n", state->dir->path, hex,
+          state->remove ? ", removed" : "");
+
+   if (state->remove) {
+      if (filename)
+         unlink(filename);
+      else
+         disk_cache_pack_remove(state->dir->pack, key);
+   }
+}
+
+static int
+validate(int argc, char **argv)
+{
+   bool remove = false;
+   bool damaged = false;
+   int i = 0;
+
+   if (i < argc && strcmp(argv[i], "--remove") == 0) {
+      remove = true;
+      i++;
+   }
+
+   if (i == argc) {
+      usage();
+      return 1;
+   }
+
+   for (; i < argc; i++) {
+      struct validate_state state = { .remove = remove };
+      struct cache_dir dir;
+
+      if (!open_cache_dir(&dir, argv[i], false, false, remove))
+         return 1;
+
+      state.dir = &dir;
+      foreach_entry(&dir, validate_cb, &state);
+
+      printf("%s: %u valid entries, %u damaged\n", argv[i],
+             state.stats.valid, state.stats.invalid);
+
+      if (state.stats.invalid && !remove)
+         damaged = true;
+
+      close_cache_dir(&dir);
+   }
+
+   return damaged ? 1 : 0;
+}
+
+struct merge_state {
+   struct cache_dir *dest;
+   struct stats stats;
+};
+
+static void
+merge_cb(void *data, const cache_key key, const char *filename,
+         uint8_t *entry, size_t size)
+{
+   struct merge_state *state = data;
+   struct cache_dir *dest = state->dest;
+
+   if (entry == NULL || !disk_cache_entry_is_valid(entry, size)) {
+      state->stats.invalid++;
+      return;
+   }
+
+   if (dest->pack) {
+      size_t existing_size;
+      void *existing = disk_cache_pack_read(dest->pack, key, &existing_size);
+      if (existing) {
+         free(existing);
+         state->stats.duplicate++;
+         return;
+      }
+
+      void *copy = malloc(size);
+      if (copy == NULL)
+         return;
+
+      memcpy(copy, entry, size);
+      disk_cache_pack_queue(dest->pack, key, copy, size);
+      state->stats.valid++;
+   } else {
+      char hex[41], *dest_filename;
+
+      _mesa_sha1_format(hex, key);
+      if (asprintf(&dest_filename, "%s/%c%c", dest->path, hex[0],
+                   hex[1]) == -1)
+         return;
+      mkdir(dest_filename, 0755);
+      free(dest_filename);
+
+      if (asprintf(&dest_filename, "%s/%c%c/%s", dest->path, hex[0], hex[1],
+                   hex + 2) == -1)
+         return;
+
+      if (access(dest_filename, F_OK) == 0)
+         state->stats.duplicate++;
+      else if (write_file(dest_filename, entry, size))
+         state->stats.valid++;
+      else
+         fprintf(stderr, "%s: %s\n", dest_filename, strerror(errno));
+
+      free(dest_filename);
+   }
+}
+
+static int
+merge(int argc, char **argv)
+{
+   struct merge_state state = { 0 };
+   struct cache_dir dest;
+   bool pack = false;
+   int i = 0;
+
+   if (i < argc && strcmp(argv[i], "--pack") == 0) {
+      pack = true;
+      i++;
+   }
+
+   if (argc - i < 2) {
+      usage();
+      return 1;
+   }
+
+   if (!open_cache_dir(&dest, argv[i++], true, pack, true))
+      return 1;
+
+   state.dest = &dest;
+
+   for (; i < argc; i++) {
+      struct cache_dir src;
+
+      if (!open_cache_dir(&src, argv[i], false, false, false))
+         continue;
+
+      foreach_entry(&src, merge_cb, &state);
+      close_cache_dir(&src);
+   }
+
+   /* Closing the pack writes out the last batch. */
+   close_cache_dir(&dest);
+
+   printf("%u entries merged, %u already present, %u damaged ones skipped\n",
+          state.stats.valid, state.stats.duplicate, state.stats.invalid);
+
+   return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+   if (argc < 2) {
+      usage();
+      return 1;
+   }
+
+   if (strcmp(argv[1], "validate") == 0)
+      return validate(argc - 2, argv + 2);
+
+   if (strcmp(argv[1], "merge") == 0)
+      return merge(argc - 2, argv + 2);
+
+   usage();
+   return 1;
+}
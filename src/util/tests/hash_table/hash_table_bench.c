@@ -0,0 +1,230 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Measures insertions and lookups with pointer keys, the way NIR passes use
+ * hash tables to remap instructions and deduplicate them.
+ *
+ * The group-probed hash_table is compared with set, which still uses the
+ * double-hashing probe hash_table used to have, with one entry read per
+ * probe.
+ *
+ * Usage: hash_table_bench [operations per measurement]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "hash_table.h"
+#include "set.h"
+#include "os_time.h"
+#include "macros.h"
+
+/* Stand-in for an IR instruction. */
+struct object {
+   uint8_t payload[64];
+};
+
+enum op {
+   OP_INSERT,
+   OP_LOOKUP_HIT,
+   OP_LOOKUP_MISS,
+   OP_REMOVE_INSERT,
+   NUM_OPS,
+};
+
+static const char *op_names[] = {
+   "insert",
+   "lookup hit",
+   "lookup miss",
+   "remove+insert",
+};
+
+static void
+shuffle(struct object **keys, unsigned num_keys)
+{
+   for (unsigned i = num_keys - 1; i > 0; i--) {
+      unsigned j = rand() % (i + 1);
+      struct object *tmp = keys[i];
+      keys[i] = keys[j];
+      keys[j] = tmp;
+   }
+}
+
+/* Returns the time per operation in nanoseconds. The keys in [0, num_keys)
+ * are used for the table and the following num_keys ones for misses.
+ */
+static double
+bench_hash_table(enum op op, struct object **keys, unsigned num_keys,
+                 unsigned num_ops)
+{
+   unsigned rounds = MAX2(num_ops / num_keys, 1);
+   struct hash_table *ht = NULL;
+   uintptr_t found = 0;
+   int64_t time = 0;
+
+   for (unsigned r = 0; r < rounds; r++) {
+      if (op == OP_INSERT || r == 0) {
+         _mesa_hash_table_destroy(ht, NULL);
+         ht = _mesa_pointer_hash_table_create(NULL);
+
+         if (op != OP_INSERT) {
+            for (unsigned i = 0; i < num_keys; i++)
+               _mesa_hash_table_insert(ht, keys[i], keys[i]);
+         }
+      }
+
+      int64_t start = os_time_get_nano();
+
+      switch (op) {
+      case OP_INSERT:
+         for (unsigned i = 0; i < num_keys; i++)
+            _mesa_hash_table_insert(ht, keys[i], keys[i]);
+         break;
+      case OP_LOOKUP_HIT:
+         for (unsigned i = 0; i < num_keys; i++)
+            found += (uintptr_t) _mesa_hash_table_search(ht, keys[i]);
+         break;
+      case OP_LOOKUP_MISS:
+         for (unsigned i = 0; i < num_keys; i++)
+            found += (uintptr_t) _mesa_hash_table_search(ht, keys[num_keys + i]);
+         break;
+      case OP_REMOVE_INSERT:
+         for (unsigned i = 0; i < num_keys; i++) {
+            _mesa_hash_table_remove_key(ht, keys[i]);
+            _mesa_hash_table_insert(ht, keys[i], keys[i]);
+         }
+         break;
+      default:
+         unreachable("bad op");
+      }
+
+      time += os_time_get_nano() - start;
+   }
+
+   _mesa_hash_table_destroy(ht, NULL);
+
+   /* Keep the lookups from being optimized out. */
+   if (found == 1)
+      printf("unexpected\n");
+
+   return (double) time / (rounds * num_keys);
+}
+
+static double
+bench_set(enum op op, struct object **keys, unsigned num_keys,
+          unsigned num_ops)
+{
+   unsigned rounds = MAX2(num_ops / num_keys, 1);
+   struct set *set = NULL;
+   uintptr_t found = 0;
+   int64_t time = 0;
+
+   for (unsigned r = 0; r < rounds; r++) {
+      if (op == OP_INSERT || r == 0) {
+         _mesa_set_destroy(set, NULL);
+         set = _mesa_pointer_set_create(NULL);
+
+         if (op != OP_INSERT) {
+            for (unsigned i = 0; i < num_keys; i++)
+               _mesa_set_add(set, keys[i]);
+         }
+      }
+
+      int64_t start = os_time_get_nano();
+
+      switch (op) {
+      case OP_INSERT:
+         for (unsigned i = 0; i < num_keys; i++)
+            _mesa_set_add(set, keys[i]);
+         break;
+      case OP_LOOKUP_HIT:
+         for (unsigned i = 0; i < num_keys; i++)
+            found += (uintptr_t) _mesa_set_search(set, keys[i]);
+         break;
+      case OP_LOOKUP_MISS:
+         for (unsigned i = 0; i < num_keys; i++)
+            found += (uintptr_t) _mesa_set_search(set, keys[num_keys + i]);
+         break;
+      case OP_REMOVE_INSERT:
+         for (unsigned i = 0; i < num_keys; i++) {
+            _mesa_set_remove_key(set, keys[i]);
+            _mesa_set_add(set, keys[i]);
+         }
+         break;
+      default:
+         unreachable("bad op");
+      }
+
+      time += os_time_get_nano() - start;
+   }
+
+   _mesa_set_destroy(set, NULL);
+
+   if (found == 1)
+      printf("unexpected\n");
+
+   return (double) time / (rounds * num_keys);
+}
+
+int
+main(int argc, char **argv)
+{
+   /* Not powers of two: set rehashes on every remove+insert when it is
+    * filled up to exactly its maximum number of entries.
+    */
+   static const unsigned sizes[] = { 10, 100, 1000, 10000, 100000, 1000000 };
+   unsigned num_ops = argc > 1 ? atoi(argv[1]) : 4000000;
+   unsigned max_keys = sizes[ARRAY_SIZE(sizes) - 1];
+
+   if (num_ops == 0)
+      return 1;
+
+   struct object *objects = calloc(2 * max_keys, sizeof(struct object));
+   struct object **keys = malloc(2 * max_keys * sizeof(struct object *));
+
+   printf("ns per operation, %u operations per measurement\n", num_ops);
+   printf("%-14s %8s %12s %12s %8s\n",
+          "operation", "entries", "hash_table", "set", "speedup");
+
+   for (unsigned op = 0; op < NUM_OPS; op++) {
+      for (unsigned s = 0; s < ARRAY_SIZE(sizes); s++) {
+         unsigned num_keys = sizes[s];
+
+         /* Look keys up in a different order than they were inserted. */
+         for (unsigned i = 0; i < 2 * num_keys; i++)
+            keys[i] = &objects[i];
+         shuffle(keys, 2 * num_keys);
+
+         double ht_time = bench_hash_table(op, keys, num_keys, num_ops);
+         double set_time = bench_set(op, keys, num_keys, num_ops);
+
+         printf("%-14s %8u %12.2f %12.2f %7.2fx\n", op_names[op], num_keys,
+                ht_time, set_time, set_time / ht_time);
+      }
+   }
+
+   free(keys);
+   free(objects);
+
+   return 0;
+}
@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Compares util_queue with dedicated threads and on the shared thread pool
+ * (UTIL_QUEUE_INIT_SHARED_POOL):
+ *
+ *  - contention: several producer threads adding empty jobs to one queue,
+ *    which measures the overhead of adding and dispatching a job;
+ *
+ *  - oversubscription: several queues with one thread per CPU each, like
+ *    the shader compiler and disk cache queues of a driver, all busy with
+ *    jobs doing some work at the same time.
+ *
+ * Usage: queue_bench [num_jobs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c11/threads.h"
+#include "util/os_time.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_queue.h"
+
+#define MAX_PRODUCERS 8
+#define NUM_OVERSUBSCRIBED_QUEUES 4
+
+struct job {
+   struct util_queue_fence fence;
+   unsigned work;
+   unsigned result;
+};
+
+struct producer {
+   struct util_queue *queue;
+   struct job *jobs;
+   unsigned num_jobs;
+   thrd_t thread;
+};
+
+static void
+job_execute(void *data, int thread_index)
+{
+   struct job *job = data;
+   unsigned x = job->work;
+
+   /* Something the compiler can't remove. */
+   for (unsigned i = 0; i < job->work; i++)
+      x = x * 1664525u + 1013904223u;
+
+   job->result = x;
+}
+
+static int
+producer_func(void *data)
+{
+   struct producer *producer = data;
+
+   for (unsigned i = 0; i < producer->num_jobs; i++) {
+      struct job *job = &producer->jobs[i];
+
+      util_queue_add_job(producer->queue, job, &job->fence, job_execute,
+                         NULL);
+   }
+
+   for (unsigned i = 0; i < producer->num_jobs; i++)
+      util_queue_fence_wait(&producer->jobs[i].fence);
+
+   return 0;
+}
+
+/* Run 'num_producers' threads each adding 'num_jobs' jobs to their queue,
+ * and return the time until all jobs completed in nanoseconds.
+ */
+static int64_t
+run_producers(struct util_queue **queues, unsigned num_producers,
+              unsigned num_jobs, unsigned work)
+{
+   struct producer producers[MAX_PRODUCERS];
+
+   for (unsigned i = 0; i < num_producers; i++) {
+      producers[i].queue = queues[i];
+      producers[i].num_jobs = num_jobs;
+      producers[i].jobs = calloc(num_jobs, sizeof(struct job));
+
+      for (unsigned j = 0; j < num_jobs; j++) {
+         util_queue_fence_init(&producers[i].jobs[j].fence);
+         producers[i].jobs[j].work = work;
+      }
+   }
+
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_producers; i++)
+      thrd_create(&producers[i].thread, producer_func, &producers[i]);
+
+   for (unsigned i = 0; i < num_producers; i++)
+      thrd_join(producers[i].thread, NULL);
+
+   int64_t end = os_time_get_nano();
+
+   for (unsigned i = 0; i < num_producers; i++) {
+      for (unsigned j = 0; j < num_jobs; j++)
+         util_queue_fence_destroy(&producers[i].jobs[j].fence);
+      free(producers[i].jobs);
+   }
+
+   return end - start;
+}
+
+static void
+bench_contention(unsigned num_jobs)
+{
+   static const unsigned num_producers[] = { 1, 2, 4, 8 };
+
+   printf("contention: ns per empty job, %u jobs per producer\n", num_jobs);
+   printf("%-10s %12s %12s\n", "producers", "dedicated", "shared");
+
+   for (unsigned i = 0; i < ARRAY_SIZE(num_producers); i++) {
+      unsigned n = num_producers[i];
+      double ns[2];
+
+      for (unsigned shared = 0; shared < 2; shared++) {
+         struct util_queue queue;
+         struct util_queue *queues[MAX_PRODUCERS];
+
+         util_queue_init(&queue, "bench", 256, util_cpu_caps.nr_cpus,
+                         shared ? UTIL_QUEUE_INIT_SHARED_POOL : 0);
+         for (unsigned j = 0; j < n; j++)
+            queues[j] = &queue;
+
+         int64_t time = run_producers(queues, n, num_jobs, 0);
+         ns[shared] = (double) time / (n * num_jobs);
+
+         util_queue_destroy(&queue);
+      }
+
+      printf("%-10u %12.1f %12.1f\n", n, ns[0], ns[1]);
+   }
+}
+
+static void
+bench_oversubscription(unsigned num_jobs)
+{
+   static const unsigned work[] = { 1000, 10000, 100000 };
+
+   printf("\noversubscription: ms for %u queues of %u threads\n",
+          NUM_OVERSUBSCRIBED_QUEUES, util_cpu_caps.nr_cpus);
+   printf("%-10s %-10s %12s %12s\n", "work", "jobs", "dedicated", "shared");
+
+   for (unsigned i = 0; i < ARRAY_SIZE(work); i++) {
+      /* Fewer jobs for the longer ones to keep the run time bounded. */
+      unsigned n = MAX2(num_jobs * 1000 / work[i], 1);
+      double ms[2];
+
+      for (unsigned shared = 0; shared < 2; shared++) {
+         struct util_queue queues[NUM_OVERSUBSCRIBED_QUEUES];
+         struct util_queue *producer_queues[NUM_OVERSUBSCRIBED_QUEUES];
+
+         for (unsigned j = 0; j < NUM_OVERSUBSCRIBED_QUEUES; j++) {
+            util_queue_init(&queues[j], "bench", 256, util_cpu_caps.nr_cpus,
+                            shared ? UTIL_QUEUE_INIT_SHARED_POOL : 0);
+            producer_queues[j] = &queues[j];
+         }
+
+         int64_t time = run_producers(producer_queues,
+                                      NUM_OVERSUBSCRIBED_QUEUES, n, work[i]);
+         ms[shared] = time / 1000000.0;
+
+         for (unsigned j = 0; j < NUM_OVERSUBSCRIBED_QUEUES; j++)
+            util_queue_destroy(&queues[j]);
+      }
+
+      printf("%-10u %-10u %12.2f %12.2f\n", work[i], n, ms[0], ms[1]);
+   }
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned num_jobs = argc > 1 ? atoi(argv[1]) : 100000;
+
+   if (num_jobs == 0)
+      return 1;
+
+   util_cpu_detect();
+
+   bench_contention(num_jobs);
+   bench_oversubscription(num_jobs / 10);
+
+   return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Tests of util_queue on the shared thread pool (UTIL_QUEUE_INIT_SHARED_POOL).
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "util/u_atomic.h"
+#include "util/u_queue.h"
+
+#define POOL_SIZE 4
+#define NUM_JOBS 1000
+
+struct job {
+   struct util_queue_fence fence;
+   unsigned index;
+   int release;
+};
+
+static int counter;
+static int num_running;
+static int max_running;
+static uint64_t busy_thread_indices;
+
+static void
+wait_until(volatile int *value, int expected)
+{
+   while (p_atomic_read(value) != expected)
+      sched_yield();
+}
+
+static void
+init_jobs(struct job *jobs, unsigned num_jobs)
+{
+   for (unsigned i = 0; i < num_jobs; i++) {
+      util_queue_fence_init(&jobs[i].fence);
+      jobs[i].index = i;
+      jobs[i].release = 0;
+   }
+}
+
+static void
+destroy_jobs(struct job *jobs, unsigned num_jobs)
+{
+   for (unsigned i = 0; i < num_jobs; i++)
+      util_queue_fence_destroy(&jobs[i].fence);
+}
+
+static void
+ordered_execute(void *data, int thread_index)
+{
+   struct job *job = data;
+
+   assert(thread_index == 0);
+   assert(p_atomic_read(&counter) == job->index);
+   p_atomic_inc(&counter);
+}
+
+/* A queue with one thread executes its jobs in order. */
+static void
+test_serial(void)
+{
+   struct util_queue queue;
+   struct job *jobs = calloc(NUM_JOBS, sizeof(*jobs));
+
+   assert(util_queue_init(&queue, "serial", 8, 1,
+                          UTIL_QUEUE_INIT_SHARED_POOL));
+   assert(queue.threads == NULL);
+
+   init_jobs(jobs, NUM_JOBS);
+   counter = 0;
+
+   for (unsigned i = 0; i < NUM_JOBS; i++)
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, ordered_execute,
+                         NULL);
+
+   util_queue_finish(&queue);
+   assert(counter == NUM_JOBS);
+
+   for (unsigned i = 0; i < NUM_JOBS; i++)
+      assert(util_queue_fence_is_signalled(&jobs[i].fence));
+
+   destroy_jobs(jobs, NUM_JOBS);
+   util_queue_destroy(&queue);
+   free(jobs);
+}
+
+static void
+concurrent_execute(void *data, int thread_index)
+{
+   uint64_t bit = 1ull << thread_index;
+
+   assert(thread_index >= 0 && thread_index < 3);
+   assert(!(__sync_fetch_and_or(&busy_thread_indices, bit) & bit));
+
+   int running = p_atomic_inc_return(&num_running);
+   int max = p_atomic_read(&max_running);
+   while (running > max) {
+      int old = p_atomic_cmpxchg(&max_running, max, running);
+      if (old == max)
+         break;
+      max = old;
+   }
+
+   for (unsigned i = 0; i < 100; i++)
+      sched_yield();
+
+   p_atomic_dec(&num_running);
+   __sync_fetch_and_and(&busy_thread_indices, ~bit);
+   p_atomic_inc(&counter);
+}
+
+/* At most num_threads jobs of a queue execute at the same time, with
+ * distinct thread indices.
+ */
+static void
+test_concurrency_limit(void)
+{
+   struct util_queue queue;
+   struct job *jobs = calloc(NUM_JOBS, sizeof(*jobs));
+
+   assert(util_queue_init(&queue, "limit", NUM_JOBS, 3,
+                          UTIL_QUEUE_INIT_SHARED_POOL));
+
+   init_jobs(jobs, NUM_JOBS);
+   counter = 0;
+   max_running = 0;
+
+   for (unsigned i = 0; i < NUM_JOBS; i++)
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, concurrent_execute,
+                         NULL);
+
+   util_queue_finish(&queue);
+   assert(counter == NUM_JOBS);
+   assert(max_running >= 1 && max_running <= 3);
+
+   /* Only one job at a time after reducing the number of threads. */
+   util_queue_adjust_num_threads(&queue, 1);
+   counter = 0;
+   max_running = 0;
+
+   for (unsigned i = 0; i < NUM_JOBS; i++)
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, concurrent_execute,
+                         NULL);
+
+   util_queue_finish(&queue);
+   assert(counter == NUM_JOBS);
+   assert(max_running == 1);
+
+   destroy_jobs(jobs, NUM_JOBS);
+   util_queue_destroy(&queue);
+   free(jobs);
+}
+
+static void
+blocking_execute(void *data, int thread_index)
+{
+   struct job *job = data;
+
+   p_atomic_inc(&num_running);
+   while (!p_atomic_read(&job->release))
+      sched_yield();
+   p_atomic_dec(&num_running);
+}
+
+static void
+record_execute(void *data, int thread_index)
+{
+   struct job *job = data;
+
+   job->index = p_atomic_inc_return(&counter);
+}
+
+static void
+never_execute(void *data, int thread_index)
+{
+   assert(!"dropped job executed");
+}
+
+/* Jobs of higher priority queues go first, and dropped jobs don't execute.
+ * Minimum priority queues stay off the pool.
+ */
+static void
+test_priorities(void)
+{
+   struct util_queue blocker, low, normal, high;
+   struct job blockers[POOL_SIZE], jobs[4];
+
+   assert(util_queue_init(&blocker, "blocker", POOL_SIZE, POOL_SIZE,
+                          UTIL_QUEUE_INIT_SHARED_POOL));
+   assert(util_queue_init(&low, "low", 8, 1,
+                          UTIL_QUEUE_INIT_SHARED_POOL |
+                          UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY));
+   assert(!(low.flags & UTIL_QUEUE_INIT_SHARED_POOL));
+   assert(low.threads != NULL);
+   assert(util_queue_init(&normal, "normal", 8, 1,
+                          UTIL_QUEUE_INIT_SHARED_POOL));
+   assert(util_queue_init(&high, "high", 8, 1,
+                          UTIL_QUEUE_INIT_SHARED_POOL |
+                          UTIL_QUEUE_INIT_HIGH_PRIORITY));
+
+   init_jobs(blockers, POOL_SIZE);
+   init_jobs(jobs, 4);
+   counter = 0;
+   num_running = 0;
+
+   /* Occupy all pool threads. */
+   for (unsigned i = 0; i < POOL_SIZE; i++)
+      util_queue_add_job(&blocker, &blockers[i], &blockers[i].fence,
+                         blocking_execute, NULL);
+   wait_until(&num_running, POOL_SIZE);
+
+   /* The minimum priority queue has its own thread, so it makes progress
+    * while the pool is busy.
+    */
+   util_queue_add_job(&low, &jobs[0], &jobs[0].fence, record_execute, NULL);
+   util_queue_fence_wait(&jobs[0].fence);
+   assert(jobs[0].index == 1);
+
+   util_queue_add_job(&normal, &jobs[1], &jobs[1].fence, record_execute, NULL);
+   util_queue_add_job(&normal, &jobs[2], &jobs[2].fence, never_execute, NULL);
+   util_queue_add_job(&high, &jobs[3], &jobs[3].fence, record_execute, NULL);
+
+   util_queue_drop_job(&normal, &jobs[2].fence);
+   assert(util_queue_fence_is_signalled(&jobs[2].fence));
+
+   /* With a single pool thread available, the order is deterministic. */
+   p_atomic_set(&blockers[0].release, 1);
+   util_queue_fence_wait(&jobs[1].fence);
+   util_queue_fence_wait(&jobs[3].fence);
+
+   assert(jobs[3].index == 2);
+   assert(jobs[1].index == 3);
+
+   for (unsigned i = 1; i < POOL_SIZE; i++)
+      p_atomic_set(&blockers[i].release, 1);
+   util_queue_finish(&blocker);
+
+   destroy_jobs(blockers, POOL_SIZE);
+   destroy_jobs(jobs, 4);
+   util_queue_destroy(&high);
+   util_queue_destroy(&normal);
+   util_queue_destroy(&low);
+   util_queue_destroy(&blocker);
+}
+
+int
+main(int argc, char **argv)
+{
+   (void) argc;
+   (void) argv;
+
+   /* Must be set before the pool is started by the first shared queue. */
+   setenv("MESA_THREAD_POOL_SIZE", "4", 1);
+
+   test_serial();
+   test_concurrency_limit();
+   test_priorities();
+
+   return 0;
+}
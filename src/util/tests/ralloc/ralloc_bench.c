@@ -0,0 +1,127 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Compares ralloc_context() and ralloc_arena_context() for the temporary
+ * context of a compiler pass: many small objects hanging off each other,
+ * some strings and growing arrays, and freeing everything at the end.
+ *
+ * Usage: ralloc_bench [number of objects per context]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "ralloc.h"
+#include "os_time.h"
+#include "macros.h"
+
+#define NUM_ROUNDS 20
+
+static uint64_t seed;
+
+static unsigned
+random_uint(unsigned max)
+{
+   seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+   return (seed >> 33) % max;
+}
+
+static void
+build_tree(void *ctx, unsigned num_objects)
+{
+   void **objects = malloc(num_objects * sizeof(void *));
+   unsigned *array = NULL;
+
+   for (unsigned i = 0; i < num_objects; i++) {
+      /* Mostly children of the context or of a recent object. */
+      void *parent = i == 0 || random_uint(4) == 0 ?
+                     ctx : objects[i - 1 - random_uint(MIN2(i, 16))];
+
+      switch (random_uint(8)) {
+      case 0:
+         objects[i] = ralloc_asprintf(parent, "ssa_%u", i);
+         break;
+      case 1:
+         array = reralloc(ctx, array, unsigned, i + 1);
+         array[i] = i;
+         objects[i] = ralloc_size(parent, 32);
+         break;
+      default:
+         objects[i] = ralloc_size(parent, 32 + 16 * random_uint(6));
+         break;
+      }
+   }
+
+   free(objects);
+}
+
+static void
+bench(unsigned num_objects, double *alloc_ns, double *free_ns, bool arena)
+{
+   int64_t alloc_time = 0, free_time = 0;
+
+   seed = 0;
+
+   for (unsigned r = 0; r < NUM_ROUNDS; r++) {
+      int64_t start = os_time_get_nano();
+
+      void *ctx = arena ? ralloc_arena_context(NULL) : ralloc_context(NULL);
+      build_tree(ctx, num_objects);
+
+      int64_t middle = os_time_get_nano();
+
+      ralloc_free(ctx);
+
+      int64_t end = os_time_get_nano();
+
+      alloc_time += middle - start;
+      free_time += end - middle;
+   }
+
+   *alloc_ns = (double) alloc_time / (NUM_ROUNDS * num_objects);
+   *free_ns = (double) free_time / (NUM_ROUNDS * num_objects);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned max_objects = argc > 1 ? atoi(argv[1]) : 1000000;
+
+   if (max_objects == 0)
+      return 1;
+
+   printf("ns per object, allocation / free\n");
+   printf("%-10s %20s %20s\n", "objects", "ralloc_context", "ralloc_arena");
+
+   for (unsigned n = 100; n <= max_objects; n *= 10) {
+      double plain_alloc, plain_free, arena_alloc, arena_free;
+
+      bench(n, &plain_alloc, &plain_free, false);
+      bench(n, &arena_alloc, &arena_free, true);
+
+      printf("%-10u %9.1f / %8.1f %9.1f / %8.1f\n", n,
+             plain_alloc, plain_free, arena_alloc, arena_free);
+   }
+
+   return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Tests of ralloc contexts backed by an arena (ralloc_arena_context()).
+ * Mostly useful with a memory checker, which catches the slabs being freed
+ * too early or leaked.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ralloc.h"
+
+static unsigned num_destroyed;
+
+static void
+destructor(void *ptr)
+{
+   num_destroyed++;
+}
+
+/* Allocations of all sizes keep their contents and alignment. */
+static void
+test_alloc(void)
+{
+   void *ctx = ralloc_arena_context(NULL);
+   uint8_t *blocks[1000];
+
+   for (unsigned i = 0; i < 1000; i++) {
+      /* Some are larger than a slab. */
+      unsigned size = i % 100 == 99 ? 100000 + i : i;
+      void *parent = i % 3 == 0 ? ctx : blocks[i / 2];
+
+      blocks[i] = ralloc_size(parent, size);
+      assert(((uintptr_t) blocks[i]) % sizeof(void *) == 0);
+      assert(ralloc_parent(blocks[i]) == parent);
+      memset(blocks[i], i & 0xff, size);
+   }
+
+   for (unsigned i = 0; i < 1000; i++) {
+      unsigned size = i % 100 == 99 ? 100000 + i : i;
+
+      for (unsigned j = 0; j < size; j++)
+         assert(blocks[i][j] == (i & 0xff));
+   }
+
+   /* Free some of them individually. */
+   for (unsigned i = 500; i < 1000; i += 7)
+      ralloc_free(blocks[i]);
+
+   ralloc_free(ctx);
+}
+
+/* Destructors are called once, whether blocks are freed individually or with
+ * the whole context.
+ */
+static void
+test_destructors(void)
+{
+   void *ctx = ralloc_arena_context(NULL);
+   void *a = ralloc_context(ctx);
+   void *b = ralloc_size(a, 16);
+   void *c = ralloc_size(a, 16);
+
+   ralloc_set_destructor(b, destructor);
+   ralloc_set_destructor(c, destructor);
+   num_destroyed = 0;
+
+   ralloc_free(c);
+   assert(num_destroyed == 1);
+
+   ralloc_free(ctx);
+   assert(num_destroyed == 2);
+
+   /* A destructor that was removed isn't called. */
+   ctx = ralloc_arena_context(NULL);
+   b = ralloc_size(ctx, 16);
+   ralloc_set_destructor(b, destructor);
+   ralloc_set_destructor(b, NULL);
+   num_destroyed = 0;
+
+   ralloc_free(ctx);
+   assert(num_destroyed == 0);
+}
+
+/* Blocks that don't belong to the arena and are stolen into it are freed
+ * with it.
+ */
+static void
+test_foreign_children(void)
+{
+   void *ctx = ralloc_arena_context(NULL);
+   void *block = ralloc_size(ctx, 16);
+   void *foreign = ralloc_context(NULL);
+   void *nested = ralloc_arena_context(block);
+
+   ralloc_set_destructor(ralloc_size(foreign, 16), destructor);
+   ralloc_set_destructor(ralloc_size(nested, 16), destructor);
+   ralloc_steal(block, foreign);
+   assert(ralloc_parent(nested) == block);
+
+   num_destroyed = 0;
+   ralloc_free(ctx);
+   assert(num_destroyed == 2);
+}
+
+/* Blocks stolen out of the arena, individually or with ralloc_adopt(),
+ * survive it.
+ */
+static void
+test_steal_out(void)
+{
+   void *ctx = ralloc_arena_context(NULL);
+   void *other = ralloc_context(NULL);
+   char *str = ralloc_strdup(ctx, "stolen");
+   void *child = ralloc_context(ctx);
+   char *grandchild = ralloc_strdup(child, "adopted");
+
+   ralloc_set_destructor(grandchild, destructor);
+
+   ralloc_steal(other, str);
+   ralloc_adopt(other, ctx);
+   assert(ralloc_parent(child) == other);
+
+   num_destroyed = 0;
+   ralloc_free(ctx);
+   assert(num_destroyed == 0);
+   assert(strcmp(str, "stolen") == 0);
+   assert(strcmp(grandchild, "adopted") == 0);
+
+   /* And can still allocate out of the arena. */
+   char *str2 = ralloc_asprintf(str, "%s again", str);
+   assert(strcmp(str2, "stolen again") == 0);
+
+   ralloc_free(str);
+   ralloc_free(other);
+   assert(num_destroyed == 1);
+
+   /* Stealing it back in doesn't keep the slabs alive anymore. */
+   ctx = ralloc_arena_context(NULL);
+   str = ralloc_strdup(ctx, "back");
+   ralloc_steal(NULL, str);
+   ralloc_steal(ctx, str);
+   ralloc_free(ctx);
+}
+
+/* Resizing keeps the contents, in place or not. */
+static void
+test_resize(void)
+{
+   void *ctx = ralloc_arena_context(NULL);
+   char *a = ralloc_strdup(ctx, "a");
+   char *b = ralloc_strdup(ctx, "b");
+   unsigned *array = NULL;
+
+   for (unsigned i = 0; i < 1000; i++) {
+      ralloc_asprintf_append(&a, "%u,", i);
+      ralloc_strcat(&b, "x");
+   }
+
+   for (unsigned i = 0; i < 10000; i++) {
+      array = reralloc(ctx, array, unsigned, i + 1);
+      array[i] = i;
+   }
+
+   assert(strlen(b) == 1001);
+   assert(strncmp(a, "a0,1,2,", 7) == 0);
+   for (unsigned i = 0; i < 10000; i++)
+      assert(array[i] == i);
+
+   /* Children follow their parent when it moves. */
+   char *child = ralloc_strdup(a, "child");
+   ralloc_strcat(&a, "more");
+   assert(ralloc_parent(child) == a);
+
+   ralloc_free(ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+   (void) argc;
+   (void) argv;
+
+   test_alloc();
+   test_destructors();
+   test_foreign_children();
+   test_steal_out();
+   test_resize();
+
+   return 0;
+}
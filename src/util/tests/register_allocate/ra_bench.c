@@ -0,0 +1,186 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Times building interference graphs and allocating them, for graphs shaped
+ * like the ones of the i965 FS backend: a register set made of 128 base
+ * registers and classes of contiguous runs of them, and nodes that are live
+ * over overlapping ranges of the program.  Allocations that fail go through
+ * a few rounds of spilling, which resets the interference of the spilled
+ * node and adds new nodes for the fills.
+ *
+ * Usage: ra_bench [maximum number of nodes] [average live values]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/register_allocate.h"
+#include "util/ralloc.h"
+#include "util/os_time.h"
+#include "util/macros.h"
+
+#define NUM_BASE_REGS 128
+#define NUM_ROUNDS 5
+#define MAX_SPILLS 8
+
+static const unsigned class_sizes[] = { 1, 2, 4, 8 };
+
+static uint64_t seed;
+
+static unsigned
+random_uint(unsigned max)
+{
+   seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+   return (seed >> 33) % max;
+}
+
+static struct ra_regs *
+create_reg_set(unsigned *classes)
+{
+   unsigned count = 0;
+   for (unsigned i = 0; i < ARRAY_SIZE(class_sizes); i++)
+      count += NUM_BASE_REGS - class_sizes[i] + 1;
+
+   struct ra_regs *regs = ra_alloc_reg_set(NULL, count, true);
+   unsigned reg = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(class_sizes); i++) {
+      classes[i] = ra_alloc_reg_class(regs);
+
+      for (unsigned base = 0; base <= NUM_BASE_REGS - class_sizes[i]; base++) {
+         ra_class_add_reg(regs, classes[i], reg);
+         for (unsigned j = 0; j < class_sizes[i]; j++)
+            ra_add_transitive_reg_conflict(regs, base + j, reg);
+         reg++;
+      }
+   }
+
+   ra_set_finalize(regs, NULL);
+
+   return regs;
+}
+
+static void
+bench(struct ra_regs *regs, const unsigned *classes, unsigned num_nodes,
+      unsigned live, double *build_ms, double *alloc_ms,
+      unsigned *edges, unsigned *spills)
+{
+   unsigned *end = malloc(num_nodes * sizeof(*end));
+   int64_t build_time = 0, alloc_time = 0;
+
+   seed = 0;
+   *edges = 0;
+   *spills = 0;
+
+   for (unsigned r = 0; r < NUM_ROUNDS; r++) {
+      int64_t start = os_time_get_nano();
+
+      struct ra_graph *g = ra_alloc_interference_graph(regs, num_nodes);
+
+      /* Node n is defined by instruction n, and lives until end[n]. */
+      for (unsigned n = 0; n < num_nodes; n++) {
+         unsigned c = random_uint(8);
+         ra_set_node_class(g, n, classes[c < 3 ? 0 : c < 6 ? 1 : c < 7 ? 2 : 3]);
+         ra_set_node_spill_cost(g, n, 1 + random_uint(10));
+         end[n] = n + 1 + random_uint(2 * live);
+      }
+
+      for (unsigned n = 0; n < num_nodes; n++) {
+         for (unsigned m = n + 1; m < num_nodes && m < end[n]; m++) {
+            ra_add_node_interference(g, n, m);
+            (*edges)++;
+         }
+      }
+
+      int64_t middle = os_time_get_nano();
+
+      for (unsigned s = 0; !ra_allocate(g) && s < MAX_SPILLS; s++) {
+         int n = ra_get_best_spill_node(g);
+         if (n < 0)
+            break;
+
+         /* The spilled value now only lives around its definition, and is
+          * filled into a new node further down.
+          */
+         ra_reset_node_interference(g, n);
+         ra_set_node_spill_cost(g, n, -1);
+         for (unsigned m = n + 1; m < num_nodes && m < n + 2; m++)
+            ra_add_node_interference(g, n, m);
+
+         unsigned fill = ra_add_node(g, classes[0]);
+         ra_set_node_spill_cost(g, fill, -1);
+         unsigned use = MIN2(end[n], num_nodes - 1);
+         for (unsigned m = use > live ? use - live : 0; m < use; m++) {
+            if (end[m] > use)
+               ra_add_node_interference(g, fill, m);
+         }
+
+         (*spills)++;
+      }
+
+      int64_t stop = os_time_get_nano();
+
+      ralloc_free(g);
+
+      build_time += middle - start;
+      alloc_time += stop - middle;
+   }
+
+   free(end);
+
+   *build_ms = build_time / (NUM_ROUNDS * 1000000.0);
+   *alloc_ms = alloc_time / (NUM_ROUNDS * 1000000.0);
+   *edges /= NUM_ROUNDS;
+   *spills /= NUM_ROUNDS;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned max_nodes = argc > 1 ? atoi(argv[1]) : 10000;
+   unsigned live = argc > 2 ? atoi(argv[2]) : 35;
+   unsigned classes[ARRAY_SIZE(class_sizes)];
+
+   if (max_nodes == 0 || live == 0)
+      return 1;
+
+   struct ra_regs *regs = create_reg_set(classes);
+
+   printf("ms per graph, %u values live on average\n", live);
+   printf("%-10s %10s %10s %10s %10s\n",
+          "nodes", "edges", "spills", "build", "allocate");
+
+   for (unsigned n = 100; n <= max_nodes; n *= 10) {
+      double build_ms, alloc_ms;
+      unsigned edges, spills;
+
+      bench(regs, classes, n, live, &build_ms, &alloc_ms, &edges, &spills);
+
+      printf("%-10u %10u %10u %10.2f %10.2f\n",
+             n, edges, spills, build_ms, alloc_ms);
+   }
+
+   ralloc_free(regs);
+
+   return 0;
+}
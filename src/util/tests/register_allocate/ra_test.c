@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2019 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* Checks that the allocations of random interference graphs are valid, for
+ * graphs built in one go and for graphs grown and changed while spilling.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "util/register_allocate.h"
+#include "util/ralloc.h"
+#include "util/macros.h"
+
+#define NUM_BASE_REGS 16
+
+static const unsigned class_sizes[] = { 1, 2, 4 };
+
+static uint64_t seed;
+
+static unsigned
+random_uint(unsigned max)
+{
+   seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+   return (seed >> 33) % max;
+}
+
+static struct ra_regs *
+create_reg_set(unsigned *classes, unsigned *class_base)
+{
+   unsigned count = 0;
+   for (unsigned i = 0; i < ARRAY_SIZE(class_sizes); i++)
+      count += NUM_BASE_REGS - class_sizes[i] + 1;
+
+   struct ra_regs *regs = ra_alloc_reg_set(NULL, count, true);
+   unsigned reg = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(class_sizes); i++) {
+      classes[i] = ra_alloc_reg_class(regs);
+      class_base[i] = reg;
+
+      for (unsigned base = 0; base <= NUM_BASE_REGS - class_sizes[i]; base++) {
+         ra_class_add_reg(regs, classes[i], reg);
+         for (unsigned j = 0; j < class_sizes[i]; j++)
+            ra_add_transitive_reg_conflict(regs, base + j, reg);
+         reg++;
+      }
+   }
+
+   ra_set_finalize(regs, NULL);
+
+   return regs;
+}
+
+struct graph {
+   struct ra_graph *g;
+   unsigned count;
+   unsigned size[1000];
+   bool interferes[1000][1000];
+};
+
+static void
+add_node(struct graph *graph, const unsigned *classes)
+{
+   unsigned c = random_uint(ARRAY_SIZE(class_sizes));
+   unsigned n = ra_add_node(graph->g, classes[c]);
+
+   assert(n == graph->count);
+   graph->size[n] = class_sizes[c];
+   ra_set_node_spill_cost(graph->g, n, 1 + random_uint(10));
+
+   for (unsigned m = 0; m < n; m++)
+      graph->interferes[n][m] = graph->interferes[m][n] = false;
+   graph->interferes[n][n] = false;
+
+   graph->count++;
+}
+
+static void
+add_interference(struct graph *graph, unsigned n, unsigned m)
+{
+   ra_add_node_interference(graph->g, n, m);
+   if (n != m)
+      graph->interferes[n][m] = graph->interferes[m][n] = true;
+}
+
+/* Returns the first base register used by node n. */
+static unsigned
+node_base_reg(struct graph *graph, const unsigned *class_base, unsigned n)
+{
+   unsigned reg = ra_get_node_reg(graph->g, n);
+
+   for (int i = ARRAY_SIZE(class_sizes) - 1; i >= 0; i--) {
+      if (reg >= class_base[i]) {
+         assert(graph->size[n] == class_sizes[i]);
+         return reg - class_base[i];
+      }
+   }
+
+   assert(!"unreachable");
+   return 0;
+}
+
+static void
+check_allocation(struct graph *graph, const unsigned *class_base)
+{
+   for (unsigned n = 0; n < graph->count; n++) {
+      unsigned n_base = node_base_reg(graph, class_base, n);
+
+      for (unsigned m = 0; m < n; m++) {
+         if (!graph->interferes[n][m])
+            continue;
+
+         unsigned m_base = node_base_reg(graph, class_base, m);
+         assert(n_base + graph->size[n] <= m_base ||
+                m_base + graph->size[m] <= n_base);
+      }
+   }
+}
+
+static void
+test_allocate(struct ra_regs *regs, const unsigned *classes,
+              const unsigned *class_base)
+{
+   static struct graph graph;
+   unsigned num_allocated = 0;
+
+   for (unsigned i = 0; i < 200; i++) {
+      unsigned num_nodes = 1 + random_uint(300);
+      unsigned live = 1 + random_uint(8);
+
+      /* Start small, so that adding the nodes grows the graph. */
+      graph.g = ra_alloc_interference_graph(regs, 0);
+      graph.count = 0;
+      for (unsigned n = 0; n < num_nodes; n++)
+         add_node(&graph, classes);
+
+      for (unsigned n = 0; n < num_nodes; n++) {
+         unsigned end = n + 1 + random_uint(2 * live);
+         for (unsigned m = n; m < MIN2(end, num_nodes); m++)
+            add_interference(&graph, n, m);
+      }
+
+      /* Spill until it fits: the spilled node only interferes with the next
+       * one, and a new node is added for it.
+       */
+      while (!ra_allocate(graph.g)) {
+         int n = ra_get_best_spill_node(graph.g);
+         assert(n >= 0);
+
+         ra_reset_node_interference(graph.g, n);
+         for (unsigned m = 0; m < graph.count; m++)
+            graph.interferes[n][m] = graph.interferes[m][n] = false;
+         ra_set_node_spill_cost(graph.g, n, -1);
+         if (n + 1 < num_nodes)
+            add_interference(&graph, n, n + 1);
+
+         if (graph.count < ARRAY_SIZE(graph.size)) {
+            unsigned fill = graph.count;
+            add_node(&graph, classes);
+            ra_set_node_spill_cost(graph.g, fill, -1);
+            add_interference(&graph, fill, random_uint(fill));
+         }
+      }
+
+      check_allocation(&graph, class_base);
+      num_allocated += graph.count;
+
+      ralloc_free(graph.g);
+   }
+
+   assert(num_allocated > 0);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned classes[ARRAY_SIZE(class_sizes)];
+   unsigned class_base[ARRAY_SIZE(class_sizes)];
+
+   (void) argc;
+   (void) argv;
+
+   struct ra_regs *regs = create_reg_set(classes, class_base);
+
+   test_allocate(regs, classes, class_base);
+
+   ra_set_allocate_round_robin(regs);
+   test_allocate(regs, classes, class_base);
+
+   ralloc_free(regs);
+
+   return 0;
+}
@@ -28,7 +28,11 @@
 
 #include "c11/threads.h"
 
+#include "util/bitscan.h"
+#include "util/debug.h"
 #include "util/os_time.h"
+#include "util/simple_mtx.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
 #include "u_process.h"
@@ -36,6 +40,8 @@
 static void
 util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
                         bool finish_locked);
+static void
+pool_exit(void);
 
 /****************************************************************************
  * Wait for all queues to assert idle when exit() is called.
@@ -59,6 +65,8 @@ atexit_handler(void)
       util_queue_kill_threads(iter, 0, false);
    }
    mtx_unlock(&exit_mutex);
+
+   pool_exit();
 }
 
 static void
@@ -175,8 +183,8 @@ _util_queue_fence_wait_timeout(struct util_queue_fence *fence,
 
       timespec_get(&ts, TIME_UTC);
 
-      ts.tv_sec += abs_timeout / (1000*1000*1000);
-      ts.tv_nsec += abs_timeout % (1000*1000*1000);
+      ts.tv_sec += rel / (1000*1000*1000);
+      ts.tv_nsec += rel % (1000*1000*1000);
       if (ts.tv_nsec >= (1000*1000*1000)) {
          ts.tv_sec++;
          ts.tv_nsec -= (1000*1000*1000);
@@ -224,10 +232,374 @@ util_queue_fence_destroy(struct util_queue_fence *fence)
 }
 #endif
 
+/****************************************************************************
+ * Process-wide thread pool for UTIL_QUEUE_INIT_SHARED_POOL queues
+ *
+ * Instead of owning threads, a shared queue gets activations scheduled on
+ * the pool. An activation is just a reference to the queue: the pool thread
+ * picking it up executes the oldest job of the queue, and then schedules the
+ * activation again if there are more jobs. A queue never has more than
+ * num_threads activations, which bounds the number of its jobs executing at
+ * the same time.
+ *
+ * Each pool thread has one deque of activations per priority class. New
+ * activations are distributed round-robin among the threads. A thread takes
+ * work from the back of its own deques and, when they are empty, steals from
+ * the front of the other threads' deques. Higher priority classes are always
+ * drained first.
+ *
+ * The pool threads run at normal OS priority, so queues asking for
+ * UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY keep their own SCHED_IDLE threads
+ * instead of competing with the application on the pool.
+ */
+
+#define POOL_MAX_THREADS 64
+
+/* How many jobs of a queue an activation executes in a row before letting
+ * other activations waiting in the pool go first.
+ */
+#define POOL_ACTIVATION_MAX_JOBS 8
+
+enum pool_priority {
+   POOL_PRIORITY_HIGH,
+   POOL_PRIORITY_NORMAL,
+   POOL_NUM_PRIORITIES,
+};
+
+struct pool_deque {
+   simple_mtx_t lock;
+   struct util_queue **entries;
+   unsigned size; /* a power of two */
+   /* The entries are entries[head..tail), with the indices wrapped around
+    * size. They are only changed with the lock held, but atomically, so
+    * that emptiness can be checked without it.
+    */
+   unsigned head, tail;
+};
+
+struct pool_thread {
+   thrd_t thread;
+   struct pool_deque deques[POOL_NUM_PRIORITIES];
+};
+
+static once_flag pool_once_flag = ONCE_FLAG_INIT;
+
+static struct {
+   mtx_t lock;
+   cnd_t work_cond;
+   struct pool_thread *threads;
+   unsigned num_threads;
+   unsigned next_thread;
+   int num_pending; /* activations in the deques */
+   int num_sleeping;
+   bool exiting;
+} pool;
+
+static void
+pool_deque_grow(struct pool_deque *deque)
+{
+   unsigned new_size = deque->size ? deque->size * 2 : 16;
+   struct util_queue **entries =
+      (struct util_queue **) malloc(new_size * sizeof(*entries));
+   unsigned num = deque->tail - deque->head;
+   assert(entries);
+
+   for (unsigned i = 0; i < num; i++)
+      entries[i] = deque->entries[(deque->head + i) & (deque->size - 1)];
+
+   free(deque->entries);
+   deque->entries = entries;
+   deque->size = new_size;
+   p_atomic_set(&deque->head, 0);
+   p_atomic_set(&deque->tail, num);
+}
+
+static void
+pool_deque_push(struct pool_deque *deque, struct util_queue *queue,
+                bool front)
+{
+   simple_mtx_lock(&deque->lock);
+   if (deque->tail - deque->head == deque->size)
+      pool_deque_grow(deque);
+
+   if (front) {
+      deque->entries[(deque->head - 1) & (deque->size - 1)] = queue;
+      p_atomic_set(&deque->head, deque->head - 1);
+   } else {
+      deque->entries[deque->tail & (deque->size - 1)] = queue;
+      p_atomic_set(&deque->tail, deque->tail + 1);
+   }
+   simple_mtx_unlock(&deque->lock);
+}
+
+static struct util_queue *
+pool_deque_pop(struct pool_deque *deque, bool front)
+{
+   struct util_queue *queue = NULL;
+
+   /* Skip the lock for empty deques, which is the common case when looking
+    * for work to steal. Missing a concurrent push is harmless: num_pending
+    * makes the caller look again.
+    */
+   if (p_atomic_read(&deque->tail) == p_atomic_read(&deque->head))
+      return NULL;
+
+   simple_mtx_lock(&deque->lock);
+   if (deque->tail != deque->head) {
+      if (front) {
+         queue = deque->entries[deque->head & (deque->size - 1)];
+         p_atomic_set(&deque->head, deque->head + 1);
+      } else {
+         queue = deque->entries[(deque->tail - 1) & (deque->size - 1)];
+         p_atomic_set(&deque->tail, deque->tail - 1);
+      }
+   }
+   simple_mtx_unlock(&deque->lock);
+
+   return queue;
+}
+
+/**
+ * Schedule an activation of \p queue, on the deque of \p thread_index, or
+ * of the next thread in round-robin order if it's negative.
+ */
+static void
+pool_schedule(struct util_queue *queue, int thread_index, bool front)
+{
+   if (thread_index < 0)
+      thread_index = p_atomic_inc_return(&pool.next_thread) % pool.num_threads;
+
+   pool_deque_push(&pool.threads[thread_index].deques[queue->priority],
+                   queue, front);
+
+   /* Both this and the check of num_pending by sleeping threads must be
+    * read-modify-write operations, so that either we see the sleeper or it
+    * sees the new activation.
+    */
+   p_atomic_inc(&pool.num_pending);
+   if (p_atomic_cmpxchg(&pool.num_sleeping, 0, 0)) {
+      mtx_lock(&pool.lock);
+      cnd_signal(&pool.work_cond);
+      mtx_unlock(&pool.lock);
+   }
+}
+
+static struct util_queue *
+pool_take_activation(unsigned thread_index)
+{
+   for (unsigned p = 0; p < POOL_NUM_PRIORITIES; p++) {
+      struct util_queue *queue =
+         pool_deque_pop(&pool.threads[thread_index].deques[p], false);
+
+      for (unsigned i = 1; !queue && i < pool.num_threads; i++) {
+         unsigned victim = (thread_index + i) % pool.num_threads;
+         queue = pool_deque_pop(&pool.threads[victim].deques[p], true);
+      }
+
+      if (queue) {
+         p_atomic_dec(&pool.num_pending);
+         return queue;
+      }
+   }
+
+   return NULL;
+}
+
+/**
+ * Execute the jobs of \p queue for an activation taken by the pool thread
+ * \p pool_thread_index.
+ */
+static void
+pool_run_activation(struct util_queue *queue, unsigned pool_thread_index)
+{
+   struct util_queue_job job;
+   unsigned num_jobs = 0;
+
+   mtx_lock(&queue->lock);
+
+   while (queue->num_queued && queue->num_active <= queue->num_threads) {
+      job = queue->jobs[queue->read_idx];
+      memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
+      queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
+
+      queue->num_queued--;
+      cnd_signal(&queue->has_space_cond);
+
+      /* Jobs get a thread index below num_threads, unique among the jobs of
+       * the queue executing at the same time, as with dedicated threads.
+       */
+      int thread_index = ffsll(~queue->busy_thread_indices) - 1;
+      assert(thread_index >= 0 && thread_index < queue->max_threads);
+      queue->busy_thread_indices |= BITFIELD64_BIT(thread_index);
+      mtx_unlock(&queue->lock);
+
+      if (job.job) {
+         job.execute(job.job, thread_index);
+         util_queue_fence_signal(job.fence);
+         if (job.cleanup)
+            job.cleanup(job.job, thread_index);
+      }
+
+      mtx_lock(&queue->lock);
+      queue->busy_thread_indices &= ~BITFIELD64_BIT(thread_index);
+
+      /* Keep executing jobs of this queue for a while, or as long as
+       * nothing else is waiting. Then put the activation back at the front
+       * of the deque (where other threads steal from), so that this thread
+       * goes through its other activations first.
+       */
+      if (queue->num_queued && queue->num_active <= queue->num_threads &&
+          ++num_jobs >= POOL_ACTIVATION_MAX_JOBS &&
+          p_atomic_read(&pool.num_pending)) {
+         pool_schedule(queue, pool_thread_index, true);
+         mtx_unlock(&queue->lock);
+         return;
+      }
+   }
+
+   queue->num_active--;
+   if (queue->num_active == 0)
+      cnd_broadcast(&queue->idle_cond);
+   mtx_unlock(&queue->lock);
+}
+
+static int
+pool_thread_func(void *input)
+{
+   unsigned thread_index = (uintptr_t) input;
+   char name[16];
+
+#ifdef HAVE_PTHREAD_SETAFFINITY
+   /* The pool is started by whichever thread first uses a shared queue, so
+    * don't inherit its affinity. See UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY.
+    */
+   cpu_set_t cpuset;
+   CPU_ZERO(&cpuset);
+   for (unsigned i = 0; i < CPU_SETSIZE; i++)
+      CPU_SET(i, &cpuset);
+
+   pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+#endif
+
+   snprintf(name, sizeof(name), "mesa:pool%u", thread_index);
+   u_thread_setname(name);
+
+   while (1) {
+      struct util_queue *queue = pool_take_activation(thread_index);
+
+      if (queue) {
+         pool_run_activation(queue, thread_index);
+         continue;
+      }
+
+      mtx_lock(&pool.lock);
+      p_atomic_inc(&pool.num_sleeping);
+      while (!pool.exiting && !p_atomic_cmpxchg(&pool.num_pending, 0, 0))
+         cnd_wait(&pool.work_cond, &pool.lock);
+      p_atomic_dec(&pool.num_sleeping);
+
+      if (pool.exiting) {
+         mtx_unlock(&pool.lock);
+         break;
+      }
+      mtx_unlock(&pool.lock);
+   }
+
+   return 0;
+}
+
+static void
+pool_init(void)
+{
+   util_cpu_detect();
+
+   unsigned num_threads = env_var_as_unsigned("MESA_THREAD_POOL_SIZE",
+                                              util_cpu_caps.nr_cpus);
+   num_threads = MIN2(num_threads, POOL_MAX_THREADS);
+
+   /* Zero threads disables the pool, shared queues then get their own
+    * threads.
+    */
+   if (num_threads == 0)
+      return;
+
+   (void) mtx_init(&pool.lock, mtx_plain);
+   cnd_init(&pool.work_cond);
+
+   pool.threads = (struct pool_thread *)
+                  calloc(num_threads, sizeof(struct pool_thread));
+   if (!pool.threads)
+      return;
+
+   for (unsigned i = 0; i < num_threads; i++) {
+      for (unsigned p = 0; p < POOL_NUM_PRIORITIES; p++)
+         simple_mtx_init(&pool.threads[i].deques[p].lock, mtx_plain);
+   }
+
+   /* num_threads must be set before the threads start looking for work to
+    * steal.
+    */
+   pool.num_threads = num_threads;
+   for (unsigned i = 0; i < num_threads; i++) {
+      pool.threads[i].thread =
+         u_thread_create(pool_thread_func, (void *)(uintptr_t) i);
+
+      if (!pool.threads[i].thread) {
+         /* The existing threads can take over the deques of the missing
+          * ones, but with no threads at all, give up.
+          */
+         if (i == 0)
+            pool.num_threads = 0;
+         break;
+      }
+   }
+}
+
+/**
+ * Return whether the pool is available, starting it if needed.
+ */
+static bool
+pool_get(void)
+{
+   call_once(&pool_once_flag, pool_init);
+   return pool.num_threads > 0;
+}
+
+static void
+pool_exit(void)
+{
+   if (!pool.num_threads)
+      return;
+
+   mtx_lock(&pool.lock);
+   pool.exiting = true;
+   cnd_broadcast(&pool.work_cond);
+   mtx_unlock(&pool.lock);
+
+   for (unsigned i = 0; i < pool.num_threads; i++) {
+      if (pool.threads[i].thread)
+         thrd_join(pool.threads[i].thread, NULL);
+   }
+}
+
 /****************************************************************************
  * util_queue implementation
  */
 
+static void
+util_queue_signal_remaining_jobs(struct util_queue *queue)
+{
+   for (unsigned i = queue->read_idx; i != queue->write_idx;
+        i = (i + 1) % queue->max_jobs) {
+      if (queue->jobs[i].job) {
+         util_queue_fence_signal(queue->jobs[i].fence);
+         queue->jobs[i].job = NULL;
+      }
+   }
+   queue->read_idx = queue->write_idx;
+   queue->num_queued = 0;
+}
+
 struct thread_input {
    struct util_queue *queue;
    int thread_index;
@@ -295,17 +667,8 @@ util_queue_thread_func(void *input)
 
    /* signal remaining jobs if all threads are being terminated */
    mtx_lock(&queue->lock);
-   if (queue->num_threads == 0) {
-      for (unsigned i = queue->read_idx; i != queue->write_idx;
-           i = (i + 1) % queue->max_jobs) {
-         if (queue->jobs[i].job) {
-            util_queue_fence_signal(queue->jobs[i].fence);
-            queue->jobs[i].job = NULL;
-         }
-      }
-      queue->read_idx = queue->write_idx;
-      queue->num_queued = 0;
-   }
+   if (queue->num_threads == 0)
+      util_queue_signal_remaining_jobs(queue);
    mtx_unlock(&queue->lock);
    return 0;
 }
@@ -350,6 +713,21 @@ util_queue_adjust_num_threads(struct util_queue *queue, unsigned num_threads)
    mtx_lock(&queue->finish_lock);
    unsigned old_num_threads = queue->num_threads;
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      /* Surplus activations stop after their current job, and missing ones
+       * are scheduled for the jobs already queued.
+       */
+      mtx_lock(&queue->lock);
+      queue->num_threads = num_threads;
+      while (queue->num_active < MIN2(num_threads, queue->num_queued)) {
+         queue->num_active++;
+         pool_schedule(queue, -1, false);
+      }
+      mtx_unlock(&queue->lock);
+      mtx_unlock(&queue->finish_lock);
+      return;
+   }
+
    if (num_threads == old_num_threads) {
       mtx_unlock(&queue->finish_lock);
       return;
@@ -411,6 +789,24 @@ util_queue_init(struct util_queue *queue,
       snprintf(queue->name, sizeof(queue->name), "%s", name);
    }
 
+   /* Fall back to dedicated threads if the pool can't be used, or if the
+    * jobs should only get idle CPU time, which the pool threads don't
+    * provide.
+    */
+   if ((flags & UTIL_QUEUE_INIT_SHARED_POOL) &&
+       ((flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY) || !pool_get()))
+      flags &= ~UTIL_QUEUE_INIT_SHARED_POOL;
+
+   if (flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      /* busy_thread_indices has one bit per thread index. */
+      num_threads = MIN2(num_threads, 64);
+
+      if (flags & UTIL_QUEUE_INIT_HIGH_PRIORITY)
+         queue->priority = POOL_PRIORITY_HIGH;
+      else
+         queue->priority = POOL_PRIORITY_NORMAL;
+   }
+
    queue->flags = flags;
    queue->max_threads = num_threads;
    queue->num_threads = num_threads;
@@ -427,6 +823,12 @@ util_queue_init(struct util_queue *queue,
    queue->num_queued = 0;
    cnd_init(&queue->has_queued_cond);
    cnd_init(&queue->has_space_cond);
+   cnd_init(&queue->idle_cond);
+
+   if (flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      add_to_atexit_list(queue);
+      return true;
+   }
 
    queue->threads = (thrd_t*) calloc(num_threads, sizeof(thrd_t));
    if (!queue->threads)
@@ -453,6 +855,7 @@ fail:
    free(queue->threads);
 
    if (queue->jobs) {
+      cnd_destroy(&queue->idle_cond);
       cnd_destroy(&queue->has_space_cond);
       cnd_destroy(&queue->has_queued_cond);
       mtx_destroy(&queue->lock);
@@ -478,6 +881,24 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
       return;
    }
 
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      /* Drop the queued jobs like terminating threads do, and wait for the
+       * pool to finish executing the others.
+       */
+      mtx_lock(&queue->lock);
+      queue->num_threads = keep_num_threads;
+      if (keep_num_threads == 0) {
+         util_queue_signal_remaining_jobs(queue);
+         while (queue->num_active)
+            cnd_wait(&queue->idle_cond, &queue->lock);
+      }
+      mtx_unlock(&queue->lock);
+
+      if (!finish_locked)
+         mtx_unlock(&queue->finish_lock);
+      return;
+   }
+
    mtx_lock(&queue->lock);
    unsigned old_num_threads = queue->num_threads;
    /* Setting num_threads is what causes the threads to terminate.
@@ -500,6 +921,7 @@ util_queue_destroy(struct util_queue *queue)
    util_queue_kill_threads(queue, 0, false);
    remove_from_atexit_list(queue);
 
+   cnd_destroy(&queue->idle_cond);
    cnd_destroy(&queue->has_space_cond);
    cnd_destroy(&queue->has_queued_cond);
    mtx_destroy(&queue->finish_lock);
@@ -573,7 +995,15 @@ util_queue_add_job(struct util_queue *queue,
    queue->write_idx = (queue->write_idx + 1) % queue->max_jobs;
 
    queue->num_queued++;
-   cnd_signal(&queue->has_queued_cond);
+
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      if (queue->num_active < queue->num_threads) {
+         queue->num_active++;
+         pool_schedule(queue, -1, false);
+      }
+   } else {
+      cnd_signal(&queue->has_queued_cond);
+   }
    mtx_unlock(&queue->lock);
 }
 
@@ -644,6 +1074,18 @@ util_queue_finish(struct util_queue *queue)
       return;
    }
 
+   /* Pool threads can't be blocked on a barrier, but the queue going idle
+    * means that all jobs have completed.
+    */
+   if (queue->flags & UTIL_QUEUE_INIT_SHARED_POOL) {
+      mtx_lock(&queue->lock);
+      while (queue->num_active)
+         cnd_wait(&queue->idle_cond, &queue->lock);
+      mtx_unlock(&queue->lock);
+      mtx_unlock(&queue->finish_lock);
+      return;
+   }
+
    fences = malloc(queue->num_threads * sizeof(*fences));
    util_barrier_init(&barrier, queue->num_threads);
 
@@ -667,7 +1109,7 @@ int64_t
 util_queue_get_thread_time_nano(struct util_queue *queue, unsigned thread_index)
 {
    /* Allow some flexibility by not raising an error. */
-   if (thread_index >= queue->num_threads)
+   if (thread_index >= queue->num_threads || !queue->threads)
       return 0;
 
    return u_thread_get_time_nano(queue->threads[thread_index]);
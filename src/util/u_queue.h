@@ -49,6 +49,20 @@ extern "C" {
 #define UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY      (1 << 0)
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
+/* Execute the jobs on the process-wide thread pool instead of threads owned
+ * by the queue. num_threads is then the maximum number of jobs of the queue
+ * executing at the same time. With one thread, jobs are still executed one
+ * at a time in the order they were added.
+ *
+ * The pool threads are shared by all such queues, so jobs shouldn't block
+ * waiting for other jobs, and queue->threads is NULL.
+ *
+ * Ignored together with UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY: the pool runs
+ * at normal OS priority, so such queues keep their own idle priority threads.
+ */
+#define UTIL_QUEUE_INIT_SHARED_POOL               (1 << 3)
+/* For shared pool queues: run the jobs before those of other queues. */
+#define UTIL_QUEUE_INIT_HIGH_PRIORITY             (1 << 4)
 
 #if defined(__GNUC__) && defined(HAVE_LINUX_FUTEX_H)
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -214,6 +228,12 @@ struct util_queue {
    int write_idx, read_idx; /* ring buffer pointers */
    struct util_queue_job *jobs;
 
+   /* for UTIL_QUEUE_INIT_SHARED_POOL, protected by lock */
+   unsigned priority;
+   unsigned num_active; /* activations scheduled or running in the pool */
+   uint64_t busy_thread_indices;
+   cnd_t idle_cond;
+
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
 };
@@ -250,7 +270,7 @@ int64_t util_queue_get_thread_time_nano(struct util_queue *queue,
 static inline bool
 util_queue_is_initialized(struct util_queue *queue)
 {
-   return queue->threads != NULL;
+   return queue->jobs != NULL;
 }
 
 /* Convenient structure for monitoring the queue externally and passing
@@ -29,6 +29,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "c11/threads.h"
 #include "detect_os.h"
@@ -107,6 +108,61 @@ util_pin_thread_to_L3(thrd_t thread, unsigned L3_index, unsigned cores_per_L3)
 #endif
 }
 
+/**
+ * Restrict the calling thread to the CPUs set in the given bitmask.
+ *
+ * \param mask           bitmask of CPUs, 32 CPUs per element
+ * \param num_mask_bits  number of valid bits in mask
+ * \return true on success, false if not supported or the call failed
+ */
+static inline bool
+util_set_current_thread_affinity(const uint32_t *mask, unsigned num_mask_bits)
+{
+#if defined(HAVE_PTHREAD_SETAFFINITY)
+   cpu_set_t cpuset;
+
+   CPU_ZERO(&cpuset);
+   for (unsigned i = 0; i < num_mask_bits && i < CPU_SETSIZE; i++) {
+      if (mask[i / 32] & (1u << (i % 32)))
+         CPU_SET(i, &cpuset);
+   }
+   return pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) == 0;
+#else
+   (void)mask;
+   (void)num_mask_bits;
+   return false;
+#endif
+}
+
+/**
+ * Get the set of CPUs the calling thread may run on.
+ *
+ * \param mask           bitmask of CPUs, 32 CPUs per element
+ * \param num_mask_bits  number of bits in mask
+ * \return true on success, false if not supported or the call failed
+ */
+static inline bool
+util_get_current_thread_affinity(uint32_t *mask, unsigned num_mask_bits)
+{
+#if defined(HAVE_PTHREAD_SETAFFINITY)
+   cpu_set_t cpuset;
+
+   if (pthread_getaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0)
+      return false;
+
+   memset(mask, 0, (num_mask_bits + 31) / 32 * sizeof(uint32_t));
+   for (unsigned i = 0; i < num_mask_bits && i < CPU_SETSIZE; i++) {
+      if (CPU_ISSET(i, &cpuset))
+         mask[i / 32] |= 1u << (i % 32);
+   }
+   return true;
+#else
+   (void)mask;
+   (void)num_mask_bits;
+   return false;
+#endif
+}
+
 /**
  * Return the index of L3 that the thread is pinned to. If the thread is
  * pinned to multiple L3 caches, return -1.